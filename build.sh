@@ -20,15 +20,22 @@ build_gsr_kms_server() {
 }
 
 build_gsr() {
-    dependencies="libavcodec libavformat libavutil x11 xcomposite xrandr libpulse libswresample libavfilter libva libcap libdrm wayland-egl wayland-client"
+    dependencies="libavcodec libavformat libavutil x11 xcomposite xrandr xext xfixes xdamage libpulse libswresample libavfilter libva libcap libdrm wayland-egl wayland-client dbus-1 gbm"
     includes="$(pkg-config --cflags $dependencies)"
     libs="$(pkg-config --libs $dependencies) -ldl -pthread -lm"
+    # libpipewire is loaded at runtime, only the headers are needed
+    pipewire_includes="$(pkg-config --cflags libpipewire-0.3)"
     $CC -c src/capture/capture.c $opts $includes
     $CC -c src/capture/nvfbc.c $opts $includes
     $CC -c src/capture/xcomposite_cuda.c $opts $includes
     $CC -c src/capture/xcomposite_vaapi.c $opts $includes
     $CC -c src/capture/kms_vaapi.c $opts $includes
     $CC -c src/capture/kms_cuda.c $opts $includes
+    $CC -c src/capture/portal.c $opts $includes $pipewire_includes
+    $CC -c src/capture/screencopy.c $opts $includes
+    $CC -c src/capture/xshm.c $opts $includes
+    $CC -c external/wlr-screencopy-unstable-v1-protocol.c $opts $includes
+    $CC -c external/linux-dmabuf-unstable-v1-protocol.c $opts $includes
     $CC -c kms/client/kms_client.c $opts $includes
     $CC -c src/egl.c $opts $includes
     $CC -c src/cuda.c $opts $includes
@@ -37,12 +44,24 @@ build_gsr() {
     $CC -c src/window_texture.c $opts $includes
     $CC -c src/shader.c $opts $includes
     $CC -c src/color_conversion.c $opts $includes
+    $CC -c src/cpu_color_conversion.c $opts $includes
+    $CC -c src/vulkan.c $opts $includes
+    $CC -c src/vulkan_color_conversion.c $opts $includes
     $CC -c src/utils.c $opts $includes
+    $CC -c src/control_socket.c $opts $includes
+    $CC -c src/file_writer.c $opts $includes
+    $CC -c src/pipe_writer.c $opts $includes
+    $CC -c src/network_output.c $opts $includes
+    $CC -c src/adaptive_bitrate.c $opts $includes
+    $CC -c src/frame_queue.c $opts $includes
     $CC -c src/library_loader.c $opts $includes
+    $CC -c src/pipewire_library.c $opts $includes $pipewire_includes
+    $CC -c src/dbus.c $opts $includes
     $CXX -c src/sound.cpp $opts $includes
+    $CXX -c src/sound_pipewire.cpp $opts $includes $pipewire_includes
     $CXX -c src/main.cpp $opts $includes
     $CXX -o gpu-screen-recorder capture.o nvfbc.o kms_client.o egl.o cuda.o xnvctrl.o overclock.o window_texture.o shader.o \
-        color_conversion.o utils.o library_loader.o xcomposite_cuda.o xcomposite_vaapi.o kms_vaapi.o kms_cuda.o sound.o main.o $libs $opts
+        color_conversion.o cpu_color_conversion.o vulkan.o vulkan_color_conversion.o utils.o control_socket.o file_writer.o pipe_writer.o network_output.o adaptive_bitrate.o frame_queue.o library_loader.o pipewire_library.o dbus.o xcomposite_cuda.o xcomposite_vaapi.o kms_vaapi.o kms_cuda.o portal.o screencopy.o xshm.o wlr-screencopy-unstable-v1-protocol.o linux-dmabuf-unstable-v1-protocol.o sound.o sound_pipewire.o main.o $libs $opts
 }
 
 build_gsr_kms_server
@@ -0,0 +1,36 @@
+#ifndef GSR_ADAPTIVE_BITRATE_H
+#define GSR_ADAPTIVE_BITRATE_H
+
+#include "network_output.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Adjusts the video bitrate and framerate of a live stream to what the connection can handle, based on the network output queue.
+    The bitrate is lowered quickly when the queue starts to grow and raised slowly once it has been empty for a while.
+    The framerate is only lowered when the bitrate can't be lowered any more.
+*/
+
+typedef struct {
+    int64_t min_bitrate;
+    int64_t max_bitrate;
+    int64_t bitrate;         /* In bits per second */
+    int fps_divider;         /* Only every fps_divider frame is encoded */
+    int max_fps_divider;
+
+    uint64_t prev_num_dropped_packets;
+    double last_update_time;
+    double last_decrease_time;
+    double last_increase_time;
+    double stable_start_time; /* When the queue was last congested */
+} gsr_adaptive_bitrate;
+
+/*
+    |min_bitrate| should be the same as |max_bitrate| if the encoder doesn't support changing bitrate while encoding, then only the framerate is changed.
+    The framerate is never lowered below 15 fps (or |fps| if it's already lower than that).
+*/
+void gsr_adaptive_bitrate_init(gsr_adaptive_bitrate *self, int64_t min_bitrate, int64_t max_bitrate, int fps, double time_now);
+/* Call this regularly, it only does something twice per second. Returns true if the bitrate or fps divider changed */
+bool gsr_adaptive_bitrate_update(gsr_adaptive_bitrate *self, const gsr_network_output_stats *stats, double max_queue_latency_seconds, double time_now);
+
+#endif /* GSR_ADAPTIVE_BITRATE_H */
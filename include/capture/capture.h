@@ -1,6 +1,7 @@
 #ifndef GSR_CAPTURE_CAPTURE_H
 #define GSR_CAPTURE_CAPTURE_H
 
+#include "../vec2.h"
 #include <stdbool.h>
 
 typedef struct AVCodecContext AVCodecContext;
@@ -15,6 +16,7 @@ struct gsr_capture {
     bool (*should_stop)(gsr_capture *cap, bool *err); /* can be NULL */
     int (*capture)(gsr_capture *cap, AVFrame *frame);
     void (*capture_end)(gsr_capture *cap, AVFrame *frame); /* can be NULL */
+    bool (*get_cursor_position)(gsr_capture *cap, vec2i *position); /* can be NULL */
     void (*destroy)(gsr_capture *cap, AVCodecContext *video_codec_context);
 
     void *priv; /* can be NULL */
@@ -26,6 +28,8 @@ void gsr_capture_tick(gsr_capture *cap, AVCodecContext *video_codec_context, AVF
 bool gsr_capture_should_stop(gsr_capture *cap, bool *err);
 int gsr_capture_capture(gsr_capture *cap, AVFrame *frame);
 void gsr_capture_end(gsr_capture *cap, AVFrame *frame);
+/* Position of the cursor in the captured frame, as of the last capture. Returns false if the cursor is not visible in the frame or if the capture method doesn't support it */
+bool gsr_capture_get_cursor_position(gsr_capture *cap, vec2i *position);
 /* Calls |gsr_capture_stop| as well */
 void gsr_capture_destroy(gsr_capture *cap, AVCodecContext *video_codec_context);
 
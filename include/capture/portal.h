@@ -0,0 +1,22 @@
+#ifndef GSR_CAPTURE_PORTAL_H
+#define GSR_CAPTURE_PORTAL_H
+
+#include "../color_conversion.h"
+#include "capture.h"
+
+typedef struct {
+    gsr_egl *egl;
+    /*
+        The pipewire node (id or name) to capture directly from the local pipewire instance, for example a video test source.
+        If this is NULL then the desktop portal (org.freedesktop.portal.ScreenCast) is used to ask the user what to capture.
+        A copy is made of this.
+    */
+    const char *pipewire_target;
+    int fps;
+    bool hdr;
+    gsr_color_range color_range;
+} gsr_capture_portal_params;
+
+gsr_capture* gsr_capture_portal_create(const gsr_capture_portal_params *params);
+
+#endif /* GSR_CAPTURE_PORTAL_H */
@@ -0,0 +1,18 @@
+#ifndef GSR_CAPTURE_SCREENCOPY_H
+#define GSR_CAPTURE_SCREENCOPY_H
+
+#include "../color_conversion.h"
+#include "capture.h"
+
+typedef struct {
+    gsr_egl *egl;
+    const char *display_to_capture; /* if this is "screen", then the first monitor is captured. A copy is made of this */
+    bool hdr;
+    gsr_color_range color_range;
+    bool software_encoding; /* If true then the frames are NV12 frames in memory (for libx264) instead of vaapi frames, and no GPU is used. Only shm buffers are used then */
+} gsr_capture_screencopy_params;
+
+/* Captures a wayland output with wlr-screencopy (supported by wlroots based compositors). Requires a pure wayland session (egl->wayland). With |software_encoding| the egl context isn't needed, only egl->wayland */
+gsr_capture* gsr_capture_screencopy_create(const gsr_capture_screencopy_params *params);
+
+#endif /* GSR_CAPTURE_SCREENCOPY_H */
@@ -0,0 +1,23 @@
+#ifndef GSR_CAPTURE_XSHM_H
+#define GSR_CAPTURE_XSHM_H
+
+#include "../color_conversion.h"
+#include "capture.h"
+
+typedef struct {
+    gsr_egl *egl;
+    vec2i pos;  /* Position of the captured area on the x11 screen */
+    vec2i size; /* If this is 0, 0 then the whole x11 screen is captured */
+    bool hdr;
+    gsr_color_range color_range;
+    bool software_encoding; /* If true then the frames are NV12 frames in memory (for libx264) instead of vaapi frames, and no GPU is used */
+} gsr_capture_xshm_params;
+
+/*
+    Captures the x11 screen (or a part of it) with MIT-SHM, only copying the parts of the screen that have been damaged (XDamage).
+    The color conversion is done on the cpu and the frame is uploaded to vaapi (or given to a software encoder), so this works with any x11 server, including Xvfb.
+    Only egl->x11.dpy is used, egl doesn't have to be loaded when using software encoding
+*/
+gsr_capture* gsr_capture_xshm_create(const gsr_capture_xshm_params *params);
+
+#endif /* GSR_CAPTURE_XSHM_H */
@@ -19,11 +19,25 @@ typedef enum {
     GSR_DESTINATION_COLOR_P010  /* YUV420, BT2020, 10-bit */
 } gsr_destination_color;
 
+#define GSR_COLOR_CONVERSION_MAX_LAYERS 8
+
 typedef struct {
     int offset;
     int rotation;
 } gsr_color_uniforms;
 
+/* The per layer uniforms are arrays, one element for each layer in a batch */
+typedef struct {
+    int num_layers;
+    int chroma_origin;
+    int destination_pos[GSR_COLOR_CONVERSION_MAX_LAYERS];
+    int destination_size[GSR_COLOR_CONVERSION_MAX_LAYERS];
+    int texture_pos[GSR_COLOR_CONVERSION_MAX_LAYERS];
+    int texture_size[GSR_COLOR_CONVERSION_MAX_LAYERS];
+    int rotation[GSR_COLOR_CONVERSION_MAX_LAYERS];
+    int swap_texture_size[GSR_COLOR_CONVERSION_MAX_LAYERS];
+} gsr_color_compute_uniforms;
+
 typedef struct {
     gsr_egl *egl;
 
@@ -45,11 +59,39 @@ typedef struct {
 
     unsigned int vertex_array_object_id;
     unsigned int vertex_buffer_object_id;
+
+    /*
+        Single pass conversion to NV12/P010 that writes both planes at once, with one dispatch for each batch of layers.
+        Only used if the compute shader is supported (OpenGL 4.3).
+    */
+    bool use_compute_shader;
+    gsr_shader compute_shader;
+    gsr_color_compute_uniforms compute_uniforms;
+
+    vec2i destination_texture_size;
 } gsr_color_conversion;
 
 int gsr_color_conversion_init(gsr_color_conversion *self, const gsr_color_conversion_params *params);
 void gsr_color_conversion_deinit(gsr_color_conversion *self);
 
+/* A texture to draw to the destination, for example a monitor, the cursor or an overlay */
+typedef struct {
+    unsigned int texture_id;
+    vec2i source_pos;   /* Position in the destination texture, in pixels */
+    vec2i source_size;  /* Size in the destination texture, in pixels */
+    vec2i texture_pos;  /* Region of |texture_id| to draw, in pixels */
+    vec2i texture_size; /* A negative height draws the region upside down, |texture_pos| is the bottom of the region then */
+    vec2i texture_full_size; /* Size of the whole |texture_id|. If this is 0, 0 then the region ends at the edge of the texture (texture_pos + texture_size) */
+    float rotation;     /* In radians */
+    bool external_texture;
+} gsr_color_conversion_layer;
+
+/*
+    Draws the layers in order (later layers are blended on top of earlier layers).
+    All layers are uploaded at once and drawn to one destination plane at a time, so drawing more layers only adds a draw call per layer and plane.
+*/
+void gsr_color_conversion_draw_layers(gsr_color_conversion *self, const gsr_color_conversion_layer *layers, int num_layers);
+/* Same as |gsr_color_conversion_draw_layers| with one layer */
 void gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation, bool external_texture);
 void gsr_color_conversion_clear(gsr_color_conversion *self);
 
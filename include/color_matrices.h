@@ -0,0 +1,65 @@
+#ifndef GSR_COLOR_MATRICES_H
+#define GSR_COLOR_MATRICES_H
+
+#include "color_conversion.h"
+#include <stddef.h>
+
+/*
+    RGB to YUV matrices used by every color conversion (opengl, compute shader and cpu), so that they all give the same colors.
+    Index 0 is y, 1 is u and 2 is v. The values are for rgb in the range [0, 1].
+    https://en.wikipedia.org/wiki/YCbCr, see study/color_space_transform_matrix.png and study/create_matrix.py
+*/
+typedef struct {
+    double r[3];
+    double g[3];
+    double b[3];
+    double offset[3];
+} gsr_color_matrix;
+
+/* ITU-R BT709, full */
+/* https://www.itu.int/dms_pubrec/itu-r/rec/bt/R-REC-BT.709-6-201506-I!!PDF-E.pdf */
+static const gsr_color_matrix GSR_RGB_TO_NV12_FULL = {
+    { 0.212600, -0.114572,  0.500000 },
+    { 0.715200, -0.385428, -0.454153 },
+    { 0.072200,  0.500000, -0.045847 },
+    { 0.000000,  0.500000,  0.500000 }
+};
+
+/* ITU-R BT709, limited (full multiplied by (235-16)/255, adding 16/255 to luma) */
+static const gsr_color_matrix GSR_RGB_TO_NV12_LIMITED = {
+    { 0.182586, -0.098397,  0.429412 },
+    { 0.614231, -0.331015, -0.390037 },
+    { 0.062007,  0.429412, -0.039375 },
+    { 0.062745,  0.500000,  0.500000 }
+};
+
+/* ITU-R BT2020, full */
+/* https://www.itu.int/dms_pubrec/itu-r/rec/bt/R-REC-BT.2020-2-201510-I!!PDF-E.pdf */
+static const gsr_color_matrix GSR_RGB_TO_P010_FULL = {
+    { 0.262700, -0.139630,  0.500000 },
+    { 0.678000, -0.360370, -0.459786 },
+    { 0.059300,  0.500000, -0.040214 },
+    { 0.000000,  0.500000,  0.500000 }
+};
+
+/* ITU-R BT2020, limited (full multiplied by (235-16)/255, adding 16/255 to luma) */
+static const gsr_color_matrix GSR_RGB_TO_P010_LIMITED = {
+    { 0.225613, -0.119918,  0.429412 },
+    { 0.582282, -0.309494, -0.394875 },
+    { 0.050928,  0.429412, -0.034537 },
+    { 0.062745,  0.500000,  0.500000 }
+};
+
+/* Returns NULL if |destination_color| is not a yuv format */
+static inline const gsr_color_matrix* gsr_color_matrix_get(gsr_destination_color destination_color, gsr_color_range color_range) {
+    switch(destination_color) {
+        case GSR_DESTINATION_COLOR_NV12:
+            return color_range == GSR_COLOR_RANGE_FULL ? &GSR_RGB_TO_NV12_FULL : &GSR_RGB_TO_NV12_LIMITED;
+        case GSR_DESTINATION_COLOR_P010:
+            return color_range == GSR_COLOR_RANGE_FULL ? &GSR_RGB_TO_P010_FULL : &GSR_RGB_TO_P010_LIMITED;
+        default:
+            return NULL;
+    }
+}
+
+#endif /* GSR_COLOR_MATRICES_H */
@@ -0,0 +1,105 @@
+#ifndef GSR_CONTROL_SOCKET_H
+#define GSR_CONTROL_SOCKET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/*
+    Runtime control of a running gpu screen recorder over a unix domain socket (SOCK_SEQPACKET).
+    Each message is one gsr_control_request/gsr_control_response. Responses have the same |id| as the request they respond to
+    and can arrive in a different order than the requests were sent, for example a save replay response is sent when the replay has been saved.
+*/
+
+#define GSR_CONTROL_PROTOCOL_VERSION 4
+#define GSR_CONTROL_MAX_CLIENTS 16
+#define GSR_CONTROL_MAX_QUEUED_COMMANDS 32
+
+typedef enum {
+    GSR_CONTROL_REQUEST_SAVE_REPLAY,    /* |value| is the number of seconds to save, 0 to save the whole replay buffer. |offset| is the number of seconds to skip at the end of the replay buffer */
+    GSR_CONTROL_REQUEST_PAUSE,
+    GSR_CONTROL_REQUEST_RESUME,
+    GSR_CONTROL_REQUEST_GET_STATS,
+    GSR_CONTROL_REQUEST_FORCE_KEYFRAME,
+    GSR_CONTROL_REQUEST_SET_BITRATE,    /* |value| is the bitrate in kbps */
+    GSR_CONTROL_REQUEST_SET_FPS         /* |value| is the framerate */
+} gsr_control_request_type;
+
+typedef enum {
+    GSR_CONTROL_RESULT_OK,
+    GSR_CONTROL_RESULT_INVALID_REQUEST,
+    GSR_CONTROL_RESULT_NOT_SUPPORTED,
+    GSR_CONTROL_RESULT_BUSY,
+    GSR_CONTROL_RESULT_FAILED
+} gsr_control_result;
+
+typedef struct {
+    uint32_t version; /* GSR_CONTROL_PROTOCOL_VERSION */
+    uint32_t id;      /* Chosen by the client */
+    int type;         /* gsr_control_request_type */
+    int64_t value;
+    int64_t offset;
+} gsr_control_request;
+
+typedef struct {
+    double recording_duration_seconds;     /* Excluding the time spent paused */
+    double replay_buffer_duration_seconds; /* 0 if not in replay mode */
+    uint64_t replay_buffer_size_bytes;     /* 0 if not in replay mode */
+    uint64_t num_video_frames;
+    uint32_t fps;                          /* Number of frames captured during the last second */
+    double capture_to_packet_latency_seconds; /* Average time from the start of capturing a video frame until it has been encoded, over the last second */
+    double packet_to_socket_latency_seconds;  /* Average time from a video packet being encoded until it has been written to the socket, over the last second. 0 if not live streaming */
+    double capture_to_socket_latency_seconds; /* Average time from the start of capturing a video frame until its packet has been written to the socket, over the last second. 0 if not live streaming */
+    bool paused;
+    bool saving_replay;
+} gsr_control_stats;
+
+typedef struct {
+    uint32_t version; /* GSR_CONTROL_PROTOCOL_VERSION */
+    uint32_t id;      /* The id of the request */
+    int type;         /* gsr_control_request_type of the request */
+    int result;       /* gsr_control_result */
+    char message[4096]; /* Error message, or the filepath of the saved replay for GSR_CONTROL_REQUEST_SAVE_REPLAY */
+    gsr_control_stats stats; /* Only set for GSR_CONTROL_REQUEST_GET_STATS */
+} gsr_control_response;
+
+typedef struct {
+    int client_index;
+    uint32_t client_generation;
+    gsr_control_request request;
+} gsr_control_command;
+
+typedef struct {
+    int fd; /* -1 if unused */
+    uint32_t generation;
+} gsr_control_client;
+
+typedef struct {
+    int listen_fd;
+    int wakeup_fd;
+    char path[108];
+    pthread_t thread;
+    bool thread_started;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t command_cond;
+    gsr_control_client clients[GSR_CONTROL_MAX_CLIENTS];
+    gsr_control_command commands[GSR_CONTROL_MAX_QUEUED_COMMANDS];
+    int num_commands;
+} gsr_control_socket;
+
+/* Creates the socket at |path| and starts a thread that receives requests. Returns 0 on success */
+int gsr_control_socket_init(gsr_control_socket *self, const char *path);
+void gsr_control_socket_deinit(gsr_control_socket *self);
+
+/* Returns true and removes the oldest received command if there is one */
+bool gsr_control_socket_pop_command(gsr_control_socket *self, gsr_control_command *command);
+/* Waits until a command is received or until |timeout_sec| has passed. Returns true if there is a command to pop */
+bool gsr_control_socket_wait(gsr_control_socket *self, double timeout_sec);
+/* Thread safe. Does nothing if the client that sent |command| has disconnected */
+void gsr_control_socket_send_response(gsr_control_socket *self, const gsr_control_command *command, gsr_control_result result, const char *message, const gsr_control_stats *stats);
+
+/* For clients: sends |request| to the gpu screen recorder listening on |path| and waits for the response. Returns 0 on success */
+int gsr_control_socket_send_request(const char *path, const gsr_control_request *request, gsr_control_response *response);
+
+#endif /* GSR_CONTROL_SOCKET_H */
@@ -0,0 +1,47 @@
+#ifndef GSR_CPU_COLOR_CONVERSION_H
+#define GSR_CPU_COLOR_CONVERSION_H
+
+#include "color_conversion.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Color conversion on the cpu, for capture methods that don't give us an opengl texture (or a dma-buf) */
+
+typedef enum {
+    GSR_CPU_SOURCE_FORMAT_RGBA, /* 4 bytes per pixel: r, g, b, a (in memory order) */
+    GSR_CPU_SOURCE_FORMAT_BGRA, /* 4 bytes per pixel: b, g, r, a (in memory order). This is the X11 ZPixmap format for depth 24/32 on little endian */
+    GSR_CPU_SOURCE_FORMAT_RGB   /* 3 bytes per pixel: r, g, b (in memory order) */
+} gsr_cpu_source_format;
+
+typedef struct {
+    const uint8_t *data;
+    int stride; /* In bytes. Negative to flip the image vertically, |data| is the last row then */
+    int width;
+    int height;
+    gsr_cpu_source_format format;
+} gsr_cpu_source_image;
+
+typedef struct {
+    uint8_t *y;
+    int y_stride;  /* In bytes */
+    uint8_t *uv;   /* Interleaved u and v, half the width and height of y (rounded up) */
+    int uv_stride; /* In bytes */
+} gsr_cpu_destination_image;
+
+/*
+    Converts |source| to NV12 (BT709, 8-bit) or P010 (BT2020, 10-bit in the high bits of each 16-bit sample) using the same color matrices as the opengl color conversion.
+    Chroma is the average of each 2x2 block of pixels. The alpha channel is ignored.
+    Uses avx2, sse4.1 or neon when the cpu supports it.
+    Returns 0 on success.
+*/
+int gsr_cpu_color_conversion_convert(const gsr_cpu_source_image *source, const gsr_cpu_destination_image *destination, gsr_destination_color destination_color, gsr_color_range color_range);
+
+/* Returns "avx2", "sse4.1", "neon" or "scalar" */
+const char* gsr_cpu_color_conversion_get_implementation_name(void);
+/*
+    Forces the implementation ("avx2", "sse4.1", "neon" or "scalar"), for tests and benchmarks. NULL goes back to choosing the fastest one.
+    Returns false if the cpu doesn't support |name|. |name| has to be a string literal (it's not copied).
+*/
+bool gsr_cpu_color_conversion_set_implementation(const char *name);
+
+#endif /* GSR_CPU_COLOR_CONVERSION_H */
@@ -0,0 +1,46 @@
+#ifndef GSR_DBUS_H
+#define GSR_DBUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <dbus/dbus.h>
+
+/*
+    org.freedesktop.portal.ScreenCast session. The methods should be called in this order:
+    create_session, select_sources, start, open_pipewire_remote. Each of them (except open_pipewire_remote) blocks until
+    the portal sends its response, which can take a while since the user is asked what to share in select_sources/start.
+*/
+
+typedef enum {
+    GSR_PORTAL_CAPTURE_TYPE_MONITOR = 1 << 0,
+    GSR_PORTAL_CAPTURE_TYPE_WINDOW  = 1 << 1,
+    GSR_PORTAL_CAPTURE_TYPE_VIRTUAL = 1 << 2,
+    GSR_PORTAL_CAPTURE_TYPE_ALL     = GSR_PORTAL_CAPTURE_TYPE_MONITOR | GSR_PORTAL_CAPTURE_TYPE_WINDOW | GSR_PORTAL_CAPTURE_TYPE_VIRTUAL
+} gsr_portal_capture_type;
+
+typedef enum {
+    GSR_PORTAL_CURSOR_MODE_HIDDEN   = 1 << 0,
+    GSR_PORTAL_CURSOR_MODE_EMBEDDED = 1 << 1,
+    GSR_PORTAL_CURSOR_MODE_METADATA = 1 << 2
+} gsr_portal_cursor_mode;
+
+typedef struct {
+    DBusConnection *con;
+    DBusError err;
+    char sender_path_name[128]; /* The unique name of the connection in the form used in request object paths */
+    uint32_t handle_counter;
+} gsr_dbus;
+
+bool gsr_dbus_init(gsr_dbus *self);
+void gsr_dbus_deinit(gsr_dbus *self);
+
+/* All of these return 0 on success. The returned |session_handle| has to be freed with free */
+int gsr_dbus_screencast_create_session(gsr_dbus *self, char **session_handle);
+int gsr_dbus_screencast_select_sources(gsr_dbus *self, const char *session_handle, gsr_portal_capture_type capture_type, gsr_portal_cursor_mode cursor_mode);
+int gsr_dbus_screencast_start(gsr_dbus *self, const char *session_handle, uint32_t *pipewire_node);
+/* The returned fd is a connection to the pipewire instance that only has access to the shared streams */
+int gsr_dbus_screencast_open_pipewire_remote(gsr_dbus *self, const char *session_handle, int *pipewire_fd);
+/* Calls org.freedesktop.portal.Session.Close, which stops the screencast. Can be called at any point after create_session */
+int gsr_dbus_screencast_close_session(gsr_dbus *self, const char *session_handle);
+
+#endif /* GSR_DBUS_H */
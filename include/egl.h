@@ -54,6 +54,21 @@ typedef void (*__eglMustCastToProperFunctionPointerType)(void);
 #define EGL_DMA_BUF_PLANE0_PITCH_EXT            0x3274
 #define EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT      0x3443
 #define EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT      0x3444
+#define EGL_DMA_BUF_PLANE1_FD_EXT               0x3275
+#define EGL_DMA_BUF_PLANE1_OFFSET_EXT           0x3276
+#define EGL_DMA_BUF_PLANE1_PITCH_EXT            0x3277
+#define EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT      0x3445
+#define EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT      0x3446
+#define EGL_DMA_BUF_PLANE2_FD_EXT               0x3278
+#define EGL_DMA_BUF_PLANE2_OFFSET_EXT           0x3279
+#define EGL_DMA_BUF_PLANE2_PITCH_EXT            0x327A
+#define EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT      0x3447
+#define EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT      0x3448
+#define EGL_DMA_BUF_PLANE3_FD_EXT               0x3440
+#define EGL_DMA_BUF_PLANE3_OFFSET_EXT           0x3441
+#define EGL_DMA_BUF_PLANE3_PITCH_EXT            0x3442
+#define EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT      0x3449
+#define EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT      0x344A
 #define EGL_LINUX_DMA_BUF_EXT                   0x3270
 #define EGL_RED_SIZE                            0x3024
 #define EGL_ALPHA_SIZE                          0x3021
@@ -70,8 +85,11 @@ typedef void (*__eglMustCastToProperFunctionPointerType)(void);
 #define GL_TRIANGLES                            0x0004
 #define GL_TEXTURE_2D                           0x0DE1
 #define GL_TEXTURE_EXTERNAL_OES                 0x8D65 // TODO: Use this where applicable
+#define GL_TEXTURE0                             0x84C0
 #define GL_RGB                                  0x1907
 #define GL_RGBA                                 0x1908
+#define GL_BGRA                                 0x80E1
+#define GL_UNPACK_ROW_LENGTH                    0x0CF2
 #define GL_RGBA8                                0x8058
 #define GL_UNSIGNED_BYTE                        0x1401
 #define GL_COLOR_BUFFER_BIT                     0x00004000
@@ -95,17 +113,36 @@ typedef void (*__eglMustCastToProperFunctionPointerType)(void);
 
 #define GL_VENDOR                               0x1F00
 #define GL_RENDERER                             0x1F01
+#define GL_VERSION                              0x1F02
 
 #define GL_COMPILE_STATUS                       0x8B81
 #define GL_INFO_LOG_LENGTH                      0x8B84
 #define GL_FRAGMENT_SHADER                      0x8B30
 #define GL_VERTEX_SHADER                        0x8B31
+#define GL_COMPUTE_SHADER                       0x91B9
 #define GL_COMPILE_STATUS                       0x8B81
 #define GL_LINK_STATUS                          0x8B82
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT      0x8257
+#define GL_PROGRAM_BINARY_LENGTH                0x8741
+
+#define GL_R8                                   0x8229
+#define GL_R16                                  0x822A
+#define GL_RG8                                  0x822B
+#define GL_RG16                                 0x822C
+#define GL_READ_WRITE                           0x88BA
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT      0x00000020
+#define GL_ALL_BARRIER_BITS                     0xFFFFFFFF
 
 typedef unsigned int (*FUNC_eglExportDMABUFImageQueryMESA)(EGLDisplay dpy, EGLImageKHR image, int *fourcc, int *num_planes, uint64_t *modifiers);
 typedef unsigned int (*FUNC_eglExportDMABUFImageMESA)(EGLDisplay dpy, EGLImageKHR image, int *fds, int32_t *strides, int32_t *offsets);
+typedef unsigned int (*FUNC_eglQueryDmaBufModifiersEXT)(EGLDisplay dpy, int32_t format, int32_t max_modifiers, uint64_t *modifiers, unsigned int *external_only, int32_t *num_modifiers);
 typedef void (*FUNC_glEGLImageTargetTexture2DOES)(unsigned int target, GLeglImageOES image);
+typedef void (*FUNC_glGetProgramBinary)(unsigned int program, int bufSize, int *length, unsigned int *binaryFormat, void *binary);
+typedef void (*FUNC_glProgramBinary)(unsigned int program, unsigned int binaryFormat, const void *binary, int length);
+typedef void (*FUNC_glProgramParameteri)(unsigned int program, unsigned int pname, int value);
+typedef void (*FUNC_glDispatchCompute)(unsigned int num_groups_x, unsigned int num_groups_y, unsigned int num_groups_z);
+typedef void (*FUNC_glMemoryBarrier)(unsigned int barriers);
+typedef void (*FUNC_glBindImageTexture)(unsigned int unit, unsigned int texture, int level, unsigned char layered, int layer, unsigned int access, unsigned int format);
 
 #define GSR_MAX_OUTPUTS 32
 
@@ -129,6 +166,9 @@ typedef struct {
     void *registry;
     void *surface;
     void *compositor;
+    void *shm;
+    void *linux_dmabuf; /* NULL if not supported by the compositor */
+    void *screencopy_manager; /* NULL if not supported by the compositor (wlroots based compositors support it) */
     gsr_wayland_output outputs[GSR_MAX_OUTPUTS];
     int num_outputs;
 } gsr_wayland;
@@ -165,6 +205,16 @@ typedef struct {
     FUNC_eglExportDMABUFImageQueryMESA eglExportDMABUFImageQueryMESA;
     FUNC_eglExportDMABUFImageMESA eglExportDMABUFImageMESA;
     FUNC_glEGLImageTargetTexture2DOES glEGLImageTargetTexture2DOES;
+    /* Optional (NULL if not supported). Used to tell pipewire which dma-buf modifiers can be imported */
+    FUNC_eglQueryDmaBufModifiersEXT eglQueryDmaBufModifiersEXT;
+    /* These are optional (NULL if not supported). Used for the shader program binary cache */
+    FUNC_glGetProgramBinary glGetProgramBinary;
+    FUNC_glProgramBinary glProgramBinary;
+    FUNC_glProgramParameteri glProgramParameteri;
+    /* These are optional (NULL if not supported). Used for the compute shader color conversion, requires OpenGL 4.3 */
+    FUNC_glDispatchCompute glDispatchCompute;
+    FUNC_glMemoryBarrier glMemoryBarrier;
+    FUNC_glBindImageTexture glBindImageTexture;
 
     unsigned int (*glGetError)(void);
     const unsigned char* (*glGetString)(unsigned int name);
@@ -175,9 +225,12 @@ typedef struct {
     void (*glGenTextures)(int n, unsigned int *textures);
     void (*glDeleteTextures)(int n, const unsigned int *texture);
     void (*glBindTexture)(unsigned int target, unsigned int texture);
+    void (*glActiveTexture)(unsigned int texture);
     void (*glTexParameteri)(unsigned int target, unsigned int pname, int param);
     void (*glGetTexLevelParameteriv)(unsigned int target, int level, unsigned int pname, int *params);
+    void (*glPixelStorei)(unsigned int pname, int param);
     void (*glTexImage2D)(unsigned int target, int level, int internalFormat, int width, int height, int border, unsigned int format, unsigned int type, const void *pixels);
+    void (*glTexSubImage2D)(unsigned int target, int level, int xoffset, int yoffset, int width, int height, unsigned int format, unsigned int type, const void *pixels);
     void (*glCopyImageSubData)(unsigned int srcName, unsigned int srcTarget, int srcLevel, int srcX, int srcY, int srcZ, unsigned int dstName, unsigned int dstTarget, int dstLevel, int dstX, int dstY, int dstZ, int srcWidth, int srcHeight, int srcDepth);
     void (*glClearTexImage)(unsigned int texture, unsigned int level, unsigned int format, unsigned int type, const void *data);
     void (*glGenFramebuffers)(int n, unsigned int *framebuffers);
@@ -217,9 +270,16 @@ typedef struct {
     int (*glGetUniformLocation)(unsigned int program, const char *name);
     void (*glUniform1f)(int location, float v0);
     void (*glUniform2f)(int location, float v0, float v1);
+    void (*glUniform1i)(int location, int v0);
+    void (*glUniform2i)(int location, int v0, int v1);
 } gsr_egl;
 
 bool gsr_egl_load(gsr_egl *self, Display *dpy, bool wayland);
+/*
+    Only connects to the wayland compositor (|wayland| is set up, but there is no egl display or opengl context).
+    For capture on the cpu (screencopy with -encoder cpu), where no gpu is needed. Unload with |gsr_egl_unload|.
+*/
+bool gsr_egl_load_wayland_only(gsr_egl *self);
 void gsr_egl_unload(gsr_egl *self);
 
 void gsr_egl_update(gsr_egl *self);
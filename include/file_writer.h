@@ -0,0 +1,49 @@
+#ifndef GSR_FILE_WRITER_H
+#define GSR_FILE_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Sequential file writer for saving large files (replays) in the background without disturbing the rest of the system.
+    Data that has been written is handed to the kernel for writeback in large chunks and then dropped from the page cache,
+    which avoids building up gigabytes of dirty pages that are then flushed all at once.
+*/
+
+typedef enum {
+    GSR_FILE_WRITER_SYNC_NONE,      /* Let the kernel write back the data whenever it wants to */
+    GSR_FILE_WRITER_SYNC_WRITEBACK, /* Start writeback of every written chunk and drop the previous chunk from the page cache */
+    GSR_FILE_WRITER_SYNC_FULL       /* GSR_FILE_WRITER_SYNC_WRITEBACK and fsync when closing the file */
+} gsr_file_writer_sync;
+
+typedef struct {
+    gsr_file_writer_sync sync;
+    int64_t preallocate_size;         /* Expected size of the file, 0 to not preallocate */
+    int64_t rate_limit_bytes_per_sec; /* 0 for no limit */
+    bool low_io_priority;             /* Sets the io priority of the calling thread to the lowest best-effort priority */
+} gsr_file_writer_params;
+
+typedef struct {
+    int fd;
+    gsr_file_writer_params params;
+    int64_t pos;
+    int64_t size;
+    int64_t writeback_start;      /* Start of the data that hasn't been written back yet */
+    int64_t prev_writeback_start; /* Previous chunk that writeback was started for, to drop it from the page cache later */
+    int64_t prev_writeback_end;
+    double rate_limit_start_time;
+    int64_t rate_limit_bytes_written;
+} gsr_file_writer;
+
+/* Returns 0 on success */
+int gsr_file_writer_open(gsr_file_writer *self, const char *filepath, const gsr_file_writer_params *params);
+/* Writes all of |data|. Returns 0 on success */
+int gsr_file_writer_write(gsr_file_writer *self, const uint8_t *data, int64_t size);
+/* Same as lseek. Returns the new position, or -1 on failure */
+int64_t gsr_file_writer_seek(gsr_file_writer *self, int64_t offset, int whence);
+/* Returns the size of the file */
+int64_t gsr_file_writer_get_size(gsr_file_writer *self);
+/* Removes the unused preallocated space and syncs the file (depending on the sync mode). Returns 0 on success */
+int gsr_file_writer_close(gsr_file_writer *self);
+
+#endif /* GSR_FILE_WRITER_H */
@@ -0,0 +1,43 @@
+#ifndef GSR_FRAME_QUEUE_H
+#define GSR_FRAME_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct AVFrame AVFrame;
+
+/*
+    Lock-free single producer, single consumer queue of frames. Used to hand audio frames from the thread that reads
+    an audio device to the thread that encodes the audio track, without either of them ever waiting for the other.
+    Only one thread may push and only one (other) thread may pop.
+*/
+
+#define GSR_FRAME_QUEUE_CACHE_LINE_SIZE 64
+
+/*
+    |frames| and |capacity| are read by both threads and never modified after init, while each index is written by one thread.
+    The padding keeps each of them in a different cache line (from each other and from what comes after the queue) so that
+    a write to one index doesn't make the other thread reload the cache line it reads the rest from. The queue isn't necessarily
+    aligned to a cache line, so each padding is a whole cache line.
+*/
+typedef struct {
+    AVFrame **frames;
+    uint32_t capacity; /* Power of two */
+    char padding0[GSR_FRAME_QUEUE_CACHE_LINE_SIZE];
+    uint32_t write_index; /* Only modified by the producer */
+    char padding1[GSR_FRAME_QUEUE_CACHE_LINE_SIZE];
+    uint32_t read_index;  /* Only modified by the consumer */
+    char padding2[GSR_FRAME_QUEUE_CACHE_LINE_SIZE];
+} gsr_frame_queue;
+
+/* |capacity| is rounded up to a power of two. Returns 0 on success */
+int gsr_frame_queue_init(gsr_frame_queue *self, uint32_t capacity);
+/* Frees the frames that are still in the queue */
+void gsr_frame_queue_deinit(gsr_frame_queue *self);
+
+/* Returns false if the queue is full, the frame is not added then */
+bool gsr_frame_queue_push(gsr_frame_queue *self, AVFrame *frame);
+/* Returns NULL if the queue is empty */
+AVFrame* gsr_frame_queue_pop(gsr_frame_queue *self);
+
+#endif /* GSR_FRAME_QUEUE_H */
@@ -0,0 +1,90 @@
+#ifndef GSR_NETWORK_OUTPUT_H
+#define GSR_NETWORK_OUTPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef struct AVFormatContext AVFormatContext;
+typedef struct AVPacket AVPacket;
+
+/*
+    Live stream output. Packets are queued by the capture loop and written to the muxer (and network) by a separate thread,
+    so that a slow or stalled connection doesn't stall capture. When the connection can't keep up the queue is kept short
+    by dropping video packets until the next keyframe. Audio packets are only dropped as a last resort.
+*/
+
+#define GSR_NETWORK_OUTPUT_MAX_QUEUED_PACKETS 4096
+
+typedef struct {
+    AVPacket *packet;
+    double enqueue_time;
+    double capture_time; /* Negative if unknown */
+    bool is_video;
+} gsr_network_output_entry;
+
+typedef struct {
+    double queue_latency_seconds; /* How long the oldest queued packet has been waiting to be sent */
+    int64_t queued_bytes;
+    double send_bytes_per_second; /* Measured over the last second */
+    double video_send_latency_seconds; /* Average time from a video packet being queued until it has been written to the socket, over the last second */
+    double video_capture_to_socket_latency_seconds; /* Average time from a video frame being captured until its packet has been written to the socket, over the last second */
+    uint64_t num_dropped_packets;
+} gsr_network_output_stats;
+
+typedef struct {
+    AVFormatContext *format_context;
+    double max_queue_latency_seconds;
+    int tcp_fd; /* -1 unless the url is tcp:// */
+
+    pthread_t thread;
+    bool thread_started;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool stop;
+
+    gsr_network_output_entry entries[GSR_NETWORK_OUTPUT_MAX_QUEUED_PACKETS]; /* Ring buffer */
+    int entries_start;
+    int num_entries;
+    int64_t queued_bytes;
+
+    bool drop_until_keyframe;
+    bool keyframe_requested;
+    bool keyframe_request_sent;
+    uint64_t num_dropped_packets;
+
+    double send_second_start;
+    int64_t send_second_bytes;
+    double send_bytes_per_second;
+    double send_second_video_latency_sum;
+    int send_second_num_video_packets;
+    double send_second_video_capture_latency_sum;
+    int send_second_num_video_capture_packets;
+    double video_send_latency_seconds;
+    double video_capture_to_socket_latency_seconds;
+    double last_error_time;
+} gsr_network_output;
+
+/*
+    Opens the connection to |url| and sets it as the io context of |format_context|. The header is not written.
+    tcp:// urls are connected to directly (with TCP_NODELAY and TCP_NOTSENT_LOWAT), everything else (rtmp, srt, udp, http) goes through ffmpeg.
+    Returns 0 on success.
+*/
+int gsr_network_output_open(gsr_network_output *self, AVFormatContext *format_context, const char *url, double max_queue_latency_seconds);
+/* Call after the header has been written. Returns 0 on success */
+int gsr_network_output_start(gsr_network_output *self);
+/* Sends the remaining queued packets and stops the thread. Call this before writing the trailer */
+void gsr_network_output_stop(gsr_network_output *self);
+/* Closes the connection. Call this after the trailer has been written */
+void gsr_network_output_close(gsr_network_output *self);
+
+/*
+    |packet| should already be rescaled to the stream time base. The data is copied.
+    |capture_time| is the clock_get_monotonic_seconds time the video frame of the packet was captured, or negative if unknown (for example for audio).
+*/
+void gsr_network_output_push(gsr_network_output *self, const AVPacket *packet, bool is_video, double capture_time);
+void gsr_network_output_get_stats(gsr_network_output *self, gsr_network_output_stats *stats);
+/* Returns true (once) if video packets have been dropped and the next video frame should be a keyframe to recover quickly */
+bool gsr_network_output_take_keyframe_request(gsr_network_output *self);
+
+#endif /* GSR_NETWORK_OUTPUT_H */
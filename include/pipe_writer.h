@@ -0,0 +1,41 @@
+#ifndef GSR_PIPE_WRITER_H
+#define GSR_PIPE_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+    Writes data to a pipe (for example stdout piped to ffmpeg) from a separate thread, so that a slow reader doesn't block the capture loop
+    until the ring buffer is full. The pipe buffer is enlarged so that the writer thread can write large batches.
+*/
+
+typedef struct {
+    int fd;
+    uint8_t *buffer;
+    size_t capacity;
+    uint64_t read_pos;  /* Total number of bytes written to the pipe */
+    uint64_t write_pos; /* Total number of bytes added to the ring buffer */
+
+    pthread_mutex_t mutex;
+    pthread_cond_t data_cond;
+    pthread_cond_t space_cond;
+    pthread_t thread;
+    bool thread_started;
+    bool stop;
+    bool failed;
+
+    double blocked_seconds;           /* Total time gsr_pipe_writer_write has waited for the reader */
+    double last_blocked_warning_time;
+} gsr_pipe_writer;
+
+/* |fd| should be a pipe. |buffer_size| is the size of the ring buffer. Returns 0 on success */
+int gsr_pipe_writer_init(gsr_pipe_writer *self, int fd, size_t buffer_size);
+/* Writes the remaining data in the ring buffer to the pipe and stops the thread */
+void gsr_pipe_writer_deinit(gsr_pipe_writer *self);
+
+/* Adds |data| to the ring buffer. This only blocks if the ring buffer is full, which means that the reader is not keeping up. Returns 0 on success */
+int gsr_pipe_writer_write(gsr_pipe_writer *self, const uint8_t *data, size_t size);
+
+#endif /* GSR_PIPE_WRITER_H */
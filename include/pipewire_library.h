@@ -0,0 +1,63 @@
+#ifndef GSR_PIPEWIRE_LIBRARY_H
+#define GSR_PIPEWIRE_LIBRARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pipewire/pipewire.h>
+
+/*
+    libpipewire-0.3.so.0 is loaded at runtime so that pipewire is only required when it's used (-asrv pipewire and -w portal).
+    Only the exported functions are loaded, everything in the spa headers and the pipewire interface methods are inline.
+*/
+
+typedef struct {
+    void *library;
+
+    void (*pw_init)(int *argc, char ***argv);
+
+    struct pw_thread_loop* (*pw_thread_loop_new)(const char *name, const struct spa_dict *props);
+    void (*pw_thread_loop_destroy)(struct pw_thread_loop *loop);
+    int (*pw_thread_loop_start)(struct pw_thread_loop *loop);
+    void (*pw_thread_loop_stop)(struct pw_thread_loop *loop);
+    void (*pw_thread_loop_lock)(struct pw_thread_loop *loop);
+    void (*pw_thread_loop_unlock)(struct pw_thread_loop *loop);
+    void (*pw_thread_loop_signal)(struct pw_thread_loop *loop, bool wait_for_accept);
+    int (*pw_thread_loop_timed_wait)(struct pw_thread_loop *loop, int wait_max_sec);
+    struct pw_loop* (*pw_thread_loop_get_loop)(struct pw_thread_loop *loop);
+
+    struct pw_main_loop* (*pw_main_loop_new)(const struct spa_dict *props);
+    void (*pw_main_loop_destroy)(struct pw_main_loop *loop);
+    struct pw_loop* (*pw_main_loop_get_loop)(struct pw_main_loop *loop);
+    int (*pw_main_loop_run)(struct pw_main_loop *loop);
+    int (*pw_main_loop_quit)(struct pw_main_loop *loop);
+
+    struct pw_context* (*pw_context_new)(struct pw_loop *main_loop, struct pw_properties *props, size_t user_data_size);
+    void (*pw_context_destroy)(struct pw_context *context);
+    struct pw_core* (*pw_context_connect)(struct pw_context *context, struct pw_properties *properties, size_t user_data_size);
+    struct pw_core* (*pw_context_connect_fd)(struct pw_context *context, int fd, struct pw_properties *properties, size_t user_data_size);
+    int (*pw_core_disconnect)(struct pw_core *core);
+    void (*pw_proxy_destroy)(struct pw_proxy *proxy);
+
+    struct pw_properties* (*pw_properties_new)(const char *key, ...);
+    int (*pw_properties_set)(struct pw_properties *properties, const char *key, const char *value);
+    int (*pw_properties_setf)(struct pw_properties *properties, const char *key, const char *format, ...);
+
+    struct pw_stream* (*pw_stream_new)(struct pw_core *core, const char *name, struct pw_properties *props);
+    struct pw_stream* (*pw_stream_new_simple)(struct pw_loop *loop, const char *name, struct pw_properties *props, const struct pw_stream_events *events, void *data);
+    void (*pw_stream_add_listener)(struct pw_stream *stream, struct spa_hook *listener, const struct pw_stream_events *events, void *data);
+    void (*pw_stream_destroy)(struct pw_stream *stream);
+    int (*pw_stream_connect)(struct pw_stream *stream, enum pw_direction direction, uint32_t target_id, enum pw_stream_flags flags, const struct spa_pod **params, uint32_t n_params);
+    int (*pw_stream_disconnect)(struct pw_stream *stream);
+    int (*pw_stream_update_params)(struct pw_stream *stream, const struct spa_pod **params, uint32_t n_params);
+    const char* (*pw_stream_state_as_string)(enum pw_stream_state state);
+    struct pw_buffer* (*pw_stream_dequeue_buffer)(struct pw_stream *stream);
+    int (*pw_stream_queue_buffer)(struct pw_stream *stream, struct pw_buffer *buffer);
+} gsr_pipewire_library;
+
+/* Also calls pw_init. Returns false if libpipewire-0.3.so.0 can't be loaded or if a function is missing */
+bool gsr_pipewire_library_load(gsr_pipewire_library *self);
+void gsr_pipewire_library_unload(gsr_pipewire_library *self);
+
+#endif /* GSR_PIPEWIRE_LIBRARY_H */
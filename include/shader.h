@@ -10,6 +10,8 @@ typedef struct {
 
 /* |vertex_shader| or |fragment_shader| may be NULL */
 int gsr_shader_init(gsr_shader *self, gsr_egl *egl, const char *vertex_shader, const char *fragment_shader);
+/* Requires OpenGL 4.3 */
+int gsr_shader_init_compute(gsr_shader *self, gsr_egl *egl, const char *compute_shader);
 void gsr_shader_deinit(gsr_shader *self);
 
 int gsr_shader_bind_attribute_location(gsr_shader *self, const char *attribute, int location);
@@ -21,9 +21,15 @@
 #include <vector>
 #include <string>
 
+typedef enum {
+    SOUND_BACKEND_PULSEAUDIO,
+    SOUND_BACKEND_PIPEWIRE
+} SoundBackend;
+
 typedef struct {
     void *handle;
     unsigned int frames;
+    SoundBackend backend;
 } SoundDevice;
 
 struct AudioInput {
@@ -41,6 +47,12 @@ typedef enum {
     F32
 } AudioFormat;
 
+/*
+    Has to be called before the other sound functions. Selects the sound server that audio is recorded from.
+    Returns false if the backend can't be used, for example if libpipewire can't be loaded.
+*/
+bool sound_backend_init(SoundBackend backend);
+
 /*
     Get a sound device by name, returning the device into the @device parameter.
     The device should be closed with @sound_device_close after it has been used
@@ -58,5 +70,7 @@ void sound_device_close(SoundDevice *device);
 int sound_device_read_next_chunk(SoundDevice *device, void **buffer);
 
 std::vector<AudioInput> get_pulseaudio_inputs();
+/* Audio sources and sink monitors, named the same way as in pulseaudio. Requires the pipewire sound backend */
+std::vector<AudioInput> get_pipewire_inputs();
 
 #endif /* GPU_SCREEN_RECORDER_H */
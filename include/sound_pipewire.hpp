@@ -0,0 +1,23 @@
+#ifndef GSR_SOUND_PIPEWIRE_HPP
+#define GSR_SOUND_PIPEWIRE_HPP
+
+#include "sound.hpp"
+
+/*
+    Native pipewire audio capture, used by sound.cpp when the pipewire sound backend is selected.
+    libpipewire is loaded at runtime so that pipewire is not required when using pulseaudio.
+*/
+
+/* Returns false if libpipewire-0.3.so.0 can't be loaded */
+bool pipewire_load();
+
+/* The pipewire stream is processed in a pipewire real-time thread that writes the audio into a lock-free ring buffer */
+void* pipewire_sound_device_new(const char *device_name, const char *description, unsigned int num_channels, unsigned int period_frame_size, AudioFormat audio_format);
+void pipewire_sound_device_free(void *handle);
+/* Returns a pointer to |period_frame_size| frames of audio, or NULL if they are not available within the time of one period */
+const void* pipewire_sound_device_read(void *handle);
+
+/* Audio sources and sink monitors. Sink monitors are named <sink>.monitor, like in pulseaudio */
+std::vector<AudioInput> pipewire_get_inputs();
+
+#endif /* GSR_SOUND_PIPEWIRE_HPP */
@@ -66,4 +66,7 @@ bool gsr_card_path_get_render_path(const char *card_path, char *render_path);
 
 int even_number_ceil(int value);
 
+/* Modifies |path| temporarily while creating the directories. Returns 0 on success */
+int create_directory_recursive(char *path);
+
 #endif /* GSR_UTILS_H */
@@ -0,0 +1,459 @@
+#ifndef GSR_VULKAN_H
+#define GSR_VULKAN_H
+
+/* Vulkan library with a compute queue, loaded at runtime (libvulkan.so.1) so that vulkan is not a build dependency */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct VkInstance_T* VkInstance;
+typedef struct VkPhysicalDevice_T* VkPhysicalDevice;
+typedef struct VkDevice_T* VkDevice;
+typedef struct VkQueue_T* VkQueue;
+typedef struct VkCommandBuffer_T* VkCommandBuffer;
+typedef uint64_t VkBuffer;
+typedef uint64_t VkDeviceMemory;
+typedef uint64_t VkShaderModule;
+typedef uint64_t VkDescriptorSetLayout;
+typedef uint64_t VkPipelineLayout;
+typedef uint64_t VkPipeline;
+typedef uint64_t VkPipelineCache;
+typedef uint64_t VkDescriptorPool;
+typedef uint64_t VkDescriptorSet;
+typedef uint64_t VkCommandPool;
+typedef uint64_t VkFence;
+typedef uint64_t VkSemaphore;
+typedef uint64_t VkBufferView;
+typedef uint64_t VkSampler;
+typedef uint64_t VkDeviceSize;
+typedef uint32_t VkFlags;
+typedef uint32_t VkBool32;
+typedef int32_t VkResult;
+typedef void (*PFN_vkVoidFunction)(void);
+
+#define VK_SUCCESS                                          0
+#define VK_TRUE                                             1
+#define VK_FALSE                                            0
+#define VK_WHOLE_SIZE                                       (~0ULL)
+#define VK_NULL_HANDLE                                      0
+#define VK_API_VERSION_1_1                                  ((1u << 22) | (1u << 12))
+#define VK_MAX_EXTENSION_NAME_SIZE                          256
+#define VK_MAX_PHYSICAL_DEVICE_NAME_SIZE                    256
+#define VK_MAX_MEMORY_TYPES                                 32
+#define VK_MAX_MEMORY_HEAPS                                 16
+
+#define VK_STRUCTURE_TYPE_APPLICATION_INFO                  0
+#define VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO              1
+#define VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO          2
+#define VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO                3
+#define VK_STRUCTURE_TYPE_SUBMIT_INFO                       4
+#define VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO              5
+#define VK_STRUCTURE_TYPE_FENCE_CREATE_INFO                 8
+#define VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO                12
+#define VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO         16
+#define VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO 18
+#define VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO      29
+#define VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO       30
+#define VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO 32
+#define VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO       33
+#define VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO      34
+#define VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET              35
+#define VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO          39
+#define VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO      40
+#define VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO         42
+#define VK_STRUCTURE_TYPE_MEMORY_BARRIER                    46
+#define VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO 1000072000
+#define VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR         1000074000
+#define VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR          1000074001
+
+#define VK_QUEUE_COMPUTE_BIT                                0x00000002
+#define VK_BUFFER_USAGE_STORAGE_BUFFER_BIT                  0x00000020
+#define VK_SHARING_MODE_EXCLUSIVE                           0
+#define VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT                 0x00000002
+#define VK_MEMORY_PROPERTY_HOST_COHERENT_BIT                0x00000004
+#define VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT      0x00000200
+#define VK_DESCRIPTOR_TYPE_STORAGE_BUFFER                   7
+#define VK_SHADER_STAGE_COMPUTE_BIT                         0x00000020
+#define VK_PIPELINE_BIND_POINT_COMPUTE                      1
+#define VK_COMMAND_BUFFER_LEVEL_PRIMARY                     0
+#define VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT     0x00000002
+#define VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT         0x00000001
+#define VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT                0x00000800
+#define VK_PIPELINE_STAGE_HOST_BIT                          0x00004000
+#define VK_ACCESS_SHADER_WRITE_BIT                          0x00000040
+#define VK_ACCESS_HOST_READ_BIT                             0x00002000
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    const char *pApplicationName;
+    uint32_t applicationVersion;
+    const char *pEngineName;
+    uint32_t engineVersion;
+    uint32_t apiVersion;
+} VkApplicationInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    const VkApplicationInfo *pApplicationInfo;
+    uint32_t enabledLayerCount;
+    const char* const *ppEnabledLayerNames;
+    uint32_t enabledExtensionCount;
+    const char* const *ppEnabledExtensionNames;
+} VkInstanceCreateInfo;
+
+typedef struct {
+    uint32_t apiVersion;
+    uint32_t driverVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    int deviceType;
+    char deviceName[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE];
+    uint8_t pipelineCacheUUID[16];
+    uint8_t limits_and_sparse_properties[1024]; /* Not used. Larger than VkPhysicalDeviceLimits + VkPhysicalDeviceSparseProperties */
+} VkPhysicalDeviceProperties;
+
+typedef struct {
+    VkFlags queueFlags;
+    uint32_t queueCount;
+    uint32_t timestampValidBits;
+    uint32_t minImageTransferGranularity[3];
+} VkQueueFamilyProperties;
+
+typedef struct {
+    VkFlags propertyFlags;
+    uint32_t heapIndex;
+} VkMemoryType;
+
+typedef struct {
+    VkDeviceSize size;
+    VkFlags flags;
+} VkMemoryHeap;
+
+typedef struct {
+    uint32_t memoryTypeCount;
+    VkMemoryType memoryTypes[VK_MAX_MEMORY_TYPES];
+    uint32_t memoryHeapCount;
+    VkMemoryHeap memoryHeaps[VK_MAX_MEMORY_HEAPS];
+} VkPhysicalDeviceMemoryProperties;
+
+typedef struct {
+    char extensionName[VK_MAX_EXTENSION_NAME_SIZE];
+    uint32_t specVersion;
+} VkExtensionProperties;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    uint32_t queueFamilyIndex;
+    uint32_t queueCount;
+    const float *pQueuePriorities;
+} VkDeviceQueueCreateInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    uint32_t queueCreateInfoCount;
+    const VkDeviceQueueCreateInfo *pQueueCreateInfos;
+    uint32_t enabledLayerCount;
+    const char* const *ppEnabledLayerNames;
+    uint32_t enabledExtensionCount;
+    const char* const *ppEnabledExtensionNames;
+    const void *pEnabledFeatures;
+} VkDeviceCreateInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    VkDeviceSize size;
+    VkFlags usage;
+    int sharingMode;
+    uint32_t queueFamilyIndexCount;
+    const uint32_t *pQueueFamilyIndices;
+} VkBufferCreateInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags handleTypes;
+} VkExternalMemoryBufferCreateInfo;
+
+typedef struct {
+    VkDeviceSize size;
+    VkDeviceSize alignment;
+    uint32_t memoryTypeBits;
+} VkMemoryRequirements;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkDeviceSize allocationSize;
+    uint32_t memoryTypeIndex;
+} VkMemoryAllocateInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags handleType;
+    int fd;
+} VkImportMemoryFdInfoKHR;
+
+typedef struct {
+    int sType;
+    void *pNext;
+    uint32_t memoryTypeBits;
+} VkMemoryFdPropertiesKHR;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    size_t codeSize;
+    const uint32_t *pCode;
+} VkShaderModuleCreateInfo;
+
+typedef struct {
+    uint32_t binding;
+    int descriptorType;
+    uint32_t descriptorCount;
+    VkFlags stageFlags;
+    const VkSampler *pImmutableSamplers;
+} VkDescriptorSetLayoutBinding;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    uint32_t bindingCount;
+    const VkDescriptorSetLayoutBinding *pBindings;
+} VkDescriptorSetLayoutCreateInfo;
+
+typedef struct {
+    VkFlags stageFlags;
+    uint32_t offset;
+    uint32_t size;
+} VkPushConstantRange;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    uint32_t setLayoutCount;
+    const VkDescriptorSetLayout *pSetLayouts;
+    uint32_t pushConstantRangeCount;
+    const VkPushConstantRange *pPushConstantRanges;
+} VkPipelineLayoutCreateInfo;
+
+typedef struct {
+    uint32_t constantID;
+    uint32_t offset;
+    size_t size;
+} VkSpecializationMapEntry;
+
+typedef struct {
+    uint32_t mapEntryCount;
+    const VkSpecializationMapEntry *pMapEntries;
+    size_t dataSize;
+    const void *pData;
+} VkSpecializationInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    VkFlags stage;
+    VkShaderModule module;
+    const char *pName;
+    const VkSpecializationInfo *pSpecializationInfo;
+} VkPipelineShaderStageCreateInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    VkPipelineShaderStageCreateInfo stage;
+    VkPipelineLayout layout;
+    VkPipeline basePipelineHandle;
+    int32_t basePipelineIndex;
+} VkComputePipelineCreateInfo;
+
+typedef struct {
+    int type;
+    uint32_t descriptorCount;
+} VkDescriptorPoolSize;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    uint32_t maxSets;
+    uint32_t poolSizeCount;
+    const VkDescriptorPoolSize *pPoolSizes;
+} VkDescriptorPoolCreateInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkDescriptorPool descriptorPool;
+    uint32_t descriptorSetCount;
+    const VkDescriptorSetLayout *pSetLayouts;
+} VkDescriptorSetAllocateInfo;
+
+typedef struct {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize range;
+} VkDescriptorBufferInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkDescriptorSet dstSet;
+    uint32_t dstBinding;
+    uint32_t dstArrayElement;
+    uint32_t descriptorCount;
+    int descriptorType;
+    const void *pImageInfo;
+    const VkDescriptorBufferInfo *pBufferInfo;
+    const VkBufferView *pTexelBufferView;
+} VkWriteDescriptorSet;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    uint32_t queueFamilyIndex;
+} VkCommandPoolCreateInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkCommandPool commandPool;
+    int level;
+    uint32_t commandBufferCount;
+} VkCommandBufferAllocateInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+    const void *pInheritanceInfo;
+} VkCommandBufferBeginInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags srcAccessMask;
+    VkFlags dstAccessMask;
+} VkMemoryBarrier;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    VkFlags flags;
+} VkFenceCreateInfo;
+
+typedef struct {
+    int sType;
+    const void *pNext;
+    uint32_t waitSemaphoreCount;
+    const VkSemaphore *pWaitSemaphores;
+    const VkFlags *pWaitDstStageMask;
+    uint32_t commandBufferCount;
+    const VkCommandBuffer *pCommandBuffers;
+    uint32_t signalSemaphoreCount;
+    const VkSemaphore *pSignalSemaphores;
+} VkSubmitInfo;
+
+typedef struct {
+    void *library;
+    VkInstance instance;
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+    VkQueue queue;
+    uint32_t queue_family_index;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    char device_name[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE];
+    bool dma_buf_import_supported; /* VK_KHR_external_memory_fd and VK_EXT_external_memory_dma_buf */
+
+    PFN_vkVoidFunction (*vkGetInstanceProcAddr)(VkInstance instance, const char *name);
+    PFN_vkVoidFunction (*vkGetDeviceProcAddr)(VkDevice device, const char *name);
+    VkResult (*vkCreateInstance)(const VkInstanceCreateInfo *create_info, const void *allocator, VkInstance *instance);
+    void (*vkDestroyInstance)(VkInstance instance, const void *allocator);
+    VkResult (*vkEnumeratePhysicalDevices)(VkInstance instance, uint32_t *physical_device_count, VkPhysicalDevice *physical_devices);
+    void (*vkGetPhysicalDeviceProperties)(VkPhysicalDevice physical_device, VkPhysicalDeviceProperties *properties);
+    void (*vkGetPhysicalDeviceQueueFamilyProperties)(VkPhysicalDevice physical_device, uint32_t *queue_family_property_count, VkQueueFamilyProperties *queue_family_properties);
+    void (*vkGetPhysicalDeviceMemoryProperties)(VkPhysicalDevice physical_device, VkPhysicalDeviceMemoryProperties *memory_properties);
+    VkResult (*vkEnumerateDeviceExtensionProperties)(VkPhysicalDevice physical_device, const char *layer_name, uint32_t *property_count, VkExtensionProperties *properties);
+    VkResult (*vkCreateDevice)(VkPhysicalDevice physical_device, const VkDeviceCreateInfo *create_info, const void *allocator, VkDevice *device);
+
+    void (*vkDestroyDevice)(VkDevice device, const void *allocator);
+    void (*vkGetDeviceQueue)(VkDevice device, uint32_t queue_family_index, uint32_t queue_index, VkQueue *queue);
+    VkResult (*vkCreateBuffer)(VkDevice device, const VkBufferCreateInfo *create_info, const void *allocator, VkBuffer *buffer);
+    void (*vkDestroyBuffer)(VkDevice device, VkBuffer buffer, const void *allocator);
+    void (*vkGetBufferMemoryRequirements)(VkDevice device, VkBuffer buffer, VkMemoryRequirements *memory_requirements);
+    VkResult (*vkAllocateMemory)(VkDevice device, const VkMemoryAllocateInfo *allocate_info, const void *allocator, VkDeviceMemory *memory);
+    void (*vkFreeMemory)(VkDevice device, VkDeviceMemory memory, const void *allocator);
+    VkResult (*vkBindBufferMemory)(VkDevice device, VkBuffer buffer, VkDeviceMemory memory, VkDeviceSize memory_offset);
+    VkResult (*vkMapMemory)(VkDevice device, VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize size, VkFlags flags, void **data);
+    void (*vkUnmapMemory)(VkDevice device, VkDeviceMemory memory);
+    VkResult (*vkCreateShaderModule)(VkDevice device, const VkShaderModuleCreateInfo *create_info, const void *allocator, VkShaderModule *shader_module);
+    void (*vkDestroyShaderModule)(VkDevice device, VkShaderModule shader_module, const void *allocator);
+    VkResult (*vkCreateDescriptorSetLayout)(VkDevice device, const VkDescriptorSetLayoutCreateInfo *create_info, const void *allocator, VkDescriptorSetLayout *set_layout);
+    void (*vkDestroyDescriptorSetLayout)(VkDevice device, VkDescriptorSetLayout set_layout, const void *allocator);
+    VkResult (*vkCreatePipelineLayout)(VkDevice device, const VkPipelineLayoutCreateInfo *create_info, const void *allocator, VkPipelineLayout *pipeline_layout);
+    void (*vkDestroyPipelineLayout)(VkDevice device, VkPipelineLayout pipeline_layout, const void *allocator);
+    VkResult (*vkCreateComputePipelines)(VkDevice device, VkPipelineCache pipeline_cache, uint32_t create_info_count, const VkComputePipelineCreateInfo *create_infos, const void *allocator, VkPipeline *pipelines);
+    void (*vkDestroyPipeline)(VkDevice device, VkPipeline pipeline, const void *allocator);
+    VkResult (*vkCreateDescriptorPool)(VkDevice device, const VkDescriptorPoolCreateInfo *create_info, const void *allocator, VkDescriptorPool *descriptor_pool);
+    void (*vkDestroyDescriptorPool)(VkDevice device, VkDescriptorPool descriptor_pool, const void *allocator);
+    VkResult (*vkAllocateDescriptorSets)(VkDevice device, const VkDescriptorSetAllocateInfo *allocate_info, VkDescriptorSet *descriptor_sets);
+    void (*vkUpdateDescriptorSets)(VkDevice device, uint32_t descriptor_write_count, const VkWriteDescriptorSet *descriptor_writes, uint32_t descriptor_copy_count, const void *descriptor_copies);
+    VkResult (*vkCreateCommandPool)(VkDevice device, const VkCommandPoolCreateInfo *create_info, const void *allocator, VkCommandPool *command_pool);
+    void (*vkDestroyCommandPool)(VkDevice device, VkCommandPool command_pool, const void *allocator);
+    VkResult (*vkAllocateCommandBuffers)(VkDevice device, const VkCommandBufferAllocateInfo *allocate_info, VkCommandBuffer *command_buffers);
+    VkResult (*vkBeginCommandBuffer)(VkCommandBuffer command_buffer, const VkCommandBufferBeginInfo *begin_info);
+    VkResult (*vkEndCommandBuffer)(VkCommandBuffer command_buffer);
+    VkResult (*vkResetCommandBuffer)(VkCommandBuffer command_buffer, VkFlags flags);
+    void (*vkCmdBindPipeline)(VkCommandBuffer command_buffer, int pipeline_bind_point, VkPipeline pipeline);
+    void (*vkCmdBindDescriptorSets)(VkCommandBuffer command_buffer, int pipeline_bind_point, VkPipelineLayout layout, uint32_t first_set, uint32_t descriptor_set_count, const VkDescriptorSet *descriptor_sets, uint32_t dynamic_offset_count, const uint32_t *dynamic_offsets);
+    void (*vkCmdPushConstants)(VkCommandBuffer command_buffer, VkPipelineLayout layout, VkFlags stage_flags, uint32_t offset, uint32_t size, const void *values);
+    void (*vkCmdDispatch)(VkCommandBuffer command_buffer, uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z);
+    void (*vkCmdPipelineBarrier)(VkCommandBuffer command_buffer, VkFlags src_stage_mask, VkFlags dst_stage_mask, VkFlags dependency_flags, uint32_t memory_barrier_count, const VkMemoryBarrier *memory_barriers, uint32_t buffer_memory_barrier_count, const void *buffer_memory_barriers, uint32_t image_memory_barrier_count, const void *image_memory_barriers);
+    VkResult (*vkQueueSubmit)(VkQueue queue, uint32_t submit_count, const VkSubmitInfo *submits, VkFence fence);
+    VkResult (*vkCreateFence)(VkDevice device, const VkFenceCreateInfo *create_info, const void *allocator, VkFence *fence);
+    void (*vkDestroyFence)(VkDevice device, VkFence fence, const void *allocator);
+    VkResult (*vkWaitForFences)(VkDevice device, uint32_t fence_count, const VkFence *fences, VkBool32 wait_all, uint64_t timeout);
+    VkResult (*vkResetFences)(VkDevice device, uint32_t fence_count, const VkFence *fences);
+
+    /* Only set if |dma_buf_import_supported| */
+    VkResult (*vkGetMemoryFdPropertiesKHR)(VkDevice device, VkFlags handle_type, int fd, VkMemoryFdPropertiesKHR *memory_fd_properties);
+} gsr_vulkan;
+
+typedef struct {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    uint64_t size;
+    void *mapped; /* NULL for imported dma-bufs */
+} gsr_vulkan_buffer;
+
+/*
+    Loads libvulkan.so.1 and creates a device on the first physical device that has a compute queue.
+    Set VK_ICD_FILENAMES to choose the driver, for example mesa lavapipe (lvp_icd.x86_64.json) to run without a gpu.
+*/
+bool gsr_vulkan_load(gsr_vulkan *self);
+void gsr_vulkan_unload(gsr_vulkan *self);
+
+/* Creates a host visible buffer that can be used as a storage buffer. |buffer->mapped| points to its memory */
+bool gsr_vulkan_buffer_create(gsr_vulkan *self, gsr_vulkan_buffer *buffer, uint64_t size);
+/* Imports a linear dma-buf as a storage buffer. |fd| is duplicated, so the caller still owns it. Requires |dma_buf_import_supported| */
+bool gsr_vulkan_buffer_import_dma_buf(gsr_vulkan *self, gsr_vulkan_buffer *buffer, int fd, uint64_t size);
+void gsr_vulkan_buffer_destroy(gsr_vulkan *self, gsr_vulkan_buffer *buffer);
+
+#endif /* GSR_VULKAN_H */
@@ -0,0 +1,67 @@
+#ifndef GSR_VULKAN_COLOR_CONVERSION_H
+#define GSR_VULKAN_COLOR_CONVERSION_H
+
+#include "vulkan.h"
+#include "color_conversion.h"
+#include "vec2.h"
+
+/*
+    Color conversion with a vulkan compute shader, an alternative to the opengl shaders in color_conversion.c.
+    The source (a linear rgba8/bgra8 dma-buf, or host memory) is scaled to the destination region with bilinear filtering, the cursor is blended on top
+    and both planes of the nv12/p010 destination are written in one dispatch. Everything outside of the destination region is black.
+    Only needs a vulkan device with a compute queue, so it can run on mesa lavapipe without a gpu.
+*/
+
+typedef struct {
+    gsr_vulkan_buffer *buffer;
+    int offset; /* In bytes, has to be a multiple of 4 */
+    int pitch;  /* In bytes, has to be a multiple of 4 */
+    vec2i size; /* Size of the whole image */
+    bool bgra;  /* b, g, r, a in memory order instead of r, g, b, a */
+} gsr_vulkan_source_image;
+
+typedef struct {
+    gsr_vulkan_source_image source;
+    vec2i source_pos;       /* Region of |source| to draw */
+    vec2i source_size;
+    vec2i destination_pos;  /* |source_size| is scaled to |destination_size| */
+    vec2i destination_size;
+    gsr_vulkan_source_image cursor; /* No cursor if |cursor.buffer| is NULL */
+    vec2i cursor_pos;       /* Position in the destination. The cursor is not scaled */
+} gsr_vulkan_color_conversion_layer;
+
+typedef struct {
+    gsr_vulkan_buffer *buffer;
+    int y_offset;  /* In bytes, has to be a multiple of 4 */
+    int y_pitch;   /* In bytes, has to be a multiple of 4 */
+    int uv_offset; /* In bytes, has to be a multiple of 4 */
+    int uv_pitch;  /* In bytes, has to be a multiple of 4 */
+    vec2i size;    /* Has to be even. The pitches have to fit the width rounded up to a multiple of 4 */
+} gsr_vulkan_destination_image;
+
+typedef struct {
+    gsr_vulkan *vulkan;
+    gsr_destination_color destination_color; /* nv12 or p010 */
+    gsr_color_range color_range;
+} gsr_vulkan_color_conversion_params;
+
+typedef struct {
+    gsr_vulkan_color_conversion_params params;
+    VkDescriptorSetLayout descriptor_set_layout;
+    VkPipelineLayout pipeline_layout;
+    VkPipeline pipeline;
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSet descriptor_set;
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    gsr_vulkan_buffer no_cursor_buffer;
+} gsr_vulkan_color_conversion;
+
+int gsr_vulkan_color_conversion_init(gsr_vulkan_color_conversion *self, const gsr_vulkan_color_conversion_params *params);
+void gsr_vulkan_color_conversion_deinit(gsr_vulkan_color_conversion *self);
+
+/* Converts |layer| into |destination| and waits until the conversion has finished. Returns 0 on success */
+int gsr_vulkan_color_conversion_convert(gsr_vulkan_color_conversion *self, const gsr_vulkan_color_conversion_layer *layer, const gsr_vulkan_destination_image *destination);
+
+#endif /* GSR_VULKAN_COLOR_CONVERSION_H */
@@ -0,0 +1,87 @@
+#include "../include/adaptive_bitrate.h"
+#include <string.h>
+
+#define UPDATE_INTERVAL_SECONDS 0.5
+/* Wait for the previous decrease to have an effect on the queue before decreasing again */
+#define DECREASE_INTERVAL_SECONDS 1.0
+#define INCREASE_INTERVAL_SECONDS 2.0
+/* How long the connection has to keep up before increasing the bitrate or framerate again */
+#define STABLE_SECONDS_BEFORE_INCREASE 5.0
+#define MIN_FPS 15
+
+void gsr_adaptive_bitrate_init(gsr_adaptive_bitrate *self, int64_t min_bitrate, int64_t max_bitrate, int fps, double time_now) {
+    memset(self, 0, sizeof(*self));
+    self->min_bitrate = min_bitrate;
+    self->max_bitrate = max_bitrate;
+    self->bitrate = max_bitrate;
+    self->fps_divider = 1;
+    self->max_fps_divider = 1;
+    while(self->max_fps_divider < 4 && fps / (self->max_fps_divider * 2) >= MIN_FPS)
+        self->max_fps_divider *= 2;
+
+    self->last_update_time = time_now;
+    self->last_decrease_time = time_now;
+    self->last_increase_time = time_now;
+    self->stable_start_time = time_now;
+}
+
+static void adaptive_bitrate_decrease(gsr_adaptive_bitrate *self, const gsr_network_output_stats *stats) {
+    if(self->bitrate > self->min_bitrate) {
+        /* Go below the measured throughput so that the queue can drain */
+        int64_t new_bitrate = self->bitrate * 7 / 10;
+        const int64_t throughput_bitrate = (int64_t)(stats->send_bytes_per_second * 8.0 * 0.85);
+        if(throughput_bitrate > 0 && throughput_bitrate < new_bitrate)
+            new_bitrate = throughput_bitrate;
+
+        if(new_bitrate < self->min_bitrate)
+            new_bitrate = self->min_bitrate;
+        self->bitrate = new_bitrate;
+    } else if(self->fps_divider < self->max_fps_divider) {
+        self->fps_divider *= 2;
+    }
+}
+
+static void adaptive_bitrate_increase(gsr_adaptive_bitrate *self) {
+    /* Restore the framerate first, frame drops are more noticeable than lower quality */
+    if(self->fps_divider > 1) {
+        self->fps_divider /= 2;
+    } else if(self->bitrate < self->max_bitrate) {
+        int64_t increase = self->bitrate / 10;
+        if(increase < 100000)
+            increase = 100000;
+
+        self->bitrate += increase;
+        if(self->bitrate > self->max_bitrate)
+            self->bitrate = self->max_bitrate;
+    }
+}
+
+bool gsr_adaptive_bitrate_update(gsr_adaptive_bitrate *self, const gsr_network_output_stats *stats, double max_queue_latency_seconds, double time_now) {
+    if(time_now - self->last_update_time < UPDATE_INTERVAL_SECONDS)
+        return false;
+    self->last_update_time = time_now;
+
+    const int64_t prev_bitrate = self->bitrate;
+    const int prev_fps_divider = self->fps_divider;
+
+    /* Act long before the network output has to drop packets, at a quarter of the allowed latency */
+    const bool dropped_packets = stats->num_dropped_packets != self->prev_num_dropped_packets;
+    self->prev_num_dropped_packets = stats->num_dropped_packets;
+    const bool congested = dropped_packets || stats->queue_latency_seconds > max_queue_latency_seconds * 0.25;
+    const bool idle = stats->queue_latency_seconds < max_queue_latency_seconds * 0.1;
+
+    if(congested) {
+        self->stable_start_time = time_now;
+        if(time_now - self->last_decrease_time >= DECREASE_INTERVAL_SECONDS) {
+            adaptive_bitrate_decrease(self, stats);
+            self->last_decrease_time = time_now;
+        }
+    } else if(!idle) {
+        self->stable_start_time = time_now;
+    } else if(time_now - self->stable_start_time >= STABLE_SECONDS_BEFORE_INCREASE && time_now - self->last_increase_time >= INCREASE_INTERVAL_SECONDS) {
+        adaptive_bitrate_increase(self);
+        self->last_increase_time = time_now;
+    }
+
+    return self->bitrate != prev_bitrate || self->fps_divider != prev_fps_divider;
+}
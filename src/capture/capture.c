@@ -54,6 +54,18 @@ void gsr_capture_end(gsr_capture *cap, AVFrame *frame) {
     cap->capture_end(cap, frame);
 }
 
+bool gsr_capture_get_cursor_position(gsr_capture *cap, vec2i *position) {
+    if(!cap->started) {
+        fprintf(stderr, "gsr error: gsr_capture_get_cursor_position failed: the gsr capture has not been started\n");
+        return false;
+    }
+
+    if(!cap->get_cursor_position)
+        return false;
+
+    return cap->get_cursor_position(cap, position);
+}
+
 void gsr_capture_destroy(gsr_capture *cap, AVCodecContext *video_codec_context) {
     cap->destroy(cap, video_codec_context);
 }
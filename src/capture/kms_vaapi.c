@@ -48,6 +48,9 @@ typedef struct {
     AVContentLightMetadata *light_metadata;
 
     gsr_monitor_rotation monitor_rotation;
+
+    vec2i cursor_position;
+    bool cursor_visible;
 } gsr_capture_kms_vaapi;
 
 static int max_int(int a, int b) {
@@ -469,6 +472,7 @@ static int gsr_capture_kms_vaapi_capture(gsr_capture *cap, AVFrame *frame) {
     gsr_kms_response_fd *drm_fd = NULL;
     gsr_kms_response_fd *cursor_drm_fd = NULL;
     bool capture_is_combined_plane = false;
+    cap_kms->cursor_visible = false;
 
     if(gsr_kms_client_get_kms(&cap_kms->kms_client, &cap_kms->kms_response) != 0) {
         fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_capture: failed to get kms, error: %d (%s)\n", cap_kms->kms_response.result, cap_kms->kms_response.err_msg);
@@ -556,10 +560,20 @@ static int gsr_capture_kms_vaapi_capture(gsr_capture *cap, AVFrame *frame) {
 
     const float texture_rotation = monitor_rotation_to_radians(cap_kms->monitor_rotation);
 
-    gsr_color_conversion_draw(&cap_kms->color_conversion, cap_kms->input_texture,
-        (vec2i){0, 0}, cap_kms->capture_size,
-        capture_pos, cap_kms->capture_size,
-        texture_rotation, false);
+    /* The screen and the cursor are drawn in one batch */
+    gsr_color_conversion_layer layers[2];
+    int num_layers = 0;
+
+    layers[num_layers++] = (gsr_color_conversion_layer){
+        .texture_id = cap_kms->input_texture,
+        .source_pos = (vec2i){0, 0},
+        .source_size = cap_kms->capture_size,
+        .texture_pos = capture_pos,
+        .texture_size = cap_kms->capture_size,
+        .texture_full_size = (vec2i){drm_fd->width, drm_fd->height},
+        .rotation = texture_rotation,
+        .external_texture = false
+    };
 
     if(cursor_drm_fd) {
         const vec2i cursor_size = {cursor_drm_fd->width, cursor_drm_fd->height};
@@ -606,12 +620,22 @@ static int gsr_capture_kms_vaapi_capture(gsr_capture *cap, AVFrame *frame) {
         cap_kms->params.egl->eglDestroyImage(cap_kms->params.egl->egl_display, cursor_image);
         cap_kms->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
 
-        gsr_color_conversion_draw(&cap_kms->color_conversion, cap_kms->cursor_texture,
-            cursor_pos, cursor_size,
-            (vec2i){0, 0}, cursor_size,
-            texture_rotation, false);
+        cap_kms->cursor_position = cursor_pos;
+        cap_kms->cursor_visible = true;
+
+        layers[num_layers++] = (gsr_color_conversion_layer){
+            .texture_id = cap_kms->cursor_texture,
+            .source_pos = cursor_pos,
+            .source_size = cursor_size,
+            .texture_pos = (vec2i){0, 0},
+            .texture_size = cursor_size,
+            .rotation = texture_rotation,
+            .external_texture = false
+        };
     }
 
+    gsr_color_conversion_draw_layers(&cap_kms->color_conversion, layers, num_layers);
+
     cap_kms->params.egl->eglSwapBuffers(cap_kms->params.egl->egl_display, cap_kms->params.egl->egl_surface);
     //cap_kms->params.egl->glFlush();
     //cap_kms->params.egl->glFinish();
@@ -619,6 +643,12 @@ static int gsr_capture_kms_vaapi_capture(gsr_capture *cap, AVFrame *frame) {
     return 0;
 }
 
+static bool gsr_capture_kms_vaapi_get_cursor_position(gsr_capture *cap, vec2i *position) {
+    gsr_capture_kms_vaapi *cap_kms = cap->priv;
+    *position = cap_kms->cursor_position;
+    return cap_kms->cursor_visible;
+}
+
 static void gsr_capture_kms_vaapi_capture_end(gsr_capture *cap, AVFrame *frame) {
     (void)frame;
     gsr_capture_kms_vaapi *cap_kms = cap->priv;
@@ -720,6 +750,7 @@ gsr_capture* gsr_capture_kms_vaapi_create(const gsr_capture_kms_vaapi_params *pa
         .should_stop = gsr_capture_kms_vaapi_should_stop,
         .capture = gsr_capture_kms_vaapi_capture,
         .capture_end = gsr_capture_kms_vaapi_capture_end,
+        .get_cursor_position = gsr_capture_kms_vaapi_get_cursor_position,
         .destroy = gsr_capture_kms_vaapi_destroy,
         .priv = cap_kms
     };
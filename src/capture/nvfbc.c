@@ -25,6 +25,9 @@ typedef struct {
 
     gsr_cuda cuda;
     bool frame_initialized;
+
+    vec2i tracking_pos; /* Position of the captured display on the x11 screen */
+    vec2i tracking_size;
 } gsr_capture_nvfbc;
 
 #if defined(_WIN64) || defined(__LP64__)
@@ -39,12 +42,14 @@ static int max_int(int a, int b) {
 }
 
 /* Returns 0 on failure */
-static uint32_t get_output_id_from_display_name(NVFBC_RANDR_OUTPUT_INFO *outputs, uint32_t num_outputs, const char *display_name, uint32_t *width, uint32_t *height) {
+static uint32_t get_output_id_from_display_name(NVFBC_RANDR_OUTPUT_INFO *outputs, uint32_t num_outputs, const char *display_name, vec2i *pos, uint32_t *width, uint32_t *height) {
     if(!outputs)
         return 0;
 
     for(uint32_t i = 0; i < num_outputs; ++i) {
         if(strcmp(outputs[i].name, display_name) == 0) {
+            pos->x = outputs[i].trackedBox.x;
+            pos->y = outputs[i].trackedBox.y;
             *width = outputs[i].trackedBox.w;
             *height = outputs[i].trackedBox.h;
             return outputs[i].dwId;
@@ -283,7 +288,7 @@ static int gsr_capture_nvfbc_start(gsr_capture *cap, AVCodecContext *video_codec
             goto error_cleanup;
         }
 
-        output_id = get_output_id_from_display_name(status_params.outputs, status_params.dwOutputNum, cap_nvfbc->params.display_to_capture, &tracking_width, &tracking_height);
+        output_id = get_output_id_from_display_name(status_params.outputs, status_params.dwOutputNum, cap_nvfbc->params.display_to_capture, &cap_nvfbc->tracking_pos, &tracking_width, &tracking_height);
         if(output_id == 0) {
             fprintf(stderr, "gsr error: gsr_capture_nvfbc_start failed: display '%s' not found\n", cap_nvfbc->params.display_to_capture);
             goto error_cleanup;
@@ -326,9 +331,13 @@ static int gsr_capture_nvfbc_start(gsr_capture *cap, AVCodecContext *video_codec
     if(capture_region) {
         video_codec_context->width = width & ~1;
         video_codec_context->height = height & ~1;
+        cap_nvfbc->tracking_pos.x += x;
+        cap_nvfbc->tracking_pos.y += y;
+        cap_nvfbc->tracking_size = (vec2i){ width, height };
     } else {
         video_codec_context->width = tracking_width & ~1;
         video_codec_context->height = tracking_height & ~1;
+        cap_nvfbc->tracking_size = (vec2i){ tracking_width, tracking_height };
     }
 
     if(!ffmpeg_create_cuda_contexts(cap_nvfbc, video_codec_context))
@@ -399,6 +408,27 @@ static void gsr_capture_nvfbc_tick(gsr_capture *cap, AVCodecContext *video_codec
     }
 }
 
+static bool gsr_capture_nvfbc_get_cursor_position(gsr_capture *cap, vec2i *position) {
+    gsr_capture_nvfbc *cap_nvfbc = cap->priv;
+
+    Window root_window = None;
+    Window child_window = None;
+    int root_x = 0;
+    int root_y = 0;
+    int window_x = 0;
+    int window_y = 0;
+    unsigned int mask = 0;
+    if(!XQueryPointer(cap_nvfbc->params.dpy, DefaultRootWindow(cap_nvfbc->params.dpy), &root_window, &child_window, &root_x, &root_y, &window_x, &window_y, &mask))
+        return false;
+
+    const vec2i pos = {root_x - cap_nvfbc->tracking_pos.x, root_y - cap_nvfbc->tracking_pos.y};
+    if(pos.x < 0 || pos.y < 0 || pos.x >= cap_nvfbc->tracking_size.x || pos.y >= cap_nvfbc->tracking_size.y)
+        return false;
+
+    *position = pos;
+    return true;
+}
+
 static int gsr_capture_nvfbc_capture(gsr_capture *cap, AVFrame *frame) {
     gsr_capture_nvfbc *cap_nvfbc = cap->priv;
 
@@ -494,6 +524,7 @@ gsr_capture* gsr_capture_nvfbc_create(const gsr_capture_nvfbc_params *params) {
         .should_stop = NULL,
         .capture = gsr_capture_nvfbc_capture,
         .capture_end = NULL,
+        .get_cursor_position = gsr_capture_nvfbc_get_cursor_position,
         .destroy = gsr_capture_nvfbc_destroy,
         .priv = cap_nvfbc
     };
@@ -0,0 +1,967 @@
+#include "../../include/capture/portal.h"
+#include "../../include/dbus.h"
+#include "../../include/pipewire_library.h"
+#include "../../include/utils.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/hwcontext_vaapi.h>
+#include <libavutil/frame.h>
+#include <libavcodec/avcodec.h>
+#include <va/va.h>
+#include <va/va_drmcommon.h>
+
+#include <spa/param/video/format-utils.h>
+#include <spa/param/buffers.h>
+#include <spa/pod/builder.h>
+#include <spa/buffer/buffer.h>
+
+#define DRM_FORMAT_MOD_INVALID 0xffffffffffffffULL
+#define GSR_PORTAL_MAX_MODIFIERS 64
+#define GSR_PORTAL_MAX_BUFFERS 32
+#define GSR_PORTAL_MAX_PLANES 4
+
+typedef struct {
+    enum spa_video_format spa_format;
+    unsigned int gl_format; /* For memory (shm) buffers */
+} gsr_portal_video_format;
+
+static uint32_t fourcc(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    return (d << 24) | (c << 16) | (b << 8) | a;
+}
+
+/* Alpha is ignored when drawing the frame, so the x and a variants are treated the same */
+static const gsr_portal_video_format video_formats[] = {
+    { SPA_VIDEO_FORMAT_BGRx, GL_BGRA },
+    { SPA_VIDEO_FORMAT_BGRA, GL_BGRA },
+    { SPA_VIDEO_FORMAT_RGBx, GL_RGBA },
+    { SPA_VIDEO_FORMAT_RGBA, GL_RGBA },
+};
+#define NUM_VIDEO_FORMATS (sizeof(video_formats) / sizeof(video_formats[0]))
+
+static uint32_t spa_video_format_to_drm_format(enum spa_video_format format) {
+    switch(format) {
+        case SPA_VIDEO_FORMAT_BGRx: return fourcc('X', 'R', '2', '4');
+        case SPA_VIDEO_FORMAT_BGRA: return fourcc('A', 'R', '2', '4');
+        case SPA_VIDEO_FORMAT_RGBx: return fourcc('X', 'B', '2', '4');
+        case SPA_VIDEO_FORMAT_RGBA: return fourcc('A', 'B', '2', '4');
+        default: return 0;
+    }
+}
+
+static unsigned int spa_video_format_to_gl_format(enum spa_video_format format) {
+    for(size_t i = 0; i < NUM_VIDEO_FORMATS; ++i) {
+        if(video_formats[i].spa_format == format)
+            return video_formats[i].gl_format;
+    }
+    return GL_BGRA;
+}
+
+/* A pipewire dma-buf buffer that has been imported as a texture. Pipewire reuses the same buffers, so each of them is only imported once */
+typedef struct {
+    struct pw_buffer *buffer;
+    unsigned int texture;
+} gsr_portal_buffer_texture;
+
+typedef struct {
+    gsr_capture_portal_params params;
+
+    bool should_stop;
+    bool stop_is_error;
+    bool created_hw_frame;
+
+    gsr_dbus dbus;
+    bool dbus_initialized;
+    char *session_handle;
+
+    gsr_pipewire_library pw;
+    struct pw_thread_loop *thread_loop;
+    struct pw_context *context;
+    struct pw_core *core;
+    struct pw_stream *stream;
+    struct spa_hook stream_listener;
+
+    /* These are accessed by the pipewire thread as well, the thread loop has to be locked when accessing them from the capture thread */
+    enum pw_stream_state stream_state;
+    bool negotiated;
+    struct spa_video_info_raw video_info;
+    bool has_modifier;
+    uint64_t modifiers[NUM_VIDEO_FORMATS][GSR_PORTAL_MAX_MODIFIERS];
+    int num_modifiers[NUM_VIDEO_FORMATS];
+    struct pw_buffer *pending_buffer; /* The newest buffer from pipewire that hasn't been drawn yet */
+    struct pw_buffer *current_buffer; /* The buffer that is drawn, it's held until a newer buffer arrives */
+    gsr_portal_buffer_texture buffer_textures[GSR_PORTAL_MAX_BUFFERS];
+    int num_buffer_textures;
+    unsigned int removed_textures[GSR_PORTAL_MAX_BUFFERS]; /* Textures of buffers that pipewire removed. Deleted in the capture thread since that is where the gl context is */
+    int num_removed_textures;
+
+    unsigned int shm_texture;
+    vec2i shm_texture_size; /* The storage of |shm_texture| is only allocated again when the size changes */
+    unsigned int current_texture;
+    vec2i current_size;
+
+    VADisplay va_dpy;
+    VADRMPRIMESurfaceDescriptor prime;
+    unsigned int target_textures[2];
+    gsr_color_conversion color_conversion;
+
+    vec2i capture_size;
+} gsr_capture_portal;
+
+static int max_int(int a, int b) {
+    return a > b ? a : b;
+}
+
+static void gsr_capture_portal_stop(gsr_capture *cap, AVCodecContext *video_codec_context);
+
+static bool drm_create_codec_context(gsr_capture_portal *cap_portal, AVCodecContext *video_codec_context) {
+    char render_path[128];
+    if(!gsr_card_path_get_render_path(cap_portal->params.egl->card_path, render_path)) {
+        fprintf(stderr, "gsr error: failed to get /dev/dri/renderDXXX file from %s\n", cap_portal->params.egl->card_path);
+        return false;
+    }
+
+    AVBufferRef *device_ctx;
+    if(av_hwdevice_ctx_create(&device_ctx, AV_HWDEVICE_TYPE_VAAPI, render_path, NULL, 0) < 0) {
+        fprintf(stderr, "Error: Failed to create hardware device context\n");
+        return false;
+    }
+
+    AVBufferRef *frame_context = av_hwframe_ctx_alloc(device_ctx);
+    if(!frame_context) {
+        fprintf(stderr, "Error: Failed to create hwframe context\n");
+        av_buffer_unref(&device_ctx);
+        return false;
+    }
+
+    AVHWFramesContext *hw_frame_context =
+        (AVHWFramesContext *)frame_context->data;
+    hw_frame_context->width = video_codec_context->width;
+    hw_frame_context->height = video_codec_context->height;
+    hw_frame_context->sw_format = cap_portal->params.hdr ? AV_PIX_FMT_P010LE : AV_PIX_FMT_NV12;
+    hw_frame_context->format = video_codec_context->pix_fmt;
+    hw_frame_context->device_ref = device_ctx;
+    hw_frame_context->device_ctx = (AVHWDeviceContext*)device_ctx->data;
+
+    hw_frame_context->initial_pool_size = 1;
+
+    AVVAAPIDeviceContext *vactx =((AVHWDeviceContext*)device_ctx->data)->hwctx;
+    cap_portal->va_dpy = vactx->display;
+
+    if (av_hwframe_ctx_init(frame_context) < 0) {
+        fprintf(stderr, "Error: Failed to initialize hardware frame context "
+                        "(note: ffmpeg version needs to be > 4.0)\n");
+        av_buffer_unref(&device_ctx);
+        //av_buffer_unref(&frame_context);
+        return false;
+    }
+
+    video_codec_context->hw_device_ctx = av_buffer_ref(device_ctx);
+    video_codec_context->hw_frames_ctx = av_buffer_ref(frame_context);
+    return true;
+}
+
+/* Queries the modifiers that the gpu can import for each format. DRM_FORMAT_MOD_INVALID (implicit modifier) is always supported */
+static void gsr_capture_portal_query_modifiers(gsr_capture_portal *cap_portal) {
+    gsr_egl *egl = cap_portal->params.egl;
+    for(size_t i = 0; i < NUM_VIDEO_FORMATS; ++i) {
+        cap_portal->num_modifiers[i] = 0;
+        if(egl->eglQueryDmaBufModifiersEXT) {
+            uint64_t modifiers[GSR_PORTAL_MAX_MODIFIERS];
+            unsigned int external_only[GSR_PORTAL_MAX_MODIFIERS];
+            int32_t num_modifiers = 0;
+            const int32_t drm_format = spa_video_format_to_drm_format(video_formats[i].spa_format);
+            if(egl->eglQueryDmaBufModifiersEXT(egl->egl_display, drm_format, GSR_PORTAL_MAX_MODIFIERS - 1, modifiers, external_only, &num_modifiers)) {
+                for(int32_t j = 0; j < num_modifiers; ++j) {
+                    /* External only images can't be bound to GL_TEXTURE_2D */
+                    if(!external_only[j])
+                        cap_portal->modifiers[i][cap_portal->num_modifiers[i]++] = modifiers[j];
+                }
+            }
+        }
+        cap_portal->modifiers[i][cap_portal->num_modifiers[i]++] = DRM_FORMAT_MOD_INVALID;
+    }
+}
+
+/*
+    Builds an EnumFormat param for |format|. If |modifiers| is not NULL then the format is for dma-buf buffers with one of the modifiers,
+    otherwise the format is for memory buffers.
+*/
+static struct spa_pod* gsr_capture_portal_build_format(gsr_capture_portal *cap_portal, struct spa_pod_builder *builder, enum spa_video_format format, const uint64_t *modifiers, int num_modifiers) {
+    struct spa_pod_frame object_frame;
+    spa_pod_builder_push_object(builder, &object_frame, SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
+    spa_pod_builder_add(builder, SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video), 0);
+    spa_pod_builder_add(builder, SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw), 0);
+    spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_format, SPA_POD_Id(format), 0);
+
+    if(modifiers && num_modifiers > 0) {
+        if(num_modifiers == 1) {
+            spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY);
+            spa_pod_builder_long(builder, modifiers[0]);
+        } else {
+            /* The producer picks the modifiers it can use and then we fixate one of them */
+            struct spa_pod_frame choice_frame;
+            spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY | SPA_POD_PROP_FLAG_DONT_FIXATE);
+            spa_pod_builder_push_choice(builder, &choice_frame, SPA_CHOICE_Enum, 0);
+            spa_pod_builder_long(builder, modifiers[0]); /* default */
+            for(int i = 0; i < num_modifiers; ++i) {
+                spa_pod_builder_long(builder, modifiers[i]);
+            }
+            spa_pod_builder_pop(builder, &choice_frame);
+        }
+    }
+
+    struct spa_rectangle default_size = SPA_RECTANGLE(1920, 1080);
+    struct spa_rectangle min_size = SPA_RECTANGLE(1, 1);
+    struct spa_rectangle max_size = SPA_RECTANGLE(16384, 16384);
+    struct spa_fraction default_framerate = SPA_FRACTION(cap_portal->params.fps, 1);
+    struct spa_fraction min_framerate = SPA_FRACTION(0, 1);
+    struct spa_fraction max_framerate = SPA_FRACTION(1000, 1);
+    spa_pod_builder_add(builder,
+        SPA_FORMAT_VIDEO_size, SPA_POD_CHOICE_RANGE_Rectangle(&default_size, &min_size, &max_size),
+        SPA_FORMAT_VIDEO_framerate, SPA_POD_CHOICE_RANGE_Fraction(&default_framerate, &min_framerate, &max_framerate),
+        0);
+    return (struct spa_pod*)spa_pod_builder_pop(builder, &object_frame);
+}
+
+/* dma-buf formats first since pipewire picks the first format that the producer supports */
+static int gsr_capture_portal_build_formats(gsr_capture_portal *cap_portal, struct spa_pod_builder *builder, const struct spa_pod **params) {
+    int num_params = 0;
+    for(size_t i = 0; i < NUM_VIDEO_FORMATS; ++i) {
+        params[num_params++] = gsr_capture_portal_build_format(cap_portal, builder, video_formats[i].spa_format, cap_portal->modifiers[i], cap_portal->num_modifiers[i]);
+    }
+    for(size_t i = 0; i < NUM_VIDEO_FORMATS; ++i) {
+        params[num_params++] = gsr_capture_portal_build_format(cap_portal, builder, video_formats[i].spa_format, NULL, 0);
+    }
+    return num_params;
+}
+
+static void on_state_changed(void *userdata, enum pw_stream_state old, enum pw_stream_state state, const char *error) {
+    (void)old;
+    gsr_capture_portal *cap_portal = userdata;
+    cap_portal->stream_state = state;
+    if(state == PW_STREAM_STATE_ERROR)
+        fprintf(stderr, "gsr error: pipewire video stream failed, error: %s\n", error ? error : "(null)");
+    cap_portal->pw.pw_thread_loop_signal(cap_portal->thread_loop, false);
+}
+
+/* Picks the first modifier that the producer offered and renegotiates with only that modifier */
+static void gsr_capture_portal_fixate_modifier(gsr_capture_portal *cap_portal, const struct spa_pod_prop *modifier_prop) {
+    uint32_t num_values = 0;
+    uint32_t choice = 0;
+    const struct spa_pod *values_pod = spa_pod_get_values(&modifier_prop->value, &num_values, &choice);
+    if(num_values == 0 || values_pod->type != SPA_TYPE_Long)
+        return;
+
+    const uint64_t *values = SPA_POD_BODY(values_pod);
+    const uint64_t modifier = values[0];
+
+    uint8_t params_buffer[4096];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(params_buffer, sizeof(params_buffer));
+    const struct spa_pod *params[NUM_VIDEO_FORMATS + 1];
+    int num_params = 0;
+    params[num_params++] = gsr_capture_portal_build_format(cap_portal, &builder, cap_portal->video_info.format, &modifier, 1);
+    /* Memory buffers as a fallback in case the producer can't allocate buffers with the modifier */
+    params[num_params++] = gsr_capture_portal_build_format(cap_portal, &builder, cap_portal->video_info.format, NULL, 0);
+    cap_portal->pw.pw_stream_update_params(cap_portal->stream, params, num_params);
+}
+
+static void on_param_changed(void *userdata, uint32_t id, const struct spa_pod *param) {
+    gsr_capture_portal *cap_portal = userdata;
+    if(!param || id != SPA_PARAM_Format)
+        return;
+
+    uint32_t media_type = 0;
+    uint32_t media_subtype = 0;
+    if(spa_format_parse(param, &media_type, &media_subtype) < 0 || media_type != SPA_MEDIA_TYPE_video || media_subtype != SPA_MEDIA_SUBTYPE_raw)
+        return;
+
+    memset(&cap_portal->video_info, 0, sizeof(cap_portal->video_info));
+    if(spa_format_video_raw_parse(param, &cap_portal->video_info) < 0) {
+        fprintf(stderr, "gsr error: on_param_changed: failed to parse the video format\n");
+        return;
+    }
+
+    const struct spa_pod_prop *modifier_prop = spa_pod_find_prop(param, NULL, SPA_FORMAT_VIDEO_modifier);
+    if(modifier_prop && (modifier_prop->flags & SPA_POD_PROP_FLAG_DONT_FIXATE)) {
+        gsr_capture_portal_fixate_modifier(cap_portal, modifier_prop);
+        return;
+    }
+
+    cap_portal->has_modifier = modifier_prop != NULL;
+
+    uint8_t params_buffer[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(params_buffer, sizeof(params_buffer));
+    const int data_types = cap_portal->has_modifier ? (1 << SPA_DATA_DmaBuf) : ((1 << SPA_DATA_MemFd) | (1 << SPA_DATA_MemPtr));
+    const struct spa_pod *params[1];
+    params[0] = spa_pod_builder_add_object(&builder,
+        SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+        SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(data_types));
+    cap_portal->pw.pw_stream_update_params(cap_portal->stream, params, 1);
+
+    fprintf(stderr, "gsr info: pipewire video stream: %ux%u, format: %u, %s\n", cap_portal->video_info.size.width, cap_portal->video_info.size.height,
+        cap_portal->video_info.format, cap_portal->has_modifier ? "dma-buf" : "shared memory");
+
+    cap_portal->negotiated = true;
+    cap_portal->pw.pw_thread_loop_signal(cap_portal->thread_loop, false);
+}
+
+static void on_remove_buffer(void *userdata, struct pw_buffer *buffer) {
+    gsr_capture_portal *cap_portal = userdata;
+    if(cap_portal->pending_buffer == buffer)
+        cap_portal->pending_buffer = NULL;
+    if(cap_portal->current_buffer == buffer)
+        cap_portal->current_buffer = NULL;
+
+    for(int i = 0; i < cap_portal->num_buffer_textures; ++i) {
+        if(cap_portal->buffer_textures[i].buffer == buffer) {
+            cap_portal->removed_textures[cap_portal->num_removed_textures++] = cap_portal->buffer_textures[i].texture;
+            cap_portal->buffer_textures[i] = cap_portal->buffer_textures[cap_portal->num_buffer_textures - 1];
+            --cap_portal->num_buffer_textures;
+            break;
+        }
+    }
+}
+
+/*
+    Only the newest buffer is kept, older buffers that haven't been drawn are given back to the producer right away.
+    Buffers without video data (mutter sends those when only the cursor or metadata has changed) are given back as well.
+*/
+static void on_process(void *userdata) {
+    gsr_capture_portal *cap_portal = userdata;
+
+    struct pw_buffer *newest_buffer = NULL;
+    struct pw_buffer *buffer = NULL;
+    while((buffer = cap_portal->pw.pw_stream_dequeue_buffer(cap_portal->stream))) {
+        const struct spa_data *data = &buffer->buffer->datas[0];
+        if(!data->chunk || data->chunk->size == 0 || (data->chunk->flags & SPA_CHUNK_FLAG_CORRUPTED)) {
+            cap_portal->pw.pw_stream_queue_buffer(cap_portal->stream, buffer);
+            continue;
+        }
+
+        if(newest_buffer)
+            cap_portal->pw.pw_stream_queue_buffer(cap_portal->stream, newest_buffer);
+        newest_buffer = buffer;
+    }
+
+    if(!newest_buffer)
+        return;
+
+    if(cap_portal->pending_buffer)
+        cap_portal->pw.pw_stream_queue_buffer(cap_portal->stream, cap_portal->pending_buffer);
+    cap_portal->pending_buffer = newest_buffer;
+}
+
+static const struct pw_stream_events stream_events = {
+    .version = PW_VERSION_STREAM_EVENTS,
+    .state_changed = on_state_changed,
+    .param_changed = on_param_changed,
+    .remove_buffer = on_remove_buffer,
+    .process = on_process,
+};
+
+static int gsr_capture_portal_setup_dbus(gsr_capture_portal *cap_portal, int *pipewire_fd, uint32_t *pipewire_node) {
+    *pipewire_fd = -1;
+    *pipewire_node = 0;
+
+    if(!gsr_dbus_init(&cap_portal->dbus))
+        return -1;
+    cap_portal->dbus_initialized = true;
+
+    fprintf(stderr, "gsr info: gsr_capture_portal_setup_dbus: CreateSession\n");
+    if(gsr_dbus_screencast_create_session(&cap_portal->dbus, &cap_portal->session_handle) != 0)
+        return -1;
+
+    fprintf(stderr, "gsr info: gsr_capture_portal_setup_dbus: SelectSources\n");
+    if(gsr_dbus_screencast_select_sources(&cap_portal->dbus, cap_portal->session_handle, GSR_PORTAL_CAPTURE_TYPE_MONITOR | GSR_PORTAL_CAPTURE_TYPE_WINDOW, GSR_PORTAL_CURSOR_MODE_EMBEDDED) != 0)
+        return -1;
+
+    fprintf(stderr, "gsr info: gsr_capture_portal_setup_dbus: Start\n");
+    if(gsr_dbus_screencast_start(&cap_portal->dbus, cap_portal->session_handle, pipewire_node) != 0)
+        return -1;
+
+    fprintf(stderr, "gsr info: gsr_capture_portal_setup_dbus: OpenPipeWireRemote\n");
+    if(gsr_dbus_screencast_open_pipewire_remote(&cap_portal->dbus, cap_portal->session_handle, pipewire_fd) != 0)
+        return -1;
+
+    return 0;
+}
+
+/* Takes ownership of |pipewire_fd|. If |pipewire_fd| is -1 then the local pipewire instance is used */
+static int gsr_capture_portal_setup_pipewire(gsr_capture_portal *cap_portal, int pipewire_fd, uint32_t pipewire_node) {
+    if(!gsr_pipewire_library_load(&cap_portal->pw)) {
+        if(pipewire_fd >= 0)
+            close(pipewire_fd);
+        return -1;
+    }
+
+    cap_portal->thread_loop = cap_portal->pw.pw_thread_loop_new("gsr screencast", NULL);
+    if(!cap_portal->thread_loop) {
+        fprintf(stderr, "gsr error: gsr_capture_portal_setup_pipewire: failed to create thread loop\n");
+        if(pipewire_fd >= 0)
+            close(pipewire_fd);
+        return -1;
+    }
+
+    cap_portal->context = cap_portal->pw.pw_context_new(cap_portal->pw.pw_thread_loop_get_loop(cap_portal->thread_loop), NULL, 0);
+    if(!cap_portal->context) {
+        fprintf(stderr, "gsr error: gsr_capture_portal_setup_pipewire: failed to create context\n");
+        if(pipewire_fd >= 0)
+            close(pipewire_fd);
+        return -1;
+    }
+
+    if(cap_portal->pw.pw_thread_loop_start(cap_portal->thread_loop) < 0) {
+        fprintf(stderr, "gsr error: gsr_capture_portal_setup_pipewire: failed to start thread loop\n");
+        if(pipewire_fd >= 0)
+            close(pipewire_fd);
+        return -1;
+    }
+
+    cap_portal->pw.pw_thread_loop_lock(cap_portal->thread_loop);
+
+    if(pipewire_fd >= 0)
+        cap_portal->core = cap_portal->pw.pw_context_connect_fd(cap_portal->context, pipewire_fd, NULL, 0);
+    else
+        cap_portal->core = cap_portal->pw.pw_context_connect(cap_portal->context, NULL, 0);
+
+    if(!cap_portal->core) {
+        fprintf(stderr, "gsr error: gsr_capture_portal_setup_pipewire: failed to connect to pipewire\n");
+        cap_portal->pw.pw_thread_loop_unlock(cap_portal->thread_loop);
+        return -1;
+    }
+
+    struct pw_properties *props = cap_portal->pw.pw_properties_new(NULL, NULL);
+    cap_portal->pw.pw_properties_set(props, PW_KEY_MEDIA_TYPE, "Video");
+    cap_portal->pw.pw_properties_set(props, PW_KEY_MEDIA_CATEGORY, "Capture");
+    cap_portal->pw.pw_properties_set(props, PW_KEY_MEDIA_ROLE, "Screen");
+    uint32_t target_id = pipewire_node;
+    if(cap_portal->params.pipewire_target) {
+        /* "target.object" replaced "node.target" in pipewire 0.3.44, set both to support older versions */
+        cap_portal->pw.pw_properties_set(props, "target.object", cap_portal->params.pipewire_target);
+        cap_portal->pw.pw_properties_set(props, "node.target", cap_portal->params.pipewire_target);
+        cap_portal->pw.pw_properties_set(props, PW_KEY_NODE_DONT_RECONNECT, "true");
+        target_id = PW_ID_ANY;
+    }
+
+    cap_portal->stream = cap_portal->pw.pw_stream_new(cap_portal->core, "gpu-screen-recorder", props);
+    if(!cap_portal->stream) {
+        fprintf(stderr, "gsr error: gsr_capture_portal_setup_pipewire: failed to create stream\n");
+        cap_portal->pw.pw_thread_loop_unlock(cap_portal->thread_loop);
+        return -1;
+    }
+
+    cap_portal->pw.pw_stream_add_listener(cap_portal->stream, &cap_portal->stream_listener, &stream_events, cap_portal);
+
+    gsr_capture_portal_query_modifiers(cap_portal);
+
+    uint8_t params_buffer[16384];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(params_buffer, sizeof(params_buffer));
+    const struct spa_pod *params[NUM_VIDEO_FORMATS * 2];
+    const int num_params = gsr_capture_portal_build_formats(cap_portal, &builder, params);
+
+    const int res = cap_portal->pw.pw_stream_connect(cap_portal->stream, PW_DIRECTION_INPUT, target_id,
+        (enum pw_stream_flags)(PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS), params, num_params);
+    if(res < 0) {
+        fprintf(stderr, "gsr error: gsr_capture_portal_setup_pipewire: failed to connect stream, error: %s\n", strerror(-res));
+        cap_portal->pw.pw_thread_loop_unlock(cap_portal->thread_loop);
+        return -1;
+    }
+
+    /* The size of the video has to be known before the encoder is created */
+    while(!cap_portal->negotiated && cap_portal->stream_state != PW_STREAM_STATE_ERROR) {
+        if(cap_portal->pw.pw_thread_loop_timed_wait(cap_portal->thread_loop, 5) != 0) {
+            fprintf(stderr, "gsr error: gsr_capture_portal_setup_pipewire: timed out waiting for the video format, stream state: %s\n", cap_portal->pw.pw_stream_state_as_string(cap_portal->stream_state));
+            cap_portal->pw.pw_thread_loop_unlock(cap_portal->thread_loop);
+            return -1;
+        }
+    }
+
+    const bool negotiated = cap_portal->negotiated;
+    cap_portal->capture_size.x = cap_portal->video_info.size.width;
+    cap_portal->capture_size.y = cap_portal->video_info.size.height;
+    cap_portal->pw.pw_thread_loop_unlock(cap_portal->thread_loop);
+    return negotiated ? 0 : -1;
+}
+
+static int gsr_capture_portal_start(gsr_capture *cap, AVCodecContext *video_codec_context) {
+    gsr_capture_portal *cap_portal = cap->priv;
+
+    int pipewire_fd = -1;
+    uint32_t pipewire_node = PW_ID_ANY;
+    if(!cap_portal->params.pipewire_target) {
+        if(gsr_capture_portal_setup_dbus(cap_portal, &pipewire_fd, &pipewire_node) != 0) {
+            gsr_capture_portal_stop(cap, video_codec_context);
+            return -1;
+        }
+    }
+
+    if(gsr_capture_portal_setup_pipewire(cap_portal, pipewire_fd, pipewire_node) != 0) {
+        gsr_capture_portal_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    /* Disable vsync */
+    cap_portal->params.egl->eglSwapInterval(cap_portal->params.egl->egl_display, 0);
+
+    video_codec_context->width = max_int(2, even_number_ceil(cap_portal->capture_size.x));
+    video_codec_context->height = max_int(2, even_number_ceil(cap_portal->capture_size.y));
+
+    if(!drm_create_codec_context(cap_portal, video_codec_context)) {
+        gsr_capture_portal_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    return 0;
+}
+
+#define FOURCC_NV12 842094158
+#define FOURCC_P010 808530000
+
+static unsigned int gsr_capture_portal_create_texture(gsr_egl *egl) {
+    unsigned int texture = 0;
+    egl->glGenTextures(1, &texture);
+    egl->glBindTexture(GL_TEXTURE_2D, texture);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    egl->glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+static void gsr_capture_portal_tick(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame **frame) {
+    gsr_capture_portal *cap_portal = cap->priv;
+
+    if(!cap_portal->created_hw_frame) {
+        cap_portal->created_hw_frame = true;
+
+        av_frame_free(frame);
+        *frame = av_frame_alloc();
+        if(!frame) {
+            fprintf(stderr, "gsr error: gsr_capture_portal_tick: failed to allocate frame\n");
+            cap_portal->should_stop = true;
+            cap_portal->stop_is_error = true;
+            return;
+        }
+        (*frame)->format = video_codec_context->pix_fmt;
+        (*frame)->width = video_codec_context->width;
+        (*frame)->height = video_codec_context->height;
+        (*frame)->color_range = video_codec_context->color_range;
+        (*frame)->color_primaries = video_codec_context->color_primaries;
+        (*frame)->color_trc = video_codec_context->color_trc;
+        (*frame)->colorspace = video_codec_context->colorspace;
+        (*frame)->chroma_location = video_codec_context->chroma_sample_location;
+
+        int res = av_hwframe_get_buffer(video_codec_context->hw_frames_ctx, *frame, 0);
+        if(res < 0) {
+            fprintf(stderr, "gsr error: gsr_capture_portal_tick: av_hwframe_get_buffer failed: %d\n", res);
+            cap_portal->should_stop = true;
+            cap_portal->stop_is_error = true;
+            return;
+        }
+
+        VASurfaceID target_surface_id = (uintptr_t)(*frame)->data[3];
+
+        VAStatus va_status = vaExportSurfaceHandle(cap_portal->va_dpy, target_surface_id, VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2, VA_EXPORT_SURFACE_WRITE_ONLY | VA_EXPORT_SURFACE_SEPARATE_LAYERS, &cap_portal->prime);
+        if(va_status != VA_STATUS_SUCCESS) {
+            fprintf(stderr, "gsr error: gsr_capture_portal_tick: vaExportSurfaceHandle failed, error: %d\n", va_status);
+            cap_portal->should_stop = true;
+            cap_portal->stop_is_error = true;
+            return;
+        }
+        vaSyncSurface(cap_portal->va_dpy, target_surface_id);
+
+        cap_portal->shm_texture = gsr_capture_portal_create_texture(cap_portal->params.egl);
+
+        const uint32_t formats_nv12[2] = { fourcc('R', '8', ' ', ' '), fourcc('G', 'R', '8', '8') };
+        const uint32_t formats_p010[2] = { fourcc('R', '1', '6', ' '), fourcc('G', 'R', '3', '2') };
+
+        if(cap_portal->prime.fourcc == FOURCC_NV12 || cap_portal->prime.fourcc == FOURCC_P010) {
+            const uint32_t *formats = cap_portal->prime.fourcc == FOURCC_NV12 ? formats_nv12 : formats_p010;
+
+            cap_portal->params.egl->glGenTextures(2, cap_portal->target_textures);
+            for(int i = 0; i < 2; ++i) {
+                const int layer = i;
+                const int plane = 0;
+
+                const int div[2] = {1, 2}; // divide UV texture size by 2 because chroma is half size
+
+                const intptr_t img_attr[] = {
+                    EGL_LINUX_DRM_FOURCC_EXT,       formats[i],
+                    EGL_WIDTH,                      cap_portal->prime.width / div[i],
+                    EGL_HEIGHT,                     cap_portal->prime.height / div[i],
+                    EGL_DMA_BUF_PLANE0_FD_EXT,      cap_portal->prime.objects[cap_portal->prime.layers[layer].object_index[plane]].fd,
+                    EGL_DMA_BUF_PLANE0_OFFSET_EXT,  cap_portal->prime.layers[layer].offset[plane],
+                    EGL_DMA_BUF_PLANE0_PITCH_EXT,   cap_portal->prime.layers[layer].pitch[plane],
+                    EGL_NONE
+                };
+
+                while(cap_portal->params.egl->eglGetError() != EGL_SUCCESS){}
+                EGLImage image = cap_portal->params.egl->eglCreateImage(cap_portal->params.egl->egl_display, 0, EGL_LINUX_DMA_BUF_EXT, NULL, img_attr);
+                if(!image) {
+                    fprintf(stderr, "gsr error: gsr_capture_portal_tick: failed to create egl image from drm fd for output drm fd, error: %d\n", cap_portal->params.egl->eglGetError());
+                    cap_portal->should_stop = true;
+                    cap_portal->stop_is_error = true;
+                    return;
+                }
+
+                cap_portal->params.egl->glBindTexture(GL_TEXTURE_2D, cap_portal->target_textures[i]);
+                cap_portal->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                cap_portal->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                cap_portal->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                cap_portal->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+                while(cap_portal->params.egl->glGetError()) {}
+                while(cap_portal->params.egl->eglGetError() != EGL_SUCCESS){}
+                cap_portal->params.egl->glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+                if(cap_portal->params.egl->glGetError() != 0 || cap_portal->params.egl->eglGetError() != EGL_SUCCESS) {
+                    fprintf(stderr, "gsr error: gsr_capture_portal_tick: failed to bind egl image to gl texture, error: %d\n", cap_portal->params.egl->eglGetError());
+                    cap_portal->should_stop = true;
+                    cap_portal->stop_is_error = true;
+                    cap_portal->params.egl->eglDestroyImage(cap_portal->params.egl->egl_display, image);
+                    cap_portal->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
+                    return;
+                }
+
+                cap_portal->params.egl->eglDestroyImage(cap_portal->params.egl->egl_display, image);
+                cap_portal->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
+            }
+
+            gsr_color_conversion_params color_conversion_params = {0};
+            color_conversion_params.color_range = cap_portal->params.color_range;
+            color_conversion_params.egl = cap_portal->params.egl;
+            color_conversion_params.source_color = GSR_SOURCE_COLOR_RGB;
+            if(cap_portal->prime.fourcc == FOURCC_NV12)
+                color_conversion_params.destination_color = GSR_DESTINATION_COLOR_NV12;
+            else
+                color_conversion_params.destination_color = GSR_DESTINATION_COLOR_P010;
+
+            color_conversion_params.destination_textures[0] = cap_portal->target_textures[0];
+            color_conversion_params.destination_textures[1] = cap_portal->target_textures[1];
+            color_conversion_params.num_destination_textures = 2;
+
+            if(gsr_color_conversion_init(&cap_portal->color_conversion, &color_conversion_params) != 0) {
+                fprintf(stderr, "gsr error: gsr_capture_portal_tick: failed to create color conversion\n");
+                cap_portal->should_stop = true;
+                cap_portal->stop_is_error = true;
+                return;
+            }
+        } else {
+            fprintf(stderr, "gsr error: gsr_capture_portal_tick: unexpected fourcc %u for output drm fd, expected nv12 or p010\n", cap_portal->prime.fourcc);
+            cap_portal->should_stop = true;
+            cap_portal->stop_is_error = true;
+            return;
+        }
+    }
+}
+
+static bool gsr_capture_portal_should_stop(gsr_capture *cap, bool *err) {
+    gsr_capture_portal *cap_portal = cap->priv;
+    if(cap_portal->stream_state == PW_STREAM_STATE_ERROR || cap_portal->stream_state == PW_STREAM_STATE_UNCONNECTED) {
+        cap_portal->should_stop = true;
+        cap_portal->stop_is_error = true;
+    }
+
+    if(cap_portal->should_stop) {
+        if(err)
+            *err = cap_portal->stop_is_error;
+        return true;
+    }
+
+    if(err)
+        *err = false;
+    return false;
+}
+
+/* Returns 0 if the buffer couldn't be imported */
+static unsigned int gsr_capture_portal_import_dmabuf(gsr_capture_portal *cap_portal, struct pw_buffer *buffer) {
+    for(int i = 0; i < cap_portal->num_buffer_textures; ++i) {
+        if(cap_portal->buffer_textures[i].buffer == buffer)
+            return cap_portal->buffer_textures[i].texture;
+    }
+
+    if(cap_portal->num_buffer_textures == GSR_PORTAL_MAX_BUFFERS) {
+        fprintf(stderr, "gsr error: gsr_capture_portal_import_dmabuf: reached max number of buffers\n");
+        return 0;
+    }
+
+    static const int plane_fd_attribs[GSR_PORTAL_MAX_PLANES] = { EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE3_FD_EXT };
+    static const int plane_offset_attribs[GSR_PORTAL_MAX_PLANES] = { EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT, EGL_DMA_BUF_PLANE3_OFFSET_EXT };
+    static const int plane_pitch_attribs[GSR_PORTAL_MAX_PLANES] = { EGL_DMA_BUF_PLANE0_PITCH_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT, EGL_DMA_BUF_PLANE2_PITCH_EXT, EGL_DMA_BUF_PLANE3_PITCH_EXT };
+    static const int plane_modifier_lo_attribs[GSR_PORTAL_MAX_PLANES] = { EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT };
+    static const int plane_modifier_hi_attribs[GSR_PORTAL_MAX_PLANES] = { EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT };
+
+    /* Compressed modifiers (such as intel ccs) have more than one plane for one rgb image */
+    const uint64_t modifier = cap_portal->video_info.modifier;
+    const uint32_t num_planes = buffer->buffer->n_datas < GSR_PORTAL_MAX_PLANES ? buffer->buffer->n_datas : GSR_PORTAL_MAX_PLANES;
+    intptr_t img_attr[6 + GSR_PORTAL_MAX_PLANES * 10 + 1];
+    int num_attr = 0;
+    img_attr[num_attr++] = EGL_LINUX_DRM_FOURCC_EXT;
+    img_attr[num_attr++] = spa_video_format_to_drm_format(cap_portal->video_info.format);
+    img_attr[num_attr++] = EGL_WIDTH;
+    img_attr[num_attr++] = cap_portal->video_info.size.width;
+    img_attr[num_attr++] = EGL_HEIGHT;
+    img_attr[num_attr++] = cap_portal->video_info.size.height;
+    for(uint32_t i = 0; i < num_planes; ++i) {
+        const struct spa_data *data = &buffer->buffer->datas[i];
+        img_attr[num_attr++] = plane_fd_attribs[i];
+        img_attr[num_attr++] = data->fd;
+        img_attr[num_attr++] = plane_offset_attribs[i];
+        img_attr[num_attr++] = data->chunk->offset;
+        img_attr[num_attr++] = plane_pitch_attribs[i];
+        img_attr[num_attr++] = data->chunk->stride;
+        if(modifier != DRM_FORMAT_MOD_INVALID) {
+            img_attr[num_attr++] = plane_modifier_lo_attribs[i];
+            img_attr[num_attr++] = modifier & 0xFFFFFFFFULL;
+            img_attr[num_attr++] = plane_modifier_hi_attribs[i];
+            img_attr[num_attr++] = modifier >> 32ULL;
+        }
+    }
+    img_attr[num_attr++] = EGL_NONE;
+
+    gsr_egl *egl = cap_portal->params.egl;
+    while(egl->eglGetError() != EGL_SUCCESS){}
+    EGLImage image = egl->eglCreateImage(egl->egl_display, 0, EGL_LINUX_DMA_BUF_EXT, NULL, img_attr);
+    if(!image) {
+        fprintf(stderr, "gsr error: gsr_capture_portal_import_dmabuf: failed to create egl image from dma-buf, error: %d\n", egl->eglGetError());
+        return 0;
+    }
+
+    const unsigned int texture = gsr_capture_portal_create_texture(egl);
+    egl->glBindTexture(GL_TEXTURE_2D, texture);
+    egl->glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+    egl->glBindTexture(GL_TEXTURE_2D, 0);
+    /* The texture keeps a reference to the dma-buf */
+    egl->eglDestroyImage(egl->egl_display, image);
+
+    cap_portal->buffer_textures[cap_portal->num_buffer_textures++] = (gsr_portal_buffer_texture){ buffer, texture };
+    return texture;
+}
+
+static void gsr_capture_portal_upload_shm(gsr_capture_portal *cap_portal, struct pw_buffer *buffer) {
+    const struct spa_data *data = &buffer->buffer->datas[0];
+    if(!data->data || !data->chunk)
+        return;
+
+    const int bytes_per_pixel = 4;
+    gsr_egl *egl = cap_portal->params.egl;
+    egl->glBindTexture(GL_TEXTURE_2D, cap_portal->shm_texture);
+    egl->glPixelStorei(GL_UNPACK_ROW_LENGTH, data->chunk->stride / bytes_per_pixel);
+
+    const int width = cap_portal->video_info.size.width;
+    const int height = cap_portal->video_info.size.height;
+    const unsigned int format = spa_video_format_to_gl_format(cap_portal->video_info.format);
+    const uint8_t *pixels = (const uint8_t*)data->data + data->chunk->offset;
+    if(width != cap_portal->shm_texture_size.x || height != cap_portal->shm_texture_size.y) {
+        egl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+        cap_portal->shm_texture_size = (vec2i){ width, height };
+    } else {
+        egl->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, pixels);
+    }
+
+    egl->glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    egl->glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+static int gsr_capture_portal_capture(gsr_capture *cap, AVFrame *frame) {
+    (void)frame;
+    gsr_capture_portal *cap_portal = cap->priv;
+    gsr_egl *egl = cap_portal->params.egl;
+
+    cap_portal->pw.pw_thread_loop_lock(cap_portal->thread_loop);
+
+    for(int i = 0; i < cap_portal->num_removed_textures; ++i) {
+        if(cap_portal->removed_textures[i] == cap_portal->current_texture)
+            cap_portal->current_texture = 0;
+        egl->glDeleteTextures(1, &cap_portal->removed_textures[i]);
+    }
+    cap_portal->num_removed_textures = 0;
+
+    if(cap_portal->pending_buffer) {
+        /* The previous buffer is no longer drawn, give it back to the producer */
+        if(cap_portal->current_buffer)
+            cap_portal->pw.pw_stream_queue_buffer(cap_portal->stream, cap_portal->current_buffer);
+        cap_portal->current_buffer = cap_portal->pending_buffer;
+        cap_portal->pending_buffer = NULL;
+
+        if(cap_portal->current_buffer->buffer->datas[0].type == SPA_DATA_DmaBuf) {
+            cap_portal->current_texture = gsr_capture_portal_import_dmabuf(cap_portal, cap_portal->current_buffer);
+        } else {
+            gsr_capture_portal_upload_shm(cap_portal, cap_portal->current_buffer);
+            cap_portal->current_texture = cap_portal->shm_texture;
+        }
+        cap_portal->current_size.x = cap_portal->video_info.size.width;
+        cap_portal->current_size.y = cap_portal->video_info.size.height;
+    }
+
+    const unsigned int texture = cap_portal->current_texture;
+    const vec2i texture_size = cap_portal->current_size;
+    cap_portal->pw.pw_thread_loop_unlock(cap_portal->thread_loop);
+
+    /* Nothing has been received yet. The frame is cleared so that black is encoded instead of whatever the frame contained */
+    if(texture == 0) {
+        gsr_color_conversion_clear(&cap_portal->color_conversion);
+        egl->eglSwapBuffers(egl->egl_display, egl->egl_surface);
+        return 0;
+    }
+
+    egl->glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    egl->glClear(GL_COLOR_BUFFER_BIT);
+
+    /* The cursor is embedded in the frames by the compositor. The window can be resized while recording, the frame is cropped to the video size then */
+    const gsr_color_conversion_layer layer = {
+        .texture_id = texture,
+        .source_pos = (vec2i){0, 0},
+        .source_size = texture_size,
+        .texture_pos = (vec2i){0, 0},
+        .texture_size = texture_size,
+        .rotation = 0.0f,
+        .external_texture = false
+    };
+    gsr_color_conversion_draw_layers(&cap_portal->color_conversion, &layer, 1);
+
+    egl->eglSwapBuffers(egl->egl_display, egl->egl_surface);
+    return 0;
+}
+
+static void gsr_capture_portal_stop(gsr_capture *cap, AVCodecContext *video_codec_context) {
+    gsr_capture_portal *cap_portal = cap->priv;
+
+    if(cap_portal->thread_loop)
+        cap_portal->pw.pw_thread_loop_stop(cap_portal->thread_loop);
+
+    if(cap_portal->stream) {
+        spa_hook_remove(&cap_portal->stream_listener);
+        cap_portal->pw.pw_stream_disconnect(cap_portal->stream);
+        cap_portal->pw.pw_stream_destroy(cap_portal->stream);
+        cap_portal->stream = NULL;
+    }
+    cap_portal->pending_buffer = NULL;
+    cap_portal->current_buffer = NULL;
+
+    if(cap_portal->core) {
+        cap_portal->pw.pw_core_disconnect(cap_portal->core);
+        cap_portal->core = NULL;
+    }
+
+    if(cap_portal->context) {
+        cap_portal->pw.pw_context_destroy(cap_portal->context);
+        cap_portal->context = NULL;
+    }
+
+    if(cap_portal->thread_loop) {
+        cap_portal->pw.pw_thread_loop_destroy(cap_portal->thread_loop);
+        cap_portal->thread_loop = NULL;
+    }
+
+    gsr_pipewire_library_unload(&cap_portal->pw);
+
+    /* The dbus connection is shared (dbus_bus_get) and stays open, so the screencast session has to be closed explicitly */
+    if(cap_portal->dbus_initialized) {
+        if(cap_portal->session_handle)
+            gsr_dbus_screencast_close_session(&cap_portal->dbus, cap_portal->session_handle);
+        gsr_dbus_deinit(&cap_portal->dbus);
+        cap_portal->dbus_initialized = false;
+    }
+
+    if(cap_portal->session_handle) {
+        free(cap_portal->session_handle);
+        cap_portal->session_handle = NULL;
+    }
+
+    gsr_color_conversion_deinit(&cap_portal->color_conversion);
+
+    for(uint32_t i = 0; i < cap_portal->prime.num_objects; ++i) {
+        if(cap_portal->prime.objects[i].fd > 0) {
+            close(cap_portal->prime.objects[i].fd);
+            cap_portal->prime.objects[i].fd = 0;
+        }
+    }
+
+    if(cap_portal->params.egl->egl_context) {
+        for(int i = 0; i < cap_portal->num_buffer_textures; ++i) {
+            cap_portal->params.egl->glDeleteTextures(1, &cap_portal->buffer_textures[i].texture);
+        }
+        cap_portal->num_buffer_textures = 0;
+
+        if(cap_portal->num_removed_textures > 0) {
+            cap_portal->params.egl->glDeleteTextures(cap_portal->num_removed_textures, cap_portal->removed_textures);
+            cap_portal->num_removed_textures = 0;
+        }
+
+        if(cap_portal->shm_texture) {
+            cap_portal->params.egl->glDeleteTextures(1, &cap_portal->shm_texture);
+            cap_portal->shm_texture = 0;
+            cap_portal->shm_texture_size = (vec2i){ 0, 0 };
+        }
+
+        cap_portal->params.egl->glDeleteTextures(2, cap_portal->target_textures);
+        cap_portal->target_textures[0] = 0;
+        cap_portal->target_textures[1] = 0;
+    }
+    cap_portal->current_texture = 0;
+
+    if(video_codec_context->hw_device_ctx)
+        av_buffer_unref(&video_codec_context->hw_device_ctx);
+    if(video_codec_context->hw_frames_ctx)
+        av_buffer_unref(&video_codec_context->hw_frames_ctx);
+}
+
+static void gsr_capture_portal_destroy(gsr_capture *cap, AVCodecContext *video_codec_context) {
+    gsr_capture_portal *cap_portal = cap->priv;
+    if(cap->priv) {
+        gsr_capture_portal_stop(cap, video_codec_context);
+        free((void*)cap_portal->params.pipewire_target);
+        cap_portal->params.pipewire_target = NULL;
+        free(cap->priv);
+        cap->priv = NULL;
+    }
+    free(cap);
+}
+
+gsr_capture* gsr_capture_portal_create(const gsr_capture_portal_params *params) {
+    if(!params) {
+        fprintf(stderr, "gsr error: gsr_capture_portal_create params is NULL\n");
+        return NULL;
+    }
+
+    gsr_capture *cap = calloc(1, sizeof(gsr_capture));
+    if(!cap)
+        return NULL;
+
+    gsr_capture_portal *cap_portal = calloc(1, sizeof(gsr_capture_portal));
+    if(!cap_portal) {
+        free(cap);
+        return NULL;
+    }
+
+    const char *pipewire_target = NULL;
+    if(params->pipewire_target) {
+        pipewire_target = strdup(params->pipewire_target);
+        if(!pipewire_target) {
+            free(cap);
+            free(cap_portal);
+            return NULL;
+        }
+    }
+
+    cap_portal->params = *params;
+    cap_portal->params.pipewire_target = pipewire_target;
+    cap_portal->stream_state = PW_STREAM_STATE_UNCONNECTED;
+
+    *cap = (gsr_capture) {
+        .start = gsr_capture_portal_start,
+        .tick = gsr_capture_portal_tick,
+        .should_stop = gsr_capture_portal_should_stop,
+        .capture = gsr_capture_portal_capture,
+        .capture_end = NULL,
+        .get_cursor_position = NULL,
+        .destroy = gsr_capture_portal_destroy,
+        .priv = cap_portal
+    };
+
+    return cap;
+}
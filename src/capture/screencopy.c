@@ -0,0 +1,1054 @@
+#define _GNU_SOURCE
+#include "../../include/capture/screencopy.h"
+#include "../../include/cpu_color_conversion.h"
+#include "../../include/utils.h"
+#include "../../external/wlr-screencopy-unstable-v1-client-protocol.h"
+#include "../../external/linux-dmabuf-unstable-v1-client-protocol.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <wayland-client.h>
+#include <gbm.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/hwcontext_vaapi.h>
+#include <libavutil/frame.h>
+#include <libavcodec/avcodec.h>
+#include <va/va.h>
+#include <va/va_drmcommon.h>
+
+#define DRM_FORMAT_MOD_INVALID 0xffffffffffffffULL
+#define GSR_SCREENCOPY_MAX_PLANES 4
+/* One buffer is drawn while the compositor copies the next frame to the other one */
+#define GSR_SCREENCOPY_NUM_DMABUF_BUFFERS 2
+/* The output was most likely disconnected if this many frames in a row fail */
+#define GSR_SCREENCOPY_MAX_FAILED_FRAMES 10
+
+static uint32_t fourcc(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    return (d << 24) | (c << 16) | (b << 8) | a;
+}
+
+/* Returns 0 if the format is not supported. Only 8-bit rgb formats are supported, alpha is ignored when drawing */
+static unsigned int drm_format_to_gl_format(uint32_t format) {
+    if(format == fourcc('X', 'R', '2', '4') || format == fourcc('A', 'R', '2', '4'))
+        return GL_BGRA;
+    else if(format == fourcc('X', 'B', '2', '4') || format == fourcc('A', 'B', '2', '4'))
+        return GL_RGBA;
+    return 0;
+}
+
+/* wl_shm formats are drm formats, except for argb8888 and xrgb8888 */
+static uint32_t shm_format_to_drm_format(uint32_t format) {
+    switch(format) {
+        case WL_SHM_FORMAT_ARGB8888: return fourcc('A', 'R', '2', '4');
+        case WL_SHM_FORMAT_XRGB8888: return fourcc('X', 'R', '2', '4');
+        default:                     return format;
+    }
+}
+
+typedef struct {
+    struct wl_buffer *wl_buffer;
+    struct gbm_bo *bo; /* NULL for shm buffers */
+    unsigned int texture; /* The dma-buf imported as a texture. 0 for shm buffers, they are uploaded to |shm_texture| instead */
+} gsr_screencopy_buffer;
+
+typedef struct {
+    gsr_capture_screencopy_params params;
+
+    bool should_stop;
+    bool stop_is_error;
+    bool created_hw_frame;
+
+    struct wl_output *output;
+    struct zwlr_screencopy_frame_v1 *frame; /* The frame that the compositor is copying to, NULL if no frame has been requested */
+    bool frame_ready;
+    bool frame_failed;
+    bool frame_buffer_done;
+    int num_failed_frames;
+
+    /* The buffer types that the compositor can copy |frame| to, received before buffer_done */
+    bool frame_has_shm;
+    uint32_t frame_shm_format;
+    vec2i frame_shm_size;
+    uint32_t frame_shm_stride;
+    bool frame_has_dmabuf;
+    uint32_t frame_dmabuf_format;
+    vec2i frame_dmabuf_size;
+
+    /* Damage since the last ready frame, in buffer coordinates */
+    bool has_damage;
+    vec2i damage_min;
+    vec2i damage_max;
+    /* Older wlroots versions give the frames upside down, they are flipped when they are converted */
+    bool frame_y_invert; /* For |frame| */
+    bool y_invert; /* For the buffer at |ready_index| */
+
+    bool use_dmabuf; /* Set to false if the compositor fails to copy to dma-buf, shm is used instead then */
+    int gbm_fd;
+    struct gbm_device *gbm;
+
+    gsr_screencopy_buffer buffers[GSR_SCREENCOPY_NUM_DMABUF_BUFFERS];
+    int num_buffers;
+    bool buffers_are_dmabuf;
+    uint32_t buffer_format; /* drm format */
+    vec2i buffer_size;
+    uint32_t buffer_stride; /* Only for shm */
+    int copy_index; /* The buffer that |frame| is copied to */
+    int ready_index; /* The newest buffer that has been copied to completely, -1 if none */
+
+    void *shm_data;
+    size_t shm_data_size;
+    unsigned int shm_texture;
+    bool shm_texture_needs_full_upload; /* Also used for |sw_frame| */
+
+    /* NV12 or P010, only with software encoding. Has the content of the previous frames, only the damaged part is converted */
+    AVFrame *sw_frame;
+
+    VADisplay va_dpy;
+    VADRMPRIMESurfaceDescriptor prime;
+    unsigned int target_textures[2];
+    gsr_color_conversion color_conversion;
+
+    vec2i capture_size;
+} gsr_capture_screencopy;
+
+static int max_int(int a, int b) {
+    return a > b ? a : b;
+}
+
+static int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+static void gsr_capture_screencopy_stop(gsr_capture *cap, AVCodecContext *video_codec_context);
+
+static bool drm_create_codec_context(gsr_capture_screencopy *cap_screencopy, AVCodecContext *video_codec_context) {
+    char render_path[128];
+    if(!gsr_card_path_get_render_path(cap_screencopy->params.egl->card_path, render_path)) {
+        fprintf(stderr, "gsr error: failed to get /dev/dri/renderDXXX file from %s\n", cap_screencopy->params.egl->card_path);
+        return false;
+    }
+
+    AVBufferRef *device_ctx;
+    if(av_hwdevice_ctx_create(&device_ctx, AV_HWDEVICE_TYPE_VAAPI, render_path, NULL, 0) < 0) {
+        fprintf(stderr, "Error: Failed to create hardware device context\n");
+        return false;
+    }
+
+    AVBufferRef *frame_context = av_hwframe_ctx_alloc(device_ctx);
+    if(!frame_context) {
+        fprintf(stderr, "Error: Failed to create hwframe context\n");
+        av_buffer_unref(&device_ctx);
+        return false;
+    }
+
+    AVHWFramesContext *hw_frame_context =
+        (AVHWFramesContext *)frame_context->data;
+    hw_frame_context->width = video_codec_context->width;
+    hw_frame_context->height = video_codec_context->height;
+    hw_frame_context->sw_format = cap_screencopy->params.hdr ? AV_PIX_FMT_P010LE : AV_PIX_FMT_NV12;
+    hw_frame_context->format = video_codec_context->pix_fmt;
+    hw_frame_context->device_ref = device_ctx;
+    hw_frame_context->device_ctx = (AVHWDeviceContext*)device_ctx->data;
+
+    hw_frame_context->initial_pool_size = 1;
+
+    AVVAAPIDeviceContext *vactx =((AVHWDeviceContext*)device_ctx->data)->hwctx;
+    cap_screencopy->va_dpy = vactx->display;
+
+    if (av_hwframe_ctx_init(frame_context) < 0) {
+        fprintf(stderr, "Error: Failed to initialize hardware frame context "
+                        "(note: ffmpeg version needs to be > 4.0)\n");
+        av_buffer_unref(&device_ctx);
+        //av_buffer_unref(&frame_context);
+        return false;
+    }
+
+    video_codec_context->hw_device_ctx = av_buffer_ref(device_ctx);
+    video_codec_context->hw_frames_ctx = av_buffer_ref(frame_context);
+    return true;
+}
+
+static unsigned int gsr_capture_screencopy_create_texture(gsr_egl *egl) {
+    unsigned int texture = 0;
+    egl->glGenTextures(1, &texture);
+    egl->glBindTexture(GL_TEXTURE_2D, texture);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    egl->glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+static void gsr_capture_screencopy_destroy_buffers(gsr_capture_screencopy *cap_screencopy) {
+    for(int i = 0; i < cap_screencopy->num_buffers; ++i) {
+        gsr_screencopy_buffer *buffer = &cap_screencopy->buffers[i];
+        if(buffer->wl_buffer) {
+            wl_buffer_destroy(buffer->wl_buffer);
+            buffer->wl_buffer = NULL;
+        }
+
+        if(buffer->texture) {
+            cap_screencopy->params.egl->glDeleteTextures(1, &buffer->texture);
+            buffer->texture = 0;
+        }
+
+        if(buffer->bo) {
+            gbm_bo_destroy(buffer->bo);
+            buffer->bo = NULL;
+        }
+    }
+    cap_screencopy->num_buffers = 0;
+    cap_screencopy->ready_index = -1;
+
+    if(cap_screencopy->shm_data) {
+        munmap(cap_screencopy->shm_data, cap_screencopy->shm_data_size);
+        cap_screencopy->shm_data = NULL;
+        cap_screencopy->shm_data_size = 0;
+    }
+}
+
+/* Allocates a buffer on the gpu that the compositor copies to, and imports it as a texture so no copy is needed on our side */
+static bool gsr_capture_screencopy_create_dmabuf_buffer(gsr_capture_screencopy *cap_screencopy, gsr_screencopy_buffer *buffer, uint32_t format, vec2i size) {
+    buffer->bo = gbm_bo_create(cap_screencopy->gbm, size.x, size.y, format, GBM_BO_USE_RENDERING);
+    if(!buffer->bo) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_create_dmabuf_buffer: failed to create %dx%d gbm buffer\n", size.x, size.y);
+        return false;
+    }
+
+    const int fd = gbm_bo_get_fd(buffer->bo);
+    if(fd < 0) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_create_dmabuf_buffer: failed to get gbm buffer fd\n");
+        return false;
+    }
+
+    static const int plane_fd_attribs[GSR_SCREENCOPY_MAX_PLANES] = { EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE3_FD_EXT };
+    static const int plane_offset_attribs[GSR_SCREENCOPY_MAX_PLANES] = { EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT, EGL_DMA_BUF_PLANE3_OFFSET_EXT };
+    static const int plane_pitch_attribs[GSR_SCREENCOPY_MAX_PLANES] = { EGL_DMA_BUF_PLANE0_PITCH_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT, EGL_DMA_BUF_PLANE2_PITCH_EXT, EGL_DMA_BUF_PLANE3_PITCH_EXT };
+    static const int plane_modifier_lo_attribs[GSR_SCREENCOPY_MAX_PLANES] = { EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT };
+    static const int plane_modifier_hi_attribs[GSR_SCREENCOPY_MAX_PLANES] = { EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT };
+
+    /* Compressed modifiers (such as intel ccs) have more than one plane for one rgb image */
+    const uint64_t modifier = gbm_bo_get_modifier(buffer->bo);
+    const int num_planes = min_int(gbm_bo_get_plane_count(buffer->bo), GSR_SCREENCOPY_MAX_PLANES);
+    intptr_t img_attr[6 + GSR_SCREENCOPY_MAX_PLANES * 10 + 1];
+    int num_attr = 0;
+    img_attr[num_attr++] = EGL_LINUX_DRM_FOURCC_EXT;
+    img_attr[num_attr++] = format;
+    img_attr[num_attr++] = EGL_WIDTH;
+    img_attr[num_attr++] = size.x;
+    img_attr[num_attr++] = EGL_HEIGHT;
+    img_attr[num_attr++] = size.y;
+
+    struct zwp_linux_buffer_params_v1 *buffer_params = zwp_linux_dmabuf_v1_create_params(cap_screencopy->params.egl->wayland.linux_dmabuf);
+    for(int i = 0; i < num_planes; ++i) {
+        const uint32_t offset = gbm_bo_get_offset(buffer->bo, i);
+        const uint32_t stride = gbm_bo_get_stride_for_plane(buffer->bo, i);
+        /* The fd is duplicated when it's sent to the compositor */
+        zwp_linux_buffer_params_v1_add(buffer_params, fd, i, offset, stride, modifier >> 32ULL, modifier & 0xFFFFFFFFULL);
+
+        img_attr[num_attr++] = plane_fd_attribs[i];
+        img_attr[num_attr++] = fd;
+        img_attr[num_attr++] = plane_offset_attribs[i];
+        img_attr[num_attr++] = offset;
+        img_attr[num_attr++] = plane_pitch_attribs[i];
+        img_attr[num_attr++] = stride;
+        if(modifier != DRM_FORMAT_MOD_INVALID) {
+            img_attr[num_attr++] = plane_modifier_lo_attribs[i];
+            img_attr[num_attr++] = modifier & 0xFFFFFFFFULL;
+            img_attr[num_attr++] = plane_modifier_hi_attribs[i];
+            img_attr[num_attr++] = modifier >> 32ULL;
+        }
+    }
+    img_attr[num_attr++] = EGL_NONE;
+
+    buffer->wl_buffer = zwp_linux_buffer_params_v1_create_immed(buffer_params, size.x, size.y, format, 0);
+    zwp_linux_buffer_params_v1_destroy(buffer_params);
+
+    gsr_egl *egl = cap_screencopy->params.egl;
+    while(egl->eglGetError() != EGL_SUCCESS){}
+    EGLImage image = egl->eglCreateImage(egl->egl_display, 0, EGL_LINUX_DMA_BUF_EXT, NULL, img_attr);
+    close(fd);
+    if(!image) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_create_dmabuf_buffer: failed to create egl image from dma-buf, error: %d\n", egl->eglGetError());
+        return false;
+    }
+
+    buffer->texture = gsr_capture_screencopy_create_texture(egl);
+    egl->glBindTexture(GL_TEXTURE_2D, buffer->texture);
+    egl->glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+    egl->glBindTexture(GL_TEXTURE_2D, 0);
+    /* The texture keeps a reference to the dma-buf */
+    egl->eglDestroyImage(egl->egl_display, image);
+    return buffer->wl_buffer != NULL;
+}
+
+static bool gsr_capture_screencopy_create_shm_buffer(gsr_capture_screencopy *cap_screencopy, gsr_screencopy_buffer *buffer, uint32_t shm_format, vec2i size, uint32_t stride) {
+    const size_t data_size = (size_t)stride * (size_t)size.y;
+    const int fd = memfd_create("gsr-screencopy", MFD_CLOEXEC);
+    if(fd < 0) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_create_shm_buffer: failed to create shared memory\n");
+        return false;
+    }
+
+    if(ftruncate(fd, data_size) != 0) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_create_shm_buffer: failed to resize shared memory to %zu bytes\n", data_size);
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(data == MAP_FAILED) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_create_shm_buffer: failed to map shared memory\n");
+        close(fd);
+        return false;
+    }
+    cap_screencopy->shm_data = data;
+    cap_screencopy->shm_data_size = data_size;
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(cap_screencopy->params.egl->wayland.shm, fd, data_size);
+    buffer->wl_buffer = wl_shm_pool_create_buffer(pool, 0, size.x, size.y, stride, shm_format);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    return buffer->wl_buffer != NULL;
+}
+
+/* Recreates the buffers if the type, format or size of the frame changed. Returns false if no buffer could be created */
+static bool gsr_capture_screencopy_ensure_buffers(gsr_capture_screencopy *cap_screencopy) {
+    const bool use_dmabuf = cap_screencopy->use_dmabuf && cap_screencopy->frame_has_dmabuf && drm_format_to_gl_format(cap_screencopy->frame_dmabuf_format) != 0;
+    const bool use_shm = !use_dmabuf && cap_screencopy->frame_has_shm && drm_format_to_gl_format(shm_format_to_drm_format(cap_screencopy->frame_shm_format)) != 0;
+    if(!use_dmabuf && !use_shm) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_ensure_buffers: the compositor didn't offer a supported buffer format, shm format: %u, dma-buf format: %u\n",
+            cap_screencopy->frame_has_shm ? cap_screencopy->frame_shm_format : 0, cap_screencopy->frame_has_dmabuf ? cap_screencopy->frame_dmabuf_format : 0);
+        return false;
+    }
+
+    const uint32_t format = use_dmabuf ? cap_screencopy->frame_dmabuf_format : shm_format_to_drm_format(cap_screencopy->frame_shm_format);
+    const vec2i size = use_dmabuf ? cap_screencopy->frame_dmabuf_size : cap_screencopy->frame_shm_size;
+    const uint32_t stride = use_dmabuf ? 0 : cap_screencopy->frame_shm_stride;
+    if(cap_screencopy->num_buffers > 0 && cap_screencopy->buffers_are_dmabuf == use_dmabuf && cap_screencopy->buffer_format == format
+        && cap_screencopy->buffer_size.x == size.x && cap_screencopy->buffer_size.y == size.y && cap_screencopy->buffer_stride == stride)
+    {
+        return true;
+    }
+
+    gsr_capture_screencopy_destroy_buffers(cap_screencopy);
+    cap_screencopy->buffers_are_dmabuf = use_dmabuf;
+    cap_screencopy->buffer_format = format;
+    cap_screencopy->buffer_size = size;
+    cap_screencopy->buffer_stride = stride;
+    cap_screencopy->copy_index = 0;
+    cap_screencopy->has_damage = false;
+
+    if(use_dmabuf) {
+        cap_screencopy->num_buffers = GSR_SCREENCOPY_NUM_DMABUF_BUFFERS;
+        for(int i = 0; i < cap_screencopy->num_buffers; ++i) {
+            if(!gsr_capture_screencopy_create_dmabuf_buffer(cap_screencopy, &cap_screencopy->buffers[i], format, size)) {
+                fprintf(stderr, "gsr warning: gsr_capture_screencopy_ensure_buffers: failed to create dma-buf buffer, using shm instead\n");
+                gsr_capture_screencopy_destroy_buffers(cap_screencopy);
+                cap_screencopy->use_dmabuf = false;
+                return gsr_capture_screencopy_ensure_buffers(cap_screencopy);
+            }
+        }
+    } else {
+        /* The shm buffer is uploaded to |shm_texture| as soon as it's ready, so one buffer is enough */
+        cap_screencopy->num_buffers = 1;
+        if(!gsr_capture_screencopy_create_shm_buffer(cap_screencopy, &cap_screencopy->buffers[0], cap_screencopy->frame_shm_format, size, stride)) {
+            gsr_capture_screencopy_destroy_buffers(cap_screencopy);
+            return false;
+        }
+        cap_screencopy->shm_texture_needs_full_upload = true;
+    }
+
+    fprintf(stderr, "gsr info: gsr_capture_screencopy: %dx%d, format: %u, %s\n", size.x, size.y, format, use_dmabuf ? "dma-buf" : "shared memory");
+    return true;
+}
+
+static void frame_handle_buffer(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t format, uint32_t width, uint32_t height, uint32_t stride) {
+    (void)frame;
+    gsr_capture_screencopy *cap_screencopy = data;
+    cap_screencopy->frame_has_shm = true;
+    cap_screencopy->frame_shm_format = format;
+    cap_screencopy->frame_shm_size = (vec2i){ width, height };
+    cap_screencopy->frame_shm_stride = stride;
+}
+
+static void frame_handle_flags(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t flags) {
+    (void)frame;
+    gsr_capture_screencopy *cap_screencopy = data;
+    cap_screencopy->frame_y_invert = (flags & ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT) != 0;
+}
+
+static void frame_handle_ready(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec) {
+    (void)frame;
+    (void)tv_sec_hi;
+    (void)tv_sec_lo;
+    (void)tv_nsec;
+    gsr_capture_screencopy *cap_screencopy = data;
+    cap_screencopy->frame_ready = true;
+}
+
+static void frame_handle_failed(void *data, struct zwlr_screencopy_frame_v1 *frame) {
+    (void)frame;
+    gsr_capture_screencopy *cap_screencopy = data;
+    cap_screencopy->frame_failed = true;
+}
+
+static void frame_handle_damage(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    (void)frame;
+    gsr_capture_screencopy *cap_screencopy = data;
+    const vec2i damage_min = { x, y };
+    const vec2i damage_max = { x + width, y + height };
+    if(cap_screencopy->has_damage) {
+        cap_screencopy->damage_min.x = min_int(cap_screencopy->damage_min.x, damage_min.x);
+        cap_screencopy->damage_min.y = min_int(cap_screencopy->damage_min.y, damage_min.y);
+        cap_screencopy->damage_max.x = max_int(cap_screencopy->damage_max.x, damage_max.x);
+        cap_screencopy->damage_max.y = max_int(cap_screencopy->damage_max.y, damage_max.y);
+    } else {
+        cap_screencopy->damage_min = damage_min;
+        cap_screencopy->damage_max = damage_max;
+        cap_screencopy->has_damage = true;
+    }
+}
+
+static void frame_handle_linux_dmabuf(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t format, uint32_t width, uint32_t height) {
+    (void)frame;
+    gsr_capture_screencopy *cap_screencopy = data;
+    cap_screencopy->frame_has_dmabuf = true;
+    cap_screencopy->frame_dmabuf_format = format;
+    cap_screencopy->frame_dmabuf_size = (vec2i){ width, height };
+}
+
+/* All buffer types have been received, the copy is requested right away to not add a frame of latency */
+static void frame_handle_buffer_done(void *data, struct zwlr_screencopy_frame_v1 *frame) {
+    gsr_capture_screencopy *cap_screencopy = data;
+    cap_screencopy->frame_buffer_done = true;
+
+    if(!gsr_capture_screencopy_ensure_buffers(cap_screencopy)) {
+        cap_screencopy->should_stop = true;
+        cap_screencopy->stop_is_error = true;
+        return;
+    }
+
+    /* Copy to the buffer that isn't being drawn */
+    cap_screencopy->copy_index = cap_screencopy->ready_index < 0 ? 0 : (cap_screencopy->ready_index + 1) % cap_screencopy->num_buffers;
+    struct wl_buffer *wl_buffer = cap_screencopy->buffers[cap_screencopy->copy_index].wl_buffer;
+
+    /*
+        The first frame is copied right away, after that the compositor waits until the output has changed before copying.
+        This means that nothing is copied (and nothing has to be uploaded) when the screen is static.
+    */
+    if(cap_screencopy->ready_index < 0)
+        zwlr_screencopy_frame_v1_copy(frame, wl_buffer);
+    else
+        zwlr_screencopy_frame_v1_copy_with_damage(frame, wl_buffer);
+}
+
+static const struct zwlr_screencopy_frame_v1_listener frame_listener = {
+    .buffer = frame_handle_buffer,
+    .flags = frame_handle_flags,
+    .ready = frame_handle_ready,
+    .failed = frame_handle_failed,
+    .damage = frame_handle_damage,
+    .linux_dmabuf = frame_handle_linux_dmabuf,
+    .buffer_done = frame_handle_buffer_done,
+};
+
+static void gsr_capture_screencopy_request_frame(gsr_capture_screencopy *cap_screencopy) {
+    cap_screencopy->frame_ready = false;
+    cap_screencopy->frame_failed = false;
+    cap_screencopy->frame_buffer_done = false;
+    cap_screencopy->frame_has_shm = false;
+    cap_screencopy->frame_has_dmabuf = false;
+    cap_screencopy->frame_y_invert = false;
+
+    const int overlay_cursor = 1;
+    cap_screencopy->frame = zwlr_screencopy_manager_v1_capture_output(cap_screencopy->params.egl->wayland.screencopy_manager, overlay_cursor, cap_screencopy->output);
+    zwlr_screencopy_frame_v1_add_listener(cap_screencopy->frame, &frame_listener, cap_screencopy);
+}
+
+static void gsr_capture_screencopy_destroy_frame(gsr_capture_screencopy *cap_screencopy) {
+    if(cap_screencopy->frame) {
+        zwlr_screencopy_frame_v1_destroy(cap_screencopy->frame);
+        cap_screencopy->frame = NULL;
+    }
+}
+
+/* Handles the wayland events that have been received, without blocking */
+static void gsr_capture_screencopy_dispatch(struct wl_display *dpy) {
+    while(wl_display_prepare_read(dpy) != 0) {
+        if(wl_display_dispatch_pending(dpy) < 0)
+            return;
+    }
+    wl_display_flush(dpy);
+
+    struct pollfd poll_fd = {
+        .fd = wl_display_get_fd(dpy),
+        .events = POLLIN,
+        .revents = 0
+    };
+
+    if(poll(&poll_fd, 1, 0) > 0)
+        wl_display_read_events(dpy);
+    else
+        wl_display_cancel_read(dpy);
+
+    wl_display_dispatch_pending(dpy);
+}
+
+static struct wl_output* get_wayland_output_by_name(gsr_egl *egl, const char *name) {
+    for(int i = 0; i < egl->wayland.num_outputs; ++i) {
+        const gsr_wayland_output *output = &egl->wayland.outputs[i];
+        if(strcmp(name, "screen") == 0 || (output->name && strcmp(output->name, name) == 0))
+            return output->output;
+    }
+    return NULL;
+}
+
+/* The rows and columns that are only there because the video size has to be even are never written to by the color conversion */
+static void gsr_capture_screencopy_clear_sw_frame(gsr_capture_screencopy *cap_screencopy) {
+    AVFrame *sw_frame = cap_screencopy->sw_frame;
+    const bool full_range = cap_screencopy->params.color_range == GSR_COLOR_RANGE_FULL;
+    if(cap_screencopy->params.hdr) {
+        const uint16_t y_black = (full_range ? 0 : 64) << 6;
+        const uint16_t uv_black = 512 << 6;
+        for(int y = 0; y < sw_frame->height; ++y) {
+            uint16_t *row = (uint16_t*)(sw_frame->data[0] + (size_t)y * sw_frame->linesize[0]);
+            for(int x = 0; x < sw_frame->width; ++x)
+                row[x] = y_black;
+        }
+        for(int y = 0; y < sw_frame->height / 2; ++y) {
+            uint16_t *row = (uint16_t*)(sw_frame->data[1] + (size_t)y * sw_frame->linesize[1]);
+            for(int x = 0; x < sw_frame->width; ++x)
+                row[x] = uv_black;
+        }
+    } else {
+        for(int y = 0; y < sw_frame->height; ++y)
+            memset(sw_frame->data[0] + (size_t)y * sw_frame->linesize[0], full_range ? 0 : 16, sw_frame->width);
+        for(int y = 0; y < sw_frame->height / 2; ++y)
+            memset(sw_frame->data[1] + (size_t)y * sw_frame->linesize[1], 128, sw_frame->width);
+    }
+}
+
+static int gsr_capture_screencopy_start(gsr_capture *cap, AVCodecContext *video_codec_context) {
+    gsr_capture_screencopy *cap_screencopy = cap->priv;
+    gsr_egl *egl = cap_screencopy->params.egl;
+
+    if(!egl->wayland.dpy) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_start: screencopy capture requires wayland\n");
+        gsr_capture_screencopy_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    if(!egl->wayland.screencopy_manager || !egl->wayland.shm) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_start: the wayland compositor doesn't support wlr-screencopy (version 3)\n");
+        gsr_capture_screencopy_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    cap_screencopy->output = get_wayland_output_by_name(egl, cap_screencopy->params.display_to_capture);
+    if(!cap_screencopy->output) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_start: failed to find wayland output \"%s\"\n", cap_screencopy->params.display_to_capture);
+        gsr_capture_screencopy_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    /* Without a gpu the compositor copies to shm and the frames are converted on the cpu */
+    if(egl->wayland.linux_dmabuf && !cap_screencopy->params.software_encoding) {
+        char render_path[128];
+        if(gsr_card_path_get_render_path(egl->card_path, render_path)) {
+            cap_screencopy->gbm_fd = open(render_path, O_RDWR | O_CLOEXEC);
+            if(cap_screencopy->gbm_fd > 0)
+                cap_screencopy->gbm = gbm_create_device(cap_screencopy->gbm_fd);
+        }
+
+        if(cap_screencopy->gbm)
+            cap_screencopy->use_dmabuf = true;
+        else
+            fprintf(stderr, "gsr warning: gsr_capture_screencopy_start: failed to create gbm device, using shm instead of dma-buf\n");
+    }
+
+    /* The size of the video has to be known before the encoder is created, the size of the first frame is used */
+    gsr_capture_screencopy_request_frame(cap_screencopy);
+    while(!cap_screencopy->frame_buffer_done && !cap_screencopy->frame_failed && !cap_screencopy->should_stop) {
+        if(wl_display_roundtrip(egl->wayland.dpy) < 0) {
+            fprintf(stderr, "gsr error: gsr_capture_screencopy_start: wayland connection failed\n");
+            gsr_capture_screencopy_stop(cap, video_codec_context);
+            return -1;
+        }
+    }
+
+    if(cap_screencopy->frame_failed || cap_screencopy->should_stop || cap_screencopy->num_buffers == 0) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_start: failed to capture the first frame\n");
+        gsr_capture_screencopy_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    cap_screencopy->capture_size = cap_screencopy->buffer_size;
+
+    video_codec_context->width = max_int(2, even_number_ceil(cap_screencopy->capture_size.x));
+    video_codec_context->height = max_int(2, even_number_ceil(cap_screencopy->capture_size.y));
+
+    if(cap_screencopy->params.software_encoding) {
+        cap_screencopy->sw_frame = av_frame_alloc();
+        if(!cap_screencopy->sw_frame) {
+            fprintf(stderr, "gsr error: gsr_capture_screencopy_start: failed to allocate frame\n");
+            gsr_capture_screencopy_stop(cap, video_codec_context);
+            return -1;
+        }
+        cap_screencopy->sw_frame->format = cap_screencopy->params.hdr ? AV_PIX_FMT_P010LE : AV_PIX_FMT_NV12;
+        cap_screencopy->sw_frame->width = video_codec_context->width;
+        cap_screencopy->sw_frame->height = video_codec_context->height;
+        if(av_frame_get_buffer(cap_screencopy->sw_frame, 0) < 0) {
+            fprintf(stderr, "gsr error: gsr_capture_screencopy_start: failed to allocate %dx%d frame\n", video_codec_context->width, video_codec_context->height);
+            gsr_capture_screencopy_stop(cap, video_codec_context);
+            return -1;
+        }
+        gsr_capture_screencopy_clear_sw_frame(cap_screencopy);
+
+        fprintf(stderr, "gsr info: gsr_capture_screencopy: cpu color conversion: %s, encoding: software\n", gsr_cpu_color_conversion_get_implementation_name());
+        return 0;
+    }
+
+    /* Disable vsync */
+    egl->eglSwapInterval(egl->egl_display, 0);
+
+    if(!drm_create_codec_context(cap_screencopy, video_codec_context)) {
+        gsr_capture_screencopy_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    return 0;
+}
+
+#define FOURCC_NV12 842094158
+#define FOURCC_P010 808530000
+
+static void gsr_capture_screencopy_tick(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame **frame) {
+    gsr_capture_screencopy *cap_screencopy = cap->priv;
+
+    if(!cap_screencopy->created_hw_frame) {
+        cap_screencopy->created_hw_frame = true;
+
+        av_frame_free(frame);
+        *frame = av_frame_alloc();
+        if(!frame) {
+            fprintf(stderr, "gsr error: gsr_capture_screencopy_tick: failed to allocate frame\n");
+            cap_screencopy->should_stop = true;
+            cap_screencopy->stop_is_error = true;
+            return;
+        }
+        (*frame)->format = video_codec_context->pix_fmt;
+        (*frame)->width = video_codec_context->width;
+        (*frame)->height = video_codec_context->height;
+        (*frame)->color_range = video_codec_context->color_range;
+        (*frame)->color_primaries = video_codec_context->color_primaries;
+        (*frame)->color_trc = video_codec_context->color_trc;
+        (*frame)->colorspace = video_codec_context->colorspace;
+        (*frame)->chroma_location = video_codec_context->chroma_sample_location;
+
+        int res = 0;
+        if(cap_screencopy->params.software_encoding)
+            res = av_frame_get_buffer(*frame, 0);
+        else
+            res = av_hwframe_get_buffer(video_codec_context->hw_frames_ctx, *frame, 0);
+
+        if(res < 0) {
+            fprintf(stderr, "gsr error: gsr_capture_screencopy_tick: failed to allocate frame: %d\n", res);
+            cap_screencopy->should_stop = true;
+            cap_screencopy->stop_is_error = true;
+            return;
+        }
+
+        /* The frames are converted on the cpu, no color conversion on the gpu is needed */
+        if(cap_screencopy->params.software_encoding)
+            return;
+
+        VASurfaceID target_surface_id = (uintptr_t)(*frame)->data[3];
+
+        VAStatus va_status = vaExportSurfaceHandle(cap_screencopy->va_dpy, target_surface_id, VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2, VA_EXPORT_SURFACE_WRITE_ONLY | VA_EXPORT_SURFACE_SEPARATE_LAYERS, &cap_screencopy->prime);
+        if(va_status != VA_STATUS_SUCCESS) {
+            fprintf(stderr, "gsr error: gsr_capture_screencopy_tick: vaExportSurfaceHandle failed, error: %d\n", va_status);
+            cap_screencopy->should_stop = true;
+            cap_screencopy->stop_is_error = true;
+            return;
+        }
+        vaSyncSurface(cap_screencopy->va_dpy, target_surface_id);
+
+        const uint32_t formats_nv12[2] = { fourcc('R', '8', ' ', ' '), fourcc('G', 'R', '8', '8') };
+        const uint32_t formats_p010[2] = { fourcc('R', '1', '6', ' '), fourcc('G', 'R', '3', '2') };
+
+        if(cap_screencopy->prime.fourcc == FOURCC_NV12 || cap_screencopy->prime.fourcc == FOURCC_P010) {
+            const uint32_t *formats = cap_screencopy->prime.fourcc == FOURCC_NV12 ? formats_nv12 : formats_p010;
+
+            cap_screencopy->params.egl->glGenTextures(2, cap_screencopy->target_textures);
+            for(int i = 0; i < 2; ++i) {
+                const int layer = i;
+                const int plane = 0;
+
+                const int div[2] = {1, 2}; // divide UV texture size by 2 because chroma is half size
+
+                const intptr_t img_attr[] = {
+                    EGL_LINUX_DRM_FOURCC_EXT,       formats[i],
+                    EGL_WIDTH,                      cap_screencopy->prime.width / div[i],
+                    EGL_HEIGHT,                     cap_screencopy->prime.height / div[i],
+                    EGL_DMA_BUF_PLANE0_FD_EXT,      cap_screencopy->prime.objects[cap_screencopy->prime.layers[layer].object_index[plane]].fd,
+                    EGL_DMA_BUF_PLANE0_OFFSET_EXT,  cap_screencopy->prime.layers[layer].offset[plane],
+                    EGL_DMA_BUF_PLANE0_PITCH_EXT,   cap_screencopy->prime.layers[layer].pitch[plane],
+                    EGL_NONE
+                };
+
+                while(cap_screencopy->params.egl->eglGetError() != EGL_SUCCESS){}
+                EGLImage image = cap_screencopy->params.egl->eglCreateImage(cap_screencopy->params.egl->egl_display, 0, EGL_LINUX_DMA_BUF_EXT, NULL, img_attr);
+                if(!image) {
+                    fprintf(stderr, "gsr error: gsr_capture_screencopy_tick: failed to create egl image from drm fd for output drm fd, error: %d\n", cap_screencopy->params.egl->eglGetError());
+                    cap_screencopy->should_stop = true;
+                    cap_screencopy->stop_is_error = true;
+                    return;
+                }
+
+                cap_screencopy->params.egl->glBindTexture(GL_TEXTURE_2D, cap_screencopy->target_textures[i]);
+                cap_screencopy->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                cap_screencopy->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                cap_screencopy->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                cap_screencopy->params.egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+                while(cap_screencopy->params.egl->glGetError()) {}
+                while(cap_screencopy->params.egl->eglGetError() != EGL_SUCCESS){}
+                cap_screencopy->params.egl->glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+                if(cap_screencopy->params.egl->glGetError() != 0 || cap_screencopy->params.egl->eglGetError() != EGL_SUCCESS) {
+                    fprintf(stderr, "gsr error: gsr_capture_screencopy_tick: failed to bind egl image to gl texture, error: %d\n", cap_screencopy->params.egl->eglGetError());
+                    cap_screencopy->should_stop = true;
+                    cap_screencopy->stop_is_error = true;
+                    cap_screencopy->params.egl->eglDestroyImage(cap_screencopy->params.egl->egl_display, image);
+                    cap_screencopy->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
+                    return;
+                }
+
+                cap_screencopy->params.egl->eglDestroyImage(cap_screencopy->params.egl->egl_display, image);
+                cap_screencopy->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
+            }
+
+            gsr_color_conversion_params color_conversion_params = {0};
+            color_conversion_params.color_range = cap_screencopy->params.color_range;
+            color_conversion_params.egl = cap_screencopy->params.egl;
+            color_conversion_params.source_color = GSR_SOURCE_COLOR_RGB;
+            if(cap_screencopy->prime.fourcc == FOURCC_NV12)
+                color_conversion_params.destination_color = GSR_DESTINATION_COLOR_NV12;
+            else
+                color_conversion_params.destination_color = GSR_DESTINATION_COLOR_P010;
+
+            color_conversion_params.destination_textures[0] = cap_screencopy->target_textures[0];
+            color_conversion_params.destination_textures[1] = cap_screencopy->target_textures[1];
+            color_conversion_params.num_destination_textures = 2;
+
+            if(gsr_color_conversion_init(&cap_screencopy->color_conversion, &color_conversion_params) != 0) {
+                fprintf(stderr, "gsr error: gsr_capture_screencopy_tick: failed to create color conversion\n");
+                cap_screencopy->should_stop = true;
+                cap_screencopy->stop_is_error = true;
+                return;
+            }
+        } else {
+            fprintf(stderr, "gsr error: gsr_capture_screencopy_tick: unexpected fourcc %u for output drm fd, expected nv12 or p010\n", cap_screencopy->prime.fourcc);
+            cap_screencopy->should_stop = true;
+            cap_screencopy->stop_is_error = true;
+            return;
+        }
+    }
+}
+
+static bool gsr_capture_screencopy_should_stop(gsr_capture *cap, bool *err) {
+    gsr_capture_screencopy *cap_screencopy = cap->priv;
+    if(cap_screencopy->params.egl->wayland.dpy && wl_display_get_error(cap_screencopy->params.egl->wayland.dpy) != 0) {
+        cap_screencopy->should_stop = true;
+        cap_screencopy->stop_is_error = true;
+    }
+
+    if(cap_screencopy->should_stop) {
+        if(err)
+            *err = cap_screencopy->stop_is_error;
+        return true;
+    }
+
+    if(err)
+        *err = false;
+    return false;
+}
+
+/* Only the damaged region is uploaded, the rest of |shm_texture| already has the content of the previous frames */
+static void gsr_capture_screencopy_upload_shm(gsr_capture_screencopy *cap_screencopy) {
+    const int bytes_per_pixel = 4;
+    const vec2i size = cap_screencopy->buffer_size;
+    const unsigned int gl_format = drm_format_to_gl_format(cap_screencopy->buffer_format);
+    gsr_egl *egl = cap_screencopy->params.egl;
+
+    if(!cap_screencopy->shm_texture)
+        cap_screencopy->shm_texture = gsr_capture_screencopy_create_texture(egl);
+
+    egl->glBindTexture(GL_TEXTURE_2D, cap_screencopy->shm_texture);
+    egl->glPixelStorei(GL_UNPACK_ROW_LENGTH, cap_screencopy->buffer_stride / bytes_per_pixel);
+    if(cap_screencopy->shm_texture_needs_full_upload || !cap_screencopy->has_damage) {
+        egl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, gl_format, GL_UNSIGNED_BYTE, cap_screencopy->shm_data);
+        cap_screencopy->shm_texture_needs_full_upload = false;
+    } else {
+        const vec2i damage_min = { max_int(0, cap_screencopy->damage_min.x), max_int(0, cap_screencopy->damage_min.y) };
+        const vec2i damage_max = { min_int(size.x, cap_screencopy->damage_max.x), min_int(size.y, cap_screencopy->damage_max.y) };
+        if(damage_max.x > damage_min.x && damage_max.y > damage_min.y) {
+            const uint8_t *damage_data = (const uint8_t*)cap_screencopy->shm_data + (size_t)damage_min.y * cap_screencopy->buffer_stride + (size_t)damage_min.x * bytes_per_pixel;
+            egl->glTexSubImage2D(GL_TEXTURE_2D, 0, damage_min.x, damage_min.y, damage_max.x - damage_min.x, damage_max.y - damage_min.y, gl_format, GL_UNSIGNED_BYTE, damage_data);
+        }
+    }
+    egl->glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    egl->glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/*
+    Only the damaged region is converted, the rest of |sw_frame| already has the content of the previous frames.
+    If the output is resized while recording then the frame is cropped to the video size.
+*/
+static void gsr_capture_screencopy_convert_shm(gsr_capture_screencopy *cap_screencopy) {
+    const int bytes_per_pixel = 4;
+    const vec2i buffer_size = cap_screencopy->buffer_size;
+    const vec2i size = { min_int(buffer_size.x, cap_screencopy->capture_size.x), min_int(buffer_size.y, cap_screencopy->capture_size.y) };
+    AVFrame *sw_frame = cap_screencopy->sw_frame;
+
+    vec2i min = { 0, 0 };
+    vec2i max = size;
+    if(cap_screencopy->shm_texture_needs_full_upload) {
+        /* The new buffer can be smaller than the video */
+        gsr_capture_screencopy_clear_sw_frame(cap_screencopy);
+        cap_screencopy->shm_texture_needs_full_upload = false;
+    } else if(cap_screencopy->has_damage && !cap_screencopy->y_invert) {
+        min = (vec2i){ max_int(0, cap_screencopy->damage_min.x), max_int(0, cap_screencopy->damage_min.y) };
+        max = (vec2i){ min_int(size.x, cap_screencopy->damage_max.x), min_int(size.y, cap_screencopy->damage_max.y) };
+    }
+
+    /* Each chroma sample is shared by 2x2 pixels, so the rectangle is expanded to cover whole chroma samples */
+    min.x &= ~1;
+    min.y &= ~1;
+    max.x = min_int(even_number_ceil(max.x), size.x);
+    max.y = min_int(even_number_ceil(max.y), size.y);
+    if(max.x <= min.x || max.y <= min.y)
+        return;
+
+    /* A y-inverted buffer is read from the bottom row up, with a negative stride */
+    const int first_row = cap_screencopy->y_invert ? buffer_size.y - 1 - min.y : min.y;
+    const int stride = cap_screencopy->y_invert ? -(int)cap_screencopy->buffer_stride : (int)cap_screencopy->buffer_stride;
+    const int bytes_per_sample = cap_screencopy->params.hdr ? 2 : 1;
+
+    const gsr_cpu_source_image source = {
+        .data = (const uint8_t*)cap_screencopy->shm_data + (size_t)first_row * cap_screencopy->buffer_stride + (size_t)min.x * bytes_per_pixel,
+        .stride = stride,
+        .width = max.x - min.x,
+        .height = max.y - min.y,
+        .format = drm_format_to_gl_format(cap_screencopy->buffer_format) == GL_BGRA ? GSR_CPU_SOURCE_FORMAT_BGRA : GSR_CPU_SOURCE_FORMAT_RGBA
+    };
+
+    const gsr_cpu_destination_image destination = {
+        .y = sw_frame->data[0] + (size_t)min.y * sw_frame->linesize[0] + (size_t)min.x * bytes_per_sample,
+        .y_stride = sw_frame->linesize[0],
+        .uv = sw_frame->data[1] + (size_t)(min.y / 2) * sw_frame->linesize[1] + (size_t)min.x * bytes_per_sample,
+        .uv_stride = sw_frame->linesize[1]
+    };
+
+    gsr_cpu_color_conversion_convert(&source, &destination, cap_screencopy->params.hdr ? GSR_DESTINATION_COLOR_P010 : GSR_DESTINATION_COLOR_NV12, cap_screencopy->params.color_range);
+}
+
+static int gsr_capture_screencopy_capture(gsr_capture *cap, AVFrame *frame) {
+    gsr_capture_screencopy *cap_screencopy = cap->priv;
+    gsr_egl *egl = cap_screencopy->params.egl;
+
+    gsr_capture_screencopy_dispatch(egl->wayland.dpy);
+    if(cap_screencopy->should_stop)
+        return -1;
+
+    bool updated = false;
+    if(cap_screencopy->frame_ready) {
+        cap_screencopy->num_failed_frames = 0;
+        cap_screencopy->y_invert = cap_screencopy->frame_y_invert;
+        if(cap_screencopy->buffers_are_dmabuf) {
+            cap_screencopy->ready_index = cap_screencopy->copy_index;
+        } else {
+            if(cap_screencopy->params.software_encoding)
+                gsr_capture_screencopy_convert_shm(cap_screencopy);
+            else
+                gsr_capture_screencopy_upload_shm(cap_screencopy);
+            cap_screencopy->ready_index = 0;
+        }
+        updated = true;
+        cap_screencopy->has_damage = false;
+        gsr_capture_screencopy_destroy_frame(cap_screencopy);
+    } else if(cap_screencopy->frame_failed) {
+        if(cap_screencopy->buffers_are_dmabuf && cap_screencopy->use_dmabuf) {
+            fprintf(stderr, "gsr warning: gsr_capture_screencopy_capture: the compositor failed to copy to dma-buf, using shm instead\n");
+            cap_screencopy->use_dmabuf = false;
+        }
+
+        ++cap_screencopy->num_failed_frames;
+        if(cap_screencopy->num_failed_frames >= GSR_SCREENCOPY_MAX_FAILED_FRAMES) {
+            fprintf(stderr, "gsr error: gsr_capture_screencopy_capture: failed to capture %d frames in a row, stopping\n", cap_screencopy->num_failed_frames);
+            cap_screencopy->should_stop = true;
+            cap_screencopy->stop_is_error = true;
+            return -1;
+        }
+        /* The damage received so far is kept and uploaded together with the damage of the next frame */
+        gsr_capture_screencopy_destroy_frame(cap_screencopy);
+    }
+
+    /* The next frame is requested right away so the compositor can copy it while this frame is encoded */
+    if(!cap_screencopy->frame) {
+        gsr_capture_screencopy_request_frame(cap_screencopy);
+        wl_display_flush(egl->wayland.dpy);
+    }
+
+    if(cap_screencopy->ready_index < 0)
+        return -1;
+
+    if(cap_screencopy->params.software_encoding) {
+        /* Nothing has changed on the output, the frame already has the content of the previous frame */
+        if(!updated)
+            return 0;
+
+        /* The encoder may still reference the frame that was sent last, in which case a new buffer is allocated */
+        int res = av_frame_make_writable(frame);
+        if(res >= 0)
+            res = av_frame_copy(frame, cap_screencopy->sw_frame);
+
+        if(res < 0) {
+            fprintf(stderr, "gsr error: gsr_capture_screencopy_capture: failed to copy frame: %d\n", res);
+            cap_screencopy->should_stop = true;
+            cap_screencopy->stop_is_error = true;
+            return -1;
+        }
+        return 0;
+    }
+
+    const unsigned int texture = cap_screencopy->buffers_are_dmabuf ? cap_screencopy->buffers[cap_screencopy->ready_index].texture : cap_screencopy->shm_texture;
+    const vec2i texture_size = cap_screencopy->buffer_size;
+
+    egl->glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    egl->glClear(GL_COLOR_BUFFER_BIT);
+
+    /*
+        The cursor is drawn in the frames by the compositor. If the output is resized while recording then the frame is cropped to the video size.
+        A y-inverted texture is drawn from the bottom row up with a negative height.
+    */
+    const bool y_invert = cap_screencopy->y_invert;
+    const gsr_color_conversion_layer layer = {
+        .texture_id = texture,
+        .source_pos = (vec2i){0, 0},
+        .source_size = texture_size,
+        .texture_pos = (vec2i){0, y_invert ? texture_size.y : 0},
+        .texture_size = (vec2i){texture_size.x, y_invert ? -texture_size.y : texture_size.y},
+        .texture_full_size = texture_size,
+        .rotation = 0.0f,
+        .external_texture = false
+    };
+    gsr_color_conversion_draw_layers(&cap_screencopy->color_conversion, &layer, 1);
+
+    egl->eglSwapBuffers(egl->egl_display, egl->egl_surface);
+    return 0;
+}
+
+static void gsr_capture_screencopy_stop(gsr_capture *cap, AVCodecContext *video_codec_context) {
+    gsr_capture_screencopy *cap_screencopy = cap->priv;
+
+    gsr_capture_screencopy_destroy_frame(cap_screencopy);
+    gsr_capture_screencopy_destroy_buffers(cap_screencopy);
+    if(cap_screencopy->params.egl->wayland.dpy)
+        wl_display_flush(cap_screencopy->params.egl->wayland.dpy);
+
+    if(cap_screencopy->gbm) {
+        gbm_device_destroy(cap_screencopy->gbm);
+        cap_screencopy->gbm = NULL;
+    }
+
+    if(cap_screencopy->gbm_fd > 0) {
+        close(cap_screencopy->gbm_fd);
+        cap_screencopy->gbm_fd = 0;
+    }
+
+    gsr_color_conversion_deinit(&cap_screencopy->color_conversion);
+
+    for(uint32_t i = 0; i < cap_screencopy->prime.num_objects; ++i) {
+        if(cap_screencopy->prime.objects[i].fd > 0) {
+            close(cap_screencopy->prime.objects[i].fd);
+            cap_screencopy->prime.objects[i].fd = 0;
+        }
+    }
+
+    if(cap_screencopy->params.egl->egl_context) {
+        if(cap_screencopy->shm_texture) {
+            cap_screencopy->params.egl->glDeleteTextures(1, &cap_screencopy->shm_texture);
+            cap_screencopy->shm_texture = 0;
+        }
+
+        cap_screencopy->params.egl->glDeleteTextures(2, cap_screencopy->target_textures);
+        cap_screencopy->target_textures[0] = 0;
+        cap_screencopy->target_textures[1] = 0;
+    }
+
+    av_frame_free(&cap_screencopy->sw_frame);
+
+    if(video_codec_context->hw_device_ctx)
+        av_buffer_unref(&video_codec_context->hw_device_ctx);
+    if(video_codec_context->hw_frames_ctx)
+        av_buffer_unref(&video_codec_context->hw_frames_ctx);
+}
+
+static void gsr_capture_screencopy_destroy(gsr_capture *cap, AVCodecContext *video_codec_context) {
+    gsr_capture_screencopy *cap_screencopy = cap->priv;
+    if(cap->priv) {
+        gsr_capture_screencopy_stop(cap, video_codec_context);
+        free((void*)cap_screencopy->params.display_to_capture);
+        cap_screencopy->params.display_to_capture = NULL;
+        free(cap->priv);
+        cap->priv = NULL;
+    }
+    free(cap);
+}
+
+gsr_capture* gsr_capture_screencopy_create(const gsr_capture_screencopy_params *params) {
+    if(!params) {
+        fprintf(stderr, "gsr error: gsr_capture_screencopy_create params is NULL\n");
+        return NULL;
+    }
+
+    gsr_capture *cap = calloc(1, sizeof(gsr_capture));
+    if(!cap)
+        return NULL;
+
+    gsr_capture_screencopy *cap_screencopy = calloc(1, sizeof(gsr_capture_screencopy));
+    if(!cap_screencopy) {
+        free(cap);
+        return NULL;
+    }
+
+    const char *display_to_capture = strdup(params->display_to_capture);
+    if(!display_to_capture) {
+        free(cap);
+        free(cap_screencopy);
+        return NULL;
+    }
+
+    cap_screencopy->params = *params;
+    cap_screencopy->params.display_to_capture = display_to_capture;
+    cap_screencopy->ready_index = -1;
+
+    *cap = (gsr_capture) {
+        .start = gsr_capture_screencopy_start,
+        .tick = gsr_capture_screencopy_tick,
+        .should_stop = gsr_capture_screencopy_should_stop,
+        .capture = gsr_capture_screencopy_capture,
+        .capture_end = NULL,
+        .get_cursor_position = NULL,
+        .destroy = gsr_capture_screencopy_destroy,
+        .priv = cap_screencopy
+    };
+
+    return cap;
+}
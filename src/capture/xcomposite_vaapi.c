@@ -26,6 +26,7 @@ typedef struct {
     Window window;
     vec2i window_size;
     vec2i texture_size;
+    vec2i target_pos; /* Where the window is drawn in the frame */
     double window_resize_timer;
     
     WindowTexture window_texture;
@@ -442,6 +443,7 @@ static int gsr_capture_xcomposite_vaapi_capture(gsr_capture *cap, AVFrame *frame
 
     const int target_x = max_int(0, frame->width / 2 - cap_xcomp->texture_size.x / 2);
     const int target_y = max_int(0, frame->height / 2 - cap_xcomp->texture_size.y / 2);
+    cap_xcomp->target_pos = (vec2i){target_x, target_y};
 
     gsr_color_conversion_draw(&cap_xcomp->color_conversion, window_texture_get_opengl_texture_id(&cap_xcomp->window_texture),
         (vec2i){target_x, target_y}, cap_xcomp->texture_size,
@@ -455,6 +457,26 @@ static int gsr_capture_xcomposite_vaapi_capture(gsr_capture *cap, AVFrame *frame
     return 0;
 }
 
+static bool gsr_capture_xcomposite_vaapi_get_cursor_position(gsr_capture *cap, vec2i *position) {
+    gsr_capture_xcomposite_vaapi *cap_xcomp = cap->priv;
+
+    Window root_window = None;
+    Window child_window = None;
+    int root_x = 0;
+    int root_y = 0;
+    int window_x = 0;
+    int window_y = 0;
+    unsigned int mask = 0;
+    if(!XQueryPointer(cap_xcomp->params.egl->x11.dpy, cap_xcomp->window, &root_window, &child_window, &root_x, &root_y, &window_x, &window_y, &mask))
+        return false;
+
+    if(window_x < 0 || window_y < 0 || window_x >= cap_xcomp->texture_size.x || window_y >= cap_xcomp->texture_size.y)
+        return false;
+
+    *position = (vec2i){cap_xcomp->target_pos.x + window_x, cap_xcomp->target_pos.y + window_y};
+    return true;
+}
+
 static void gsr_capture_xcomposite_vaapi_stop(gsr_capture *cap, AVCodecContext *video_codec_context) {
     gsr_capture_xcomposite_vaapi *cap_xcomp = cap->priv;
 
@@ -515,6 +537,7 @@ gsr_capture* gsr_capture_xcomposite_vaapi_create(const gsr_capture_xcomposite_va
         .should_stop = gsr_capture_xcomposite_vaapi_should_stop,
         .capture = gsr_capture_xcomposite_vaapi_capture,
         .capture_end = NULL,
+        .get_cursor_position = gsr_capture_xcomposite_vaapi_get_cursor_position,
         .destroy = gsr_capture_xcomposite_vaapi_destroy,
         .priv = cap_xcomp
     };
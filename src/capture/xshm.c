@@ -0,0 +1,579 @@
+#include "../../include/capture/xshm.h"
+#include "../../include/cpu_color_conversion.h"
+#include "../../include/utils.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xfixes.h>
+#include <X11/extensions/Xdamage.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/hwcontext_vaapi.h>
+#include <libavutil/frame.h>
+#include <libavcodec/avcodec.h>
+
+/*
+    Every damaged rectangle is a round trip to the x server, so if there are more rectangles than this
+    (or if most of the screen is damaged) then the whole screen is copied in one request instead
+*/
+#define GSR_XSHM_MAX_DAMAGE_RECTS 32
+
+typedef struct {
+    gsr_capture_xshm_params params;
+    XEvent xev;
+
+    bool should_stop;
+    bool stop_is_error;
+    bool created_hw_frame;
+
+    vec2i capture_pos;
+    vec2i capture_size;
+
+    /* Has the content of the captured area of the previous frames, only the damaged parts are updated */
+    XShmSegmentInfo shm_info;
+    XImage *image;
+    /* Damaged rectangles are copied here first and then to |image|, since XShmGetImage always writes to the start of the shared memory */
+    XShmSegmentInfo scratch_shm_info;
+    XImage *scratch_image;
+    gsr_cpu_source_format source_format;
+
+    int damage_event;
+    Damage damage; /* None if the x server doesn't support the damage extension, then the whole screen is copied every frame */
+    XserverRegion damage_region;
+    bool damaged;
+    bool needs_full_capture;
+
+    /* NV12 or P010, uploaded to the vaapi frame (or copied to the software frame) when something has changed */
+    AVFrame *sw_frame;
+} gsr_capture_xshm;
+
+static int max_int(int a, int b) {
+    return a > b ? a : b;
+}
+
+static int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+static void gsr_capture_xshm_stop(gsr_capture *cap, AVCodecContext *video_codec_context);
+
+static bool drm_create_codec_context(gsr_capture_xshm *cap_xshm, AVCodecContext *video_codec_context) {
+    char render_path[128];
+    if(!gsr_card_path_get_render_path(cap_xshm->params.egl->card_path, render_path)) {
+        fprintf(stderr, "gsr error: failed to get /dev/dri/renderDXXX file from %s\n", cap_xshm->params.egl->card_path);
+        return false;
+    }
+
+    AVBufferRef *device_ctx;
+    if(av_hwdevice_ctx_create(&device_ctx, AV_HWDEVICE_TYPE_VAAPI, render_path, NULL, 0) < 0) {
+        fprintf(stderr, "Error: Failed to create hardware device context\n");
+        return false;
+    }
+
+    AVBufferRef *frame_context = av_hwframe_ctx_alloc(device_ctx);
+    if(!frame_context) {
+        fprintf(stderr, "Error: Failed to create hwframe context\n");
+        av_buffer_unref(&device_ctx);
+        return false;
+    }
+
+    AVHWFramesContext *hw_frame_context =
+        (AVHWFramesContext *)frame_context->data;
+    hw_frame_context->width = video_codec_context->width;
+    hw_frame_context->height = video_codec_context->height;
+    hw_frame_context->sw_format = cap_xshm->params.hdr ? AV_PIX_FMT_P010LE : AV_PIX_FMT_NV12;
+    hw_frame_context->format = video_codec_context->pix_fmt;
+    hw_frame_context->device_ref = device_ctx;
+    hw_frame_context->device_ctx = (AVHWDeviceContext*)device_ctx->data;
+
+    hw_frame_context->initial_pool_size = 1;
+
+    if (av_hwframe_ctx_init(frame_context) < 0) {
+        fprintf(stderr, "Error: Failed to initialize hardware frame context "
+                        "(note: ffmpeg version needs to be > 4.0)\n");
+        av_buffer_unref(&device_ctx);
+        //av_buffer_unref(&frame_context);
+        return false;
+    }
+
+    video_codec_context->hw_device_ctx = av_buffer_ref(device_ctx);
+    video_codec_context->hw_frames_ctx = av_buffer_ref(frame_context);
+    return true;
+}
+
+static XImage* gsr_capture_xshm_create_shm_image(Display *dpy, XShmSegmentInfo *shm_info, vec2i size) {
+    const int screen = DefaultScreen(dpy);
+    XImage *image = XShmCreateImage(dpy, DefaultVisual(dpy, screen), DefaultDepth(dpy, screen), ZPixmap, NULL, shm_info, size.x, size.y);
+    if(!image) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_create_shm_image: XShmCreateImage failed\n");
+        return NULL;
+    }
+
+    shm_info->shmid = shmget(IPC_PRIVATE, (size_t)image->bytes_per_line * (size_t)image->height, IPC_CREAT | 0600);
+    if(shm_info->shmid < 0) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_create_shm_image: failed to create %dx%d shared memory segment\n", size.x, size.y);
+        XDestroyImage(image);
+        return NULL;
+    }
+
+    shm_info->shmaddr = image->data = shmat(shm_info->shmid, NULL, 0);
+    if(shm_info->shmaddr == (char*)-1) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_create_shm_image: failed to attach shared memory segment\n");
+        shmctl(shm_info->shmid, IPC_RMID, NULL);
+        XDestroyImage(image);
+        return NULL;
+    }
+    shm_info->readOnly = False;
+
+    if(!XShmAttach(dpy, shm_info)) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_create_shm_image: XShmAttach failed\n");
+        shmdt(shm_info->shmaddr);
+        shmctl(shm_info->shmid, IPC_RMID, NULL);
+        XDestroyImage(image);
+        return NULL;
+    }
+    XSync(dpy, False);
+
+    /* The segment is removed once both we and the x server have detached from it, even if we crash */
+    shmctl(shm_info->shmid, IPC_RMID, NULL);
+    return image;
+}
+
+static void gsr_capture_xshm_destroy_shm_image(Display *dpy, XShmSegmentInfo *shm_info, XImage **image) {
+    if(!*image)
+        return;
+
+    XShmDetach(dpy, shm_info);
+    XSync(dpy, False);
+    /* This doesn't free the shared memory */
+    XDestroyImage(*image);
+    *image = NULL;
+    shmdt(shm_info->shmaddr);
+}
+
+/* The rows and columns that are only there because the video size has to be even are never written to by the color conversion */
+static void gsr_capture_xshm_clear_sw_frame(gsr_capture_xshm *cap_xshm) {
+    AVFrame *sw_frame = cap_xshm->sw_frame;
+    const bool full_range = cap_xshm->params.color_range == GSR_COLOR_RANGE_FULL;
+    if(cap_xshm->params.hdr) {
+        const uint16_t y_black = (full_range ? 0 : 64) << 6;
+        const uint16_t uv_black = 512 << 6;
+        for(int y = 0; y < sw_frame->height; ++y) {
+            uint16_t *row = (uint16_t*)(sw_frame->data[0] + (size_t)y * sw_frame->linesize[0]);
+            for(int x = 0; x < sw_frame->width; ++x)
+                row[x] = y_black;
+        }
+        for(int y = 0; y < sw_frame->height / 2; ++y) {
+            uint16_t *row = (uint16_t*)(sw_frame->data[1] + (size_t)y * sw_frame->linesize[1]);
+            for(int x = 0; x < sw_frame->width; ++x)
+                row[x] = uv_black;
+        }
+    } else {
+        for(int y = 0; y < sw_frame->height; ++y)
+            memset(sw_frame->data[0] + (size_t)y * sw_frame->linesize[0], full_range ? 0 : 16, sw_frame->width);
+        for(int y = 0; y < sw_frame->height / 2; ++y)
+            memset(sw_frame->data[1] + (size_t)y * sw_frame->linesize[1], 128, sw_frame->width);
+    }
+}
+
+static int gsr_capture_xshm_start(gsr_capture *cap, AVCodecContext *video_codec_context) {
+    gsr_capture_xshm *cap_xshm = cap->priv;
+    Display *dpy = cap_xshm->params.egl->x11.dpy;
+
+    if(!dpy) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_start: xshm capture requires x11\n");
+        gsr_capture_xshm_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    if(!XShmQueryExtension(dpy)) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_start: the x server doesn't support the MIT-SHM extension\n");
+        gsr_capture_xshm_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    const vec2i screen_size = { WidthOfScreen(DefaultScreenOfDisplay(dpy)), HeightOfScreen(DefaultScreenOfDisplay(dpy)) };
+    if(cap_xshm->params.size.x > 0 && cap_xshm->params.size.y > 0) {
+        cap_xshm->capture_pos.x = max_int(0, cap_xshm->params.pos.x);
+        cap_xshm->capture_pos.y = max_int(0, cap_xshm->params.pos.y);
+        cap_xshm->capture_size.x = min_int(cap_xshm->params.pos.x + cap_xshm->params.size.x, screen_size.x) - cap_xshm->capture_pos.x;
+        cap_xshm->capture_size.y = min_int(cap_xshm->params.pos.y + cap_xshm->params.size.y, screen_size.y) - cap_xshm->capture_pos.y;
+    } else {
+        cap_xshm->capture_pos = (vec2i){ 0, 0 };
+        cap_xshm->capture_size = screen_size;
+    }
+
+    if(cap_xshm->capture_size.x <= 0 || cap_xshm->capture_size.y <= 0) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_start: the area %dx%d+%d+%d is outside the x11 screen (%dx%d)\n",
+            cap_xshm->params.size.x, cap_xshm->params.size.y, cap_xshm->params.pos.x, cap_xshm->params.pos.y, screen_size.x, screen_size.y);
+        gsr_capture_xshm_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    cap_xshm->image = gsr_capture_xshm_create_shm_image(dpy, &cap_xshm->shm_info, cap_xshm->capture_size);
+    cap_xshm->scratch_image = gsr_capture_xshm_create_shm_image(dpy, &cap_xshm->scratch_shm_info, cap_xshm->capture_size);
+    if(!cap_xshm->image || !cap_xshm->scratch_image) {
+        gsr_capture_xshm_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    const XImage *image = cap_xshm->image;
+    if(image->bits_per_pixel == 32 && image->byte_order == LSBFirst && image->red_mask == 0xFF0000 && image->blue_mask == 0xFF) {
+        cap_xshm->source_format = GSR_CPU_SOURCE_FORMAT_BGRA;
+    } else if(image->bits_per_pixel == 32 && image->byte_order == LSBFirst && image->red_mask == 0xFF && image->blue_mask == 0xFF0000) {
+        cap_xshm->source_format = GSR_CPU_SOURCE_FORMAT_RGBA;
+    } else {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_start: unsupported x11 screen format, depth: %d, bits per pixel: %d, red mask: 0x%lx\n", image->depth, image->bits_per_pixel, image->red_mask);
+        gsr_capture_xshm_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    int damage_error = 0;
+    int fixes_event = 0;
+    int fixes_error = 0;
+    if(XDamageQueryExtension(dpy, &cap_xshm->damage_event, &damage_error) && XFixesQueryExtension(dpy, &fixes_event, &fixes_error)) {
+        cap_xshm->damage = XDamageCreate(dpy, DefaultRootWindow(dpy), XDamageReportNonEmpty);
+        cap_xshm->damage_region = XFixesCreateRegion(dpy, NULL, 0);
+        /* The first frame copies everything, so the damage until then isn't needed */
+        XDamageSubtract(dpy, cap_xshm->damage, None, None);
+    } else {
+        fprintf(stderr, "gsr warning: gsr_capture_xshm_start: the x server doesn't support the damage extension, the whole screen will be copied every frame\n");
+    }
+    cap_xshm->needs_full_capture = true;
+
+    video_codec_context->width = max_int(2, even_number_ceil(cap_xshm->capture_size.x));
+    video_codec_context->height = max_int(2, even_number_ceil(cap_xshm->capture_size.y));
+
+    if(!cap_xshm->params.software_encoding && !drm_create_codec_context(cap_xshm, video_codec_context)) {
+        gsr_capture_xshm_stop(cap, video_codec_context);
+        return -1;
+    }
+
+    cap_xshm->sw_frame = av_frame_alloc();
+    if(!cap_xshm->sw_frame) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_start: failed to allocate frame\n");
+        gsr_capture_xshm_stop(cap, video_codec_context);
+        return -1;
+    }
+    cap_xshm->sw_frame->format = cap_xshm->params.hdr ? AV_PIX_FMT_P010LE : AV_PIX_FMT_NV12;
+    cap_xshm->sw_frame->width = video_codec_context->width;
+    cap_xshm->sw_frame->height = video_codec_context->height;
+    if(av_frame_get_buffer(cap_xshm->sw_frame, 0) < 0) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_start: failed to allocate %dx%d frame\n", video_codec_context->width, video_codec_context->height);
+        gsr_capture_xshm_stop(cap, video_codec_context);
+        return -1;
+    }
+    gsr_capture_xshm_clear_sw_frame(cap_xshm);
+
+    fprintf(stderr, "gsr info: gsr_capture_xshm: %dx%d+%d+%d, damage: %s, cpu color conversion: %s, encoding: %s\n",
+        cap_xshm->capture_size.x, cap_xshm->capture_size.y, cap_xshm->capture_pos.x, cap_xshm->capture_pos.y,
+        cap_xshm->damage ? "yes" : "no", gsr_cpu_color_conversion_get_implementation_name(), cap_xshm->params.software_encoding ? "software" : "vaapi");
+    return 0;
+}
+
+static void gsr_capture_xshm_tick(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame **frame) {
+    gsr_capture_xshm *cap_xshm = cap->priv;
+
+    if(!cap_xshm->created_hw_frame) {
+        cap_xshm->created_hw_frame = true;
+
+        av_frame_free(frame);
+        *frame = av_frame_alloc();
+        if(!frame) {
+            fprintf(stderr, "gsr error: gsr_capture_xshm_tick: failed to allocate frame\n");
+            cap_xshm->should_stop = true;
+            cap_xshm->stop_is_error = true;
+            return;
+        }
+        (*frame)->format = video_codec_context->pix_fmt;
+        (*frame)->width = video_codec_context->width;
+        (*frame)->height = video_codec_context->height;
+        (*frame)->color_range = video_codec_context->color_range;
+        (*frame)->color_primaries = video_codec_context->color_primaries;
+        (*frame)->color_trc = video_codec_context->color_trc;
+        (*frame)->colorspace = video_codec_context->colorspace;
+        (*frame)->chroma_location = video_codec_context->chroma_sample_location;
+
+        int res = 0;
+        if(cap_xshm->params.software_encoding)
+            res = av_frame_get_buffer(*frame, 0);
+        else
+            res = av_hwframe_get_buffer(video_codec_context->hw_frames_ctx, *frame, 0);
+
+        if(res < 0) {
+            fprintf(stderr, "gsr error: gsr_capture_xshm_tick: failed to allocate frame: %d\n", res);
+            cap_xshm->should_stop = true;
+            cap_xshm->stop_is_error = true;
+            return;
+        }
+    }
+}
+
+static bool gsr_capture_xshm_should_stop(gsr_capture *cap, bool *err) {
+    gsr_capture_xshm *cap_xshm = cap->priv;
+    if(cap_xshm->should_stop) {
+        if(err)
+            *err = cap_xshm->stop_is_error;
+        return true;
+    }
+
+    if(err)
+        *err = false;
+    return false;
+}
+
+/* |min| and |max| are relative to the captured area. Only that part of |sw_frame| is written to */
+static void gsr_capture_xshm_convert_rect(gsr_capture_xshm *cap_xshm, vec2i min, vec2i max) {
+    /* Each chroma sample is shared by 2x2 pixels, so the rectangle is expanded to cover whole chroma samples */
+    min.x &= ~1;
+    min.y &= ~1;
+    max.x = min_int(even_number_ceil(max.x), cap_xshm->capture_size.x);
+    max.y = min_int(even_number_ceil(max.y), cap_xshm->capture_size.y);
+    if(max.x <= min.x || max.y <= min.y)
+        return;
+
+    const int bytes_per_sample = cap_xshm->params.hdr ? 2 : 1;
+    const XImage *image = cap_xshm->image;
+    AVFrame *sw_frame = cap_xshm->sw_frame;
+
+    const gsr_cpu_source_image source = {
+        .data = (const uint8_t*)image->data + (size_t)min.y * image->bytes_per_line + (size_t)min.x * 4,
+        .stride = image->bytes_per_line,
+        .width = max.x - min.x,
+        .height = max.y - min.y,
+        .format = cap_xshm->source_format
+    };
+
+    const gsr_cpu_destination_image destination = {
+        .y = sw_frame->data[0] + (size_t)min.y * sw_frame->linesize[0] + (size_t)min.x * bytes_per_sample,
+        .y_stride = sw_frame->linesize[0],
+        .uv = sw_frame->data[1] + (size_t)(min.y / 2) * sw_frame->linesize[1] + (size_t)min.x * bytes_per_sample,
+        .uv_stride = sw_frame->linesize[1]
+    };
+
+    gsr_cpu_color_conversion_convert(&source, &destination, cap_xshm->params.hdr ? GSR_DESTINATION_COLOR_P010 : GSR_DESTINATION_COLOR_NV12, cap_xshm->params.color_range);
+}
+
+/* Copies a part of the screen into |image|, relative to the captured area */
+static bool gsr_capture_xshm_copy_rect(gsr_capture_xshm *cap_xshm, vec2i pos, vec2i size) {
+    Display *dpy = cap_xshm->params.egl->x11.dpy;
+    XImage *scratch_image = cap_xshm->scratch_image;
+    const int bytes_per_pixel = 4;
+
+    /* The x server writes as many pixels as the size of the image, so the scratch image is temporarily made the size of the rectangle */
+    const int scratch_width = scratch_image->width;
+    const int scratch_height = scratch_image->height;
+    const int scratch_bytes_per_line = scratch_image->bytes_per_line;
+    scratch_image->width = size.x;
+    scratch_image->height = size.y;
+    scratch_image->bytes_per_line = size.x * bytes_per_pixel;
+    const bool success = XShmGetImage(dpy, DefaultRootWindow(dpy), scratch_image, cap_xshm->capture_pos.x + pos.x, cap_xshm->capture_pos.y + pos.y, AllPlanes);
+    scratch_image->width = scratch_width;
+    scratch_image->height = scratch_height;
+    scratch_image->bytes_per_line = scratch_bytes_per_line;
+
+    if(!success)
+        return false;
+
+    const XImage *image = cap_xshm->image;
+    for(int y = 0; y < size.y; ++y) {
+        memcpy(image->data + (size_t)(pos.y + y) * image->bytes_per_line + (size_t)pos.x * bytes_per_pixel,
+            scratch_image->data + (size_t)y * size.x * bytes_per_pixel,
+            (size_t)size.x * bytes_per_pixel);
+    }
+    return true;
+}
+
+static bool gsr_capture_xshm_copy_full(gsr_capture_xshm *cap_xshm) {
+    Display *dpy = cap_xshm->params.egl->x11.dpy;
+    if(!XShmGetImage(dpy, DefaultRootWindow(dpy), cap_xshm->image, cap_xshm->capture_pos.x, cap_xshm->capture_pos.y, AllPlanes))
+        return false;
+
+    gsr_capture_xshm_convert_rect(cap_xshm, (vec2i){0, 0}, cap_xshm->capture_size);
+    return true;
+}
+
+/* Returns true if anything was copied */
+static bool gsr_capture_xshm_copy_damage(gsr_capture_xshm *cap_xshm) {
+    Display *dpy = cap_xshm->params.egl->x11.dpy;
+
+    /* The damage is cleared before copying so that anything that is drawn while copying is copied next frame */
+    XDamageSubtract(dpy, cap_xshm->damage, None, cap_xshm->damage_region);
+    int num_rects = 0;
+    XRectangle *rects = XFixesFetchRegion(dpy, cap_xshm->damage_region, &num_rects);
+    if(!rects)
+        return false;
+
+    vec2i rects_min[GSR_XSHM_MAX_DAMAGE_RECTS];
+    vec2i rects_max[GSR_XSHM_MAX_DAMAGE_RECTS];
+    int num_damaged = 0;
+    int64_t damaged_area = 0;
+    bool copy_full = num_rects > GSR_XSHM_MAX_DAMAGE_RECTS;
+    for(int i = 0; i < num_rects && !copy_full; ++i) {
+        const vec2i min = {
+            max_int(0, rects[i].x - cap_xshm->capture_pos.x),
+            max_int(0, rects[i].y - cap_xshm->capture_pos.y)
+        };
+        const vec2i max = {
+            min_int(cap_xshm->capture_size.x, rects[i].x + (int)rects[i].width - cap_xshm->capture_pos.x),
+            min_int(cap_xshm->capture_size.y, rects[i].y + (int)rects[i].height - cap_xshm->capture_pos.y)
+        };
+
+        /* Damage outside the captured area */
+        if(max.x <= min.x || max.y <= min.y)
+            continue;
+
+        rects_min[num_damaged] = min;
+        rects_max[num_damaged] = max;
+        ++num_damaged;
+        damaged_area += (int64_t)(max.x - min.x) * (int64_t)(max.y - min.y);
+    }
+    XFree(rects);
+
+    if(!copy_full)
+        copy_full = damaged_area * 2 > (int64_t)cap_xshm->capture_size.x * (int64_t)cap_xshm->capture_size.y;
+
+    if(copy_full)
+        return gsr_capture_xshm_copy_full(cap_xshm);
+
+    bool copied = false;
+    for(int i = 0; i < num_damaged; ++i) {
+        const vec2i size = { rects_max[i].x - rects_min[i].x, rects_max[i].y - rects_min[i].y };
+        if(gsr_capture_xshm_copy_rect(cap_xshm, rects_min[i], size))
+            copied = true;
+    }
+
+    /* The rectangles are converted after all of them have been copied since the expanded chroma rectangles can overlap a rectangle that hasn't been copied yet */
+    if(copied) {
+        for(int i = 0; i < num_damaged; ++i) {
+            gsr_capture_xshm_convert_rect(cap_xshm, rects_min[i], rects_max[i]);
+        }
+    }
+    return copied;
+}
+
+static int gsr_capture_xshm_capture(gsr_capture *cap, AVFrame *frame) {
+    gsr_capture_xshm *cap_xshm = cap->priv;
+    Display *dpy = cap_xshm->params.egl->x11.dpy;
+
+    if(cap_xshm->damage) {
+        while(XCheckTypedEvent(dpy, cap_xshm->damage_event + XDamageNotify, &cap_xshm->xev)) {
+            cap_xshm->damaged = true;
+        }
+    }
+
+    bool updated = false;
+    if(cap_xshm->needs_full_capture || !cap_xshm->damage) {
+        updated = gsr_capture_xshm_copy_full(cap_xshm);
+        if(!updated) {
+            fprintf(stderr, "gsr error: gsr_capture_xshm_capture: failed to copy the screen\n");
+            cap_xshm->should_stop = true;
+            cap_xshm->stop_is_error = true;
+            return -1;
+        }
+        cap_xshm->needs_full_capture = false;
+    } else if(cap_xshm->damaged) {
+        cap_xshm->damaged = false;
+        updated = gsr_capture_xshm_copy_damage(cap_xshm);
+    }
+
+    /* Nothing has changed on the screen, the frame already has the content of the previous frame */
+    if(!updated)
+        return 0;
+
+    if(cap_xshm->params.software_encoding) {
+        /* The encoder may still reference the frame that was sent last, in which case a new buffer is allocated */
+        int res = av_frame_make_writable(frame);
+        if(res >= 0)
+            res = av_frame_copy(frame, cap_xshm->sw_frame);
+
+        if(res < 0) {
+            fprintf(stderr, "gsr error: gsr_capture_xshm_capture: failed to copy frame: %d\n", res);
+            cap_xshm->should_stop = true;
+            cap_xshm->stop_is_error = true;
+            return -1;
+        }
+        return 0;
+    }
+
+    const int res = av_hwframe_transfer_data(frame, cap_xshm->sw_frame, 0);
+    if(res < 0) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_capture: failed to upload frame to vaapi: %d\n", res);
+        cap_xshm->should_stop = true;
+        cap_xshm->stop_is_error = true;
+        return -1;
+    }
+    return 0;
+}
+
+static void gsr_capture_xshm_stop(gsr_capture *cap, AVCodecContext *video_codec_context) {
+    gsr_capture_xshm *cap_xshm = cap->priv;
+    Display *dpy = cap_xshm->params.egl->x11.dpy;
+
+    if(cap_xshm->damage) {
+        XDamageDestroy(dpy, cap_xshm->damage);
+        cap_xshm->damage = None;
+    }
+
+    if(cap_xshm->damage_region) {
+        XFixesDestroyRegion(dpy, cap_xshm->damage_region);
+        cap_xshm->damage_region = None;
+    }
+
+    if(dpy) {
+        gsr_capture_xshm_destroy_shm_image(dpy, &cap_xshm->shm_info, &cap_xshm->image);
+        gsr_capture_xshm_destroy_shm_image(dpy, &cap_xshm->scratch_shm_info, &cap_xshm->scratch_image);
+    }
+
+    av_frame_free(&cap_xshm->sw_frame);
+
+    if(video_codec_context->hw_device_ctx)
+        av_buffer_unref(&video_codec_context->hw_device_ctx);
+    if(video_codec_context->hw_frames_ctx)
+        av_buffer_unref(&video_codec_context->hw_frames_ctx);
+}
+
+static void gsr_capture_xshm_destroy(gsr_capture *cap, AVCodecContext *video_codec_context) {
+    if(cap->priv) {
+        gsr_capture_xshm_stop(cap, video_codec_context);
+        free(cap->priv);
+        cap->priv = NULL;
+    }
+    free(cap);
+}
+
+gsr_capture* gsr_capture_xshm_create(const gsr_capture_xshm_params *params) {
+    if(!params) {
+        fprintf(stderr, "gsr error: gsr_capture_xshm_create params is NULL\n");
+        return NULL;
+    }
+
+    gsr_capture *cap = calloc(1, sizeof(gsr_capture));
+    if(!cap)
+        return NULL;
+
+    gsr_capture_xshm *cap_xshm = calloc(1, sizeof(gsr_capture_xshm));
+    if(!cap_xshm) {
+        free(cap);
+        return NULL;
+    }
+
+    cap_xshm->params = *params;
+
+    *cap = (gsr_capture) {
+        .start = gsr_capture_xshm_start,
+        .tick = gsr_capture_xshm_tick,
+        .should_stop = gsr_capture_xshm_should_stop,
+        .capture = gsr_capture_xshm_capture,
+        .capture_end = NULL,
+        .get_cursor_position = NULL,
+        .destroy = gsr_capture_xshm_destroy,
+        .priv = cap_xshm
+    };
+
+    return cap;
+}
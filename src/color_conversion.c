@@ -1,4 +1,5 @@
 #include "../include/color_conversion.h"
+#include "../include/color_matrices.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
@@ -13,6 +14,19 @@ static float abs_f(float v) {
     return v >= 0.0f ? v : -v;
 }
 
+static int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+static int max_int(int a, int b) {
+    return a > b ? a : b;
+}
+
+/* Rounds towards negative infinity, unlike the / operator. |b| has to be positive */
+static int floor_div_int(int a, int b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
 #define ROTATE_Z   "mat4 rotate_z(in float angle) {\n"                        \
                    "    return mat4(cos(angle), -sin(angle), 0.0, 0.0,\n"     \
                    "                sin(angle),  cos(angle), 0.0, 0.0,\n"     \
@@ -20,58 +34,23 @@ static float abs_f(float v) {
                    "                0.0,           0.0,      0.0, 1.0);\n"    \
                    "}\n"
 
-/* https://en.wikipedia.org/wiki/YCbCr, see study/color_space_transform_matrix.png */
-
-/* ITU-R BT2020, full */
-/* https://www.itu.int/dms_pubrec/itu-r/rec/bt/R-REC-BT.2020-2-201510-I!!PDF-E.pdf */
-#define RGB_TO_P010_FULL "const mat4 RGBtoYUV = mat4(0.262700, -0.139630,  0.500000, 0.000000,\n" \
-                         "                           0.678000, -0.360370, -0.459786, 0.000000,\n" \
-                         "                           0.059300,  0.500000, -0.040214, 0.000000,\n" \
-                         "                           0.000000,  0.500000,  0.500000, 1.000000);"
-
-/* ITU-R BT2020, limited (full multiplied by (235-16)/255, adding 16/255 to luma) */
-#define RGB_TO_P010_LIMITED "const mat4 RGBtoYUV = mat4(0.225613, -0.119918,  0.429412, 0.000000,\n" \
-                            "                           0.582282, -0.309494, -0.394875, 0.000000,\n" \
-                            "                           0.050928,  0.429412, -0.034537, 0.000000,\n" \
-                            "                           0.062745,  0.500000,  0.500000, 1.000000);"
-
-/* ITU-R BT709, full */
-/* https://www.itu.int/dms_pubrec/itu-r/rec/bt/R-REC-BT.709-6-201506-I!!PDF-E.pdf */
-#define RGB_TO_NV12_FULL "const mat4 RGBtoYUV = mat4(0.212600, -0.114572,  0.500000, 0.000000,\n" \
-                         "                           0.715200, -0.385428, -0.454153, 0.000000,\n" \
-                         "                           0.072200,  0.500000, -0.045847, 0.000000,\n" \
-                         "                           0.000000,  0.500000,  0.500000, 1.000000);"
-
-/* ITU-R BT709, limited (full multiplied by (235-16)/255, adding 16/255 to luma) */
-#define RGB_TO_NV12_LIMITED "const mat4 RGBtoYUV = mat4(0.182586, -0.098397,  0.429412, 0.000000,\n" \
-                            "                           0.614231, -0.331015, -0.390037, 0.000000,\n" \
-                            "                           0.062007,  0.429412, -0.039375, 0.000000,\n" \
-                            "                           0.062745,  0.500000,  0.500000, 1.000000);"
-
-static const char* color_format_range_get_transform_matrix(gsr_destination_color color_format, gsr_color_range color_range) {
-    switch(color_format) {
-        case GSR_DESTINATION_COLOR_NV12: {
-            switch(color_range) {
-                case GSR_COLOR_RANGE_LIMITED:
-                    return RGB_TO_NV12_LIMITED;
-                case GSR_COLOR_RANGE_FULL:
-                    return RGB_TO_NV12_FULL;
-            }
-            break;
-        }
-        case GSR_DESTINATION_COLOR_P010: {
-            switch(color_range) {
-                case GSR_COLOR_RANGE_LIMITED:
-                    return RGB_TO_P010_LIMITED;
-                case GSR_COLOR_RANGE_FULL:
-                    return RGB_TO_P010_FULL;
-            }
-            break;
-        }
-        default:
-            return NULL;
+/* Writes the RGBtoYUV matrix for |color_format| and |color_range| as glsl. The matrices are shared with the cpu color conversion (color_matrices.h) */
+static void color_format_range_get_transform_matrix(gsr_destination_color color_format, gsr_color_range color_range, char *output, size_t output_size) {
+    const gsr_color_matrix *matrix = gsr_color_matrix_get(color_format, color_range);
+    if(!matrix) {
+        output[0] = '\0';
+        return;
     }
-    return NULL;
+
+    snprintf(output, output_size,
+        "const mat4 RGBtoYUV = mat4(%f, %f, %f, 0.000000,\n"
+        "                           %f, %f, %f, 0.000000,\n"
+        "                           %f, %f, %f, 0.000000,\n"
+        "                           %f, %f, %f, 1.000000);",
+        matrix->r[0], matrix->r[1], matrix->r[2],
+        matrix->g[0], matrix->g[1], matrix->g[2],
+        matrix->b[0], matrix->b[1], matrix->b[2],
+        matrix->offset[0], matrix->offset[1], matrix->offset[2]);
 }
 
 static int load_shader_bgr(gsr_shader *shader, gsr_egl *egl, gsr_color_uniforms *uniforms) {
@@ -151,7 +130,8 @@ static int load_shader_bgr_external_texture(gsr_shader *shader, gsr_egl *egl, gs
 }
 
 static int load_shader_y(gsr_shader *shader, gsr_egl *egl, gsr_color_uniforms *uniforms, gsr_destination_color color_format, gsr_color_range color_range) {
-    const char *color_transform_matrix = color_format_range_get_transform_matrix(color_format, color_range);
+    char color_transform_matrix[512];
+    color_format_range_get_transform_matrix(color_format, color_range, color_transform_matrix, sizeof(color_transform_matrix));
 
     char vertex_shader[2048];
     snprintf(vertex_shader, sizeof(vertex_shader),
@@ -194,7 +174,8 @@ static int load_shader_y(gsr_shader *shader, gsr_egl *egl, gsr_color_uniforms *u
 }
 
 static unsigned int load_shader_uv(gsr_shader *shader, gsr_egl *egl, gsr_color_uniforms *uniforms, gsr_destination_color color_format, gsr_color_range color_range) {
-    const char *color_transform_matrix = color_format_range_get_transform_matrix(color_format, color_range);
+    char color_transform_matrix[512];
+    color_format_range_get_transform_matrix(color_format, color_range, color_transform_matrix, sizeof(color_transform_matrix));
 
     char vertex_shader[2048];
     snprintf(vertex_shader, sizeof(vertex_shader),
@@ -236,6 +217,192 @@ static unsigned int load_shader_uv(gsr_shader *shader, gsr_egl *egl, gsr_color_u
     return 0;
 }
 
+/* Image format of the Y and UV destination textures, used by the compute shader */
+static void destination_color_get_image_formats(gsr_destination_color color_format, unsigned int *y_format, unsigned int *uv_format, const char **y_format_glsl, const char **uv_format_glsl) {
+    if(color_format == GSR_DESTINATION_COLOR_P010) {
+        *y_format = GL_R16;
+        *uv_format = GL_RG16;
+        *y_format_glsl = "r16";
+        *uv_format_glsl = "rg16";
+    } else {
+        *y_format = GL_R8;
+        *uv_format = GL_RG8;
+        *y_format_glsl = "r8";
+        *uv_format_glsl = "rg8";
+    }
+}
+
+/*
+    Each invocation converts a 2x2 block of pixels, writing the 4 luma values and 1 chroma value (the average of the 4 pixels).
+    This samples the source texture once per pixel instead of once for Y and once for UV.
+    Blending is done manually (same as glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)) since blending doesn't apply to image stores.
+*/
+static int load_shader_yuv_compute(gsr_shader *shader, gsr_egl *egl, gsr_color_compute_uniforms *uniforms, gsr_destination_color color_format, gsr_color_range color_range) {
+    char color_transform_matrix[512];
+    color_format_range_get_transform_matrix(color_format, color_range, color_transform_matrix, sizeof(color_transform_matrix));
+
+    unsigned int y_format = 0;
+    unsigned int uv_format = 0;
+    const char *y_format_glsl = NULL;
+    const char *uv_format_glsl = NULL;
+    destination_color_get_image_formats(color_format, &y_format, &uv_format, &y_format_glsl, &uv_format_glsl);
+
+    /* One invocation for each chroma sample (2x2 luma pixels). All layers of a batch are blended for each pixel before anything is stored, so chroma is the average of the blended pixels */
+    char compute_shader[8192];
+    const int compute_shader_length = snprintf(compute_shader, sizeof(compute_shader),
+        "#version 430                                                                    \n"
+        "#define MAX_LAYERS %d                                                           \n"
+        "layout(local_size_x = 8, local_size_y = 8) in;                                  \n"
+        "uniform sampler2D textures[MAX_LAYERS];                                         \n"
+        "layout(%s, binding = 0) uniform image2D img_y;                                  \n"
+        "layout(%s, binding = 1) uniform image2D img_uv;                                 \n"
+        "uniform int num_layers;                                                         \n"
+        "uniform ivec2 chroma_origin;                                                    \n"
+        "uniform ivec2 destination_pos[MAX_LAYERS];                                      \n"
+        "uniform ivec2 destination_size[MAX_LAYERS];                                     \n"
+        "uniform ivec2 texture_pos[MAX_LAYERS];                                          \n"
+        "uniform ivec2 texture_size[MAX_LAYERS];                                         \n"
+        "uniform float rotation[MAX_LAYERS];                                             \n"
+        "uniform int swap_texture_size[MAX_LAYERS];                                      \n"
+        "%s                                                                              \n"
+        ROTATE_Z
+        "/* Transparent outside of the destination rectangle of the layer */             \n"
+        "vec4 sample_layer(int layer, ivec2 luma_coord) {                                \n"
+        "  ivec2 relative_pos = luma_coord - destination_pos[layer];                     \n"
+        "  if(any(lessThan(relative_pos, ivec2(0))) || any(greaterThanEqual(relative_pos, destination_size[layer]))) \n"
+        "    return vec4(0.0);                                                           \n"
+        "                                                                                \n"
+        "  ivec2 source_texture_size = textureSize(textures[layer], 0);                  \n"
+        "  if(swap_texture_size[layer] != 0)                                             \n"
+        "    source_texture_size = source_texture_size.yx;                               \n"
+        "  vec2 source_texture_size_f = max(vec2(source_texture_size), vec2(1.0));       \n"
+        "  vec2 texture_pos_norm = vec2(texture_pos[layer]) / source_texture_size_f;     \n"
+        "  vec2 texture_size_norm = vec2(texture_size[layer]) / source_texture_size_f;   \n"
+        "  vec2 texcoords = texture_pos_norm + ((vec2(relative_pos) + vec2(0.5)) / vec2(destination_size[layer])) * texture_size_norm; \n"
+        "  texcoords = (vec4(texcoords.x - 0.5, texcoords.y - 0.5, 0.0, 0.0) * rotate_z(rotation[layer])).xy + vec2(0.5, 0.5); \n"
+        "  return textureLod(textures[layer], texcoords, 0.0);                           \n"
+        "}                                                                               \n"
+        "                                                                                \n"
+        "void main()                                                                     \n"
+        "{                                                                               \n"
+        "  ivec2 chroma_coord = chroma_origin + ivec2(gl_GlobalInvocationID.xy);         \n"
+        "  if(any(greaterThanEqual(chroma_coord, imageSize(img_uv))))                    \n"
+        "    return;                                                                     \n"
+        "                                                                                \n"
+        "  ivec2 luma_size = imageSize(img_y);                                           \n"
+        "  vec2 previous_uv = imageLoad(img_uv, chroma_coord).xy;                        \n"
+        "  vec2 uv_sum = vec2(0.0);                                                      \n"
+        "  bool block_changed = false;                                                   \n"
+        "  for(int i = 0; i < 4; ++i) {                                                  \n"
+        "    ivec2 luma_coord = chroma_coord * 2 + ivec2(i & 1, i >> 1);                 \n"
+        "    if(any(greaterThanEqual(luma_coord, luma_size))) {                          \n"
+        "      uv_sum += previous_uv;                                                    \n"
+        "      continue;                                                                 \n"
+        "    }                                                                           \n"
+        "                                                                                \n"
+        "    /* The chroma of the pixels below the batch is only known for the whole block */ \n"
+        "    vec3 yuv = vec3(imageLoad(img_y, luma_coord).x, previous_uv);               \n"
+        "    bool pixel_changed = false;                                                 \n"
+        "    for(int layer = 0; layer < num_layers; ++layer) {                           \n"
+        "      vec4 pixel = sample_layer(layer, luma_coord);                             \n"
+        "      if(pixel.a <= 0.0)                                                        \n"
+        "        continue;                                                               \n"
+        "      yuv = mix(yuv, (RGBtoYUV * vec4(pixel.rgb, 1.0)).xyz, pixel.a);           \n"
+        "      pixel_changed = true;                                                     \n"
+        "    }                                                                           \n"
+        "                                                                                \n"
+        "    if(pixel_changed) {                                                         \n"
+        "      imageStore(img_y, luma_coord, vec4(yuv.x, 0.0, 0.0, 1.0));                \n"
+        "      block_changed = true;                                                     \n"
+        "    }                                                                           \n"
+        "    uv_sum += yuv.yz;                                                           \n"
+        "  }                                                                             \n"
+        "                                                                                \n"
+        "  if(block_changed)                                                             \n"
+        "    imageStore(img_uv, chroma_coord, vec4(uv_sum * 0.25, 0.0, 1.0));            \n"
+        "}                                                                               \n", GSR_COLOR_CONVERSION_MAX_LAYERS, y_format_glsl, uv_format_glsl, color_transform_matrix);
+
+    if(compute_shader_length < 0 || compute_shader_length >= (int)sizeof(compute_shader)) {
+        fprintf(stderr, "gsr error: load_shader_yuv_compute: compute shader source is too large (%d bytes)\n", compute_shader_length);
+        return -1;
+    }
+
+    if(gsr_shader_init_compute(shader, egl, compute_shader) != 0)
+        return -1;
+
+    uniforms->num_layers = egl->glGetUniformLocation(shader->program_id, "num_layers");
+    uniforms->chroma_origin = egl->glGetUniformLocation(shader->program_id, "chroma_origin");
+
+    gsr_shader_use(shader);
+    for(int i = 0; i < GSR_COLOR_CONVERSION_MAX_LAYERS; ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "textures[%d]", i);
+        /* Texture unit i */
+        egl->glUniform1i(egl->glGetUniformLocation(shader->program_id, name), i);
+
+        snprintf(name, sizeof(name), "destination_pos[%d]", i);
+        uniforms->destination_pos[i] = egl->glGetUniformLocation(shader->program_id, name);
+        snprintf(name, sizeof(name), "destination_size[%d]", i);
+        uniforms->destination_size[i] = egl->glGetUniformLocation(shader->program_id, name);
+        snprintf(name, sizeof(name), "texture_pos[%d]", i);
+        uniforms->texture_pos[i] = egl->glGetUniformLocation(shader->program_id, name);
+        snprintf(name, sizeof(name), "texture_size[%d]", i);
+        uniforms->texture_size[i] = egl->glGetUniformLocation(shader->program_id, name);
+        snprintf(name, sizeof(name), "rotation[%d]", i);
+        uniforms->rotation[i] = egl->glGetUniformLocation(shader->program_id, name);
+        snprintf(name, sizeof(name), "swap_texture_size[%d]", i);
+        uniforms->swap_texture_size[i] = egl->glGetUniformLocation(shader->program_id, name);
+    }
+    gsr_shader_use_none(shader);
+    return 0;
+}
+
+static bool gl_version_at_least(gsr_egl *egl, int major, int minor) {
+    const char *version = (const char*)egl->glGetString(GL_VERSION);
+    if(!version)
+        return false;
+
+    int version_major = 0;
+    int version_minor = 0;
+    if(sscanf(version, "%d.%d", &version_major, &version_minor) != 2)
+        return false;
+
+    return version_major > major || (version_major == major && version_minor >= minor);
+}
+
+/* Returns true if the compute shader can be used. Falls back to the two pass (Y and UV) rendering otherwise */
+static bool load_compute_shader(gsr_color_conversion *self) {
+    gsr_egl *egl = self->params.egl;
+    if(!egl->glDispatchCompute || !egl->glMemoryBarrier || !egl->glBindImageTexture || !gl_version_at_least(egl, 4, 3))
+        return false;
+
+    if(load_shader_yuv_compute(&self->compute_shader, egl, &self->compute_uniforms, self->params.destination_color, self->params.color_range) != 0) {
+        fprintf(stderr, "gsr warning: gsr_color_conversion_init: failed to load compute shader, falling back to rendering Y and UV separately\n");
+        return false;
+    }
+
+    unsigned int y_format = 0;
+    unsigned int uv_format = 0;
+    const char *y_format_glsl = NULL;
+    const char *uv_format_glsl = NULL;
+    destination_color_get_image_formats(self->params.destination_color, &y_format, &uv_format, &y_format_glsl, &uv_format_glsl);
+
+    /* Textures imported from an egl image might not be usable as image units on all drivers */
+    while(egl->glGetError()) {}
+    egl->glBindImageTexture(0, self->params.destination_textures[0], 0, GL_FALSE, 0, GL_READ_WRITE, y_format);
+    egl->glBindImageTexture(1, self->params.destination_textures[1], 0, GL_FALSE, 0, GL_READ_WRITE, uv_format);
+    const bool bound = egl->glGetError() == 0;
+    egl->glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_WRITE, y_format);
+    egl->glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_READ_WRITE, uv_format);
+
+    if(!bound) {
+        gsr_shader_deinit(&self->compute_shader);
+        return false;
+    }
+
+    return true;
+}
+
 static int load_framebuffers(gsr_color_conversion *self) {
     /* TODO: Only generate the necessary amount of framebuffers (self->params.num_destination_textures) */
     const unsigned int draw_buffer = GL_COLOR_ATTACHMENT0;
@@ -273,7 +440,7 @@ static int create_vertices(gsr_color_conversion *self) {
 
     self->params.egl->glGenBuffers(1, &self->vertex_buffer_object_id);
     self->params.egl->glBindBuffer(GL_ARRAY_BUFFER, self->vertex_buffer_object_id);
-    self->params.egl->glBufferData(GL_ARRAY_BUFFER, 24 * sizeof(float), NULL, GL_STREAM_DRAW);
+    self->params.egl->glBufferData(GL_ARRAY_BUFFER, GSR_COLOR_CONVERSION_MAX_LAYERS * 24 * sizeof(float), NULL, GL_STREAM_DRAW);
 
     self->params.egl->glEnableVertexAttribArray(0);
     self->params.egl->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
@@ -326,6 +493,8 @@ int gsr_color_conversion_init(gsr_color_conversion *self, const gsr_color_conver
                 fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to load UV shader\n");
                 goto err;
             }
+
+            self->use_compute_shader = load_compute_shader(self);
             break;
         }
     }
@@ -336,6 +505,12 @@ int gsr_color_conversion_init(gsr_color_conversion *self, const gsr_color_conver
     if(create_vertices(self) != 0)
         goto err;
 
+    /* The destination textures don't change size, so there is no need to query this every frame */
+    self->params.egl->glBindTexture(GL_TEXTURE_2D, self->params.destination_textures[0]);
+    self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &self->destination_texture_size.x);
+    self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &self->destination_texture_size.y);
+    self->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
+
     return 0;
 
     err:
@@ -366,45 +541,105 @@ void gsr_color_conversion_deinit(gsr_color_conversion *self) {
         gsr_shader_deinit(&self->shaders[i]);
     }
 
+    gsr_shader_deinit(&self->compute_shader);
+    self->use_compute_shader = false;
+
     self->params.egl = NULL;
 }
 
-/* |source_pos| is in pixel coordinates and |source_size|  */
-void gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation, bool external_texture) {
+/* Returns true if |rotation| (as given to the shaders) is 90 or 270 degrees, in which case the width and height of the source are swapped */
+static bool rotation_swaps_size(float rotation) {
+    return abs_f(M_PI * 0.5f - rotation) <= 0.001f || abs_f(M_PI * 1.5f - rotation) <= 0.001f;
+}
+
+/* The rotation that the shaders expect */
+static float layer_get_shader_rotation(const gsr_color_conversion_layer *layer) {
     // TODO: Remove this crap
-    rotation = M_PI*2.0f - rotation;
+    return M_PI*2.0f - layer->rotation;
+}
 
-    /* TODO: Do not call this every frame? */
-    vec2i dest_texture_size = {0, 0};
-    self->params.egl->glBindTexture(GL_TEXTURE_2D, self->params.destination_textures[0]);
-    self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &dest_texture_size.x);
-    self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &dest_texture_size.y);
-    self->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
+static void gsr_color_conversion_draw_layers_compute(gsr_color_conversion *self, const gsr_color_conversion_layer *layers, int num_layers) {
+    gsr_egl *egl = self->params.egl;
+
+    /* Only dispatch the chroma blocks that are covered by the destination rectangle of any layer */
+    const vec2i chroma_size = { self->destination_texture_size.x / 2, self->destination_texture_size.y / 2 };
+    vec2i chroma_start = chroma_size;
+    vec2i chroma_end = {0, 0};
+    for(int i = 0; i < num_layers; ++i) {
+        const vec2i source_pos = layers[i].source_pos;
+        const vec2i source_size = layers[i].source_size;
+        chroma_start.x = min_int(chroma_start.x, max_int(0, floor_div_int(source_pos.x, 2)));
+        chroma_start.y = min_int(chroma_start.y, max_int(0, floor_div_int(source_pos.y, 2)));
+        chroma_end.x = max_int(chroma_end.x, min_int(chroma_size.x, floor_div_int(source_pos.x + source_size.x + 1, 2)));
+        chroma_end.y = max_int(chroma_end.y, min_int(chroma_size.y, floor_div_int(source_pos.y + source_size.y + 1, 2)));
+    }
 
-    const int texture_target = external_texture ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D;
+    if(chroma_end.x <= chroma_start.x || chroma_end.y <= chroma_start.y)
+        return;
 
-    self->params.egl->glBindTexture(texture_target, texture_id);
+    unsigned int y_format = 0;
+    unsigned int uv_format = 0;
+    const char *y_format_glsl = NULL;
+    const char *uv_format_glsl = NULL;
+    destination_color_get_image_formats(self->params.destination_color, &y_format, &uv_format, &y_format_glsl, &uv_format_glsl);
+
+    egl->glBindImageTexture(0, self->params.destination_textures[0], 0, GL_FALSE, 0, GL_READ_WRITE, y_format);
+    egl->glBindImageTexture(1, self->params.destination_textures[1], 0, GL_FALSE, 0, GL_READ_WRITE, uv_format);
+    gsr_shader_use(&self->compute_shader);
+
+    for(int i = 0; i < num_layers; ++i) {
+        const gsr_color_conversion_layer *layer = &layers[i];
+        const float rotation = layer_get_shader_rotation(layer);
+        egl->glActiveTexture(GL_TEXTURE0 + i);
+        egl->glBindTexture(GL_TEXTURE_2D, layer->texture_id);
+        egl->glUniform2i(self->compute_uniforms.destination_pos[i], layer->source_pos.x, layer->source_pos.y);
+        egl->glUniform2i(self->compute_uniforms.destination_size[i], layer->source_size.x, layer->source_size.y);
+        egl->glUniform2i(self->compute_uniforms.texture_pos[i], layer->texture_pos.x, layer->texture_pos.y);
+        egl->glUniform2i(self->compute_uniforms.texture_size[i], layer->texture_size.x, layer->texture_size.y);
+        egl->glUniform1f(self->compute_uniforms.rotation[i], rotation);
+        egl->glUniform1i(self->compute_uniforms.swap_texture_size[i], rotation_swaps_size(rotation));
+    }
+    egl->glUniform1i(self->compute_uniforms.num_layers, num_layers);
+    egl->glUniform2i(self->compute_uniforms.chroma_origin, chroma_start.x, chroma_start.y);
+
+    const int num_blocks_x = chroma_end.x - chroma_start.x;
+    const int num_blocks_y = chroma_end.y - chroma_start.y;
+    egl->glDispatchCompute((num_blocks_x + 7) / 8, (num_blocks_y + 7) / 8, 1);
+    /* The next batch (or the encoder) reads what this batch stored */
+    egl->glMemoryBarrier(GL_ALL_BARRIER_BITS);
+
+    for(int i = num_layers - 1; i >= 0; --i) {
+        egl->glActiveTexture(GL_TEXTURE0 + i);
+        egl->glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    gsr_shader_use_none(&self->compute_shader);
+}
 
-    vec2i source_texture_size = {0, 0};
-    if(external_texture) {
+/* Writes 24 floats (2 triangles of position + texture coordinates) to |vertices| and the offset uniform to |pos_norm| */
+static void gsr_color_conversion_get_layer_vertices(gsr_color_conversion *self, const gsr_color_conversion_layer *layer, float *vertices, vec2f *pos_norm) {
+    const vec2i dest_texture_size = self->destination_texture_size;
+    const vec2i source_pos = layer->source_pos;
+    const vec2i source_size = layer->source_size;
+    const vec2i texture_pos = layer->texture_pos;
+    const vec2i texture_size = layer->texture_size;
+
+    /* The size comes from the caller instead of glGetTexLevelParameteriv, which stalls the pipeline on some drivers */
+    vec2i source_texture_size = layer->texture_full_size;
+    if(layer->external_texture) {
         source_texture_size = source_size;
-    } else {
-        /* TODO: Do not call this every frame? */
-        self->params.egl->glGetTexLevelParameteriv(texture_target, 0, GL_TEXTURE_WIDTH, &source_texture_size.x);
-        self->params.egl->glGetTexLevelParameteriv(texture_target, 0, GL_TEXTURE_HEIGHT, &source_texture_size.y);
+    } else if(source_texture_size.x == 0 && source_texture_size.y == 0) {
+        source_texture_size = (vec2i){ texture_pos.x + texture_size.x, texture_pos.y + texture_size.y };
     }
 
     // TODO: Remove this crap
-    if(abs_f(M_PI * 0.5f - rotation) <= 0.001f || abs_f(M_PI * 1.5f - rotation) <= 0.001f) {
+    if(rotation_swaps_size(layer_get_shader_rotation(layer))) {
         float tmp = source_texture_size.x;
         source_texture_size.x = source_texture_size.y;
         source_texture_size.y = tmp;
     }
 
-    const vec2f pos_norm = {
-        ((float)source_pos.x / (dest_texture_size.x == 0 ? 1.0f : (float)dest_texture_size.x)) * 2.0f,
-        ((float)source_pos.y / (dest_texture_size.y == 0 ? 1.0f : (float)dest_texture_size.y)) * 2.0f,
-    };
+    pos_norm->x = ((float)source_pos.x / (dest_texture_size.x == 0 ? 1.0f : (float)dest_texture_size.x)) * 2.0f;
+    pos_norm->y = ((float)source_pos.y / (dest_texture_size.y == 0 ? 1.0f : (float)dest_texture_size.y)) * 2.0f;
 
     const vec2f size_norm = {
         ((float)source_size.x / (dest_texture_size.x == 0 ? 1.0f : (float)dest_texture_size.x)) * 2.0f,
@@ -421,7 +656,7 @@ void gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_
         (float)texture_size.y / (source_texture_size.y == 0 ? 1.0f : (float)source_texture_size.y),
     };
 
-    const float vertices[] = {
+    const float layer_vertices[] = {
         -1.0f + 0.0f,               -1.0f + 0.0f + size_norm.y, texture_pos_norm.x,                       texture_pos_norm.y + texture_size_norm.y,
         -1.0f + 0.0f,               -1.0f + 0.0f,               texture_pos_norm.x,                       texture_pos_norm.y,
         -1.0f + 0.0f + size_norm.x, -1.0f + 0.0f,               texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y,
@@ -430,46 +665,87 @@ void gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_
         -1.0f + 0.0f + size_norm.x, -1.0f + 0.0f,               texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y,
         -1.0f + 0.0f + size_norm.x, -1.0f + 0.0f + size_norm.y, texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y + texture_size_norm.y
     };
+    memcpy(vertices, layer_vertices, sizeof(layer_vertices));
+}
 
-    self->params.egl->glBindVertexArray(self->vertex_array_object_id);
-    self->params.egl->glViewport(0, 0, dest_texture_size.x, dest_texture_size.y);
-
-    /* TODO: this, also cleanup */
-    //self->params.egl->glBindBuffer(GL_ARRAY_BUFFER, self->vertex_buffer_object_id);
-    self->params.egl->glBufferSubData(GL_ARRAY_BUFFER, 0, 24 * sizeof(float), vertices);
-
-    {
-        self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[0]);
-        //cap_xcomp->params.egl->glClear(GL_COLOR_BUFFER_BIT); // TODO: Do this in a separate clear_ function. We want to do that when using multiple drm to create the final image (multiple monitors for example)
-
-        if(external_texture) {
-            gsr_shader_use(&self->shaders[1]);
-            self->params.egl->glUniform1f(self->uniforms[1].rotation, rotation);
-            self->params.egl->glUniform2f(self->uniforms[1].offset, pos_norm.x, pos_norm.y);
-        } else {
-            gsr_shader_use(&self->shaders[0]);
-            self->params.egl->glUniform1f(self->uniforms[0].rotation, rotation);
-            self->params.egl->glUniform2f(self->uniforms[0].offset, pos_norm.x, pos_norm.y);
+/* Renders all layers to one plane (framebuffer), only switching shaders and textures when they change between layers */
+static void gsr_color_conversion_draw_plane(gsr_color_conversion *self, int plane, const gsr_color_conversion_layer *layers, const vec2f *pos_norms, int num_layers) {
+    self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[plane]);
+    //cap_xcomp->params.egl->glClear(GL_COLOR_BUFFER_BIT); // TODO: Do this in a separate clear_ function. We want to do that when using multiple drm to create the final image (multiple monitors for example)
+
+    int current_shader_index = -1;
+    for(int i = 0; i < num_layers; ++i) {
+        const gsr_color_conversion_layer *layer = &layers[i];
+        const int shader_index = (plane == 0 && !layer->external_texture) ? 0 : 1;
+        if(shader_index != current_shader_index) {
+            gsr_shader_use(&self->shaders[shader_index]);
+            current_shader_index = shader_index;
         }
-        self->params.egl->glDrawArrays(GL_TRIANGLES, 0, 6);
+
+        self->params.egl->glBindTexture(layer->external_texture ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D, layer->texture_id);
+        self->params.egl->glUniform1f(self->uniforms[shader_index].rotation, layer_get_shader_rotation(layer));
+        self->params.egl->glUniform2f(self->uniforms[shader_index].offset, pos_norms[i].x, pos_norms[i].y);
+        self->params.egl->glDrawArrays(GL_TRIANGLES, i * 6, 6);
     }
+}
 
-    if(self->params.num_destination_textures > 1) {
-        self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[1]);
-        //cap_xcomp->params.egl->glClear(GL_COLOR_BUFFER_BIT);
+static void gsr_color_conversion_draw_layers_batch(gsr_color_conversion *self, const gsr_color_conversion_layer *layers, int num_layers) {
+    bool has_external_texture = false;
+    for(int i = 0; i < num_layers; ++i) {
+        if(layers[i].external_texture)
+            has_external_texture = true;
+    }
 
-        gsr_shader_use(&self->shaders[1]);
-        self->params.egl->glUniform1f(self->uniforms[1].rotation, rotation);
-        self->params.egl->glUniform2f(self->uniforms[1].offset, pos_norm.x, pos_norm.y);
-        self->params.egl->glDrawArrays(GL_TRIANGLES, 0, 6);
+    /* External textures can't be sampled in the compute shader on all drivers */
+    if(self->use_compute_shader && !has_external_texture) {
+        gsr_color_conversion_draw_layers_compute(self, layers, num_layers);
+        return;
     }
 
+    float vertices[GSR_COLOR_CONVERSION_MAX_LAYERS * 24];
+    vec2f pos_norms[GSR_COLOR_CONVERSION_MAX_LAYERS];
+    for(int i = 0; i < num_layers; ++i) {
+        gsr_color_conversion_get_layer_vertices(self, &layers[i], vertices + i * 24, &pos_norms[i]);
+    }
+
+    self->params.egl->glBindVertexArray(self->vertex_array_object_id);
+    self->params.egl->glViewport(0, 0, self->destination_texture_size.x, self->destination_texture_size.y);
+
+    /* TODO: this, also cleanup */
+    //self->params.egl->glBindBuffer(GL_ARRAY_BUFFER, self->vertex_buffer_object_id);
+    self->params.egl->glBufferSubData(GL_ARRAY_BUFFER, 0, num_layers * 24 * sizeof(float), vertices);
+
+    gsr_color_conversion_draw_plane(self, 0, layers, pos_norms, num_layers);
+    if(self->params.num_destination_textures > 1)
+        gsr_color_conversion_draw_plane(self, 1, layers, pos_norms, num_layers);
+
     self->params.egl->glBindVertexArray(0);
     gsr_shader_use_none(&self->shaders[0]);
-    self->params.egl->glBindTexture(texture_target, 0);
+    self->params.egl->glBindTexture(GL_TEXTURE_2D, 0);
+    self->params.egl->glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
     self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void gsr_color_conversion_draw_layers(gsr_color_conversion *self, const gsr_color_conversion_layer *layers, int num_layers) {
+    for(int i = 0; i < num_layers; i += GSR_COLOR_CONVERSION_MAX_LAYERS) {
+        gsr_color_conversion_draw_layers_batch(self, layers + i, min_int(num_layers - i, GSR_COLOR_CONVERSION_MAX_LAYERS));
+    }
+}
+
+/* |source_pos| is in pixel coordinates and |source_size|  */
+void gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation, bool external_texture) {
+    const gsr_color_conversion_layer layer = {
+        .texture_id = texture_id,
+        .source_pos = source_pos,
+        .source_size = source_size,
+        .texture_pos = texture_pos,
+        .texture_size = texture_size,
+        .rotation = rotation,
+        .external_texture = external_texture
+    };
+    gsr_color_conversion_draw_layers(self, &layer, 1);
+}
+
 void gsr_color_conversion_clear(gsr_color_conversion *self) {
     float color1[4] = {0.0f, 0.0f, 0.0f, 1.0f};
     float color2[4] = {0.0f, 0.0f, 0.0f, 1.0f};
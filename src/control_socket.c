@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include "../include/control_socket.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+static int set_socket_path(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    const size_t path_len = strlen(path);
+    if(path_len == 0 || path_len >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "gsr error: control socket path \"%s\" is empty or too long\n", path);
+        return -1;
+    }
+    memcpy(addr->sun_path, path, path_len + 1);
+    return 0;
+}
+
+/* Removes the socket file at |path| if it's left over from a gpu screen recorder that didn't exit cleanly */
+static int remove_stale_socket(const struct sockaddr_un *addr) {
+    struct stat st;
+    if(stat(addr->sun_path, &st) == -1)
+        return errno == ENOENT ? 0 : -1;
+
+    if(!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "gsr error: control socket path \"%s\" exists and is not a socket\n", addr->sun_path);
+        return -1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(fd == -1)
+        return -1;
+
+    const int connected = connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) == 0;
+    close(fd);
+    if(connected) {
+        fprintf(stderr, "gsr error: control socket \"%s\" is already in use by another process\n", addr->sun_path);
+        return -1;
+    }
+
+    unlink(addr->sun_path);
+    return 0;
+}
+
+static void send_response_to_fd(int fd, const gsr_control_request *request, gsr_control_result result, const char *message, const gsr_control_stats *stats) {
+    gsr_control_response response;
+    memset(&response, 0, sizeof(response));
+    response.version = GSR_CONTROL_PROTOCOL_VERSION;
+    response.id = request->id;
+    response.type = request->type;
+    response.result = result;
+    if(message)
+        snprintf(response.message, sizeof(response.message), "%s", message);
+    if(stats)
+        response.stats = *stats;
+
+    if(send(fd, &response, sizeof(response), MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(response))
+        fprintf(stderr, "gsr warning: control socket: failed to send response to client, error: %s\n", strerror(errno));
+}
+
+static void accept_client(gsr_control_socket *self) {
+    const int client_fd = accept4(self->listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if(client_fd == -1)
+        return;
+
+    pthread_mutex_lock(&self->mutex);
+    for(int i = 0; i < GSR_CONTROL_MAX_CLIENTS; ++i) {
+        if(self->clients[i].fd == -1) {
+            self->clients[i].fd = client_fd;
+            pthread_mutex_unlock(&self->mutex);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&self->mutex);
+
+    fprintf(stderr, "gsr warning: control socket: too many clients connected, rejecting new client\n");
+    close(client_fd);
+}
+
+static void remove_client(gsr_control_socket *self, int client_index) {
+    pthread_mutex_lock(&self->mutex);
+    close(self->clients[client_index].fd);
+    self->clients[client_index].fd = -1;
+    ++self->clients[client_index].generation;
+    pthread_mutex_unlock(&self->mutex);
+}
+
+static void receive_from_client(gsr_control_socket *self, int client_index) {
+    const int client_fd = self->clients[client_index].fd;
+    gsr_control_request request;
+    memset(&request, 0, sizeof(request));
+
+    const ssize_t bytes_read = recv(client_fd, &request, sizeof(request), 0);
+    if(bytes_read == 0 || (bytes_read == -1 && errno != EAGAIN && errno != EINTR)) {
+        remove_client(self, client_index);
+        return;
+    } else if(bytes_read == -1) {
+        return;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    if(bytes_read != sizeof(request) || request.version != GSR_CONTROL_PROTOCOL_VERSION) {
+        char err_msg[128];
+        snprintf(err_msg, sizeof(err_msg), "expected a request of %d bytes with protocol version %d", (int)sizeof(request), GSR_CONTROL_PROTOCOL_VERSION);
+        send_response_to_fd(client_fd, &request, GSR_CONTROL_RESULT_INVALID_REQUEST, err_msg, NULL);
+    } else if(self->num_commands == GSR_CONTROL_MAX_QUEUED_COMMANDS) {
+        send_response_to_fd(client_fd, &request, GSR_CONTROL_RESULT_BUSY, "too many requests", NULL);
+    } else {
+        gsr_control_command *command = &self->commands[self->num_commands++];
+        command->client_index = client_index;
+        command->client_generation = self->clients[client_index].generation;
+        command->request = request;
+        pthread_cond_signal(&self->command_cond);
+    }
+    pthread_mutex_unlock(&self->mutex);
+}
+
+static void* control_socket_thread(void *userdata) {
+    gsr_control_socket *self = userdata;
+    struct pollfd poll_fds[2 + GSR_CONTROL_MAX_CLIENTS];
+    int poll_fd_client_index[2 + GSR_CONTROL_MAX_CLIENTS];
+
+    for(;;) {
+        int num_poll_fds = 0;
+        poll_fds[num_poll_fds] = (struct pollfd){ .fd = self->wakeup_fd, .events = POLLIN };
+        poll_fd_client_index[num_poll_fds++] = -1;
+        poll_fds[num_poll_fds] = (struct pollfd){ .fd = self->listen_fd, .events = POLLIN };
+        poll_fd_client_index[num_poll_fds++] = -1;
+
+        /* Only this thread adds and removes clients so it's fine to read them without locking the mutex */
+        for(int i = 0; i < GSR_CONTROL_MAX_CLIENTS; ++i) {
+            if(self->clients[i].fd == -1)
+                continue;
+            poll_fds[num_poll_fds] = (struct pollfd){ .fd = self->clients[i].fd, .events = POLLIN };
+            poll_fd_client_index[num_poll_fds++] = i;
+        }
+
+        if(poll(poll_fds, num_poll_fds, -1) == -1) {
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "gsr error: control socket: poll failed, error: %s\n", strerror(errno));
+            break;
+        }
+
+        if(poll_fds[0].revents)
+            break;
+
+        if(poll_fds[1].revents & POLLIN)
+            accept_client(self);
+
+        for(int i = 2; i < num_poll_fds; ++i) {
+            if(poll_fds[i].revents & POLLIN)
+                receive_from_client(self, poll_fd_client_index[i]);
+            else if(poll_fds[i].revents & (POLLHUP | POLLERR))
+                remove_client(self, poll_fd_client_index[i]);
+        }
+    }
+
+    return NULL;
+}
+
+int gsr_control_socket_init(gsr_control_socket *self, const char *path) {
+    memset(self, 0, sizeof(*self));
+    self->listen_fd = -1;
+    self->wakeup_fd = -1;
+    for(int i = 0; i < GSR_CONTROL_MAX_CLIENTS; ++i) {
+        self->clients[i].fd = -1;
+    }
+
+    struct sockaddr_un addr;
+    if(set_socket_path(&addr, path) != 0)
+        return -1;
+
+    if(remove_stale_socket(&addr) != 0)
+        return -1;
+
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&self->command_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    self->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(self->listen_fd == -1) {
+        fprintf(stderr, "gsr error: gsr_control_socket_init: failed to create socket, error: %s\n", strerror(errno));
+        goto err;
+    }
+
+    /*
+        Only the user running gpu screen recorder should be able to control it. On linux the socket file is created with the mode of the socket fd
+        (minus the umask), so it's set before bind. A chmod after bind would leave a window where anyone can connect and changing the umask
+        would affect files created by other threads at the same time.
+    */
+    if(fchmod(self->listen_fd, S_IRUSR | S_IWUSR) == -1) {
+        fprintf(stderr, "gsr error: gsr_control_socket_init: failed to set the permissions of the socket, error: %s\n", strerror(errno));
+        goto err;
+    }
+
+    if(bind(self->listen_fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "gsr error: gsr_control_socket_init: failed to bind socket to \"%s\", error: %s\n", path, strerror(errno));
+        goto err;
+    }
+    snprintf(self->path, sizeof(self->path), "%s", path);
+
+    if(listen(self->listen_fd, GSR_CONTROL_MAX_CLIENTS) == -1) {
+        fprintf(stderr, "gsr error: gsr_control_socket_init: failed to listen on socket, error: %s\n", strerror(errno));
+        goto err;
+    }
+
+    self->wakeup_fd = eventfd(0, EFD_CLOEXEC);
+    if(self->wakeup_fd == -1) {
+        fprintf(stderr, "gsr error: gsr_control_socket_init: failed to create eventfd, error: %s\n", strerror(errno));
+        goto err;
+    }
+
+    if(pthread_create(&self->thread, NULL, control_socket_thread, self) != 0) {
+        fprintf(stderr, "gsr error: gsr_control_socket_init: failed to create thread\n");
+        goto err;
+    }
+    self->thread_started = true;
+
+    return 0;
+
+    err:
+    gsr_control_socket_deinit(self);
+    return -1;
+}
+
+void gsr_control_socket_deinit(gsr_control_socket *self) {
+    if(self->thread_started) {
+        const uint64_t value = 1;
+        if(write(self->wakeup_fd, &value, sizeof(value)) == sizeof(value))
+            pthread_join(self->thread, NULL);
+        self->thread_started = false;
+    }
+
+    for(int i = 0; i < GSR_CONTROL_MAX_CLIENTS; ++i) {
+        if(self->clients[i].fd != -1) {
+            close(self->clients[i].fd);
+            self->clients[i].fd = -1;
+        }
+    }
+
+    if(self->wakeup_fd != -1) {
+        close(self->wakeup_fd);
+        self->wakeup_fd = -1;
+    }
+
+    if(self->listen_fd != -1) {
+        close(self->listen_fd);
+        self->listen_fd = -1;
+    }
+
+    if(self->path[0] != '\0') {
+        unlink(self->path);
+        self->path[0] = '\0';
+    }
+
+    pthread_cond_destroy(&self->command_cond);
+    pthread_mutex_destroy(&self->mutex);
+}
+
+bool gsr_control_socket_pop_command(gsr_control_socket *self, gsr_control_command *command) {
+    bool popped = false;
+    pthread_mutex_lock(&self->mutex);
+    if(self->num_commands > 0) {
+        *command = self->commands[0];
+        --self->num_commands;
+        memmove(&self->commands[0], &self->commands[1], self->num_commands * sizeof(self->commands[0]));
+        popped = true;
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return popped;
+}
+
+bool gsr_control_socket_wait(gsr_control_socket *self, double timeout_sec) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    const int64_t timeout_ns = (int64_t)(timeout_sec * 1000000000.0);
+    deadline.tv_sec += timeout_ns / 1000000000LL;
+    deadline.tv_nsec += timeout_ns % 1000000000LL;
+    if(deadline.tv_nsec >= 1000000000LL) {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000LL;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    while(self->num_commands == 0) {
+        if(pthread_cond_timedwait(&self->command_cond, &self->mutex, &deadline) != 0)
+            break;
+    }
+    const bool has_command = self->num_commands > 0;
+    pthread_mutex_unlock(&self->mutex);
+    return has_command;
+}
+
+void gsr_control_socket_send_response(gsr_control_socket *self, const gsr_control_command *command, gsr_control_result result, const char *message, const gsr_control_stats *stats) {
+    pthread_mutex_lock(&self->mutex);
+    const gsr_control_client *client = &self->clients[command->client_index];
+    if(client->fd != -1 && client->generation == command->client_generation)
+        send_response_to_fd(client->fd, &command->request, result, message, stats);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+int gsr_control_socket_send_request(const char *path, const gsr_control_request *request, gsr_control_response *response) {
+    struct sockaddr_un addr;
+    if(set_socket_path(&addr, path) != 0)
+        return -1;
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(fd == -1) {
+        fprintf(stderr, "gsr error: gsr_control_socket_send_request: failed to create socket, error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "gsr error: gsr_control_socket_send_request: failed to connect to \"%s\", error: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if(send(fd, request, sizeof(*request), MSG_NOSIGNAL) != sizeof(*request)) {
+        fprintf(stderr, "gsr error: gsr_control_socket_send_request: failed to send request, error: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    for(;;) {
+        const ssize_t bytes_read = recv(fd, response, sizeof(*response), 0);
+        if(bytes_read == -1 && errno == EINTR)
+            continue;
+
+        if(bytes_read != sizeof(*response) || response->version != GSR_CONTROL_PROTOCOL_VERSION) {
+            fprintf(stderr, "gsr error: gsr_control_socket_send_request: failed to receive response\n");
+            close(fd);
+            return -1;
+        }
+
+        if(response->id == request->id)
+            break;
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,446 @@
+#include "../include/cpu_color_conversion.h"
+#include "../include/color_matrices.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GSR_CPU_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) || (defined(__ARM_NEON) && defined(__ARM_NEON__))
+#define GSR_CPU_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+    Fixed point with 14 fractional bits. Everything is done in 32-bit integers so that the simd versions give the exact same result as the scalar version.
+    Chroma is calculated from the sum of 4 pixels (2x2 block), so it's shifted down by 2 more bits.
+*/
+#define FIXED_POINT_SHIFT 14
+#define CHROMA_SHIFT (FIXED_POINT_SHIFT + 2)
+
+typedef struct {
+    int32_t y[3]; /* r, g, b */
+    int32_t u[3];
+    int32_t v[3];
+    int32_t y_offset;  /* Includes rounding */
+    int32_t uv_offset; /* Includes rounding, for the sum of 4 pixels */
+    int32_t max_value;
+    bool ten_bit;
+} conversion_coefficients;
+
+typedef struct {
+    const uint8_t *src[2];
+    uint8_t *y[2]; /* y[1] is NULL for the last row when the height is odd */
+    uint8_t *uv;
+    int width;
+    int r_offset;
+    int b_offset;
+} row_pair;
+
+static int32_t round_to_int(double value) {
+    return (int32_t)(value >= 0.0 ? value + 0.5 : value - 0.5);
+}
+
+static int clamp_int(int value, int max_value) {
+    if(value < 0)
+        return 0;
+    else if(value > max_value)
+        return max_value;
+    else
+        return value;
+}
+
+static void conversion_coefficients_init(conversion_coefficients *self, const gsr_color_matrix *matrix, bool ten_bit) {
+    self->ten_bit = ten_bit;
+    self->max_value = ten_bit ? 1023 : 255;
+
+    /* The matrices are for normalized values, the input is 8-bit */
+    const double scale = (double)self->max_value / 255.0 * (double)(1 << FIXED_POINT_SHIFT);
+    for(int i = 0; i < 3; ++i) {
+        int32_t *dst = i == 0 ? self->y : (i == 1 ? self->u : self->v);
+        dst[0] = round_to_int(matrix->r[i] * scale);
+        dst[1] = round_to_int(matrix->g[i] * scale);
+        dst[2] = round_to_int(matrix->b[i] * scale);
+    }
+
+    self->y_offset = round_to_int(matrix->offset[0] * (double)self->max_value * (double)(1 << FIXED_POINT_SHIFT)) + (1 << (FIXED_POINT_SHIFT - 1));
+    self->uv_offset = round_to_int(matrix->offset[1] * (double)self->max_value * (double)(1 << CHROMA_SHIFT)) + (1 << (CHROMA_SHIFT - 1));
+}
+
+static inline void store_sample(uint8_t *plane, int index, int value, bool ten_bit) {
+    if(ten_bit)
+        ((uint16_t*)plane)[index] = (uint16_t)(value << 6);
+    else
+        plane[index] = (uint8_t)value;
+}
+
+/* Converts pixels [x_start, width) of two rows. |x_start| has to be even */
+static void convert_row_pair_scalar(const row_pair *rows, int x_start, int bytes_per_pixel, const conversion_coefficients *c) {
+    const int r_offset = rows->r_offset;
+    const int b_offset = rows->b_offset;
+
+    for(int x = x_start; x < rows->width; x += 2) {
+        const int num_columns = x + 1 < rows->width ? 2 : 1;
+        int r_sum = 0;
+        int g_sum = 0;
+        int b_sum = 0;
+
+        for(int row = 0; row < 2; ++row) {
+            for(int column = 0; column < 2; ++column) {
+                /* Odd width: the last column is repeated for chroma */
+                const uint8_t *pixel = rows->src[row] + (x + (column < num_columns ? column : 0)) * bytes_per_pixel;
+                const int r = pixel[r_offset];
+                const int g = pixel[1];
+                const int b = pixel[b_offset];
+                r_sum += r;
+                g_sum += g;
+                b_sum += b;
+
+                if(column < num_columns && rows->y[row]) {
+                    const int y = (c->y[0] * r + c->y[1] * g + c->y[2] * b + c->y_offset) >> FIXED_POINT_SHIFT;
+                    store_sample(rows->y[row], x + column, clamp_int(y, c->max_value), c->ten_bit);
+                }
+            }
+        }
+
+        const int u = (c->u[0] * r_sum + c->u[1] * g_sum + c->u[2] * b_sum + c->uv_offset) >> CHROMA_SHIFT;
+        const int v = (c->v[0] * r_sum + c->v[1] * g_sum + c->v[2] * b_sum + c->uv_offset) >> CHROMA_SHIFT;
+        store_sample(rows->uv, x, clamp_int(u, c->max_value), c->ten_bit);
+        store_sample(rows->uv, x + 1, clamp_int(v, c->max_value), c->ten_bit);
+    }
+}
+
+#ifdef GSR_CPU_X86
+
+/* Pixel i of |pixels| (4 pixels, 4 bytes each) to 32-bit lane i */
+__attribute__((target("sse4.1")))
+static inline __m128i sse41_channel_mask(int channel_offset) {
+    return _mm_setr_epi8(channel_offset,      -1, -1, -1,
+                         channel_offset + 4,  -1, -1, -1,
+                         channel_offset + 8,  -1, -1, -1,
+                         channel_offset + 12, -1, -1, -1);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i sse41_dot(__m128i r, __m128i g, __m128i b, const int32_t *coeffs, int32_t offset, int shift, int32_t max_value) {
+    __m128i result = _mm_add_epi32(_mm_mullo_epi32(r, _mm_set1_epi32(coeffs[0])), _mm_mullo_epi32(g, _mm_set1_epi32(coeffs[1])));
+    result = _mm_add_epi32(result, _mm_mullo_epi32(b, _mm_set1_epi32(coeffs[2])));
+    result = _mm_srai_epi32(_mm_add_epi32(result, _mm_set1_epi32(offset)), shift);
+    return _mm_min_epi32(_mm_max_epi32(result, _mm_setzero_si128()), _mm_set1_epi32(max_value));
+}
+
+/* 8 pixels per iteration. Returns the number of pixels that were converted */
+__attribute__((target("sse4.1")))
+static int convert_row_pair_sse41(const row_pair *rows, const conversion_coefficients *c) {
+    const __m128i r_mask = sse41_channel_mask(rows->r_offset);
+    const __m128i g_mask = sse41_channel_mask(1);
+    const __m128i b_mask = sse41_channel_mask(rows->b_offset);
+
+    int x = 0;
+    for(; x + 8 <= rows->width; x += 8) {
+        __m128i r[4], g[4], b[4];
+        for(int i = 0; i < 4; ++i) {
+            /* 0 and 1 are the first row, 2 and 3 are the second row */
+            const __m128i pixels = _mm_loadu_si128((const __m128i*)(rows->src[i >> 1] + (x + (i & 1) * 4) * 4));
+            r[i] = _mm_shuffle_epi8(pixels, r_mask);
+            g[i] = _mm_shuffle_epi8(pixels, g_mask);
+            b[i] = _mm_shuffle_epi8(pixels, b_mask);
+        }
+
+        for(int row = 0; row < 2; ++row) {
+            if(!rows->y[row])
+                continue;
+
+            const __m128i y_left = sse41_dot(r[row * 2], g[row * 2], b[row * 2], c->y, c->y_offset, FIXED_POINT_SHIFT, c->max_value);
+            const __m128i y_right = sse41_dot(r[row * 2 + 1], g[row * 2 + 1], b[row * 2 + 1], c->y, c->y_offset, FIXED_POINT_SHIFT, c->max_value);
+            const __m128i y16 = _mm_packus_epi32(y_left, y_right);
+            if(c->ten_bit)
+                _mm_storeu_si128((__m128i*)(rows->y[row] + x * 2), _mm_slli_epi16(y16, 6));
+            else
+                _mm_storel_epi64((__m128i*)(rows->y[row] + x), _mm_packus_epi16(y16, y16));
+        }
+
+        /* Vertical sum and then horizontal sum of neighboring pixels gives the sum of each 2x2 block */
+        const __m128i r_sum = _mm_hadd_epi32(_mm_add_epi32(r[0], r[2]), _mm_add_epi32(r[1], r[3]));
+        const __m128i g_sum = _mm_hadd_epi32(_mm_add_epi32(g[0], g[2]), _mm_add_epi32(g[1], g[3]));
+        const __m128i b_sum = _mm_hadd_epi32(_mm_add_epi32(b[0], b[2]), _mm_add_epi32(b[1], b[3]));
+        const __m128i u = sse41_dot(r_sum, g_sum, b_sum, c->u, c->uv_offset, CHROMA_SHIFT, c->max_value);
+        const __m128i v = sse41_dot(r_sum, g_sum, b_sum, c->v, c->uv_offset, CHROMA_SHIFT, c->max_value);
+        if(c->ten_bit) {
+            const __m128i uv = _mm_or_si128(_mm_slli_epi32(u, 6), _mm_slli_epi32(v, 22));
+            _mm_storeu_si128((__m128i*)(rows->uv + x * 2), uv);
+        } else {
+            const __m128i uv = _mm_or_si128(u, _mm_slli_epi32(v, 8));
+            _mm_storel_epi64((__m128i*)(rows->uv + x), _mm_packus_epi32(uv, uv));
+        }
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_channel_mask(int channel_offset) {
+    return _mm256_setr_epi8(channel_offset,      -1, -1, -1,
+                            channel_offset + 4,  -1, -1, -1,
+                            channel_offset + 8,  -1, -1, -1,
+                            channel_offset + 12, -1, -1, -1,
+                            channel_offset,      -1, -1, -1,
+                            channel_offset + 4,  -1, -1, -1,
+                            channel_offset + 8,  -1, -1, -1,
+                            channel_offset + 12, -1, -1, -1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_dot(__m256i r, __m256i g, __m256i b, const int32_t *coeffs, int32_t offset, int shift, int32_t max_value) {
+    __m256i result = _mm256_add_epi32(_mm256_mullo_epi32(r, _mm256_set1_epi32(coeffs[0])), _mm256_mullo_epi32(g, _mm256_set1_epi32(coeffs[1])));
+    result = _mm256_add_epi32(result, _mm256_mullo_epi32(b, _mm256_set1_epi32(coeffs[2])));
+    result = _mm256_srai_epi32(_mm256_add_epi32(result, _mm256_set1_epi32(offset)), shift);
+    return _mm256_min_epi32(_mm256_max_epi32(result, _mm256_setzero_si256()), _mm256_set1_epi32(max_value));
+}
+
+/* 16 pixels per iteration. Returns the number of pixels that were converted */
+__attribute__((target("avx2")))
+static int convert_row_pair_avx2(const row_pair *rows, const conversion_coefficients *c) {
+    const __m256i r_mask = avx2_channel_mask(rows->r_offset);
+    const __m256i g_mask = avx2_channel_mask(1);
+    const __m256i b_mask = avx2_channel_mask(rows->b_offset);
+
+    int x = 0;
+    for(; x + 16 <= rows->width; x += 16) {
+        __m256i r[4], g[4], b[4];
+        for(int i = 0; i < 4; ++i) {
+            /* 0 and 1 are the first row, 2 and 3 are the second row */
+            const __m256i pixels = _mm256_loadu_si256((const __m256i*)(rows->src[i >> 1] + (x + (i & 1) * 8) * 4));
+            r[i] = _mm256_shuffle_epi8(pixels, r_mask);
+            g[i] = _mm256_shuffle_epi8(pixels, g_mask);
+            b[i] = _mm256_shuffle_epi8(pixels, b_mask);
+        }
+
+        for(int row = 0; row < 2; ++row) {
+            if(!rows->y[row])
+                continue;
+
+            const __m256i y_left = avx2_dot(r[row * 2], g[row * 2], b[row * 2], c->y, c->y_offset, FIXED_POINT_SHIFT, c->max_value);
+            const __m256i y_right = avx2_dot(r[row * 2 + 1], g[row * 2 + 1], b[row * 2 + 1], c->y, c->y_offset, FIXED_POINT_SHIFT, c->max_value);
+            /* Packing works on each 128-bit lane separately, the permute puts the pixels back in order */
+            const __m256i y16 = _mm256_permute4x64_epi64(_mm256_packus_epi32(y_left, y_right), 0xD8);
+            if(c->ten_bit) {
+                _mm256_storeu_si256((__m256i*)(rows->y[row] + x * 2), _mm256_slli_epi16(y16, 6));
+            } else {
+                const __m256i y8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(y16, y16), 0xD8);
+                _mm_storeu_si128((__m128i*)(rows->y[row] + x), _mm256_castsi256_si128(y8));
+            }
+        }
+
+        /* Vertical sum and then horizontal sum of neighboring pixels gives the sum of each 2x2 block */
+        const __m256i r_sum = _mm256_permute4x64_epi64(_mm256_hadd_epi32(_mm256_add_epi32(r[0], r[2]), _mm256_add_epi32(r[1], r[3])), 0xD8);
+        const __m256i g_sum = _mm256_permute4x64_epi64(_mm256_hadd_epi32(_mm256_add_epi32(g[0], g[2]), _mm256_add_epi32(g[1], g[3])), 0xD8);
+        const __m256i b_sum = _mm256_permute4x64_epi64(_mm256_hadd_epi32(_mm256_add_epi32(b[0], b[2]), _mm256_add_epi32(b[1], b[3])), 0xD8);
+        const __m256i u = avx2_dot(r_sum, g_sum, b_sum, c->u, c->uv_offset, CHROMA_SHIFT, c->max_value);
+        const __m256i v = avx2_dot(r_sum, g_sum, b_sum, c->v, c->uv_offset, CHROMA_SHIFT, c->max_value);
+        if(c->ten_bit) {
+            const __m256i uv = _mm256_or_si256(_mm256_slli_epi32(u, 6), _mm256_slli_epi32(v, 22));
+            _mm256_storeu_si256((__m256i*)(rows->uv + x * 2), uv);
+        } else {
+            const __m256i uv = _mm256_or_si256(u, _mm256_slli_epi32(v, 8));
+            const __m256i uv16 = _mm256_permute4x64_epi64(_mm256_packus_epi32(uv, uv), 0xD8);
+            _mm_storeu_si128((__m128i*)(rows->uv + x), _mm256_castsi256_si128(uv16));
+        }
+    }
+    return x;
+}
+
+#endif /* GSR_CPU_X86 */
+
+#ifdef GSR_CPU_NEON
+
+static inline int32x4_t neon_dot(uint32x4_t r, uint32x4_t g, uint32x4_t b, const int32_t *coeffs, int32_t offset) {
+    int32x4_t result = vdupq_n_s32(offset);
+    result = vmlaq_n_s32(result, vreinterpretq_s32_u32(r), coeffs[0]);
+    result = vmlaq_n_s32(result, vreinterpretq_s32_u32(g), coeffs[1]);
+    result = vmlaq_n_s32(result, vreinterpretq_s32_u32(b), coeffs[2]);
+    return result;
+}
+
+/* Applies |coeffs| to 8 values and returns them clamped to [0, max_value] */
+static inline uint16x8_t neon_dot8(uint16x8_t r, uint16x8_t g, uint16x8_t b, const int32_t *coeffs, int32_t offset, bool chroma, int32_t max_value) {
+    int32x4_t low = neon_dot(vmovl_u16(vget_low_u16(r)), vmovl_u16(vget_low_u16(g)), vmovl_u16(vget_low_u16(b)), coeffs, offset);
+    int32x4_t high = neon_dot(vmovl_u16(vget_high_u16(r)), vmovl_u16(vget_high_u16(g)), vmovl_u16(vget_high_u16(b)), coeffs, offset);
+    if(chroma) {
+        low = vshrq_n_s32(low, CHROMA_SHIFT);
+        high = vshrq_n_s32(high, CHROMA_SHIFT);
+    } else {
+        low = vshrq_n_s32(low, FIXED_POINT_SHIFT);
+        high = vshrq_n_s32(high, FIXED_POINT_SHIFT);
+    }
+    const uint16x8_t result = vcombine_u16(vqmovun_s32(low), vqmovun_s32(high));
+    return vminq_u16(result, vdupq_n_u16((uint16_t)max_value));
+}
+
+/* 16 pixels per iteration. Returns the number of pixels that were converted */
+static int convert_row_pair_neon(const row_pair *rows, const conversion_coefficients *c) {
+    int x = 0;
+    for(; x + 16 <= rows->width; x += 16) {
+        const uint8x16x4_t pixels[2] = {
+            vld4q_u8(rows->src[0] + x * 4),
+            vld4q_u8(rows->src[1] + x * 4)
+        };
+
+        for(int row = 0; row < 2; ++row) {
+            if(!rows->y[row])
+                continue;
+
+            const uint8x16_t r = pixels[row].val[rows->r_offset];
+            const uint8x16_t g = pixels[row].val[1];
+            const uint8x16_t b = pixels[row].val[rows->b_offset];
+            const uint16x8_t y_low = neon_dot8(vmovl_u8(vget_low_u8(r)), vmovl_u8(vget_low_u8(g)), vmovl_u8(vget_low_u8(b)), c->y, c->y_offset, false, c->max_value);
+            const uint16x8_t y_high = neon_dot8(vmovl_u8(vget_high_u8(r)), vmovl_u8(vget_high_u8(g)), vmovl_u8(vget_high_u8(b)), c->y, c->y_offset, false, c->max_value);
+            if(c->ten_bit) {
+                vst1q_u16((uint16_t*)(rows->y[row] + x * 2), vshlq_n_u16(y_low, 6));
+                vst1q_u16((uint16_t*)(rows->y[row] + x * 2 + 16), vshlq_n_u16(y_high, 6));
+            } else {
+                vst1q_u8(rows->y[row] + x, vcombine_u8(vqmovn_u16(y_low), vqmovn_u16(y_high)));
+            }
+        }
+
+        /* Pairwise add of neighboring pixels and then the vertical sum gives the sum of each 2x2 block */
+        const uint16x8_t r_sum = vaddq_u16(vpaddlq_u8(pixels[0].val[rows->r_offset]), vpaddlq_u8(pixels[1].val[rows->r_offset]));
+        const uint16x8_t g_sum = vaddq_u16(vpaddlq_u8(pixels[0].val[1]), vpaddlq_u8(pixels[1].val[1]));
+        const uint16x8_t b_sum = vaddq_u16(vpaddlq_u8(pixels[0].val[rows->b_offset]), vpaddlq_u8(pixels[1].val[rows->b_offset]));
+        const uint16x8_t u = neon_dot8(r_sum, g_sum, b_sum, c->u, c->uv_offset, true, c->max_value);
+        const uint16x8_t v = neon_dot8(r_sum, g_sum, b_sum, c->v, c->uv_offset, true, c->max_value);
+        if(c->ten_bit) {
+            const uint16x8x2_t uv = { { vshlq_n_u16(u, 6), vshlq_n_u16(v, 6) } };
+            vst2q_u16((uint16_t*)(rows->uv + x * 2), uv);
+        } else {
+            const uint8x8x2_t uv = { { vqmovn_u16(u), vqmovn_u16(v) } };
+            vst2_u8(rows->uv + x, uv);
+        }
+    }
+    return x;
+}
+
+#endif /* GSR_CPU_NEON */
+
+typedef int (*convert_row_pair_simd_func)(const row_pair *rows, const conversion_coefficients *c);
+
+/* Set with |gsr_cpu_color_conversion_set_implementation| */
+static bool implementation_forced = false;
+static convert_row_pair_simd_func forced_implementation = NULL;
+static const char *forced_implementation_name = NULL;
+
+static convert_row_pair_simd_func get_convert_row_pair_simd(const char **name) {
+    if(implementation_forced) {
+        *name = forced_implementation_name;
+        return forced_implementation;
+    }
+
+#if defined(GSR_CPU_X86)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return convert_row_pair_avx2;
+    } else if(__builtin_cpu_supports("sse4.1")) {
+        *name = "sse4.1";
+        return convert_row_pair_sse41;
+    }
+#elif defined(GSR_CPU_NEON)
+    *name = "neon";
+    return convert_row_pair_neon;
+#endif
+    *name = "scalar";
+    return NULL;
+}
+
+int gsr_cpu_color_conversion_convert(const gsr_cpu_source_image *source, const gsr_cpu_destination_image *destination, gsr_destination_color destination_color, gsr_color_range color_range) {
+    const gsr_color_matrix *matrix = gsr_color_matrix_get(destination_color, color_range);
+    if(!matrix) {
+        fprintf(stderr, "gsr error: gsr_cpu_color_conversion_convert: only nv12 and p010 destination colors are supported\n");
+        return -1;
+    }
+
+    if(source->width <= 0 || source->height <= 0)
+        return 0;
+
+    conversion_coefficients coefficients;
+    conversion_coefficients_init(&coefficients, matrix, destination_color == GSR_DESTINATION_COLOR_P010);
+
+    int bytes_per_pixel = 4;
+    int r_offset = 0;
+    int b_offset = 2;
+    switch(source->format) {
+        case GSR_CPU_SOURCE_FORMAT_RGBA:
+            break;
+        case GSR_CPU_SOURCE_FORMAT_BGRA:
+            r_offset = 2;
+            b_offset = 0;
+            break;
+        case GSR_CPU_SOURCE_FORMAT_RGB:
+            bytes_per_pixel = 3;
+            break;
+    }
+
+    const char *implementation_name = NULL;
+    /* The simd versions only handle 4 bytes per pixel */
+    const convert_row_pair_simd_func convert_row_pair_simd = bytes_per_pixel == 4 ? get_convert_row_pair_simd(&implementation_name) : NULL;
+
+    for(int y = 0; y < source->height; y += 2) {
+        /* Odd height: the last row is repeated for chroma */
+        const bool has_second_row = y + 1 < source->height;
+        row_pair rows;
+        rows.src[0] = source->data + (ptrdiff_t)y * source->stride;
+        rows.src[1] = has_second_row ? rows.src[0] + source->stride : rows.src[0];
+        rows.y[0] = destination->y + (size_t)y * destination->y_stride;
+        rows.y[1] = has_second_row ? rows.y[0] + destination->y_stride : NULL;
+        rows.uv = destination->uv + (size_t)(y / 2) * destination->uv_stride;
+        rows.width = source->width;
+        rows.r_offset = r_offset;
+        rows.b_offset = b_offset;
+
+        const int x = convert_row_pair_simd ? convert_row_pair_simd(&rows, &coefficients) : 0;
+        convert_row_pair_scalar(&rows, x, bytes_per_pixel, &coefficients);
+    }
+
+    return 0;
+}
+
+const char* gsr_cpu_color_conversion_get_implementation_name(void) {
+    const char *name = NULL;
+    get_convert_row_pair_simd(&name);
+    return name;
+}
+
+bool gsr_cpu_color_conversion_set_implementation(const char *name) {
+    if(!name) {
+        implementation_forced = false;
+        return true;
+    }
+
+    convert_row_pair_simd_func func = NULL;
+    if(strcmp(name, "scalar") == 0) {
+        func = NULL;
+#if defined(GSR_CPU_X86)
+    } else if(strcmp(name, "avx2") == 0) {
+        __builtin_cpu_init();
+        if(!__builtin_cpu_supports("avx2"))
+            return false;
+        func = convert_row_pair_avx2;
+    } else if(strcmp(name, "sse4.1") == 0) {
+        __builtin_cpu_init();
+        if(!__builtin_cpu_supports("sse4.1"))
+            return false;
+        func = convert_row_pair_sse41;
+#elif defined(GSR_CPU_NEON)
+    } else if(strcmp(name, "neon") == 0) {
+        func = convert_row_pair_neon;
+#endif
+    } else {
+        return false;
+    }
+
+    forced_implementation = func;
+    forced_implementation_name = name;
+    implementation_forced = true;
+    return true;
+}
@@ -0,0 +1,421 @@
+#include "../include/dbus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define PORTAL_BUS_NAME "org.freedesktop.portal.Desktop"
+#define PORTAL_OBJECT_PATH "/org/freedesktop/portal/desktop"
+#define PORTAL_SCREENCAST_INTERFACE "org.freedesktop.portal.ScreenCast"
+#define PORTAL_REQUEST_INTERFACE "org.freedesktop.portal.Request"
+#define PORTAL_SESSION_INTERFACE "org.freedesktop.portal.Session"
+
+typedef enum {
+    DICT_TYPE_STRING,
+    DICT_TYPE_UINT32,
+    DICT_TYPE_BOOL
+} dict_value_type;
+
+typedef struct {
+    const char *key;
+    dict_value_type value_type;
+    union {
+        const char *str;
+        dbus_uint32_t u32;
+        dbus_bool_t boolean;
+    };
+} dict_entry;
+
+bool gsr_dbus_init(gsr_dbus *self) {
+    memset(self, 0, sizeof(*self));
+    dbus_error_init(&self->err);
+
+    self->con = dbus_bus_get(DBUS_BUS_SESSION, &self->err);
+    if(dbus_error_is_set(&self->err)) {
+        fprintf(stderr, "gsr error: gsr_dbus_init: dbus_bus_get failed with error: %s\n", self->err.message);
+        gsr_dbus_deinit(self);
+        return false;
+    }
+
+    if(!self->con) {
+        fprintf(stderr, "gsr error: gsr_dbus_init: failed to get dbus session\n");
+        gsr_dbus_deinit(self);
+        return false;
+    }
+
+    /* The portal creates request objects at /org/freedesktop/portal/desktop/request/SENDER/TOKEN where SENDER is the unique name without ':' and with '.' replaced by '_' */
+    const char *unique_name = dbus_bus_get_unique_name(self->con);
+    if(!unique_name || unique_name[0] != ':' || strlen(unique_name) >= sizeof(self->sender_path_name)) {
+        fprintf(stderr, "gsr error: gsr_dbus_init: invalid unique name for the dbus connection\n");
+        gsr_dbus_deinit(self);
+        return false;
+    }
+
+    snprintf(self->sender_path_name, sizeof(self->sender_path_name), "%s", unique_name + 1);
+    for(char *c = self->sender_path_name; *c; ++c) {
+        if(*c == '.')
+            *c = '_';
+    }
+
+    return true;
+}
+
+void gsr_dbus_deinit(gsr_dbus *self) {
+    dbus_error_free(&self->err);
+    if(self->con) {
+        /* Shared connection (dbus_bus_get), it must not be closed */
+        dbus_connection_unref(self->con);
+        self->con = NULL;
+    }
+}
+
+static bool gsr_dbus_add_variant(DBusMessageIter *iter, const dict_entry *entry) {
+    DBusMessageIter variant_iter;
+    switch(entry->value_type) {
+        case DICT_TYPE_STRING: {
+            if(!dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, DBUS_TYPE_STRING_AS_STRING, &variant_iter))
+                return false;
+            if(!dbus_message_iter_append_basic(&variant_iter, DBUS_TYPE_STRING, &entry->str)) {
+                dbus_message_iter_abandon_container_if_open(iter, &variant_iter);
+                return false;
+            }
+            break;
+        }
+        case DICT_TYPE_UINT32: {
+            if(!dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, DBUS_TYPE_UINT32_AS_STRING, &variant_iter))
+                return false;
+            if(!dbus_message_iter_append_basic(&variant_iter, DBUS_TYPE_UINT32, &entry->u32)) {
+                dbus_message_iter_abandon_container_if_open(iter, &variant_iter);
+                return false;
+            }
+            break;
+        }
+        case DICT_TYPE_BOOL: {
+            if(!dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, DBUS_TYPE_BOOLEAN_AS_STRING, &variant_iter))
+                return false;
+            if(!dbus_message_iter_append_basic(&variant_iter, DBUS_TYPE_BOOLEAN, &entry->boolean)) {
+                dbus_message_iter_abandon_container_if_open(iter, &variant_iter);
+                return false;
+            }
+            break;
+        }
+    }
+    return dbus_message_iter_close_container(iter, &variant_iter);
+}
+
+/* Appends an a{sv} */
+static bool gsr_dbus_add_dict(DBusMessageIter *iter, const dict_entry *entries, int num_entries) {
+    DBusMessageIter array_iter;
+    if(!dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "{sv}", &array_iter))
+        return false;
+
+    for(int i = 0; i < num_entries; ++i) {
+        DBusMessageIter entry_iter;
+        if(!dbus_message_iter_open_container(&array_iter, DBUS_TYPE_DICT_ENTRY, NULL, &entry_iter))
+            goto fail;
+
+        if(!dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING, &entries[i].key) || !gsr_dbus_add_variant(&entry_iter, &entries[i])) {
+            dbus_message_iter_abandon_container_if_open(&array_iter, &entry_iter);
+            goto fail;
+        }
+
+        if(!dbus_message_iter_close_container(&array_iter, &entry_iter))
+            goto fail;
+    }
+
+    return dbus_message_iter_close_container(iter, &array_iter);
+
+    fail:
+    dbus_message_iter_abandon_container_if_open(iter, &array_iter);
+    return false;
+}
+
+/* Returns a new token every call, the portal uses it as the last part of the request (and session) object path */
+static void gsr_dbus_create_token(gsr_dbus *self, char *token, size_t token_size) {
+    snprintf(token, token_size, "gpu_screen_recorder_%u", self->handle_counter++);
+}
+
+/*
+    Waits for the org.freedesktop.portal.Request::Response signal on |request_path|. Returns the message on success, which has to be unreffed.
+    The signal is often received together with the reply of the method call, in which case it's already in the incoming queue
+    and dbus_connection_read_write would block until the next message arrives. So the queue is checked before waiting.
+*/
+static DBusMessage* gsr_dbus_wait_for_response(gsr_dbus *self, const char *request_path) {
+    for(;;) {
+        DBusMessage *msg = NULL;
+        while((msg = dbus_connection_pop_message(self->con))) {
+            const char *path = dbus_message_get_path(msg);
+            if(dbus_message_is_signal(msg, PORTAL_REQUEST_INTERFACE, "Response") && path && strcmp(path, request_path) == 0)
+                return msg;
+            dbus_message_unref(msg);
+        }
+
+        if(!dbus_connection_read_write(self->con, -1)) {
+            fprintf(stderr, "gsr error: gsr_dbus_wait_for_response: the dbus connection was closed\n");
+            return NULL;
+        }
+    }
+}
+
+/*
+    Calls a ScreenCast method that responds with a org.freedesktop.portal.Request::Response signal and waits for it.
+    |session_handle| and |parent_window| are only added to the call when they are not NULL.
+    Returns the response message on success, with |results_iter| pointing to the a{sv} results.
+*/
+static DBusMessage* gsr_dbus_call_screencast_request(gsr_dbus *self, const char *method_name, const char *session_handle, const char *parent_window, dict_entry *entries, int num_entries, DBusMessageIter *results_iter) {
+    char handle_token[64];
+    gsr_dbus_create_token(self, handle_token, sizeof(handle_token));
+
+    char request_path[256];
+    snprintf(request_path, sizeof(request_path), PORTAL_OBJECT_PATH "/request/%s/%s", self->sender_path_name, handle_token);
+
+    /* Subscribe before the call, the response can come before the reply otherwise */
+    char match_rule[512];
+    snprintf(match_rule, sizeof(match_rule), "type='signal',interface='" PORTAL_REQUEST_INTERFACE "',member='Response',path='%s'", request_path);
+    dbus_bus_add_match(self->con, match_rule, &self->err);
+    if(dbus_error_is_set(&self->err)) {
+        fprintf(stderr, "gsr error: gsr_dbus_call_screencast_request: dbus_bus_add_match failed with error: %s\n", self->err.message);
+        dbus_error_free(&self->err);
+        return NULL;
+    }
+
+    DBusMessage *response_msg = NULL;
+    DBusMessage *msg = dbus_message_new_method_call(PORTAL_BUS_NAME, PORTAL_OBJECT_PATH, PORTAL_SCREENCAST_INTERFACE, method_name);
+    if(!msg) {
+        fprintf(stderr, "gsr error: gsr_dbus_call_screencast_request: failed to create %s method call\n", method_name);
+        goto done;
+    }
+
+    entries[0].key = "handle_token";
+    entries[0].value_type = DICT_TYPE_STRING;
+    entries[0].str = handle_token;
+
+    DBusMessageIter it;
+    dbus_message_iter_init_append(msg, &it);
+    if(session_handle && !dbus_message_iter_append_basic(&it, DBUS_TYPE_OBJECT_PATH, &session_handle))
+        goto done;
+    if(parent_window && !dbus_message_iter_append_basic(&it, DBUS_TYPE_STRING, &parent_window))
+        goto done;
+    if(!gsr_dbus_add_dict(&it, entries, num_entries))
+        goto done;
+
+    DBusMessage *reply = dbus_connection_send_with_reply_and_block(self->con, msg, DBUS_TIMEOUT_INFINITE, &self->err);
+    if(!reply) {
+        fprintf(stderr, "gsr error: gsr_dbus_call_screencast_request: %s failed with error: %s\n", method_name, dbus_error_is_set(&self->err) ? self->err.message : "(null)");
+        dbus_error_free(&self->err);
+        goto done;
+    }
+    dbus_message_unref(reply);
+
+    response_msg = gsr_dbus_wait_for_response(self, request_path);
+    if(!response_msg)
+        goto done;
+
+    dbus_uint32_t response = 2;
+    if(!dbus_message_iter_init(response_msg, results_iter) || dbus_message_iter_get_arg_type(results_iter) != DBUS_TYPE_UINT32) {
+        fprintf(stderr, "gsr error: gsr_dbus_call_screencast_request: invalid response to %s\n", method_name);
+        dbus_message_unref(response_msg);
+        response_msg = NULL;
+        goto done;
+    }
+
+    dbus_message_iter_get_basic(results_iter, &response);
+    if(response != 0) {
+        /* 1 = the user cancelled the interaction, 2 = the interaction was ended some other way */
+        fprintf(stderr, "gsr error: gsr_dbus_call_screencast_request: %s failed, %s\n", method_name, response == 1 ? "the request was cancelled" : "the request was ended");
+        dbus_message_unref(response_msg);
+        response_msg = NULL;
+        goto done;
+    }
+
+    if(!dbus_message_iter_next(results_iter) || dbus_message_iter_get_arg_type(results_iter) != DBUS_TYPE_ARRAY) {
+        fprintf(stderr, "gsr error: gsr_dbus_call_screencast_request: missing results in the response to %s\n", method_name);
+        dbus_message_unref(response_msg);
+        response_msg = NULL;
+        goto done;
+    }
+
+    done:
+    if(msg)
+        dbus_message_unref(msg);
+    dbus_bus_remove_match(self->con, match_rule, NULL);
+    return response_msg;
+}
+
+/* Finds |key| in the a{sv} |dict_iter| and sets |variant_iter| to the iterator of the value inside the variant */
+static bool gsr_dbus_dict_find(DBusMessageIter *dict_iter, const char *key, DBusMessageIter *variant_iter) {
+    DBusMessageIter array_iter;
+    dbus_message_iter_recurse(dict_iter, &array_iter);
+
+    while(dbus_message_iter_get_arg_type(&array_iter) == DBUS_TYPE_DICT_ENTRY) {
+        DBusMessageIter entry_iter;
+        dbus_message_iter_recurse(&array_iter, &entry_iter);
+
+        if(dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_STRING) {
+            const char *entry_key = NULL;
+            dbus_message_iter_get_basic(&entry_iter, &entry_key);
+            if(entry_key && strcmp(entry_key, key) == 0 && dbus_message_iter_next(&entry_iter) && dbus_message_iter_get_arg_type(&entry_iter) == DBUS_TYPE_VARIANT) {
+                dbus_message_iter_recurse(&entry_iter, variant_iter);
+                return true;
+            }
+        }
+
+        dbus_message_iter_next(&array_iter);
+    }
+
+    return false;
+}
+
+int gsr_dbus_screencast_create_session(gsr_dbus *self, char **session_handle) {
+    assert(session_handle);
+    *session_handle = NULL;
+
+    char session_handle_token[64];
+    gsr_dbus_create_token(self, session_handle_token, sizeof(session_handle_token));
+
+    dict_entry args[2];
+    args[1].key = "session_handle_token";
+    args[1].value_type = DICT_TYPE_STRING;
+    args[1].str = session_handle_token;
+
+    DBusMessageIter results_iter;
+    DBusMessage *response_msg = gsr_dbus_call_screencast_request(self, "CreateSession", NULL, NULL, args, 2, &results_iter);
+    if(!response_msg)
+        return -1;
+
+    DBusMessageIter variant_iter;
+    if(gsr_dbus_dict_find(&results_iter, "session_handle", &variant_iter)) {
+        const int type = dbus_message_iter_get_arg_type(&variant_iter);
+        if(type == DBUS_TYPE_STRING || type == DBUS_TYPE_OBJECT_PATH) {
+            const char *value = NULL;
+            dbus_message_iter_get_basic(&variant_iter, &value);
+            if(value)
+                *session_handle = strdup(value);
+        }
+    }
+
+    dbus_message_unref(response_msg);
+    if(!*session_handle) {
+        fprintf(stderr, "gsr error: gsr_dbus_screencast_create_session: missing session_handle in the response\n");
+        return -1;
+    }
+    return 0;
+}
+
+int gsr_dbus_screencast_select_sources(gsr_dbus *self, const char *session_handle, gsr_portal_capture_type capture_type, gsr_portal_cursor_mode cursor_mode) {
+    dict_entry args[4];
+    args[1].key = "types";
+    args[1].value_type = DICT_TYPE_UINT32;
+    args[1].u32 = capture_type;
+
+    args[2].key = "multiple";
+    args[2].value_type = DICT_TYPE_BOOL;
+    args[2].boolean = false;
+
+    args[3].key = "cursor_mode";
+    args[3].value_type = DICT_TYPE_UINT32;
+    args[3].u32 = cursor_mode;
+
+    DBusMessageIter results_iter;
+    DBusMessage *response_msg = gsr_dbus_call_screencast_request(self, "SelectSources", session_handle, NULL, args, 4, &results_iter);
+    if(!response_msg)
+        return -1;
+
+    dbus_message_unref(response_msg);
+    return 0;
+}
+
+int gsr_dbus_screencast_start(gsr_dbus *self, const char *session_handle, uint32_t *pipewire_node) {
+    assert(pipewire_node);
+    *pipewire_node = 0;
+
+    dict_entry args[1];
+    DBusMessageIter results_iter;
+    DBusMessage *response_msg = gsr_dbus_call_screencast_request(self, "Start", session_handle, "", args, 1, &results_iter);
+    if(!response_msg)
+        return -1;
+
+    /* streams is a(ua{sv}), the first value of each stream is the pipewire node id */
+    bool found_node = false;
+    DBusMessageIter variant_iter;
+    if(gsr_dbus_dict_find(&results_iter, "streams", &variant_iter) && dbus_message_iter_get_arg_type(&variant_iter) == DBUS_TYPE_ARRAY) {
+        DBusMessageIter streams_iter;
+        dbus_message_iter_recurse(&variant_iter, &streams_iter);
+        if(dbus_message_iter_get_arg_type(&streams_iter) == DBUS_TYPE_STRUCT) {
+            DBusMessageIter stream_iter;
+            dbus_message_iter_recurse(&streams_iter, &stream_iter);
+            if(dbus_message_iter_get_arg_type(&stream_iter) == DBUS_TYPE_UINT32) {
+                dbus_uint32_t node = 0;
+                dbus_message_iter_get_basic(&stream_iter, &node);
+                *pipewire_node = node;
+                found_node = true;
+            }
+        }
+    }
+
+    dbus_message_unref(response_msg);
+    if(!found_node) {
+        fprintf(stderr, "gsr error: gsr_dbus_screencast_start: no stream in the response\n");
+        return -1;
+    }
+    return 0;
+}
+
+int gsr_dbus_screencast_open_pipewire_remote(gsr_dbus *self, const char *session_handle, int *pipewire_fd) {
+    assert(pipewire_fd);
+    *pipewire_fd = -1;
+
+    DBusMessage *msg = dbus_message_new_method_call(PORTAL_BUS_NAME, PORTAL_OBJECT_PATH, PORTAL_SCREENCAST_INTERFACE, "OpenPipeWireRemote");
+    if(!msg) {
+        fprintf(stderr, "gsr error: gsr_dbus_screencast_open_pipewire_remote: failed to create method call\n");
+        return -1;
+    }
+
+    DBusMessageIter it;
+    dbus_message_iter_init_append(msg, &it);
+    if(!dbus_message_iter_append_basic(&it, DBUS_TYPE_OBJECT_PATH, &session_handle) || !gsr_dbus_add_dict(&it, NULL, 0)) {
+        dbus_message_unref(msg);
+        return -1;
+    }
+
+    DBusMessage *reply = dbus_connection_send_with_reply_and_block(self->con, msg, DBUS_TIMEOUT_USE_DEFAULT, &self->err);
+    dbus_message_unref(msg);
+    if(!reply) {
+        fprintf(stderr, "gsr error: gsr_dbus_screencast_open_pipewire_remote: OpenPipeWireRemote failed with error: %s\n", dbus_error_is_set(&self->err) ? self->err.message : "(null)");
+        dbus_error_free(&self->err);
+        return -1;
+    }
+
+    int fd = -1;
+    if(!dbus_message_get_args(reply, &self->err, DBUS_TYPE_UNIX_FD, &fd, DBUS_TYPE_INVALID)) {
+        fprintf(stderr, "gsr error: gsr_dbus_screencast_open_pipewire_remote: invalid reply, error: %s\n", dbus_error_is_set(&self->err) ? self->err.message : "(null)");
+        dbus_error_free(&self->err);
+        dbus_message_unref(reply);
+        return -1;
+    }
+
+    dbus_message_unref(reply);
+    *pipewire_fd = fd;
+    return 0;
+}
+
+int gsr_dbus_screencast_close_session(gsr_dbus *self, const char *session_handle) {
+    /* The method is called on the session object itself */
+    DBusMessage *msg = dbus_message_new_method_call(PORTAL_BUS_NAME, session_handle, PORTAL_SESSION_INTERFACE, "Close");
+    if(!msg) {
+        fprintf(stderr, "gsr error: gsr_dbus_screencast_close_session: failed to create method call\n");
+        return -1;
+    }
+
+    DBusMessage *reply = dbus_connection_send_with_reply_and_block(self->con, msg, DBUS_TIMEOUT_USE_DEFAULT, &self->err);
+    dbus_message_unref(msg);
+    if(!reply) {
+        fprintf(stderr, "gsr error: gsr_dbus_screencast_close_session: Close failed with error: %s\n", dbus_error_is_set(&self->err) ? self->err.message : "(null)");
+        dbus_error_free(&self->err);
+        return -1;
+    }
+
+    dbus_message_unref(reply);
+    return 0;
+}
@@ -8,6 +8,8 @@
 
 #include <wayland-client.h>
 #include <wayland-egl.h>
+#include "../external/wlr-screencopy-unstable-v1-client-protocol.h"
+#include "../external/linux-dmabuf-unstable-v1-client-protocol.h"
 #include <unistd.h>
 #include <sys/capability.h>
 
@@ -105,6 +107,34 @@ static void registry_add_object(void *data, struct wl_registry *registry, uint32
             .name = NULL,
         };
         wl_output_add_listener(gsr_output->output, &output_listener, gsr_output);
+    } else if(strcmp(interface, wl_shm_interface.name) == 0) {
+        if(egl->wayland.shm) {
+            wl_shm_destroy(egl->wayland.shm);
+            egl->wayland.shm = NULL;
+        }
+        egl->wayland.shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    } else if(strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0) {
+        /* create_immed is only available in version >= 2 */
+        if(version < 2)
+            return;
+
+        if(egl->wayland.linux_dmabuf) {
+            zwp_linux_dmabuf_v1_destroy(egl->wayland.linux_dmabuf);
+            egl->wayland.linux_dmabuf = NULL;
+        }
+        egl->wayland.linux_dmabuf = wl_registry_bind(registry, name, &zwp_linux_dmabuf_v1_interface, version < 3 ? version : 3);
+    } else if(strcmp(interface, zwlr_screencopy_manager_v1_interface.name) == 0) {
+        /* buffer_done (needed to know if the compositor can copy to dma-buf) is only available in version >= 3 */
+        if(version < 3) {
+            fprintf(stderr, "gsr warning: wlr screencopy interface version is < 3, expected >= 3 to capture a monitor with screencopy\n");
+            return;
+        }
+
+        if(egl->wayland.screencopy_manager) {
+            zwlr_screencopy_manager_v1_destroy(egl->wayland.screencopy_manager);
+            egl->wayland.screencopy_manager = NULL;
+        }
+        egl->wayland.screencopy_manager = wl_registry_bind(registry, name, &zwlr_screencopy_manager_v1_interface, 3);
     }
 }
 
@@ -131,6 +161,31 @@ static void reset_cap_nice(void) {
     cap_free(caps);
 }
 
+/* Connects to the wayland compositor and gets the globals and outputs */
+static bool gsr_egl_wayland_connect(gsr_egl *self) {
+    self->wayland.dpy = wl_display_connect(NULL);
+    if(!self->wayland.dpy) {
+        fprintf(stderr, "gsr error: gsr_egl_wayland_connect failed: wl_display_connect failed\n");
+        return false;
+    }
+
+    self->wayland.registry = wl_display_get_registry(self->wayland.dpy); // TODO: Error checking
+    wl_registry_add_listener(self->wayland.registry, &registry_listener, self); // TODO: Error checking
+
+    // Fetch globals
+    wl_display_roundtrip(self->wayland.dpy);
+
+    // Fetch wl_output
+    wl_display_roundtrip(self->wayland.dpy);
+
+    if(!self->wayland.compositor) {
+        fprintf(stderr, "gsr error: gsr_egl_wayland_connect failed: failed to find compositor\n");
+        return false;
+    }
+
+    return true;
+}
+
 // TODO: Create egl context without surface (in other words, x11/wayland agnostic, doesn't require x11/wayland dependency)
 static bool gsr_egl_create_window(gsr_egl *self, bool wayland) {
     EGLConfig  ecfg;
@@ -149,25 +204,8 @@ static bool gsr_egl_create_window(gsr_egl *self, bool wayland) {
     };
 
     if(wayland) {
-        self->wayland.dpy = wl_display_connect(NULL);
-        if(!self->wayland.dpy) {
-            fprintf(stderr, "gsr error: gsr_egl_create_window failed: wl_display_connect failed\n");
+        if(!gsr_egl_wayland_connect(self))
             goto fail;
-        }
-
-        self->wayland.registry = wl_display_get_registry(self->wayland.dpy); // TODO: Error checking
-        wl_registry_add_listener(self->wayland.registry, &registry_listener, self); // TODO: Error checking
-
-        // Fetch globals
-        wl_display_roundtrip(self->wayland.dpy);
-
-        // Fetch wl_output
-        wl_display_roundtrip(self->wayland.dpy);
-
-        if(!self->wayland.compositor) {
-            fprintf(stderr, "gsr error: gsr_gl_create_window failed: failed to find compositor\n");
-            goto fail;
-        }
     } else {
         self->x11.window = XCreateWindow(self->x11.dpy, DefaultRootWindow(self->x11.dpy), 0, 0, 16, 16, 0, CopyFromParent, InputOutput, CopyFromParent, 0, NULL);
 
@@ -262,6 +300,13 @@ static bool gsr_egl_proc_load_egl(gsr_egl *self) {
     self->eglExportDMABUFImageQueryMESA = (FUNC_eglExportDMABUFImageQueryMESA)self->eglGetProcAddress("eglExportDMABUFImageQueryMESA");
     self->eglExportDMABUFImageMESA = (FUNC_eglExportDMABUFImageMESA)self->eglGetProcAddress("eglExportDMABUFImageMESA");
     self->glEGLImageTargetTexture2DOES = (FUNC_glEGLImageTargetTexture2DOES)self->eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    self->eglQueryDmaBufModifiersEXT = (FUNC_eglQueryDmaBufModifiersEXT)self->eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+    self->glGetProgramBinary = (FUNC_glGetProgramBinary)self->eglGetProcAddress("glGetProgramBinary");
+    self->glProgramBinary = (FUNC_glProgramBinary)self->eglGetProcAddress("glProgramBinary");
+    self->glProgramParameteri = (FUNC_glProgramParameteri)self->eglGetProcAddress("glProgramParameteri");
+    self->glDispatchCompute = (FUNC_glDispatchCompute)self->eglGetProcAddress("glDispatchCompute");
+    self->glMemoryBarrier = (FUNC_glMemoryBarrier)self->eglGetProcAddress("glMemoryBarrier");
+    self->glBindImageTexture = (FUNC_glBindImageTexture)self->eglGetProcAddress("glBindImageTexture");
 
     if(!self->glEGLImageTargetTexture2DOES) {
         fprintf(stderr, "gsr error: gsr_egl_load failed: could not find glEGLImageTargetTexture2DOES\n");
@@ -282,9 +327,12 @@ static bool gsr_egl_load_gl(gsr_egl *self, void *library) {
         { (void**)&self->glGenTextures, "glGenTextures" },
         { (void**)&self->glDeleteTextures, "glDeleteTextures" },
         { (void**)&self->glBindTexture, "glBindTexture" },
+        { (void**)&self->glActiveTexture, "glActiveTexture" },
         { (void**)&self->glTexParameteri, "glTexParameteri" },
         { (void**)&self->glGetTexLevelParameteriv, "glGetTexLevelParameteriv" },
+        { (void**)&self->glPixelStorei, "glPixelStorei" },
         { (void**)&self->glTexImage2D, "glTexImage2D" },
+        { (void**)&self->glTexSubImage2D, "glTexSubImage2D" },
         { (void**)&self->glCopyImageSubData, "glCopyImageSubData" },
         { (void**)&self->glClearTexImage, "glClearTexImage" },
         { (void**)&self->glGenFramebuffers, "glGenFramebuffers" },
@@ -324,6 +372,8 @@ static bool gsr_egl_load_gl(gsr_egl *self, void *library) {
         { (void**)&self->glGetUniformLocation, "glGetUniformLocation" },
         { (void**)&self->glUniform1f, "glUniform1f" },
         { (void**)&self->glUniform2f, "glUniform2f" },
+        { (void**)&self->glUniform1i, "glUniform1i" },
+        { (void**)&self->glUniform2i, "glUniform2i" },
 
         { NULL, NULL }
     };
@@ -384,6 +434,15 @@ bool gsr_egl_load(gsr_egl *self, Display *dpy, bool wayland) {
     return false;
 }
 
+bool gsr_egl_load_wayland_only(gsr_egl *self) {
+    memset(self, 0, sizeof(gsr_egl));
+    if(!gsr_egl_wayland_connect(self)) {
+        gsr_egl_unload(self);
+        return false;
+    }
+    return true;
+}
+
 void gsr_egl_unload(gsr_egl *self) {
     if(self->egl_context) {
         self->eglDestroyContext(self->egl_display, self->egl_context);
@@ -428,6 +487,21 @@ void gsr_egl_unload(gsr_egl *self) {
     }
     self->wayland.num_outputs = 0;
 
+    if(self->wayland.screencopy_manager) {
+        zwlr_screencopy_manager_v1_destroy(self->wayland.screencopy_manager);
+        self->wayland.screencopy_manager = NULL;
+    }
+
+    if(self->wayland.linux_dmabuf) {
+        zwp_linux_dmabuf_v1_destroy(self->wayland.linux_dmabuf);
+        self->wayland.linux_dmabuf = NULL;
+    }
+
+    if(self->wayland.shm) {
+        wl_shm_destroy(self->wayland.shm);
+        self->wayland.shm = NULL;
+    }
+
     if(self->wayland.compositor) {
         wl_compositor_destroy(self->wayland.compositor);
         self->wayland.compositor = NULL;
@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include "../include/file_writer.h"
+#include "../include/utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define WRITEBACK_CHUNK_SIZE (8 * 1024 * 1024)
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_PRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+
+static void file_writer_writeback(gsr_file_writer *self, bool force) {
+    const int64_t writeback_size = self->size - self->writeback_start;
+    if(writeback_size <= 0 || (!force && writeback_size < WRITEBACK_CHUNK_SIZE))
+        return;
+
+    /* Start writeback of the new chunk without waiting for it */
+    sync_file_range(self->fd, self->writeback_start, writeback_size, SYNC_FILE_RANGE_WRITE);
+
+    /* Wait for the previous chunk to be written (which it most likely already is) and drop it from the page cache */
+    if(self->prev_writeback_end > self->prev_writeback_start) {
+        const int64_t prev_size = self->prev_writeback_end - self->prev_writeback_start;
+        sync_file_range(self->fd, self->prev_writeback_start, prev_size, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(self->fd, self->prev_writeback_start, prev_size, POSIX_FADV_DONTNEED);
+    }
+
+    self->prev_writeback_start = self->writeback_start;
+    self->prev_writeback_end = self->size;
+    self->writeback_start = self->size;
+}
+
+static void file_writer_rate_limit(gsr_file_writer *self, int64_t bytes_written) {
+    if(self->params.rate_limit_bytes_per_sec <= 0)
+        return;
+
+    self->rate_limit_bytes_written += bytes_written;
+    const double expected_time = (double)self->rate_limit_bytes_written / (double)self->params.rate_limit_bytes_per_sec;
+    const double elapsed_time = clock_get_monotonic_seconds() - self->rate_limit_start_time;
+    if(expected_time > elapsed_time)
+        usleep((expected_time - elapsed_time) * 1000.0 * 1000.0);
+}
+
+int gsr_file_writer_open(gsr_file_writer *self, const char *filepath, const gsr_file_writer_params *params) {
+    memset(self, 0, sizeof(*self));
+    self->params = *params;
+
+    self->fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(self->fd == -1) {
+        fprintf(stderr, "gsr error: gsr_file_writer_open: failed to open \"%s\", error: %s\n", filepath, strerror(errno));
+        return -1;
+    }
+
+    if(params->low_io_priority) {
+        /* Only affects the calling thread. This is only a hint, it's fine if it fails or if the io scheduler ignores it */
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 7));
+    }
+
+    /*
+        Allocate the space up front so that the filesystem can allocate it in one piece, and so that we fail early if the disk is full.
+        The file size is not changed (FALLOC_FL_KEEP_SIZE) so the file is valid even if we crash before the unused space is removed
+    */
+    if(params->preallocate_size > 0 && fallocate(self->fd, FALLOC_FL_KEEP_SIZE, 0, params->preallocate_size) == -1) {
+        if(errno == ENOSPC) {
+            fprintf(stderr, "gsr error: gsr_file_writer_open: not enough space to write %lld bytes to \"%s\"\n", (long long)params->preallocate_size, filepath);
+            close(self->fd);
+            self->fd = -1;
+            unlink(filepath);
+            return -1;
+        }
+        /* Not supported by the filesystem, that's ok */
+    }
+
+    self->rate_limit_start_time = clock_get_monotonic_seconds();
+    return 0;
+}
+
+int gsr_file_writer_write(gsr_file_writer *self, const uint8_t *data, int64_t size) {
+    int64_t written = 0;
+    while(written < size) {
+        const ssize_t bytes_written = pwrite(self->fd, data + written, size - written, self->pos);
+        if(bytes_written == -1) {
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "gsr error: gsr_file_writer_write: failed to write to file, error: %s\n", strerror(errno));
+            return -1;
+        }
+
+        written += bytes_written;
+        self->pos += bytes_written;
+    }
+
+    if(self->pos > self->size)
+        self->size = self->pos;
+
+    if(self->params.sync != GSR_FILE_WRITER_SYNC_NONE)
+        file_writer_writeback(self, false);
+
+    file_writer_rate_limit(self, size);
+    return 0;
+}
+
+int64_t gsr_file_writer_seek(gsr_file_writer *self, int64_t offset, int whence) {
+    int64_t new_pos = 0;
+    switch(whence) {
+        case SEEK_SET:
+            new_pos = offset;
+            break;
+        case SEEK_CUR:
+            new_pos = self->pos + offset;
+            break;
+        case SEEK_END:
+            new_pos = self->size + offset;
+            break;
+        default:
+            return -1;
+    }
+
+    if(new_pos < 0)
+        return -1;
+
+    self->pos = new_pos;
+    return new_pos;
+}
+
+int64_t gsr_file_writer_get_size(gsr_file_writer *self) {
+    return self->size;
+}
+
+int gsr_file_writer_close(gsr_file_writer *self) {
+    if(self->fd == -1)
+        return -1;
+
+    int result = 0;
+    if(self->params.preallocate_size > self->size && ftruncate(self->fd, self->size) == -1) {
+        fprintf(stderr, "gsr warning: gsr_file_writer_close: failed to remove preallocated space, error: %s\n", strerror(errno));
+    }
+
+    if(self->params.sync != GSR_FILE_WRITER_SYNC_NONE)
+        file_writer_writeback(self, true);
+
+    if(self->params.sync == GSR_FILE_WRITER_SYNC_FULL && fsync(self->fd) == -1) {
+        fprintf(stderr, "gsr error: gsr_file_writer_close: failed to sync file, error: %s\n", strerror(errno));
+        result = -1;
+    }
+
+    if(close(self->fd) == -1)
+        result = -1;
+    self->fd = -1;
+    return result;
+}
@@ -0,0 +1,56 @@
+#include "../include/frame_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/frame.h>
+
+int gsr_frame_queue_init(gsr_frame_queue *self, uint32_t capacity) {
+    memset(self, 0, sizeof(*self));
+    self->capacity = 1;
+    while(self->capacity < capacity)
+        self->capacity *= 2;
+
+    self->frames = calloc(self->capacity, sizeof(AVFrame*));
+    if(!self->frames) {
+        fprintf(stderr, "gsr error: gsr_frame_queue_init: failed to allocate %u frames\n", self->capacity);
+        return -1;
+    }
+    return 0;
+}
+
+void gsr_frame_queue_deinit(gsr_frame_queue *self) {
+    if(!self->frames)
+        return;
+
+    AVFrame *frame = NULL;
+    while((frame = gsr_frame_queue_pop(self)))
+        av_frame_free(&frame);
+
+    free(self->frames);
+    self->frames = NULL;
+}
+
+/* The indices wrap around at 2^32, which works since the capacity is a power of two */
+bool gsr_frame_queue_push(gsr_frame_queue *self, AVFrame *frame) {
+    const uint32_t write_index = self->write_index;
+    const uint32_t read_index = __atomic_load_n(&self->read_index, __ATOMIC_ACQUIRE);
+    if(write_index - read_index == self->capacity)
+        return false;
+
+    self->frames[write_index & (self->capacity - 1)] = frame;
+    /* Publishes the frame to the consumer */
+    __atomic_store_n(&self->write_index, write_index + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+AVFrame* gsr_frame_queue_pop(gsr_frame_queue *self) {
+    const uint32_t read_index = self->read_index;
+    const uint32_t write_index = __atomic_load_n(&self->write_index, __ATOMIC_ACQUIRE);
+    if(read_index == write_index)
+        return NULL;
+
+    AVFrame *frame = self->frames[read_index & (self->capacity - 1)];
+    /* Gives the slot back to the producer */
+    __atomic_store_n(&self->read_index, read_index + 1, __ATOMIC_RELEASE);
+    return frame;
+}
@@ -4,9 +4,18 @@ extern "C" {
 #include "../include/capture/xcomposite_vaapi.h"
 #include "../include/capture/kms_vaapi.h"
 #include "../include/capture/kms_cuda.h"
+#include "../include/capture/portal.h"
+#include "../include/capture/screencopy.h"
+#include "../include/capture/xshm.h"
 #include "../include/egl.h"
 #include "../include/utils.h"
 #include "../include/color_conversion.h"
+#include "../include/control_socket.h"
+#include "../include/file_writer.h"
+#include "../include/pipe_writer.h"
+#include "../include/network_output.h"
+#include "../include/adaptive_bitrate.h"
+#include "../include/frame_queue.h"
 }
 
 #include <assert.h>
@@ -16,13 +25,18 @@ extern "C" {
 #include <vector>
 #include <unordered_map>
 #include <thread>
+#include <atomic>
 #include <mutex>
 #include <map>
 #include <signal.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <spawn.h>
 #include <libgen.h>
+#include <semaphore.h>
+#include <inttypes.h>
+#include <limits.h>
 
 #include "../include/sound.hpp"
 
@@ -41,6 +55,7 @@ extern "C" {
 }
 
 #include <deque>
+#include <algorithm>
 #include <future>
 
 // TODO: If options are not supported then they are returned (allocated) in the options. This should be free'd.
@@ -103,6 +118,36 @@ enum class FramerateMode {
     VARIABLE
 };
 
+enum class VideoEncoder {
+    GPU, // nvenc or vaapi
+    CPU  // libx264, only with xshm capture
+};
+
+enum class RoiMode {
+    NONE,
+    CURSOR, // A region around the cursor, moves with the cursor
+    REGION  // A fixed region set by the user
+};
+
+struct RegionOfInterest {
+    RoiMode mode = RoiMode::NONE;
+    vec2i pos = {0, 0};
+    vec2i size = {0, 0};
+};
+
+enum class BitrateMode {
+    CQP, // Constant quantizer, set by the quality (-q)
+    VBR,
+    CBR
+};
+
+struct VideoBitrate {
+    BitrateMode mode = BitrateMode::CQP;
+    int64_t bitrate = 0;     // Target bitrate in bits per second, not used with cqp
+    int64_t max_bitrate = 0; // Same as |bitrate| for cbr
+    int buffer_size_ms = 1000; // Size of the vbv buffer, as the number of milliseconds of |max_bitrate| it holds
+};
+
 static int x11_error_handler(Display*, XErrorEvent*) {
     return 0;
 }
@@ -131,17 +176,59 @@ struct PacketData {
     }
 
     AVPacket data;
+    double timestamp = 0.0; // Seconds since the recording started, excluding the time spent paused
+};
+
+// Maps the pts of the video frames sent to the encoder to the time they were captured, so that the latency can be measured
+// when the packet of that frame comes out of the encoder (which can be several frames later) and when it has been sent
+struct VideoCaptureTimes {
+    static constexpr int max_frames = 64;
+    int64_t pts[max_frames];
+    double capture_time[max_frames];
+    int index = 0;
+
+    // Average over the last second
+    double capture_to_packet_latency_sum = 0.0;
+    int capture_to_packet_latency_count = 0;
+
+    VideoCaptureTimes() {
+        for(int i = 0; i < max_frames; ++i) {
+            pts[i] = AV_NOPTS_VALUE;
+            capture_time[i] = -1.0;
+        }
+    }
+
+    void add(int64_t frame_pts, double frame_capture_time) {
+        pts[index] = frame_pts;
+        capture_time[index] = frame_capture_time;
+        index = (index + 1) % max_frames;
+    }
+
+    // Returns -1.0 if the frame is unknown, for example if the encoder has held on to it for longer than |max_frames| frames
+    double take(int64_t frame_pts) {
+        for(int i = 0; i < max_frames; ++i) {
+            if(pts[i] == frame_pts) {
+                pts[i] = AV_NOPTS_VALUE;
+                return capture_time[i];
+            }
+        }
+        return -1.0;
+    }
 };
 
-// |stream| is only required for non-replay mode
+// |stream| is only required for non-replay mode. |network_output| is only set when live streaming.
+// |video_capture_times| is only set for the video stream
 static void receive_frames(AVCodecContext *av_codec_context, int stream_index, AVStream *stream, int64_t pts,
                            AVFormatContext *av_format_context,
+                           gsr_network_output *network_output,
                            double replay_start_time,
                            std::deque<std::shared_ptr<PacketData>> &frame_data_queue,
                            int replay_buffer_size_secs,
                            bool &frames_erased,
+                           uint64_t &frame_data_queue_size_bytes,
                            std::mutex &write_output_mutex,
-                           double paused_time_offset) {
+                           double paused_time_offset,
+                           VideoCaptureTimes *video_capture_times) {
     for (;;) {
         AVPacket *av_packet = av_packet_alloc();
         if(!av_packet)
@@ -151,6 +238,16 @@ static void receive_frames(AVCodecContext *av_codec_context, int stream_index, A
         av_packet->size = 0;
         int res = avcodec_receive_packet(av_codec_context, av_packet);
         if (res == 0) { // we have a packet, send the packet to the muxer
+            // The pts set by the encoder is the pts of the frame this packet belongs to
+            double capture_time = -1.0;
+            if(video_capture_times) {
+                capture_time = video_capture_times->take(av_packet->pts);
+                if(capture_time >= 0.0) {
+                    video_capture_times->capture_to_packet_latency_sum += (clock_get_monotonic_seconds() - capture_time);
+                    ++video_capture_times->capture_to_packet_latency_count;
+                }
+            }
+
             av_packet->stream_index = stream_index;
             av_packet->pts = pts;
             av_packet->dts = pts;
@@ -168,19 +265,27 @@ static void receive_frames(AVCodecContext *av_codec_context, int stream_index, A
 
                 double time_now = clock_get_monotonic_seconds() - paused_time_offset;
                 double replay_time_elapsed = time_now - replay_start_time;
+                new_packet->timestamp = replay_time_elapsed;
 
+                frame_data_queue_size_bytes += new_packet->data.size;
                 frame_data_queue.push_back(std::move(new_packet));
                 if(replay_time_elapsed >= replay_buffer_size_secs) {
+                    frame_data_queue_size_bytes -= frame_data_queue.front()->data.size;
                     frame_data_queue.pop_front();
                     frames_erased = true;
                 }
             } else {
                 av_packet_rescale_ts(av_packet, av_codec_context->time_base, stream->time_base);
                 av_packet->stream_index = stream->index;
-                // TODO: Is av_interleaved_write_frame needed?
-                int ret = av_write_frame(av_format_context, av_packet);
-                if(ret < 0) {
-                    fprintf(stderr, "Error: Failed to write frame index %d to muxer, reason: %s (%d)\n", av_packet->stream_index, av_error_to_string(ret), ret);
+                if(network_output) {
+                    // Sent from the network thread, which drops packets if the connection can't keep up
+                    gsr_network_output_push(network_output, av_packet, av_codec_context->codec_type == AVMEDIA_TYPE_VIDEO, capture_time);
+                } else {
+                    // TODO: Is av_interleaved_write_frame needed?
+                    int ret = av_write_frame(av_format_context, av_packet);
+                    if(ret < 0) {
+                        fprintf(stderr, "Error: Failed to write frame index %d to muxer, reason: %s (%d)\n", av_packet->stream_index, av_error_to_string(ret), ret);
+                    }
                 }
             }
             av_packet_free(&av_packet);
@@ -270,10 +375,12 @@ static int64_t audio_codec_get_get_bitrate(AudioCodec audio_codec) {
     return 96000;
 }
 
+// The format to request from the sound device. Pulseaudio only gives interleaved samples, so planar formats get the same sample type
+// and only have to be deinterleaved
 static AudioFormat audio_codec_context_get_audio_format(const AVCodecContext *audio_codec_context) {
     switch(audio_codec_context->sample_fmt) {
         case AV_SAMPLE_FMT_FLT:   return F32;
-        case AV_SAMPLE_FMT_FLTP:  return S32;
+        case AV_SAMPLE_FMT_FLTP:  return F32;
         case AV_SAMPLE_FMT_S16:   return S16;
         case AV_SAMPLE_FMT_S32:   return S32;
         default:                  return S16;
@@ -323,10 +430,89 @@ static AVCodecContext* create_audio_codec_context(int fps, AudioCodec audio_code
     return codec_context;
 }
 
+static const char* bitrate_mode_get_vaapi_rc_mode(BitrateMode bitrate_mode) {
+    switch(bitrate_mode) {
+        case BitrateMode::CQP: return "CQP";
+        case BitrateMode::VBR: return "VBR";
+        case BitrateMode::CBR: return "CBR";
+    }
+    return "CQP";
+}
+
+static const char* bitrate_mode_get_nvenc_rc(BitrateMode bitrate_mode) {
+    switch(bitrate_mode) {
+        case BitrateMode::CQP: return "constqp";
+        case BitrateMode::VBR: return "vbr";
+        case BitrateMode::CBR: return "cbr";
+    }
+    return "constqp";
+}
+
+// |bitrate| replaces the target bitrate in |video_bitrate|, the max bitrate and vbv buffer are scaled by the same amount.
+// This can be changed while encoding with nvenc (it reconfigures the encoder on the next frame), vaapi only uses the bitrate the encoder was opened with
+static void video_codec_context_set_bitrate(AVCodecContext *codec_context, const VideoBitrate &video_bitrate, int64_t bitrate) {
+    int64_t max_bitrate = bitrate;
+    if(video_bitrate.mode == BitrateMode::VBR && video_bitrate.bitrate > 0)
+        max_bitrate = (int64_t)((double)bitrate * ((double)video_bitrate.max_bitrate / (double)video_bitrate.bitrate));
+
+    codec_context->bit_rate = bitrate;
+    codec_context->rc_max_rate = max_bitrate;
+    codec_context->rc_buffer_size = (int)std::min((int64_t)INT_MAX, max_bitrate * video_bitrate.buffer_size_ms / 1000);
+    if(video_bitrate.mode == BitrateMode::CBR)
+        codec_context->rc_min_rate = bitrate;
+}
+
+// Makes the encoder spend more bits on the region of interest (the area around the cursor or the region set by the user), at the cost of the rest of the frame.
+// The side data is ignored by encoders that don't support it. libx264 supports it as long as adaptive quantization is enabled, which it is with the options set in open_video
+static void frame_set_region_of_interest(AVFrame *frame, const RegionOfInterest &roi, gsr_capture *capture) {
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
+    vec2i pos;
+    vec2i size;
+    switch(roi.mode) {
+        case RoiMode::NONE:
+            return;
+        case RoiMode::CURSOR: {
+            vec2i cursor_pos;
+            if(!gsr_capture_get_cursor_position(capture, &cursor_pos))
+                return;
+
+            size = { std::max(16, frame->width / 4), std::max(16, frame->height / 4) };
+            pos = { cursor_pos.x - size.x / 2, cursor_pos.y - size.y / 2 };
+            break;
+        }
+        case RoiMode::REGION: {
+            pos = roi.pos;
+            size = roi.size;
+            break;
+        }
+    }
+
+    const int left = std::max(0, std::min(pos.x, frame->width - size.x));
+    const int top = std::max(0, std::min(pos.y, frame->height - size.y));
+    const int right = std::min(frame->width, left + size.x);
+    const int bottom = std::min(frame->height, top + size.y);
+    if(right <= left || bottom <= top)
+        return;
+
+    AVFrameSideData *side_data = av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, sizeof(AVRegionOfInterest));
+    if(!side_data)
+        return;
+
+    AVRegionOfInterest *region = (AVRegionOfInterest*)side_data->data;
+    region->self_size = sizeof(AVRegionOfInterest);
+    region->top = top;
+    region->bottom = bottom;
+    region->left = left;
+    region->right = right;
+    // Negative is better quality. -1 is the best quality, but that starves the rest of the frame
+    region->qoffset = av_make_q(-1, 5);
+}
+
 static AVCodecContext *create_video_codec_context(AVPixelFormat pix_fmt,
                             VideoQuality video_quality,
-                            int fps, const AVCodec *codec, bool is_livestream, gsr_gpu_vendor vendor, FramerateMode framerate_mode,
-                            bool hdr, gsr_color_range color_range) {
+                            int fps, const AVCodec *codec, bool is_livestream, FramerateMode framerate_mode,
+                            bool hdr, gsr_color_range color_range, const VideoBitrate &video_bitrate, double keyframe_interval_secs) {
 
     AVCodecContext *codec_context = avcodec_alloc_context3(codec);
 
@@ -350,10 +536,9 @@ static AVCodecContext *create_video_codec_context(AVPixelFormat pix_fmt,
         codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
         //codec_context->gop_size = std::numeric_limits<int>::max();
         //codec_context->keyint_min = std::numeric_limits<int>::max();
-        codec_context->gop_size = fps * 2;
-    } else {
-        codec_context->gop_size = fps * 2;
     }
+    // With intra refresh this is the number of frames it takes to refresh the whole frame instead
+    codec_context->gop_size = std::max(1, (int)std::round(fps * keyframe_interval_secs));
     codec_context->max_b_frames = 0;
     codec_context->pix_fmt = pix_fmt;
     codec_context->color_range = color_range == GSR_COLOR_RANGE_LIMITED ? AVCOL_RANGE_MPEG : AVCOL_RANGE_JPEG;
@@ -391,6 +576,9 @@ static AVCodecContext *create_video_codec_context(AVPixelFormat pix_fmt,
             codec_context->bit_rate = 100000;//10000000-9000000 + (codec_context->width * codec_context->height)*0.75;
             break;
     }
+
+    if(video_bitrate.mode != BitrateMode::CQP)
+        video_codec_context_set_bitrate(codec_context, video_bitrate, video_bitrate.bitrate);
     //codec_context->profile = FF_PROFILE_H264_MAIN;
     if (codec_context->codec_id == AV_CODEC_ID_MPEG1VIDEO)
         codec_context->mb_decision = 2;
@@ -414,7 +602,7 @@ static AVCodecContext *create_video_codec_context(AVPixelFormat pix_fmt,
     codec_context->bit_rate = 0;
     #endif
 
-    if(vendor != GSR_GPU_VENDOR_NVIDIA) {
+    if(pix_fmt == AV_PIX_FMT_VAAPI && video_bitrate.mode == BitrateMode::CQP) {
         switch(video_quality) {
             case VideoQuality::MEDIUM:
                 codec_context->global_quality = 180;
@@ -434,10 +622,10 @@ static AVCodecContext *create_video_codec_context(AVPixelFormat pix_fmt,
     av_opt_set_int(codec_context->priv_data, "b_ref_mode", 0, 0);
     //av_opt_set_int(codec_context->priv_data, "cbr", true, 0);
 
-    if(vendor != GSR_GPU_VENDOR_NVIDIA) {
+    if(pix_fmt == AV_PIX_FMT_VAAPI) {
         // TODO: More options, better options
         //codec_context->bit_rate = codec_context->width * codec_context->height;
-        av_opt_set(codec_context->priv_data, "rc_mode", "CQP", 0);
+        av_opt_set(codec_context->priv_data, "rc_mode", bitrate_mode_get_vaapi_rc_mode(video_bitrate.mode), 0);
         //codec_context->global_quality = 4;
         //codec_context->compression_level = 2;
     }
@@ -501,7 +689,7 @@ static bool vaapi_create_codec_context(AVCodecContext *video_codec_context, cons
 
 static bool check_if_codec_valid_for_hardware(const AVCodec *codec, gsr_gpu_vendor vendor, const char *card_path) {
     // Do not use AV_PIX_FMT_CUDA because we dont want to do full check with hardware context
-    AVCodecContext *codec_context = create_video_codec_context(vendor == GSR_GPU_VENDOR_NVIDIA ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_VAAPI, VideoQuality::VERY_HIGH, 60, codec, false, vendor, FramerateMode::CONSTANT, false, GSR_COLOR_RANGE_LIMITED);
+    AVCodecContext *codec_context = create_video_codec_context(vendor == GSR_GPU_VENDOR_NVIDIA ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_VAAPI, VideoQuality::VERY_HIGH, 60, codec, false, FramerateMode::CONSTANT, false, GSR_COLOR_RANGE_LIMITED, VideoBitrate(), 2.0);
     if(!codec_context)
         return false;
 
@@ -579,9 +767,16 @@ static const AVCodec* find_av1_encoder(gsr_gpu_vendor vendor, const char *card_p
     return checked_success ? codec : nullptr;
 }
 
-static void open_audio(AVCodecContext *audio_codec_context) {
+static void open_audio(AVCodecContext *audio_codec_context, bool dtx) {
     AVDictionary *options = nullptr;
     av_dict_set(&options, "strict", "experimental", 0);
+    if(dtx) {
+        // Silence is sent as (almost) empty packets instead of being encoded like any other audio
+        if(strcmp(audio_codec_context->codec->name, "libopus") == 0)
+            av_dict_set_int(&options, "dtx", 1, 0);
+        else
+            fprintf(stderr, "Warning: -dtx is only supported by the libopus audio encoder, ignoring it\n");
+    }
 
     int ret;
     ret = avcodec_open2(audio_codec_context, audio_codec_context->codec, &options);
@@ -591,6 +786,43 @@ static void open_audio(AVCodecContext *audio_codec_context) {
     }
 }
 
+template <typename T>
+static void deinterleave_samples(const T *samples, T **planes, int num_samples, int num_channels) {
+    if(num_channels == 2) {
+        T *left = planes[0];
+        T *right = planes[1];
+        for(int i = 0; i < num_samples; ++i) {
+            left[i] = samples[i * 2];
+            right[i] = samples[i * 2 + 1];
+        }
+        return;
+    }
+
+    for(int i = 0; i < num_samples; ++i) {
+        for(int c = 0; c < num_channels; ++c) {
+            planes[c][i] = samples[i * num_channels + c];
+        }
+    }
+}
+
+// Splits interleaved |samples| into one plane per channel. This is an exact copy, unlike converting with swresample
+static void deinterleave_audio_samples(const uint8_t *samples, uint8_t **planes, int num_samples, int num_channels, int bytes_per_sample) {
+    switch(bytes_per_sample) {
+        case 2:
+            deinterleave_samples((const uint16_t*)samples, (uint16_t**)planes, num_samples, num_channels);
+            break;
+        case 4:
+            deinterleave_samples((const uint32_t*)samples, (uint32_t**)planes, num_samples, num_channels);
+            break;
+        case 8:
+            deinterleave_samples((const uint64_t*)samples, (uint64_t**)planes, num_samples, num_channels);
+            break;
+        default:
+            assert(false);
+            break;
+    }
+}
+
 static AVFrame* create_audio_frame(AVCodecContext *audio_codec_context) {
     AVFrame *frame = av_frame_alloc();
     if(!frame) {
@@ -617,9 +849,38 @@ static AVFrame* create_audio_frame(AVCodecContext *audio_codec_context) {
     return frame;
 }
 
-static void open_video(AVCodecContext *codec_context, VideoQuality video_quality, bool very_old_gpu, gsr_gpu_vendor vendor, PixelFormat pixel_format, bool hdr) {
+// The quality is only used with BitrateMode::CQP
+static void open_video(AVCodecContext *codec_context, VideoQuality video_quality, bool very_old_gpu, gsr_gpu_vendor vendor, VideoEncoder video_encoder, PixelFormat pixel_format, bool hdr, BitrateMode bitrate_mode, bool intra_refresh, bool low_latency) {
     AVDictionary *options = nullptr;
-    if(vendor == GSR_GPU_VENDOR_NVIDIA) {
+    if(video_encoder == VideoEncoder::CPU) {
+        if(bitrate_mode != BitrateMode::CQP) {
+            // Using the bitrate set in create_video_codec_context
+        } else {
+            switch(video_quality) {
+                case VideoQuality::MEDIUM:
+                    av_dict_set_int(&options, "crf", 30, 0);
+                    break;
+                case VideoQuality::HIGH:
+                    av_dict_set_int(&options, "crf", 26, 0);
+                    break;
+                case VideoQuality::VERY_HIGH:
+                    av_dict_set_int(&options, "crf", 23, 0);
+                    break;
+                case VideoQuality::ULTRA:
+                    av_dict_set_int(&options, "crf", 19, 0);
+                    break;
+            }
+        }
+
+        // The cpu is also doing the capture and color conversion, so use a fast preset
+        av_dict_set(&options, "preset", "veryfast", 0);
+        if(low_latency) {
+            // No lookahead and no frame threads, every frame is output as soon as it has been encoded
+            av_dict_set(&options, "tune", "zerolatency", 0);
+        }
+        av_dict_set(&options, "profile", "high", 0);
+        av_dict_set_int(&options, "forced-idr", 1, 0);
+    } else if(vendor == GSR_GPU_VENDOR_NVIDIA) {
 #if 0
         bool supports_p4 = false;
         bool supports_p5 = false;
@@ -635,7 +896,9 @@ static void open_video(AVCodecContext *codec_context, VideoQuality video_quality
         }
 #endif
 
-        if(codec_context->codec_id == AV_CODEC_ID_AV1) {
+        if(bitrate_mode != BitrateMode::CQP) {
+            // Using the bitrate set in create_video_codec_context
+        } else if(codec_context->codec_id == AV_CODEC_ID_AV1) {
             switch(video_quality) {
                 case VideoQuality::MEDIUM:
                     av_dict_set_int(&options, "qp", 43, 0);
@@ -706,8 +969,23 @@ static void open_video(AVCodecContext *codec_context, VideoQuality video_quality
             av_dict_set(&options, "preset", supports_p5 ? "p5" : "slow", 0);
 #endif
 
-        av_dict_set(&options, "tune", "hq", 0);
-        av_dict_set(&options, "rc", "constqp", 0);
+        if(low_latency) {
+            // Output every frame as soon as it has been encoded (delay) and don't look ahead at future frames
+            av_dict_set(&options, "tune", "ll", 0);
+            av_dict_set_int(&options, "zerolatency", 1, 0);
+            av_dict_set_int(&options, "delay", 0, 0);
+            av_dict_set_int(&options, "rc-lookahead", 0, 0);
+        } else {
+            av_dict_set(&options, "tune", "hq", 0);
+        }
+        av_dict_set(&options, "rc", bitrate_mode_get_nvenc_rc(bitrate_mode), 0);
+        // Make frames with pict_type AV_PICTURE_TYPE_I (forced keyframes) idr frames, so that the stream can be decoded from them
+        av_dict_set_int(&options, "forced-idr", 1, 0);
+        if(intra_refresh) {
+            // Refresh a column of the frame in every frame instead of sending keyframes. Nvenc uses an infinite gop and
+            // refreshes the whole frame every gop_size frames
+            av_dict_set_int(&options, "intra-refresh", 1, 0);
+        }
 
         if(codec_context->codec_id == AV_CODEC_ID_H264) {
             switch(pixel_format) {
@@ -732,7 +1010,9 @@ static void open_video(AVCodecContext *codec_context, VideoQuality video_quality
             //av_dict_set(&options, "pix_fmt", "yuv420p16le", 0);
         }
     } else {
-        if(codec_context->codec_id == AV_CODEC_ID_AV1) {
+        if(bitrate_mode != BitrateMode::CQP) {
+            // Using the bitrate set in create_video_codec_context
+        } else if(codec_context->codec_id == AV_CODEC_ID_AV1) {
             // Using global_quality option
         } else if(codec_context->codec_id == AV_CODEC_ID_H264) {
             switch(video_quality) {
@@ -767,7 +1047,11 @@ static void open_video(AVCodecContext *codec_context, VideoQuality video_quality
         }
 
         // TODO: More quality options
-        av_dict_set(&options, "rc_mode", "CQP", 0);
+        av_dict_set(&options, "rc_mode", bitrate_mode_get_vaapi_rc_mode(bitrate_mode), 0);
+        if(low_latency) {
+            // Wait for each frame to be encoded before the next one is submitted, instead of pipelining frames
+            av_dict_set_int(&options, "async_depth", 1, 0);
+        }
         //av_dict_set_int(&options, "low_power", 1, 0);
 
         if(codec_context->codec_id == AV_CODEC_ID_H264) {
@@ -800,20 +1084,32 @@ static void open_video(AVCodecContext *codec_context, VideoQuality video_quality
 }
 
 static void usage_header() {
-    fprintf(stderr, "usage: gpu-screen-recorder -w <window_id|monitor|focused> [-c <container_format>] [-s WxH] -f <fps> [-a <audio_input>] [-q <quality>] [-r <replay_buffer_size_sec>] [-k h264|hevc|hevc_hdr|av1|av1_hdr] [-ac aac|opus|flac] [-oc yes|no] [-fm cfr|vfr] [-cr limited|full] [-v yes|no] [-h|--help] [-o <output_file>] [-mf yes|no] [-sc <script_path>]\n");
+    fprintf(stderr, "usage: gpu-screen-recorder [-w <window_id|monitor|focused>] [-c <container_format>] [-s WxH] [-f <fps>] [-a <audio_input>] [-q <quality>] [-r <replay_buffer_size_sec>] [-k h264|hevc|hevc_hdr|av1|av1_hdr] [-ac aac|opus|flac] [-oc yes|no] [-fm cfr|vfr] [-cr limited|full] [-v yes|no] [-h|--help] [-o <output_file>] [-mf yes|no] [-sc <script_path>] [-ctl <socket_path>] [-rws none|writeback|full] [-rwl <mb_per_sec>] [-frag yes|no] [-faststart yes|no] [-ql <milliseconds>] [-abr <max_kbps>] [-bm cqp|vbr|cbr] [-b <kbps>] [-bmax <kbps>] [-bbuf <milliseconds>] [-keyint <seconds>] [-ir yes|no] [-latency normal|low] [-roi cursor|WxH+X+Y] [-dtx yes|no] [-asrv pulseaudio|pipewire] [-encoder gpu|cpu]\n");
 }
 
 static void usage_full() {
     usage_header();
     fprintf(stderr, "\n");
     fprintf(stderr, "OPTIONS:\n");
-    fprintf(stderr, "  -w    Window id to record, a display (monitor name), \"screen\", \"screen-direct\", \"screen-direct-force\" or \"focused\".\n");
+    fprintf(stderr, "  -w    Window id to record, a display (monitor name), \"screen\", \"screen-direct\", \"screen-direct-force\", \"focused\", \"portal\", \"pipewire:<node>\",\n");
+    fprintf(stderr, "        \"screencopy\", \"screencopy:<monitor>\", \"xshm\" or \"xshm:<monitor>\".\n");
     fprintf(stderr, "        If this is \"screen\", \"screen-direct\" or \"screen-direct-force\" then all displays are recorded.\n");
     fprintf(stderr, "        If this is \"focused\" then the currently focused window is recorded. When recording the focused window then the -s option has to be used as well.\n");
     fprintf(stderr, "        \"screen-direct\"/\"screen-direct-force\" skips one texture copy for fullscreen applications so it may lead to better performance and it works with VRR monitors\n");
     fprintf(stderr, "        when recording fullscreen application but may break some applications, such as mpv in fullscreen mode or might cause games to freeze/crash because of nvidia driver issues.\n");
     fprintf(stderr, "        Direct mode doesn't capture cursor either.\n");
     fprintf(stderr, "        \"screen-direct-force\" is not recommended unless you use a VRR monitor and you are aware that using this option can cause games to freeze/crash or other issues.\n");
+    fprintf(stderr, "        If this is \"portal\" then the desktop portal (xdg-desktop-portal) is used to ask which monitor or window to record. The frames are received from pipewire.\n");
+    fprintf(stderr, "        If this is \"pipewire:<node>\" then the pipewire node with that id or name is recorded directly without the desktop portal,\n");
+    fprintf(stderr, "        for example a video test source created with: gst-launch-1.0 videotestsrc ! pipewiresink. \"portal\" and \"pipewire:\" are only supported on AMD and Intel.\n");
+    fprintf(stderr, "        If this is \"screencopy\" (first monitor) or \"screencopy:<monitor>\" then the monitor is recorded with the wlr-screencopy wayland protocol instead of KMS.\n");
+    fprintf(stderr, "        This is supported by wlroots based compositors (such as sway and hyprland), doesn't require root access and only copies the monitor when it changes.\n");
+    fprintf(stderr, "        It also works with compositors that render without a GPU (for example sway in headless mode). \"screencopy\" is only supported on AMD and Intel, or without a GPU with -encoder cpu.\n");
+    fprintf(stderr, "        If this is \"xshm\" (the whole screen) or \"xshm:<monitor>\" then the X11 screen is copied with MIT-SHM, only copying the parts that have changed (XDamage).\n");
+    fprintf(stderr, "        The color conversion is done on the CPU and the frames are uploaded to the GPU for encoding. This works with any X11 server, including Xvfb,\n");
+    fprintf(stderr, "        but uses more CPU than the other capture methods. The cursor is not recorded. \"xshm\" is only supported on AMD and Intel, or without a GPU with -encoder cpu.\n");
+    fprintf(stderr, "        If this is not set then only audio (-a) is recorded. The display server and the GPU are not used at all then, so this works on headless machines without a GPU.\n");
+    fprintf(stderr, "        Replay mode (-r) is not supported when only recording audio.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -c    Container format for output file, for example mp4, or flv. Only required if no output file is specified or if recording in replay buffer mode.\n");
     fprintf(stderr, "        If an output file is specified and -c is not used then the container format is determined from the output filename extension.\n");
@@ -822,16 +1118,54 @@ static void usage_full() {
     fprintf(stderr, "\n");
     fprintf(stderr, "  -s    The size (area) to record at in the format WxH, for example 1920x1080. This option is only supported (and required) when -w is \"focused\".\n");
     fprintf(stderr, "\n");
-    fprintf(stderr, "  -f    Framerate to record at.\n");
+    fprintf(stderr, "  -f    Framerate to record at. Not needed when only recording audio.\n");
     fprintf(stderr, "\n");
-    fprintf(stderr, "  -a    Audio device to record from (pulse audio device). Can be specified multiple times. Each time this is specified a new audio track is added for the specified audio device.\n");
+    fprintf(stderr, "  -a    Audio device to record from (pulse audio device, or pipewire node with -asrv pipewire). Can be specified multiple times. Each time this is specified a new audio track is added for the specified audio device.\n");
     fprintf(stderr, "        A name can be given to the audio input device by prefixing the audio input with <name>/, for example \"dummy/alsa_output.pci-0000_00_1b.0.analog-stereo.monitor\".\n");
     fprintf(stderr, "        Multiple audio devices can be merged into one audio track by using \"|\" as a separator into one -a argument, for example: -a \"alsa_output1|alsa_output2\".\n");
     fprintf(stderr, "        Optional, no audio track is added by default.\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "  -asrv Sound server to record audio from. Should be either 'pulseaudio' or 'pipewire'. 'pipewire' records directly from pipewire nodes in pipewire real-time threads\n");
+    fprintf(stderr, "        instead of going through pipewire-pulse, which gives lower audio latency and less cpu usage. The audio device names are the same for both.\n");
+    fprintf(stderr, "        Optional, set to 'pulseaudio' by default.\n");
+    fprintf(stderr, "\n");
     fprintf(stderr, "  -q    Video quality. Should be either 'medium', 'high', 'very_high' or 'ultra'. 'high' is the recommended option when live streaming or when you have a slower harddrive.\n");
     fprintf(stderr, "        Optional, set to 'very_high' be default.\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "  -bm   Video bitrate mode. Should be either 'cqp', 'vbr' or 'cbr'. 'cqp' encodes every frame with a constant quality (set with -q), which gives the best quality for the size\n");
+    fprintf(stderr, "        but the bitrate goes up and down with the content. 'vbr' and 'cbr' use the bitrate set with -b instead of -q, which makes the size of the video (and the replay buffer)\n");
+    fprintf(stderr, "        and the bandwidth of live streams predictable. 'cbr' is recommended for live streaming. Optional, set to 'cqp' by default ('vbr' when using -abr).\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -b    Video bitrate in kbps. Required when using -bm vbr or -bm cbr.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -bmax The maximum video bitrate in kbps when using -bm vbr, should be higher than -b. Optional, set to the same value as -b by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -bbuf The size of the encoders rate control (vbv) buffer when using -bm vbr or -bm cbr, in milliseconds of data at the max bitrate. Lower values keep the bitrate closer\n");
+    fprintf(stderr, "        to the target over short periods of time (less bursty live streams) at the cost of quality. Optional, set to 1000 by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -keyint\n");
+    fprintf(stderr, "        The time between keyframes, in seconds. Lower values let viewers join a live stream faster and make saved replays start closer to the requested time,\n");
+    fprintf(stderr, "        but increase the size of the video. A keyframe can also be requested at any time with the control socket (see --control). Optional, set to 2 by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -ir   Use intra refresh instead of keyframes when live streaming. Every frame refreshes a part of the image, so that the whole image has been refreshed after -keyint seconds.\n");
+    fprintf(stderr, "        This avoids the bitrate spikes caused by keyframes, which lowers latency on slow connections. Some streaming services require regular keyframes and don't support this.\n");
+    fprintf(stderr, "        Only supported on NVIDIA. Should be either 'yes' or 'no'. Optional, set to 'no' by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -latency\n");
+    fprintf(stderr, "        Should be either 'normal' or 'low'. 'low' configures the encoder to output every frame as soon as it has been encoded (no lookahead or pipelining of frames)\n");
+    fprintf(stderr, "        and writes every packet to the output immediately instead of buffering it in the muxer, at the cost of some quality. Use this for game streaming.\n");
+    fprintf(stderr, "        The latency from capture to encoded packet, and to the network when live streaming, is printed every second (with -v yes) and reported by --control stats.\n");
+    fprintf(stderr, "        Optional, set to 'normal' by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -encoder\n");
+    fprintf(stderr, "        Should be either 'gpu' or 'cpu'. 'cpu' encodes the video with libx264 on the CPU instead of with the GPU, so that the screen can be recorded on machines\n");
+    fprintf(stderr, "        without a GPU, for example with Xvfb or sway in headless mode. Only supported with -w xshm or -w screencopy and the h264 video codec, and it uses a lot more CPU.\n");
+    fprintf(stderr, "        Optional, set to 'gpu' by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -roi  Region of interest. The encoder gives the region a higher quality than the rest of the video, which helps keep text readable at low bitrates.\n");
+    fprintf(stderr, "        Should be either 'cursor' (the area around the cursor) or a region of the recorded video in the format WxH+X+Y, for example 1280x720+0+0.\n");
+    fprintf(stderr, "        This is a hint to the encoder. libx264 (-encoder cpu) supports it, for the GPU encoders it depends on the GPU driver and ffmpeg version. Optional, disabled by default.\n");
+    fprintf(stderr, "\n");
     fprintf(stderr, "  -r    Replay buffer size in seconds. If this is set, then only the last seconds as set by this option will be stored\n");
     fprintf(stderr, "        and the video will only be saved when the gpu-screen-recorder is closed. This feature is similar to Nvidia's instant replay feature.\n");
     fprintf(stderr, "        This option has be between 5 and 1200. Note that the replay buffer size will not always be precise, because of keyframes. Optional, disabled by default.\n");
@@ -843,6 +1177,10 @@ static void usage_full() {
     fprintf(stderr, "  -ac   Audio codec to use. Should be either 'aac', 'opus' or 'flac'. Defaults to 'opus' for .mp4/.mkv files, otherwise defaults to 'aac'.\n");
     fprintf(stderr, "        'opus' and 'flac' is only supported by .mp4/.mkv files. 'opus' is recommended for best performance and smallest audio size.\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "  -dtx  Discontinuous transmission for opus audio. Silent parts of the audio (muted microphones, nothing playing) are stored in a few bytes\n");
+    fprintf(stderr, "        instead of being encoded like the rest of the audio, which saves space and cpu. Only supported when ffmpeg uses libopus for opus.\n");
+    fprintf(stderr, "        Should be either 'yes' or 'no'. Optional, set to 'no' by default.\n");
+    fprintf(stderr, "\n");
     fprintf(stderr, "  -oc   Overclock memory transfer rate to the maximum performance level. This only applies to NVIDIA on X11 and exists to overcome a bug in NVIDIA driver where performance level\n");
     fprintf(stderr, "        is dropped when you record a game. Only needed if you are recording a game that is bottlenecked by GPU. The same issue exists on Wayland but overclocking is not possible on Wayland.\n");
     fprintf(stderr, "        Works only if your have \"Coolbits\" set to \"12\" in NVIDIA X settings, see README for more information. Note! use at your own risk! Optional, disabled by default.\n");
@@ -862,6 +1200,37 @@ static void usage_full() {
     fprintf(stderr, "\n");
     fprintf(stderr, "  -sc   Run a script on the saved video file (non-blocking). The first argument to the script is the filepath to the saved video file and the second argument is the recording type (either \"regular\" or \"replay\"). Not applicable for live streams.\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "  -rws  How the saved replay is written to disk. Should be either 'none', 'writeback' or 'full'. Defaults to 'writeback'.\n");
+    fprintf(stderr, "        'none' leaves it to the operating system. 'writeback' writes the replay to disk while it's being saved and removes it from the page cache,\n");
+    fprintf(stderr, "        which avoids io stutter when saving large replays. 'full' also waits for the replay to be fully written to disk before reporting that it has been saved.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -rwl  Limit the speed at which replays are saved, in MB per second. Use this if saving a replay slows down the application you are recording. Optional, set to 0 (no limit) by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -frag Write the output file in a way that keeps it playable if gpu screen recorder is killed or the computer crashes while recording. Should be either 'yes' or 'no'.\n");
+    fprintf(stderr, "        For mp4/mov this writes a fragmented mp4 (one fragment per keyframe) and for mkv a cluster is written every second.\n");
+    fprintf(stderr, "        Only applies when recording to a file (not replay or live streaming). Optional, set to 'no' by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -faststart\n");
+    fprintf(stderr, "        Convert the fragmented mp4/mov file to a regular mp4/mov file with the index at the start of the file after the recording has finished, which some video players/websites require.\n");
+    fprintf(stderr, "        This is done in a background process after gpu screen recorder exits. The -sc script is run after this has finished. Requires -frag yes. Should be either 'yes' or 'no'. Optional, set to 'no' by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -ql   The maximum time in milliseconds that encoded data can wait to be sent when live streaming. If the connection is too slow to keep up then video frames are dropped until the next keyframe,\n");
+    fprintf(stderr, "        to keep the delay of the live stream low. Audio is only dropped if the connection is far behind. Optional, set to 2000 by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -abr  Adapt the video bitrate of a live stream to the speed of the connection, up to the given bitrate in kbps. The bitrate is lowered as soon as data starts to queue up\n");
+    fprintf(stderr, "        and slowly raised again when the connection keeps up. If the bitrate can't be lowered any further then the framerate is lowered (down to 15 fps).\n");
+    fprintf(stderr, "        Only the framerate is changed on AMD/Intel since VAAPI doesn't support changing the bitrate while encoding. Can't be used with -bm cqp.\n");
+    fprintf(stderr, "        Optional, disabled by default (the video is encoded with a constant quality).\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -ctl  Create a control socket at the given path that can be used to control gpu screen recorder while it's running, see --control below.\n");
+    fprintf(stderr, "        Optional, disabled by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  --control <socket_path> <command> [value]\n");
+    fprintf(stderr, "        Send a command to a gpu screen recorder that was started with -ctl <socket_path>, print the result and exit. The command should be one of:\n");
+    fprintf(stderr, "        'save-replay [seconds] [end_offset_seconds]' (save the replay buffer and print the filepath once it has been saved. If seconds is set then only\n");
+    fprintf(stderr, "        the last seconds of the replay buffer are saved (starting at the keyframe before that), ending end_offset_seconds before the newest data), 'pause', 'resume', 'stats',\n");
+    fprintf(stderr, "        'keyframe' (make the next video frame a keyframe), 'bitrate <kbps>' (only with -bm vbr or cbr on NVIDIA) or 'fps <fps>' (only with -fm vfr and not higher than -f).\n");
+    fprintf(stderr, "\n");
     fprintf(stderr, "  --list-supported-video-codecs\n");
     fprintf(stderr, "        List supported video codecs and exits. Prints h264, hevc, hevc_hdr, av1 and av1_hdr (if supported).\n");
     fprintf(stderr, "\n");
@@ -869,16 +1238,20 @@ static void usage_full() {
     fprintf(stderr, "  -o    The output file path. If omitted then the encoded data is sent to stdout. Required in replay mode (when using -r).\n");
     fprintf(stderr, "        In replay mode this has to be a directory instead of a file.\n");
     fprintf(stderr, "        The directory to the file is created (recursively) if it doesn't already exist.\n");
+    fprintf(stderr, "        This can also be a live stream url (rtmp://, rtmps://, http://, https://, srt://, tcp:// or udp://). srt, tcp and udp require a container that can be streamed, such as -c mpegts.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "NOTES:\n");
     fprintf(stderr, "  Send signal SIGINT to gpu-screen-recorder (Ctrl+C, or killall -SIGINT gpu-screen-recorder) to stop and save the recording. When in replay mode this stops recording without saving.\n");
     fprintf(stderr, "  Send signal SIGUSR1 to gpu-screen-recorder (killall -SIGUSR1 gpu-screen-recorder) to save a replay (when in replay mode).\n");
     fprintf(stderr, "  Send signal SIGUSR2 to gpu-screen-recorder (killall -SIGUSR2 gpu-screen-recorder) to pause/unpause recording. Only applicable and useful when recording (not streaming nor replay).\n");
+    fprintf(stderr, "  The control socket (-ctl) can be used instead of signals to control a specific gpu-screen-recorder process, for example: gpu-screen-recorder --control \"$XDG_RUNTIME_DIR/gsr.sock\" save-replay\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "EXAMPLES:\n");
     fprintf(stderr, "  gpu-screen-recorder -w screen -f 60 -a \"$(pactl get-default-sink).monitor\" -o \"$HOME/Videos/video.mp4\"\n");
     fprintf(stderr, "  gpu-screen-recorder -w screen -f 60 -a \"$(pactl get-default-sink).monitor|$(pactl get-default-source)\" -o \"$HOME/Videos/video.mp4\"\n");
     fprintf(stderr, "  gpu-screen-recorder -w screen -f 60 -a \"$(pactl get-default-sink).monitor\" -c mkv -r 60 -o \"$HOME/Videos\"\n");
+    fprintf(stderr, "  gpu-screen-recorder -w screen -f 60 -a \"$(pactl get-default-sink).monitor\" -c mpegts -o \"srt://192.168.0.2:9000\"\n");
+    fprintf(stderr, "  gpu-screen-recorder -a \"$(pactl get-default-source)\" -o \"$HOME/Audio/voice.mka\"\n");
     //fprintf(stderr, "  gpu-screen-recorder -w screen -f 60 -q ultra -pixfmt yuv444 -o video.mp4\n");
     _exit(1);
 }
@@ -967,6 +1340,64 @@ static AVStream* create_stream(AVFormatContext *av_format_context, AVCodecContex
     return stream;
 }
 
+static std::vector<pid_t> recording_saved_script_pids;
+
+// posix_spawn (which is implemented with vfork-like semantics in glibc) is used instead of fork because fork has to copy the page tables
+// of this process, which is slow and causes copy-on-write page faults in the capture loop when the replay buffer is large.
+// The process is started in a new session so that it's not killed when the terminal gpu screen recorder was started from is closed.
+// POSIX_SPAWN_SETSID was added in glibc 2.26, older versions fork instead.
+static void spawn_process_async(const char **args) {
+#ifdef POSIX_SPAWN_SETSID
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSID);
+
+    sigset_t default_signals;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGINT);
+    sigaddset(&default_signals, SIGUSR1);
+    sigaddset(&default_signals, SIGUSR2);
+    sigaddset(&default_signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    posix_spawnattr_setsigmask(&attr, &signal_mask);
+
+    pid_t pid = -1;
+    const int ret = posix_spawnp(&pid, args[0], nullptr, &attr, (char* const*)args, environ);
+    posix_spawnattr_destroy(&attr);
+    if(ret != 0) {
+        fprintf(stderr, "Error: failed to run %s, error: %s\n", args[0], strerror(ret));
+        return;
+    }
+#else
+    const pid_t pid = fork();
+    if(pid == -1) {
+        perror(args[0]);
+        return;
+    } else if(pid == 0) { // child
+        setsid();
+        signal(SIGHUP, SIG_IGN);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGUSR1, SIG_DFL);
+        signal(SIGUSR2, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+
+        sigset_t signal_mask;
+        sigemptyset(&signal_mask);
+        sigprocmask(SIG_SETMASK, &signal_mask, nullptr);
+
+        execvp(args[0], (char* const*)args);
+        perror(args[0]);
+        _exit(127);
+    }
+#endif
+
+    // The process is reaped in reap_recording_saved_scripts
+    recording_saved_script_pids.push_back(pid);
+}
+
 static void run_recording_saved_script_async(const char *script_file, const char *video_file, const char *type) {
     const char *args[6];
     const bool inside_flatpak = getenv("FLATPAK_ID") != NULL;
@@ -985,24 +1416,110 @@ static void run_recording_saved_script_async(const char *script_file, const char
         args[3] = NULL;
     }
 
-    pid_t pid = fork();
-    if(pid == -1) {
-        perror(script_file);
-        return;
-    } else if(pid == 0) { // child
-        setsid();
-        signal(SIGHUP, SIG_IGN);
+    spawn_process_async(args);
+}
+
+// Remuxes the (fragmented) mp4 file |video_file| to a regular mp4 file with the index at the start in a separate process,
+// so that exiting doesn't have to wait for it. The recording saved script is run after that, if there is one
+static void run_faststart_remux_async(const char *video_file, const char *script_file) {
+    const char *args[5];
+    args[0] = "/proc/self/exe";
+    args[1] = "--faststart";
+    args[2] = video_file;
+    args[3] = script_file;
+    args[4] = NULL;
+    spawn_process_async(args);
+}
+
+// Implements --faststart <video_file> [script_file]. This is run in a separate process, see run_faststart_remux_async
+static void faststart_remux(int argc, char **argv) {
+    if(argc < 3 || argc > 4) {
+        fprintf(stderr, "Error: expected --faststart <video_file> [script_file]\n");
+        _exit(1);
+    }
+
+    const char *video_file = argv[2];
+    const char *script_file = argc == 4 ? argv[3] : nullptr;
+    const std::string tmp_file = std::string(video_file) + ".faststart.tmp";
+    bool success = false;
+
+    AVFormatContext *input_context = nullptr;
+    AVFormatContext *output_context = nullptr;
+    AVPacket *av_packet = av_packet_alloc();
+    AVDictionary *options = nullptr;
+    int ret = 0;
+
+    if(avformat_open_input(&input_context, video_file, nullptr, nullptr) < 0 || avformat_find_stream_info(input_context, nullptr) < 0) {
+        fprintf(stderr, "Error: faststart: failed to open %s\n", video_file);
+        goto done;
+    }
+
+    avformat_alloc_output_context2(&output_context, av_guess_format(nullptr, video_file, nullptr), nullptr, tmp_file.c_str());
+    if(!output_context || !av_packet) {
+        fprintf(stderr, "Error: faststart: failed to create output for %s\n", video_file);
+        goto done;
+    }
+
+    for(unsigned int i = 0; i < input_context->nb_streams; ++i) {
+        AVStream *stream = avformat_new_stream(output_context, nullptr);
+        if(!stream || avcodec_parameters_copy(stream->codecpar, input_context->streams[i]->codecpar) < 0)
+            goto done;
+        stream->codecpar->codec_tag = 0;
+        stream->time_base = input_context->streams[i]->time_base;
+    }
+
+    if(avio_open(&output_context->pb, tmp_file.c_str(), AVIO_FLAG_WRITE) < 0) {
+        fprintf(stderr, "Error: faststart: failed to open %s\n", tmp_file.c_str());
+        goto done;
+    }
+
+    av_dict_set(&options, "strict", "experimental", 0);
+    av_dict_set(&options, "movflags", "+faststart", 0);
+    if(avformat_write_header(output_context, &options) < 0)
+        goto done;
+
+    while((ret = av_read_frame(input_context, av_packet)) >= 0) {
+        av_packet_rescale_ts(av_packet, input_context->streams[av_packet->stream_index]->time_base, output_context->streams[av_packet->stream_index]->time_base);
+        ret = av_interleaved_write_frame(output_context, av_packet);
+        av_packet_unref(av_packet);
+        if(ret < 0)
+            break;
+    }
+
+    success = ret == AVERROR_EOF && av_write_trailer(output_context) == 0;
+
+    done:
+    if(output_context) {
+        if(output_context->pb)
+            avio_closep(&output_context->pb);
+        avformat_free_context(output_context);
+    }
+    avformat_close_input(&input_context);
+    av_packet_free(&av_packet);
+    av_dict_free(&options);
+
+    if(success && rename(tmp_file.c_str(), video_file) == 0) {
+        fprintf(stderr, "Info: faststart: moved the index to the start of %s\n", video_file);
+    } else {
+        // The fragmented file is still playable, leave it as it is
+        fprintf(stderr, "Error: faststart: failed to remux %s, the file is left as a fragmented mp4\n", video_file);
+        unlink(tmp_file.c_str());
+    }
+
+    if(script_file)
+        run_recording_saved_script_async(script_file, video_file, "regular");
+    _exit(success ? 0 : 1);
+}
 
-        pid_t second_child = fork();
-        if(second_child == 0) { // child
-            execvp(args[0], (char* const*)args);
-            perror(script_file);
-            _exit(127);
-        } else if(second_child != -1) { // parent
-            _exit(0);
+// Reaps the scripts that have finished without blocking
+static void reap_recording_saved_scripts() {
+    for(size_t i = 0; i < recording_saved_script_pids.size();) {
+        if(waitpid(recording_saved_script_pids[i], nullptr, WNOHANG) != 0) {
+            recording_saved_script_pids[i] = recording_saved_script_pids.back();
+            recording_saved_script_pids.pop_back();
+        } else {
+            ++i;
         }
-    } else { // parent
-        waitpid(pid, NULL, 0);
     }
 }
 
@@ -1010,7 +1527,9 @@ struct AudioDevice {
     SoundDevice sound_device;
     AudioInput audio_input;
     AVFilterContext *src_filter_ctx = nullptr;
-    AVFrame *frame = nullptr;
+    int64_t pts = 0;
+    gsr_frame_queue frame_queue;      // Frames to encode (or mix), from the audio device thread to the encoder thread
+    gsr_frame_queue free_frame_queue; // Encoded frames that can be reused, from the encoder thread to the audio device thread
     std::thread thread; // TODO: Instead of having a thread for each track, have one thread for all threads and read the data with non-blocking read
 };
 
@@ -1018,77 +1537,112 @@ struct AudioDevice {
 struct AudioTrack {
     AVCodecContext *codec_context = nullptr;
     AVStream *stream = nullptr;
+    AVFrame *silent_frame = nullptr; // Silence in the sample format of the encoder, copied into the gaps when an audio device doesn't deliver audio
 
     std::vector<AudioDevice> audio_devices;
     AVFilterGraph *graph = nullptr;
     AVFilterContext *sink = nullptr;
     int stream_index = 0;
     int64_t pts = 0;
+
+    // The audio is encoded in a separate thread so that encoding never delays reading the audio devices or capturing video.
+    // The filter graph (when mixing audio) is also only used by the encoder thread
+    std::thread encoder_thread;
+    sem_t encoder_sem; // Posted when a frame has been added to the frame queue of one of the audio devices
 };
 
-static std::future<void> save_replay_thread;
+static std::future<bool> save_replay_thread;
 static std::vector<std::shared_ptr<PacketData>> save_replay_packets;
 static std::string save_replay_output_filepath;
 
-static int create_directory_recursive(char *path) {
-    int path_len = strlen(path);
-    char *p = path;
-    char *end = path + path_len;
-    for(;;) {
-        char *slash_p = strchr(p, '/');
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+static int file_writer_avio_write(void *opaque, const uint8_t *buf, int buf_size) {
+#else
+static int file_writer_avio_write(void *opaque, uint8_t *buf, int buf_size) {
+#endif
+    gsr_file_writer *file_writer = (gsr_file_writer*)opaque;
+    return gsr_file_writer_write(file_writer, buf, buf_size) == 0 ? buf_size : AVERROR(EIO);
+}
 
-        // Skips first '/', we don't want to try and create the root directory
-        if(slash_p == path) {
-            ++p;
-            continue;
-        }
+static int64_t file_writer_avio_seek(void *opaque, int64_t offset, int whence) {
+    gsr_file_writer *file_writer = (gsr_file_writer*)opaque;
+    if(whence & AVSEEK_SIZE)
+        return gsr_file_writer_get_size(file_writer);
 
-        if(!slash_p)
-            slash_p = end;
+    const int64_t pos = gsr_file_writer_seek(file_writer, offset, whence & ~AVSEEK_FORCE);
+    return pos == -1 ? AVERROR(EINVAL) : pos;
+}
 
-        char prev_char = *slash_p;
-        *slash_p = '\0';
-        int err = mkdir(path, S_IRWXU);
-        *slash_p = prev_char;
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+static int pipe_writer_avio_write(void *opaque, const uint8_t *buf, int buf_size) {
+#else
+static int pipe_writer_avio_write(void *opaque, uint8_t *buf, int buf_size) {
+#endif
+    gsr_pipe_writer *pipe_writer = (gsr_pipe_writer*)opaque;
+    return gsr_pipe_writer_write(pipe_writer, buf, buf_size) == 0 ? buf_size : AVERROR(EPIPE);
+}
 
-        if(err == -1 && errno != EEXIST)
-            return err;
+static bool is_video_keyframe(const AVPacket &av_packet, int video_stream_index) {
+    return (av_packet.flags & AV_PKT_FLAG_KEY) && av_packet.stream_index == video_stream_index;
+}
 
-        if(slash_p == end)
-            break;
-        else
-            p = slash_p + 1;
+// Returns the index of the video keyframe at or before the first packet at |start_time| (or the first keyframe after it if there is none before it),
+// or (size_t)-1 if there is no keyframe before |end_index|
+static size_t find_replay_start_index(const std::deque<std::shared_ptr<PacketData>> &frame_data_queue, int video_stream_index, double start_time, size_t end_index) {
+    auto it = std::lower_bound(frame_data_queue.begin(), frame_data_queue.begin() + (ptrdiff_t)end_index, start_time, [](const std::shared_ptr<PacketData> &packet, double time) {
+        return packet->timestamp < time;
+    });
+
+    const size_t index = it - frame_data_queue.begin();
+    for(size_t i = std::min(index + 1, end_index); i > 0; --i) {
+        if(is_video_keyframe(frame_data_queue[i - 1]->data, video_stream_index))
+            return i - 1;
     }
-    return 0;
+
+    for(size_t i = index; i < end_index; ++i) {
+        if(is_video_keyframe(frame_data_queue[i]->data, video_stream_index))
+            return i;
+    }
+
+    return (size_t)-1;
 }
 
-static void save_replay_async(AVCodecContext *video_codec_context, int video_stream_index, std::vector<AudioTrack> &audio_tracks, std::deque<std::shared_ptr<PacketData>> &frame_data_queue, bool frames_erased, std::string output_dir, const char *container_format, const std::string &file_extension, std::mutex &write_output_mutex, bool make_folders) {
+// |duration_secs| is the number of seconds to save (0 to save the whole replay buffer) and the saved replay ends |end_offset_secs| seconds before the newest data.
+// The replay starts at the closest keyframe before the requested start, so the saved replay can be up to one gop longer than requested.
+static bool save_replay_async(AVCodecContext *video_codec_context, int video_stream_index, std::vector<AudioTrack> &audio_tracks, std::deque<std::shared_ptr<PacketData>> &frame_data_queue, bool frames_erased, std::string output_dir, const char *container_format, const std::string &file_extension, std::mutex &write_output_mutex, bool make_folders, double duration_secs, double end_offset_secs, gsr_file_writer_params file_writer_params) {
     if(save_replay_thread.valid())
-        return;
+        return false;
     
     size_t start_index = (size_t)-1;
+    size_t end_index = 0;
     int64_t video_pts_offset = 0;
     int64_t audio_pts_offset = 0;
 
     {
         std::lock_guard<std::mutex> lock(write_output_mutex);
-        start_index = (size_t)-1;
-        for(size_t i = 0; i < frame_data_queue.size(); ++i) {
-            const AVPacket &av_packet = frame_data_queue[i]->data;
-            if((av_packet.flags & AV_PKT_FLAG_KEY) && av_packet.stream_index == video_stream_index) {
-                start_index = i;
-                break;
-            }
-        }
+        if(frame_data_queue.empty())
+            return false;
+
+        const double newest_timestamp = frame_data_queue.back()->timestamp;
+        const double end_time = newest_timestamp - end_offset_secs;
+        end_index = std::upper_bound(frame_data_queue.begin(), frame_data_queue.end(), end_time, [](double time, const std::shared_ptr<PacketData> &packet) {
+            return time < packet->timestamp;
+        }) - frame_data_queue.begin();
+
+        const bool save_whole_buffer = duration_secs <= 0.0 && end_offset_secs <= 0.0;
+        if(save_whole_buffer)
+            start_index = find_replay_start_index(frame_data_queue, video_stream_index, 0.0, end_index);
+        else
+            start_index = find_replay_start_index(frame_data_queue, video_stream_index, duration_secs > 0.0 ? end_time - duration_secs : 0.0, end_index);
 
         if(start_index == (size_t)-1)
-            return;
+            return false;
 
-        if(frames_erased) {
+        if(frames_erased || !save_whole_buffer) {
             video_pts_offset = frame_data_queue[start_index]->data.pts;
             
             // Find the next audio packet to use as audio pts offset
-            for(size_t i = start_index; i < frame_data_queue.size(); ++i) {
+            for(size_t i = start_index; i < end_index; ++i) {
                 const AVPacket &av_packet = frame_data_queue[i]->data;
                 if(av_packet.stream_index != video_stream_index) {
                     audio_pts_offset = av_packet.pts;
@@ -1099,10 +1653,15 @@ static void save_replay_async(AVCodecContext *video_codec_context, int video_str
             start_index = 0;
         }
 
-        save_replay_packets.resize(frame_data_queue.size());
-        for(size_t i = 0; i < frame_data_queue.size(); ++i) {
-            save_replay_packets[i] = frame_data_queue[i];
+        // Only the packets that are saved are copied (shared), so saving a short replay is fast no matter how large the replay buffer is
+        save_replay_packets.resize(end_index - start_index);
+        int64_t packets_size = 0;
+        for(size_t i = start_index; i < end_index; ++i) {
+            save_replay_packets[i - start_index] = frame_data_queue[i];
+            packets_size += frame_data_queue[i]->data.size;
         }
+        // Some extra space for the container overhead
+        file_writer_params.preallocate_size = packets_size + packets_size / 100 + 1024 * 1024;
     }
 
     if (make_folders) {
@@ -1114,7 +1673,7 @@ static void save_replay_async(AVCodecContext *video_codec_context, int video_str
         save_replay_output_filepath = output_dir + "/Replay_" + get_date_str() + "." + file_extension;
     }
 
-    save_replay_thread = std::async(std::launch::async, [video_stream_index, container_format, start_index, video_pts_offset, audio_pts_offset, video_codec_context, &audio_tracks]() mutable {
+    save_replay_thread = std::async(std::launch::async, [video_stream_index, container_format, video_pts_offset, audio_pts_offset, video_codec_context, &audio_tracks, file_writer_params]() mutable {
         AVFormatContext *av_format_context;
         avformat_alloc_output_context2(&av_format_context, nullptr, container_format, nullptr);
 
@@ -1129,22 +1688,41 @@ static void save_replay_async(AVCodecContext *video_codec_context, int video_str
             audio_track.stream = audio_stream;
         }
 
-        int ret = avio_open(&av_format_context->pb, save_replay_output_filepath.c_str(), AVIO_FLAG_WRITE);
-        if (ret < 0) {
-            fprintf(stderr, "Error: Could not open '%s': %s. Make sure %s is an existing directory with write access\n", save_replay_output_filepath.c_str(), av_error_to_string(ret), save_replay_output_filepath.c_str());
-            return;
+        // The muxer output is buffered in large chunks and written by the file writer, which paces the writeback so that
+        // saving a large replay doesn't cause io stutter in the application that is being recorded
+        gsr_file_writer file_writer;
+        if(gsr_file_writer_open(&file_writer, save_replay_output_filepath.c_str(), &file_writer_params) != 0) {
+            fprintf(stderr, "Error: Could not open '%s'. Make sure %s is an existing directory with write access\n", save_replay_output_filepath.c_str(), save_replay_output_filepath.c_str());
+            avformat_free_context(av_format_context);
+            return false;
+        }
+
+        const int avio_buffer_size = 4 * 1024 * 1024;
+        uint8_t *avio_buffer = (uint8_t*)av_malloc(avio_buffer_size);
+        av_format_context->pb = avio_buffer ? avio_alloc_context(avio_buffer, avio_buffer_size, 1, &file_writer, nullptr, file_writer_avio_write, file_writer_avio_seek) : nullptr;
+        if(!av_format_context->pb) {
+            fprintf(stderr, "Error: Failed to create io context for '%s'\n", save_replay_output_filepath.c_str());
+            av_free(avio_buffer);
+            gsr_file_writer_close(&file_writer);
+            avformat_free_context(av_format_context);
+            return false;
         }
 
         AVDictionary *options = nullptr;
         av_dict_set(&options, "strict", "experimental", 0);
 
-        ret = avformat_write_header(av_format_context, &options);
+        int ret = avformat_write_header(av_format_context, &options);
         if (ret < 0) {
             fprintf(stderr, "Error occurred when writing header to output file: %s\n", av_error_to_string(ret));
-            return;
+            av_freep(&av_format_context->pb->buffer);
+            avio_context_free(&av_format_context->pb);
+            gsr_file_writer_close(&file_writer);
+            avformat_free_context(av_format_context);
+            av_dict_free(&options);
+            return false;
         }
 
-        for(size_t i = start_index; i < save_replay_packets.size(); ++i) {
+        for(size_t i = 0; i < save_replay_packets.size(); ++i) {
             // TODO: Check if successful
             AVPacket av_packet;
             memset(&av_packet, 0, sizeof(av_packet));
@@ -1181,17 +1759,29 @@ static void save_replay_async(AVCodecContext *video_codec_context, int video_str
             //av_packet_free(&av_packet);
         }
 
-        if (av_write_trailer(av_format_context) != 0)
+        bool saved = true;
+        if (av_write_trailer(av_format_context) != 0) {
             fprintf(stderr, "Failed to write trailer\n");
+            saved = false;
+        }
+
+        avio_flush(av_format_context->pb);
+        if(av_format_context->pb->error < 0)
+            saved = false;
+        av_freep(&av_format_context->pb->buffer);
+        avio_context_free(&av_format_context->pb);
+        if(gsr_file_writer_close(&file_writer) != 0)
+            saved = false;
 
-        avio_close(av_format_context->pb);
         avformat_free_context(av_format_context);
         av_dict_free(&options);
 
         for(AudioTrack &audio_track : audio_tracks) {
             audio_track.stream = nullptr;
         }
+        return saved;
     });
+    return true;
 }
 
 static void split_string(const std::string &str, char delimiter, std::function<bool(const char*,size_t)> callback) {
@@ -1231,6 +1821,8 @@ static bool is_livestream_path(const char *str) {
         return true;
     else if((len >= 7 && memcmp(str, "rtmp://", 7) == 0) || (len >= 8 && memcmp(str, "rtmps://", 8) == 0))
         return true;
+    else if((len >= 6 && memcmp(str, "srt://", 6) == 0) || (len >= 6 && memcmp(str, "tcp://", 6) == 0) || (len >= 6 && memcmp(str, "udp://", 6) == 0))
+        return true;
     else
         return false;
 }
@@ -1407,7 +1999,7 @@ static void list_supported_video_codecs() {
     fflush(stdout);
 }
 
-static gsr_capture* create_capture_impl(const char *window_str, const char *screen_region, bool wayland, gsr_gpu_info gpu_inf, gsr_egl &egl, int fps, bool overclock, VideoCodec video_codec, gsr_color_range color_range) {
+static gsr_capture* create_capture_impl(const char *window_str, const char *screen_region, bool wayland, gsr_gpu_info gpu_inf, gsr_egl &egl, int fps, bool overclock, VideoCodec video_codec, VideoEncoder video_encoder, gsr_color_range color_range) {
     vec2i region_size = { 0, 0 };
     Window src_window_id = None;
     bool follow_focused = false;
@@ -1435,6 +2027,93 @@ static gsr_capture* create_capture_impl(const char *window_str, const char *scre
         }
 
         follow_focused = true;
+    } else if(strcmp(window_str, "screencopy") == 0 || strncmp(window_str, "screencopy:", 11) == 0) {
+        if(!wayland || !egl.wayland.dpy) {
+            fprintf(stderr, "Error: screencopy capture only works on wayland\n");
+            _exit(2);
+        }
+
+        if(video_encoder == VideoEncoder::GPU && gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA) {
+            fprintf(stderr, "Error: screencopy capture is currently only supported on AMD and Intel, or with -encoder cpu\n");
+            _exit(2);
+        }
+
+        const char *display_to_capture = strcmp(window_str, "screencopy") == 0 ? "screen" : window_str + 11;
+        if(strcmp(display_to_capture, "screen") != 0) {
+            bool output_found = false;
+            for(int i = 0; i < egl.wayland.num_outputs; ++i) {
+                if(egl.wayland.outputs[i].name && strcmp(egl.wayland.outputs[i].name, display_to_capture) == 0)
+                    output_found = true;
+            }
+
+            if(!output_found) {
+                fprintf(stderr, "gsr error: display \"%s\" not found, expected one of:\n", display_to_capture);
+                for(int i = 0; i < egl.wayland.num_outputs; ++i) {
+                    if(egl.wayland.outputs[i].name)
+                        fprintf(stderr, "    \"screencopy:%s\"    (%dx%d+%d+%d)\n", egl.wayland.outputs[i].name, egl.wayland.outputs[i].size.x, egl.wayland.outputs[i].size.y, egl.wayland.outputs[i].pos.x, egl.wayland.outputs[i].pos.y);
+                }
+                _exit(1);
+            }
+        }
+
+        gsr_capture_screencopy_params screencopy_params;
+        screencopy_params.egl = &egl;
+        screencopy_params.display_to_capture = display_to_capture;
+        screencopy_params.hdr = video_codec_is_hdr(video_codec);
+        screencopy_params.color_range = color_range;
+        screencopy_params.software_encoding = video_encoder == VideoEncoder::CPU;
+        capture = gsr_capture_screencopy_create(&screencopy_params);
+        if(!capture)
+            _exit(1);
+    } else if(strcmp(window_str, "xshm") == 0 || strncmp(window_str, "xshm:", 5) == 0) {
+        if(wayland || !egl.x11.dpy) {
+            fprintf(stderr, "Error: xshm capture only works in a pure X11 session. Xwayland is not supported\n");
+            _exit(2);
+        }
+
+        if(video_encoder == VideoEncoder::GPU && gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA) {
+            fprintf(stderr, "Error: xshm capture is currently only supported on AMD and Intel, or with -encoder cpu\n");
+            _exit(2);
+        }
+
+        gsr_capture_xshm_params xshm_params;
+        xshm_params.egl = &egl;
+        xshm_params.pos = { 0, 0 };
+        xshm_params.size = { 0, 0 };
+        xshm_params.hdr = video_codec_is_hdr(video_codec);
+        xshm_params.color_range = color_range;
+        xshm_params.software_encoding = video_encoder == VideoEncoder::CPU;
+
+        if(strcmp(window_str, "xshm") != 0) {
+            const char *monitor_name = window_str + 5;
+            gsr_monitor gmon;
+            if(!get_monitor_by_name(&egl, GSR_CONNECTION_X11, monitor_name, &gmon)) {
+                fprintf(stderr, "gsr error: display \"%s\" not found, expected one of:\n", monitor_name);
+                for_each_active_monitor_output(&egl, GSR_CONNECTION_X11, monitor_output_callback_print, NULL);
+                _exit(1);
+            }
+            xshm_params.pos = gmon.pos;
+            xshm_params.size = gmon.size;
+        }
+
+        capture = gsr_capture_xshm_create(&xshm_params);
+        if(!capture)
+            _exit(1);
+    } else if(strcmp(window_str, "portal") == 0 || strncmp(window_str, "pipewire:", 9) == 0) {
+        if(gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA) {
+            fprintf(stderr, "Error: desktop portal/pipewire capture is currently only supported on AMD and Intel\n");
+            _exit(2);
+        }
+
+        gsr_capture_portal_params portal_params;
+        portal_params.egl = &egl;
+        portal_params.pipewire_target = strcmp(window_str, "portal") == 0 ? nullptr : window_str + 9;
+        portal_params.fps = fps;
+        portal_params.hdr = video_codec_is_hdr(video_codec);
+        portal_params.color_range = color_range;
+        capture = gsr_capture_portal_create(&portal_params);
+        if(!capture)
+            _exit(1);
     } else if(contains_non_hex_number(window_str)) {
         if(wayland || gpu_inf.vendor != GSR_GPU_VENDOR_NVIDIA) {
             if(strcmp(window_str, "screen") == 0) {
@@ -1569,24 +2248,113 @@ static gsr_capture* create_capture_impl(const char *window_str, const char *scre
     return capture;
 }
 
-struct Arg {
-    std::vector<const char*> values;
-    bool optional = false;
-    bool list = false;
-
-    const char* value() const {
-        if(values.empty())
-            return nullptr;
-        return values.front();
-    }
+struct ControlCommand {
+    const char *name;
+    gsr_control_request_type type;
+    int min_values;
+    int max_values; // The first value is set as |value| and the second as |offset|
 };
 
-int main(int argc, char **argv) {
-    signal(SIGINT, stop_handler);
-    signal(SIGUSR1, save_replay_handler);
-    signal(SIGUSR2, toggle_pause_handler);
+static const ControlCommand control_commands[] = {
+    { "save-replay", GSR_CONTROL_REQUEST_SAVE_REPLAY,    0, 2 },
+    { "pause",       GSR_CONTROL_REQUEST_PAUSE,          0, 0 },
+    { "resume",      GSR_CONTROL_REQUEST_RESUME,         0, 0 },
+    { "stats",       GSR_CONTROL_REQUEST_GET_STATS,      0, 0 },
+    { "keyframe",    GSR_CONTROL_REQUEST_FORCE_KEYFRAME, 0, 0 },
+    { "bitrate",     GSR_CONTROL_REQUEST_SET_BITRATE,    1, 1 },
+    { "fps",         GSR_CONTROL_REQUEST_SET_FPS,        1, 1 },
+};
 
-    // Stop nvidia driver from buffering frames
+// Values are non-negative integers (seconds, kbps or a framerate). Exits on invalid input
+static int64_t parse_control_value(const ControlCommand *control_command, const char *str) {
+    errno = 0;
+    char *end = nullptr;
+    const long long value = strtoll(str, &end, 10);
+    if(end == str || *end != '\0' || errno == ERANGE || value < 0 || value > INT_MAX) {
+        fprintf(stderr, "Error: control command '%s' expects integer values between 0 and %d, got '%s'\n", control_command->name, INT_MAX, str);
+        usage();
+    }
+    return value;
+}
+
+static void send_control_command(int argc, char **argv) {
+    if(argc < 4) {
+        fprintf(stderr, "Error: expected --control <socket_path> <command> [value]\n");
+        usage();
+    }
+
+    const ControlCommand *control_command = nullptr;
+    for(const ControlCommand &command : control_commands) {
+        if(strcmp(argv[3], command.name) == 0) {
+            control_command = &command;
+            break;
+        }
+    }
+
+    if(!control_command) {
+        fprintf(stderr, "Error: invalid control command '%s'\n", argv[3]);
+        usage();
+    }
+
+    const int num_values = argc - 4;
+    if(num_values < control_command->min_values || num_values > control_command->max_values) {
+        fprintf(stderr, "Error: control command '%s' expects between %d and %d values, got %d\n", control_command->name, control_command->min_values, control_command->max_values, num_values);
+        usage();
+    }
+
+    gsr_control_request request;
+    memset(&request, 0, sizeof(request));
+    request.version = GSR_CONTROL_PROTOCOL_VERSION;
+    request.id = getpid();
+    request.type = control_command->type;
+    request.value = num_values >= 1 ? parse_control_value(control_command, argv[4]) : 0;
+    request.offset = num_values >= 2 ? parse_control_value(control_command, argv[5]) : 0;
+
+    gsr_control_response response;
+    if(gsr_control_socket_send_request(argv[2], &request, &response) != 0)
+        _exit(1);
+
+    if(response.result != GSR_CONTROL_RESULT_OK) {
+        fprintf(stderr, "Error: %s failed: %s\n", control_command->name, response.message);
+        _exit(1);
+    }
+
+    if(response.type == GSR_CONTROL_REQUEST_GET_STATS) {
+        const gsr_control_stats &stats = response.stats;
+        printf("recording_duration_seconds: %.3f\n", stats.recording_duration_seconds);
+        printf("replay_buffer_duration_seconds: %.3f\n", stats.replay_buffer_duration_seconds);
+        printf("replay_buffer_size_bytes: %" PRIu64 "\n", stats.replay_buffer_size_bytes);
+        printf("num_video_frames: %" PRIu64 "\n", stats.num_video_frames);
+        printf("fps: %u\n", stats.fps);
+        printf("capture_to_packet_latency_ms: %.2f\n", stats.capture_to_packet_latency_seconds * 1000.0);
+        printf("packet_to_socket_latency_ms: %.2f\n", stats.packet_to_socket_latency_seconds * 1000.0);
+        printf("capture_to_socket_latency_ms: %.2f\n", stats.capture_to_socket_latency_seconds * 1000.0);
+        printf("paused: %s\n", stats.paused ? "yes" : "no");
+        printf("saving_replay: %s\n", stats.saving_replay ? "yes" : "no");
+    } else if(response.message[0] != '\0') {
+        puts(response.message);
+    }
+    _exit(0);
+}
+
+struct Arg {
+    std::vector<const char*> values;
+    bool optional = false;
+    bool list = false;
+
+    const char* value() const {
+        if(values.empty())
+            return nullptr;
+        return values.front();
+    }
+};
+
+int main(int argc, char **argv) {
+    signal(SIGINT, stop_handler);
+    signal(SIGUSR1, save_replay_handler);
+    signal(SIGUSR2, toggle_pause_handler);
+
+    // Stop nvidia driver from buffering frames
     setenv("__GL_MaxFramesAllowed", "1", true);
     // Some people set this to nvidia (for nvdec) or vdpau (for nvidia vdpau), which breaks gpu screen recorder since
     // nvidia doesn't support vaapi and nvidia-vaapi-driver doesn't support encoding yet.
@@ -1604,12 +2372,18 @@ int main(int argc, char **argv) {
         _exit(0);
     }
 
+    if(strcmp(argv[1], "--control") == 0)
+        send_control_command(argc, argv);
+
+    if(strcmp(argv[1], "--faststart") == 0)
+        faststart_remux(argc, argv);
+
     //av_log_set_level(AV_LOG_TRACE);
 
     std::map<std::string, Arg> args = {
-        { "-w", Arg { {}, false, false } },
+        { "-w", Arg { {}, true, false } },
         { "-c", Arg { {}, true, false } },
-        { "-f", Arg { {}, false, false } },
+        { "-f", Arg { {}, true, false } },
         { "-s", Arg { {}, true, false } },
         { "-a", Arg { {}, true, true } },
         { "-q", Arg { {}, true, false } },
@@ -1624,6 +2398,24 @@ int main(int argc, char **argv) {
         { "-mf", Arg { {}, true, false } },
         { "-sc", Arg { {}, true, false } },
         { "-cr", Arg { {}, true, false } },
+        { "-ctl", Arg { {}, true, false } },
+        { "-rws", Arg { {}, true, false } },
+        { "-rwl", Arg { {}, true, false } },
+        { "-frag", Arg { {}, true, false } },
+        { "-faststart", Arg { {}, true, false } },
+        { "-ql", Arg { {}, true, false } },
+        { "-abr", Arg { {}, true, false } },
+        { "-bm", Arg { {}, true, false } },
+        { "-b", Arg { {}, true, false } },
+        { "-bmax", Arg { {}, true, false } },
+        { "-bbuf", Arg { {}, true, false } },
+        { "-keyint", Arg { {}, true, false } },
+        { "-ir", Arg { {}, true, false } },
+        { "-latency", Arg { {}, true, false } },
+        { "-roi", Arg { {}, true, false } },
+        { "-dtx", Arg { {}, true, false } },
+        { "-asrv", Arg { {}, true, false } },
+        { "-encoder", Arg { {}, true, false } },
     };
 
     for(int i = 1; i < argc; i += 2) {
@@ -1653,6 +2445,18 @@ int main(int argc, char **argv) {
         }
     }
 
+    // Without -w only audio is recorded
+    const bool audio_only = !args["-w"].value();
+    if(audio_only && args["-a"].values.empty()) {
+        fprintf(stderr, "Missing argument '-w'\n");
+        usage();
+    }
+
+    if(!audio_only && !args["-f"].value()) {
+        fprintf(stderr, "Missing argument '-f'\n");
+        usage();
+    }
+
     VideoCodec video_codec = VideoCodec::HEVC;
     const char *video_codec_to_use = args["-k"].value();
     if(!video_codec_to_use)
@@ -1689,6 +2493,20 @@ int main(int argc, char **argv) {
         usage();
     }
 
+    bool dtx = false;
+    const char *dtx_str = args["-dtx"].value();
+    if(!dtx_str)
+        dtx_str = "no";
+
+    if(strcmp(dtx_str, "yes") == 0) {
+        dtx = true;
+    } else if(strcmp(dtx_str, "no") == 0) {
+        dtx = false;
+    } else {
+        fprintf(stderr, "Error: -dtx should either be either 'yes' or 'no', got: '%s'\n", dtx_str);
+        usage();
+    }
+
     bool overclock = false;
     const char *overclock_str = args["-oc"].value();
     if(!overclock_str)
@@ -1731,6 +2549,76 @@ int main(int argc, char **argv) {
         usage();
     }
 
+    gsr_file_writer_params file_writer_params;
+    memset(&file_writer_params, 0, sizeof(file_writer_params));
+    file_writer_params.low_io_priority = true;
+
+    const char *replay_write_sync_str = args["-rws"].value();
+    if(!replay_write_sync_str)
+        replay_write_sync_str = "writeback";
+
+    if(strcmp(replay_write_sync_str, "none") == 0) {
+        file_writer_params.sync = GSR_FILE_WRITER_SYNC_NONE;
+    } else if(strcmp(replay_write_sync_str, "writeback") == 0) {
+        file_writer_params.sync = GSR_FILE_WRITER_SYNC_WRITEBACK;
+    } else if(strcmp(replay_write_sync_str, "full") == 0) {
+        file_writer_params.sync = GSR_FILE_WRITER_SYNC_FULL;
+    } else {
+        fprintf(stderr, "Error: -rws should either be either 'none', 'writeback' or 'full', got: '%s'\n", replay_write_sync_str);
+        usage();
+    }
+
+    const char *replay_write_limit_str = args["-rwl"].value();
+    if(replay_write_limit_str) {
+        const int replay_write_limit_mb = atoi(replay_write_limit_str);
+        if(replay_write_limit_mb < 0) {
+            fprintf(stderr, "Error: -rwl is expected to be 0 or larger, got: '%s'\n", replay_write_limit_str);
+            usage();
+        }
+        file_writer_params.rate_limit_bytes_per_sec = (int64_t)replay_write_limit_mb * 1024LL * 1024LL;
+    }
+
+    bool fragmented_output = false;
+    const char *fragmented_output_str = args["-frag"].value();
+    if(!fragmented_output_str)
+        fragmented_output_str = "no";
+
+    if(strcmp(fragmented_output_str, "yes") == 0) {
+        fragmented_output = true;
+    } else if(strcmp(fragmented_output_str, "no") == 0) {
+        fragmented_output = false;
+    } else {
+        fprintf(stderr, "Error: -frag should either be either 'yes' or 'no', got: '%s'\n", fragmented_output_str);
+        usage();
+    }
+
+    bool faststart = false;
+    const char *faststart_str = args["-faststart"].value();
+    if(!faststart_str)
+        faststart_str = "no";
+
+    if(strcmp(faststart_str, "yes") == 0) {
+        faststart = true;
+    } else if(strcmp(faststart_str, "no") == 0) {
+        faststart = false;
+    } else {
+        fprintf(stderr, "Error: -faststart should either be either 'yes' or 'no', got: '%s'\n", faststart_str);
+        usage();
+    }
+
+    double max_stream_queue_latency_seconds = 2.0;
+    const char *max_stream_queue_latency_str = args["-ql"].value();
+    if(max_stream_queue_latency_str) {
+        const int max_stream_queue_latency_ms = atoi(max_stream_queue_latency_str);
+        if(max_stream_queue_latency_ms < 100) {
+            fprintf(stderr, "Error: -ql is expected to be 100 or larger, got: '%s'\n", max_stream_queue_latency_str);
+            usage();
+        }
+        max_stream_queue_latency_seconds = max_stream_queue_latency_ms / 1000.0;
+    }
+
+    const char *control_socket_path = args["-ctl"].value();
+
     const char *recording_saved_script = args["-sc"].value();
     if(recording_saved_script) {
         struct stat buf;
@@ -1754,10 +2642,29 @@ int main(int argc, char **argv) {
         usage();
     }
 
+    SoundBackend sound_backend = SOUND_BACKEND_PULSEAUDIO;
+    const char *sound_backend_str = args["-asrv"].value();
+    if(!sound_backend_str)
+        sound_backend_str = "pulseaudio";
+
+    if(strcmp(sound_backend_str, "pulseaudio") == 0) {
+        sound_backend = SOUND_BACKEND_PULSEAUDIO;
+    } else if(strcmp(sound_backend_str, "pipewire") == 0) {
+        sound_backend = SOUND_BACKEND_PIPEWIRE;
+    } else {
+        fprintf(stderr, "Error: -asrv should either be either 'pulseaudio' or 'pipewire', got: '%s'\n", sound_backend_str);
+        usage();
+    }
+
     const Arg &audio_input_arg = args["-a"];
     std::vector<AudioInput> audio_inputs;
-    if(!audio_input_arg.values.empty())
-        audio_inputs = get_pulseaudio_inputs();
+    if(!audio_input_arg.values.empty()) {
+        if(!sound_backend_init(sound_backend)) {
+            fprintf(stderr, "Error: failed to initialize the %s sound backend\n", sound_backend_str);
+            _exit(1);
+        }
+        audio_inputs = sound_backend == SOUND_BACKEND_PIPEWIRE ? get_pipewire_inputs() : get_pulseaudio_inputs();
+    }
     std::vector<MergedAudioInputs> requested_audio_inputs;
     bool uses_amix = false;
 
@@ -1798,13 +2705,17 @@ int main(int argc, char **argv) {
     if(container_format && strcmp(container_format, "mkv") == 0)
         container_format = "matroska";
 
-    int fps = atoi(args["-f"].value());
-    if(fps == 0) {
-        fprintf(stderr, "Invalid fps argument: %s\n", args["-f"].value());
-        _exit(1);
+    // Only used as the framerate metadata of the audio streams when recording audio only
+    int fps = 60;
+    if(!audio_only) {
+        fps = atoi(args["-f"].value());
+        if(fps == 0) {
+            fprintf(stderr, "Invalid fps argument: %s\n", args["-f"].value());
+            _exit(1);
+        }
+        if(fps < 1)
+            fps = 1;
     }
-    if(fps < 1)
-        fps = 1;
 
     const char *quality_str = args["-q"].value();
     if(!quality_str)
@@ -1824,6 +2735,161 @@ int main(int argc, char **argv) {
         usage();
     }
 
+    VideoBitrate video_bitrate;
+    const char *bitrate_mode_str = args["-bm"].value();
+    if(!bitrate_mode_str)
+        bitrate_mode_str = args["-abr"].value() ? "vbr" : "cqp";
+
+    if(strcmp(bitrate_mode_str, "cqp") == 0) {
+        video_bitrate.mode = BitrateMode::CQP;
+    } else if(strcmp(bitrate_mode_str, "vbr") == 0) {
+        video_bitrate.mode = BitrateMode::VBR;
+    } else if(strcmp(bitrate_mode_str, "cbr") == 0) {
+        video_bitrate.mode = BitrateMode::CBR;
+    } else {
+        fprintf(stderr, "Error: -bm should either be either 'cqp', 'vbr' or 'cbr', got: '%s'\n", bitrate_mode_str);
+        usage();
+    }
+
+    const char *bitrate_str = args["-b"].value();
+    if(bitrate_str) {
+        const int bitrate_kbps = atoi(bitrate_str);
+        if(bitrate_kbps < 100) {
+            fprintf(stderr, "Error: -b is expected to be 100 or larger, got: '%s'\n", bitrate_str);
+            usage();
+        }
+        video_bitrate.bitrate = (int64_t)bitrate_kbps * 1000LL;
+    }
+
+    video_bitrate.max_bitrate = video_bitrate.bitrate;
+    const char *max_bitrate_str = args["-bmax"].value();
+    if(max_bitrate_str) {
+        const int max_bitrate_kbps = atoi(max_bitrate_str);
+        if((int64_t)max_bitrate_kbps * 1000LL < video_bitrate.bitrate) {
+            fprintf(stderr, "Error: -bmax is expected to be higher than -b, got: '%s'\n", max_bitrate_str);
+            usage();
+        }
+        video_bitrate.max_bitrate = (int64_t)max_bitrate_kbps * 1000LL;
+    }
+
+    const char *bitrate_buffer_str = args["-bbuf"].value();
+    if(bitrate_buffer_str) {
+        video_bitrate.buffer_size_ms = atoi(bitrate_buffer_str);
+        if(video_bitrate.buffer_size_ms < 50 || video_bitrate.buffer_size_ms > 10000) {
+            fprintf(stderr, "Error: -bbuf is expected to be between 50 and 10000, got: '%s'\n", bitrate_buffer_str);
+            usage();
+        }
+    }
+
+    if(video_bitrate.mode == BitrateMode::CQP && (bitrate_str || max_bitrate_str || bitrate_buffer_str)) {
+        fprintf(stderr, "Warning: -b, -bmax and -bbuf are only used with -bm vbr or -bm cbr, ignoring them\n");
+    } else if(video_bitrate.mode == BitrateMode::CBR && max_bitrate_str) {
+        fprintf(stderr, "Warning: -bmax is only used with -bm vbr, ignoring it\n");
+        video_bitrate.max_bitrate = video_bitrate.bitrate;
+    }
+
+    int64_t adaptive_bitrate_max = 0;
+    const char *adaptive_bitrate_str = args["-abr"].value();
+    if(adaptive_bitrate_str) {
+        const int adaptive_bitrate_max_kbps = atoi(adaptive_bitrate_str);
+        if(adaptive_bitrate_max_kbps < 500) {
+            fprintf(stderr, "Error: -abr is expected to be 500 or larger, got: '%s'\n", adaptive_bitrate_str);
+            usage();
+        }
+        adaptive_bitrate_max = (int64_t)adaptive_bitrate_max_kbps * 1000LL;
+
+        if(video_bitrate.mode == BitrateMode::CQP) {
+            fprintf(stderr, "Error: -abr can't be used with -bm cqp\n");
+            usage();
+        }
+
+        // The adaptive bitrate changes the target bitrate, the max bitrate is scaled with it
+        if(video_bitrate.bitrate > 0)
+            video_bitrate.max_bitrate = (int64_t)((double)adaptive_bitrate_max * ((double)video_bitrate.max_bitrate / (double)video_bitrate.bitrate));
+        else
+            video_bitrate.max_bitrate = adaptive_bitrate_max;
+        video_bitrate.bitrate = adaptive_bitrate_max;
+    }
+
+    if(video_bitrate.mode != BitrateMode::CQP && video_bitrate.bitrate == 0) {
+        fprintf(stderr, "Error: -b is required when using -bm %s\n", bitrate_mode_str);
+        usage();
+    }
+
+    double keyframe_interval_secs = 2.0;
+    const char *keyframe_interval_str = args["-keyint"].value();
+    if(keyframe_interval_str) {
+        keyframe_interval_secs = atof(keyframe_interval_str);
+        if(keyframe_interval_secs < 0.1 || keyframe_interval_secs > 60.0) {
+            fprintf(stderr, "Error: -keyint is expected to be between 0.1 and 60, got: '%s'\n", keyframe_interval_str);
+            usage();
+        }
+    }
+
+    bool intra_refresh = false;
+    const char *intra_refresh_str = args["-ir"].value();
+    if(!intra_refresh_str)
+        intra_refresh_str = "no";
+
+    if(strcmp(intra_refresh_str, "yes") == 0) {
+        intra_refresh = true;
+    } else if(strcmp(intra_refresh_str, "no") == 0) {
+        intra_refresh = false;
+    } else {
+        fprintf(stderr, "Error: -ir should either be either 'yes' or 'no', got: '%s'\n", intra_refresh_str);
+        usage();
+    }
+
+    bool low_latency = false;
+    const char *latency_str = args["-latency"].value();
+    if(!latency_str)
+        latency_str = "normal";
+
+    if(strcmp(latency_str, "low") == 0) {
+        low_latency = true;
+    } else if(strcmp(latency_str, "normal") == 0) {
+        low_latency = false;
+    } else {
+        fprintf(stderr, "Error: -latency should either be either 'normal' or 'low', got: '%s'\n", latency_str);
+        usage();
+    }
+
+    VideoEncoder video_encoder = VideoEncoder::GPU;
+    const char *encoder_str = args["-encoder"].value();
+    if(!encoder_str)
+        encoder_str = "gpu";
+
+    if(strcmp(encoder_str, "gpu") == 0) {
+        video_encoder = VideoEncoder::GPU;
+    } else if(strcmp(encoder_str, "cpu") == 0) {
+        video_encoder = VideoEncoder::CPU;
+    } else {
+        fprintf(stderr, "Error: -encoder should either be either 'gpu' or 'cpu', got: '%s'\n", encoder_str);
+        usage();
+    }
+
+    const bool window_is_xshm = !audio_only && (strcmp(args["-w"].value(), "xshm") == 0 || strncmp(args["-w"].value(), "xshm:", 5) == 0);
+    const bool window_is_screencopy = !audio_only && (strcmp(args["-w"].value(), "screencopy") == 0 || strncmp(args["-w"].value(), "screencopy:", 11) == 0);
+    if(video_encoder == VideoEncoder::CPU && !audio_only && !window_is_xshm && !window_is_screencopy) {
+        fprintf(stderr, "Error: -encoder cpu is only supported with -w xshm and -w screencopy\n");
+        usage();
+    }
+
+    RegionOfInterest region_of_interest;
+    const char *roi_str = args["-roi"].value();
+    if(roi_str) {
+        if(strcmp(roi_str, "cursor") == 0) {
+            region_of_interest.mode = RoiMode::CURSOR;
+        } else if(sscanf(roi_str, "%dx%d+%d+%d", &region_of_interest.size.x, &region_of_interest.size.y, &region_of_interest.pos.x, &region_of_interest.pos.y) == 4
+            && region_of_interest.size.x > 0 && region_of_interest.size.y > 0 && region_of_interest.pos.x >= 0 && region_of_interest.pos.y >= 0)
+        {
+            region_of_interest.mode = RoiMode::REGION;
+        } else {
+            fprintf(stderr, "Error: -roi should either be either 'cursor' or a region in the format WxH+X+Y, got: '%s'\n", roi_str);
+            usage();
+        }
+    }
+
     int replay_buffer_size_secs = -1;
     const char *replay_buffer_size_secs_str = args["-r"].value();
     if(replay_buffer_size_secs_str) {
@@ -1835,49 +2901,69 @@ int main(int argc, char **argv) {
         replay_buffer_size_secs += 3; // Add a few seconds to account of lost packets because of non-keyframe packets skipped
     }
 
-    bool wayland = false;
-    Display *dpy = XOpenDisplay(nullptr);
-    if (!dpy) {
-        wayland = true;
-        fprintf(stderr, "Warning: failed to connect to the X server. Assuming wayland is running without Xwayland\n");
+    if(audio_only && replay_buffer_size_secs != -1) {
+        fprintf(stderr, "Error: option -r is not supported when only recording audio (without -w)\n");
+        usage();
     }
 
-    XSetErrorHandler(x11_error_handler);
-    XSetIOErrorHandler(x11_io_error_handler);
-
-    if(!wayland)
-        wayland = is_xwayland(dpy);
-
+    bool wayland = false;
+    Display *dpy = nullptr;
     gsr_egl egl;
-    if(!gsr_egl_load(&egl, dpy, wayland)) {
-        fprintf(stderr, "gsr error: failed to load opengl\n");
-        _exit(1);
-    }
-
+    memset(&egl, 0, sizeof(egl));
     gsr_gpu_info gpu_inf;
+    memset(&gpu_inf, 0, sizeof(gpu_inf));
     bool very_old_gpu = false;
-    if(!gl_get_gpu_info(&egl, &gpu_inf))
-        _exit(2);
+    // The display server and gpu are only needed to record video. Skipping them makes audio only recording start instantly and work on headless machines
+    if(!audio_only) {
+        dpy = XOpenDisplay(nullptr);
+        if (!dpy) {
+            wayland = true;
+            fprintf(stderr, "Warning: failed to connect to the X server. Assuming wayland is running without Xwayland\n");
+        }
 
-    if(gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA && gpu_inf.gpu_version != 0 && gpu_inf.gpu_version < 900) {
-        fprintf(stderr, "Info: your gpu appears to be very old (older than maxwell architecture). Switching to lower preset\n");
-        very_old_gpu = true;
-    }
+        XSetErrorHandler(x11_error_handler);
+        XSetIOErrorHandler(x11_io_error_handler);
 
-    if(gpu_inf.vendor != GSR_GPU_VENDOR_NVIDIA && overclock) {
-        fprintf(stderr, "Info: overclock option has no effect on amd/intel, ignoring option\n");
+        if(!wayland)
+            wayland = is_xwayland(dpy);
     }
 
-    if(gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA && overclock && wayland) {
-        fprintf(stderr, "Info: overclocking is not possible on nvidia on wayland, ignoring option\n");
-    }
+    if(!audio_only && video_encoder == VideoEncoder::CPU) {
+        // xshm capture only uses the x11 connection and screencopy only the wayland connection, opengl and the gpu are not used at all
+        egl.x11.dpy = dpy;
+        if(window_is_screencopy && wayland && !gsr_egl_load_wayland_only(&egl)) {
+            fprintf(stderr, "gsr error: failed to connect to the wayland compositor\n");
+            _exit(1);
+        }
+    } else if(!audio_only) {
+        if(!gsr_egl_load(&egl, dpy, wayland)) {
+            fprintf(stderr, "gsr error: failed to load opengl\n");
+            _exit(1);
+        }
 
-    egl.card_path[0] = '\0';
-    if(wayland || gpu_inf.vendor != GSR_GPU_VENDOR_NVIDIA) {
-        // TODO: Allow specifying another card, and in other places
-        if(!gsr_get_valid_card_path(egl.card_path)) {
-            fprintf(stderr, "Error: no /dev/dri/cardX device found\n");
+        if(!gl_get_gpu_info(&egl, &gpu_inf))
             _exit(2);
+
+        if(gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA && gpu_inf.gpu_version != 0 && gpu_inf.gpu_version < 900) {
+            fprintf(stderr, "Info: your gpu appears to be very old (older than maxwell architecture). Switching to lower preset\n");
+            very_old_gpu = true;
+        }
+
+        if(gpu_inf.vendor != GSR_GPU_VENDOR_NVIDIA && overclock) {
+            fprintf(stderr, "Info: overclock option has no effect on amd/intel, ignoring option\n");
+        }
+
+        if(gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA && overclock && wayland) {
+            fprintf(stderr, "Info: overclocking is not possible on nvidia on wayland, ignoring option\n");
+        }
+
+        egl.card_path[0] = '\0';
+        if(wayland || gpu_inf.vendor != GSR_GPU_VENDOR_NVIDIA) {
+            // TODO: Allow specifying another card, and in other places
+            if(!gsr_get_valid_card_path(egl.card_path)) {
+                fprintf(stderr, "Error: no /dev/dri/cardX device found\n");
+                _exit(2);
+            }
         }
     }
 
@@ -1913,16 +2999,18 @@ int main(int argc, char **argv) {
     }
 
     const char *screen_region = args["-s"].value();
-    const char *window_str = strdup(args["-w"].value());
+    const char *window_str = audio_only ? nullptr : strdup(args["-w"].value());
 
-    if(screen_region && strcmp(window_str, "focused") != 0) {
+    if(screen_region && (audio_only || strcmp(window_str, "focused") != 0)) {
         fprintf(stderr, "Error: option -s is only available when using -w focused\n");
         usage();
     }
 
     const char *filename = args["-o"].value();
     if(filename) {
-        if(replay_buffer_size_secs == -1) {
+        if(is_livestream_path(filename)) {
+            // Nothing to create
+        } else if(replay_buffer_size_secs == -1) {
             char directory_buf[PATH_MAX];
             strcpy(directory_buf, filename);
             char *directory = dirname(directory_buf);
@@ -1978,7 +3066,7 @@ int main(int argc, char **argv) {
             file_extension = file_extension.substr(0, comma_index);
     }
 
-    if(gpu_inf.vendor != GSR_GPU_VENDOR_NVIDIA && file_extension == "mkv" && strcmp(video_codec_to_use, "h264") == 0) {
+    if(!audio_only && video_encoder == VideoEncoder::GPU && gpu_inf.vendor != GSR_GPU_VENDOR_NVIDIA && file_extension == "mkv" && strcmp(video_codec_to_use, "h264") == 0) {
         video_codec_to_use = "hevc";
         video_codec = VideoCodec::HEVC;
         fprintf(stderr, "Warning: video codec was forcefully set to hevc because mkv container is used and mesa (AMD and Intel driver) does not support h264 in mkv files\n");
@@ -1990,19 +3078,19 @@ int main(int argc, char **argv) {
         }
         case AudioCodec::OPUS: {
             // TODO: Also check mpegts?
-            if(file_extension != "mp4" && file_extension != "mkv") {
+            if(file_extension != "mp4" && file_extension != "mkv" && file_extension != "mka") {
                 audio_codec_to_use = "aac";
                 audio_codec = AudioCodec::AAC;
-                fprintf(stderr, "Warning: opus audio codec is only supported by .mp4 and .mkv files, falling back to aac instead\n");
+                fprintf(stderr, "Warning: opus audio codec is only supported by .mp4, .mkv and .mka files, falling back to aac instead\n");
             }
             break;
         }
         case AudioCodec::FLAC: {
             // TODO: Also check mpegts?
-            if(file_extension != "mp4" && file_extension != "mkv") {
+            if(file_extension != "mp4" && file_extension != "mkv" && file_extension != "mka") {
                 audio_codec_to_use = "aac";
                 audio_codec = AudioCodec::AAC;
-                fprintf(stderr, "Warning: flac audio codec is only supported by .mp4 and .mkv files, falling back to aac instead\n");
+                fprintf(stderr, "Warning: flac audio codec is only supported by .mp4, .mkv and .mka files, falling back to aac instead\n");
             } else if(uses_amix) {
                 audio_codec_to_use = "opus";
                 audio_codec = AudioCodec::OPUS;
@@ -2012,127 +3100,142 @@ int main(int argc, char **argv) {
         }
     }
 
-    const double target_fps = 1.0 / (double)fps;
+    double target_fps = 1.0 / (double)fps;
 
-    const bool video_codec_auto = strcmp(video_codec_to_use, "auto") == 0;
-    if(video_codec_auto) {
-        if(gpu_inf.vendor == GSR_GPU_VENDOR_INTEL) {
-            const AVCodec *h264_codec = find_h264_encoder(gpu_inf.vendor, egl.card_path);
-            if(!h264_codec) {
-                fprintf(stderr, "Info: using hevc encoder because a codec was not specified and your gpu does not support h264\n");
-                video_codec_to_use = "hevc";
-                video_codec = VideoCodec::HEVC;
+    const AVCodec *video_codec_f = nullptr;
+    gsr_capture *capture = nullptr;
+    if(!audio_only) {
+        if(video_encoder == VideoEncoder::CPU) {
+            if(strcmp(video_codec_to_use, "auto") != 0 && video_codec != VideoCodec::H264)
+                fprintf(stderr, "Warning: only h264 is supported with -encoder cpu, using h264 instead\n");
+            video_codec_to_use = "h264";
+            video_codec = VideoCodec::H264;
+        }
+
+        const bool video_codec_auto = strcmp(video_codec_to_use, "auto") == 0;
+        if(video_codec_auto) {
+            if(gpu_inf.vendor == GSR_GPU_VENDOR_INTEL) {
+                const AVCodec *h264_codec = find_h264_encoder(gpu_inf.vendor, egl.card_path);
+                if(!h264_codec) {
+                    fprintf(stderr, "Info: using hevc encoder because a codec was not specified and your gpu does not support h264\n");
+                    video_codec_to_use = "hevc";
+                    video_codec = VideoCodec::HEVC;
+                } else {
+                    fprintf(stderr, "Info: using h264 encoder because a codec was not specified\n");
+                    video_codec_to_use = "h264";
+                    video_codec = VideoCodec::H264;
+                }
             } else {
-                fprintf(stderr, "Info: using h264 encoder because a codec was not specified\n");
-                video_codec_to_use = "h264";
-                video_codec = VideoCodec::H264;
-            }
-        } else {
-            const AVCodec *h265_codec = find_h265_encoder(gpu_inf.vendor, egl.card_path);
+                const AVCodec *h265_codec = find_h265_encoder(gpu_inf.vendor, egl.card_path);
 
-            if(h265_codec && fps > 60) {
-                fprintf(stderr, "Warning: recording at higher fps than 60 with hevc might result in recording at a very low fps. If this happens, switch to h264 or av1\n");
-            }
+                if(h265_codec && fps > 60) {
+                    fprintf(stderr, "Warning: recording at higher fps than 60 with hevc might result in recording at a very low fps. If this happens, switch to h264 or av1\n");
+                }
 
-            // hevc generally allows recording at a higher resolution than h264 on nvidia cards. On a gtx 1080 4k is the max resolution for h264 but for hevc it's 8k.
-            // Another important info is that when recording at a higher fps than.. 60? hevc has very bad performance. For example when recording at 144 fps the fps drops to 1
-            // while with h264 the fps doesn't drop.
-            if(!h265_codec) {
-                fprintf(stderr, "Info: using h264 encoder because a codec was not specified and your gpu does not support hevc\n");
-                video_codec_to_use = "h264";
-                video_codec = VideoCodec::H264;
-            } else {
-                fprintf(stderr, "Info: using hevc encoder because a codec was not specified\n");
-                video_codec_to_use = "hevc";
-                video_codec = VideoCodec::HEVC;
+                // hevc generally allows recording at a higher resolution than h264 on nvidia cards. On a gtx 1080 4k is the max resolution for h264 but for hevc it's 8k.
+                // Another important info is that when recording at a higher fps than.. 60? hevc has very bad performance. For example when recording at 144 fps the fps drops to 1
+                // while with h264 the fps doesn't drop.
+                if(!h265_codec) {
+                    fprintf(stderr, "Info: using h264 encoder because a codec was not specified and your gpu does not support hevc\n");
+                    video_codec_to_use = "h264";
+                    video_codec = VideoCodec::H264;
+                } else {
+                    fprintf(stderr, "Info: using hevc encoder because a codec was not specified\n");
+                    video_codec_to_use = "hevc";
+                    video_codec = VideoCodec::HEVC;
+                }
             }
         }
-    }
-
-    // TODO: Allow hevc, vp9 and av1 in (enhanced) flv (supported since ffmpeg 6.1)
-    const bool is_flv = strcmp(file_extension.c_str(), "flv") == 0;
-    if(video_codec != VideoCodec::H264 && is_flv) {
-        video_codec_to_use = "h264";
-        video_codec = VideoCodec::H264;
-        fprintf(stderr, "Warning: hevc/av1 is not compatible with flv, falling back to h264 instead.\n");
-    }
 
-    const AVCodec *video_codec_f = nullptr;
-    switch(video_codec) {
-        case VideoCodec::H264:
-            video_codec_f = find_h264_encoder(gpu_inf.vendor, egl.card_path);
-            break;
-        case VideoCodec::HEVC:
-        case VideoCodec::HEVC_HDR:
-            video_codec_f = find_h265_encoder(gpu_inf.vendor, egl.card_path);
-            break;
-        case VideoCodec::AV1:
-        case VideoCodec::AV1_HDR:
-            video_codec_f = find_av1_encoder(gpu_inf.vendor, egl.card_path);
-            break;
-    }
+        // TODO: Allow hevc, vp9 and av1 in (enhanced) flv (supported since ffmpeg 6.1)
+        const bool is_flv = strcmp(file_extension.c_str(), "flv") == 0;
+        if(video_codec != VideoCodec::H264 && is_flv) {
+            video_codec_to_use = "h264";
+            video_codec = VideoCodec::H264;
+            fprintf(stderr, "Warning: hevc/av1 is not compatible with flv, falling back to h264 instead.\n");
+        }
 
-    if(!video_codec_auto && !video_codec_f && !is_flv) {
         switch(video_codec) {
-            case VideoCodec::H264: {
-                fprintf(stderr, "Warning: selected video codec h264 is not supported, trying hevc instead\n");
-                video_codec_to_use = "hevc";
-                video_codec = VideoCodec::HEVC;
-                video_codec_f = find_h265_encoder(gpu_inf.vendor, egl.card_path);
+            case VideoCodec::H264:
+                video_codec_f = video_encoder == VideoEncoder::CPU ? avcodec_find_encoder_by_name("libx264") : find_h264_encoder(gpu_inf.vendor, egl.card_path);
                 break;
-            }
             case VideoCodec::HEVC:
-            case VideoCodec::HEVC_HDR: {
-                fprintf(stderr, "Warning: selected video codec hevc is not supported, trying h264 instead\n");
-                video_codec_to_use = "h264";
-                video_codec = VideoCodec::H264;
-                video_codec_f = find_h264_encoder(gpu_inf.vendor, egl.card_path);
+            case VideoCodec::HEVC_HDR:
+                video_codec_f = find_h265_encoder(gpu_inf.vendor, egl.card_path);
                 break;
-            }
             case VideoCodec::AV1:
-            case VideoCodec::AV1_HDR: {
-                fprintf(stderr, "Warning: selected video codec av1 is not supported, trying h264 instead\n");
-                video_codec_to_use = "h264";
-                video_codec = VideoCodec::H264;
-                video_codec_f = find_h264_encoder(gpu_inf.vendor, egl.card_path);
+            case VideoCodec::AV1_HDR:
+                video_codec_f = find_av1_encoder(gpu_inf.vendor, egl.card_path);
                 break;
-            }
         }
-    }
 
-    if(!video_codec_f) {
-        const char *video_codec_name = "";
-        switch(video_codec) {
-            case VideoCodec::H264: {
-                video_codec_name = "h265";
-                break;
-            }
-            case VideoCodec::HEVC:
-            case VideoCodec::HEVC_HDR: {
-                video_codec_name = "h265";
-                break;
+        if(video_encoder == VideoEncoder::CPU && !video_codec_f) {
+            fprintf(stderr, "Error: -encoder cpu requires ffmpeg to be built with libx264\n");
+            _exit(2);
+        }
+
+        if(!video_codec_auto && !video_codec_f && !is_flv) {
+            switch(video_codec) {
+                case VideoCodec::H264: {
+                    fprintf(stderr, "Warning: selected video codec h264 is not supported, trying hevc instead\n");
+                    video_codec_to_use = "hevc";
+                    video_codec = VideoCodec::HEVC;
+                    video_codec_f = find_h265_encoder(gpu_inf.vendor, egl.card_path);
+                    break;
+                }
+                case VideoCodec::HEVC:
+                case VideoCodec::HEVC_HDR: {
+                    fprintf(stderr, "Warning: selected video codec hevc is not supported, trying h264 instead\n");
+                    video_codec_to_use = "h264";
+                    video_codec = VideoCodec::H264;
+                    video_codec_f = find_h264_encoder(gpu_inf.vendor, egl.card_path);
+                    break;
+                }
+                case VideoCodec::AV1:
+                case VideoCodec::AV1_HDR: {
+                    fprintf(stderr, "Warning: selected video codec av1 is not supported, trying h264 instead\n");
+                    video_codec_to_use = "h264";
+                    video_codec = VideoCodec::H264;
+                    video_codec_f = find_h264_encoder(gpu_inf.vendor, egl.card_path);
+                    break;
+                }
             }
-            case VideoCodec::AV1:
-            case VideoCodec::AV1_HDR: {
-                video_codec_name = "av1";
-                break;
+        }
+
+        if(!video_codec_f) {
+            const char *video_codec_name = "";
+            switch(video_codec) {
+                case VideoCodec::H264: {
+                    video_codec_name = "h265";
+                    break;
+                }
+                case VideoCodec::HEVC:
+                case VideoCodec::HEVC_HDR: {
+                    video_codec_name = "h265";
+                    break;
+                }
+                case VideoCodec::AV1:
+                case VideoCodec::AV1_HDR: {
+                    video_codec_name = "av1";
+                    break;
+                }
             }
+
+            fprintf(stderr, "Error: your gpu does not support '%s' video codec. If you are sure that your gpu does support '%s' video encoding and you are using an AMD/Intel GPU,\n"
+                "  then make sure you have installed the GPU specific vaapi packages.\n"
+                "  It's also possible that your distro has disabled hardware accelerated video encoding for '%s' video codec.\n"
+                "  This may be the case on corporate distros such as Manjaro, Fedora or OpenSUSE.\n"
+                "  You can test this by running 'vainfo | grep VAEntrypointEncSlice' to see if it matches any H264/HEVC profile.\n"
+                "  On such distros, you need to manually install mesa from source to enable H264/HEVC hardware acceleration, or use a more user friendly distro. Alternatively record with AV1 if supported by your GPU.\n"
+                "  You can alternatively use the flatpak version of GPU Screen Recorder (https://flathub.org/apps/com.dec05eba.gpu_screen_recorder) which bypasses system issues with patented H264/HEVC codecs.\n"
+                "  Make sure you have mesa-extra freedesktop runtime installed when using the flatpak (this should be the default), which can be installed with this command:\n"
+                "  flatpak install --system org.freedesktop.Platform.GL.default//23.08-extra", video_codec_name, video_codec_name, video_codec_name);
+            _exit(2);
         }
 
-        fprintf(stderr, "Error: your gpu does not support '%s' video codec. If you are sure that your gpu does support '%s' video encoding and you are using an AMD/Intel GPU,\n"
-            "  then make sure you have installed the GPU specific vaapi packages.\n"
-            "  It's also possible that your distro has disabled hardware accelerated video encoding for '%s' video codec.\n"
-            "  This may be the case on corporate distros such as Manjaro, Fedora or OpenSUSE.\n"
-            "  You can test this by running 'vainfo | grep VAEntrypointEncSlice' to see if it matches any H264/HEVC profile.\n"
-            "  On such distros, you need to manually install mesa from source to enable H264/HEVC hardware acceleration, or use a more user friendly distro. Alternatively record with AV1 if supported by your GPU.\n"
-            "  You can alternatively use the flatpak version of GPU Screen Recorder (https://flathub.org/apps/com.dec05eba.gpu_screen_recorder) which bypasses system issues with patented H264/HEVC codecs.\n"
-            "  Make sure you have mesa-extra freedesktop runtime installed when using the flatpak (this should be the default), which can be installed with this command:\n"
-            "  flatpak install --system org.freedesktop.Platform.GL.default//23.08-extra", video_codec_name, video_codec_name, video_codec_name);
-        _exit(2);
+        capture = create_capture_impl(window_str, screen_region, wayland, gpu_inf, egl, fps, overclock, video_codec, video_encoder, color_range);
     }
 
-    gsr_capture *capture = create_capture_impl(window_str, screen_region, wayland, gpu_inf, egl, fps, overclock, video_codec, color_range);
-
     const bool is_livestream = is_livestream_path(filename);
     // (Some?) livestreaming services require at least one audio track to work.
     // If not audio is provided then create one silent audio track.
@@ -2143,34 +3246,75 @@ int main(int argc, char **argv) {
         requested_audio_inputs.push_back(std::move(mai));
     }
 
-    if(is_livestream && framerate_mode != FramerateMode::CONSTANT) {
+    if(is_livestream && !audio_only && framerate_mode != FramerateMode::CONSTANT) {
         fprintf(stderr, "Info: framerate mode was forcefully set to \"cfr\" because live streaming was detected\n");
         framerate_mode = FramerateMode::CONSTANT;
         framerate_mode_str = "cfr";
     }
 
+    if(audio_only) {
+        // Video options have no effect
+        adaptive_bitrate_max = 0;
+        intra_refresh = false;
+        region_of_interest.mode = RoiMode::NONE;
+    }
+
+    if(adaptive_bitrate_max > 0 && !is_livestream) {
+        fprintf(stderr, "Warning: -abr is only used when live streaming, ignoring it\n");
+        adaptive_bitrate_max = 0;
+    }
+
+    // Replays and seeking in recordings need keyframes
+    if(intra_refresh && !is_livestream) {
+        fprintf(stderr, "Warning: -ir is only used when live streaming, ignoring it\n");
+        intra_refresh = false;
+    } else if(intra_refresh && gpu_inf.vendor != GSR_GPU_VENDOR_NVIDIA) {
+        fprintf(stderr, "Warning: -ir is only supported on NVIDIA, ignoring it\n");
+        intra_refresh = false;
+    }
+
     if(is_livestream && recording_saved_script) {
         fprintf(stderr, "Warning: live stream detected, -sc script is ignored\n");
         recording_saved_script = nullptr;
     }
 
+    const bool is_mp4_output = file_extension == "mp4" || file_extension == "mov";
+    if(fragmented_output && (replay_buffer_size_secs != -1 || is_livestream)) {
+        fprintf(stderr, "Warning: -frag is only used when recording to a file, ignoring it\n");
+        fragmented_output = false;
+    } else if(fragmented_output && !is_mp4_output && file_extension != "mkv") {
+        fprintf(stderr, "Info: -frag has no effect with the container format %s, it's already crash safe\n", file_extension.c_str());
+        fragmented_output = false;
+    }
+
+    if(faststart && (!fragmented_output || !is_mp4_output || strcmp(filename, "/dev/stdout") == 0)) {
+        fprintf(stderr, "Error: -faststart requires -frag yes and a mp4 or mov output file\n");
+        usage();
+    }
+
     AVStream *video_stream = nullptr;
     std::vector<AudioTrack> audio_tracks;
     const bool hdr = video_codec_is_hdr(video_codec);
 
-    AVCodecContext *video_codec_context = create_video_codec_context(gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA ? AV_PIX_FMT_CUDA : AV_PIX_FMT_VAAPI, quality, fps, video_codec_f, is_livestream, gpu_inf.vendor, framerate_mode, hdr, color_range);
-    if(replay_buffer_size_secs == -1)
-        video_stream = create_stream(av_format_context, video_codec_context);
+    AVCodecContext *video_codec_context = nullptr;
+    if(!audio_only) {
+        AVPixelFormat video_pix_fmt = gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA ? AV_PIX_FMT_CUDA : AV_PIX_FMT_VAAPI;
+        if(video_encoder == VideoEncoder::CPU)
+            video_pix_fmt = AV_PIX_FMT_NV12;
+        video_codec_context = create_video_codec_context(video_pix_fmt, quality, fps, video_codec_f, is_livestream, framerate_mode, hdr, color_range, video_bitrate, keyframe_interval_secs);
+        if(replay_buffer_size_secs == -1)
+            video_stream = create_stream(av_format_context, video_codec_context);
 
-    int capture_result = gsr_capture_start(capture, video_codec_context);
-    if(capture_result != 0) {
-        fprintf(stderr, "gsr error: gsr_capture_start failed\n");
-        _exit(capture_result);
-    }
+        int capture_result = gsr_capture_start(capture, video_codec_context);
+        if(capture_result != 0) {
+            fprintf(stderr, "gsr error: gsr_capture_start failed\n");
+            _exit(capture_result);
+        }
 
-    open_video(video_codec_context, quality, very_old_gpu, gpu_inf.vendor, pixel_format, hdr);
-    if(video_stream)
-        avcodec_parameters_from_context(video_stream->codecpar, video_codec_context);
+        open_video(video_codec_context, quality, very_old_gpu, gpu_inf.vendor, video_encoder, pixel_format, hdr, video_bitrate.mode, intra_refresh, low_latency);
+        if(video_stream)
+            avcodec_parameters_from_context(video_stream->codecpar, video_codec_context);
+    }
 
     int audio_stream_index = VIDEO_STREAM_INDEX + 1;
     for(const MergedAudioInputs &merged_audio_inputs : requested_audio_inputs) {
@@ -2181,7 +3325,7 @@ int main(int argc, char **argv) {
         if(replay_buffer_size_secs == -1)
             audio_stream = create_stream(av_format_context, audio_codec_context);
 
-        open_audio(audio_codec_context);
+        open_audio(audio_codec_context, dtx);
         if(audio_stream)
             avcodec_parameters_from_context(audio_stream->codecpar, audio_codec_context);
 
@@ -2227,15 +3371,14 @@ int main(int argc, char **argv) {
                 }
             }
 
-            audio_device.frame = create_audio_frame(audio_codec_context);
-            audio_device.frame->pts = 0;
-
             audio_devices.push_back(std::move(audio_device));
         }
 
         AudioTrack audio_track;
         audio_track.codec_context = audio_codec_context;
         audio_track.stream = audio_stream;
+        audio_track.silent_frame = create_audio_frame(audio_codec_context);
+        av_samples_set_silence(audio_track.silent_frame->data, 0, audio_track.silent_frame->nb_samples, num_channels, audio_codec_context->sample_fmt);
         audio_track.audio_devices = std::move(audio_devices);
         audio_track.graph = graph;
         audio_track.sink = sink;
@@ -2246,17 +3389,57 @@ int main(int argc, char **argv) {
 
     //av_dump_format(av_format_context, 0, filename, 1);
 
+    gsr_pipe_writer pipe_writer;
+    bool use_pipe_writer = false;
+    gsr_network_output network_output;
+    bool use_network_output = false;
     if (replay_buffer_size_secs == -1 && !(output_format->flags & AVFMT_NOFILE)) {
-        int ret = avio_open(&av_format_context->pb, filename, AVIO_FLAG_WRITE);
-        if (ret < 0) {
-            fprintf(stderr, "Error: Could not open '%s': %s\n", filename, av_error_to_string(ret));
-            _exit(1);
+        struct stat stdout_stat;
+        if(is_livestream) {
+            if(gsr_network_output_open(&network_output, av_format_context, filename, max_stream_queue_latency_seconds) != 0) {
+                fprintf(stderr, "Error: Could not open '%s'\n", filename);
+                _exit(1);
+            }
+            use_network_output = true;
+        } else if(strcmp(filename, "/dev/stdout") == 0 && fstat(STDOUT_FILENO, &stdout_stat) == 0 && S_ISFIFO(stdout_stat.st_mode)
+            && gsr_pipe_writer_init(&pipe_writer, STDOUT_FILENO, 64 * 1024 * 1024) == 0)
+        {
+            // The output is piped to another program (for example ffmpeg when live streaming). Write to the pipe from another thread
+            // so that the capture loop doesn't stall every time the other program is slow to read
+            use_pipe_writer = true;
+            const int avio_buffer_size = 256 * 1024;
+            uint8_t *avio_buffer = (uint8_t*)av_malloc(avio_buffer_size);
+            av_format_context->pb = avio_buffer ? avio_alloc_context(avio_buffer, avio_buffer_size, 1, &pipe_writer, nullptr, pipe_writer_avio_write, nullptr) : nullptr;
+            if(!av_format_context->pb) {
+                fprintf(stderr, "Error: Failed to create io context for the output pipe\n");
+                _exit(1);
+            }
+        } else {
+            int ret = avio_open(&av_format_context->pb, filename, AVIO_FLAG_WRITE);
+            if (ret < 0) {
+                fprintf(stderr, "Error: Could not open '%s': %s\n", filename, av_error_to_string(ret));
+                _exit(1);
+            }
         }
     }
 
     if(replay_buffer_size_secs == -1) {
         AVDictionary *options = nullptr;
         av_dict_set(&options, "strict", "experimental", 0);
+        if(fragmented_output) {
+            // Every keyframe starts a new self-contained fragment (for mp4) or cluster (for mkv) that is written immediately,
+            // so the recording is playable up to the last keyframe even if gpu screen recorder is killed
+            if(is_mp4_output)
+                av_dict_set(&options, "movflags", "+frag_keyframe+empty_moov+default_base_moof", 0);
+            else
+                av_dict_set_int(&options, "cluster_time_limit", 1000, 0);
+            av_format_context->flush_packets = 1;
+        }
+        if(low_latency) {
+            // Don't let the muxer hold on to packets to interleave them, and write every packet to the output immediately
+            av_format_context->max_delay = 0;
+            av_format_context->flush_packets = 1;
+        }
         //av_dict_set_int(&av_format_context->metadata, "video_full_range_flag", 1, 0);
 
         int ret = avformat_write_header(av_format_context, &options);
@@ -2268,6 +3451,21 @@ int main(int argc, char **argv) {
         av_dict_free(&options);
     }
 
+    if(use_network_output && gsr_network_output_start(&network_output) != 0) {
+        fprintf(stderr, "Error: Failed to start the network output\n");
+        _exit(1);
+    }
+
+    gsr_adaptive_bitrate adaptive_bitrate;
+    const bool use_adaptive_bitrate = use_network_output && adaptive_bitrate_max > 0;
+    if(use_adaptive_bitrate) {
+        // Nvenc and libx264 reconfigure the encoder when the bitrate in the codec context changes, vaapi only reads it when the encoder is opened
+        int64_t adaptive_bitrate_min = adaptive_bitrate_max;
+        if(gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA || video_encoder == VideoEncoder::CPU)
+            adaptive_bitrate_min = std::min(adaptive_bitrate_max, std::max(adaptive_bitrate_max / 8, (int64_t)250000LL));
+        gsr_adaptive_bitrate_init(&adaptive_bitrate, adaptive_bitrate_min, adaptive_bitrate_max, fps, clock_get_monotonic_seconds());
+    }
+
     const double start_time_pts = clock_get_monotonic_seconds();
 
     double start_time = clock_get_monotonic_seconds();
@@ -2284,36 +3482,103 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Error: Failed to allocate frame\n");
         _exit(1);
     }
-    frame->format = video_codec_context->pix_fmt;
-    frame->width = video_codec_context->width;
-    frame->height = video_codec_context->height;
-    frame->color_range = video_codec_context->color_range;
-    frame->color_primaries = video_codec_context->color_primaries;
-    frame->color_trc = video_codec_context->color_trc;
-    frame->colorspace = video_codec_context->colorspace;
-    frame->chroma_location = video_codec_context->chroma_sample_location;
+    if(video_codec_context) {
+        frame->format = video_codec_context->pix_fmt;
+        frame->width = video_codec_context->width;
+        frame->height = video_codec_context->height;
+        frame->color_range = video_codec_context->color_range;
+        frame->color_primaries = video_codec_context->color_primaries;
+        frame->color_trc = video_codec_context->color_trc;
+        frame->colorspace = video_codec_context->colorspace;
+        frame->chroma_location = video_codec_context->chroma_sample_location;
+    }
 
     std::mutex write_output_mutex;
-    std::mutex audio_filter_mutex;
 
     const double record_start_time = clock_get_monotonic_seconds();
     std::deque<std::shared_ptr<PacketData>> frame_data_queue;
     bool frames_erased = false;
+    // Kept up to date when packets are added and removed so that the stats don't have to go through the whole replay buffer
+    uint64_t frame_data_queue_size_bytes = 0;
 
-    const size_t audio_buffer_size = 1024 * 4 * 2; // max 4 bytes/sample, 2 channels
-    uint8_t *empty_audio = (uint8_t*)malloc(audio_buffer_size);
-    if(!empty_audio) {
-        fprintf(stderr, "Error: failed to create empty audio\n");
-        _exit(1);
-    }
-    memset(empty_audio, 0, audio_buffer_size);
+    // Up to ~5 seconds of audio, if the encoder falls further behind than that then audio is dropped instead of delaying the audio devices
+    const uint32_t audio_frame_queue_size = 256;
+    std::atomic<bool> audio_encoders_running(true);
 
     for(AudioTrack &audio_track : audio_tracks) {
+        for(AudioDevice &audio_device : audio_track.audio_devices) {
+            if(gsr_frame_queue_init(&audio_device.frame_queue, audio_frame_queue_size) != 0 || gsr_frame_queue_init(&audio_device.free_frame_queue, audio_frame_queue_size) != 0) {
+                fprintf(stderr, "Error: failed to create audio frame queue\n");
+                _exit(1);
+            }
+        }
+
+        sem_init(&audio_track.encoder_sem, 0, 0);
+        audio_track.encoder_thread = std::thread([&]() mutable {
+            AVFrame *aframe = av_frame_alloc();
+            if(!aframe) {
+                fprintf(stderr, "Error: failed to allocate audio frame\n");
+                _exit(1);
+            }
+
+            auto encode_frame = [&](AVFrame *frame_to_encode) {
+                const int ret = avcodec_send_frame(audio_track.codec_context, frame_to_encode);
+                if(ret >= 0) {
+                    // TODO: Move to separate thread because this could write to network (for example when livestreaming)
+                    receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, frame_to_encode->pts, av_format_context, use_network_output ? &network_output : nullptr, record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, frame_data_queue_size_bytes, write_output_mutex, paused_time_offset, nullptr);
+                } else {
+                    fprintf(stderr, "Failed to encode audio!\n");
+                }
+            };
+
+            for(;;) {
+                while(sem_wait(&audio_track.encoder_sem) == -1 && errno == EINTR) {}
+                // Checked before the queues are emptied so that the last frames from the audio devices are encoded before stopping
+                const bool stop = !audio_encoders_running;
+
+                for(AudioDevice &audio_device : audio_track.audio_devices) {
+                    AVFrame *queued_frame = nullptr;
+                    while((queued_frame = gsr_frame_queue_pop(&audio_device.frame_queue))) {
+                        if(audio_track.graph) {
+                            // TODO: av_buffersrc_add_frame
+                            if(av_buffersrc_write_frame(audio_device.src_filter_ctx, queued_frame) < 0) {
+                                fprintf(stderr, "Error: failed to add audio frame to filter\n");
+                            }
+                        } else {
+                            encode_frame(queued_frame);
+                        }
+
+                        if(!gsr_frame_queue_push(&audio_device.free_frame_queue, queued_frame))
+                            av_frame_free(&queued_frame);
+                    }
+                }
+
+                if(audio_track.graph) {
+                    while(av_buffersink_get_frame(audio_track.sink, aframe) >= 0) {
+                        aframe->pts = audio_track.pts;
+                        encode_frame(aframe);
+                        av_frame_unref(aframe);
+                        audio_track.pts += audio_track.codec_context->frame_size;
+                    }
+                }
+
+                if(stop)
+                    break;
+            }
+
+            av_frame_free(&aframe);
+        });
+
         for(AudioDevice &audio_device : audio_track.audio_devices) {
             audio_device.thread = std::thread([&]() mutable {
                 const AVSampleFormat sound_device_sample_format = audio_format_to_sample_format(audio_codec_context_get_audio_format(audio_track.codec_context));
-                // TODO: Always do conversion for now. This fixes issue with stuttering audio on pulseaudio with opus + multiple audio sources merged
-                const bool needs_audio_conversion = true;//audio_track.codec_context->sample_fmt != sound_device_sample_format;
+                const AVSampleFormat codec_sample_format = audio_track.codec_context->sample_fmt;
+                // The sound device is opened with the sample format of the encoder (or the packed version of it), so swresample is only needed
+                // for sample formats the sound device doesn't support. The samples are always copied into the data of the queued frame,
+                // since the encoder thread (and the amix filter) keeps references to the frame after the sound device buffer has been reused
+                const bool needs_deinterleave = av_sample_fmt_is_planar(codec_sample_format) && av_get_packed_sample_fmt(codec_sample_format) == sound_device_sample_format;
+                const bool needs_audio_conversion = !needs_deinterleave && codec_sample_format != sound_device_sample_format;
+                const int num_channels = 2;
                 SwrContext *swr = nullptr;
                 if(needs_audio_conversion) {
                     swr = swr_alloc();
@@ -2330,8 +3595,61 @@ int main(int argc, char **argv) {
                     swr_init(swr);
                 }
 
-                const double target_audio_hz = 1.0 / (double)audio_track.codec_context->sample_rate;
-                double received_audio_time = clock_get_monotonic_seconds();
+                // The warning about dropped audio is printed at most once per second, with the number of frames dropped since the last warning
+                double dropped_audio_warning_time = 0.0;
+                int num_dropped_audio_frames = 0;
+
+                // Frames are taken back from the encoder thread when it's done with them, so no frames are allocated while recording.
+                // |samples| is null for silence
+                auto queue_frame = [&](const uint8_t *samples) {
+                    AVFrame *queued_frame = gsr_frame_queue_pop(&audio_device.free_frame_queue);
+                    if(!queued_frame)
+                        queued_frame = create_audio_frame(audio_track.codec_context);
+
+                    // The encoder or filter could still be referencing the data of the frame, in which case this allocates new data for the frame
+                    if(av_frame_make_writable(queued_frame) < 0) {
+                        fprintf(stderr, "Failed to make audio frame writable\n");
+                        av_frame_free(&queued_frame);
+                        return;
+                    }
+
+                    if(!samples)
+                        av_frame_copy(queued_frame, audio_track.silent_frame);
+                    else if(needs_audio_conversion)
+                        swr_convert(swr, &queued_frame->data[0], audio_track.codec_context->frame_size, &samples, audio_track.codec_context->frame_size);
+                    else if(needs_deinterleave)
+                        deinterleave_audio_samples(samples, queued_frame->data, audio_track.codec_context->frame_size, num_channels, av_get_bytes_per_sample(sound_device_sample_format));
+                    else
+                        memcpy(queued_frame->data[0], samples, av_samples_get_buffer_size(nullptr, num_channels, audio_track.codec_context->frame_size, sound_device_sample_format, 1));
+
+                    queued_frame->pts = audio_device.pts;
+                    audio_device.pts += audio_track.codec_context->frame_size;
+
+                    if(gsr_frame_queue_push(&audio_device.frame_queue, queued_frame)) {
+                        sem_post(&audio_track.encoder_sem);
+                    } else {
+                        av_frame_free(&queued_frame);
+                        ++num_dropped_audio_frames;
+                        const double time_now = clock_get_monotonic_seconds();
+                        if(time_now - dropped_audio_warning_time >= 1.0) {
+                            fprintf(stderr, "Warning: audio encoding is too slow, dropped %d audio frame(s)\n", num_dropped_audio_frames);
+                            dropped_audio_warning_time = time_now;
+                            num_dropped_audio_frames = 0;
+                        }
+                    }
+                };
+
+                // The sample clock. |audio_device.pts| is the number of samples that have been queued and it should follow the time since the
+                // audio device was started (excluding pauses). Silence is added when the audio device falls behind, for example when nothing is playing
+                // on some devices or when pulseaudio stalls
+                const double audio_start_time = clock_get_monotonic_seconds() - paused_time_offset;
+                const int64_t sample_rate = audio_track.codec_context->sample_rate;
+                const int64_t frame_size = audio_track.codec_context->frame_size;
+                // Pulseaudio delivers audio in bursts, so the audio device is allowed to be a few frames behind (or ahead) before the clock is corrected
+                const int64_t max_missing_frames = 5;
+                // A gap this large (one second) is a real hole in the audio, for example after the audio device stalled. It's filled at once since filling
+                // one frame at a time would take too long to catch up. It's limited to half of the frame queue so that filling it doesn't drop audio
+                const int64_t resync_missing_frames = std::max(max_missing_frames + 1, std::min(sample_rate / frame_size, (int64_t)audio_frame_queue_size / 2));
                 const int64_t timeout_ms = std::round((1000.0 / (double)audio_track.codec_context->sample_rate) * 1000.0);
 
                 while(running) {
@@ -2341,102 +3659,53 @@ int main(int argc, char **argv) {
                         sound_buffer_size = sound_device_read_next_chunk(&audio_device.sound_device, &sound_buffer);
                     const bool got_audio_data = sound_buffer_size >= 0;
 
-                    const double this_audio_frame_time = clock_get_monotonic_seconds() - paused_time_offset;
-
                     if(paused) {
-                        if(got_audio_data)
-                            received_audio_time = this_audio_frame_time;
-
                         if(!audio_device.sound_device.handle)
                             usleep(timeout_ms * 1000);
 
                         continue;
                     }
 
-                    int ret = av_frame_make_writable(audio_device.frame);
-                    if (ret < 0) {
-                        fprintf(stderr, "Failed to make audio frame writable\n");
-                        break;
-                    }
-
-                    // TODO: Is this |received_audio_time| really correct?
-                    int64_t num_missing_frames = std::round((this_audio_frame_time - received_audio_time) / target_audio_hz / (int64_t)audio_track.codec_context->frame_size);
-                    if(got_audio_data)
-                        num_missing_frames = std::max((int64_t)0, num_missing_frames - 1);
-
-                    if(!audio_device.sound_device.handle)
-                        num_missing_frames = std::max((int64_t)1, num_missing_frames);
-
+                    const double this_audio_frame_time = clock_get_monotonic_seconds() - paused_time_offset;
+                    int64_t num_missing_samples = (int64_t)((this_audio_frame_time - audio_start_time) * (double)sample_rate) - audio_device.pts;
+                    // The audio that was just received covers the last |frame_size| samples
                     if(got_audio_data)
-                        received_audio_time = this_audio_frame_time;
+                        num_missing_samples -= frame_size;
 
-                    // Jesus is there a better way to do this? I JUST WANT TO KEEP VIDEO AND AUDIO SYNCED HOLY FUCK I WANT TO KILL MYSELF NOW.
-                    // THIS PIECE OF SHIT WANTS EMPTY FRAMES OTHERWISE VIDEO PLAYS TOO FAST TO KEEP UP WITH AUDIO OR THE AUDIO PLAYS TOO EARLY.
-                    // BUT WE CANT USE DELAYS TO GIVE DUMMY DATA BECAUSE PULSEAUDIO MIGHT GIVE AUDIO A BIG DELAYED!!!
-                    // This garbage is needed because we want to produce constant frame rate videos instead of variable frame rate
+                    // This is needed because we want to produce constant frame rate videos instead of variable frame rate
                     // videos because bad software such as video editing software and VLC do not support variable frame rate software,
                     // despite nvidia shadowplay and xbox game bar producing variable frame rate videos.
                     // So we have to make sure we produce frames at the same relative rate as the video.
-                    if(num_missing_frames >= 5 || !audio_device.sound_device.handle) {
-                        // TODO:
-                        //audio_track.frame->data[0] = empty_audio;
-                        received_audio_time = this_audio_frame_time;
-                        if(needs_audio_conversion)
-                            swr_convert(swr, &audio_device.frame->data[0], audio_track.codec_context->frame_size, (const uint8_t**)&empty_audio, audio_track.codec_context->frame_size);
-                        else
-                            audio_device.frame->data[0] = empty_audio;
-
-                        // TODO: Check if duplicate frame can be saved just by writing it with a different pts instead of sending it again
-                        std::lock_guard<std::mutex> lock(audio_filter_mutex);
-                        for(int i = 0; i < num_missing_frames; ++i) {
-                            if(audio_track.graph) {
-                                // TODO: av_buffersrc_add_frame
-                                if(av_buffersrc_write_frame(audio_device.src_filter_ctx, audio_device.frame) < 0) {
-                                    fprintf(stderr, "Error: failed to add audio frame to filter\n");
-                                }
-                            } else {
-                                ret = avcodec_send_frame(audio_track.codec_context, audio_device.frame);
-                                if(ret >= 0) {
-                                    // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                                    receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, audio_device.frame->pts, av_format_context, record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex, paused_time_offset);
-                                } else {
-                                    fprintf(stderr, "Failed to encode audio!\n");
-                                }
-                            }
-                            audio_device.frame->pts += audio_track.codec_context->frame_size;
+                    // Only whole frames can be encoded, the remaining samples are filled when the next frame is due since the clock is absolute.
+                    const int64_t num_missing_frames = num_missing_samples / frame_size;
+                    // TODO: Check if duplicate frame can be saved just by writing it with a different pts instead of sending it again
+                    if(!audio_device.sound_device.handle || num_missing_frames >= resync_missing_frames) {
+                        const int64_t num_frames_to_fill = audio_device.sound_device.handle ? num_missing_frames - max_missing_frames : num_missing_frames;
+                        for(int64_t i = 0; i < num_frames_to_fill; ++i) {
+                            queue_frame(nullptr);
                         }
+                    } else if(num_missing_frames >= max_missing_frames) {
+                        // Add one frame of silence for every chunk of audio (or read timeout) until the audio device has caught up,
+                        // instead of adding the whole gap at once when pulseaudio is only late with a burst of audio
+                        queue_frame(nullptr);
                     }
 
-                    if(!audio_device.sound_device.handle)
-                        usleep(timeout_ms * 1000);
+                    // The audio device runs ahead of the clock (its sample rate is a bit higher than it claims to be). Drop the audio that was just received,
+                    // which moves the audio device back by one frame, instead of letting the audio drift away from the video
+                    const bool audio_ahead_of_clock = num_missing_frames <= -max_missing_frames;
 
-                    if(got_audio_data) {
+                    if(got_audio_data && !audio_ahead_of_clock) {
                         // TODO: Instead of converting audio, get float audio from alsa. Or does alsa do conversion internally to get this format?
-                        if(needs_audio_conversion)
-                            swr_convert(swr, &audio_device.frame->data[0], audio_track.codec_context->frame_size, (const uint8_t**)&sound_buffer, audio_track.codec_context->frame_size);
-                        else
-                            audio_device.frame->data[0] = (uint8_t*)sound_buffer;
-
-                        if(audio_track.graph) {
-                            std::lock_guard<std::mutex> lock(audio_filter_mutex);
-                            // TODO: av_buffersrc_add_frame
-                            if(av_buffersrc_write_frame(audio_device.src_filter_ctx, audio_device.frame) < 0) {
-                                fprintf(stderr, "Error: failed to add audio frame to filter\n");
-                            }
-                        } else {
-                            ret = avcodec_send_frame(audio_track.codec_context, audio_device.frame);
-                            if(ret >= 0) {
-                                // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                                receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, audio_device.frame->pts, av_format_context, record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex, paused_time_offset);
-                            } else {
-                                fprintf(stderr, "Failed to encode audio!\n");
-                            }
-                        }
-
-                        audio_device.frame->pts += audio_track.codec_context->frame_size;
+                        queue_frame((const uint8_t*)sound_buffer);
                     }
+
+                    if(!audio_device.sound_device.handle)
+                        usleep(timeout_ms * 1000);
                 }
 
+                if(num_dropped_audio_frames > 0)
+                    fprintf(stderr, "Warning: audio encoding is too slow, dropped %d audio frame(s)\n", num_dropped_audio_frames);
+
                 if(swr)
                     swr_free(&swr);
             });
@@ -2444,60 +3713,210 @@ int main(int argc, char **argv) {
     }
 
     // Set update_fps to 24 to test if duplicate/delayed frames cause video/audio desync or too fast/slow video.
-    const double update_fps = fps + 190;
+    // When recording audio only the loop only handles the control socket and signals, the audio is encoded in the encoder threads
+    const double update_fps = audio_only ? 10.0 : fps + 190;
     bool should_stop_error = false;
 
-    AVFrame *aframe = av_frame_alloc();
-
     int64_t video_pts_counter = 0;
     int64_t video_prev_pts = 0;
+    uint64_t num_video_frames = 0;
+    int video_fps_counter = 0;
+    int video_fps = 0;
+    VideoCaptureTimes video_capture_times;
+    double capture_to_packet_latency = 0.0;
+    bool force_keyframe = false;
+
+    auto set_paused = [&](bool new_paused_state) {
+        if(new_paused_state == paused)
+            return;
 
-    while(running) {
-        double frame_start = clock_get_monotonic_seconds();
+        if(new_paused_state) {
+            paused_time_start = clock_get_monotonic_seconds();
+            fprintf(stderr, "Paused\n");
+        } else {
+            paused_time_offset += (clock_get_monotonic_seconds() - paused_time_start);
+            fprintf(stderr, "Unpaused\n");
+        }
+        paused = new_paused_state;
+    };
 
-        gsr_capture_tick(capture, video_codec_context, &frame);
-        should_stop_error = false;
-        if(gsr_capture_should_stop(capture, &should_stop_error)) {
-            running = 0;
-            break;
+    gsr_control_socket control_socket;
+    if(control_socket_path && gsr_control_socket_init(&control_socket, control_socket_path) != 0) {
+        fprintf(stderr, "Error: failed to create control socket at \"%s\"\n", control_socket_path);
+        _exit(1);
+    }
+
+    // The save replay response is sent when the replay has been saved
+    bool has_save_replay_command = false;
+    gsr_control_command save_replay_command;
+
+    auto get_stats = [&]() {
+        gsr_control_stats stats;
+        memset(&stats, 0, sizeof(stats));
+        const double time_now = clock_get_monotonic_seconds();
+        stats.recording_duration_seconds = time_now - record_start_time - paused_time_offset - (paused ? time_now - paused_time_start : 0.0);
+        stats.num_video_frames = num_video_frames;
+        stats.fps = video_fps;
+        stats.capture_to_packet_latency_seconds = capture_to_packet_latency;
+        if(use_network_output) {
+            gsr_network_output_stats network_stats;
+            gsr_network_output_get_stats(&network_output, &network_stats);
+            stats.packet_to_socket_latency_seconds = network_stats.video_send_latency_seconds;
+            stats.capture_to_socket_latency_seconds = network_stats.video_capture_to_socket_latency_seconds;
+        }
+        stats.paused = paused;
+        stats.saving_replay = save_replay_thread.valid();
+
+        if(replay_buffer_size_secs != -1) {
+            std::lock_guard<std::mutex> lock(write_output_mutex);
+            stats.replay_buffer_size_bytes = frame_data_queue_size_bytes;
+            if(!frame_data_queue.empty())
+                stats.replay_buffer_duration_seconds = frame_data_queue.back()->timestamp - frame_data_queue.front()->timestamp;
         }
-        ++fps_counter;
+        return stats;
+    };
 
-        {
-            std::lock_guard<std::mutex> lock(audio_filter_mutex);
-            for(AudioTrack &audio_track : audio_tracks) {
-                if(!audio_track.sink)
-                    continue;
-
-                int err = 0;
-                while ((err = av_buffersink_get_frame(audio_track.sink, aframe)) >= 0) {
-                    aframe->pts = audio_track.pts;
-                    err = avcodec_send_frame(audio_track.codec_context, aframe);
-                    if(err >= 0){
-                        // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                        receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, aframe->pts, av_format_context, record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex, paused_time_offset);
-                    } else {
-                        fprintf(stderr, "Failed to encode audio!\n");
-                    }
-                    av_frame_unref(aframe);
-                    audio_track.pts += audio_track.codec_context->frame_size;
+    auto handle_control_command = [&](const gsr_control_command &command) {
+        switch(command.request.type) {
+            case GSR_CONTROL_REQUEST_SAVE_REPLAY: {
+                if(replay_buffer_size_secs == -1) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_NOT_SUPPORTED, "not recording in replay mode (-r)", nullptr);
+                } else if(command.request.value < 0 || command.request.offset < 0) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_INVALID_REQUEST, "the duration and end offset can't be negative", nullptr);
+                } else if(save_replay_thread.valid()) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_BUSY, "a replay is already being saved", nullptr);
+                } else if(!save_replay_async(video_codec_context, VIDEO_STREAM_INDEX, audio_tracks, frame_data_queue, frames_erased, filename, container_format, file_extension, write_output_mutex, make_folders, command.request.value, command.request.offset, file_writer_params)) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_FAILED, "the requested part of the replay buffer doesn't contain a keyframe", nullptr);
+                } else {
+                    has_save_replay_command = true;
+                    save_replay_command = command;
+                }
+                break;
+            }
+            case GSR_CONTROL_REQUEST_PAUSE:
+            case GSR_CONTROL_REQUEST_RESUME: {
+                set_paused(command.request.type == GSR_CONTROL_REQUEST_PAUSE);
+                gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_OK, nullptr, nullptr);
+                break;
+            }
+            case GSR_CONTROL_REQUEST_GET_STATS: {
+                const gsr_control_stats stats = get_stats();
+                gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_OK, nullptr, &stats);
+                break;
+            }
+            case GSR_CONTROL_REQUEST_FORCE_KEYFRAME: {
+                if(audio_only) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_NOT_SUPPORTED, "only recording audio", nullptr);
+                    break;
+                }
+                force_keyframe = true;
+                gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_OK, nullptr, nullptr);
+                break;
+            }
+            case GSR_CONTROL_REQUEST_SET_BITRATE: {
+                if(audio_only) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_NOT_SUPPORTED, "only recording audio", nullptr);
+                } else if(video_bitrate.mode == BitrateMode::CQP) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_NOT_SUPPORTED, "the video is encoded with a constant quantizer (-bm cqp), the bitrate can't be changed", nullptr);
+                } else if(video_encoder == VideoEncoder::GPU && gpu_inf.vendor != GSR_GPU_VENDOR_NVIDIA) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_NOT_SUPPORTED, "vaapi doesn't support changing the bitrate while encoding", nullptr);
+                } else if(use_adaptive_bitrate) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_NOT_SUPPORTED, "the bitrate is controlled by -abr", nullptr);
+                } else if(command.request.value < 100) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_INVALID_REQUEST, "the bitrate has to be 100 kbps or higher", nullptr);
+                } else {
+                    video_codec_context_set_bitrate(video_codec_context, video_bitrate, command.request.value * 1000LL);
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_OK, nullptr, nullptr);
                 }
+                break;
+            }
+            case GSR_CONTROL_REQUEST_SET_FPS: {
+                if(audio_only) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_NOT_SUPPORTED, "only recording audio", nullptr);
+                } else if(framerate_mode != FramerateMode::VARIABLE) {
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_NOT_SUPPORTED, "the framerate can only be changed when using -fm vfr", nullptr);
+                } else if(command.request.value < 1 || command.request.value > fps) {
+                    char err_msg[128];
+                    snprintf(err_msg, sizeof(err_msg), "the framerate has to be between 1 and %d (-f)", fps);
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_INVALID_REQUEST, err_msg, nullptr);
+                } else {
+                    target_fps = 1.0 / (double)command.request.value;
+                    gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_OK, nullptr, nullptr);
+                }
+                break;
+            }
+            default: {
+                gsr_control_socket_send_response(&control_socket, &command, GSR_CONTROL_RESULT_INVALID_REQUEST, "unknown request type", nullptr);
+                break;
+            }
+        }
+    };
+
+    auto on_replay_saved = [&]() {
+        const bool saved = save_replay_thread.get();
+        if(saved) {
+            puts(save_replay_output_filepath.c_str());
+            fflush(stdout);
+            if(recording_saved_script)
+                run_recording_saved_script_async(recording_saved_script, save_replay_output_filepath.c_str(), "replay");
+        }
+
+        if(has_save_replay_command) {
+            if(saved)
+                gsr_control_socket_send_response(&control_socket, &save_replay_command, GSR_CONTROL_RESULT_OK, save_replay_output_filepath.c_str(), nullptr);
+            else
+                gsr_control_socket_send_response(&control_socket, &save_replay_command, GSR_CONTROL_RESULT_FAILED, "failed to save the replay", nullptr);
+            has_save_replay_command = false;
+        }
+
+        std::lock_guard<std::mutex> lock(write_output_mutex);
+        save_replay_packets.clear();
+    };
+
+    while(running) {
+        double frame_start = clock_get_monotonic_seconds();
+
+        if(capture) {
+            gsr_capture_tick(capture, video_codec_context, &frame);
+            should_stop_error = false;
+            if(gsr_capture_should_stop(capture, &should_stop_error)) {
+                running = 0;
+                break;
             }
         }
+        ++fps_counter;
 
         double time_now = clock_get_monotonic_seconds();
         double frame_timer_elapsed = time_now - frame_timer_start;
         double elapsed = time_now - start_time;
         if (elapsed >= 1.0) {
-            if(verbose) {
+            capture_to_packet_latency = video_capture_times.capture_to_packet_latency_count > 0 ? video_capture_times.capture_to_packet_latency_sum / video_capture_times.capture_to_packet_latency_count : 0.0;
+            video_capture_times.capture_to_packet_latency_sum = 0.0;
+            video_capture_times.capture_to_packet_latency_count = 0;
+
+            if(verbose && !audio_only) {
                 fprintf(stderr, "update fps: %d\n", fps_counter);
+                if(low_latency) {
+                    double packet_to_socket_latency = 0.0;
+                    double capture_to_socket_latency = 0.0;
+                    if(use_network_output) {
+                        gsr_network_output_stats network_stats;
+                        gsr_network_output_get_stats(&network_output, &network_stats);
+                        packet_to_socket_latency = network_stats.video_send_latency_seconds;
+                        capture_to_socket_latency = network_stats.video_capture_to_socket_latency_seconds;
+                    }
+                    fprintf(stderr, "latency: capture to packet: %.2f ms, packet to socket: %.2f ms, capture to socket: %.2f ms\n",
+                        capture_to_packet_latency * 1000.0, packet_to_socket_latency * 1000.0, capture_to_socket_latency * 1000.0);
+                }
             }
             start_time = time_now;
             fps_counter = 0;
+            video_fps = video_fps_counter;
+            video_fps_counter = 0;
         }
 
         double frame_time_overflow = frame_timer_elapsed - target_fps;
-        if (frame_time_overflow >= 0.0) {
+        if (capture && frame_time_overflow >= 0.0) {
             frame_time_overflow = std::min(frame_time_overflow, target_fps);
             frame_timer_start = time_now - frame_time_overflow;
 
@@ -2506,12 +3925,30 @@ int main(int argc, char **argv) {
             const int num_frames = framerate_mode == FramerateMode::CONSTANT ? std::max((int64_t)0LL, expected_frames - video_pts_counter) : 1;
 
             if(num_frames > 0 && !paused) {
+                // The network output dropped video because the connection was too slow, start from a keyframe to recover quickly
+                if(use_network_output && gsr_network_output_take_keyframe_request(&network_output))
+                    force_keyframe = true;
+
+                if(use_adaptive_bitrate) {
+                    gsr_network_output_stats network_stats;
+                    gsr_network_output_get_stats(&network_output, &network_stats);
+                    if(gsr_adaptive_bitrate_update(&adaptive_bitrate, &network_stats, max_stream_queue_latency_seconds, time_now)) {
+                        video_codec_context_set_bitrate(video_codec_context, video_bitrate, adaptive_bitrate.bitrate);
+                        fprintf(stderr, "Info: live stream adapted to the connection, video bitrate: %d kbps, fps: %d\n", (int)(adaptive_bitrate.bitrate / 1000), fps / adaptive_bitrate.fps_divider);
+                    }
+                }
+
+                const double capture_start_time = clock_get_monotonic_seconds();
                 gsr_capture_capture(capture, frame);
+                frame_set_region_of_interest(frame, region_of_interest, capture);
 
                 // TODO: Check if duplicate frame can be saved just by writing it with a different pts instead of sending it again
                 for(int i = 0; i < num_frames; ++i) {
                     if(framerate_mode == FramerateMode::CONSTANT) {
                         frame->pts = video_pts_counter + i;
+                        // Lower framerate to reduce the bitrate. The pts of the skipped frames are left as a gap, which the muxer and decoder handle fine
+                        if(use_adaptive_bitrate && frame->pts % adaptive_bitrate.fps_divider != 0)
+                            continue;
                     } else {
                         frame->pts = (this_video_frame_time - record_start_time) * (double)AV_TIME_BASE;
                         const bool same_pts = frame->pts == video_prev_pts;
@@ -2520,11 +3957,16 @@ int main(int argc, char **argv) {
                             continue;
                     }
 
+                    frame->pict_type = force_keyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+                    // Duplicated frames (cfr) are not captured again, they have the capture time of the frame they duplicate
+                    video_capture_times.add(frame->pts, capture_start_time);
                     int ret = avcodec_send_frame(video_codec_context, frame);
                     if(ret == 0) {
+                        force_keyframe = false;
+                        ++num_video_frames;
                         // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                        receive_frames(video_codec_context, VIDEO_STREAM_INDEX, video_stream, frame->pts, av_format_context,
-                            record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex, paused_time_offset);
+                        receive_frames(video_codec_context, VIDEO_STREAM_INDEX, video_stream, frame->pts, av_format_context, use_network_output ? &network_output : nullptr,
+                            record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, frame_data_queue_size_bytes, write_output_mutex, paused_time_offset, &video_capture_times);
                     } else {
                         fprintf(stderr, "Error: avcodec_send_frame failed, error: %s\n", av_error_to_string(ret));
                     }
@@ -2532,56 +3974,52 @@ int main(int argc, char **argv) {
 
                 gsr_capture_end(capture, frame);
                 video_pts_counter += num_frames;
+                ++video_fps_counter;
             }
         }
 
         if(toggle_pause == 1) {
-            const bool new_paused_state = !paused;
-            if(new_paused_state) {
-                paused_time_start = clock_get_monotonic_seconds();
-                fprintf(stderr, "Paused\n");
-            } else {
-                paused_time_offset += (clock_get_monotonic_seconds() - paused_time_start);
-                fprintf(stderr, "Unpaused\n");
-            }
-
             toggle_pause = 0;
-            paused = !paused;
+            set_paused(!paused);
         }
 
-        if(save_replay_thread.valid() && save_replay_thread.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
-            save_replay_thread.get();
-            puts(save_replay_output_filepath.c_str());
-            fflush(stdout);
-            if(recording_saved_script)
-                run_recording_saved_script_async(recording_saved_script, save_replay_output_filepath.c_str(), "replay");
-            std::lock_guard<std::mutex> lock(write_output_mutex);
-            save_replay_packets.clear();
+        if(control_socket_path) {
+            gsr_control_command command;
+            while(gsr_control_socket_pop_command(&control_socket, &command)) {
+                handle_control_command(command);
+            }
         }
 
+        if(save_replay_thread.valid() && save_replay_thread.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            on_replay_saved();
+
+        if(!recording_saved_script_pids.empty())
+            reap_recording_saved_scripts();
+
         if(save_replay == 1 && !save_replay_thread.valid() && replay_buffer_size_secs != -1) {
             save_replay = 0;
-            save_replay_async(video_codec_context, VIDEO_STREAM_INDEX, audio_tracks, frame_data_queue, frames_erased, filename, container_format, file_extension, write_output_mutex, make_folders);
+            save_replay_async(video_codec_context, VIDEO_STREAM_INDEX, audio_tracks, frame_data_queue, frames_erased, filename, container_format, file_extension, write_output_mutex, make_folders, 0.0, 0.0, file_writer_params);
         }
 
         double frame_end = clock_get_monotonic_seconds();
         double frame_sleep_fps = 1.0 / update_fps;
         double sleep_time = frame_sleep_fps - (frame_end - frame_start);
-        if(sleep_time > 0.0)
-            usleep(sleep_time * 1000.0 * 1000.0);
+        if(sleep_time > 0.0) {
+            // Wakes up as soon as a control command is received
+            if(control_socket_path)
+                gsr_control_socket_wait(&control_socket, sleep_time);
+            else
+                usleep(sleep_time * 1000.0 * 1000.0);
+        }
     }
 
     running = 0;
 
-    if(save_replay_thread.valid()) {
-        save_replay_thread.get();
-        puts(save_replay_output_filepath.c_str());
-        fflush(stdout);
-        if(recording_saved_script)
-            run_recording_saved_script_async(recording_saved_script, save_replay_output_filepath.c_str(), "replay");
-        std::lock_guard<std::mutex> lock(write_output_mutex);
-        save_replay_packets.clear();
-    }
+    if(save_replay_thread.valid())
+        on_replay_saved();
+
+    if(control_socket_path)
+        gsr_control_socket_deinit(&control_socket);
 
     for(AudioTrack &audio_track : audio_tracks) {
         for(AudioDevice &audio_device : audio_track.audio_devices) {
@@ -2590,18 +4028,43 @@ int main(int argc, char **argv) {
         }
     }
 
-    av_frame_free(&aframe);
+    // The audio devices have stopped, encode the remaining queued audio
+    audio_encoders_running = false;
+    for(AudioTrack &audio_track : audio_tracks) {
+        sem_post(&audio_track.encoder_sem);
+        audio_track.encoder_thread.join();
+        sem_destroy(&audio_track.encoder_sem);
+        for(AudioDevice &audio_device : audio_track.audio_devices) {
+            gsr_frame_queue_deinit(&audio_device.frame_queue);
+            gsr_frame_queue_deinit(&audio_device.free_frame_queue);
+        }
+        av_frame_free(&audio_track.silent_frame);
+    }
+
+    if(use_network_output)
+        gsr_network_output_stop(&network_output);
 
     if (replay_buffer_size_secs == -1 && av_write_trailer(av_format_context) != 0) {
         fprintf(stderr, "Failed to write trailer\n");
     }
 
-    if(replay_buffer_size_secs == -1 && !(output_format->flags & AVFMT_NOFILE))
+    if(use_pipe_writer) {
+        avio_flush(av_format_context->pb);
+        av_freep(&av_format_context->pb->buffer);
+        avio_context_free(&av_format_context->pb);
+        gsr_pipe_writer_deinit(&pipe_writer);
+    } else if(use_network_output) {
+        gsr_network_output_close(&network_output);
+    } else if(replay_buffer_size_secs == -1 && !(output_format->flags & AVFMT_NOFILE)) {
         avio_close(av_format_context->pb);
+    }
 
-    gsr_capture_destroy(capture, video_codec_context);
+    if(capture)
+        gsr_capture_destroy(capture, video_codec_context);
 
-    if(replay_buffer_size_secs == -1 && recording_saved_script)
+    if(replay_buffer_size_secs == -1 && faststart)
+        run_faststart_remux_async(filename, recording_saved_script);
+    else if(replay_buffer_size_secs == -1 && recording_saved_script)
         run_recording_saved_script_async(recording_saved_script, filename, "regular");
 
     if(dpy) {
@@ -2610,7 +4073,6 @@ int main(int argc, char **argv) {
     }
 
     free((void*)window_str);
-    free(empty_audio);
     // We do an _exit here because cuda uses at_exit to do _something_ that causes the program to freeze,
     // but only on some nvidia driver versions on some gpus (RTX?), and _exit exits the program without calling
     // the at_exit registered functions.
@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+#include "../include/network_output.h"
+#include "../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <libavformat/avformat.h>
+
+/*
+    Only keep a small amount of unsent data in the kernel socket buffer. The rest stays in our queue, where it can still be dropped
+    when the connection is too slow, and the queue length reflects how congested the connection is.
+*/
+#define TCP_NOTSENT_LOWAT_SIZE (128 * 1024)
+#define TCP_AVIO_BUFFER_SIZE (64 * 1024)
+
+static int connect_tcp(const char *url) {
+    /* tcp://host:port[?options] */
+    char host[256];
+    char port[32];
+    const char *host_start = url + 6;
+    const char *port_start = strrchr(host_start, ':');
+    if(!port_start || port_start == host_start || (size_t)(port_start - host_start) >= sizeof(host)) {
+        fprintf(stderr, "gsr error: gsr_network_output_open: expected url in the format tcp://host:port, got: %s\n", url);
+        return -1;
+    }
+
+    memcpy(host, host_start, port_start - host_start);
+    host[port_start - host_start] = '\0';
+    snprintf(port, sizeof(port), "%.*s", (int)strcspn(port_start + 1, "/?"), port_start + 1);
+
+    /* Allow ipv6 addresses in the format [::1] */
+    char *host_name = host;
+    const size_t host_len = strlen(host);
+    if(host_len >= 2 && host[0] == '[' && host[host_len - 1] == ']') {
+        host[host_len - 1] = '\0';
+        host_name = host + 1;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *addresses = NULL;
+    const int ret = getaddrinfo(host_name, port, &hints, &addresses);
+    if(ret != 0) {
+        fprintf(stderr, "gsr error: gsr_network_output_open: failed to resolve %s, error: %s\n", host_name, gai_strerror(ret));
+        return -1;
+    }
+
+    int fd = -1;
+    for(struct addrinfo *addr = addresses; addr; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+        if(fd == -1)
+            continue;
+
+        if(connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+
+    if(fd == -1) {
+        fprintf(stderr, "gsr error: gsr_network_output_open: failed to connect to %s:%s, error: %s\n", host_name, port, strerror(errno));
+        return -1;
+    }
+
+    const int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+#ifdef TCP_NOTSENT_LOWAT
+    const int notsent_lowat = TCP_NOTSENT_LOWAT_SIZE;
+    setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &notsent_lowat, sizeof(notsent_lowat));
+#endif
+    return fd;
+}
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+static int tcp_avio_write(void *opaque, const uint8_t *buf, int buf_size) {
+#else
+static int tcp_avio_write(void *opaque, uint8_t *buf, int buf_size) {
+#endif
+    gsr_network_output *self = opaque;
+    int sent = 0;
+    while(sent < buf_size) {
+        const ssize_t bytes_sent = send(self->tcp_fd, buf + sent, buf_size - sent, MSG_NOSIGNAL);
+        if(bytes_sent == -1) {
+            if(errno == EINTR)
+                continue;
+            return AVERROR(errno);
+        }
+        sent += bytes_sent;
+    }
+    return buf_size;
+}
+
+int gsr_network_output_open(gsr_network_output *self, AVFormatContext *format_context, const char *url, double max_queue_latency_seconds) {
+    memset(self, 0, sizeof(*self));
+    self->format_context = format_context;
+    self->max_queue_latency_seconds = max_queue_latency_seconds;
+    self->tcp_fd = -1;
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->cond, NULL);
+
+    if(strncmp(url, "tcp://", 6) == 0) {
+        self->tcp_fd = connect_tcp(url);
+        if(self->tcp_fd == -1)
+            return -1;
+
+        uint8_t *avio_buffer = av_malloc(TCP_AVIO_BUFFER_SIZE);
+        format_context->pb = avio_buffer ? avio_alloc_context(avio_buffer, TCP_AVIO_BUFFER_SIZE, 1, self, NULL, tcp_avio_write, NULL) : NULL;
+        if(!format_context->pb) {
+            fprintf(stderr, "gsr error: gsr_network_output_open: failed to create io context\n");
+            av_free(avio_buffer);
+            close(self->tcp_fd);
+            self->tcp_fd = -1;
+            return -1;
+        }
+        return 0;
+    }
+
+    AVDictionary *options = NULL;
+    /* These are only used by the protocols that support them (tcp is used by rtmp and http), the others ignore them */
+    av_dict_set(&options, "tcp_nodelay", "1", 0);
+    if(strncmp(url, "srt://", 6) == 0) {
+        av_dict_set(&options, "transtype", "live", 0);
+        av_dict_set(&options, "tlpktdrop", "1", 0);
+    }
+
+    const int ret = avio_open2(&format_context->pb, url, AVIO_FLAG_WRITE, NULL, &options);
+    av_dict_free(&options);
+    if(ret < 0) {
+        char err_msg[AV_ERROR_MAX_STRING_SIZE];
+        av_strerror(ret, err_msg, sizeof(err_msg));
+        fprintf(stderr, "gsr error: gsr_network_output_open: failed to open %s, error: %s\n", url, err_msg);
+        return -1;
+    }
+    return 0;
+}
+
+static gsr_network_output_entry* network_output_get_entry(gsr_network_output *self, int index) {
+    return &self->entries[(self->entries_start + index) % GSR_NETWORK_OUTPUT_MAX_QUEUED_PACKETS];
+}
+
+static void network_output_drop_entry(gsr_network_output *self, gsr_network_output_entry *entry) {
+    self->queued_bytes -= entry->packet->size;
+    av_packet_free(&entry->packet);
+    ++self->num_dropped_packets;
+}
+
+/*
+    Drops the video packets at the front of the queue up to the next queued keyframe (or all of them if there is no queued keyframe),
+    for when the start of their gop has been dropped. Audio packets are kept.
+*/
+static void network_output_drop_video_until_keyframe(gsr_network_output *self) {
+    int keyframe_index = self->num_entries;
+    for(int i = 0; i < self->num_entries; ++i) {
+        const gsr_network_output_entry *entry = network_output_get_entry(self, i);
+        if(entry->is_video && (entry->packet->flags & AV_PKT_FLAG_KEY)) {
+            keyframe_index = i;
+            break;
+        }
+    }
+
+    /* The kept audio packets are moved to the end of the range so that the front of the queue can be moved forward */
+    int num_removed = keyframe_index;
+    for(int i = keyframe_index - 1; i >= 0; --i) {
+        gsr_network_output_entry *entry = network_output_get_entry(self, i);
+        if(entry->is_video) {
+            network_output_drop_entry(self, entry);
+        } else {
+            --num_removed;
+            *network_output_get_entry(self, num_removed) = *entry;
+        }
+    }
+    self->entries_start = (self->entries_start + num_removed) % GSR_NETWORK_OUTPUT_MAX_QUEUED_PACKETS;
+    self->num_entries -= num_removed;
+}
+
+/*
+    The connection can't keep up. Drop the queued video packets after the newest queued keyframe (or all of them if there is no queued keyframe).
+    These belong to the newest gop, which stays decodable since only its end is removed. New video packets are dropped until the next keyframe.
+    Audio packets are kept unless the queue is still far behind after that, because gaps in audio are a lot more noticeable than frozen video.
+    In that case the oldest packets are dropped, and the rest of the gop of a dropped video packet with them since it can't be decoded without it.
+*/
+static void network_output_shed_load(gsr_network_output *self, double time_now) {
+    int newest_keyframe_index = -1;
+    for(int i = self->num_entries - 1; i >= 0; --i) {
+        const gsr_network_output_entry *entry = network_output_get_entry(self, i);
+        if(entry->is_video && (entry->packet->flags & AV_PKT_FLAG_KEY)) {
+            newest_keyframe_index = i;
+            break;
+        }
+    }
+
+    int num_kept = newest_keyframe_index + 1;
+    for(int i = newest_keyframe_index + 1; i < self->num_entries; ++i) {
+        gsr_network_output_entry *entry = network_output_get_entry(self, i);
+        if(entry->is_video) {
+            network_output_drop_entry(self, entry);
+        } else {
+            *network_output_get_entry(self, num_kept) = *entry;
+            ++num_kept;
+        }
+    }
+    self->num_entries = num_kept;
+
+    self->drop_until_keyframe = true;
+    self->keyframe_request_sent = false;
+
+    bool video_dropped = false;
+    while(self->num_entries > 0 && time_now - network_output_get_entry(self, 0)->enqueue_time > self->max_queue_latency_seconds * 4.0) {
+        gsr_network_output_entry *entry = network_output_get_entry(self, 0);
+        if(entry->is_video)
+            video_dropped = true;
+        network_output_drop_entry(self, entry);
+        self->entries_start = (self->entries_start + 1) % GSR_NETWORK_OUTPUT_MAX_QUEUED_PACKETS;
+        --self->num_entries;
+    }
+
+    if(video_dropped)
+        network_output_drop_video_until_keyframe(self);
+}
+
+static void* network_output_thread(void *userdata) {
+    gsr_network_output *self = userdata;
+
+    pthread_mutex_lock(&self->mutex);
+    for(;;) {
+        while(self->num_entries == 0 && !self->stop)
+            pthread_cond_wait(&self->cond, &self->mutex);
+
+        if(self->num_entries == 0 && self->stop)
+            break;
+
+        gsr_network_output_entry entry = *network_output_get_entry(self, 0);
+        self->entries_start = (self->entries_start + 1) % GSR_NETWORK_OUTPUT_MAX_QUEUED_PACKETS;
+        --self->num_entries;
+        self->queued_bytes -= entry.packet->size;
+        pthread_mutex_unlock(&self->mutex);
+
+        const int packet_size = entry.packet->size;
+        const int ret = av_write_frame(self->format_context, entry.packet);
+        av_packet_free(&entry.packet);
+        const double time_now = clock_get_monotonic_seconds();
+
+        pthread_mutex_lock(&self->mutex);
+        if(ret < 0 && time_now - self->last_error_time >= 1.0) {
+            char err_msg[AV_ERROR_MAX_STRING_SIZE];
+            av_strerror(ret, err_msg, sizeof(err_msg));
+            fprintf(stderr, "gsr error: network output: failed to send packet, error: %s\n", err_msg);
+            self->last_error_time = time_now;
+        }
+
+        self->send_second_bytes += packet_size;
+        if(entry.is_video) {
+            self->send_second_video_latency_sum += (time_now - entry.enqueue_time);
+            ++self->send_second_num_video_packets;
+            /* The muxer flushes every packet in low latency mode, otherwise this doesn't include the time spent in the io buffer */
+            if(entry.capture_time >= 0.0) {
+                self->send_second_video_capture_latency_sum += (time_now - entry.capture_time);
+                ++self->send_second_num_video_capture_packets;
+            }
+        }
+
+        if(time_now - self->send_second_start >= 1.0) {
+            self->send_bytes_per_second = self->send_second_bytes / (time_now - self->send_second_start);
+            self->video_send_latency_seconds = self->send_second_num_video_packets > 0 ? self->send_second_video_latency_sum / self->send_second_num_video_packets : 0.0;
+            self->video_capture_to_socket_latency_seconds = self->send_second_num_video_capture_packets > 0 ? self->send_second_video_capture_latency_sum / self->send_second_num_video_capture_packets : 0.0;
+            self->send_second_start = time_now;
+            self->send_second_bytes = 0;
+            self->send_second_video_latency_sum = 0.0;
+            self->send_second_num_video_packets = 0;
+            self->send_second_video_capture_latency_sum = 0.0;
+            self->send_second_num_video_capture_packets = 0;
+        }
+    }
+    pthread_mutex_unlock(&self->mutex);
+
+    return NULL;
+}
+
+int gsr_network_output_start(gsr_network_output *self) {
+    self->send_second_start = clock_get_monotonic_seconds();
+
+    if(pthread_create(&self->thread, NULL, network_output_thread, self) != 0) {
+        fprintf(stderr, "gsr error: gsr_network_output_start: failed to create thread\n");
+        return -1;
+    }
+    self->thread_started = true;
+    return 0;
+}
+
+void gsr_network_output_stop(gsr_network_output *self) {
+    if(!self->thread_started)
+        return;
+
+    pthread_mutex_lock(&self->mutex);
+    self->stop = true;
+    pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+    pthread_join(self->thread, NULL);
+    self->thread_started = false;
+}
+
+void gsr_network_output_close(gsr_network_output *self) {
+    if(self->tcp_fd != -1) {
+        avio_flush(self->format_context->pb);
+        av_freep(&self->format_context->pb->buffer);
+        avio_context_free(&self->format_context->pb);
+        close(self->tcp_fd);
+        self->tcp_fd = -1;
+    } else {
+        avio_closep(&self->format_context->pb);
+    }
+
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->mutex);
+}
+
+void gsr_network_output_push(gsr_network_output *self, const AVPacket *packet, bool is_video, double capture_time) {
+    /* Copy the packet data instead of referencing it, see the comment about packets not being freed in receive_frames */
+    AVPacket *packet_copy = av_packet_alloc();
+    if(!packet_copy)
+        return;
+
+    if(av_new_packet(packet_copy, packet->size) != 0 || av_packet_copy_props(packet_copy, packet) != 0) {
+        av_packet_free(&packet_copy);
+        return;
+    }
+    memcpy(packet_copy->data, packet->data, packet->size);
+
+    pthread_mutex_lock(&self->mutex);
+    const double time_now = clock_get_monotonic_seconds();
+
+    const bool is_keyframe = is_video && (packet->flags & AV_PKT_FLAG_KEY);
+    const bool congested = self->num_entries > 0 && time_now - network_output_get_entry(self, 0)->enqueue_time > self->max_queue_latency_seconds;
+    if(congested || self->num_entries == GSR_NETWORK_OUTPUT_MAX_QUEUED_PACKETS)
+        network_output_shed_load(self, time_now);
+
+    /* Everything after a keyframe can be decoded, so stop dropping video */
+    if(is_keyframe)
+        self->drop_until_keyframe = false;
+
+    /*
+        Ask for a keyframe once the connection has caught up, instead of waiting for the next gop. This is not done while still congested
+        since keyframes are large and would only make it worse
+    */
+    if(self->drop_until_keyframe && !congested && !self->keyframe_request_sent) {
+        self->keyframe_requested = true;
+        self->keyframe_request_sent = true;
+    }
+
+    if(self->num_entries == GSR_NETWORK_OUTPUT_MAX_QUEUED_PACKETS || (is_video && self->drop_until_keyframe)) {
+        av_packet_free(&packet_copy);
+        ++self->num_dropped_packets;
+        pthread_mutex_unlock(&self->mutex);
+        return;
+    }
+
+    gsr_network_output_entry *entry = network_output_get_entry(self, self->num_entries);
+    entry->packet = packet_copy;
+    entry->enqueue_time = time_now;
+    entry->capture_time = capture_time;
+    entry->is_video = is_video;
+    ++self->num_entries;
+    self->queued_bytes += packet_copy->size;
+
+    pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+void gsr_network_output_get_stats(gsr_network_output *self, gsr_network_output_stats *stats) {
+    pthread_mutex_lock(&self->mutex);
+    stats->queue_latency_seconds = self->num_entries > 0 ? clock_get_monotonic_seconds() - network_output_get_entry(self, 0)->enqueue_time : 0.0;
+    stats->queued_bytes = self->queued_bytes;
+    stats->send_bytes_per_second = self->send_bytes_per_second;
+    stats->video_send_latency_seconds = self->video_send_latency_seconds;
+    stats->video_capture_to_socket_latency_seconds = self->video_capture_to_socket_latency_seconds;
+    stats->num_dropped_packets = self->num_dropped_packets;
+    pthread_mutex_unlock(&self->mutex);
+}
+
+bool gsr_network_output_take_keyframe_request(gsr_network_output *self) {
+    pthread_mutex_lock(&self->mutex);
+    const bool keyframe_requested = self->keyframe_requested;
+    self->keyframe_requested = false;
+    pthread_mutex_unlock(&self->mutex);
+    return keyframe_requested;
+}
@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include "../include/pipe_writer.h"
+#include "../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/* Large enough to hold a couple of 4k high bitrate frames, the kernel limits this to /proc/sys/fs/pipe-max-size (1mb by default) for non-root users */
+#define PIPE_BUFFER_SIZE (1024 * 1024)
+
+static void* pipe_writer_thread(void *userdata) {
+    gsr_pipe_writer *self = userdata;
+
+    pthread_mutex_lock(&self->mutex);
+    for(;;) {
+        while(self->read_pos == self->write_pos && !self->stop)
+            pthread_cond_wait(&self->data_cond, &self->mutex);
+
+        if(self->read_pos == self->write_pos && self->stop)
+            break;
+
+        /* Write everything that is available in one go, which is at most two parts since the data can wrap around the end of the ring buffer */
+        const size_t read_index = self->read_pos % self->capacity;
+        const size_t available = self->write_pos - self->read_pos;
+        struct iovec iov[2];
+        int num_iov = 1;
+        iov[0].iov_base = self->buffer + read_index;
+        iov[0].iov_len = available;
+        if(read_index + available > self->capacity) {
+            iov[0].iov_len = self->capacity - read_index;
+            iov[1].iov_base = self->buffer;
+            iov[1].iov_len = available - iov[0].iov_len;
+            num_iov = 2;
+        }
+        pthread_mutex_unlock(&self->mutex);
+
+        const ssize_t bytes_written = writev(self->fd, iov, num_iov);
+
+        pthread_mutex_lock(&self->mutex);
+        if(bytes_written == -1) {
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "gsr error: pipe writer: failed to write to pipe, error: %s\n", strerror(errno));
+            self->failed = true;
+            pthread_cond_signal(&self->space_cond);
+            break;
+        }
+
+        self->read_pos += bytes_written;
+        pthread_cond_signal(&self->space_cond);
+    }
+    pthread_mutex_unlock(&self->mutex);
+
+    return NULL;
+}
+
+int gsr_pipe_writer_init(gsr_pipe_writer *self, int fd, size_t buffer_size) {
+    memset(self, 0, sizeof(*self));
+    self->fd = fd;
+    self->capacity = buffer_size;
+
+    /* This is only an optimization, the pipe works with the default size as well */
+    if(fcntl(fd, F_SETPIPE_SZ, PIPE_BUFFER_SIZE) == -1)
+        fprintf(stderr, "gsr warning: gsr_pipe_writer_init: failed to increase pipe buffer size, error: %s\n", strerror(errno));
+
+    self->buffer = malloc(buffer_size);
+    if(!self->buffer) {
+        fprintf(stderr, "gsr error: gsr_pipe_writer_init: failed to allocate %zu bytes\n", buffer_size);
+        return -1;
+    }
+
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->data_cond, NULL);
+    pthread_cond_init(&self->space_cond, NULL);
+
+    if(pthread_create(&self->thread, NULL, pipe_writer_thread, self) != 0) {
+        fprintf(stderr, "gsr error: gsr_pipe_writer_init: failed to create thread\n");
+        gsr_pipe_writer_deinit(self);
+        return -1;
+    }
+    self->thread_started = true;
+
+    return 0;
+}
+
+void gsr_pipe_writer_deinit(gsr_pipe_writer *self) {
+    if(self->thread_started) {
+        pthread_mutex_lock(&self->mutex);
+        self->stop = true;
+        pthread_cond_signal(&self->data_cond);
+        pthread_mutex_unlock(&self->mutex);
+        pthread_join(self->thread, NULL);
+        self->thread_started = false;
+    }
+
+    if(self->blocked_seconds > 0.0)
+        fprintf(stderr, "gsr info: pipe writer: waited %.2f seconds in total for the output pipe reader\n", self->blocked_seconds);
+
+    if(self->buffer) {
+        pthread_cond_destroy(&self->space_cond);
+        pthread_cond_destroy(&self->data_cond);
+        pthread_mutex_destroy(&self->mutex);
+        free(self->buffer);
+        self->buffer = NULL;
+    }
+}
+
+int gsr_pipe_writer_write(gsr_pipe_writer *self, const uint8_t *data, size_t size) {
+    pthread_mutex_lock(&self->mutex);
+    while(size > 0) {
+        if(self->failed) {
+            pthread_mutex_unlock(&self->mutex);
+            return -1;
+        }
+
+        size_t space = self->capacity - (size_t)(self->write_pos - self->read_pos);
+        if(space == 0) {
+            /* Backpressure: the reader is slower than we produce data */
+            const double wait_start = clock_get_monotonic_seconds();
+            while(self->write_pos - self->read_pos == self->capacity && !self->failed)
+                pthread_cond_wait(&self->space_cond, &self->mutex);
+
+            const double time_now = clock_get_monotonic_seconds();
+            self->blocked_seconds += (time_now - wait_start);
+            if(time_now - self->last_blocked_warning_time >= 5.0) {
+                fprintf(stderr, "gsr warning: pipe writer: the program reading the output is too slow, recording is stalled until it catches up\n");
+                self->last_blocked_warning_time = time_now;
+            }
+            continue;
+        }
+
+        const size_t write_index = self->write_pos % self->capacity;
+        size_t to_copy = size < space ? size : space;
+        if(to_copy > self->capacity - write_index)
+            to_copy = self->capacity - write_index;
+
+        memcpy(self->buffer + write_index, data, to_copy);
+        self->write_pos += to_copy;
+        data += to_copy;
+        size -= to_copy;
+        pthread_cond_signal(&self->data_cond);
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return 0;
+}
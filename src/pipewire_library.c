@@ -0,0 +1,80 @@
+#include "../include/pipewire_library.h"
+#include "../include/library_loader.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+
+bool gsr_pipewire_library_load(gsr_pipewire_library *self) {
+    memset(self, 0, sizeof(gsr_pipewire_library));
+
+    dlerror(); /* clear */
+    void *lib = dlopen("libpipewire-0.3.so.0", RTLD_LAZY);
+    if(!lib) {
+        fprintf(stderr, "gsr error: gsr_pipewire_library_load: failed to load libpipewire-0.3.so.0, error: %s\n", dlerror());
+        return false;
+    }
+
+    dlsym_assign required_dlsym[] = {
+        { (void**)&self->pw_init, "pw_init" },
+
+        { (void**)&self->pw_thread_loop_new, "pw_thread_loop_new" },
+        { (void**)&self->pw_thread_loop_destroy, "pw_thread_loop_destroy" },
+        { (void**)&self->pw_thread_loop_start, "pw_thread_loop_start" },
+        { (void**)&self->pw_thread_loop_stop, "pw_thread_loop_stop" },
+        { (void**)&self->pw_thread_loop_lock, "pw_thread_loop_lock" },
+        { (void**)&self->pw_thread_loop_unlock, "pw_thread_loop_unlock" },
+        { (void**)&self->pw_thread_loop_signal, "pw_thread_loop_signal" },
+        { (void**)&self->pw_thread_loop_timed_wait, "pw_thread_loop_timed_wait" },
+        { (void**)&self->pw_thread_loop_get_loop, "pw_thread_loop_get_loop" },
+
+        { (void**)&self->pw_main_loop_new, "pw_main_loop_new" },
+        { (void**)&self->pw_main_loop_destroy, "pw_main_loop_destroy" },
+        { (void**)&self->pw_main_loop_get_loop, "pw_main_loop_get_loop" },
+        { (void**)&self->pw_main_loop_run, "pw_main_loop_run" },
+        { (void**)&self->pw_main_loop_quit, "pw_main_loop_quit" },
+
+        { (void**)&self->pw_context_new, "pw_context_new" },
+        { (void**)&self->pw_context_destroy, "pw_context_destroy" },
+        { (void**)&self->pw_context_connect, "pw_context_connect" },
+        { (void**)&self->pw_context_connect_fd, "pw_context_connect_fd" },
+        { (void**)&self->pw_core_disconnect, "pw_core_disconnect" },
+        { (void**)&self->pw_proxy_destroy, "pw_proxy_destroy" },
+
+        { (void**)&self->pw_properties_new, "pw_properties_new" },
+        { (void**)&self->pw_properties_set, "pw_properties_set" },
+        { (void**)&self->pw_properties_setf, "pw_properties_setf" },
+
+        { (void**)&self->pw_stream_new, "pw_stream_new" },
+        { (void**)&self->pw_stream_new_simple, "pw_stream_new_simple" },
+        { (void**)&self->pw_stream_add_listener, "pw_stream_add_listener" },
+        { (void**)&self->pw_stream_destroy, "pw_stream_destroy" },
+        { (void**)&self->pw_stream_connect, "pw_stream_connect" },
+        { (void**)&self->pw_stream_disconnect, "pw_stream_disconnect" },
+        { (void**)&self->pw_stream_update_params, "pw_stream_update_params" },
+        { (void**)&self->pw_stream_state_as_string, "pw_stream_state_as_string" },
+        { (void**)&self->pw_stream_dequeue_buffer, "pw_stream_dequeue_buffer" },
+        { (void**)&self->pw_stream_queue_buffer, "pw_stream_queue_buffer" },
+
+        { NULL, NULL }
+    };
+
+    if(!dlsym_load_list(lib, required_dlsym)) {
+        fprintf(stderr, "gsr error: gsr_pipewire_library_load failed: missing required symbols in libpipewire-0.3.so.0\n");
+        dlclose(lib);
+        memset(self, 0, sizeof(gsr_pipewire_library));
+        return false;
+    }
+
+    self->library = lib;
+    self->pw_init(NULL, NULL);
+    return true;
+}
+
+void gsr_pipewire_library_unload(gsr_pipewire_library *self) {
+    if(self->library) {
+        dlclose(self->library);
+        self->library = NULL;
+    }
+    memset(self, 0, sizeof(gsr_pipewire_library));
+}
@@ -1,7 +1,23 @@
 #include "../include/shader.h"
+#include "../include/utils.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
 #include <assert.h>
 
+#define SHADER_CACHE_MAGIC 0x53525347 /* "GSRS" */
+#define SHADER_CACHE_VERSION 1
+#define SHADER_CACHE_MAX_BINARY_SIZE (16 * 1024 * 1024)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t binary_format;
+    uint32_t binary_size;
+} shader_cache_header;
+
 static int min_int(int a, int b) {
     return a < b ? a : b;
 }
@@ -35,9 +51,10 @@ static unsigned int loader_shader(gsr_egl *egl, unsigned int type, const char *s
     return shader_id;
 }
 
-static unsigned int load_program(gsr_egl *egl, const char *vertex_shader, const char *fragment_shader) {
+static unsigned int load_program(gsr_egl *egl, const char *vertex_shader, const char *fragment_shader, const char *compute_shader) {
     unsigned int vertex_shader_id = 0;
     unsigned int fragment_shader_id = 0;
+    unsigned int compute_shader_id = 0;
     unsigned int program_id = 0;
     int linked = 0;
 
@@ -53,6 +70,12 @@ static unsigned int load_program(gsr_egl *egl, const char *vertex_shader, const
             goto err;
     }
 
+    if(compute_shader) {
+        compute_shader_id = loader_shader(egl, GL_COMPUTE_SHADER, compute_shader);
+        if(compute_shader_id == 0)
+            goto err;
+    }
+
     program_id = egl->glCreateProgram();
     if(program_id == 0) {
         fprintf(stderr, "gsr error: load_program: failed to create shader program, error: %d\n", egl->glGetError());
@@ -64,6 +87,11 @@ static unsigned int load_program(gsr_egl *egl, const char *vertex_shader, const
 
     if(fragment_shader_id)
         egl->glAttachShader(program_id, fragment_shader_id);
+    if(compute_shader_id)
+        egl->glAttachShader(program_id, compute_shader_id);
+
+    if(egl->glProgramParameteri)
+        egl->glProgramParameteri(program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
     egl->glLinkProgram(program_id);
 
@@ -81,6 +109,8 @@ static unsigned int load_program(gsr_egl *egl, const char *vertex_shader, const
         goto err;
     }
 
+    if(compute_shader_id)
+        egl->glDeleteShader(compute_shader_id);
     if(fragment_shader_id)
         egl->glDeleteShader(fragment_shader_id);
     if(vertex_shader_id)
@@ -91,6 +121,8 @@ static unsigned int load_program(gsr_egl *egl, const char *vertex_shader, const
     err:
     if(program_id)
         egl->glDeleteProgram(program_id);
+    if(compute_shader_id)
+        egl->glDeleteShader(compute_shader_id);
     if(fragment_shader_id)
         egl->glDeleteShader(fragment_shader_id);
     if(vertex_shader_id)
@@ -98,21 +130,193 @@ static unsigned int load_program(gsr_egl *egl, const char *vertex_shader, const
     return 0;
 }
 
-int gsr_shader_init(gsr_shader *self, gsr_egl *egl, const char *vertex_shader, const char *fragment_shader) {
+static uint64_t fnv1a_hash(uint64_t hash, const char *data) {
+    if(!data)
+        data = "";
+
+    /* The null terminator is included so that ("ab", "c") and ("a", "bc") give different hashes */
+    for(;;) {
+        hash ^= (unsigned char)*data;
+        hash *= 0x100000001b3ULL;
+        if(*data == '\0')
+            break;
+        ++data;
+    }
+    return hash;
+}
+
+static bool shader_cache_get_directory(char *directory, size_t directory_size) {
+    const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+    if(xdg_cache_home && xdg_cache_home[0] == '/')
+        return snprintf(directory, directory_size, "%s/gpu-screen-recorder/shaders", xdg_cache_home) < (int)directory_size;
+
+    const char *home = getenv("HOME");
+    if(!home || home[0] == '\0')
+        return false;
+
+    return snprintf(directory, directory_size, "%s/.cache/gpu-screen-recorder/shaders", home) < (int)directory_size;
+}
+
+/* The cache key is the driver (vendor, renderer and version string, which contains the driver version) and the shader source code */
+static bool shader_cache_get_filepath(gsr_egl *egl, const char *vertex_shader, const char *fragment_shader, const char *compute_shader, char *directory, size_t directory_size, char *filepath, size_t filepath_size) {
+    if(!egl->glGetProgramBinary || !egl->glProgramBinary || !egl->glProgramParameteri)
+        return false;
+
+    if(!shader_cache_get_directory(directory, directory_size))
+        return false;
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = fnv1a_hash(hash, (const char*)egl->glGetString(GL_VENDOR));
+    hash = fnv1a_hash(hash, (const char*)egl->glGetString(GL_RENDERER));
+    hash = fnv1a_hash(hash, (const char*)egl->glGetString(GL_VERSION));
+    hash = fnv1a_hash(hash, vertex_shader);
+    hash = fnv1a_hash(hash, fragment_shader);
+    hash = fnv1a_hash(hash, compute_shader);
+
+    return snprintf(filepath, filepath_size, "%s/%016llx.bin", directory, (unsigned long long)hash) < (int)filepath_size;
+}
+
+static unsigned int load_program_from_cache(gsr_egl *egl, const char *filepath) {
+    unsigned int program_id = 0;
+    void *binary = NULL;
+
+    FILE *file = fopen(filepath, "rb");
+    if(!file)
+        return 0;
+
+    shader_cache_header header;
+    if(fread(&header, 1, sizeof(header), file) != sizeof(header))
+        goto done;
+
+    if(header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.binary_size == 0 || header.binary_size > SHADER_CACHE_MAX_BINARY_SIZE)
+        goto done;
+
+    binary = malloc(header.binary_size);
+    if(!binary)
+        goto done;
+
+    if(fread(binary, 1, header.binary_size, file) != header.binary_size)
+        goto done;
+
+    program_id = egl->glCreateProgram();
+    if(program_id == 0)
+        goto done;
+
+    while(egl->glGetError()) {}
+    egl->glProgramBinary(program_id, header.binary_format, binary, header.binary_size);
+
+    int linked = 0;
+    egl->glGetProgramiv(program_id, GL_LINK_STATUS, &linked);
+    if(egl->glGetError() != 0 || !linked) {
+        /* The driver rejects the binary if it was created by another driver build, remove it so that it gets recreated */
+        egl->glDeleteProgram(program_id);
+        program_id = 0;
+        remove(filepath);
+    }
+
+    done:
+    free(binary);
+    fclose(file);
+    return program_id;
+}
+
+static void save_program_to_cache(gsr_egl *egl, unsigned int program_id, char *directory, const char *filepath) {
+    int binary_size = 0;
+    egl->glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &binary_size);
+    if(binary_size <= 0 || binary_size > SHADER_CACHE_MAX_BINARY_SIZE)
+        return;
+
+    void *binary = malloc(binary_size);
+    if(!binary)
+        return;
+
+    int binary_length = 0;
+    unsigned int binary_format = 0;
+    while(egl->glGetError()) {}
+    egl->glGetProgramBinary(program_id, binary_size, &binary_length, &binary_format, binary);
+    if(egl->glGetError() != 0 || binary_length <= 0) {
+        free(binary);
+        return;
+    }
+
+    if(create_directory_recursive(directory) != 0) {
+        free(binary);
+        return;
+    }
+
+    /* Write to a temporary file and rename it so that another instance never reads a partially written file */
+    char tmp_filepath[PATH_MAX];
+    if(snprintf(tmp_filepath, sizeof(tmp_filepath), "%s.%d.tmp", filepath, (int)getpid()) >= (int)sizeof(tmp_filepath)) {
+        free(binary);
+        return;
+    }
+
+    FILE *file = fopen(tmp_filepath, "wb");
+    if(!file) {
+        free(binary);
+        return;
+    }
+
+    const shader_cache_header header = {
+        .magic = SHADER_CACHE_MAGIC,
+        .version = SHADER_CACHE_VERSION,
+        .binary_format = binary_format,
+        .binary_size = binary_length
+    };
+
+    const bool written = fwrite(&header, 1, sizeof(header), file) == sizeof(header) && fwrite(binary, 1, binary_length, file) == (size_t)binary_length;
+    if(fclose(file) == 0 && written)
+        rename(tmp_filepath, filepath);
+    else
+        remove(tmp_filepath);
+
+    free(binary);
+}
+
+static int gsr_shader_init_program(gsr_shader *self, gsr_egl *egl, const char *vertex_shader, const char *fragment_shader, const char *compute_shader) {
     assert(egl);
     self->egl = egl;
     self->program_id = 0;
 
+    char cache_directory[PATH_MAX];
+    char cache_filepath[PATH_MAX];
+    const bool use_cache = shader_cache_get_filepath(self->egl, vertex_shader, fragment_shader, compute_shader, cache_directory, sizeof(cache_directory), cache_filepath, sizeof(cache_filepath));
+    if(use_cache) {
+        self->program_id = load_program_from_cache(self->egl, cache_filepath);
+        if(self->program_id != 0)
+            return 0;
+    }
+
+    self->program_id = load_program(self->egl, vertex_shader, fragment_shader, compute_shader);
+    if(self->program_id == 0)
+        return -1;
+
+    if(use_cache)
+        save_program_to_cache(self->egl, self->program_id, cache_directory, cache_filepath);
+
+    return 0;
+}
+
+int gsr_shader_init(gsr_shader *self, gsr_egl *egl, const char *vertex_shader, const char *fragment_shader) {
     if(!vertex_shader && !fragment_shader) {
+        self->egl = NULL;
+        self->program_id = 0;
         fprintf(stderr, "gsr error: gsr_shader_init: vertex shader and fragment shader can't be NULL at the same time\n");
         return -1;
     }
 
-    self->program_id = load_program(self->egl, vertex_shader, fragment_shader);
-    if(self->program_id == 0)
+    return gsr_shader_init_program(self, egl, vertex_shader, fragment_shader, NULL);
+}
+
+int gsr_shader_init_compute(gsr_shader *self, gsr_egl *egl, const char *compute_shader) {
+    if(!compute_shader) {
+        self->egl = NULL;
+        self->program_id = 0;
+        fprintf(stderr, "gsr error: gsr_shader_init_compute: compute shader can't be NULL\n");
         return -1;
+    }
 
-    return 0;
+    return gsr_shader_init_program(self, egl, NULL, NULL, compute_shader);
 }
 
 void gsr_shader_deinit(gsr_shader *self) {
@@ -1,4 +1,5 @@
 #include "../include/sound.hpp"
+#include "../include/sound_pipewire.hpp"
 extern "C" {
 #include "../include/utils.h"
 }
@@ -14,6 +15,8 @@ extern "C" {
 #include <pulse/xmalloc.h>
 #include <pulse/error.h>
 
+static SoundBackend sound_backend = SOUND_BACKEND_PULSEAUDIO;
+
 #define CHECK_DEAD_GOTO(p, rerror, label)                               \
     do {                                                                \
         if (!(p)->context || !PA_CONTEXT_IS_GOOD(pa_context_get_state((p)->context)) || \
@@ -247,7 +250,28 @@ static int audio_format_to_get_bytes_per_sample(AudioFormat audio_format) {
     return 2;
 }
 
+bool sound_backend_init(SoundBackend backend) {
+    if(backend == SOUND_BACKEND_PIPEWIRE && !pipewire_load())
+        return false;
+
+    sound_backend = backend;
+    return true;
+}
+
 int sound_device_get_by_name(SoundDevice *device, const char *device_name, const char *description, unsigned int num_channels, unsigned int period_frame_size, AudioFormat audio_format) {
+    if(sound_backend == SOUND_BACKEND_PIPEWIRE) {
+        void *handle = pipewire_sound_device_new(device_name, description, num_channels, period_frame_size, audio_format);
+        if(!handle) {
+            fprintf(stderr, "pipewire_sound_device_new() failed. Audio input device %s might not be valid\n", description);
+            return -1;
+        }
+
+        device->handle = handle;
+        device->frames = period_frame_size;
+        device->backend = SOUND_BACKEND_PIPEWIRE;
+        return 0;
+    }
+
     pa_sample_spec ss;
     ss.format = audio_format_to_pulse_audio_format(audio_format);
     ss.rate = 48000;
@@ -269,16 +293,29 @@ int sound_device_get_by_name(SoundDevice *device, const char *device_name, const
 
     device->handle = handle;
     device->frames = period_frame_size;
+    device->backend = SOUND_BACKEND_PULSEAUDIO;
     return 0;
 }
 
 void sound_device_close(SoundDevice *device) {
-    if(device->handle)
-        pa_sound_device_free((pa_handle*)device->handle);
+    if(device->handle) {
+        if(device->backend == SOUND_BACKEND_PIPEWIRE)
+            pipewire_sound_device_free(device->handle);
+        else
+            pa_sound_device_free((pa_handle*)device->handle);
+    }
     device->handle = NULL;
 }
 
 int sound_device_read_next_chunk(SoundDevice *device, void **buffer) {
+    if(device->backend == SOUND_BACKEND_PIPEWIRE) {
+        const void *data = pipewire_sound_device_read(device->handle);
+        if(!data)
+            return -1;
+        *buffer = (void*)data;
+        return device->frames;
+    }
+
     pa_handle *pa = (pa_handle*)device->handle;
     if(pa_sound_device_read(pa) < 0) {
         //fprintf(stderr, "pa_simple_read() failed: %s\n", pa_strerror(error));
@@ -359,3 +396,7 @@ std::vector<AudioInput> get_pulseaudio_inputs() {
     pa_mainloop_free(main_loop);
     return inputs;
 }
+
+std::vector<AudioInput> get_pipewire_inputs() {
+    return pipewire_get_inputs();
+}
@@ -0,0 +1,410 @@
+#include "../include/sound_pipewire.hpp"
+extern "C" {
+#include "../include/pipewire_library.h"
+}
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <semaphore.h>
+
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+
+static gsr_pipewire_library pw;
+
+bool pipewire_load() {
+    if(pw.library)
+        return true;
+    return gsr_pipewire_library_load(&pw);
+}
+
+struct pw_handle {
+    struct pw_thread_loop *thread_loop;
+    struct pw_stream *stream;
+    std::atomic<int> state; /* enum pw_stream_state */
+
+    /*
+        Lock-free single producer, single consumer ring buffer. The pipewire real-time thread writes to it and
+        |pipewire_sound_device_read| reads from it. The positions are never wrapped, the index is position % ring_size.
+    */
+    uint8_t *ring_data;
+    size_t ring_size;
+    std::atomic<uint64_t> write_pos;
+    char padding[56]; /* Keep the positions in different cache lines */
+    std::atomic<uint64_t> read_pos;
+    uint64_t num_dropped_bytes; /* Only accessed by the real-time thread until the stream is destroyed */
+    sem_t data_sem;
+
+    uint8_t *output_data;
+    size_t output_length;
+    int64_t timeout_ms;
+};
+
+static void ring_write(pw_handle *p, const uint8_t *data, size_t size) {
+    const uint64_t write_pos = p->write_pos.load(std::memory_order_relaxed);
+    const uint64_t read_pos = p->read_pos.load(std::memory_order_acquire);
+    const size_t space = p->ring_size - (size_t)(write_pos - read_pos);
+    if(size > space) {
+        /* The reader is too slow, drop the newest audio rather than block the real-time thread */
+        p->num_dropped_bytes += size - space;
+        size = space;
+    }
+
+    const size_t index = write_pos % p->ring_size;
+    const size_t first_part = std::min(size, p->ring_size - index);
+    memcpy(p->ring_data + index, data, first_part);
+    memcpy(p->ring_data, data + first_part, size - first_part);
+    p->write_pos.store(write_pos + size, std::memory_order_release);
+}
+
+static void ring_read(pw_handle *p, uint8_t *data, size_t size) {
+    const uint64_t read_pos = p->read_pos.load(std::memory_order_relaxed);
+    const size_t index = read_pos % p->ring_size;
+    const size_t first_part = std::min(size, p->ring_size - index);
+    memcpy(data, p->ring_data + index, first_part);
+    memcpy(data + first_part, p->ring_data, size - first_part);
+    p->read_pos.store(read_pos + size, std::memory_order_release);
+}
+
+static void pw_on_state_changed(void *userdata, enum pw_stream_state old, enum pw_stream_state state, const char *error) {
+    (void)old;
+    pw_handle *p = (pw_handle*)userdata;
+    p->state.store(state);
+    if(state == PW_STREAM_STATE_ERROR)
+        fprintf(stderr, "gsr error: pipewire stream failed, error: %s\n", error ? error : "(null)");
+    pw.pw_thread_loop_signal(p->thread_loop, false);
+}
+
+/* Called from the pipewire real-time thread because of PW_STREAM_FLAG_RT_PROCESS, so this can't block or allocate */
+static void pw_on_process(void *userdata) {
+    pw_handle *p = (pw_handle*)userdata;
+    struct pw_buffer *buffer = pw.pw_stream_dequeue_buffer(p->stream);
+    if(!buffer)
+        return;
+
+    struct spa_data *data = &buffer->buffer->datas[0];
+    if(data->data && data->chunk) {
+        const uint32_t offset = std::min(data->chunk->offset, data->maxsize);
+        const uint32_t size = std::min(data->chunk->size, data->maxsize - offset);
+        if(size > 0) {
+            ring_write(p, (const uint8_t*)data->data + offset, size);
+            sem_post(&p->data_sem);
+        }
+    }
+
+    pw.pw_stream_queue_buffer(p->stream, buffer);
+}
+
+static struct pw_stream_events make_stream_events() {
+    struct pw_stream_events events;
+    memset(&events, 0, sizeof(events));
+    events.version = PW_VERSION_STREAM_EVENTS;
+    events.state_changed = pw_on_state_changed;
+    events.process = pw_on_process;
+    return events;
+}
+
+static const struct pw_stream_events stream_events = make_stream_events();
+
+static enum spa_audio_format audio_format_to_spa_audio_format(AudioFormat audio_format) {
+    switch(audio_format) {
+        case S16: return SPA_AUDIO_FORMAT_S16_LE;
+        case S32: return SPA_AUDIO_FORMAT_S32_LE;
+        case F32: return SPA_AUDIO_FORMAT_F32_LE;
+    }
+    assert(false);
+    return SPA_AUDIO_FORMAT_S16_LE;
+}
+
+static int audio_format_get_bytes_per_sample(AudioFormat audio_format) {
+    switch(audio_format) {
+        case S16: return 2;
+        case S32: return 4;
+        case F32: return 4;
+    }
+    assert(false);
+    return 2;
+}
+
+static bool string_ends_with(const char *str, const char *substr) {
+    const size_t len = strlen(str);
+    const size_t substr_len = strlen(substr);
+    return len >= substr_len && memcmp(str + len - substr_len, substr, substr_len) == 0;
+}
+
+void pipewire_sound_device_free(void *handle) {
+    pw_handle *p = (pw_handle*)handle;
+
+    if(p->thread_loop) {
+        pw.pw_thread_loop_lock(p->thread_loop);
+        if(p->stream) {
+            pw.pw_stream_destroy(p->stream);
+            p->stream = NULL;
+        }
+        pw.pw_thread_loop_unlock(p->thread_loop);
+        pw.pw_thread_loop_stop(p->thread_loop);
+        pw.pw_thread_loop_destroy(p->thread_loop);
+        p->thread_loop = NULL;
+    }
+
+    if(p->num_dropped_bytes > 0)
+        fprintf(stderr, "gsr warning: pipewire: %" PRIu64 " bytes of audio were dropped because the audio was not read fast enough\n", p->num_dropped_bytes);
+
+    sem_destroy(&p->data_sem);
+    free(p->ring_data);
+    free(p->output_data);
+    delete p;
+}
+
+void* pipewire_sound_device_new(const char *device_name, const char *description, unsigned int num_channels, unsigned int period_frame_size, AudioFormat audio_format) {
+    const unsigned int sample_rate = 48000;
+    const size_t frame_bytes = num_channels * audio_format_get_bytes_per_sample(audio_format);
+
+    pw_handle *p = new pw_handle();
+    p->state.store(PW_STREAM_STATE_UNCONNECTED);
+    sem_init(&p->data_sem, 0, 0);
+    p->output_length = period_frame_size * frame_bytes;
+    p->output_data = (uint8_t*)malloc(p->output_length);
+    /* One second of audio, a multiple of the frame size so that a frame is never split when audio is dropped */
+    p->ring_size = sample_rate * frame_bytes;
+    p->ring_data = (uint8_t*)malloc(p->ring_size);
+    p->timeout_ms = std::round((1000.0 / (double)sample_rate) * 1000.0);
+    if(!p->output_data || !p->ring_data) {
+        pipewire_sound_device_free(p);
+        return NULL;
+    }
+
+    p->thread_loop = pw.pw_thread_loop_new("gsr audio", NULL);
+    if(!p->thread_loop || pw.pw_thread_loop_start(p->thread_loop) < 0) {
+        fprintf(stderr, "gsr error: pipewire_sound_device_new: failed to create thread loop\n");
+        pipewire_sound_device_free(p);
+        return NULL;
+    }
+
+    struct pw_properties *props = pw.pw_properties_new(NULL, NULL);
+    pw.pw_properties_set(props, PW_KEY_MEDIA_TYPE, "Audio");
+    pw.pw_properties_set(props, PW_KEY_MEDIA_CATEGORY, "Capture");
+    pw.pw_properties_set(props, PW_KEY_APP_NAME, "gpu-screen-recorder");
+    pw.pw_properties_set(props, PW_KEY_NODE_NAME, "gpu-screen-recorder");
+    pw.pw_properties_set(props, PW_KEY_NODE_DESCRIPTION, description);
+    pw.pw_properties_set(props, PW_KEY_NODE_DONT_RECONNECT, "true");
+    /* Ask for a quantum of one encoder frame so that every process call gives (about) one period of audio */
+    pw.pw_properties_setf(props, PW_KEY_NODE_LATENCY, "%u/%u", period_frame_size, sample_rate);
+
+    std::string target_name = device_name;
+    if(string_ends_with(device_name, ".monitor")) {
+        target_name.erase(target_name.size() - 8);
+        pw.pw_properties_set(props, PW_KEY_STREAM_CAPTURE_SINK, "true");
+    }
+    /* "target.object" replaced "node.target" in pipewire 0.3.44, set both to support older versions */
+    pw.pw_properties_set(props, "target.object", target_name.c_str());
+    pw.pw_properties_set(props, "node.target", target_name.c_str());
+
+    uint8_t pod_buffer[1024];
+    struct spa_pod_builder pod_builder = SPA_POD_BUILDER_INIT(pod_buffer, sizeof(pod_buffer));
+    struct spa_audio_info_raw audio_info;
+    memset(&audio_info, 0, sizeof(audio_info));
+    audio_info.format = audio_format_to_spa_audio_format(audio_format);
+    audio_info.rate = sample_rate;
+    audio_info.channels = num_channels;
+    if(num_channels == 2) {
+        audio_info.position[0] = SPA_AUDIO_CHANNEL_FL;
+        audio_info.position[1] = SPA_AUDIO_CHANNEL_FR;
+    } else {
+        audio_info.position[0] = SPA_AUDIO_CHANNEL_MONO;
+    }
+    const struct spa_pod *params[1];
+    params[0] = spa_format_audio_raw_build(&pod_builder, SPA_PARAM_EnumFormat, &audio_info);
+
+    pw.pw_thread_loop_lock(p->thread_loop);
+
+    /* |props| is owned by the stream, even on failure */
+    p->stream = pw.pw_stream_new_simple(pw.pw_thread_loop_get_loop(p->thread_loop), description, props, &stream_events, p);
+    if(!p->stream) {
+        fprintf(stderr, "gsr error: pipewire_sound_device_new: failed to create stream for audio input device %s\n", description);
+        pw.pw_thread_loop_unlock(p->thread_loop);
+        pipewire_sound_device_free(p);
+        return NULL;
+    }
+
+    const int res = pw.pw_stream_connect(p->stream, PW_DIRECTION_INPUT, PW_ID_ANY,
+        (enum pw_stream_flags)(PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS), params, 1);
+    if(res < 0) {
+        fprintf(stderr, "gsr error: pipewire_sound_device_new: failed to connect stream for audio input device %s, error: %s\n", description, strerror(-res));
+        pw.pw_thread_loop_unlock(p->thread_loop);
+        pipewire_sound_device_free(p);
+        return NULL;
+    }
+
+    /* Wait for the format negotiation to finish, like pulseaudio waits for the stream to be ready */
+    for(;;) {
+        const int state = p->state.load();
+        if(state == PW_STREAM_STATE_PAUSED || state == PW_STREAM_STATE_STREAMING || state == PW_STREAM_STATE_ERROR)
+            break;
+
+        if(pw.pw_thread_loop_timed_wait(p->thread_loop, 5) != 0) {
+            fprintf(stderr, "gsr error: pipewire_sound_device_new: timed out waiting for audio input device %s, stream state: %s\n", description, pw.pw_stream_state_as_string((enum pw_stream_state)state));
+            pw.pw_thread_loop_unlock(p->thread_loop);
+            pipewire_sound_device_free(p);
+            return NULL;
+        }
+    }
+
+    pw.pw_thread_loop_unlock(p->thread_loop);
+
+    if(p->state.load() == PW_STREAM_STATE_ERROR) {
+        pipewire_sound_device_free(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+const void* pipewire_sound_device_read(void *handle) {
+    pw_handle *p = (pw_handle*)handle;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += p->timeout_ms * 1000000LL;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000LL;
+    deadline.tv_nsec %= 1000000000LL;
+
+    for(;;) {
+        const uint64_t available = p->write_pos.load(std::memory_order_acquire) - p->read_pos.load(std::memory_order_relaxed);
+        if(available >= p->output_length)
+            break;
+
+        if(p->state.load() == PW_STREAM_STATE_ERROR)
+            return NULL;
+
+        /* The semaphore can have a larger count than the number of writes that haven't been seen yet, in which case this just loops again */
+        while(sem_timedwait(&p->data_sem, &deadline) != 0) {
+            if(errno != EINTR)
+                return NULL;
+        }
+    }
+
+    ring_read(p, p->output_data, p->output_length);
+    return p->output_data;
+}
+
+struct InputsData {
+    std::vector<AudioInput> *inputs;
+    struct pw_main_loop *main_loop;
+    int sync_seq;
+};
+
+static void registry_on_global(void *userdata, uint32_t id, uint32_t permissions, const char *type, uint32_t version, const struct spa_dict *props) {
+    (void)id;
+    (void)permissions;
+    (void)version;
+    InputsData *data = (InputsData*)userdata;
+    if(!props || strcmp(type, PW_TYPE_INTERFACE_Node) != 0)
+        return;
+
+    const char *media_class = spa_dict_lookup(props, PW_KEY_MEDIA_CLASS);
+    const char *node_name = spa_dict_lookup(props, PW_KEY_NODE_NAME);
+    if(!media_class || !node_name)
+        return;
+
+    const char *node_description = spa_dict_lookup(props, PW_KEY_NODE_DESCRIPTION);
+    if(!node_description)
+        node_description = node_name;
+
+    if(strcmp(media_class, "Audio/Source") == 0)
+        data->inputs->push_back({ node_name, node_description });
+    else if(strcmp(media_class, "Audio/Sink") == 0)
+        data->inputs->push_back({ std::string(node_name) + ".monitor", std::string("Monitor of ") + node_description });
+}
+
+static struct pw_registry_events make_registry_events() {
+    struct pw_registry_events events;
+    memset(&events, 0, sizeof(events));
+    events.version = PW_VERSION_REGISTRY_EVENTS;
+    events.global = registry_on_global;
+    return events;
+}
+
+static const struct pw_registry_events registry_events = make_registry_events();
+
+static void core_on_done(void *userdata, uint32_t id, int seq) {
+    InputsData *data = (InputsData*)userdata;
+    if(id == PW_ID_CORE && seq == data->sync_seq)
+        pw.pw_main_loop_quit(data->main_loop);
+}
+
+static void core_on_error(void *userdata, uint32_t id, int seq, int res, const char *message) {
+    (void)seq;
+    InputsData *data = (InputsData*)userdata;
+    fprintf(stderr, "gsr error: pipewire: error %d (%s) on object %u: %s\n", res, strerror(-res), id, message ? message : "(null)");
+    if(id == PW_ID_CORE)
+        pw.pw_main_loop_quit(data->main_loop);
+}
+
+static struct pw_core_events make_core_events() {
+    struct pw_core_events events;
+    memset(&events, 0, sizeof(events));
+    events.version = PW_VERSION_CORE_EVENTS;
+    events.done = core_on_done;
+    events.error = core_on_error;
+    return events;
+}
+
+static const struct pw_core_events core_events = make_core_events();
+
+std::vector<AudioInput> pipewire_get_inputs() {
+    std::vector<AudioInput> inputs;
+
+    struct pw_main_loop *main_loop = pw.pw_main_loop_new(NULL);
+    if(!main_loop)
+        return inputs;
+
+    struct pw_context *context = pw.pw_context_new(pw.pw_main_loop_get_loop(main_loop), NULL, 0);
+    if(!context) {
+        pw.pw_main_loop_destroy(main_loop);
+        return inputs;
+    }
+
+    struct pw_core *core = pw.pw_context_connect(context, NULL, 0);
+    if(!core) {
+        fprintf(stderr, "gsr error: pipewire_get_inputs: failed to connect to pipewire\n");
+        pw.pw_context_destroy(context);
+        pw.pw_main_loop_destroy(main_loop);
+        return inputs;
+    }
+
+    InputsData data;
+    data.inputs = &inputs;
+    data.main_loop = main_loop;
+    data.sync_seq = 0;
+
+    struct spa_hook core_listener;
+    spa_zero(core_listener);
+    pw_core_add_listener(core, &core_listener, &core_events, &data);
+
+    struct pw_registry *registry = pw_core_get_registry(core, PW_VERSION_REGISTRY, 0);
+    struct spa_hook registry_listener;
+    spa_zero(registry_listener);
+    pw_registry_add_listener(registry, &registry_listener, &registry_events, &data);
+
+    /* All globals have been sent to the registry once the server replies to the sync */
+    data.sync_seq = pw_core_sync(core, PW_ID_CORE, 0);
+    pw.pw_main_loop_run(main_loop);
+
+    spa_hook_remove(&registry_listener);
+    spa_hook_remove(&core_listener);
+    pw.pw_proxy_destroy((struct pw_proxy*)registry);
+    pw.pw_core_disconnect(core);
+    pw.pw_context_destroy(context);
+    pw.pw_main_loop_destroy(main_loop);
+    return inputs;
+}
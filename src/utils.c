@@ -8,6 +8,8 @@
 #include <xf86drm.h>
 #include <stdlib.h>
 #include <X11/Xatom.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 typedef enum {
     X11_ROT_0    = 1 << 0,
@@ -443,3 +445,35 @@ bool gsr_card_path_get_render_path(const char *card_path, char *render_path) {
 int even_number_ceil(int value) {
     return value + (value & 1);
 }
+
+int create_directory_recursive(char *path) {
+    int path_len = strlen(path);
+    char *p = path;
+    char *end = path + path_len;
+    for(;;) {
+        char *slash_p = strchr(p, '/');
+
+        // Skips first '/', we don't want to try and create the root directory
+        if(slash_p == path) {
+            ++p;
+            continue;
+        }
+
+        if(!slash_p)
+            slash_p = end;
+
+        char prev_char = *slash_p;
+        *slash_p = '\0';
+        int err = mkdir(path, S_IRWXU);
+        *slash_p = prev_char;
+
+        if(err == -1 && errno != EEXIST)
+            return err;
+
+        if(slash_p == end)
+            break;
+        else
+            p = slash_p + 1;
+    }
+    return 0;
+}
@@ -0,0 +1,423 @@
+#include "../include/vulkan.h"
+#include "../include/library_loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#define MAX_PHYSICAL_DEVICES 16
+#define MAX_QUEUE_FAMILIES 32
+
+/* Like dlsym_load_list, but with vkGetInstanceProcAddr/vkGetDeviceProcAddr. |functions| should be null terminated */
+static bool gsr_vulkan_load_instance_functions(gsr_vulkan *self, const dlsym_assign *functions) {
+    bool success = true;
+    for(int i = 0; functions[i].func; ++i) {
+        *functions[i].func = (void*)self->vkGetInstanceProcAddr(self->instance, functions[i].name);
+        if(!*functions[i].func) {
+            fprintf(stderr, "gsr error: gsr_vulkan_load: vkGetInstanceProcAddr(\"%s\") failed\n", functions[i].name);
+            success = false;
+        }
+    }
+    return success;
+}
+
+static bool gsr_vulkan_load_device_functions(gsr_vulkan *self, const dlsym_assign *functions) {
+    bool success = true;
+    for(int i = 0; functions[i].func; ++i) {
+        *functions[i].func = (void*)self->vkGetDeviceProcAddr(self->device, functions[i].name);
+        if(!*functions[i].func) {
+            fprintf(stderr, "gsr error: gsr_vulkan_load: vkGetDeviceProcAddr(\"%s\") failed\n", functions[i].name);
+            success = false;
+        }
+    }
+    return success;
+}
+
+static bool gsr_vulkan_create_instance(gsr_vulkan *self) {
+    self->vkCreateInstance = (void*)self->vkGetInstanceProcAddr(NULL, "vkCreateInstance");
+    if(!self->vkCreateInstance) {
+        fprintf(stderr, "gsr error: gsr_vulkan_load: vkGetInstanceProcAddr(\"vkCreateInstance\") failed\n");
+        return false;
+    }
+
+    const VkApplicationInfo application_info = {
+        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+        .pApplicationName = "gpu-screen-recorder",
+        .pEngineName = "gpu-screen-recorder",
+        .apiVersion = VK_API_VERSION_1_1
+    };
+
+    const VkInstanceCreateInfo instance_create_info = {
+        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        .pApplicationInfo = &application_info
+    };
+
+    const VkResult result = self->vkCreateInstance(&instance_create_info, NULL, &self->instance);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_load: vkCreateInstance failed, error: %d\n", result);
+        return false;
+    }
+
+    dlsym_assign instance_functions[] = {
+        { (void**)&self->vkDestroyInstance, "vkDestroyInstance" },
+        { (void**)&self->vkEnumeratePhysicalDevices, "vkEnumeratePhysicalDevices" },
+        { (void**)&self->vkGetPhysicalDeviceProperties, "vkGetPhysicalDeviceProperties" },
+        { (void**)&self->vkGetPhysicalDeviceQueueFamilyProperties, "vkGetPhysicalDeviceQueueFamilyProperties" },
+        { (void**)&self->vkGetPhysicalDeviceMemoryProperties, "vkGetPhysicalDeviceMemoryProperties" },
+        { (void**)&self->vkEnumerateDeviceExtensionProperties, "vkEnumerateDeviceExtensionProperties" },
+        { (void**)&self->vkCreateDevice, "vkCreateDevice" },
+        { (void**)&self->vkGetDeviceProcAddr, "vkGetDeviceProcAddr" },
+
+        { NULL, NULL }
+    };
+
+    return gsr_vulkan_load_instance_functions(self, instance_functions);
+}
+
+static bool physical_device_has_extension(const VkExtensionProperties *extensions, uint32_t num_extensions, const char *name) {
+    for(uint32_t i = 0; i < num_extensions; ++i) {
+        if(strcmp(extensions[i].extensionName, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool gsr_vulkan_create_device(gsr_vulkan *self) {
+    VkPhysicalDevice physical_devices[MAX_PHYSICAL_DEVICES];
+    uint32_t num_physical_devices = MAX_PHYSICAL_DEVICES;
+    VkResult result = self->vkEnumeratePhysicalDevices(self->instance, &num_physical_devices, physical_devices);
+    if(result != VK_SUCCESS && num_physical_devices == 0) {
+        fprintf(stderr, "gsr error: gsr_vulkan_load: vkEnumeratePhysicalDevices failed, error: %d\n", result);
+        return false;
+    }
+
+    /* The first device that has a compute queue */
+    for(uint32_t i = 0; i < num_physical_devices && !self->physical_device; ++i) {
+        VkQueueFamilyProperties queue_families[MAX_QUEUE_FAMILIES];
+        uint32_t num_queue_families = MAX_QUEUE_FAMILIES;
+        self->vkGetPhysicalDeviceQueueFamilyProperties(physical_devices[i], &num_queue_families, queue_families);
+        for(uint32_t j = 0; j < num_queue_families; ++j) {
+            if(queue_families[j].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+                self->physical_device = physical_devices[i];
+                self->queue_family_index = j;
+                break;
+            }
+        }
+    }
+
+    if(!self->physical_device) {
+        fprintf(stderr, "gsr error: gsr_vulkan_load: no vulkan device with a compute queue\n");
+        return false;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    memset(&properties, 0, sizeof(properties));
+    self->vkGetPhysicalDeviceProperties(self->physical_device, &properties);
+    snprintf(self->device_name, sizeof(self->device_name), "%s", properties.deviceName);
+    self->vkGetPhysicalDeviceMemoryProperties(self->physical_device, &self->memory_properties);
+
+    uint32_t num_extensions = 0;
+    self->vkEnumerateDeviceExtensionProperties(self->physical_device, NULL, &num_extensions, NULL);
+    VkExtensionProperties *extensions = calloc(num_extensions > 0 ? num_extensions : 1, sizeof(VkExtensionProperties));
+    if(!extensions) {
+        fprintf(stderr, "gsr error: gsr_vulkan_load: failed to allocate memory for the extensions\n");
+        return false;
+    }
+    self->vkEnumerateDeviceExtensionProperties(self->physical_device, NULL, &num_extensions, extensions);
+    self->dma_buf_import_supported =
+        physical_device_has_extension(extensions, num_extensions, "VK_KHR_external_memory_fd") &&
+        physical_device_has_extension(extensions, num_extensions, "VK_EXT_external_memory_dma_buf");
+    free(extensions);
+
+    /* VK_KHR_external_memory is core in vulkan 1.1 */
+    const char *dma_buf_extensions[] = { "VK_KHR_external_memory_fd", "VK_EXT_external_memory_dma_buf" };
+    const float queue_priority = 1.0f;
+    const VkDeviceQueueCreateInfo queue_create_info = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        .queueFamilyIndex = self->queue_family_index,
+        .queueCount = 1,
+        .pQueuePriorities = &queue_priority
+    };
+
+    const VkDeviceCreateInfo device_create_info = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .queueCreateInfoCount = 1,
+        .pQueueCreateInfos = &queue_create_info,
+        .enabledExtensionCount = self->dma_buf_import_supported ? 2 : 0,
+        .ppEnabledExtensionNames = dma_buf_extensions
+    };
+
+    result = self->vkCreateDevice(self->physical_device, &device_create_info, NULL, &self->device);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_load: vkCreateDevice failed, error: %d\n", result);
+        return false;
+    }
+
+    return true;
+}
+
+static bool gsr_vulkan_load_device(gsr_vulkan *self) {
+    dlsym_assign device_functions[] = {
+        { (void**)&self->vkDestroyDevice, "vkDestroyDevice" },
+        { (void**)&self->vkGetDeviceQueue, "vkGetDeviceQueue" },
+        { (void**)&self->vkCreateBuffer, "vkCreateBuffer" },
+        { (void**)&self->vkDestroyBuffer, "vkDestroyBuffer" },
+        { (void**)&self->vkGetBufferMemoryRequirements, "vkGetBufferMemoryRequirements" },
+        { (void**)&self->vkAllocateMemory, "vkAllocateMemory" },
+        { (void**)&self->vkFreeMemory, "vkFreeMemory" },
+        { (void**)&self->vkBindBufferMemory, "vkBindBufferMemory" },
+        { (void**)&self->vkMapMemory, "vkMapMemory" },
+        { (void**)&self->vkUnmapMemory, "vkUnmapMemory" },
+        { (void**)&self->vkCreateShaderModule, "vkCreateShaderModule" },
+        { (void**)&self->vkDestroyShaderModule, "vkDestroyShaderModule" },
+        { (void**)&self->vkCreateDescriptorSetLayout, "vkCreateDescriptorSetLayout" },
+        { (void**)&self->vkDestroyDescriptorSetLayout, "vkDestroyDescriptorSetLayout" },
+        { (void**)&self->vkCreatePipelineLayout, "vkCreatePipelineLayout" },
+        { (void**)&self->vkDestroyPipelineLayout, "vkDestroyPipelineLayout" },
+        { (void**)&self->vkCreateComputePipelines, "vkCreateComputePipelines" },
+        { (void**)&self->vkDestroyPipeline, "vkDestroyPipeline" },
+        { (void**)&self->vkCreateDescriptorPool, "vkCreateDescriptorPool" },
+        { (void**)&self->vkDestroyDescriptorPool, "vkDestroyDescriptorPool" },
+        { (void**)&self->vkAllocateDescriptorSets, "vkAllocateDescriptorSets" },
+        { (void**)&self->vkUpdateDescriptorSets, "vkUpdateDescriptorSets" },
+        { (void**)&self->vkCreateCommandPool, "vkCreateCommandPool" },
+        { (void**)&self->vkDestroyCommandPool, "vkDestroyCommandPool" },
+        { (void**)&self->vkAllocateCommandBuffers, "vkAllocateCommandBuffers" },
+        { (void**)&self->vkBeginCommandBuffer, "vkBeginCommandBuffer" },
+        { (void**)&self->vkEndCommandBuffer, "vkEndCommandBuffer" },
+        { (void**)&self->vkResetCommandBuffer, "vkResetCommandBuffer" },
+        { (void**)&self->vkCmdBindPipeline, "vkCmdBindPipeline" },
+        { (void**)&self->vkCmdBindDescriptorSets, "vkCmdBindDescriptorSets" },
+        { (void**)&self->vkCmdPushConstants, "vkCmdPushConstants" },
+        { (void**)&self->vkCmdDispatch, "vkCmdDispatch" },
+        { (void**)&self->vkCmdPipelineBarrier, "vkCmdPipelineBarrier" },
+        { (void**)&self->vkQueueSubmit, "vkQueueSubmit" },
+        { (void**)&self->vkCreateFence, "vkCreateFence" },
+        { (void**)&self->vkDestroyFence, "vkDestroyFence" },
+        { (void**)&self->vkWaitForFences, "vkWaitForFences" },
+        { (void**)&self->vkResetFences, "vkResetFences" },
+
+        { NULL, NULL }
+    };
+
+    if(!gsr_vulkan_load_device_functions(self, device_functions))
+        return false;
+
+    if(self->dma_buf_import_supported) {
+        dlsym_assign dma_buf_functions[] = {
+            { (void**)&self->vkGetMemoryFdPropertiesKHR, "vkGetMemoryFdPropertiesKHR" },
+
+            { NULL, NULL }
+        };
+
+        if(!gsr_vulkan_load_device_functions(self, dma_buf_functions))
+            self->dma_buf_import_supported = false;
+    }
+
+    self->vkGetDeviceQueue(self->device, self->queue_family_index, 0, &self->queue);
+    return true;
+}
+
+bool gsr_vulkan_load(gsr_vulkan *self) {
+    memset(self, 0, sizeof(gsr_vulkan));
+
+    dlerror(); /* clear */
+    void *library = dlopen("libvulkan.so.1", RTLD_LAZY);
+    if(!library) {
+        fprintf(stderr, "gsr error: gsr_vulkan_load: failed to load libvulkan.so.1, error: %s\n", dlerror());
+        return false;
+    }
+    self->library = library;
+
+    dlsym_assign required_dlsym[] = {
+        { (void**)&self->vkGetInstanceProcAddr, "vkGetInstanceProcAddr" },
+
+        { NULL, NULL }
+    };
+
+    if(!dlsym_load_list(library, required_dlsym)) {
+        fprintf(stderr, "gsr error: gsr_vulkan_load failed: missing required symbols in libvulkan.so.1\n");
+        goto fail;
+    }
+
+    if(!gsr_vulkan_create_instance(self))
+        goto fail;
+
+    if(!gsr_vulkan_create_device(self))
+        goto fail;
+
+    if(!gsr_vulkan_load_device(self))
+        goto fail;
+
+    fprintf(stderr, "gsr info: gsr_vulkan_load: using vulkan device \"%s\", dma-buf import: %s\n", self->device_name, self->dma_buf_import_supported ? "yes" : "no");
+    return true;
+
+    fail:
+    gsr_vulkan_unload(self);
+    return false;
+}
+
+void gsr_vulkan_unload(gsr_vulkan *self) {
+    if(self->device && self->vkDestroyDevice) {
+        self->vkDestroyDevice(self->device, NULL);
+        self->device = NULL;
+    }
+
+    if(self->instance && self->vkDestroyInstance) {
+        self->vkDestroyInstance(self->instance, NULL);
+        self->instance = NULL;
+    }
+
+    if(self->library) {
+        dlclose(self->library);
+        self->library = NULL;
+    }
+
+    memset(self, 0, sizeof(gsr_vulkan));
+}
+
+static bool gsr_vulkan_find_memory_type(const gsr_vulkan *self, uint32_t memory_type_bits, VkFlags required_properties, uint32_t *memory_type_index) {
+    for(uint32_t i = 0; i < self->memory_properties.memoryTypeCount; ++i) {
+        if((memory_type_bits & (1u << i)) && (self->memory_properties.memoryTypes[i].propertyFlags & required_properties) == required_properties) {
+            *memory_type_index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* |memory_allocated| is set to true if vkAllocateMemory succeeded, even if something failed after that */
+static bool gsr_vulkan_buffer_create_with_memory(gsr_vulkan *self, gsr_vulkan_buffer *buffer, uint64_t size, const void *buffer_next, const void *memory_next, uint32_t memory_type_bits, VkFlags memory_properties, bool *memory_allocated) {
+    memset(buffer, 0, sizeof(*buffer));
+    *memory_allocated = false;
+
+    const VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = buffer_next,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+
+    VkResult result = self->vkCreateBuffer(self->device, &buffer_create_info, NULL, &buffer->buffer);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_buffer_create: vkCreateBuffer failed, error: %d\n", result);
+        return false;
+    }
+
+    VkMemoryRequirements memory_requirements;
+    self->vkGetBufferMemoryRequirements(self->device, buffer->buffer, &memory_requirements);
+
+    uint32_t memory_type_index = 0;
+    if(!gsr_vulkan_find_memory_type(self, memory_requirements.memoryTypeBits & memory_type_bits, memory_properties, &memory_type_index)) {
+        fprintf(stderr, "gsr error: gsr_vulkan_buffer_create: no suitable memory type\n");
+        goto fail;
+    }
+
+    const VkMemoryAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = memory_next,
+        .allocationSize = memory_requirements.size,
+        .memoryTypeIndex = memory_type_index
+    };
+
+    result = self->vkAllocateMemory(self->device, &allocate_info, NULL, &buffer->memory);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_buffer_create: vkAllocateMemory failed, error: %d\n", result);
+        goto fail;
+    }
+    *memory_allocated = true;
+
+    result = self->vkBindBufferMemory(self->device, buffer->buffer, buffer->memory, 0);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_buffer_create: vkBindBufferMemory failed, error: %d\n", result);
+        goto fail;
+    }
+
+    buffer->size = size;
+    return true;
+
+    fail:
+    gsr_vulkan_buffer_destroy(self, buffer);
+    return false;
+}
+
+bool gsr_vulkan_buffer_create(gsr_vulkan *self, gsr_vulkan_buffer *buffer, uint64_t size) {
+    bool memory_allocated = false;
+    if(!gsr_vulkan_buffer_create_with_memory(self, buffer, size, NULL, NULL, ~0u, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memory_allocated))
+        return false;
+
+    const VkResult result = self->vkMapMemory(self->device, buffer->memory, 0, VK_WHOLE_SIZE, 0, &buffer->mapped);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_buffer_create: vkMapMemory failed, error: %d\n", result);
+        gsr_vulkan_buffer_destroy(self, buffer);
+        return false;
+    }
+
+    return true;
+}
+
+bool gsr_vulkan_buffer_import_dma_buf(gsr_vulkan *self, gsr_vulkan_buffer *buffer, int fd, uint64_t size) {
+    memset(buffer, 0, sizeof(*buffer));
+    if(!self->dma_buf_import_supported) {
+        fprintf(stderr, "gsr error: gsr_vulkan_buffer_import_dma_buf: the vulkan device doesn't support VK_EXT_external_memory_dma_buf\n");
+        return false;
+    }
+
+    VkMemoryFdPropertiesKHR fd_properties = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR
+    };
+    VkResult result = self->vkGetMemoryFdPropertiesKHR(self->device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT, fd, &fd_properties);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_buffer_import_dma_buf: vkGetMemoryFdPropertiesKHR failed, error: %d\n", result);
+        return false;
+    }
+
+    /* Vulkan takes ownership of the fd when the import succeeds */
+    const int fd_copy = dup(fd);
+    if(fd_copy == -1) {
+        fprintf(stderr, "gsr error: gsr_vulkan_buffer_import_dma_buf: failed to duplicate the dma-buf fd\n");
+        return false;
+    }
+
+    const VkExternalMemoryBufferCreateInfo external_buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT
+    };
+
+    const VkImportMemoryFdInfoKHR import_info = {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+        .fd = fd_copy
+    };
+
+    bool memory_allocated = false;
+    if(!gsr_vulkan_buffer_create_with_memory(self, buffer, size, &external_buffer_info, &import_info, fd_properties.memoryTypeBits, 0, &memory_allocated)) {
+        /* The fd is only closed by vulkan (vkFreeMemory) if the import succeeded */
+        if(!memory_allocated)
+            close(fd_copy);
+        return false;
+    }
+
+    return true;
+}
+
+void gsr_vulkan_buffer_destroy(gsr_vulkan *self, gsr_vulkan_buffer *buffer) {
+    if(buffer->mapped) {
+        self->vkUnmapMemory(self->device, buffer->memory);
+        buffer->mapped = NULL;
+    }
+
+    if(buffer->buffer) {
+        self->vkDestroyBuffer(self->device, buffer->buffer, NULL);
+        buffer->buffer = VK_NULL_HANDLE;
+    }
+
+    if(buffer->memory) {
+        self->vkFreeMemory(self->device, buffer->memory, NULL);
+        buffer->memory = VK_NULL_HANDLE;
+    }
+
+    buffer->size = 0;
+}
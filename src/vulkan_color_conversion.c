@@ -0,0 +1,441 @@
+#include "../include/vulkan_color_conversion.h"
+#include "../include/color_matrices.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "vulkan_color_conversion_spirv.h"
+
+/* Push constants of the compute shader, has to match PARAMETERS in vulkan_color_conversion_spirv.py. Offsets and pitches are in uints */
+typedef struct {
+    int32_t destination_x, destination_y, destination_width, destination_height;
+    int32_t texture_x, texture_y, texture_width, texture_height;
+    int32_t texture_full_width, texture_full_height;
+    int32_t source_offset, source_pitch, source_swap_rb;
+    int32_t cursor_x, cursor_y, cursor_width, cursor_height;
+    int32_t cursor_offset, cursor_pitch, cursor_swap_rb;
+    int32_t y_offset, y_pitch, uv_offset, uv_pitch;
+    int32_t frame_width, frame_height;
+} gsr_vulkan_color_conversion_parameters;
+
+_Static_assert(sizeof(gsr_vulkan_color_conversion_parameters) == VULKAN_COLOR_CONVERSION_NUM_PARAMETERS * sizeof(int32_t), "the push constants don't match the shader");
+
+/* Specialization constants of the compute shader: the color matrix (y, u and v rows as r, g, b, then the y, u, v offsets) and the destination format */
+typedef struct {
+    float matrix[12];
+    VkBool32 ten_bit;
+} gsr_vulkan_color_conversion_specialization;
+
+#define NUM_BINDINGS 3
+
+static int gsr_vulkan_color_conversion_create_pipeline(gsr_vulkan_color_conversion *self) {
+    gsr_vulkan *vk = self->params.vulkan;
+
+    VkDescriptorSetLayoutBinding bindings[NUM_BINDINGS];
+    for(int i = 0; i < NUM_BINDINGS; ++i) {
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT
+        };
+    }
+
+    const VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = NUM_BINDINGS,
+        .pBindings = bindings
+    };
+
+    if(vk->vkCreateDescriptorSetLayout(vk->device, &descriptor_set_layout_create_info, NULL, &self->descriptor_set_layout) != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_init: vkCreateDescriptorSetLayout failed\n");
+        return -1;
+    }
+
+    const VkPushConstantRange push_constant_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(gsr_vulkan_color_conversion_parameters)
+    };
+
+    const VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &self->descriptor_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_constant_range
+    };
+
+    if(vk->vkCreatePipelineLayout(vk->device, &pipeline_layout_create_info, NULL, &self->pipeline_layout) != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_init: vkCreatePipelineLayout failed\n");
+        return -1;
+    }
+
+    const VkShaderModuleCreateInfo shader_module_create_info = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = sizeof(vulkan_color_conversion_spirv),
+        .pCode = vulkan_color_conversion_spirv
+    };
+
+    VkShaderModule shader_module = VK_NULL_HANDLE;
+    if(vk->vkCreateShaderModule(vk->device, &shader_module_create_info, NULL, &shader_module) != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_init: vkCreateShaderModule failed\n");
+        return -1;
+    }
+
+    const gsr_color_matrix *matrix = gsr_color_matrix_get(self->params.destination_color, self->params.color_range);
+    assert(matrix);
+    gsr_vulkan_color_conversion_specialization specialization = {
+        .matrix = {
+            matrix->r[0], matrix->g[0], matrix->b[0],
+            matrix->r[1], matrix->g[1], matrix->b[1],
+            matrix->r[2], matrix->g[2], matrix->b[2],
+            matrix->offset[0], matrix->offset[1], matrix->offset[2]
+        },
+        .ten_bit = self->params.destination_color == GSR_DESTINATION_COLOR_P010 ? VK_TRUE : VK_FALSE
+    };
+
+    VkSpecializationMapEntry specialization_map_entries[13];
+    for(int i = 0; i < 12; ++i) {
+        specialization_map_entries[i] = (VkSpecializationMapEntry){ .constantID = i, .offset = i * sizeof(float), .size = sizeof(float) };
+    }
+    specialization_map_entries[12] = (VkSpecializationMapEntry){ .constantID = 12, .offset = offsetof(gsr_vulkan_color_conversion_specialization, ten_bit), .size = sizeof(VkBool32) };
+
+    const VkSpecializationInfo specialization_info = {
+        .mapEntryCount = 13,
+        .pMapEntries = specialization_map_entries,
+        .dataSize = sizeof(specialization),
+        .pData = &specialization
+    };
+
+    const VkComputePipelineCreateInfo pipeline_create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = shader_module,
+            .pName = "main",
+            .pSpecializationInfo = &specialization_info
+        },
+        .layout = self->pipeline_layout,
+        .basePipelineIndex = -1
+    };
+
+    const VkResult result = vk->vkCreateComputePipelines(vk->device, VK_NULL_HANDLE, 1, &pipeline_create_info, NULL, &self->pipeline);
+    vk->vkDestroyShaderModule(vk->device, shader_module, NULL);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_init: vkCreateComputePipelines failed, error: %d\n", result);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int gsr_vulkan_color_conversion_create_command_buffer(gsr_vulkan_color_conversion *self) {
+    gsr_vulkan *vk = self->params.vulkan;
+
+    const VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = NUM_BINDINGS
+    };
+
+    const VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size
+    };
+
+    if(vk->vkCreateDescriptorPool(vk->device, &descriptor_pool_create_info, NULL, &self->descriptor_pool) != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_init: vkCreateDescriptorPool failed\n");
+        return -1;
+    }
+
+    const VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = self->descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &self->descriptor_set_layout
+    };
+
+    if(vk->vkAllocateDescriptorSets(vk->device, &descriptor_set_allocate_info, &self->descriptor_set) != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_init: vkAllocateDescriptorSets failed\n");
+        return -1;
+    }
+
+    const VkCommandPoolCreateInfo command_pool_create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = vk->queue_family_index
+    };
+
+    if(vk->vkCreateCommandPool(vk->device, &command_pool_create_info, NULL, &self->command_pool) != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_init: vkCreateCommandPool failed\n");
+        return -1;
+    }
+
+    const VkCommandBufferAllocateInfo command_buffer_allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = self->command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1
+    };
+
+    if(vk->vkAllocateCommandBuffers(vk->device, &command_buffer_allocate_info, &self->command_buffer) != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_init: vkAllocateCommandBuffers failed\n");
+        return -1;
+    }
+
+    const VkFenceCreateInfo fence_create_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+    };
+
+    if(vk->vkCreateFence(vk->device, &fence_create_info, NULL, &self->fence) != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_init: vkCreateFence failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int gsr_vulkan_color_conversion_init(gsr_vulkan_color_conversion *self, const gsr_vulkan_color_conversion_params *params) {
+    assert(params);
+    assert(params->vulkan);
+    memset(self, 0, sizeof(*self));
+    self->params = *params;
+
+    if(params->destination_color != GSR_DESTINATION_COLOR_NV12 && params->destination_color != GSR_DESTINATION_COLOR_P010) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_init: only nv12 and p010 destination colors are supported\n");
+        return -1;
+    }
+
+    if(gsr_vulkan_color_conversion_create_pipeline(self) != 0)
+        goto err;
+
+    if(gsr_vulkan_color_conversion_create_command_buffer(self) != 0)
+        goto err;
+
+    /* Bound when there is no cursor, the shader always reads the cursor buffer */
+    if(!gsr_vulkan_buffer_create(params->vulkan, &self->no_cursor_buffer, 4))
+        goto err;
+    memset(self->no_cursor_buffer.mapped, 0, 4);
+
+    return 0;
+
+    err:
+    gsr_vulkan_color_conversion_deinit(self);
+    return -1;
+}
+
+void gsr_vulkan_color_conversion_deinit(gsr_vulkan_color_conversion *self) {
+    gsr_vulkan *vk = self->params.vulkan;
+    if(!vk)
+        return;
+
+    gsr_vulkan_buffer_destroy(vk, &self->no_cursor_buffer);
+
+    if(self->fence) {
+        vk->vkDestroyFence(vk->device, self->fence, NULL);
+        self->fence = VK_NULL_HANDLE;
+    }
+
+    /* Frees the command buffer */
+    if(self->command_pool) {
+        vk->vkDestroyCommandPool(vk->device, self->command_pool, NULL);
+        self->command_pool = VK_NULL_HANDLE;
+        self->command_buffer = NULL;
+    }
+
+    /* Frees the descriptor set */
+    if(self->descriptor_pool) {
+        vk->vkDestroyDescriptorPool(vk->device, self->descriptor_pool, NULL);
+        self->descriptor_pool = VK_NULL_HANDLE;
+        self->descriptor_set = VK_NULL_HANDLE;
+    }
+
+    if(self->pipeline) {
+        vk->vkDestroyPipeline(vk->device, self->pipeline, NULL);
+        self->pipeline = VK_NULL_HANDLE;
+    }
+
+    if(self->pipeline_layout) {
+        vk->vkDestroyPipelineLayout(vk->device, self->pipeline_layout, NULL);
+        self->pipeline_layout = VK_NULL_HANDLE;
+    }
+
+    if(self->descriptor_set_layout) {
+        vk->vkDestroyDescriptorSetLayout(vk->device, self->descriptor_set_layout, NULL);
+        self->descriptor_set_layout = VK_NULL_HANDLE;
+    }
+
+    self->params.vulkan = NULL;
+}
+
+static bool source_image_is_valid(const gsr_vulkan_source_image *image, const char *name) {
+    if(image->offset < 0 || image->offset % 4 != 0 || image->pitch % 4 != 0) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: the %s offset and pitch have to be multiples of 4\n", name);
+        return false;
+    }
+
+    if(image->size.x <= 0 || image->size.y <= 0 || image->pitch < image->size.x * 4) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: invalid %s size %dx%d (pitch: %d)\n", name, image->size.x, image->size.y, image->pitch);
+        return false;
+    }
+
+    if((uint64_t)image->offset + (uint64_t)image->pitch * (uint64_t)(image->size.y - 1) + (uint64_t)image->size.x * 4 > image->buffer->size) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: the %s image is larger than its buffer\n", name);
+        return false;
+    }
+
+    return true;
+}
+
+static bool destination_image_is_valid(const gsr_vulkan_destination_image *image, int bytes_per_sample) {
+    if(image->size.x <= 0 || image->size.y <= 0 || image->size.x % 2 != 0 || image->size.y % 2 != 0) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: the destination size has to be even, got %dx%d\n", image->size.x, image->size.y);
+        return false;
+    }
+
+    if(image->y_offset < 0 || image->uv_offset < 0 || image->y_offset % 4 != 0 || image->uv_offset % 4 != 0 || image->y_pitch % 4 != 0 || image->uv_pitch % 4 != 0) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: the destination offsets and pitches have to be multiples of 4\n");
+        return false;
+    }
+
+    /* Each invocation writes 4 pixels of a row */
+    const int row_size = ((image->size.x + 3) / 4) * 4 * bytes_per_sample;
+    if(image->y_pitch < row_size || image->uv_pitch < row_size) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: the destination pitches have to be at least %d bytes\n", row_size);
+        return false;
+    }
+
+    if((uint64_t)image->y_offset + (uint64_t)image->y_pitch * (uint64_t)image->size.y > image->buffer->size || (uint64_t)image->uv_offset + (uint64_t)image->uv_pitch * (uint64_t)(image->size.y / 2) > image->buffer->size) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: the destination image is larger than its buffer\n");
+        return false;
+    }
+
+    return true;
+}
+
+int gsr_vulkan_color_conversion_convert(gsr_vulkan_color_conversion *self, const gsr_vulkan_color_conversion_layer *layer, const gsr_vulkan_destination_image *destination) {
+    gsr_vulkan *vk = self->params.vulkan;
+    const int bytes_per_sample = self->params.destination_color == GSR_DESTINATION_COLOR_P010 ? 2 : 1;
+
+    if(!source_image_is_valid(&layer->source, "source") || !destination_image_is_valid(destination, bytes_per_sample))
+        return -1;
+
+    if(layer->cursor.buffer && !source_image_is_valid(&layer->cursor, "cursor"))
+        return -1;
+
+    gsr_vulkan_color_conversion_parameters parameters = {
+        .destination_x = layer->destination_pos.x,
+        .destination_y = layer->destination_pos.y,
+        .destination_width = layer->destination_size.x,
+        .destination_height = layer->destination_size.y,
+        .texture_x = layer->source_pos.x,
+        .texture_y = layer->source_pos.y,
+        .texture_width = layer->source_size.x,
+        .texture_height = layer->source_size.y,
+        .texture_full_width = layer->source.size.x,
+        .texture_full_height = layer->source.size.y,
+        .source_offset = layer->source.offset / 4,
+        .source_pitch = layer->source.pitch / 4,
+        .source_swap_rb = layer->source.bgra,
+        .cursor_x = layer->cursor_pos.x,
+        .cursor_y = layer->cursor_pos.y,
+        .cursor_width = layer->cursor.buffer ? layer->cursor.size.x : 0,
+        .cursor_height = layer->cursor.buffer ? layer->cursor.size.y : 0,
+        .cursor_offset = layer->cursor.buffer ? layer->cursor.offset / 4 : 0,
+        .cursor_pitch = layer->cursor.buffer ? layer->cursor.pitch / 4 : 0,
+        .cursor_swap_rb = layer->cursor.bgra,
+        .y_offset = destination->y_offset / 4,
+        .y_pitch = destination->y_pitch / 4,
+        .uv_offset = destination->uv_offset / 4,
+        .uv_pitch = destination->uv_pitch / 4,
+        .frame_width = destination->size.x,
+        .frame_height = destination->size.y
+    };
+
+    /* Nothing to draw, everything is black. Avoids dividing by 0 in the shader */
+    if(layer->destination_size.x <= 0 || layer->destination_size.y <= 0) {
+        parameters.destination_x = destination->size.x;
+        parameters.destination_y = destination->size.y;
+        parameters.destination_width = 1;
+        parameters.destination_height = 1;
+    }
+
+    const VkDescriptorBufferInfo buffer_infos[NUM_BINDINGS] = {
+        { .buffer = layer->source.buffer->buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+        { .buffer = layer->cursor.buffer ? layer->cursor.buffer->buffer : self->no_cursor_buffer.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+        { .buffer = destination->buffer->buffer, .offset = 0, .range = VK_WHOLE_SIZE }
+    };
+
+    VkWriteDescriptorSet descriptor_writes[NUM_BINDINGS];
+    for(int i = 0; i < NUM_BINDINGS; ++i) {
+        descriptor_writes[i] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = self->descriptor_set,
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffer_infos[i]
+        };
+    }
+    /* The previous conversion has finished (we wait for the fence), so the descriptor set isn't in use */
+    vk->vkUpdateDescriptorSets(vk->device, NUM_BINDINGS, descriptor_writes, 0, NULL);
+
+    const VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+
+    vk->vkResetCommandBuffer(self->command_buffer, 0);
+    if(vk->vkBeginCommandBuffer(self->command_buffer, &begin_info) != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: vkBeginCommandBuffer failed\n");
+        return -1;
+    }
+
+    /* Each invocation converts 4x2 pixels */
+    const uint32_t num_blocks_x = (destination->size.x + 3) / 4;
+    const uint32_t num_blocks_y = destination->size.y / 2;
+    vk->vkCmdBindPipeline(self->command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, self->pipeline);
+    vk->vkCmdBindDescriptorSets(self->command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, self->pipeline_layout, 0, 1, &self->descriptor_set, 0, NULL);
+    vk->vkCmdPushConstants(self->command_buffer, self->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(parameters), &parameters);
+    vk->vkCmdDispatch(self->command_buffer,
+        (num_blocks_x + VULKAN_COLOR_CONVERSION_LOCAL_SIZE_X - 1) / VULKAN_COLOR_CONVERSION_LOCAL_SIZE_X,
+        (num_blocks_y + VULKAN_COLOR_CONVERSION_LOCAL_SIZE_Y - 1) / VULKAN_COLOR_CONVERSION_LOCAL_SIZE_Y,
+        1);
+
+    /* Makes the result visible to the cpu, for host visible buffers. Dma-bufs are read by other devices (the encoder) after the fence has signaled */
+    const VkMemoryBarrier memory_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT
+    };
+    vk->vkCmdPipelineBarrier(self->command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memory_barrier, 0, NULL, 0, NULL);
+
+    if(vk->vkEndCommandBuffer(self->command_buffer) != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: vkEndCommandBuffer failed\n");
+        return -1;
+    }
+
+    const VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &self->command_buffer
+    };
+
+    VkResult result = vk->vkQueueSubmit(vk->queue, 1, &submit_info, self->fence);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: vkQueueSubmit failed, error: %d\n", result);
+        return -1;
+    }
+
+    result = vk->vkWaitForFences(vk->device, 1, &self->fence, VK_TRUE, UINT64_MAX);
+    vk->vkResetFences(vk->device, 1, &self->fence);
+    if(result != VK_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_vulkan_color_conversion_convert: vkWaitForFences failed, error: %d\n", result);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,941 @@
+/* Generated by vulkan_color_conversion_spirv.py, don't edit this file */
+
+#define VULKAN_COLOR_CONVERSION_LOCAL_SIZE_X 8
+#define VULKAN_COLOR_CONVERSION_LOCAL_SIZE_Y 8
+#define VULKAN_COLOR_CONVERSION_NUM_PARAMETERS 26
+
+static const uint32_t vulkan_color_conversion_spirv[] = {
+    0x07230203, 0x00010000, 0x00000000, 0x00000529, 0x00000000, 0x00020011, 0x00000001, 0x0006000b,
+    0x00000001, 0x4c534c47, 0x6474732e, 0x3035342e, 0x00000000, 0x0003000e, 0x00000000, 0x00000001,
+    0x0006000f, 0x00000005, 0x00000028, 0x6e69616d, 0x00000000, 0x00000024, 0x00060010, 0x00000028,
+    0x00000011, 0x00000008, 0x00000008, 0x00000001, 0x00040005, 0x00000011, 0x5f6e6574, 0x00746962,
+    0x00040005, 0x00000017, 0x72756f73, 0x00006563, 0x00040005, 0x0000001a, 0x73727563, 0x0000726f,
+    0x00050005, 0x0000001d, 0x74736564, 0x74616e69, 0x006e6f69, 0x00070006, 0x0000001f, 0x00000000,
+    0x74736564, 0x74616e69, 0x5f6e6f69, 0x00000078, 0x00070006, 0x0000001f, 0x00000001, 0x74736564,
+    0x74616e69, 0x5f6e6f69, 0x00000079, 0x00080006, 0x0000001f, 0x00000002, 0x74736564, 0x74616e69,
+    0x5f6e6f69, 0x74646977, 0x00000068, 0x00080006, 0x0000001f, 0x00000003, 0x74736564, 0x74616e69,
+    0x5f6e6f69, 0x67696568, 0x00007468, 0x00060006, 0x0000001f, 0x00000004, 0x74786574, 0x5f657275,
+    0x00000078, 0x00060006, 0x0000001f, 0x00000005, 0x74786574, 0x5f657275, 0x00000079, 0x00070006,
+    0x0000001f, 0x00000006, 0x74786574, 0x5f657275, 0x74646977, 0x00000068, 0x00070006, 0x0000001f,
+    0x00000007, 0x74786574, 0x5f657275, 0x67696568, 0x00007468, 0x00080006, 0x0000001f, 0x00000008,
+    0x74786574, 0x5f657275, 0x6c6c7566, 0x6469775f, 0x00006874, 0x00080006, 0x0000001f, 0x00000009,
+    0x74786574, 0x5f657275, 0x6c6c7566, 0x6965685f, 0x00746867, 0x00070006, 0x0000001f, 0x0000000a,
+    0x72756f73, 0x6f5f6563, 0x65736666, 0x00000074, 0x00070006, 0x0000001f, 0x0000000b, 0x72756f73,
+    0x705f6563, 0x68637469, 0x00000000, 0x00070006, 0x0000001f, 0x0000000c, 0x72756f73, 0x735f6563,
+    0x5f706177, 0x00006272, 0x00060006, 0x0000001f, 0x0000000d, 0x73727563, 0x785f726f, 0x00000000,
+    0x00060006, 0x0000001f, 0x0000000e, 0x73727563, 0x795f726f, 0x00000000, 0x00070006, 0x0000001f,
+    0x0000000f, 0x73727563, 0x775f726f, 0x68746469, 0x00000000, 0x00070006, 0x0000001f, 0x00000010,
+    0x73727563, 0x685f726f, 0x68676965, 0x00000074, 0x00070006, 0x0000001f, 0x00000011, 0x73727563,
+    0x6f5f726f, 0x65736666, 0x00000074, 0x00070006, 0x0000001f, 0x00000012, 0x73727563, 0x705f726f,
+    0x68637469, 0x00000000, 0x00070006, 0x0000001f, 0x00000013, 0x73727563, 0x735f726f, 0x5f706177,
+    0x00006272, 0x00060006, 0x0000001f, 0x00000014, 0x666f5f79, 0x74657366, 0x00000000, 0x00050006,
+    0x0000001f, 0x00000015, 0x69705f79, 0x00686374, 0x00060006, 0x0000001f, 0x00000016, 0x6f5f7675,
+    0x65736666, 0x00000074, 0x00060006, 0x0000001f, 0x00000017, 0x705f7675, 0x68637469, 0x00000000,
+    0x00060006, 0x0000001f, 0x00000018, 0x6d617266, 0x69775f65, 0x00687464, 0x00070006, 0x0000001f,
+    0x00000019, 0x6d617266, 0x65685f65, 0x74686769, 0x00000000, 0x00030005, 0x00000021, 0x00000070,
+    0x00040005, 0x00000028, 0x6e69616d, 0x00000000, 0x00040047, 0x00000005, 0x00000001, 0x00000000,
+    0x00040047, 0x00000006, 0x00000001, 0x00000001, 0x00040047, 0x00000007, 0x00000001, 0x00000002,
+    0x00040047, 0x00000008, 0x00000001, 0x00000003, 0x00040047, 0x00000009, 0x00000001, 0x00000004,
+    0x00040047, 0x0000000a, 0x00000001, 0x00000005, 0x00040047, 0x0000000b, 0x00000001, 0x00000006,
+    0x00040047, 0x0000000c, 0x00000001, 0x00000007, 0x00040047, 0x0000000d, 0x00000001, 0x00000008,
+    0x00040047, 0x0000000e, 0x00000001, 0x00000009, 0x00040047, 0x0000000f, 0x00000001, 0x0000000a,
+    0x00040047, 0x00000010, 0x00000001, 0x0000000b, 0x00040047, 0x00000011, 0x00000001, 0x0000000c,
+    0x00040047, 0x00000013, 0x00000006, 0x00000004, 0x00030047, 0x00000016, 0x00000003, 0x00050048,
+    0x00000016, 0x00000000, 0x00000023, 0x00000000, 0x00040048, 0x00000016, 0x00000000, 0x00000018,
+    0x00040047, 0x00000017, 0x00000022, 0x00000000, 0x00040047, 0x00000017, 0x00000021, 0x00000000,
+    0x00030047, 0x00000019, 0x00000003, 0x00050048, 0x00000019, 0x00000000, 0x00000023, 0x00000000,
+    0x00040048, 0x00000019, 0x00000000, 0x00000018, 0x00040047, 0x0000001a, 0x00000022, 0x00000000,
+    0x00040047, 0x0000001a, 0x00000021, 0x00000001, 0x00030047, 0x0000001c, 0x00000003, 0x00050048,
+    0x0000001c, 0x00000000, 0x00000023, 0x00000000, 0x00040047, 0x0000001d, 0x00000022, 0x00000000,
+    0x00040047, 0x0000001d, 0x00000021, 0x00000002, 0x00030047, 0x0000001f, 0x00000002, 0x00050048,
+    0x0000001f, 0x00000000, 0x00000023, 0x00000000, 0x00050048, 0x0000001f, 0x00000001, 0x00000023,
+    0x00000004, 0x00050048, 0x0000001f, 0x00000002, 0x00000023, 0x00000008, 0x00050048, 0x0000001f,
+    0x00000003, 0x00000023, 0x0000000c, 0x00050048, 0x0000001f, 0x00000004, 0x00000023, 0x00000010,
+    0x00050048, 0x0000001f, 0x00000005, 0x00000023, 0x00000014, 0x00050048, 0x0000001f, 0x00000006,
+    0x00000023, 0x00000018, 0x00050048, 0x0000001f, 0x00000007, 0x00000023, 0x0000001c, 0x00050048,
+    0x0000001f, 0x00000008, 0x00000023, 0x00000020, 0x00050048, 0x0000001f, 0x00000009, 0x00000023,
+    0x00000024, 0x00050048, 0x0000001f, 0x0000000a, 0x00000023, 0x00000028, 0x00050048, 0x0000001f,
+    0x0000000b, 0x00000023, 0x0000002c, 0x00050048, 0x0000001f, 0x0000000c, 0x00000023, 0x00000030,
+    0x00050048, 0x0000001f, 0x0000000d, 0x00000023, 0x00000034, 0x00050048, 0x0000001f, 0x0000000e,
+    0x00000023, 0x00000038, 0x00050048, 0x0000001f, 0x0000000f, 0x00000023, 0x0000003c, 0x00050048,
+    0x0000001f, 0x00000010, 0x00000023, 0x00000040, 0x00050048, 0x0000001f, 0x00000011, 0x00000023,
+    0x00000044, 0x00050048, 0x0000001f, 0x00000012, 0x00000023, 0x00000048, 0x00050048, 0x0000001f,
+    0x00000013, 0x00000023, 0x0000004c, 0x00050048, 0x0000001f, 0x00000014, 0x00000023, 0x00000050,
+    0x00050048, 0x0000001f, 0x00000015, 0x00000023, 0x00000054, 0x00050048, 0x0000001f, 0x00000016,
+    0x00000023, 0x00000058, 0x00050048, 0x0000001f, 0x00000017, 0x00000023, 0x0000005c, 0x00050048,
+    0x0000001f, 0x00000018, 0x00000023, 0x00000060, 0x00050048, 0x0000001f, 0x00000019, 0x00000023,
+    0x00000064, 0x00040047, 0x00000024, 0x0000000b, 0x0000001c, 0x00030016, 0x00000002, 0x00000020,
+    0x00040017, 0x00000003, 0x00000002, 0x00000003, 0x00040017, 0x00000004, 0x00000002, 0x00000004,
+    0x00040032, 0x00000002, 0x00000005, 0x00000000, 0x00040032, 0x00000002, 0x00000006, 0x00000000,
+    0x00040032, 0x00000002, 0x00000007, 0x00000000, 0x00040032, 0x00000002, 0x00000008, 0x00000000,
+    0x00040032, 0x00000002, 0x00000009, 0x00000000, 0x00040032, 0x00000002, 0x0000000a, 0x00000000,
+    0x00040032, 0x00000002, 0x0000000b, 0x00000000, 0x00040032, 0x00000002, 0x0000000c, 0x00000000,
+    0x00040032, 0x00000002, 0x0000000d, 0x00000000, 0x00040032, 0x00000002, 0x0000000e, 0x00000000,
+    0x00040032, 0x00000002, 0x0000000f, 0x00000000, 0x00040032, 0x00000002, 0x00000010, 0x00000000,
+    0x00020014, 0x00000012, 0x00030031, 0x00000012, 0x00000011, 0x00040015, 0x00000014, 0x00000020,
+    0x00000000, 0x0003001d, 0x00000013, 0x00000014, 0x00040020, 0x00000015, 0x00000002, 0x00000014,
+    0x0003001e, 0x00000016, 0x00000013, 0x00040020, 0x00000018, 0x00000002, 0x00000016, 0x0004003b,
+    0x00000018, 0x00000017, 0x00000002, 0x0003001e, 0x00000019, 0x00000013, 0x00040020, 0x0000001b,
+    0x00000002, 0x00000019, 0x0004003b, 0x0000001b, 0x0000001a, 0x00000002, 0x0003001e, 0x0000001c,
+    0x00000013, 0x00040020, 0x0000001e, 0x00000002, 0x0000001c, 0x0004003b, 0x0000001e, 0x0000001d,
+    0x00000002, 0x00040015, 0x00000020, 0x00000020, 0x00000001, 0x001c001e, 0x0000001f, 0x00000020,
+    0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020,
+    0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020,
+    0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020, 0x00000020,
+    0x00000020, 0x00040020, 0x00000022, 0x00000009, 0x0000001f, 0x0004003b, 0x00000022, 0x00000021,
+    0x00000009, 0x00040017, 0x00000023, 0x00000014, 0x00000003, 0x00040020, 0x00000025, 0x00000001,
+    0x00000023, 0x0004003b, 0x00000025, 0x00000024, 0x00000001, 0x00020013, 0x00000026, 0x00030021,
+    0x00000027, 0x00000026, 0x00040020, 0x0000002a, 0x00000009, 0x00000020, 0x0004002b, 0x00000020,
+    0x0000002b, 0x00000000, 0x0004002b, 0x00000020, 0x0000002e, 0x00000001, 0x0004002b, 0x00000020,
+    0x00000031, 0x00000002, 0x0004002b, 0x00000020, 0x00000034, 0x00000003, 0x0004002b, 0x00000020,
+    0x00000037, 0x00000004, 0x0004002b, 0x00000020, 0x0000003a, 0x00000005, 0x0004002b, 0x00000020,
+    0x0000003d, 0x00000006, 0x0004002b, 0x00000020, 0x00000040, 0x00000007, 0x0004002b, 0x00000020,
+    0x00000043, 0x00000008, 0x0004002b, 0x00000020, 0x00000046, 0x00000009, 0x0004002b, 0x00000020,
+    0x00000049, 0x0000000a, 0x0004002b, 0x00000020, 0x0000004c, 0x0000000b, 0x0004002b, 0x00000020,
+    0x0000004f, 0x0000000c, 0x0004002b, 0x00000020, 0x00000052, 0x0000000d, 0x0004002b, 0x00000020,
+    0x00000055, 0x0000000e, 0x0004002b, 0x00000020, 0x00000058, 0x0000000f, 0x0004002b, 0x00000020,
+    0x0000005b, 0x00000010, 0x0004002b, 0x00000020, 0x0000005e, 0x00000011, 0x0004002b, 0x00000020,
+    0x00000061, 0x00000012, 0x0004002b, 0x00000020, 0x00000064, 0x00000013, 0x0004002b, 0x00000020,
+    0x00000067, 0x00000014, 0x0004002b, 0x00000020, 0x0000006a, 0x00000015, 0x0004002b, 0x00000020,
+    0x0000006d, 0x00000016, 0x0004002b, 0x00000020, 0x00000070, 0x00000017, 0x0004002b, 0x00000020,
+    0x00000073, 0x00000018, 0x0004002b, 0x00000020, 0x00000076, 0x00000019, 0x0004002b, 0x00000002,
+    0x0000009a, 0x3f000000, 0x0004002b, 0x00000002, 0x000000fb, 0x3f800000, 0x0004002b, 0x00000002,
+    0x000000fc, 0x00000000, 0x0004002b, 0x00000002, 0x000004ae, 0x3e800000, 0x0004002b, 0x00000002,
+    0x000004c8, 0x447fc000, 0x0004002b, 0x00000014, 0x000004cc, 0x00000006, 0x0004002b, 0x00000014,
+    0x000004d3, 0x00000010, 0x00050036, 0x00000026, 0x00000028, 0x00000000, 0x00000027, 0x000200f8,
+    0x00000029, 0x00050041, 0x0000002a, 0x0000002c, 0x00000021, 0x0000002b, 0x0004003d, 0x00000020,
+    0x0000002d, 0x0000002c, 0x00050041, 0x0000002a, 0x0000002f, 0x00000021, 0x0000002e, 0x0004003d,
+    0x00000020, 0x00000030, 0x0000002f, 0x00050041, 0x0000002a, 0x00000032, 0x00000021, 0x00000031,
+    0x0004003d, 0x00000020, 0x00000033, 0x00000032, 0x00050041, 0x0000002a, 0x00000035, 0x00000021,
+    0x00000034, 0x0004003d, 0x00000020, 0x00000036, 0x00000035, 0x00050041, 0x0000002a, 0x00000038,
+    0x00000021, 0x00000037, 0x0004003d, 0x00000020, 0x00000039, 0x00000038, 0x00050041, 0x0000002a,
+    0x0000003b, 0x00000021, 0x0000003a, 0x0004003d, 0x00000020, 0x0000003c, 0x0000003b, 0x00050041,
+    0x0000002a, 0x0000003e, 0x00000021, 0x0000003d, 0x0004003d, 0x00000020, 0x0000003f, 0x0000003e,
+    0x00050041, 0x0000002a, 0x00000041, 0x00000021, 0x00000040, 0x0004003d, 0x00000020, 0x00000042,
+    0x00000041, 0x00050041, 0x0000002a, 0x00000044, 0x00000021, 0x00000043, 0x0004003d, 0x00000020,
+    0x00000045, 0x00000044, 0x00050041, 0x0000002a, 0x00000047, 0x00000021, 0x00000046, 0x0004003d,
+    0x00000020, 0x00000048, 0x00000047, 0x00050041, 0x0000002a, 0x0000004a, 0x00000021, 0x00000049,
+    0x0004003d, 0x00000020, 0x0000004b, 0x0000004a, 0x00050041, 0x0000002a, 0x0000004d, 0x00000021,
+    0x0000004c, 0x0004003d, 0x00000020, 0x0000004e, 0x0000004d, 0x00050041, 0x0000002a, 0x00000050,
+    0x00000021, 0x0000004f, 0x0004003d, 0x00000020, 0x00000051, 0x00000050, 0x00050041, 0x0000002a,
+    0x00000053, 0x00000021, 0x00000052, 0x0004003d, 0x00000020, 0x00000054, 0x00000053, 0x00050041,
+    0x0000002a, 0x00000056, 0x00000021, 0x00000055, 0x0004003d, 0x00000020, 0x00000057, 0x00000056,
+    0x00050041, 0x0000002a, 0x00000059, 0x00000021, 0x00000058, 0x0004003d, 0x00000020, 0x0000005a,
+    0x00000059, 0x00050041, 0x0000002a, 0x0000005c, 0x00000021, 0x0000005b, 0x0004003d, 0x00000020,
+    0x0000005d, 0x0000005c, 0x00050041, 0x0000002a, 0x0000005f, 0x00000021, 0x0000005e, 0x0004003d,
+    0x00000020, 0x00000060, 0x0000005f, 0x00050041, 0x0000002a, 0x00000062, 0x00000021, 0x00000061,
+    0x0004003d, 0x00000020, 0x00000063, 0x00000062, 0x00050041, 0x0000002a, 0x00000065, 0x00000021,
+    0x00000064, 0x0004003d, 0x00000020, 0x00000066, 0x00000065, 0x00050041, 0x0000002a, 0x00000068,
+    0x00000021, 0x00000067, 0x0004003d, 0x00000020, 0x00000069, 0x00000068, 0x00050041, 0x0000002a,
+    0x0000006b, 0x00000021, 0x0000006a, 0x0004003d, 0x00000020, 0x0000006c, 0x0000006b, 0x00050041,
+    0x0000002a, 0x0000006e, 0x00000021, 0x0000006d, 0x0004003d, 0x00000020, 0x0000006f, 0x0000006e,
+    0x00050041, 0x0000002a, 0x00000071, 0x00000021, 0x00000070, 0x0004003d, 0x00000020, 0x00000072,
+    0x00000071, 0x00050041, 0x0000002a, 0x00000074, 0x00000021, 0x00000073, 0x0004003d, 0x00000020,
+    0x00000075, 0x00000074, 0x00050041, 0x0000002a, 0x00000077, 0x00000021, 0x00000076, 0x0004003d,
+    0x00000020, 0x00000078, 0x00000077, 0x0004003d, 0x00000023, 0x00000079, 0x00000024, 0x00050051,
+    0x00000014, 0x0000007a, 0x00000079, 0x00000000, 0x0004007c, 0x00000020, 0x0000007b, 0x0000007a,
+    0x00050051, 0x00000014, 0x0000007c, 0x00000079, 0x00000001, 0x0004007c, 0x00000020, 0x0000007d,
+    0x0000007c, 0x00050084, 0x00000020, 0x0000007e, 0x0000007b, 0x00000037, 0x00050084, 0x00000020,
+    0x0000007f, 0x0000007d, 0x00000031, 0x000500b1, 0x00000012, 0x00000080, 0x0000007e, 0x00000075,
+    0x000500b1, 0x00000012, 0x00000081, 0x0000007f, 0x00000078, 0x000500a7, 0x00000012, 0x00000082,
+    0x00000080, 0x00000081, 0x000300f7, 0x00000084, 0x00000000, 0x000400fa, 0x00000082, 0x00000083,
+    0x00000084, 0x000200f8, 0x00000083, 0x00050082, 0x00000020, 0x00000085, 0x00000045, 0x0000002e,
+    0x0007000c, 0x00000020, 0x00000086, 0x00000001, 0x0000002a, 0x00000085, 0x0000002b, 0x00050082,
+    0x00000020, 0x00000087, 0x00000048, 0x0000002e, 0x0007000c, 0x00000020, 0x00000088, 0x00000001,
+    0x0000002a, 0x00000087, 0x0000002b, 0x00050082, 0x00000020, 0x00000089, 0x0000005a, 0x0000002e,
+    0x0007000c, 0x00000020, 0x0000008a, 0x00000001, 0x0000002a, 0x00000089, 0x0000002b, 0x00050082,
+    0x00000020, 0x0000008b, 0x0000005d, 0x0000002e, 0x0007000c, 0x00000020, 0x0000008c, 0x00000001,
+    0x0000002a, 0x0000008b, 0x0000002b, 0x0004006f, 0x00000002, 0x0000008d, 0x0000003f, 0x0004006f,
+    0x00000002, 0x0000008e, 0x00000033, 0x00050088, 0x00000002, 0x0000008f, 0x0000008d, 0x0000008e,
+    0x0004006f, 0x00000002, 0x00000090, 0x00000042, 0x0004006f, 0x00000002, 0x00000091, 0x00000036,
+    0x00050088, 0x00000002, 0x00000092, 0x00000090, 0x00000091, 0x000500ab, 0x00000012, 0x00000093,
+    0x00000051, 0x0000002b, 0x000500ab, 0x00000012, 0x00000094, 0x00000066, 0x0000002b, 0x00060050,
+    0x00000003, 0x00000095, 0x00000005, 0x00000006, 0x00000007, 0x00060050, 0x00000003, 0x00000096,
+    0x00000008, 0x00000009, 0x0000000a, 0x00060050, 0x00000003, 0x00000097, 0x0000000b, 0x0000000c,
+    0x0000000d, 0x00050080, 0x00000020, 0x00000098, 0x0000007e, 0x0000002b, 0x00050080, 0x00000020,
+    0x00000099, 0x0000007f, 0x0000002b, 0x00050082, 0x00000020, 0x0000009b, 0x00000098, 0x0000002d,
+    0x00050082, 0x00000020, 0x0000009c, 0x00000099, 0x00000030, 0x0004006f, 0x00000002, 0x0000009d,
+    0x0000009b, 0x00050081, 0x00000002, 0x0000009e, 0x0000009d, 0x0000009a, 0x00050085, 0x00000002,
+    0x0000009f, 0x0000009e, 0x0000008f, 0x00050083, 0x00000002, 0x000000a0, 0x0000009f, 0x0000009a,
+    0x0004006f, 0x00000002, 0x000000a1, 0x0000009c, 0x00050081, 0x00000002, 0x000000a2, 0x000000a1,
+    0x0000009a, 0x00050085, 0x00000002, 0x000000a3, 0x000000a2, 0x00000092, 0x00050083, 0x00000002,
+    0x000000a4, 0x000000a3, 0x0000009a, 0x0006000c, 0x00000002, 0x000000a5, 0x00000001, 0x00000008,
+    0x000000a0, 0x0006000c, 0x00000002, 0x000000a6, 0x00000001, 0x00000008, 0x000000a4, 0x00050083,
+    0x00000002, 0x000000a7, 0x000000a0, 0x000000a5, 0x00050083, 0x00000002, 0x000000a8, 0x000000a4,
+    0x000000a6, 0x0004006e, 0x00000020, 0x000000a9, 0x000000a5, 0x00050080, 0x00000020, 0x000000aa,
+    0x000000a9, 0x00000039, 0x0004006e, 0x00000020, 0x000000ab, 0x000000a6, 0x00050080, 0x00000020,
+    0x000000ac, 0x000000ab, 0x0000003c, 0x00050080, 0x00000020, 0x000000ad, 0x000000aa, 0x0000002e,
+    0x00050080, 0x00000020, 0x000000ae, 0x000000ac, 0x0000002e, 0x0008000c, 0x00000020, 0x000000af,
+    0x00000001, 0x0000002d, 0x000000aa, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x000000b0,
+    0x00000001, 0x0000002d, 0x000000ac, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x000000b1,
+    0x000000b0, 0x0000004e, 0x00050080, 0x00000020, 0x000000b2, 0x000000b1, 0x000000af, 0x00050080,
+    0x00000020, 0x000000b3, 0x0000004b, 0x000000b2, 0x00060041, 0x00000015, 0x000000b4, 0x00000017,
+    0x0000002b, 0x000000b3, 0x0004003d, 0x00000014, 0x000000b5, 0x000000b4, 0x0006000c, 0x00000004,
+    0x000000b6, 0x00000001, 0x00000040, 0x000000b5, 0x00050051, 0x00000002, 0x000000b7, 0x000000b6,
+    0x00000000, 0x00050051, 0x00000002, 0x000000b8, 0x000000b6, 0x00000001, 0x00050051, 0x00000002,
+    0x000000b9, 0x000000b6, 0x00000002, 0x00050051, 0x00000002, 0x000000ba, 0x000000b6, 0x00000003,
+    0x000600a9, 0x00000002, 0x000000bb, 0x00000093, 0x000000b9, 0x000000b7, 0x000600a9, 0x00000002,
+    0x000000bc, 0x00000093, 0x000000b7, 0x000000b9, 0x00060050, 0x00000003, 0x000000bd, 0x000000bb,
+    0x000000b8, 0x000000bc, 0x0008000c, 0x00000020, 0x000000be, 0x00000001, 0x0000002d, 0x000000ad,
+    0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x000000bf, 0x00000001, 0x0000002d, 0x000000ac,
+    0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x000000c0, 0x000000bf, 0x0000004e, 0x00050080,
+    0x00000020, 0x000000c1, 0x000000c0, 0x000000be, 0x00050080, 0x00000020, 0x000000c2, 0x0000004b,
+    0x000000c1, 0x00060041, 0x00000015, 0x000000c3, 0x00000017, 0x0000002b, 0x000000c2, 0x0004003d,
+    0x00000014, 0x000000c4, 0x000000c3, 0x0006000c, 0x00000004, 0x000000c5, 0x00000001, 0x00000040,
+    0x000000c4, 0x00050051, 0x00000002, 0x000000c6, 0x000000c5, 0x00000000, 0x00050051, 0x00000002,
+    0x000000c7, 0x000000c5, 0x00000001, 0x00050051, 0x00000002, 0x000000c8, 0x000000c5, 0x00000002,
+    0x00050051, 0x00000002, 0x000000c9, 0x000000c5, 0x00000003, 0x000600a9, 0x00000002, 0x000000ca,
+    0x00000093, 0x000000c8, 0x000000c6, 0x000600a9, 0x00000002, 0x000000cb, 0x00000093, 0x000000c6,
+    0x000000c8, 0x00060050, 0x00000003, 0x000000cc, 0x000000ca, 0x000000c7, 0x000000cb, 0x00050083,
+    0x00000003, 0x000000cd, 0x000000cc, 0x000000bd, 0x0005008e, 0x00000003, 0x000000ce, 0x000000cd,
+    0x000000a7, 0x00050081, 0x00000003, 0x000000cf, 0x000000bd, 0x000000ce, 0x0008000c, 0x00000020,
+    0x000000d0, 0x00000001, 0x0000002d, 0x000000aa, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020,
+    0x000000d1, 0x00000001, 0x0000002d, 0x000000ae, 0x0000002b, 0x00000088, 0x00050084, 0x00000020,
+    0x000000d2, 0x000000d1, 0x0000004e, 0x00050080, 0x00000020, 0x000000d3, 0x000000d2, 0x000000d0,
+    0x00050080, 0x00000020, 0x000000d4, 0x0000004b, 0x000000d3, 0x00060041, 0x00000015, 0x000000d5,
+    0x00000017, 0x0000002b, 0x000000d4, 0x0004003d, 0x00000014, 0x000000d6, 0x000000d5, 0x0006000c,
+    0x00000004, 0x000000d7, 0x00000001, 0x00000040, 0x000000d6, 0x00050051, 0x00000002, 0x000000d8,
+    0x000000d7, 0x00000000, 0x00050051, 0x00000002, 0x000000d9, 0x000000d7, 0x00000001, 0x00050051,
+    0x00000002, 0x000000da, 0x000000d7, 0x00000002, 0x00050051, 0x00000002, 0x000000db, 0x000000d7,
+    0x00000003, 0x000600a9, 0x00000002, 0x000000dc, 0x00000093, 0x000000da, 0x000000d8, 0x000600a9,
+    0x00000002, 0x000000dd, 0x00000093, 0x000000d8, 0x000000da, 0x00060050, 0x00000003, 0x000000de,
+    0x000000dc, 0x000000d9, 0x000000dd, 0x0008000c, 0x00000020, 0x000000df, 0x00000001, 0x0000002d,
+    0x000000ad, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x000000e0, 0x00000001, 0x0000002d,
+    0x000000ae, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x000000e1, 0x000000e0, 0x0000004e,
+    0x00050080, 0x00000020, 0x000000e2, 0x000000e1, 0x000000df, 0x00050080, 0x00000020, 0x000000e3,
+    0x0000004b, 0x000000e2, 0x00060041, 0x00000015, 0x000000e4, 0x00000017, 0x0000002b, 0x000000e3,
+    0x0004003d, 0x00000014, 0x000000e5, 0x000000e4, 0x0006000c, 0x00000004, 0x000000e6, 0x00000001,
+    0x00000040, 0x000000e5, 0x00050051, 0x00000002, 0x000000e7, 0x000000e6, 0x00000000, 0x00050051,
+    0x00000002, 0x000000e8, 0x000000e6, 0x00000001, 0x00050051, 0x00000002, 0x000000e9, 0x000000e6,
+    0x00000002, 0x00050051, 0x00000002, 0x000000ea, 0x000000e6, 0x00000003, 0x000600a9, 0x00000002,
+    0x000000eb, 0x00000093, 0x000000e9, 0x000000e7, 0x000600a9, 0x00000002, 0x000000ec, 0x00000093,
+    0x000000e7, 0x000000e9, 0x00060050, 0x00000003, 0x000000ed, 0x000000eb, 0x000000e8, 0x000000ec,
+    0x00050083, 0x00000003, 0x000000ee, 0x000000ed, 0x000000de, 0x0005008e, 0x00000003, 0x000000ef,
+    0x000000ee, 0x000000a7, 0x00050081, 0x00000003, 0x000000f0, 0x000000de, 0x000000ef, 0x00050083,
+    0x00000003, 0x000000f1, 0x000000f0, 0x000000cf, 0x0005008e, 0x00000003, 0x000000f2, 0x000000f1,
+    0x000000a8, 0x00050081, 0x00000003, 0x000000f3, 0x000000cf, 0x000000f2, 0x000500af, 0x00000012,
+    0x000000f4, 0x0000009b, 0x0000002b, 0x000500af, 0x00000012, 0x000000f5, 0x0000009c, 0x0000002b,
+    0x000500a7, 0x00000012, 0x000000f6, 0x000000f4, 0x000000f5, 0x000500b1, 0x00000012, 0x000000f7,
+    0x0000009b, 0x00000033, 0x000500b1, 0x00000012, 0x000000f8, 0x0000009c, 0x00000036, 0x000500a7,
+    0x00000012, 0x000000f9, 0x000000f7, 0x000000f8, 0x000500a7, 0x00000012, 0x000000fa, 0x000000f6,
+    0x000000f9, 0x000600a9, 0x00000002, 0x000000fd, 0x000000fa, 0x000000fb, 0x000000fc, 0x0005008e,
+    0x00000003, 0x000000fe, 0x000000f3, 0x000000fd, 0x00050082, 0x00000020, 0x000000ff, 0x00000098,
+    0x00000054, 0x00050082, 0x00000020, 0x00000100, 0x00000099, 0x00000057, 0x000500af, 0x00000012,
+    0x00000101, 0x000000ff, 0x0000002b, 0x000500af, 0x00000012, 0x00000102, 0x00000100, 0x0000002b,
+    0x000500a7, 0x00000012, 0x00000103, 0x00000101, 0x00000102, 0x000500b1, 0x00000012, 0x00000104,
+    0x000000ff, 0x0000005a, 0x000500b1, 0x00000012, 0x00000105, 0x00000100, 0x0000005d, 0x000500a7,
+    0x00000012, 0x00000106, 0x00000104, 0x00000105, 0x000500a7, 0x00000012, 0x00000107, 0x00000103,
+    0x00000106, 0x0008000c, 0x00000020, 0x00000108, 0x00000001, 0x0000002d, 0x000000ff, 0x0000002b,
+    0x0000008a, 0x0008000c, 0x00000020, 0x00000109, 0x00000001, 0x0000002d, 0x00000100, 0x0000002b,
+    0x0000008c, 0x00050084, 0x00000020, 0x0000010a, 0x00000109, 0x00000063, 0x00050080, 0x00000020,
+    0x0000010b, 0x0000010a, 0x00000108, 0x00050080, 0x00000020, 0x0000010c, 0x00000060, 0x0000010b,
+    0x00060041, 0x00000015, 0x0000010d, 0x0000001a, 0x0000002b, 0x0000010c, 0x0004003d, 0x00000014,
+    0x0000010e, 0x0000010d, 0x0006000c, 0x00000004, 0x0000010f, 0x00000001, 0x00000040, 0x0000010e,
+    0x00050051, 0x00000002, 0x00000110, 0x0000010f, 0x00000000, 0x00050051, 0x00000002, 0x00000111,
+    0x0000010f, 0x00000001, 0x00050051, 0x00000002, 0x00000112, 0x0000010f, 0x00000002, 0x00050051,
+    0x00000002, 0x00000113, 0x0000010f, 0x00000003, 0x000600a9, 0x00000002, 0x00000114, 0x00000094,
+    0x00000112, 0x00000110, 0x000600a9, 0x00000002, 0x00000115, 0x00000094, 0x00000110, 0x00000112,
+    0x00060050, 0x00000003, 0x00000116, 0x00000114, 0x00000111, 0x00000115, 0x000600a9, 0x00000002,
+    0x00000117, 0x00000107, 0x00000113, 0x000000fc, 0x00050083, 0x00000003, 0x00000118, 0x00000116,
+    0x000000fe, 0x0005008e, 0x00000003, 0x00000119, 0x00000118, 0x00000117, 0x00050081, 0x00000003,
+    0x0000011a, 0x000000fe, 0x00000119, 0x00050080, 0x00000020, 0x0000011b, 0x0000007e, 0x0000002e,
+    0x00050080, 0x00000020, 0x0000011c, 0x0000007f, 0x0000002b, 0x00050082, 0x00000020, 0x0000011d,
+    0x0000011b, 0x0000002d, 0x00050082, 0x00000020, 0x0000011e, 0x0000011c, 0x00000030, 0x0004006f,
+    0x00000002, 0x0000011f, 0x0000011d, 0x00050081, 0x00000002, 0x00000120, 0x0000011f, 0x0000009a,
+    0x00050085, 0x00000002, 0x00000121, 0x00000120, 0x0000008f, 0x00050083, 0x00000002, 0x00000122,
+    0x00000121, 0x0000009a, 0x0004006f, 0x00000002, 0x00000123, 0x0000011e, 0x00050081, 0x00000002,
+    0x00000124, 0x00000123, 0x0000009a, 0x00050085, 0x00000002, 0x00000125, 0x00000124, 0x00000092,
+    0x00050083, 0x00000002, 0x00000126, 0x00000125, 0x0000009a, 0x0006000c, 0x00000002, 0x00000127,
+    0x00000001, 0x00000008, 0x00000122, 0x0006000c, 0x00000002, 0x00000128, 0x00000001, 0x00000008,
+    0x00000126, 0x00050083, 0x00000002, 0x00000129, 0x00000122, 0x00000127, 0x00050083, 0x00000002,
+    0x0000012a, 0x00000126, 0x00000128, 0x0004006e, 0x00000020, 0x0000012b, 0x00000127, 0x00050080,
+    0x00000020, 0x0000012c, 0x0000012b, 0x00000039, 0x0004006e, 0x00000020, 0x0000012d, 0x00000128,
+    0x00050080, 0x00000020, 0x0000012e, 0x0000012d, 0x0000003c, 0x00050080, 0x00000020, 0x0000012f,
+    0x0000012c, 0x0000002e, 0x00050080, 0x00000020, 0x00000130, 0x0000012e, 0x0000002e, 0x0008000c,
+    0x00000020, 0x00000131, 0x00000001, 0x0000002d, 0x0000012c, 0x0000002b, 0x00000086, 0x0008000c,
+    0x00000020, 0x00000132, 0x00000001, 0x0000002d, 0x0000012e, 0x0000002b, 0x00000088, 0x00050084,
+    0x00000020, 0x00000133, 0x00000132, 0x0000004e, 0x00050080, 0x00000020, 0x00000134, 0x00000133,
+    0x00000131, 0x00050080, 0x00000020, 0x00000135, 0x0000004b, 0x00000134, 0x00060041, 0x00000015,
+    0x00000136, 0x00000017, 0x0000002b, 0x00000135, 0x0004003d, 0x00000014, 0x00000137, 0x00000136,
+    0x0006000c, 0x00000004, 0x00000138, 0x00000001, 0x00000040, 0x00000137, 0x00050051, 0x00000002,
+    0x00000139, 0x00000138, 0x00000000, 0x00050051, 0x00000002, 0x0000013a, 0x00000138, 0x00000001,
+    0x00050051, 0x00000002, 0x0000013b, 0x00000138, 0x00000002, 0x00050051, 0x00000002, 0x0000013c,
+    0x00000138, 0x00000003, 0x000600a9, 0x00000002, 0x0000013d, 0x00000093, 0x0000013b, 0x00000139,
+    0x000600a9, 0x00000002, 0x0000013e, 0x00000093, 0x00000139, 0x0000013b, 0x00060050, 0x00000003,
+    0x0000013f, 0x0000013d, 0x0000013a, 0x0000013e, 0x0008000c, 0x00000020, 0x00000140, 0x00000001,
+    0x0000002d, 0x0000012f, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x00000141, 0x00000001,
+    0x0000002d, 0x0000012e, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x00000142, 0x00000141,
+    0x0000004e, 0x00050080, 0x00000020, 0x00000143, 0x00000142, 0x00000140, 0x00050080, 0x00000020,
+    0x00000144, 0x0000004b, 0x00000143, 0x00060041, 0x00000015, 0x00000145, 0x00000017, 0x0000002b,
+    0x00000144, 0x0004003d, 0x00000014, 0x00000146, 0x00000145, 0x0006000c, 0x00000004, 0x00000147,
+    0x00000001, 0x00000040, 0x00000146, 0x00050051, 0x00000002, 0x00000148, 0x00000147, 0x00000000,
+    0x00050051, 0x00000002, 0x00000149, 0x00000147, 0x00000001, 0x00050051, 0x00000002, 0x0000014a,
+    0x00000147, 0x00000002, 0x00050051, 0x00000002, 0x0000014b, 0x00000147, 0x00000003, 0x000600a9,
+    0x00000002, 0x0000014c, 0x00000093, 0x0000014a, 0x00000148, 0x000600a9, 0x00000002, 0x0000014d,
+    0x00000093, 0x00000148, 0x0000014a, 0x00060050, 0x00000003, 0x0000014e, 0x0000014c, 0x00000149,
+    0x0000014d, 0x00050083, 0x00000003, 0x0000014f, 0x0000014e, 0x0000013f, 0x0005008e, 0x00000003,
+    0x00000150, 0x0000014f, 0x00000129, 0x00050081, 0x00000003, 0x00000151, 0x0000013f, 0x00000150,
+    0x0008000c, 0x00000020, 0x00000152, 0x00000001, 0x0000002d, 0x0000012c, 0x0000002b, 0x00000086,
+    0x0008000c, 0x00000020, 0x00000153, 0x00000001, 0x0000002d, 0x00000130, 0x0000002b, 0x00000088,
+    0x00050084, 0x00000020, 0x00000154, 0x00000153, 0x0000004e, 0x00050080, 0x00000020, 0x00000155,
+    0x00000154, 0x00000152, 0x00050080, 0x00000020, 0x00000156, 0x0000004b, 0x00000155, 0x00060041,
+    0x00000015, 0x00000157, 0x00000017, 0x0000002b, 0x00000156, 0x0004003d, 0x00000014, 0x00000158,
+    0x00000157, 0x0006000c, 0x00000004, 0x00000159, 0x00000001, 0x00000040, 0x00000158, 0x00050051,
+    0x00000002, 0x0000015a, 0x00000159, 0x00000000, 0x00050051, 0x00000002, 0x0000015b, 0x00000159,
+    0x00000001, 0x00050051, 0x00000002, 0x0000015c, 0x00000159, 0x00000002, 0x00050051, 0x00000002,
+    0x0000015d, 0x00000159, 0x00000003, 0x000600a9, 0x00000002, 0x0000015e, 0x00000093, 0x0000015c,
+    0x0000015a, 0x000600a9, 0x00000002, 0x0000015f, 0x00000093, 0x0000015a, 0x0000015c, 0x00060050,
+    0x00000003, 0x00000160, 0x0000015e, 0x0000015b, 0x0000015f, 0x0008000c, 0x00000020, 0x00000161,
+    0x00000001, 0x0000002d, 0x0000012f, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x00000162,
+    0x00000001, 0x0000002d, 0x00000130, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x00000163,
+    0x00000162, 0x0000004e, 0x00050080, 0x00000020, 0x00000164, 0x00000163, 0x00000161, 0x00050080,
+    0x00000020, 0x00000165, 0x0000004b, 0x00000164, 0x00060041, 0x00000015, 0x00000166, 0x00000017,
+    0x0000002b, 0x00000165, 0x0004003d, 0x00000014, 0x00000167, 0x00000166, 0x0006000c, 0x00000004,
+    0x00000168, 0x00000001, 0x00000040, 0x00000167, 0x00050051, 0x00000002, 0x00000169, 0x00000168,
+    0x00000000, 0x00050051, 0x00000002, 0x0000016a, 0x00000168, 0x00000001, 0x00050051, 0x00000002,
+    0x0000016b, 0x00000168, 0x00000002, 0x00050051, 0x00000002, 0x0000016c, 0x00000168, 0x00000003,
+    0x000600a9, 0x00000002, 0x0000016d, 0x00000093, 0x0000016b, 0x00000169, 0x000600a9, 0x00000002,
+    0x0000016e, 0x00000093, 0x00000169, 0x0000016b, 0x00060050, 0x00000003, 0x0000016f, 0x0000016d,
+    0x0000016a, 0x0000016e, 0x00050083, 0x00000003, 0x00000170, 0x0000016f, 0x00000160, 0x0005008e,
+    0x00000003, 0x00000171, 0x00000170, 0x00000129, 0x00050081, 0x00000003, 0x00000172, 0x00000160,
+    0x00000171, 0x00050083, 0x00000003, 0x00000173, 0x00000172, 0x00000151, 0x0005008e, 0x00000003,
+    0x00000174, 0x00000173, 0x0000012a, 0x00050081, 0x00000003, 0x00000175, 0x00000151, 0x00000174,
+    0x000500af, 0x00000012, 0x00000176, 0x0000011d, 0x0000002b, 0x000500af, 0x00000012, 0x00000177,
+    0x0000011e, 0x0000002b, 0x000500a7, 0x00000012, 0x00000178, 0x00000176, 0x00000177, 0x000500b1,
+    0x00000012, 0x00000179, 0x0000011d, 0x00000033, 0x000500b1, 0x00000012, 0x0000017a, 0x0000011e,
+    0x00000036, 0x000500a7, 0x00000012, 0x0000017b, 0x00000179, 0x0000017a, 0x000500a7, 0x00000012,
+    0x0000017c, 0x00000178, 0x0000017b, 0x000600a9, 0x00000002, 0x0000017d, 0x0000017c, 0x000000fb,
+    0x000000fc, 0x0005008e, 0x00000003, 0x0000017e, 0x00000175, 0x0000017d, 0x00050082, 0x00000020,
+    0x0000017f, 0x0000011b, 0x00000054, 0x00050082, 0x00000020, 0x00000180, 0x0000011c, 0x00000057,
+    0x000500af, 0x00000012, 0x00000181, 0x0000017f, 0x0000002b, 0x000500af, 0x00000012, 0x00000182,
+    0x00000180, 0x0000002b, 0x000500a7, 0x00000012, 0x00000183, 0x00000181, 0x00000182, 0x000500b1,
+    0x00000012, 0x00000184, 0x0000017f, 0x0000005a, 0x000500b1, 0x00000012, 0x00000185, 0x00000180,
+    0x0000005d, 0x000500a7, 0x00000012, 0x00000186, 0x00000184, 0x00000185, 0x000500a7, 0x00000012,
+    0x00000187, 0x00000183, 0x00000186, 0x0008000c, 0x00000020, 0x00000188, 0x00000001, 0x0000002d,
+    0x0000017f, 0x0000002b, 0x0000008a, 0x0008000c, 0x00000020, 0x00000189, 0x00000001, 0x0000002d,
+    0x00000180, 0x0000002b, 0x0000008c, 0x00050084, 0x00000020, 0x0000018a, 0x00000189, 0x00000063,
+    0x00050080, 0x00000020, 0x0000018b, 0x0000018a, 0x00000188, 0x00050080, 0x00000020, 0x0000018c,
+    0x00000060, 0x0000018b, 0x00060041, 0x00000015, 0x0000018d, 0x0000001a, 0x0000002b, 0x0000018c,
+    0x0004003d, 0x00000014, 0x0000018e, 0x0000018d, 0x0006000c, 0x00000004, 0x0000018f, 0x00000001,
+    0x00000040, 0x0000018e, 0x00050051, 0x00000002, 0x00000190, 0x0000018f, 0x00000000, 0x00050051,
+    0x00000002, 0x00000191, 0x0000018f, 0x00000001, 0x00050051, 0x00000002, 0x00000192, 0x0000018f,
+    0x00000002, 0x00050051, 0x00000002, 0x00000193, 0x0000018f, 0x00000003, 0x000600a9, 0x00000002,
+    0x00000194, 0x00000094, 0x00000192, 0x00000190, 0x000600a9, 0x00000002, 0x00000195, 0x00000094,
+    0x00000190, 0x00000192, 0x00060050, 0x00000003, 0x00000196, 0x00000194, 0x00000191, 0x00000195,
+    0x000600a9, 0x00000002, 0x00000197, 0x00000187, 0x00000193, 0x000000fc, 0x00050083, 0x00000003,
+    0x00000198, 0x00000196, 0x0000017e, 0x0005008e, 0x00000003, 0x00000199, 0x00000198, 0x00000197,
+    0x00050081, 0x00000003, 0x0000019a, 0x0000017e, 0x00000199, 0x00050080, 0x00000020, 0x0000019b,
+    0x0000007e, 0x00000031, 0x00050080, 0x00000020, 0x0000019c, 0x0000007f, 0x0000002b, 0x00050082,
+    0x00000020, 0x0000019d, 0x0000019b, 0x0000002d, 0x00050082, 0x00000020, 0x0000019e, 0x0000019c,
+    0x00000030, 0x0004006f, 0x00000002, 0x0000019f, 0x0000019d, 0x00050081, 0x00000002, 0x000001a0,
+    0x0000019f, 0x0000009a, 0x00050085, 0x00000002, 0x000001a1, 0x000001a0, 0x0000008f, 0x00050083,
+    0x00000002, 0x000001a2, 0x000001a1, 0x0000009a, 0x0004006f, 0x00000002, 0x000001a3, 0x0000019e,
+    0x00050081, 0x00000002, 0x000001a4, 0x000001a3, 0x0000009a, 0x00050085, 0x00000002, 0x000001a5,
+    0x000001a4, 0x00000092, 0x00050083, 0x00000002, 0x000001a6, 0x000001a5, 0x0000009a, 0x0006000c,
+    0x00000002, 0x000001a7, 0x00000001, 0x00000008, 0x000001a2, 0x0006000c, 0x00000002, 0x000001a8,
+    0x00000001, 0x00000008, 0x000001a6, 0x00050083, 0x00000002, 0x000001a9, 0x000001a2, 0x000001a7,
+    0x00050083, 0x00000002, 0x000001aa, 0x000001a6, 0x000001a8, 0x0004006e, 0x00000020, 0x000001ab,
+    0x000001a7, 0x00050080, 0x00000020, 0x000001ac, 0x000001ab, 0x00000039, 0x0004006e, 0x00000020,
+    0x000001ad, 0x000001a8, 0x00050080, 0x00000020, 0x000001ae, 0x000001ad, 0x0000003c, 0x00050080,
+    0x00000020, 0x000001af, 0x000001ac, 0x0000002e, 0x00050080, 0x00000020, 0x000001b0, 0x000001ae,
+    0x0000002e, 0x0008000c, 0x00000020, 0x000001b1, 0x00000001, 0x0000002d, 0x000001ac, 0x0000002b,
+    0x00000086, 0x0008000c, 0x00000020, 0x000001b2, 0x00000001, 0x0000002d, 0x000001ae, 0x0000002b,
+    0x00000088, 0x00050084, 0x00000020, 0x000001b3, 0x000001b2, 0x0000004e, 0x00050080, 0x00000020,
+    0x000001b4, 0x000001b3, 0x000001b1, 0x00050080, 0x00000020, 0x000001b5, 0x0000004b, 0x000001b4,
+    0x00060041, 0x00000015, 0x000001b6, 0x00000017, 0x0000002b, 0x000001b5, 0x0004003d, 0x00000014,
+    0x000001b7, 0x000001b6, 0x0006000c, 0x00000004, 0x000001b8, 0x00000001, 0x00000040, 0x000001b7,
+    0x00050051, 0x00000002, 0x000001b9, 0x000001b8, 0x00000000, 0x00050051, 0x00000002, 0x000001ba,
+    0x000001b8, 0x00000001, 0x00050051, 0x00000002, 0x000001bb, 0x000001b8, 0x00000002, 0x00050051,
+    0x00000002, 0x000001bc, 0x000001b8, 0x00000003, 0x000600a9, 0x00000002, 0x000001bd, 0x00000093,
+    0x000001bb, 0x000001b9, 0x000600a9, 0x00000002, 0x000001be, 0x00000093, 0x000001b9, 0x000001bb,
+    0x00060050, 0x00000003, 0x000001bf, 0x000001bd, 0x000001ba, 0x000001be, 0x0008000c, 0x00000020,
+    0x000001c0, 0x00000001, 0x0000002d, 0x000001af, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020,
+    0x000001c1, 0x00000001, 0x0000002d, 0x000001ae, 0x0000002b, 0x00000088, 0x00050084, 0x00000020,
+    0x000001c2, 0x000001c1, 0x0000004e, 0x00050080, 0x00000020, 0x000001c3, 0x000001c2, 0x000001c0,
+    0x00050080, 0x00000020, 0x000001c4, 0x0000004b, 0x000001c3, 0x00060041, 0x00000015, 0x000001c5,
+    0x00000017, 0x0000002b, 0x000001c4, 0x0004003d, 0x00000014, 0x000001c6, 0x000001c5, 0x0006000c,
+    0x00000004, 0x000001c7, 0x00000001, 0x00000040, 0x000001c6, 0x00050051, 0x00000002, 0x000001c8,
+    0x000001c7, 0x00000000, 0x00050051, 0x00000002, 0x000001c9, 0x000001c7, 0x00000001, 0x00050051,
+    0x00000002, 0x000001ca, 0x000001c7, 0x00000002, 0x00050051, 0x00000002, 0x000001cb, 0x000001c7,
+    0x00000003, 0x000600a9, 0x00000002, 0x000001cc, 0x00000093, 0x000001ca, 0x000001c8, 0x000600a9,
+    0x00000002, 0x000001cd, 0x00000093, 0x000001c8, 0x000001ca, 0x00060050, 0x00000003, 0x000001ce,
+    0x000001cc, 0x000001c9, 0x000001cd, 0x00050083, 0x00000003, 0x000001cf, 0x000001ce, 0x000001bf,
+    0x0005008e, 0x00000003, 0x000001d0, 0x000001cf, 0x000001a9, 0x00050081, 0x00000003, 0x000001d1,
+    0x000001bf, 0x000001d0, 0x0008000c, 0x00000020, 0x000001d2, 0x00000001, 0x0000002d, 0x000001ac,
+    0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x000001d3, 0x00000001, 0x0000002d, 0x000001b0,
+    0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x000001d4, 0x000001d3, 0x0000004e, 0x00050080,
+    0x00000020, 0x000001d5, 0x000001d4, 0x000001d2, 0x00050080, 0x00000020, 0x000001d6, 0x0000004b,
+    0x000001d5, 0x00060041, 0x00000015, 0x000001d7, 0x00000017, 0x0000002b, 0x000001d6, 0x0004003d,
+    0x00000014, 0x000001d8, 0x000001d7, 0x0006000c, 0x00000004, 0x000001d9, 0x00000001, 0x00000040,
+    0x000001d8, 0x00050051, 0x00000002, 0x000001da, 0x000001d9, 0x00000000, 0x00050051, 0x00000002,
+    0x000001db, 0x000001d9, 0x00000001, 0x00050051, 0x00000002, 0x000001dc, 0x000001d9, 0x00000002,
+    0x00050051, 0x00000002, 0x000001dd, 0x000001d9, 0x00000003, 0x000600a9, 0x00000002, 0x000001de,
+    0x00000093, 0x000001dc, 0x000001da, 0x000600a9, 0x00000002, 0x000001df, 0x00000093, 0x000001da,
+    0x000001dc, 0x00060050, 0x00000003, 0x000001e0, 0x000001de, 0x000001db, 0x000001df, 0x0008000c,
+    0x00000020, 0x000001e1, 0x00000001, 0x0000002d, 0x000001af, 0x0000002b, 0x00000086, 0x0008000c,
+    0x00000020, 0x000001e2, 0x00000001, 0x0000002d, 0x000001b0, 0x0000002b, 0x00000088, 0x00050084,
+    0x00000020, 0x000001e3, 0x000001e2, 0x0000004e, 0x00050080, 0x00000020, 0x000001e4, 0x000001e3,
+    0x000001e1, 0x00050080, 0x00000020, 0x000001e5, 0x0000004b, 0x000001e4, 0x00060041, 0x00000015,
+    0x000001e6, 0x00000017, 0x0000002b, 0x000001e5, 0x0004003d, 0x00000014, 0x000001e7, 0x000001e6,
+    0x0006000c, 0x00000004, 0x000001e8, 0x00000001, 0x00000040, 0x000001e7, 0x00050051, 0x00000002,
+    0x000001e9, 0x000001e8, 0x00000000, 0x00050051, 0x00000002, 0x000001ea, 0x000001e8, 0x00000001,
+    0x00050051, 0x00000002, 0x000001eb, 0x000001e8, 0x00000002, 0x00050051, 0x00000002, 0x000001ec,
+    0x000001e8, 0x00000003, 0x000600a9, 0x00000002, 0x000001ed, 0x00000093, 0x000001eb, 0x000001e9,
+    0x000600a9, 0x00000002, 0x000001ee, 0x00000093, 0x000001e9, 0x000001eb, 0x00060050, 0x00000003,
+    0x000001ef, 0x000001ed, 0x000001ea, 0x000001ee, 0x00050083, 0x00000003, 0x000001f0, 0x000001ef,
+    0x000001e0, 0x0005008e, 0x00000003, 0x000001f1, 0x000001f0, 0x000001a9, 0x00050081, 0x00000003,
+    0x000001f2, 0x000001e0, 0x000001f1, 0x00050083, 0x00000003, 0x000001f3, 0x000001f2, 0x000001d1,
+    0x0005008e, 0x00000003, 0x000001f4, 0x000001f3, 0x000001aa, 0x00050081, 0x00000003, 0x000001f5,
+    0x000001d1, 0x000001f4, 0x000500af, 0x00000012, 0x000001f6, 0x0000019d, 0x0000002b, 0x000500af,
+    0x00000012, 0x000001f7, 0x0000019e, 0x0000002b, 0x000500a7, 0x00000012, 0x000001f8, 0x000001f6,
+    0x000001f7, 0x000500b1, 0x00000012, 0x000001f9, 0x0000019d, 0x00000033, 0x000500b1, 0x00000012,
+    0x000001fa, 0x0000019e, 0x00000036, 0x000500a7, 0x00000012, 0x000001fb, 0x000001f9, 0x000001fa,
+    0x000500a7, 0x00000012, 0x000001fc, 0x000001f8, 0x000001fb, 0x000600a9, 0x00000002, 0x000001fd,
+    0x000001fc, 0x000000fb, 0x000000fc, 0x0005008e, 0x00000003, 0x000001fe, 0x000001f5, 0x000001fd,
+    0x00050082, 0x00000020, 0x000001ff, 0x0000019b, 0x00000054, 0x00050082, 0x00000020, 0x00000200,
+    0x0000019c, 0x00000057, 0x000500af, 0x00000012, 0x00000201, 0x000001ff, 0x0000002b, 0x000500af,
+    0x00000012, 0x00000202, 0x00000200, 0x0000002b, 0x000500a7, 0x00000012, 0x00000203, 0x00000201,
+    0x00000202, 0x000500b1, 0x00000012, 0x00000204, 0x000001ff, 0x0000005a, 0x000500b1, 0x00000012,
+    0x00000205, 0x00000200, 0x0000005d, 0x000500a7, 0x00000012, 0x00000206, 0x00000204, 0x00000205,
+    0x000500a7, 0x00000012, 0x00000207, 0x00000203, 0x00000206, 0x0008000c, 0x00000020, 0x00000208,
+    0x00000001, 0x0000002d, 0x000001ff, 0x0000002b, 0x0000008a, 0x0008000c, 0x00000020, 0x00000209,
+    0x00000001, 0x0000002d, 0x00000200, 0x0000002b, 0x0000008c, 0x00050084, 0x00000020, 0x0000020a,
+    0x00000209, 0x00000063, 0x00050080, 0x00000020, 0x0000020b, 0x0000020a, 0x00000208, 0x00050080,
+    0x00000020, 0x0000020c, 0x00000060, 0x0000020b, 0x00060041, 0x00000015, 0x0000020d, 0x0000001a,
+    0x0000002b, 0x0000020c, 0x0004003d, 0x00000014, 0x0000020e, 0x0000020d, 0x0006000c, 0x00000004,
+    0x0000020f, 0x00000001, 0x00000040, 0x0000020e, 0x00050051, 0x00000002, 0x00000210, 0x0000020f,
+    0x00000000, 0x00050051, 0x00000002, 0x00000211, 0x0000020f, 0x00000001, 0x00050051, 0x00000002,
+    0x00000212, 0x0000020f, 0x00000002, 0x00050051, 0x00000002, 0x00000213, 0x0000020f, 0x00000003,
+    0x000600a9, 0x00000002, 0x00000214, 0x00000094, 0x00000212, 0x00000210, 0x000600a9, 0x00000002,
+    0x00000215, 0x00000094, 0x00000210, 0x00000212, 0x00060050, 0x00000003, 0x00000216, 0x00000214,
+    0x00000211, 0x00000215, 0x000600a9, 0x00000002, 0x00000217, 0x00000207, 0x00000213, 0x000000fc,
+    0x00050083, 0x00000003, 0x00000218, 0x00000216, 0x000001fe, 0x0005008e, 0x00000003, 0x00000219,
+    0x00000218, 0x00000217, 0x00050081, 0x00000003, 0x0000021a, 0x000001fe, 0x00000219, 0x00050080,
+    0x00000020, 0x0000021b, 0x0000007e, 0x00000034, 0x00050080, 0x00000020, 0x0000021c, 0x0000007f,
+    0x0000002b, 0x00050082, 0x00000020, 0x0000021d, 0x0000021b, 0x0000002d, 0x00050082, 0x00000020,
+    0x0000021e, 0x0000021c, 0x00000030, 0x0004006f, 0x00000002, 0x0000021f, 0x0000021d, 0x00050081,
+    0x00000002, 0x00000220, 0x0000021f, 0x0000009a, 0x00050085, 0x00000002, 0x00000221, 0x00000220,
+    0x0000008f, 0x00050083, 0x00000002, 0x00000222, 0x00000221, 0x0000009a, 0x0004006f, 0x00000002,
+    0x00000223, 0x0000021e, 0x00050081, 0x00000002, 0x00000224, 0x00000223, 0x0000009a, 0x00050085,
+    0x00000002, 0x00000225, 0x00000224, 0x00000092, 0x00050083, 0x00000002, 0x00000226, 0x00000225,
+    0x0000009a, 0x0006000c, 0x00000002, 0x00000227, 0x00000001, 0x00000008, 0x00000222, 0x0006000c,
+    0x00000002, 0x00000228, 0x00000001, 0x00000008, 0x00000226, 0x00050083, 0x00000002, 0x00000229,
+    0x00000222, 0x00000227, 0x00050083, 0x00000002, 0x0000022a, 0x00000226, 0x00000228, 0x0004006e,
+    0x00000020, 0x0000022b, 0x00000227, 0x00050080, 0x00000020, 0x0000022c, 0x0000022b, 0x00000039,
+    0x0004006e, 0x00000020, 0x0000022d, 0x00000228, 0x00050080, 0x00000020, 0x0000022e, 0x0000022d,
+    0x0000003c, 0x00050080, 0x00000020, 0x0000022f, 0x0000022c, 0x0000002e, 0x00050080, 0x00000020,
+    0x00000230, 0x0000022e, 0x0000002e, 0x0008000c, 0x00000020, 0x00000231, 0x00000001, 0x0000002d,
+    0x0000022c, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x00000232, 0x00000001, 0x0000002d,
+    0x0000022e, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x00000233, 0x00000232, 0x0000004e,
+    0x00050080, 0x00000020, 0x00000234, 0x00000233, 0x00000231, 0x00050080, 0x00000020, 0x00000235,
+    0x0000004b, 0x00000234, 0x00060041, 0x00000015, 0x00000236, 0x00000017, 0x0000002b, 0x00000235,
+    0x0004003d, 0x00000014, 0x00000237, 0x00000236, 0x0006000c, 0x00000004, 0x00000238, 0x00000001,
+    0x00000040, 0x00000237, 0x00050051, 0x00000002, 0x00000239, 0x00000238, 0x00000000, 0x00050051,
+    0x00000002, 0x0000023a, 0x00000238, 0x00000001, 0x00050051, 0x00000002, 0x0000023b, 0x00000238,
+    0x00000002, 0x00050051, 0x00000002, 0x0000023c, 0x00000238, 0x00000003, 0x000600a9, 0x00000002,
+    0x0000023d, 0x00000093, 0x0000023b, 0x00000239, 0x000600a9, 0x00000002, 0x0000023e, 0x00000093,
+    0x00000239, 0x0000023b, 0x00060050, 0x00000003, 0x0000023f, 0x0000023d, 0x0000023a, 0x0000023e,
+    0x0008000c, 0x00000020, 0x00000240, 0x00000001, 0x0000002d, 0x0000022f, 0x0000002b, 0x00000086,
+    0x0008000c, 0x00000020, 0x00000241, 0x00000001, 0x0000002d, 0x0000022e, 0x0000002b, 0x00000088,
+    0x00050084, 0x00000020, 0x00000242, 0x00000241, 0x0000004e, 0x00050080, 0x00000020, 0x00000243,
+    0x00000242, 0x00000240, 0x00050080, 0x00000020, 0x00000244, 0x0000004b, 0x00000243, 0x00060041,
+    0x00000015, 0x00000245, 0x00000017, 0x0000002b, 0x00000244, 0x0004003d, 0x00000014, 0x00000246,
+    0x00000245, 0x0006000c, 0x00000004, 0x00000247, 0x00000001, 0x00000040, 0x00000246, 0x00050051,
+    0x00000002, 0x00000248, 0x00000247, 0x00000000, 0x00050051, 0x00000002, 0x00000249, 0x00000247,
+    0x00000001, 0x00050051, 0x00000002, 0x0000024a, 0x00000247, 0x00000002, 0x00050051, 0x00000002,
+    0x0000024b, 0x00000247, 0x00000003, 0x000600a9, 0x00000002, 0x0000024c, 0x00000093, 0x0000024a,
+    0x00000248, 0x000600a9, 0x00000002, 0x0000024d, 0x00000093, 0x00000248, 0x0000024a, 0x00060050,
+    0x00000003, 0x0000024e, 0x0000024c, 0x00000249, 0x0000024d, 0x00050083, 0x00000003, 0x0000024f,
+    0x0000024e, 0x0000023f, 0x0005008e, 0x00000003, 0x00000250, 0x0000024f, 0x00000229, 0x00050081,
+    0x00000003, 0x00000251, 0x0000023f, 0x00000250, 0x0008000c, 0x00000020, 0x00000252, 0x00000001,
+    0x0000002d, 0x0000022c, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x00000253, 0x00000001,
+    0x0000002d, 0x00000230, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x00000254, 0x00000253,
+    0x0000004e, 0x00050080, 0x00000020, 0x00000255, 0x00000254, 0x00000252, 0x00050080, 0x00000020,
+    0x00000256, 0x0000004b, 0x00000255, 0x00060041, 0x00000015, 0x00000257, 0x00000017, 0x0000002b,
+    0x00000256, 0x0004003d, 0x00000014, 0x00000258, 0x00000257, 0x0006000c, 0x00000004, 0x00000259,
+    0x00000001, 0x00000040, 0x00000258, 0x00050051, 0x00000002, 0x0000025a, 0x00000259, 0x00000000,
+    0x00050051, 0x00000002, 0x0000025b, 0x00000259, 0x00000001, 0x00050051, 0x00000002, 0x0000025c,
+    0x00000259, 0x00000002, 0x00050051, 0x00000002, 0x0000025d, 0x00000259, 0x00000003, 0x000600a9,
+    0x00000002, 0x0000025e, 0x00000093, 0x0000025c, 0x0000025a, 0x000600a9, 0x00000002, 0x0000025f,
+    0x00000093, 0x0000025a, 0x0000025c, 0x00060050, 0x00000003, 0x00000260, 0x0000025e, 0x0000025b,
+    0x0000025f, 0x0008000c, 0x00000020, 0x00000261, 0x00000001, 0x0000002d, 0x0000022f, 0x0000002b,
+    0x00000086, 0x0008000c, 0x00000020, 0x00000262, 0x00000001, 0x0000002d, 0x00000230, 0x0000002b,
+    0x00000088, 0x00050084, 0x00000020, 0x00000263, 0x00000262, 0x0000004e, 0x00050080, 0x00000020,
+    0x00000264, 0x00000263, 0x00000261, 0x00050080, 0x00000020, 0x00000265, 0x0000004b, 0x00000264,
+    0x00060041, 0x00000015, 0x00000266, 0x00000017, 0x0000002b, 0x00000265, 0x0004003d, 0x00000014,
+    0x00000267, 0x00000266, 0x0006000c, 0x00000004, 0x00000268, 0x00000001, 0x00000040, 0x00000267,
+    0x00050051, 0x00000002, 0x00000269, 0x00000268, 0x00000000, 0x00050051, 0x00000002, 0x0000026a,
+    0x00000268, 0x00000001, 0x00050051, 0x00000002, 0x0000026b, 0x00000268, 0x00000002, 0x00050051,
+    0x00000002, 0x0000026c, 0x00000268, 0x00000003, 0x000600a9, 0x00000002, 0x0000026d, 0x00000093,
+    0x0000026b, 0x00000269, 0x000600a9, 0x00000002, 0x0000026e, 0x00000093, 0x00000269, 0x0000026b,
+    0x00060050, 0x00000003, 0x0000026f, 0x0000026d, 0x0000026a, 0x0000026e, 0x00050083, 0x00000003,
+    0x00000270, 0x0000026f, 0x00000260, 0x0005008e, 0x00000003, 0x00000271, 0x00000270, 0x00000229,
+    0x00050081, 0x00000003, 0x00000272, 0x00000260, 0x00000271, 0x00050083, 0x00000003, 0x00000273,
+    0x00000272, 0x00000251, 0x0005008e, 0x00000003, 0x00000274, 0x00000273, 0x0000022a, 0x00050081,
+    0x00000003, 0x00000275, 0x00000251, 0x00000274, 0x000500af, 0x00000012, 0x00000276, 0x0000021d,
+    0x0000002b, 0x000500af, 0x00000012, 0x00000277, 0x0000021e, 0x0000002b, 0x000500a7, 0x00000012,
+    0x00000278, 0x00000276, 0x00000277, 0x000500b1, 0x00000012, 0x00000279, 0x0000021d, 0x00000033,
+    0x000500b1, 0x00000012, 0x0000027a, 0x0000021e, 0x00000036, 0x000500a7, 0x00000012, 0x0000027b,
+    0x00000279, 0x0000027a, 0x000500a7, 0x00000012, 0x0000027c, 0x00000278, 0x0000027b, 0x000600a9,
+    0x00000002, 0x0000027d, 0x0000027c, 0x000000fb, 0x000000fc, 0x0005008e, 0x00000003, 0x0000027e,
+    0x00000275, 0x0000027d, 0x00050082, 0x00000020, 0x0000027f, 0x0000021b, 0x00000054, 0x00050082,
+    0x00000020, 0x00000280, 0x0000021c, 0x00000057, 0x000500af, 0x00000012, 0x00000281, 0x0000027f,
+    0x0000002b, 0x000500af, 0x00000012, 0x00000282, 0x00000280, 0x0000002b, 0x000500a7, 0x00000012,
+    0x00000283, 0x00000281, 0x00000282, 0x000500b1, 0x00000012, 0x00000284, 0x0000027f, 0x0000005a,
+    0x000500b1, 0x00000012, 0x00000285, 0x00000280, 0x0000005d, 0x000500a7, 0x00000012, 0x00000286,
+    0x00000284, 0x00000285, 0x000500a7, 0x00000012, 0x00000287, 0x00000283, 0x00000286, 0x0008000c,
+    0x00000020, 0x00000288, 0x00000001, 0x0000002d, 0x0000027f, 0x0000002b, 0x0000008a, 0x0008000c,
+    0x00000020, 0x00000289, 0x00000001, 0x0000002d, 0x00000280, 0x0000002b, 0x0000008c, 0x00050084,
+    0x00000020, 0x0000028a, 0x00000289, 0x00000063, 0x00050080, 0x00000020, 0x0000028b, 0x0000028a,
+    0x00000288, 0x00050080, 0x00000020, 0x0000028c, 0x00000060, 0x0000028b, 0x00060041, 0x00000015,
+    0x0000028d, 0x0000001a, 0x0000002b, 0x0000028c, 0x0004003d, 0x00000014, 0x0000028e, 0x0000028d,
+    0x0006000c, 0x00000004, 0x0000028f, 0x00000001, 0x00000040, 0x0000028e, 0x00050051, 0x00000002,
+    0x00000290, 0x0000028f, 0x00000000, 0x00050051, 0x00000002, 0x00000291, 0x0000028f, 0x00000001,
+    0x00050051, 0x00000002, 0x00000292, 0x0000028f, 0x00000002, 0x00050051, 0x00000002, 0x00000293,
+    0x0000028f, 0x00000003, 0x000600a9, 0x00000002, 0x00000294, 0x00000094, 0x00000292, 0x00000290,
+    0x000600a9, 0x00000002, 0x00000295, 0x00000094, 0x00000290, 0x00000292, 0x00060050, 0x00000003,
+    0x00000296, 0x00000294, 0x00000291, 0x00000295, 0x000600a9, 0x00000002, 0x00000297, 0x00000287,
+    0x00000293, 0x000000fc, 0x00050083, 0x00000003, 0x00000298, 0x00000296, 0x0000027e, 0x0005008e,
+    0x00000003, 0x00000299, 0x00000298, 0x00000297, 0x00050081, 0x00000003, 0x0000029a, 0x0000027e,
+    0x00000299, 0x00050080, 0x00000020, 0x0000029b, 0x0000007e, 0x0000002b, 0x00050080, 0x00000020,
+    0x0000029c, 0x0000007f, 0x0000002e, 0x00050082, 0x00000020, 0x0000029d, 0x0000029b, 0x0000002d,
+    0x00050082, 0x00000020, 0x0000029e, 0x0000029c, 0x00000030, 0x0004006f, 0x00000002, 0x0000029f,
+    0x0000029d, 0x00050081, 0x00000002, 0x000002a0, 0x0000029f, 0x0000009a, 0x00050085, 0x00000002,
+    0x000002a1, 0x000002a0, 0x0000008f, 0x00050083, 0x00000002, 0x000002a2, 0x000002a1, 0x0000009a,
+    0x0004006f, 0x00000002, 0x000002a3, 0x0000029e, 0x00050081, 0x00000002, 0x000002a4, 0x000002a3,
+    0x0000009a, 0x00050085, 0x00000002, 0x000002a5, 0x000002a4, 0x00000092, 0x00050083, 0x00000002,
+    0x000002a6, 0x000002a5, 0x0000009a, 0x0006000c, 0x00000002, 0x000002a7, 0x00000001, 0x00000008,
+    0x000002a2, 0x0006000c, 0x00000002, 0x000002a8, 0x00000001, 0x00000008, 0x000002a6, 0x00050083,
+    0x00000002, 0x000002a9, 0x000002a2, 0x000002a7, 0x00050083, 0x00000002, 0x000002aa, 0x000002a6,
+    0x000002a8, 0x0004006e, 0x00000020, 0x000002ab, 0x000002a7, 0x00050080, 0x00000020, 0x000002ac,
+    0x000002ab, 0x00000039, 0x0004006e, 0x00000020, 0x000002ad, 0x000002a8, 0x00050080, 0x00000020,
+    0x000002ae, 0x000002ad, 0x0000003c, 0x00050080, 0x00000020, 0x000002af, 0x000002ac, 0x0000002e,
+    0x00050080, 0x00000020, 0x000002b0, 0x000002ae, 0x0000002e, 0x0008000c, 0x00000020, 0x000002b1,
+    0x00000001, 0x0000002d, 0x000002ac, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x000002b2,
+    0x00000001, 0x0000002d, 0x000002ae, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x000002b3,
+    0x000002b2, 0x0000004e, 0x00050080, 0x00000020, 0x000002b4, 0x000002b3, 0x000002b1, 0x00050080,
+    0x00000020, 0x000002b5, 0x0000004b, 0x000002b4, 0x00060041, 0x00000015, 0x000002b6, 0x00000017,
+    0x0000002b, 0x000002b5, 0x0004003d, 0x00000014, 0x000002b7, 0x000002b6, 0x0006000c, 0x00000004,
+    0x000002b8, 0x00000001, 0x00000040, 0x000002b7, 0x00050051, 0x00000002, 0x000002b9, 0x000002b8,
+    0x00000000, 0x00050051, 0x00000002, 0x000002ba, 0x000002b8, 0x00000001, 0x00050051, 0x00000002,
+    0x000002bb, 0x000002b8, 0x00000002, 0x00050051, 0x00000002, 0x000002bc, 0x000002b8, 0x00000003,
+    0x000600a9, 0x00000002, 0x000002bd, 0x00000093, 0x000002bb, 0x000002b9, 0x000600a9, 0x00000002,
+    0x000002be, 0x00000093, 0x000002b9, 0x000002bb, 0x00060050, 0x00000003, 0x000002bf, 0x000002bd,
+    0x000002ba, 0x000002be, 0x0008000c, 0x00000020, 0x000002c0, 0x00000001, 0x0000002d, 0x000002af,
+    0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x000002c1, 0x00000001, 0x0000002d, 0x000002ae,
+    0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x000002c2, 0x000002c1, 0x0000004e, 0x00050080,
+    0x00000020, 0x000002c3, 0x000002c2, 0x000002c0, 0x00050080, 0x00000020, 0x000002c4, 0x0000004b,
+    0x000002c3, 0x00060041, 0x00000015, 0x000002c5, 0x00000017, 0x0000002b, 0x000002c4, 0x0004003d,
+    0x00000014, 0x000002c6, 0x000002c5, 0x0006000c, 0x00000004, 0x000002c7, 0x00000001, 0x00000040,
+    0x000002c6, 0x00050051, 0x00000002, 0x000002c8, 0x000002c7, 0x00000000, 0x00050051, 0x00000002,
+    0x000002c9, 0x000002c7, 0x00000001, 0x00050051, 0x00000002, 0x000002ca, 0x000002c7, 0x00000002,
+    0x00050051, 0x00000002, 0x000002cb, 0x000002c7, 0x00000003, 0x000600a9, 0x00000002, 0x000002cc,
+    0x00000093, 0x000002ca, 0x000002c8, 0x000600a9, 0x00000002, 0x000002cd, 0x00000093, 0x000002c8,
+    0x000002ca, 0x00060050, 0x00000003, 0x000002ce, 0x000002cc, 0x000002c9, 0x000002cd, 0x00050083,
+    0x00000003, 0x000002cf, 0x000002ce, 0x000002bf, 0x0005008e, 0x00000003, 0x000002d0, 0x000002cf,
+    0x000002a9, 0x00050081, 0x00000003, 0x000002d1, 0x000002bf, 0x000002d0, 0x0008000c, 0x00000020,
+    0x000002d2, 0x00000001, 0x0000002d, 0x000002ac, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020,
+    0x000002d3, 0x00000001, 0x0000002d, 0x000002b0, 0x0000002b, 0x00000088, 0x00050084, 0x00000020,
+    0x000002d4, 0x000002d3, 0x0000004e, 0x00050080, 0x00000020, 0x000002d5, 0x000002d4, 0x000002d2,
+    0x00050080, 0x00000020, 0x000002d6, 0x0000004b, 0x000002d5, 0x00060041, 0x00000015, 0x000002d7,
+    0x00000017, 0x0000002b, 0x000002d6, 0x0004003d, 0x00000014, 0x000002d8, 0x000002d7, 0x0006000c,
+    0x00000004, 0x000002d9, 0x00000001, 0x00000040, 0x000002d8, 0x00050051, 0x00000002, 0x000002da,
+    0x000002d9, 0x00000000, 0x00050051, 0x00000002, 0x000002db, 0x000002d9, 0x00000001, 0x00050051,
+    0x00000002, 0x000002dc, 0x000002d9, 0x00000002, 0x00050051, 0x00000002, 0x000002dd, 0x000002d9,
+    0x00000003, 0x000600a9, 0x00000002, 0x000002de, 0x00000093, 0x000002dc, 0x000002da, 0x000600a9,
+    0x00000002, 0x000002df, 0x00000093, 0x000002da, 0x000002dc, 0x00060050, 0x00000003, 0x000002e0,
+    0x000002de, 0x000002db, 0x000002df, 0x0008000c, 0x00000020, 0x000002e1, 0x00000001, 0x0000002d,
+    0x000002af, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x000002e2, 0x00000001, 0x0000002d,
+    0x000002b0, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x000002e3, 0x000002e2, 0x0000004e,
+    0x00050080, 0x00000020, 0x000002e4, 0x000002e3, 0x000002e1, 0x00050080, 0x00000020, 0x000002e5,
+    0x0000004b, 0x000002e4, 0x00060041, 0x00000015, 0x000002e6, 0x00000017, 0x0000002b, 0x000002e5,
+    0x0004003d, 0x00000014, 0x000002e7, 0x000002e6, 0x0006000c, 0x00000004, 0x000002e8, 0x00000001,
+    0x00000040, 0x000002e7, 0x00050051, 0x00000002, 0x000002e9, 0x000002e8, 0x00000000, 0x00050051,
+    0x00000002, 0x000002ea, 0x000002e8, 0x00000001, 0x00050051, 0x00000002, 0x000002eb, 0x000002e8,
+    0x00000002, 0x00050051, 0x00000002, 0x000002ec, 0x000002e8, 0x00000003, 0x000600a9, 0x00000002,
+    0x000002ed, 0x00000093, 0x000002eb, 0x000002e9, 0x000600a9, 0x00000002, 0x000002ee, 0x00000093,
+    0x000002e9, 0x000002eb, 0x00060050, 0x00000003, 0x000002ef, 0x000002ed, 0x000002ea, 0x000002ee,
+    0x00050083, 0x00000003, 0x000002f0, 0x000002ef, 0x000002e0, 0x0005008e, 0x00000003, 0x000002f1,
+    0x000002f0, 0x000002a9, 0x00050081, 0x00000003, 0x000002f2, 0x000002e0, 0x000002f1, 0x00050083,
+    0x00000003, 0x000002f3, 0x000002f2, 0x000002d1, 0x0005008e, 0x00000003, 0x000002f4, 0x000002f3,
+    0x000002aa, 0x00050081, 0x00000003, 0x000002f5, 0x000002d1, 0x000002f4, 0x000500af, 0x00000012,
+    0x000002f6, 0x0000029d, 0x0000002b, 0x000500af, 0x00000012, 0x000002f7, 0x0000029e, 0x0000002b,
+    0x000500a7, 0x00000012, 0x000002f8, 0x000002f6, 0x000002f7, 0x000500b1, 0x00000012, 0x000002f9,
+    0x0000029d, 0x00000033, 0x000500b1, 0x00000012, 0x000002fa, 0x0000029e, 0x00000036, 0x000500a7,
+    0x00000012, 0x000002fb, 0x000002f9, 0x000002fa, 0x000500a7, 0x00000012, 0x000002fc, 0x000002f8,
+    0x000002fb, 0x000600a9, 0x00000002, 0x000002fd, 0x000002fc, 0x000000fb, 0x000000fc, 0x0005008e,
+    0x00000003, 0x000002fe, 0x000002f5, 0x000002fd, 0x00050082, 0x00000020, 0x000002ff, 0x0000029b,
+    0x00000054, 0x00050082, 0x00000020, 0x00000300, 0x0000029c, 0x00000057, 0x000500af, 0x00000012,
+    0x00000301, 0x000002ff, 0x0000002b, 0x000500af, 0x00000012, 0x00000302, 0x00000300, 0x0000002b,
+    0x000500a7, 0x00000012, 0x00000303, 0x00000301, 0x00000302, 0x000500b1, 0x00000012, 0x00000304,
+    0x000002ff, 0x0000005a, 0x000500b1, 0x00000012, 0x00000305, 0x00000300, 0x0000005d, 0x000500a7,
+    0x00000012, 0x00000306, 0x00000304, 0x00000305, 0x000500a7, 0x00000012, 0x00000307, 0x00000303,
+    0x00000306, 0x0008000c, 0x00000020, 0x00000308, 0x00000001, 0x0000002d, 0x000002ff, 0x0000002b,
+    0x0000008a, 0x0008000c, 0x00000020, 0x00000309, 0x00000001, 0x0000002d, 0x00000300, 0x0000002b,
+    0x0000008c, 0x00050084, 0x00000020, 0x0000030a, 0x00000309, 0x00000063, 0x00050080, 0x00000020,
+    0x0000030b, 0x0000030a, 0x00000308, 0x00050080, 0x00000020, 0x0000030c, 0x00000060, 0x0000030b,
+    0x00060041, 0x00000015, 0x0000030d, 0x0000001a, 0x0000002b, 0x0000030c, 0x0004003d, 0x00000014,
+    0x0000030e, 0x0000030d, 0x0006000c, 0x00000004, 0x0000030f, 0x00000001, 0x00000040, 0x0000030e,
+    0x00050051, 0x00000002, 0x00000310, 0x0000030f, 0x00000000, 0x00050051, 0x00000002, 0x00000311,
+    0x0000030f, 0x00000001, 0x00050051, 0x00000002, 0x00000312, 0x0000030f, 0x00000002, 0x00050051,
+    0x00000002, 0x00000313, 0x0000030f, 0x00000003, 0x000600a9, 0x00000002, 0x00000314, 0x00000094,
+    0x00000312, 0x00000310, 0x000600a9, 0x00000002, 0x00000315, 0x00000094, 0x00000310, 0x00000312,
+    0x00060050, 0x00000003, 0x00000316, 0x00000314, 0x00000311, 0x00000315, 0x000600a9, 0x00000002,
+    0x00000317, 0x00000307, 0x00000313, 0x000000fc, 0x00050083, 0x00000003, 0x00000318, 0x00000316,
+    0x000002fe, 0x0005008e, 0x00000003, 0x00000319, 0x00000318, 0x00000317, 0x00050081, 0x00000003,
+    0x0000031a, 0x000002fe, 0x00000319, 0x00050080, 0x00000020, 0x0000031b, 0x0000007e, 0x0000002e,
+    0x00050080, 0x00000020, 0x0000031c, 0x0000007f, 0x0000002e, 0x00050082, 0x00000020, 0x0000031d,
+    0x0000031b, 0x0000002d, 0x00050082, 0x00000020, 0x0000031e, 0x0000031c, 0x00000030, 0x0004006f,
+    0x00000002, 0x0000031f, 0x0000031d, 0x00050081, 0x00000002, 0x00000320, 0x0000031f, 0x0000009a,
+    0x00050085, 0x00000002, 0x00000321, 0x00000320, 0x0000008f, 0x00050083, 0x00000002, 0x00000322,
+    0x00000321, 0x0000009a, 0x0004006f, 0x00000002, 0x00000323, 0x0000031e, 0x00050081, 0x00000002,
+    0x00000324, 0x00000323, 0x0000009a, 0x00050085, 0x00000002, 0x00000325, 0x00000324, 0x00000092,
+    0x00050083, 0x00000002, 0x00000326, 0x00000325, 0x0000009a, 0x0006000c, 0x00000002, 0x00000327,
+    0x00000001, 0x00000008, 0x00000322, 0x0006000c, 0x00000002, 0x00000328, 0x00000001, 0x00000008,
+    0x00000326, 0x00050083, 0x00000002, 0x00000329, 0x00000322, 0x00000327, 0x00050083, 0x00000002,
+    0x0000032a, 0x00000326, 0x00000328, 0x0004006e, 0x00000020, 0x0000032b, 0x00000327, 0x00050080,
+    0x00000020, 0x0000032c, 0x0000032b, 0x00000039, 0x0004006e, 0x00000020, 0x0000032d, 0x00000328,
+    0x00050080, 0x00000020, 0x0000032e, 0x0000032d, 0x0000003c, 0x00050080, 0x00000020, 0x0000032f,
+    0x0000032c, 0x0000002e, 0x00050080, 0x00000020, 0x00000330, 0x0000032e, 0x0000002e, 0x0008000c,
+    0x00000020, 0x00000331, 0x00000001, 0x0000002d, 0x0000032c, 0x0000002b, 0x00000086, 0x0008000c,
+    0x00000020, 0x00000332, 0x00000001, 0x0000002d, 0x0000032e, 0x0000002b, 0x00000088, 0x00050084,
+    0x00000020, 0x00000333, 0x00000332, 0x0000004e, 0x00050080, 0x00000020, 0x00000334, 0x00000333,
+    0x00000331, 0x00050080, 0x00000020, 0x00000335, 0x0000004b, 0x00000334, 0x00060041, 0x00000015,
+    0x00000336, 0x00000017, 0x0000002b, 0x00000335, 0x0004003d, 0x00000014, 0x00000337, 0x00000336,
+    0x0006000c, 0x00000004, 0x00000338, 0x00000001, 0x00000040, 0x00000337, 0x00050051, 0x00000002,
+    0x00000339, 0x00000338, 0x00000000, 0x00050051, 0x00000002, 0x0000033a, 0x00000338, 0x00000001,
+    0x00050051, 0x00000002, 0x0000033b, 0x00000338, 0x00000002, 0x00050051, 0x00000002, 0x0000033c,
+    0x00000338, 0x00000003, 0x000600a9, 0x00000002, 0x0000033d, 0x00000093, 0x0000033b, 0x00000339,
+    0x000600a9, 0x00000002, 0x0000033e, 0x00000093, 0x00000339, 0x0000033b, 0x00060050, 0x00000003,
+    0x0000033f, 0x0000033d, 0x0000033a, 0x0000033e, 0x0008000c, 0x00000020, 0x00000340, 0x00000001,
+    0x0000002d, 0x0000032f, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x00000341, 0x00000001,
+    0x0000002d, 0x0000032e, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x00000342, 0x00000341,
+    0x0000004e, 0x00050080, 0x00000020, 0x00000343, 0x00000342, 0x00000340, 0x00050080, 0x00000020,
+    0x00000344, 0x0000004b, 0x00000343, 0x00060041, 0x00000015, 0x00000345, 0x00000017, 0x0000002b,
+    0x00000344, 0x0004003d, 0x00000014, 0x00000346, 0x00000345, 0x0006000c, 0x00000004, 0x00000347,
+    0x00000001, 0x00000040, 0x00000346, 0x00050051, 0x00000002, 0x00000348, 0x00000347, 0x00000000,
+    0x00050051, 0x00000002, 0x00000349, 0x00000347, 0x00000001, 0x00050051, 0x00000002, 0x0000034a,
+    0x00000347, 0x00000002, 0x00050051, 0x00000002, 0x0000034b, 0x00000347, 0x00000003, 0x000600a9,
+    0x00000002, 0x0000034c, 0x00000093, 0x0000034a, 0x00000348, 0x000600a9, 0x00000002, 0x0000034d,
+    0x00000093, 0x00000348, 0x0000034a, 0x00060050, 0x00000003, 0x0000034e, 0x0000034c, 0x00000349,
+    0x0000034d, 0x00050083, 0x00000003, 0x0000034f, 0x0000034e, 0x0000033f, 0x0005008e, 0x00000003,
+    0x00000350, 0x0000034f, 0x00000329, 0x00050081, 0x00000003, 0x00000351, 0x0000033f, 0x00000350,
+    0x0008000c, 0x00000020, 0x00000352, 0x00000001, 0x0000002d, 0x0000032c, 0x0000002b, 0x00000086,
+    0x0008000c, 0x00000020, 0x00000353, 0x00000001, 0x0000002d, 0x00000330, 0x0000002b, 0x00000088,
+    0x00050084, 0x00000020, 0x00000354, 0x00000353, 0x0000004e, 0x00050080, 0x00000020, 0x00000355,
+    0x00000354, 0x00000352, 0x00050080, 0x00000020, 0x00000356, 0x0000004b, 0x00000355, 0x00060041,
+    0x00000015, 0x00000357, 0x00000017, 0x0000002b, 0x00000356, 0x0004003d, 0x00000014, 0x00000358,
+    0x00000357, 0x0006000c, 0x00000004, 0x00000359, 0x00000001, 0x00000040, 0x00000358, 0x00050051,
+    0x00000002, 0x0000035a, 0x00000359, 0x00000000, 0x00050051, 0x00000002, 0x0000035b, 0x00000359,
+    0x00000001, 0x00050051, 0x00000002, 0x0000035c, 0x00000359, 0x00000002, 0x00050051, 0x00000002,
+    0x0000035d, 0x00000359, 0x00000003, 0x000600a9, 0x00000002, 0x0000035e, 0x00000093, 0x0000035c,
+    0x0000035a, 0x000600a9, 0x00000002, 0x0000035f, 0x00000093, 0x0000035a, 0x0000035c, 0x00060050,
+    0x00000003, 0x00000360, 0x0000035e, 0x0000035b, 0x0000035f, 0x0008000c, 0x00000020, 0x00000361,
+    0x00000001, 0x0000002d, 0x0000032f, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x00000362,
+    0x00000001, 0x0000002d, 0x00000330, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x00000363,
+    0x00000362, 0x0000004e, 0x00050080, 0x00000020, 0x00000364, 0x00000363, 0x00000361, 0x00050080,
+    0x00000020, 0x00000365, 0x0000004b, 0x00000364, 0x00060041, 0x00000015, 0x00000366, 0x00000017,
+    0x0000002b, 0x00000365, 0x0004003d, 0x00000014, 0x00000367, 0x00000366, 0x0006000c, 0x00000004,
+    0x00000368, 0x00000001, 0x00000040, 0x00000367, 0x00050051, 0x00000002, 0x00000369, 0x00000368,
+    0x00000000, 0x00050051, 0x00000002, 0x0000036a, 0x00000368, 0x00000001, 0x00050051, 0x00000002,
+    0x0000036b, 0x00000368, 0x00000002, 0x00050051, 0x00000002, 0x0000036c, 0x00000368, 0x00000003,
+    0x000600a9, 0x00000002, 0x0000036d, 0x00000093, 0x0000036b, 0x00000369, 0x000600a9, 0x00000002,
+    0x0000036e, 0x00000093, 0x00000369, 0x0000036b, 0x00060050, 0x00000003, 0x0000036f, 0x0000036d,
+    0x0000036a, 0x0000036e, 0x00050083, 0x00000003, 0x00000370, 0x0000036f, 0x00000360, 0x0005008e,
+    0x00000003, 0x00000371, 0x00000370, 0x00000329, 0x00050081, 0x00000003, 0x00000372, 0x00000360,
+    0x00000371, 0x00050083, 0x00000003, 0x00000373, 0x00000372, 0x00000351, 0x0005008e, 0x00000003,
+    0x00000374, 0x00000373, 0x0000032a, 0x00050081, 0x00000003, 0x00000375, 0x00000351, 0x00000374,
+    0x000500af, 0x00000012, 0x00000376, 0x0000031d, 0x0000002b, 0x000500af, 0x00000012, 0x00000377,
+    0x0000031e, 0x0000002b, 0x000500a7, 0x00000012, 0x00000378, 0x00000376, 0x00000377, 0x000500b1,
+    0x00000012, 0x00000379, 0x0000031d, 0x00000033, 0x000500b1, 0x00000012, 0x0000037a, 0x0000031e,
+    0x00000036, 0x000500a7, 0x00000012, 0x0000037b, 0x00000379, 0x0000037a, 0x000500a7, 0x00000012,
+    0x0000037c, 0x00000378, 0x0000037b, 0x000600a9, 0x00000002, 0x0000037d, 0x0000037c, 0x000000fb,
+    0x000000fc, 0x0005008e, 0x00000003, 0x0000037e, 0x00000375, 0x0000037d, 0x00050082, 0x00000020,
+    0x0000037f, 0x0000031b, 0x00000054, 0x00050082, 0x00000020, 0x00000380, 0x0000031c, 0x00000057,
+    0x000500af, 0x00000012, 0x00000381, 0x0000037f, 0x0000002b, 0x000500af, 0x00000012, 0x00000382,
+    0x00000380, 0x0000002b, 0x000500a7, 0x00000012, 0x00000383, 0x00000381, 0x00000382, 0x000500b1,
+    0x00000012, 0x00000384, 0x0000037f, 0x0000005a, 0x000500b1, 0x00000012, 0x00000385, 0x00000380,
+    0x0000005d, 0x000500a7, 0x00000012, 0x00000386, 0x00000384, 0x00000385, 0x000500a7, 0x00000012,
+    0x00000387, 0x00000383, 0x00000386, 0x0008000c, 0x00000020, 0x00000388, 0x00000001, 0x0000002d,
+    0x0000037f, 0x0000002b, 0x0000008a, 0x0008000c, 0x00000020, 0x00000389, 0x00000001, 0x0000002d,
+    0x00000380, 0x0000002b, 0x0000008c, 0x00050084, 0x00000020, 0x0000038a, 0x00000389, 0x00000063,
+    0x00050080, 0x00000020, 0x0000038b, 0x0000038a, 0x00000388, 0x00050080, 0x00000020, 0x0000038c,
+    0x00000060, 0x0000038b, 0x00060041, 0x00000015, 0x0000038d, 0x0000001a, 0x0000002b, 0x0000038c,
+    0x0004003d, 0x00000014, 0x0000038e, 0x0000038d, 0x0006000c, 0x00000004, 0x0000038f, 0x00000001,
+    0x00000040, 0x0000038e, 0x00050051, 0x00000002, 0x00000390, 0x0000038f, 0x00000000, 0x00050051,
+    0x00000002, 0x00000391, 0x0000038f, 0x00000001, 0x00050051, 0x00000002, 0x00000392, 0x0000038f,
+    0x00000002, 0x00050051, 0x00000002, 0x00000393, 0x0000038f, 0x00000003, 0x000600a9, 0x00000002,
+    0x00000394, 0x00000094, 0x00000392, 0x00000390, 0x000600a9, 0x00000002, 0x00000395, 0x00000094,
+    0x00000390, 0x00000392, 0x00060050, 0x00000003, 0x00000396, 0x00000394, 0x00000391, 0x00000395,
+    0x000600a9, 0x00000002, 0x00000397, 0x00000387, 0x00000393, 0x000000fc, 0x00050083, 0x00000003,
+    0x00000398, 0x00000396, 0x0000037e, 0x0005008e, 0x00000003, 0x00000399, 0x00000398, 0x00000397,
+    0x00050081, 0x00000003, 0x0000039a, 0x0000037e, 0x00000399, 0x00050080, 0x00000020, 0x0000039b,
+    0x0000007e, 0x00000031, 0x00050080, 0x00000020, 0x0000039c, 0x0000007f, 0x0000002e, 0x00050082,
+    0x00000020, 0x0000039d, 0x0000039b, 0x0000002d, 0x00050082, 0x00000020, 0x0000039e, 0x0000039c,
+    0x00000030, 0x0004006f, 0x00000002, 0x0000039f, 0x0000039d, 0x00050081, 0x00000002, 0x000003a0,
+    0x0000039f, 0x0000009a, 0x00050085, 0x00000002, 0x000003a1, 0x000003a0, 0x0000008f, 0x00050083,
+    0x00000002, 0x000003a2, 0x000003a1, 0x0000009a, 0x0004006f, 0x00000002, 0x000003a3, 0x0000039e,
+    0x00050081, 0x00000002, 0x000003a4, 0x000003a3, 0x0000009a, 0x00050085, 0x00000002, 0x000003a5,
+    0x000003a4, 0x00000092, 0x00050083, 0x00000002, 0x000003a6, 0x000003a5, 0x0000009a, 0x0006000c,
+    0x00000002, 0x000003a7, 0x00000001, 0x00000008, 0x000003a2, 0x0006000c, 0x00000002, 0x000003a8,
+    0x00000001, 0x00000008, 0x000003a6, 0x00050083, 0x00000002, 0x000003a9, 0x000003a2, 0x000003a7,
+    0x00050083, 0x00000002, 0x000003aa, 0x000003a6, 0x000003a8, 0x0004006e, 0x00000020, 0x000003ab,
+    0x000003a7, 0x00050080, 0x00000020, 0x000003ac, 0x000003ab, 0x00000039, 0x0004006e, 0x00000020,
+    0x000003ad, 0x000003a8, 0x00050080, 0x00000020, 0x000003ae, 0x000003ad, 0x0000003c, 0x00050080,
+    0x00000020, 0x000003af, 0x000003ac, 0x0000002e, 0x00050080, 0x00000020, 0x000003b0, 0x000003ae,
+    0x0000002e, 0x0008000c, 0x00000020, 0x000003b1, 0x00000001, 0x0000002d, 0x000003ac, 0x0000002b,
+    0x00000086, 0x0008000c, 0x00000020, 0x000003b2, 0x00000001, 0x0000002d, 0x000003ae, 0x0000002b,
+    0x00000088, 0x00050084, 0x00000020, 0x000003b3, 0x000003b2, 0x0000004e, 0x00050080, 0x00000020,
+    0x000003b4, 0x000003b3, 0x000003b1, 0x00050080, 0x00000020, 0x000003b5, 0x0000004b, 0x000003b4,
+    0x00060041, 0x00000015, 0x000003b6, 0x00000017, 0x0000002b, 0x000003b5, 0x0004003d, 0x00000014,
+    0x000003b7, 0x000003b6, 0x0006000c, 0x00000004, 0x000003b8, 0x00000001, 0x00000040, 0x000003b7,
+    0x00050051, 0x00000002, 0x000003b9, 0x000003b8, 0x00000000, 0x00050051, 0x00000002, 0x000003ba,
+    0x000003b8, 0x00000001, 0x00050051, 0x00000002, 0x000003bb, 0x000003b8, 0x00000002, 0x00050051,
+    0x00000002, 0x000003bc, 0x000003b8, 0x00000003, 0x000600a9, 0x00000002, 0x000003bd, 0x00000093,
+    0x000003bb, 0x000003b9, 0x000600a9, 0x00000002, 0x000003be, 0x00000093, 0x000003b9, 0x000003bb,
+    0x00060050, 0x00000003, 0x000003bf, 0x000003bd, 0x000003ba, 0x000003be, 0x0008000c, 0x00000020,
+    0x000003c0, 0x00000001, 0x0000002d, 0x000003af, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020,
+    0x000003c1, 0x00000001, 0x0000002d, 0x000003ae, 0x0000002b, 0x00000088, 0x00050084, 0x00000020,
+    0x000003c2, 0x000003c1, 0x0000004e, 0x00050080, 0x00000020, 0x000003c3, 0x000003c2, 0x000003c0,
+    0x00050080, 0x00000020, 0x000003c4, 0x0000004b, 0x000003c3, 0x00060041, 0x00000015, 0x000003c5,
+    0x00000017, 0x0000002b, 0x000003c4, 0x0004003d, 0x00000014, 0x000003c6, 0x000003c5, 0x0006000c,
+    0x00000004, 0x000003c7, 0x00000001, 0x00000040, 0x000003c6, 0x00050051, 0x00000002, 0x000003c8,
+    0x000003c7, 0x00000000, 0x00050051, 0x00000002, 0x000003c9, 0x000003c7, 0x00000001, 0x00050051,
+    0x00000002, 0x000003ca, 0x000003c7, 0x00000002, 0x00050051, 0x00000002, 0x000003cb, 0x000003c7,
+    0x00000003, 0x000600a9, 0x00000002, 0x000003cc, 0x00000093, 0x000003ca, 0x000003c8, 0x000600a9,
+    0x00000002, 0x000003cd, 0x00000093, 0x000003c8, 0x000003ca, 0x00060050, 0x00000003, 0x000003ce,
+    0x000003cc, 0x000003c9, 0x000003cd, 0x00050083, 0x00000003, 0x000003cf, 0x000003ce, 0x000003bf,
+    0x0005008e, 0x00000003, 0x000003d0, 0x000003cf, 0x000003a9, 0x00050081, 0x00000003, 0x000003d1,
+    0x000003bf, 0x000003d0, 0x0008000c, 0x00000020, 0x000003d2, 0x00000001, 0x0000002d, 0x000003ac,
+    0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x000003d3, 0x00000001, 0x0000002d, 0x000003b0,
+    0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x000003d4, 0x000003d3, 0x0000004e, 0x00050080,
+    0x00000020, 0x000003d5, 0x000003d4, 0x000003d2, 0x00050080, 0x00000020, 0x000003d6, 0x0000004b,
+    0x000003d5, 0x00060041, 0x00000015, 0x000003d7, 0x00000017, 0x0000002b, 0x000003d6, 0x0004003d,
+    0x00000014, 0x000003d8, 0x000003d7, 0x0006000c, 0x00000004, 0x000003d9, 0x00000001, 0x00000040,
+    0x000003d8, 0x00050051, 0x00000002, 0x000003da, 0x000003d9, 0x00000000, 0x00050051, 0x00000002,
+    0x000003db, 0x000003d9, 0x00000001, 0x00050051, 0x00000002, 0x000003dc, 0x000003d9, 0x00000002,
+    0x00050051, 0x00000002, 0x000003dd, 0x000003d9, 0x00000003, 0x000600a9, 0x00000002, 0x000003de,
+    0x00000093, 0x000003dc, 0x000003da, 0x000600a9, 0x00000002, 0x000003df, 0x00000093, 0x000003da,
+    0x000003dc, 0x00060050, 0x00000003, 0x000003e0, 0x000003de, 0x000003db, 0x000003df, 0x0008000c,
+    0x00000020, 0x000003e1, 0x00000001, 0x0000002d, 0x000003af, 0x0000002b, 0x00000086, 0x0008000c,
+    0x00000020, 0x000003e2, 0x00000001, 0x0000002d, 0x000003b0, 0x0000002b, 0x00000088, 0x00050084,
+    0x00000020, 0x000003e3, 0x000003e2, 0x0000004e, 0x00050080, 0x00000020, 0x000003e4, 0x000003e3,
+    0x000003e1, 0x00050080, 0x00000020, 0x000003e5, 0x0000004b, 0x000003e4, 0x00060041, 0x00000015,
+    0x000003e6, 0x00000017, 0x0000002b, 0x000003e5, 0x0004003d, 0x00000014, 0x000003e7, 0x000003e6,
+    0x0006000c, 0x00000004, 0x000003e8, 0x00000001, 0x00000040, 0x000003e7, 0x00050051, 0x00000002,
+    0x000003e9, 0x000003e8, 0x00000000, 0x00050051, 0x00000002, 0x000003ea, 0x000003e8, 0x00000001,
+    0x00050051, 0x00000002, 0x000003eb, 0x000003e8, 0x00000002, 0x00050051, 0x00000002, 0x000003ec,
+    0x000003e8, 0x00000003, 0x000600a9, 0x00000002, 0x000003ed, 0x00000093, 0x000003eb, 0x000003e9,
+    0x000600a9, 0x00000002, 0x000003ee, 0x00000093, 0x000003e9, 0x000003eb, 0x00060050, 0x00000003,
+    0x000003ef, 0x000003ed, 0x000003ea, 0x000003ee, 0x00050083, 0x00000003, 0x000003f0, 0x000003ef,
+    0x000003e0, 0x0005008e, 0x00000003, 0x000003f1, 0x000003f0, 0x000003a9, 0x00050081, 0x00000003,
+    0x000003f2, 0x000003e0, 0x000003f1, 0x00050083, 0x00000003, 0x000003f3, 0x000003f2, 0x000003d1,
+    0x0005008e, 0x00000003, 0x000003f4, 0x000003f3, 0x000003aa, 0x00050081, 0x00000003, 0x000003f5,
+    0x000003d1, 0x000003f4, 0x000500af, 0x00000012, 0x000003f6, 0x0000039d, 0x0000002b, 0x000500af,
+    0x00000012, 0x000003f7, 0x0000039e, 0x0000002b, 0x000500a7, 0x00000012, 0x000003f8, 0x000003f6,
+    0x000003f7, 0x000500b1, 0x00000012, 0x000003f9, 0x0000039d, 0x00000033, 0x000500b1, 0x00000012,
+    0x000003fa, 0x0000039e, 0x00000036, 0x000500a7, 0x00000012, 0x000003fb, 0x000003f9, 0x000003fa,
+    0x000500a7, 0x00000012, 0x000003fc, 0x000003f8, 0x000003fb, 0x000600a9, 0x00000002, 0x000003fd,
+    0x000003fc, 0x000000fb, 0x000000fc, 0x0005008e, 0x00000003, 0x000003fe, 0x000003f5, 0x000003fd,
+    0x00050082, 0x00000020, 0x000003ff, 0x0000039b, 0x00000054, 0x00050082, 0x00000020, 0x00000400,
+    0x0000039c, 0x00000057, 0x000500af, 0x00000012, 0x00000401, 0x000003ff, 0x0000002b, 0x000500af,
+    0x00000012, 0x00000402, 0x00000400, 0x0000002b, 0x000500a7, 0x00000012, 0x00000403, 0x00000401,
+    0x00000402, 0x000500b1, 0x00000012, 0x00000404, 0x000003ff, 0x0000005a, 0x000500b1, 0x00000012,
+    0x00000405, 0x00000400, 0x0000005d, 0x000500a7, 0x00000012, 0x00000406, 0x00000404, 0x00000405,
+    0x000500a7, 0x00000012, 0x00000407, 0x00000403, 0x00000406, 0x0008000c, 0x00000020, 0x00000408,
+    0x00000001, 0x0000002d, 0x000003ff, 0x0000002b, 0x0000008a, 0x0008000c, 0x00000020, 0x00000409,
+    0x00000001, 0x0000002d, 0x00000400, 0x0000002b, 0x0000008c, 0x00050084, 0x00000020, 0x0000040a,
+    0x00000409, 0x00000063, 0x00050080, 0x00000020, 0x0000040b, 0x0000040a, 0x00000408, 0x00050080,
+    0x00000020, 0x0000040c, 0x00000060, 0x0000040b, 0x00060041, 0x00000015, 0x0000040d, 0x0000001a,
+    0x0000002b, 0x0000040c, 0x0004003d, 0x00000014, 0x0000040e, 0x0000040d, 0x0006000c, 0x00000004,
+    0x0000040f, 0x00000001, 0x00000040, 0x0000040e, 0x00050051, 0x00000002, 0x00000410, 0x0000040f,
+    0x00000000, 0x00050051, 0x00000002, 0x00000411, 0x0000040f, 0x00000001, 0x00050051, 0x00000002,
+    0x00000412, 0x0000040f, 0x00000002, 0x00050051, 0x00000002, 0x00000413, 0x0000040f, 0x00000003,
+    0x000600a9, 0x00000002, 0x00000414, 0x00000094, 0x00000412, 0x00000410, 0x000600a9, 0x00000002,
+    0x00000415, 0x00000094, 0x00000410, 0x00000412, 0x00060050, 0x00000003, 0x00000416, 0x00000414,
+    0x00000411, 0x00000415, 0x000600a9, 0x00000002, 0x00000417, 0x00000407, 0x00000413, 0x000000fc,
+    0x00050083, 0x00000003, 0x00000418, 0x00000416, 0x000003fe, 0x0005008e, 0x00000003, 0x00000419,
+    0x00000418, 0x00000417, 0x00050081, 0x00000003, 0x0000041a, 0x000003fe, 0x00000419, 0x00050080,
+    0x00000020, 0x0000041b, 0x0000007e, 0x00000034, 0x00050080, 0x00000020, 0x0000041c, 0x0000007f,
+    0x0000002e, 0x00050082, 0x00000020, 0x0000041d, 0x0000041b, 0x0000002d, 0x00050082, 0x00000020,
+    0x0000041e, 0x0000041c, 0x00000030, 0x0004006f, 0x00000002, 0x0000041f, 0x0000041d, 0x00050081,
+    0x00000002, 0x00000420, 0x0000041f, 0x0000009a, 0x00050085, 0x00000002, 0x00000421, 0x00000420,
+    0x0000008f, 0x00050083, 0x00000002, 0x00000422, 0x00000421, 0x0000009a, 0x0004006f, 0x00000002,
+    0x00000423, 0x0000041e, 0x00050081, 0x00000002, 0x00000424, 0x00000423, 0x0000009a, 0x00050085,
+    0x00000002, 0x00000425, 0x00000424, 0x00000092, 0x00050083, 0x00000002, 0x00000426, 0x00000425,
+    0x0000009a, 0x0006000c, 0x00000002, 0x00000427, 0x00000001, 0x00000008, 0x00000422, 0x0006000c,
+    0x00000002, 0x00000428, 0x00000001, 0x00000008, 0x00000426, 0x00050083, 0x00000002, 0x00000429,
+    0x00000422, 0x00000427, 0x00050083, 0x00000002, 0x0000042a, 0x00000426, 0x00000428, 0x0004006e,
+    0x00000020, 0x0000042b, 0x00000427, 0x00050080, 0x00000020, 0x0000042c, 0x0000042b, 0x00000039,
+    0x0004006e, 0x00000020, 0x0000042d, 0x00000428, 0x00050080, 0x00000020, 0x0000042e, 0x0000042d,
+    0x0000003c, 0x00050080, 0x00000020, 0x0000042f, 0x0000042c, 0x0000002e, 0x00050080, 0x00000020,
+    0x00000430, 0x0000042e, 0x0000002e, 0x0008000c, 0x00000020, 0x00000431, 0x00000001, 0x0000002d,
+    0x0000042c, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x00000432, 0x00000001, 0x0000002d,
+    0x0000042e, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x00000433, 0x00000432, 0x0000004e,
+    0x00050080, 0x00000020, 0x00000434, 0x00000433, 0x00000431, 0x00050080, 0x00000020, 0x00000435,
+    0x0000004b, 0x00000434, 0x00060041, 0x00000015, 0x00000436, 0x00000017, 0x0000002b, 0x00000435,
+    0x0004003d, 0x00000014, 0x00000437, 0x00000436, 0x0006000c, 0x00000004, 0x00000438, 0x00000001,
+    0x00000040, 0x00000437, 0x00050051, 0x00000002, 0x00000439, 0x00000438, 0x00000000, 0x00050051,
+    0x00000002, 0x0000043a, 0x00000438, 0x00000001, 0x00050051, 0x00000002, 0x0000043b, 0x00000438,
+    0x00000002, 0x00050051, 0x00000002, 0x0000043c, 0x00000438, 0x00000003, 0x000600a9, 0x00000002,
+    0x0000043d, 0x00000093, 0x0000043b, 0x00000439, 0x000600a9, 0x00000002, 0x0000043e, 0x00000093,
+    0x00000439, 0x0000043b, 0x00060050, 0x00000003, 0x0000043f, 0x0000043d, 0x0000043a, 0x0000043e,
+    0x0008000c, 0x00000020, 0x00000440, 0x00000001, 0x0000002d, 0x0000042f, 0x0000002b, 0x00000086,
+    0x0008000c, 0x00000020, 0x00000441, 0x00000001, 0x0000002d, 0x0000042e, 0x0000002b, 0x00000088,
+    0x00050084, 0x00000020, 0x00000442, 0x00000441, 0x0000004e, 0x00050080, 0x00000020, 0x00000443,
+    0x00000442, 0x00000440, 0x00050080, 0x00000020, 0x00000444, 0x0000004b, 0x00000443, 0x00060041,
+    0x00000015, 0x00000445, 0x00000017, 0x0000002b, 0x00000444, 0x0004003d, 0x00000014, 0x00000446,
+    0x00000445, 0x0006000c, 0x00000004, 0x00000447, 0x00000001, 0x00000040, 0x00000446, 0x00050051,
+    0x00000002, 0x00000448, 0x00000447, 0x00000000, 0x00050051, 0x00000002, 0x00000449, 0x00000447,
+    0x00000001, 0x00050051, 0x00000002, 0x0000044a, 0x00000447, 0x00000002, 0x00050051, 0x00000002,
+    0x0000044b, 0x00000447, 0x00000003, 0x000600a9, 0x00000002, 0x0000044c, 0x00000093, 0x0000044a,
+    0x00000448, 0x000600a9, 0x00000002, 0x0000044d, 0x00000093, 0x00000448, 0x0000044a, 0x00060050,
+    0x00000003, 0x0000044e, 0x0000044c, 0x00000449, 0x0000044d, 0x00050083, 0x00000003, 0x0000044f,
+    0x0000044e, 0x0000043f, 0x0005008e, 0x00000003, 0x00000450, 0x0000044f, 0x00000429, 0x00050081,
+    0x00000003, 0x00000451, 0x0000043f, 0x00000450, 0x0008000c, 0x00000020, 0x00000452, 0x00000001,
+    0x0000002d, 0x0000042c, 0x0000002b, 0x00000086, 0x0008000c, 0x00000020, 0x00000453, 0x00000001,
+    0x0000002d, 0x00000430, 0x0000002b, 0x00000088, 0x00050084, 0x00000020, 0x00000454, 0x00000453,
+    0x0000004e, 0x00050080, 0x00000020, 0x00000455, 0x00000454, 0x00000452, 0x00050080, 0x00000020,
+    0x00000456, 0x0000004b, 0x00000455, 0x00060041, 0x00000015, 0x00000457, 0x00000017, 0x0000002b,
+    0x00000456, 0x0004003d, 0x00000014, 0x00000458, 0x00000457, 0x0006000c, 0x00000004, 0x00000459,
+    0x00000001, 0x00000040, 0x00000458, 0x00050051, 0x00000002, 0x0000045a, 0x00000459, 0x00000000,
+    0x00050051, 0x00000002, 0x0000045b, 0x00000459, 0x00000001, 0x00050051, 0x00000002, 0x0000045c,
+    0x00000459, 0x00000002, 0x00050051, 0x00000002, 0x0000045d, 0x00000459, 0x00000003, 0x000600a9,
+    0x00000002, 0x0000045e, 0x00000093, 0x0000045c, 0x0000045a, 0x000600a9, 0x00000002, 0x0000045f,
+    0x00000093, 0x0000045a, 0x0000045c, 0x00060050, 0x00000003, 0x00000460, 0x0000045e, 0x0000045b,
+    0x0000045f, 0x0008000c, 0x00000020, 0x00000461, 0x00000001, 0x0000002d, 0x0000042f, 0x0000002b,
+    0x00000086, 0x0008000c, 0x00000020, 0x00000462, 0x00000001, 0x0000002d, 0x00000430, 0x0000002b,
+    0x00000088, 0x00050084, 0x00000020, 0x00000463, 0x00000462, 0x0000004e, 0x00050080, 0x00000020,
+    0x00000464, 0x00000463, 0x00000461, 0x00050080, 0x00000020, 0x00000465, 0x0000004b, 0x00000464,
+    0x00060041, 0x00000015, 0x00000466, 0x00000017, 0x0000002b, 0x00000465, 0x0004003d, 0x00000014,
+    0x00000467, 0x00000466, 0x0006000c, 0x00000004, 0x00000468, 0x00000001, 0x00000040, 0x00000467,
+    0x00050051, 0x00000002, 0x00000469, 0x00000468, 0x00000000, 0x00050051, 0x00000002, 0x0000046a,
+    0x00000468, 0x00000001, 0x00050051, 0x00000002, 0x0000046b, 0x00000468, 0x00000002, 0x00050051,
+    0x00000002, 0x0000046c, 0x00000468, 0x00000003, 0x000600a9, 0x00000002, 0x0000046d, 0x00000093,
+    0x0000046b, 0x00000469, 0x000600a9, 0x00000002, 0x0000046e, 0x00000093, 0x00000469, 0x0000046b,
+    0x00060050, 0x00000003, 0x0000046f, 0x0000046d, 0x0000046a, 0x0000046e, 0x00050083, 0x00000003,
+    0x00000470, 0x0000046f, 0x00000460, 0x0005008e, 0x00000003, 0x00000471, 0x00000470, 0x00000429,
+    0x00050081, 0x00000003, 0x00000472, 0x00000460, 0x00000471, 0x00050083, 0x00000003, 0x00000473,
+    0x00000472, 0x00000451, 0x0005008e, 0x00000003, 0x00000474, 0x00000473, 0x0000042a, 0x00050081,
+    0x00000003, 0x00000475, 0x00000451, 0x00000474, 0x000500af, 0x00000012, 0x00000476, 0x0000041d,
+    0x0000002b, 0x000500af, 0x00000012, 0x00000477, 0x0000041e, 0x0000002b, 0x000500a7, 0x00000012,
+    0x00000478, 0x00000476, 0x00000477, 0x000500b1, 0x00000012, 0x00000479, 0x0000041d, 0x00000033,
+    0x000500b1, 0x00000012, 0x0000047a, 0x0000041e, 0x00000036, 0x000500a7, 0x00000012, 0x0000047b,
+    0x00000479, 0x0000047a, 0x000500a7, 0x00000012, 0x0000047c, 0x00000478, 0x0000047b, 0x000600a9,
+    0x00000002, 0x0000047d, 0x0000047c, 0x000000fb, 0x000000fc, 0x0005008e, 0x00000003, 0x0000047e,
+    0x00000475, 0x0000047d, 0x00050082, 0x00000020, 0x0000047f, 0x0000041b, 0x00000054, 0x00050082,
+    0x00000020, 0x00000480, 0x0000041c, 0x00000057, 0x000500af, 0x00000012, 0x00000481, 0x0000047f,
+    0x0000002b, 0x000500af, 0x00000012, 0x00000482, 0x00000480, 0x0000002b, 0x000500a7, 0x00000012,
+    0x00000483, 0x00000481, 0x00000482, 0x000500b1, 0x00000012, 0x00000484, 0x0000047f, 0x0000005a,
+    0x000500b1, 0x00000012, 0x00000485, 0x00000480, 0x0000005d, 0x000500a7, 0x00000012, 0x00000486,
+    0x00000484, 0x00000485, 0x000500a7, 0x00000012, 0x00000487, 0x00000483, 0x00000486, 0x0008000c,
+    0x00000020, 0x00000488, 0x00000001, 0x0000002d, 0x0000047f, 0x0000002b, 0x0000008a, 0x0008000c,
+    0x00000020, 0x00000489, 0x00000001, 0x0000002d, 0x00000480, 0x0000002b, 0x0000008c, 0x00050084,
+    0x00000020, 0x0000048a, 0x00000489, 0x00000063, 0x00050080, 0x00000020, 0x0000048b, 0x0000048a,
+    0x00000488, 0x00050080, 0x00000020, 0x0000048c, 0x00000060, 0x0000048b, 0x00060041, 0x00000015,
+    0x0000048d, 0x0000001a, 0x0000002b, 0x0000048c, 0x0004003d, 0x00000014, 0x0000048e, 0x0000048d,
+    0x0006000c, 0x00000004, 0x0000048f, 0x00000001, 0x00000040, 0x0000048e, 0x00050051, 0x00000002,
+    0x00000490, 0x0000048f, 0x00000000, 0x00050051, 0x00000002, 0x00000491, 0x0000048f, 0x00000001,
+    0x00050051, 0x00000002, 0x00000492, 0x0000048f, 0x00000002, 0x00050051, 0x00000002, 0x00000493,
+    0x0000048f, 0x00000003, 0x000600a9, 0x00000002, 0x00000494, 0x00000094, 0x00000492, 0x00000490,
+    0x000600a9, 0x00000002, 0x00000495, 0x00000094, 0x00000490, 0x00000492, 0x00060050, 0x00000003,
+    0x00000496, 0x00000494, 0x00000491, 0x00000495, 0x000600a9, 0x00000002, 0x00000497, 0x00000487,
+    0x00000493, 0x000000fc, 0x00050083, 0x00000003, 0x00000498, 0x00000496, 0x0000047e, 0x0005008e,
+    0x00000003, 0x00000499, 0x00000498, 0x00000497, 0x00050081, 0x00000003, 0x0000049a, 0x0000047e,
+    0x00000499, 0x00050094, 0x00000002, 0x0000049b, 0x0000011a, 0x00000095, 0x00050081, 0x00000002,
+    0x0000049c, 0x0000049b, 0x0000000e, 0x00050094, 0x00000002, 0x0000049d, 0x0000019a, 0x00000095,
+    0x00050081, 0x00000002, 0x0000049e, 0x0000049d, 0x0000000e, 0x00050094, 0x00000002, 0x0000049f,
+    0x0000021a, 0x00000095, 0x00050081, 0x00000002, 0x000004a0, 0x0000049f, 0x0000000e, 0x00050094,
+    0x00000002, 0x000004a1, 0x0000029a, 0x00000095, 0x00050081, 0x00000002, 0x000004a2, 0x000004a1,
+    0x0000000e, 0x00050094, 0x00000002, 0x000004a3, 0x0000031a, 0x00000095, 0x00050081, 0x00000002,
+    0x000004a4, 0x000004a3, 0x0000000e, 0x00050094, 0x00000002, 0x000004a5, 0x0000039a, 0x00000095,
+    0x00050081, 0x00000002, 0x000004a6, 0x000004a5, 0x0000000e, 0x00050094, 0x00000002, 0x000004a7,
+    0x0000041a, 0x00000095, 0x00050081, 0x00000002, 0x000004a8, 0x000004a7, 0x0000000e, 0x00050094,
+    0x00000002, 0x000004a9, 0x0000049a, 0x00000095, 0x00050081, 0x00000002, 0x000004aa, 0x000004a9,
+    0x0000000e, 0x00050081, 0x00000003, 0x000004ab, 0x0000011a, 0x0000019a, 0x00050081, 0x00000003,
+    0x000004ac, 0x0000031a, 0x0000039a, 0x00050081, 0x00000003, 0x000004ad, 0x000004ab, 0x000004ac,
+    0x0005008e, 0x00000003, 0x000004af, 0x000004ad, 0x000004ae, 0x00050094, 0x00000002, 0x000004b0,
+    0x000004af, 0x00000096, 0x00050081, 0x00000002, 0x000004b1, 0x000004b0, 0x0000000f, 0x00050094,
+    0x00000002, 0x000004b2, 0x000004af, 0x00000097, 0x00050081, 0x00000002, 0x000004b3, 0x000004b2,
+    0x00000010, 0x00050081, 0x00000003, 0x000004b4, 0x0000021a, 0x0000029a, 0x00050081, 0x00000003,
+    0x000004b5, 0x0000041a, 0x0000049a, 0x00050081, 0x00000003, 0x000004b6, 0x000004b4, 0x000004b5,
+    0x0005008e, 0x00000003, 0x000004b7, 0x000004b6, 0x000004ae, 0x00050094, 0x00000002, 0x000004b8,
+    0x000004b7, 0x00000096, 0x00050081, 0x00000002, 0x000004b9, 0x000004b8, 0x0000000f, 0x00050094,
+    0x00000002, 0x000004ba, 0x000004b7, 0x00000097, 0x00050081, 0x00000002, 0x000004bb, 0x000004ba,
+    0x00000010, 0x00050084, 0x00000020, 0x000004bc, 0x0000007f, 0x0000006c, 0x00050080, 0x00000020,
+    0x000004bd, 0x00000069, 0x000004bc, 0x00050080, 0x00000020, 0x000004be, 0x000004bd, 0x0000006c,
+    0x00050084, 0x00000020, 0x000004bf, 0x0000007d, 0x00000072, 0x00050080, 0x00000020, 0x000004c0,
+    0x0000006f, 0x000004bf, 0x000300f7, 0x000004c3, 0x00000000, 0x000400fa, 0x00000011, 0x000004c1,
+    0x000004c2, 0x000200f8, 0x000004c1, 0x00050084, 0x00000020, 0x000004c4, 0x0000007b, 0x00000031,
+    0x00050080, 0x00000020, 0x000004c5, 0x000004c4, 0x0000002e, 0x00050080, 0x00000020, 0x000004c6,
+    0x000004bd, 0x000004c4, 0x0008000c, 0x00000002, 0x000004c7, 0x00000001, 0x0000002b, 0x0000049c,
+    0x000000fc, 0x000000fb, 0x00050085, 0x00000002, 0x000004c9, 0x000004c7, 0x000004c8, 0x00050081,
+    0x00000002, 0x000004ca, 0x000004c9, 0x0000009a, 0x0004006d, 0x00000014, 0x000004cb, 0x000004ca,
+    0x000500c4, 0x00000014, 0x000004cd, 0x000004cb, 0x000004cc, 0x0008000c, 0x00000002, 0x000004ce,
+    0x00000001, 0x0000002b, 0x0000049e, 0x000000fc, 0x000000fb, 0x00050085, 0x00000002, 0x000004cf,
+    0x000004ce, 0x000004c8, 0x00050081, 0x00000002, 0x000004d0, 0x000004cf, 0x0000009a, 0x0004006d,
+    0x00000014, 0x000004d1, 0x000004d0, 0x000500c4, 0x00000014, 0x000004d2, 0x000004d1, 0x000004cc,
+    0x000500c4, 0x00000014, 0x000004d4, 0x000004d2, 0x000004d3, 0x000500c5, 0x00000014, 0x000004d5,
+    0x000004cd, 0x000004d4, 0x00060041, 0x00000015, 0x000004d6, 0x0000001d, 0x0000002b, 0x000004c6,
+    0x0003003e, 0x000004d6, 0x000004d5, 0x00050080, 0x00000020, 0x000004d7, 0x000004bd, 0x000004c5,
+    0x0008000c, 0x00000002, 0x000004d8, 0x00000001, 0x0000002b, 0x000004a0, 0x000000fc, 0x000000fb,
+    0x00050085, 0x00000002, 0x000004d9, 0x000004d8, 0x000004c8, 0x00050081, 0x00000002, 0x000004da,
+    0x000004d9, 0x0000009a, 0x0004006d, 0x00000014, 0x000004db, 0x000004da, 0x000500c4, 0x00000014,
+    0x000004dc, 0x000004db, 0x000004cc, 0x0008000c, 0x00000002, 0x000004dd, 0x00000001, 0x0000002b,
+    0x000004a2, 0x000000fc, 0x000000fb, 0x00050085, 0x00000002, 0x000004de, 0x000004dd, 0x000004c8,
+    0x00050081, 0x00000002, 0x000004df, 0x000004de, 0x0000009a, 0x0004006d, 0x00000014, 0x000004e0,
+    0x000004df, 0x000500c4, 0x00000014, 0x000004e1, 0x000004e0, 0x000004cc, 0x000500c4, 0x00000014,
+    0x000004e2, 0x000004e1, 0x000004d3, 0x000500c5, 0x00000014, 0x000004e3, 0x000004dc, 0x000004e2,
+    0x00060041, 0x00000015, 0x000004e4, 0x0000001d, 0x0000002b, 0x000004d7, 0x0003003e, 0x000004e4,
+    0x000004e3, 0x00050080, 0x00000020, 0x000004e5, 0x000004be, 0x000004c4, 0x0008000c, 0x00000002,
+    0x000004e6, 0x00000001, 0x0000002b, 0x000004a4, 0x000000fc, 0x000000fb, 0x00050085, 0x00000002,
+    0x000004e7, 0x000004e6, 0x000004c8, 0x00050081, 0x00000002, 0x000004e8, 0x000004e7, 0x0000009a,
+    0x0004006d, 0x00000014, 0x000004e9, 0x000004e8, 0x000500c4, 0x00000014, 0x000004ea, 0x000004e9,
+    0x000004cc, 0x0008000c, 0x00000002, 0x000004eb, 0x00000001, 0x0000002b, 0x000004a6, 0x000000fc,
+    0x000000fb, 0x00050085, 0x00000002, 0x000004ec, 0x000004eb, 0x000004c8, 0x00050081, 0x00000002,
+    0x000004ed, 0x000004ec, 0x0000009a, 0x0004006d, 0x00000014, 0x000004ee, 0x000004ed, 0x000500c4,
+    0x00000014, 0x000004ef, 0x000004ee, 0x000004cc, 0x000500c4, 0x00000014, 0x000004f0, 0x000004ef,
+    0x000004d3, 0x000500c5, 0x00000014, 0x000004f1, 0x000004ea, 0x000004f0, 0x00060041, 0x00000015,
+    0x000004f2, 0x0000001d, 0x0000002b, 0x000004e5, 0x0003003e, 0x000004f2, 0x000004f1, 0x00050080,
+    0x00000020, 0x000004f3, 0x000004be, 0x000004c5, 0x0008000c, 0x00000002, 0x000004f4, 0x00000001,
+    0x0000002b, 0x000004a8, 0x000000fc, 0x000000fb, 0x00050085, 0x00000002, 0x000004f5, 0x000004f4,
+    0x000004c8, 0x00050081, 0x00000002, 0x000004f6, 0x000004f5, 0x0000009a, 0x0004006d, 0x00000014,
+    0x000004f7, 0x000004f6, 0x000500c4, 0x00000014, 0x000004f8, 0x000004f7, 0x000004cc, 0x0008000c,
+    0x00000002, 0x000004f9, 0x00000001, 0x0000002b, 0x000004aa, 0x000000fc, 0x000000fb, 0x00050085,
+    0x00000002, 0x000004fa, 0x000004f9, 0x000004c8, 0x00050081, 0x00000002, 0x000004fb, 0x000004fa,
+    0x0000009a, 0x0004006d, 0x00000014, 0x000004fc, 0x000004fb, 0x000500c4, 0x00000014, 0x000004fd,
+    0x000004fc, 0x000004cc, 0x000500c4, 0x00000014, 0x000004fe, 0x000004fd, 0x000004d3, 0x000500c5,
+    0x00000014, 0x000004ff, 0x000004f8, 0x000004fe, 0x00060041, 0x00000015, 0x00000500, 0x0000001d,
+    0x0000002b, 0x000004f3, 0x0003003e, 0x00000500, 0x000004ff, 0x00050080, 0x00000020, 0x00000501,
+    0x000004c0, 0x000004c4, 0x0008000c, 0x00000002, 0x00000502, 0x00000001, 0x0000002b, 0x000004b1,
+    0x000000fc, 0x000000fb, 0x00050085, 0x00000002, 0x00000503, 0x00000502, 0x000004c8, 0x00050081,
+    0x00000002, 0x00000504, 0x00000503, 0x0000009a, 0x0004006d, 0x00000014, 0x00000505, 0x00000504,
+    0x000500c4, 0x00000014, 0x00000506, 0x00000505, 0x000004cc, 0x0008000c, 0x00000002, 0x00000507,
+    0x00000001, 0x0000002b, 0x000004b3, 0x000000fc, 0x000000fb, 0x00050085, 0x00000002, 0x00000508,
+    0x00000507, 0x000004c8, 0x00050081, 0x00000002, 0x00000509, 0x00000508, 0x0000009a, 0x0004006d,
+    0x00000014, 0x0000050a, 0x00000509, 0x000500c4, 0x00000014, 0x0000050b, 0x0000050a, 0x000004cc,
+    0x000500c4, 0x00000014, 0x0000050c, 0x0000050b, 0x000004d3, 0x000500c5, 0x00000014, 0x0000050d,
+    0x00000506, 0x0000050c, 0x00060041, 0x00000015, 0x0000050e, 0x0000001d, 0x0000002b, 0x00000501,
+    0x0003003e, 0x0000050e, 0x0000050d, 0x00050080, 0x00000020, 0x0000050f, 0x000004c0, 0x000004c5,
+    0x0008000c, 0x00000002, 0x00000510, 0x00000001, 0x0000002b, 0x000004b9, 0x000000fc, 0x000000fb,
+    0x00050085, 0x00000002, 0x00000511, 0x00000510, 0x000004c8, 0x00050081, 0x00000002, 0x00000512,
+    0x00000511, 0x0000009a, 0x0004006d, 0x00000014, 0x00000513, 0x00000512, 0x000500c4, 0x00000014,
+    0x00000514, 0x00000513, 0x000004cc, 0x0008000c, 0x00000002, 0x00000515, 0x00000001, 0x0000002b,
+    0x000004bb, 0x000000fc, 0x000000fb, 0x00050085, 0x00000002, 0x00000516, 0x00000515, 0x000004c8,
+    0x00050081, 0x00000002, 0x00000517, 0x00000516, 0x0000009a, 0x0004006d, 0x00000014, 0x00000518,
+    0x00000517, 0x000500c4, 0x00000014, 0x00000519, 0x00000518, 0x000004cc, 0x000500c4, 0x00000014,
+    0x0000051a, 0x00000519, 0x000004d3, 0x000500c5, 0x00000014, 0x0000051b, 0x00000514, 0x0000051a,
+    0x00060041, 0x00000015, 0x0000051c, 0x0000001d, 0x0000002b, 0x0000050f, 0x0003003e, 0x0000051c,
+    0x0000051b, 0x000200f9, 0x000004c3, 0x000200f8, 0x000004c2, 0x00050080, 0x00000020, 0x0000051d,
+    0x000004bd, 0x0000007b, 0x00070050, 0x00000004, 0x0000051e, 0x0000049c, 0x0000049e, 0x000004a0,
+    0x000004a2, 0x0006000c, 0x00000014, 0x0000051f, 0x00000001, 0x00000037, 0x0000051e, 0x00060041,
+    0x00000015, 0x00000520, 0x0000001d, 0x0000002b, 0x0000051d, 0x0003003e, 0x00000520, 0x0000051f,
+    0x00050080, 0x00000020, 0x00000521, 0x000004be, 0x0000007b, 0x00070050, 0x00000004, 0x00000522,
+    0x000004a4, 0x000004a6, 0x000004a8, 0x000004aa, 0x0006000c, 0x00000014, 0x00000523, 0x00000001,
+    0x00000037, 0x00000522, 0x00060041, 0x00000015, 0x00000524, 0x0000001d, 0x0000002b, 0x00000521,
+    0x0003003e, 0x00000524, 0x00000523, 0x00050080, 0x00000020, 0x00000525, 0x000004c0, 0x0000007b,
+    0x00070050, 0x00000004, 0x00000526, 0x000004b1, 0x000004b3, 0x000004b9, 0x000004bb, 0x0006000c,
+    0x00000014, 0x00000527, 0x00000001, 0x00000037, 0x00000526, 0x00060041, 0x00000015, 0x00000528,
+    0x0000001d, 0x0000002b, 0x00000525, 0x0003003e, 0x00000528, 0x00000527, 0x000200f9, 0x000004c3,
+    0x000200f8, 0x000004c3, 0x000200f9, 0x00000084, 0x000200f8, 0x00000084, 0x000100fd, 0x00010038,
+};
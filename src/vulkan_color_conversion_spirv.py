@@ -0,0 +1,540 @@
+#!/usr/bin/env python3
+
+# Generates vulkan_color_conversion_spirv.h, the spir-v compute shader used by vulkan_color_conversion.c.
+# The spir-v is written directly so that building gpu-screen-recorder doesn't need a shader compiler (glslang).
+# Run this script again after changing it: ./vulkan_color_conversion_spirv.py > vulkan_color_conversion_spirv.h
+#
+# The shader is equivalent to this glsl:
+#
+#   #version 450
+#   layout(local_size_x = 8, local_size_y = 8) in;
+#   layout(constant_id = 0)  const float y_r = 0.0;  ... layout(constant_id = 8) const float v_b = 0.0; /* color matrix (color_matrices.h) */
+#   layout(constant_id = 9)  const float y_offset = 0.0;  u_offset (10), v_offset (11)
+#   layout(constant_id = 12) const bool ten_bit = false; /* p010 if true, otherwise nv12 */
+#   layout(std430, binding = 0) readonly buffer Source { uint source[]; };         /* rgba8 or bgra8 */
+#   layout(std430, binding = 1) readonly buffer Cursor { uint cursor[]; };         /* rgba8 or bgra8 */
+#   layout(std430, binding = 2) writeonly buffer Destination { uint destination[]; }; /* y plane and uv plane */
+#   layout(push_constant) uniform Parameters { int ... } p; /* gsr_vulkan_color_conversion_parameters, all offsets and pitches are in uints */
+#
+#   vec3 source_pixel(int x, int y) {
+#       uint pixel = source[p.source_offset + clamp(y, 0, p.texture_full_height - 1) * p.source_pitch + clamp(x, 0, p.texture_full_width - 1)];
+#       vec4 color = unpackUnorm4x8(pixel);
+#       return p.source_swap_rb != 0 ? color.bgr : color.rgb;
+#   }
+#
+#   vec3 frame_pixel(int x, int y) { /* Bilinear scaling of the texture region to the destination region, black outside of it. Then the cursor is blended on top (not scaled) */
+#       vec2 pos = (vec2(x - p.destination_x, y - p.destination_y) + 0.5) * vec2(p.texture_width, p.texture_height) / vec2(p.destination_width, p.destination_height) - 0.5;
+#       vec2 base = floor(pos);
+#       vec2 f = pos - base;
+#       ivec2 i = ivec2(base) + ivec2(p.texture_x, p.texture_y);
+#       vec3 color = mix(mix(source_pixel(i.x, i.y), source_pixel(i.x + 1, i.y), f.x), mix(source_pixel(i.x, i.y + 1), source_pixel(i.x + 1, i.y + 1), f.x), f.y);
+#       color *= (inside destination rectangle ? 1.0 : 0.0);
+#       ivec2 c = ivec2(x - p.cursor_x, y - p.cursor_y);
+#       vec4 cursor_color = unpackUnorm4x8(cursor[p.cursor_offset + clamp(c.y, 0, max(p.cursor_height - 1, 0)) * p.cursor_pitch + clamp(c.x, 0, max(p.cursor_width - 1, 0))]); /* .bgra if p.cursor_swap_rb */
+#       return mix(color, cursor_color.rgb, (inside cursor rectangle ? cursor_color.a : 0.0));
+#   }
+#
+#   void main() { /* Each invocation converts 4x2 pixels, so that every store is a whole uint */
+#       int block_x = gl_GlobalInvocationID.x, block_y = gl_GlobalInvocationID.y;
+#       if(block_x * 4 < p.frame_width && block_y * 2 < p.frame_height) {
+#           vec3 pixels[2][4] = frame_pixel(block_x * 4 + column, block_y * 2 + row), Y = dot(pixel, y_rgb) + y_offset;
+#           chroma for the 2 pairs of columns from the average of the 2x2 pixels;
+#           if(ten_bit) {
+#               store (uint(clamp(value, 0.0, 1.0) * 1023.0 + 0.5) << 6) as 16-bit values, 2 per uint;
+#           } else {
+#               store packUnorm4x8(4 values);
+#           }
+#       }
+#   }
+
+import sys
+
+# Push constants, in the order of gsr_vulkan_color_conversion_parameters in vulkan_color_conversion.c. All of them are int32
+PARAMETERS = [
+    "destination_x", "destination_y", "destination_width", "destination_height",
+    "texture_x", "texture_y", "texture_width", "texture_height",
+    "texture_full_width", "texture_full_height",
+    "source_offset", "source_pitch", "source_swap_rb",
+    "cursor_x", "cursor_y", "cursor_width", "cursor_height",
+    "cursor_offset", "cursor_pitch", "cursor_swap_rb",
+    "y_offset", "y_pitch", "uv_offset", "uv_pitch",
+    "frame_width", "frame_height",
+]
+
+LOCAL_SIZE_X = 8
+LOCAL_SIZE_Y = 8
+
+# spir-v opcodes
+OpSource = 3
+OpName = 5
+OpMemberName = 6
+OpExtInstImport = 11
+OpExtInst = 12
+OpMemoryModel = 14
+OpEntryPoint = 15
+OpExecutionMode = 16
+OpCapability = 17
+OpTypeVoid = 19
+OpTypeBool = 20
+OpTypeInt = 21
+OpTypeFloat = 22
+OpTypeVector = 23
+OpTypeRuntimeArray = 29
+OpTypeStruct = 30
+OpTypePointer = 32
+OpTypeFunction = 33
+OpConstant = 43
+OpSpecConstantFalse = 49
+OpSpecConstant = 50
+OpFunction = 54
+OpFunctionEnd = 56
+OpVariable = 59
+OpLoad = 61
+OpStore = 62
+OpAccessChain = 65
+OpDecorate = 71
+OpMemberDecorate = 72
+OpCompositeConstruct = 80
+OpCompositeExtract = 81
+OpConvertFToU = 109
+OpConvertFToS = 110
+OpConvertSToF = 111
+OpBitcast = 124
+OpIAdd = 128
+OpFAdd = 129
+OpISub = 130
+OpFSub = 131
+OpIMul = 132
+OpFMul = 133
+OpFDiv = 136
+OpVectorTimesScalar = 142
+OpDot = 148
+OpLogicalAnd = 167
+OpSelect = 169
+OpINotEqual = 171
+OpSGreaterThanEqual = 175
+OpSLessThan = 177
+OpShiftLeftLogical = 196
+OpBitwiseOr = 197
+OpSelectionMerge = 247
+OpLabel = 248
+OpBranch = 249
+OpBranchConditional = 250
+OpReturn = 253
+
+# GLSL.std.450 extended instructions
+GLSL_Floor = 8
+GLSL_SMax = 42
+GLSL_FClamp = 43
+GLSL_SClamp = 45
+GLSL_PackUnorm4x8 = 55
+GLSL_UnpackUnorm4x8 = 64
+
+StorageClassInput = 1
+StorageClassUniform = 2
+StorageClassPushConstant = 9
+StorageClassFunction = 7
+
+DecorationSpecId = 1
+DecorationBlock = 2
+DecorationBufferBlock = 3
+DecorationArrayStride = 6
+DecorationBuiltIn = 11
+DecorationNonWritable = 24
+DecorationBinding = 33
+DecorationDescriptorSet = 34
+DecorationOffset = 35
+
+BuiltInGlobalInvocationId = 28
+ExecutionModelGLCompute = 5
+ExecutionModeLocalSize = 17
+CapabilityShader = 1
+AddressingModelLogical = 0
+MemoryModelGLSL450 = 1
+SourceLanguageGLSL = 2
+
+def encode_string(string):
+    data = string.encode("utf-8") + b"\0"
+    data += b"\0" * ((4 - len(data) % 4) % 4)
+    return [int.from_bytes(data[i:i+4], "little") for i in range(0, len(data), 4)]
+
+def float_bits(value):
+    import struct
+    return struct.unpack("<I", struct.pack("<f", value))[0]
+
+class Module:
+    def __init__(self):
+        self.bound = 1
+        self.capabilities = []
+        self.ext_inst_imports = []
+        self.memory_model = []
+        self.entry_points = []
+        self.execution_modes = []
+        self.debug = []
+        self.annotations = []
+        self.globals = []
+        self.code = []
+        self.types = {}
+        self.constants = {}
+
+    def new_id(self):
+        result = self.bound
+        self.bound += 1
+        return result
+
+    @staticmethod
+    def emit(section, opcode, *operands):
+        words = []
+        for operand in operands:
+            if isinstance(operand, str):
+                words += encode_string(operand)
+            else:
+                words.append(operand)
+        section.append(((len(words) + 1) << 16) | opcode)
+        section.extend(words)
+
+    def type(self, key, opcode, *operands):
+        if key not in self.types:
+            self.types[key] = self.new_id()
+            self.emit(self.globals, opcode, self.types[key], *operands)
+        return self.types[key]
+
+    def void(self):
+        return self.type("void", OpTypeVoid)
+
+    def bool(self):
+        return self.type("bool", OpTypeBool)
+
+    def int(self):
+        return self.type("int", OpTypeInt, 32, 1)
+
+    def uint(self):
+        return self.type("uint", OpTypeInt, 32, 0)
+
+    def float(self):
+        return self.type("float", OpTypeFloat, 32)
+
+    def vec(self, component_type, count):
+        return self.type(("vec", component_type, count), OpTypeVector, component_type, count)
+
+    def pointer(self, storage_class, pointee_type):
+        return self.type(("pointer", storage_class, pointee_type), OpTypePointer, storage_class, pointee_type)
+
+    def constant(self, type_id, bits):
+        key = (type_id, bits)
+        if key not in self.constants:
+            self.constants[key] = self.new_id()
+            self.emit(self.globals, OpConstant, type_id, self.constants[key], bits)
+        return self.constants[key]
+
+    def const_int(self, value):
+        return self.constant(self.int(), value & 0xFFFFFFFF)
+
+    def const_uint(self, value):
+        return self.constant(self.uint(), value)
+
+    def const_float(self, value):
+        return self.constant(self.float(), float_bits(value))
+
+    def op(self, opcode, result_type, *operands):
+        result = self.new_id()
+        self.emit(self.code, opcode, result_type, result, *operands)
+        return result
+
+    def name(self, target, name):
+        self.emit(self.debug, OpName, target, name)
+
+class Shader:
+    def __init__(self):
+        m = Module()
+        self.m = m
+        m.emit(m.capabilities, OpCapability, CapabilityShader)
+        self.glsl = m.new_id()
+        m.emit(m.ext_inst_imports, OpExtInstImport, self.glsl, "GLSL.std.450")
+        m.emit(m.memory_model, OpMemoryModel, AddressingModelLogical, MemoryModelGLSL450)
+
+        self.vec3 = m.vec(m.float(), 3)
+        self.vec4 = m.vec(m.float(), 4)
+
+        # Color matrix and format, as specialization constants
+        self.matrix = []
+        for i in range(12):
+            constant = m.new_id()
+            m.emit(m.globals, OpSpecConstant, m.float(), constant, float_bits(0.0))
+            m.emit(m.annotations, OpDecorate, constant, DecorationSpecId, i)
+            self.matrix.append(constant)
+        self.ten_bit = m.new_id()
+        m.emit(m.globals, OpSpecConstantFalse, m.bool(), self.ten_bit)
+        m.emit(m.annotations, OpDecorate, self.ten_bit, DecorationSpecId, 12)
+        m.name(self.ten_bit, "ten_bit")
+
+        # Storage buffers (Uniform + BufferBlock so that this works with spir-v 1.0)
+        uint_array = m.new_id()
+        m.emit(m.globals, OpTypeRuntimeArray, uint_array, m.uint())
+        m.emit(m.annotations, OpDecorate, uint_array, DecorationArrayStride, 4)
+        self.buffer_pointer = m.pointer(StorageClassUniform, m.uint())
+        self.buffers = []
+        for binding, name in enumerate(["source", "cursor", "destination"]):
+            block = m.new_id()
+            m.emit(m.globals, OpTypeStruct, block, uint_array)
+            m.emit(m.annotations, OpDecorate, block, DecorationBufferBlock)
+            m.emit(m.annotations, OpMemberDecorate, block, 0, DecorationOffset, 0)
+            if name != "destination":
+                m.emit(m.annotations, OpMemberDecorate, block, 0, DecorationNonWritable)
+            variable = m.new_id()
+            m.emit(m.globals, OpVariable, m.pointer(StorageClassUniform, block), variable, StorageClassUniform)
+            m.emit(m.annotations, OpDecorate, variable, DecorationDescriptorSet, 0)
+            m.emit(m.annotations, OpDecorate, variable, DecorationBinding, binding)
+            m.name(variable, name)
+            self.buffers.append(variable)
+
+        # Push constants
+        parameters_block = m.new_id()
+        m.emit(m.globals, OpTypeStruct, parameters_block, *([m.int()] * len(PARAMETERS)))
+        m.emit(m.annotations, OpDecorate, parameters_block, DecorationBlock)
+        for i, name in enumerate(PARAMETERS):
+            m.emit(m.annotations, OpMemberDecorate, parameters_block, i, DecorationOffset, i * 4)
+            m.emit(m.debug, OpMemberName, parameters_block, i, name)
+        self.parameters_variable = m.new_id()
+        m.emit(m.globals, OpVariable, m.pointer(StorageClassPushConstant, parameters_block), self.parameters_variable, StorageClassPushConstant)
+        m.name(self.parameters_variable, "p")
+
+        uvec3 = m.vec(m.uint(), 3)
+        self.global_invocation_id = m.new_id()
+        m.emit(m.globals, OpVariable, m.pointer(StorageClassInput, uvec3), self.global_invocation_id, StorageClassInput)
+        m.emit(m.annotations, OpDecorate, self.global_invocation_id, DecorationBuiltIn, BuiltInGlobalInvocationId)
+
+        function_type = m.type("void()", OpTypeFunction, m.void())
+        self.main = m.new_id()
+        m.name(self.main, "main")
+        m.emit(m.entry_points, OpEntryPoint, ExecutionModelGLCompute, self.main, "main", self.global_invocation_id)
+        m.emit(m.execution_modes, OpExecutionMode, self.main, ExecutionModeLocalSize, LOCAL_SIZE_X, LOCAL_SIZE_Y, 1)
+        m.emit(m.code, OpFunction, m.void(), self.main, 0, function_type)
+        self.label()
+
+    def label(self, label_id=None):
+        if label_id is None:
+            label_id = self.m.new_id()
+        self.m.emit(self.m.code, OpLabel, label_id)
+        return label_id
+
+    def ext(self, result_type, instruction, *operands):
+        return self.m.op(OpExtInst, result_type, self.glsl, instruction, *operands)
+
+    # Integer helpers
+    def iadd(self, a, b): return self.m.op(OpIAdd, self.m.int(), a, b)
+    def isub(self, a, b): return self.m.op(OpISub, self.m.int(), a, b)
+    def imul(self, a, b): return self.m.op(OpIMul, self.m.int(), a, b)
+    def iclamp(self, v, lo, hi): return self.ext(self.m.int(), GLSL_SClamp, v, lo, hi)
+    def imax(self, a, b): return self.ext(self.m.int(), GLSL_SMax, a, b)
+    def ige(self, a, b): return self.m.op(OpSGreaterThanEqual, self.m.bool(), a, b)
+    def ilt(self, a, b): return self.m.op(OpSLessThan, self.m.bool(), a, b)
+    def land(self, a, b): return self.m.op(OpLogicalAnd, self.m.bool(), a, b)
+
+    # Float helpers
+    def fadd(self, a, b): return self.m.op(OpFAdd, self.m.float(), a, b)
+    def fsub(self, a, b): return self.m.op(OpFSub, self.m.float(), a, b)
+    def fmul(self, a, b): return self.m.op(OpFMul, self.m.float(), a, b)
+    def fdiv(self, a, b): return self.m.op(OpFDiv, self.m.float(), a, b)
+    def itof(self, a): return self.m.op(OpConvertSToF, self.m.float(), a)
+    def fselect(self, condition, a, b): return self.m.op(OpSelect, self.m.float(), condition, a, b)
+
+    # vec3 helpers
+    def vadd(self, a, b): return self.m.op(OpFAdd, self.vec3, a, b)
+    def vsub(self, a, b): return self.m.op(OpFSub, self.vec3, a, b)
+    def vscale(self, v, s): return self.m.op(OpVectorTimesScalar, self.vec3, v, s)
+    def vlerp(self, a, b, f): return self.vadd(a, self.vscale(self.vsub(b, a), f))
+    def dot(self, a, b): return self.m.op(OpDot, self.m.float(), a, b)
+    def vec3_of(self, x, y, z): return self.m.op(OpCompositeConstruct, self.vec3, x, y, z)
+    def extract(self, result_type, composite, index): return self.m.op(OpCompositeExtract, result_type, composite, index)
+
+    def load_parameters(self):
+        m = self.m
+        self.p = {}
+        pointer_type = m.pointer(StorageClassPushConstant, m.int())
+        for i, name in enumerate(PARAMETERS):
+            pointer = m.op(OpAccessChain, pointer_type, self.parameters_variable, m.const_int(i))
+            self.p[name] = m.op(OpLoad, m.int(), pointer)
+
+    def load_color(self, buffer, index, swap_rb):
+        # Returns (rgb, alpha)
+        m = self.m
+        pointer = m.op(OpAccessChain, self.buffer_pointer, buffer, m.const_int(0), index)
+        pixel = m.op(OpLoad, m.uint(), pointer)
+        color = self.ext(self.vec4, GLSL_UnpackUnorm4x8, pixel)
+        r = self.extract(m.float(), color, 0)
+        g = self.extract(m.float(), color, 1)
+        b = self.extract(m.float(), color, 2)
+        a = self.extract(m.float(), color, 3)
+        red = self.fselect(swap_rb, b, r)
+        blue = self.fselect(swap_rb, r, b)
+        return self.vec3_of(red, g, blue), a
+
+    def source_pixel(self, x, y):
+        m = self.m
+        p = self.p
+        x = self.iclamp(x, m.const_int(0), self.texture_max_x)
+        y = self.iclamp(y, m.const_int(0), self.texture_max_y)
+        index = self.iadd(p["source_offset"], self.iadd(self.imul(y, p["source_pitch"]), x))
+        return self.load_color(self.buffers[0], index, self.source_swap_rb)[0]
+
+    def in_rectangle(self, x, y, width, height):
+        m = self.m
+        zero = m.const_int(0)
+        return self.land(self.land(self.ige(x, zero), self.ige(y, zero)), self.land(self.ilt(x, width), self.ilt(y, height)))
+
+    def frame_pixel(self, x, y):
+        m = self.m
+        p = self.p
+        half = m.const_float(0.5)
+
+        # Bilinear scaling from the texture region to the destination region
+        local_x = self.isub(x, p["destination_x"])
+        local_y = self.isub(y, p["destination_y"])
+        pos_x = self.fsub(self.fmul(self.fadd(self.itof(local_x), half), self.scale_x), half)
+        pos_y = self.fsub(self.fmul(self.fadd(self.itof(local_y), half), self.scale_y), half)
+        base_x = self.ext(m.float(), GLSL_Floor, pos_x)
+        base_y = self.ext(m.float(), GLSL_Floor, pos_y)
+        fraction_x = self.fsub(pos_x, base_x)
+        fraction_y = self.fsub(pos_y, base_y)
+        texel_x = self.iadd(m.op(OpConvertFToS, m.int(), base_x), p["texture_x"])
+        texel_y = self.iadd(m.op(OpConvertFToS, m.int(), base_y), p["texture_y"])
+        one = m.const_int(1)
+        texel_x1 = self.iadd(texel_x, one)
+        texel_y1 = self.iadd(texel_y, one)
+        top = self.vlerp(self.source_pixel(texel_x, texel_y), self.source_pixel(texel_x1, texel_y), fraction_x)
+        bottom = self.vlerp(self.source_pixel(texel_x, texel_y1), self.source_pixel(texel_x1, texel_y1), fraction_x)
+        color = self.vlerp(top, bottom, fraction_y)
+
+        # Black outside of the destination region
+        inside = self.in_rectangle(local_x, local_y, p["destination_width"], p["destination_height"])
+        color = self.vscale(color, self.fselect(inside, m.const_float(1.0), m.const_float(0.0)))
+
+        # Cursor, 1:1 and blended on top
+        cursor_local_x = self.isub(x, p["cursor_x"])
+        cursor_local_y = self.isub(y, p["cursor_y"])
+        inside_cursor = self.in_rectangle(cursor_local_x, cursor_local_y, p["cursor_width"], p["cursor_height"])
+        cursor_texel_x = self.iclamp(cursor_local_x, m.const_int(0), self.cursor_max_x)
+        cursor_texel_y = self.iclamp(cursor_local_y, m.const_int(0), self.cursor_max_y)
+        index = self.iadd(p["cursor_offset"], self.iadd(self.imul(cursor_texel_y, p["cursor_pitch"]), cursor_texel_x))
+        cursor_color, cursor_alpha = self.load_color(self.buffers[1], index, self.cursor_swap_rb)
+        cursor_alpha = self.fselect(inside_cursor, cursor_alpha, m.const_float(0.0))
+        return self.vlerp(color, cursor_color, cursor_alpha)
+
+    def store(self, index, value):
+        m = self.m
+        pointer = m.op(OpAccessChain, self.buffer_pointer, self.buffers[2], m.const_int(0), index)
+        m.emit(m.code, OpStore, pointer, value)
+
+    def pack_unorm8(self, values):
+        m = self.m
+        return self.ext(m.uint(), GLSL_PackUnorm4x8, m.op(OpCompositeConstruct, self.vec4, *values))
+
+    def pack_unorm10_msb(self, low, high):
+        # Two 16-bit p010 samples: the 10-bit value in the high bits
+        m = self.m
+        def quantize(value):
+            value = self.ext(m.float(), GLSL_FClamp, value, m.const_float(0.0), m.const_float(1.0))
+            value = self.fadd(self.fmul(value, m.const_float(1023.0)), m.const_float(0.5))
+            return m.op(OpShiftLeftLogical, m.uint(), m.op(OpConvertFToU, m.uint(), value), m.const_uint(6))
+        return m.op(OpBitwiseOr, m.uint(), quantize(low), m.op(OpShiftLeftLogical, m.uint(), quantize(high), m.const_uint(16)))
+
+    def build(self):
+        m = self.m
+        self.load_parameters()
+        p = self.p
+
+        invocation = m.op(OpLoad, m.vec(m.uint(), 3), self.global_invocation_id)
+        block_x = m.op(OpBitcast, m.int(), self.extract(m.uint(), invocation, 0))
+        block_y = m.op(OpBitcast, m.int(), self.extract(m.uint(), invocation, 1))
+        x = self.imul(block_x, m.const_int(4))
+        y = self.imul(block_y, m.const_int(2))
+
+        # OpSelectionMerge has to be right before the branch, so the condition is calculated first
+        inside_frame = self.land(self.ilt(x, p["frame_width"]), self.ilt(y, p["frame_height"]))
+        then_label = m.new_id()
+        end_label = m.new_id()
+        m.emit(m.code, OpSelectionMerge, end_label, 0)
+        m.emit(m.code, OpBranchConditional, inside_frame, then_label, end_label)
+        self.label(then_label)
+
+        zero = m.const_int(0)
+        one = m.const_int(1)
+        self.texture_max_x = self.imax(self.isub(p["texture_full_width"], one), zero)
+        self.texture_max_y = self.imax(self.isub(p["texture_full_height"], one), zero)
+        self.cursor_max_x = self.imax(self.isub(p["cursor_width"], one), zero)
+        self.cursor_max_y = self.imax(self.isub(p["cursor_height"], one), zero)
+        self.scale_x = self.fdiv(self.itof(p["texture_width"]), self.itof(p["destination_width"]))
+        self.scale_y = self.fdiv(self.itof(p["texture_height"]), self.itof(p["destination_height"]))
+        self.source_swap_rb = m.op(OpINotEqual, m.bool(), p["source_swap_rb"], zero)
+        self.cursor_swap_rb = m.op(OpINotEqual, m.bool(), p["cursor_swap_rb"], zero)
+
+        y_rgb = self.vec3_of(*self.matrix[0:3])
+        u_rgb = self.vec3_of(*self.matrix[3:6])
+        v_rgb = self.vec3_of(*self.matrix[6:9])
+        y_offset, u_offset, v_offset = self.matrix[9:12]
+
+        pixels = [[self.frame_pixel(self.iadd(x, m.const_int(column)), self.iadd(y, m.const_int(row))) for column in range(4)] for row in range(2)]
+        luma = [[self.fadd(self.dot(pixel, y_rgb), y_offset) for pixel in row] for row in pixels]
+        chroma = []
+        for pair in range(2):
+            total = self.vadd(self.vadd(pixels[0][pair * 2], pixels[0][pair * 2 + 1]), self.vadd(pixels[1][pair * 2], pixels[1][pair * 2 + 1]))
+            average = self.vscale(total, m.const_float(0.25))
+            chroma += [self.fadd(self.dot(average, u_rgb), u_offset), self.fadd(self.dot(average, v_rgb), v_offset)]
+
+        y_row0 = self.iadd(p["y_offset"], self.imul(y, p["y_pitch"]))
+        y_row1 = self.iadd(y_row0, p["y_pitch"])
+        uv_row = self.iadd(p["uv_offset"], self.imul(block_y, p["uv_pitch"]))
+
+        ten_bit_label = m.new_id()
+        eight_bit_label = m.new_id()
+        format_end_label = m.new_id()
+        m.emit(m.code, OpSelectionMerge, format_end_label, 0)
+        m.emit(m.code, OpBranchConditional, self.ten_bit, ten_bit_label, eight_bit_label)
+
+        # p010: 4 pixels are 2 uints
+        self.label(ten_bit_label)
+        column = self.imul(block_x, m.const_int(2))
+        column1 = self.iadd(column, one)
+        for row_start, row in ((y_row0, luma[0]), (y_row1, luma[1])):
+            self.store(self.iadd(row_start, column), self.pack_unorm10_msb(row[0], row[1]))
+            self.store(self.iadd(row_start, column1), self.pack_unorm10_msb(row[2], row[3]))
+        self.store(self.iadd(uv_row, column), self.pack_unorm10_msb(chroma[0], chroma[1]))
+        self.store(self.iadd(uv_row, column1), self.pack_unorm10_msb(chroma[2], chroma[3]))
+        m.emit(m.code, OpBranch, format_end_label)
+
+        # nv12: 4 pixels are 1 uint
+        self.label(eight_bit_label)
+        self.store(self.iadd(y_row0, block_x), self.pack_unorm8(luma[0]))
+        self.store(self.iadd(y_row1, block_x), self.pack_unorm8(luma[1]))
+        self.store(self.iadd(uv_row, block_x), self.pack_unorm8(chroma))
+        m.emit(m.code, OpBranch, format_end_label)
+
+        self.label(format_end_label)
+        m.emit(m.code, OpBranch, end_label)
+        self.label(end_label)
+        m.emit(m.code, OpReturn)
+        m.emit(m.code, OpFunctionEnd)
+
+    def words(self):
+        m = self.m
+        header = [0x07230203, 0x00010000, 0, m.bound, 0]
+        return header + m.capabilities + m.ext_inst_imports + m.memory_model + m.entry_points + m.execution_modes + m.debug + m.annotations + m.globals + m.code
+
+def main():
+    shader = Shader()
+    shader.build()
+    words = shader.words()
+
+    out = sys.stdout
+    out.write("/* Generated by vulkan_color_conversion_spirv.py, don't edit this file */\n\n")
+    out.write("#define VULKAN_COLOR_CONVERSION_LOCAL_SIZE_X %d\n" % LOCAL_SIZE_X)
+    out.write("#define VULKAN_COLOR_CONVERSION_LOCAL_SIZE_Y %d\n" % LOCAL_SIZE_Y)
+    out.write("#define VULKAN_COLOR_CONVERSION_NUM_PARAMETERS %d\n\n" % len(PARAMETERS))
+    out.write("static const uint32_t vulkan_color_conversion_spirv[] = {\n")
+    for i in range(0, len(words), 8):
+        out.write("    " + ", ".join("0x%08x" % word for word in words[i:i+8]) + ",\n")
+    out.write("};\n")
+
+if __name__ == "__main__":
+    main()
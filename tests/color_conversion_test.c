@@ -0,0 +1,459 @@
+/*
+    Compares the opengl color conversion (compute shader and the Y/UV render passes) with the cpu color conversion.
+    Runs without a GPU on mesa llvmpipe, which supports OpenGL 4.5 so the compute shader path is tested as well.
+    A layer with a negative texture height (drawn upside down, for y-inverted screencopy frames) is compared with the cpu conversion with a negative stride.
+*/
+
+#include "gl_test_context.h"
+#include "../include/color_conversion.h"
+#include "../include/cpu_color_conversion.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GL_RED 0x1903
+#define GL_RG 0x8227
+#define GL_UNSIGNED_SHORT 0x1403
+
+#define TEST_WIDTH 64
+#define TEST_HEIGHT 48
+
+static int num_failed = 0;
+
+#define EXPECT(cond, ...) do {                                  \
+        if(!(cond)) {                                           \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fprintf(stderr, "\n");                              \
+            ++num_failed;                                       \
+        }                                                       \
+    } while(0)
+
+typedef struct {
+    gsr_destination_color destination_color;
+    gsr_color_range color_range;
+    unsigned int textures[2];
+    gsr_color_conversion color_conversion;
+} conversion_target;
+
+static unsigned int create_texture(gsr_egl *egl, int internal_format, int width, int height, unsigned int format, unsigned int type, const void *pixels) {
+    unsigned int texture = 0;
+    egl->glGenTextures(1, &texture);
+    egl->glBindTexture(GL_TEXTURE_2D, texture);
+    egl->glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, pixels);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    egl->glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+static bool conversion_target_init(conversion_target *self, gsr_egl *egl, gsr_destination_color destination_color, gsr_color_range color_range) {
+    memset(self, 0, sizeof(*self));
+    self->destination_color = destination_color;
+    self->color_range = color_range;
+
+    const bool ten_bit = destination_color == GSR_DESTINATION_COLOR_P010;
+    self->textures[0] = create_texture(egl, ten_bit ? GL_R16 : GL_R8, TEST_WIDTH, TEST_HEIGHT, GL_RED, ten_bit ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, NULL);
+    self->textures[1] = create_texture(egl, ten_bit ? GL_RG16 : GL_RG8, TEST_WIDTH / 2, TEST_HEIGHT / 2, GL_RG, ten_bit ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, NULL);
+
+    gsr_color_conversion_params params = {0};
+    params.egl = egl;
+    params.source_color = GSR_SOURCE_COLOR_RGB;
+    params.destination_color = destination_color;
+    params.destination_textures[0] = self->textures[0];
+    params.destination_textures[1] = self->textures[1];
+    params.num_destination_textures = 2;
+    params.color_range = color_range;
+    return gsr_color_conversion_init(&self->color_conversion, &params) == 0;
+}
+
+static void conversion_target_deinit(conversion_target *self, gsr_egl *egl) {
+    gsr_color_conversion_deinit(&self->color_conversion);
+    egl->glDeleteTextures(2, self->textures);
+}
+
+/* Y and UV as 16-bit values (8-bit values are not shifted, 10-bit values are shifted down to 10 bits) */
+static void conversion_target_read(conversion_target *self, gsr_egl *egl, uint16_t *y, uint16_t *uv) {
+    if(self->destination_color == GSR_DESTINATION_COLOR_P010) {
+        gl_test_context_read_texture(egl, self->textures[0], GL_RED, GL_UNSIGNED_SHORT, y);
+        gl_test_context_read_texture(egl, self->textures[1], GL_RG, GL_UNSIGNED_SHORT, uv);
+        for(int i = 0; i < TEST_WIDTH * TEST_HEIGHT; ++i)
+            y[i] >>= 6;
+        for(int i = 0; i < TEST_WIDTH * TEST_HEIGHT / 2; ++i)
+            uv[i] >>= 6;
+    } else {
+        uint8_t y8[TEST_WIDTH * TEST_HEIGHT];
+        uint8_t uv8[TEST_WIDTH * TEST_HEIGHT / 2];
+        gl_test_context_read_texture(egl, self->textures[0], GL_RED, GL_UNSIGNED_BYTE, y8);
+        gl_test_context_read_texture(egl, self->textures[1], GL_RG, GL_UNSIGNED_BYTE, uv8);
+        for(int i = 0; i < TEST_WIDTH * TEST_HEIGHT; ++i)
+            y[i] = y8[i];
+        for(int i = 0; i < TEST_WIDTH * TEST_HEIGHT / 2; ++i)
+            uv[i] = uv8[i];
+    }
+}
+
+/* |flip| converts |rgba| upside down */
+static void cpu_convert(const uint8_t *rgba, bool flip, gsr_destination_color destination_color, gsr_color_range color_range, uint16_t *y, uint16_t *uv) {
+    const bool ten_bit = destination_color == GSR_DESTINATION_COLOR_P010;
+    const int bytes_per_sample = ten_bit ? 2 : 1;
+    uint8_t y_plane[TEST_WIDTH * TEST_HEIGHT * 2];
+    uint8_t uv_plane[TEST_WIDTH * TEST_HEIGHT];
+
+    const gsr_cpu_source_image source = {
+        flip ? rgba + (TEST_HEIGHT - 1) * TEST_WIDTH * 4 : rgba,
+        flip ? -TEST_WIDTH * 4 : TEST_WIDTH * 4,
+        TEST_WIDTH, TEST_HEIGHT, GSR_CPU_SOURCE_FORMAT_RGBA
+    };
+    const gsr_cpu_destination_image destination = { y_plane, TEST_WIDTH * bytes_per_sample, uv_plane, TEST_WIDTH * bytes_per_sample };
+    gsr_cpu_color_conversion_convert(&source, &destination, destination_color, color_range);
+
+    for(int i = 0; i < TEST_WIDTH * TEST_HEIGHT; ++i)
+        y[i] = ten_bit ? ((const uint16_t*)y_plane)[i] >> 6 : y_plane[i];
+    for(int i = 0; i < TEST_WIDTH * TEST_HEIGHT / 2; ++i)
+        uv[i] = ten_bit ? ((const uint16_t*)uv_plane)[i] >> 6 : uv_plane[i];
+}
+
+static int max_difference(const uint16_t *a, const uint16_t *b, int num_values) {
+    int max_diff = 0;
+    for(int i = 0; i < num_values; ++i) {
+        const int diff = abs((int)a[i] - (int)b[i]);
+        if(diff > max_diff)
+            max_diff = diff;
+    }
+    return max_diff;
+}
+
+/* Smooth content, so that the bilinear sampling of the UV render pass gives (nearly) the same result as averaging 2x2 pixels */
+static void generate_gradient(uint8_t *rgba, int width, int height, int seed) {
+    for(int y = 0; y < height; ++y) {
+        for(int x = 0; x < width; ++x) {
+            uint8_t *pixel = rgba + (y * width + x) * 4;
+            pixel[0] = (x * 4 + seed) & 0xFF;
+            pixel[1] = (y * 5 + seed * 3) & 0xFF;
+            pixel[2] = ((x + y) * 2 + seed * 7) & 0xFF;
+            pixel[3] = 255;
+        }
+    }
+}
+
+static void generate_noise(uint8_t *rgba, int width, int height, unsigned int seed) {
+    for(int i = 0; i < width * height; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        rgba[i * 4 + 0] = (seed >> 16) & 0xFF;
+        rgba[i * 4 + 1] = (seed >> 8) & 0xFF;
+        rgba[i * 4 + 2] = (seed >> 24) & 0xFF;
+        rgba[i * 4 + 3] = 255;
+    }
+}
+
+static const char* destination_color_name(gsr_destination_color destination_color, gsr_color_range color_range) {
+    if(destination_color == GSR_DESTINATION_COLOR_P010)
+        return color_range == GSR_COLOR_RANGE_FULL ? "p010 full" : "p010 limited";
+    else
+        return color_range == GSR_COLOR_RANGE_FULL ? "nv12 full" : "nv12 limited";
+}
+
+static bool gl_version_at_least_4_3(gsr_egl *egl) {
+    int major = 0;
+    int minor = 0;
+    const char *version = (const char*)egl->glGetString(GL_VERSION);
+    return version && sscanf(version, "%d.%d", &major, &minor) == 2 && (major > 4 || (major == 4 && minor >= 3));
+}
+
+/* One full screen layer, compared with the cpu conversion of the same image. |flip| draws the layer upside down with a negative texture height */
+static void test_single_layer(gsr_egl *egl, gsr_destination_color destination_color, gsr_color_range color_range, bool compute_shader, bool noise, bool flip) {
+    conversion_target target;
+    if(!conversion_target_init(&target, egl, destination_color, color_range)) {
+        EXPECT(false, "%s: gsr_color_conversion_init failed", destination_color_name(destination_color, color_range));
+        return;
+    }
+
+    if(compute_shader) {
+        if(!target.color_conversion.use_compute_shader) {
+            EXPECT(!gl_version_at_least_4_3(egl), "%s: the compute shader is not used with %s", destination_color_name(destination_color, color_range), egl->glGetString(GL_VERSION));
+            conversion_target_deinit(&target, egl);
+            return;
+        }
+    } else {
+        /* Forces the Y/UV render passes */
+        target.color_conversion.use_compute_shader = false;
+    }
+
+    static uint8_t rgba[TEST_WIDTH * TEST_HEIGHT * 4];
+    if(noise)
+        generate_noise(rgba, TEST_WIDTH, TEST_HEIGHT, 1234);
+    else
+        generate_gradient(rgba, TEST_WIDTH, TEST_HEIGHT, 17);
+    const unsigned int source_texture = create_texture(egl, GL_RGBA8, TEST_WIDTH, TEST_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+
+    gsr_color_conversion_clear(&target.color_conversion);
+    const gsr_color_conversion_layer layer = {
+        .texture_id = source_texture,
+        .source_pos = (vec2i){0, 0},
+        .source_size = (vec2i){TEST_WIDTH, TEST_HEIGHT},
+        .texture_pos = (vec2i){0, flip ? TEST_HEIGHT : 0},
+        .texture_size = (vec2i){TEST_WIDTH, flip ? -TEST_HEIGHT : TEST_HEIGHT},
+        .texture_full_size = (vec2i){TEST_WIDTH, TEST_HEIGHT},
+        .rotation = 0.0f,
+        .external_texture = false
+    };
+    gsr_color_conversion_draw_layers(&target.color_conversion, &layer, 1);
+    egl->glFinish();
+
+    static uint16_t gl_y[TEST_WIDTH * TEST_HEIGHT];
+    static uint16_t gl_uv[TEST_WIDTH * TEST_HEIGHT / 2];
+    static uint16_t cpu_y[TEST_WIDTH * TEST_HEIGHT];
+    static uint16_t cpu_uv[TEST_WIDTH * TEST_HEIGHT / 2];
+    conversion_target_read(&target, egl, gl_y, gl_uv);
+    cpu_convert(rgba, flip, destination_color, color_range, cpu_y, cpu_uv);
+
+    const int max_y_diff = max_difference(gl_y, cpu_y, TEST_WIDTH * TEST_HEIGHT);
+    const int max_uv_diff = max_difference(gl_uv, cpu_uv, TEST_WIDTH * TEST_HEIGHT / 2);
+    /* 10-bit values have 4 times the precision, so rounding differences are up to 4 times larger */
+    const int tolerance = destination_color == GSR_DESTINATION_COLOR_P010 ? 4 : 1;
+    fprintf(stderr, "  %s, %s, %s%s: max difference to cpu: y: %d, uv: %d\n", destination_color_name(destination_color, color_range),
+        compute_shader ? "compute shader" : "render passes", noise ? "noise" : "gradient", flip ? ", upside down" : "", max_y_diff, max_uv_diff);
+    EXPECT(max_y_diff <= tolerance, "y differs by %d from the cpu conversion", max_y_diff);
+    /* The UV render pass samples between 4 pixels with bilinear filtering, which is only the exact average of the 4 pixels with the compute shader */
+    if(compute_shader || !noise)
+        EXPECT(max_uv_diff <= tolerance, "uv differs by %d from the cpu conversion", max_uv_diff);
+
+    egl->glDeleteTextures(1, &source_texture);
+    conversion_target_deinit(&target, egl);
+}
+
+typedef struct {
+    int x, y;
+    int width, height;
+    unsigned int seed;
+    bool transparent; /* Alpha is 255, 128 or 0 */
+} test_layer;
+
+/*
+    More layers than GSR_COLOR_CONVERSION_MAX_LAYERS (so they are drawn in more than one batch) that overlap, have odd positions/sizes,
+    are partially transparent (like the cursor) and are partially outside the destination.
+*/
+static const test_layer test_layers[] = {
+    { 0,  0,  TEST_WIDTH, TEST_HEIGHT, 0,  false }, /* Background, a gradient */
+    { 13, 7,  9,  11, 1,  true  },
+    { 17, 9,  3,  3,  11, false }, /* On top of the transparent layer, in the same batch */
+    { -3, -5, 8,  8,  2,  false },
+    { 58, 44, 10, 10, 3,  false },
+    { 2,  30, 6,  6,  4,  false },
+    { 5,  33, 6,  6,  5,  false },
+    { 30, 20, 4,  4,  7,  false },
+    { 31, 21, 5,  3,  8,  true  }, /* On top of the previous layer, in the next batch */
+    { 8,  36, 6,  6,  6,  false },
+    { 40, 2,  12, 2,  9,  false },
+    { 41, 3,  3,  12, 10, false },
+    { 50, 30, 7,  9,  12, true  },
+};
+#define NUM_TEST_LAYERS (int)(sizeof(test_layers) / sizeof(test_layers[0]))
+
+static void test_layer_generate(const test_layer *layer, uint8_t *rgba) {
+    if(layer->seed == 0) {
+        generate_gradient(rgba, layer->width, layer->height, 17);
+        return;
+    }
+
+    generate_noise(rgba, layer->width, layer->height, layer->seed);
+    if(layer->transparent) {
+        for(int y = 0; y < layer->height; ++y) {
+            for(int x = 0; x < layer->width; ++x) {
+                const uint8_t alphas[3] = { 255, 128, 0 };
+                rgba[(y * layer->width + x) * 4 + 3] = alphas[(x + y) % 3];
+            }
+        }
+    }
+}
+
+/*
+    Blends the layers on the cpu in rgb and then converts the result. |signatures| gets a value for each pixel that is only the same
+    for two pixels if the same layers with the same alpha cover them. |later_batch_signatures| is the same but only for the layers after the first batch.
+*/
+static void cpu_draw_layers(gsr_destination_color destination_color, gsr_color_range color_range, uint16_t *y, uint16_t *uv, uint32_t *signatures, uint32_t *later_batch_signatures) {
+    static double composite[TEST_WIDTH * TEST_HEIGHT * 3];
+    static uint8_t rgba[TEST_WIDTH * TEST_HEIGHT * 4];
+    static uint8_t layer_rgba[TEST_WIDTH * TEST_HEIGHT * 4];
+
+    for(int i = 0; i < TEST_WIDTH * TEST_HEIGHT * 3; ++i)
+        composite[i] = 0.0;
+    for(int i = 0; i < TEST_WIDTH * TEST_HEIGHT; ++i) {
+        signatures[i] = 0;
+        later_batch_signatures[i] = 0;
+    }
+
+    for(int l = 0; l < NUM_TEST_LAYERS; ++l) {
+        const test_layer *layer = &test_layers[l];
+        test_layer_generate(layer, layer_rgba);
+        for(int ly = 0; ly < layer->height; ++ly) {
+            for(int lx = 0; lx < layer->width; ++lx) {
+                const int x = layer->x + lx;
+                const int dy = layer->y + ly;
+                if(x < 0 || dy < 0 || x >= TEST_WIDTH || dy >= TEST_HEIGHT)
+                    continue;
+
+                const uint8_t *pixel = layer_rgba + (ly * layer->width + lx) * 4;
+                const double alpha = pixel[3] / 255.0;
+                for(int c = 0; c < 3; ++c) {
+                    double *value = &composite[(dy * TEST_WIDTH + x) * 3 + c];
+                    *value = pixel[c] * alpha + *value * (1.0 - alpha);
+                }
+                const uint32_t signature = (uint32_t)(l + 1) * 257u + pixel[3];
+                signatures[dy * TEST_WIDTH + x] = signatures[dy * TEST_WIDTH + x] * 31u + signature;
+                if(l >= GSR_COLOR_CONVERSION_MAX_LAYERS)
+                    later_batch_signatures[dy * TEST_WIDTH + x] = later_batch_signatures[dy * TEST_WIDTH + x] * 31u + signature;
+            }
+        }
+    }
+
+    for(int i = 0; i < TEST_WIDTH * TEST_HEIGHT; ++i) {
+        for(int c = 0; c < 3; ++c)
+            rgba[i * 4 + c] = (uint8_t)(composite[i * 3 + c] + 0.5);
+        rgba[i * 4 + 3] = 255;
+    }
+    cpu_convert(rgba, false, destination_color, color_range, y, uv);
+}
+
+/*
+    Each layer is drawn from a region in the middle of a larger texture, like a monitor in the combined kms plane, so the
+    texture coordinates are only right if the size of the whole texture (|texture_full_size|) is used
+*/
+#define LAYER_TEXTURE_PADDING 3
+
+/* All test layers drawn with one |gsr_color_conversion_draw_layers| call, compared with blending the layers on the cpu */
+static void test_multiple_layers(gsr_egl *egl, gsr_destination_color destination_color, gsr_color_range color_range, bool compute_shader) {
+    conversion_target target;
+    if(!conversion_target_init(&target, egl, destination_color, color_range)) {
+        EXPECT(false, "%s: gsr_color_conversion_init failed", destination_color_name(destination_color, color_range));
+        return;
+    }
+
+    if(compute_shader) {
+        if(!target.color_conversion.use_compute_shader) {
+            conversion_target_deinit(&target, egl);
+            return;
+        }
+    } else {
+        target.color_conversion.use_compute_shader = false;
+    }
+
+    static uint8_t rgba[TEST_WIDTH * TEST_HEIGHT * 4];
+    static uint8_t padded_rgba[(TEST_WIDTH + LAYER_TEXTURE_PADDING * 2) * (TEST_HEIGHT + LAYER_TEXTURE_PADDING * 2) * 4];
+    unsigned int textures[NUM_TEST_LAYERS];
+    gsr_color_conversion_layer layers[NUM_TEST_LAYERS];
+    for(int i = 0; i < NUM_TEST_LAYERS; ++i) {
+        const test_layer *layer = &test_layers[i];
+        test_layer_generate(layer, rgba);
+
+        /* The padding is opaque white, which shows up in the comparison if it's sampled */
+        const int padded_width = layer->width + LAYER_TEXTURE_PADDING * 2;
+        const int padded_height = layer->height + LAYER_TEXTURE_PADDING * 2;
+        memset(padded_rgba, 255, (size_t)padded_width * padded_height * 4);
+        for(int y = 0; y < layer->height; ++y) {
+            memcpy(padded_rgba + ((size_t)(y + LAYER_TEXTURE_PADDING) * padded_width + LAYER_TEXTURE_PADDING) * 4,
+                rgba + (size_t)y * layer->width * 4, (size_t)layer->width * 4);
+        }
+
+        textures[i] = create_texture(egl, GL_RGBA8, padded_width, padded_height, GL_RGBA, GL_UNSIGNED_BYTE, padded_rgba);
+        layers[i] = (gsr_color_conversion_layer){
+            .texture_id = textures[i],
+            .source_pos = (vec2i){layer->x, layer->y},
+            .source_size = (vec2i){layer->width, layer->height},
+            .texture_pos = (vec2i){LAYER_TEXTURE_PADDING, LAYER_TEXTURE_PADDING},
+            .texture_size = (vec2i){layer->width, layer->height},
+            .texture_full_size = (vec2i){padded_width, padded_height},
+            .rotation = 0.0f,
+            .external_texture = false
+        };
+    }
+
+    gsr_color_conversion_clear(&target.color_conversion);
+    gsr_color_conversion_draw_layers(&target.color_conversion, layers, NUM_TEST_LAYERS);
+    egl->glFinish();
+
+    static uint16_t gl_y[TEST_WIDTH * TEST_HEIGHT];
+    static uint16_t gl_uv[TEST_WIDTH * TEST_HEIGHT / 2];
+    static uint16_t cpu_y[TEST_WIDTH * TEST_HEIGHT];
+    static uint16_t cpu_uv[TEST_WIDTH * TEST_HEIGHT / 2];
+    static uint32_t signatures[TEST_WIDTH * TEST_HEIGHT];
+    static uint32_t later_batch_signatures[TEST_WIDTH * TEST_HEIGHT];
+    conversion_target_read(&target, egl, gl_y, gl_uv);
+    cpu_draw_layers(destination_color, color_range, cpu_y, cpu_uv, signatures, later_batch_signatures);
+
+    const int max_y_diff = max_difference(gl_y, cpu_y, TEST_WIDTH * TEST_HEIGHT);
+
+    /*
+        The render passes sample the 4 pixels of a chroma block with bilinear filtering, which doesn't give the average of the
+        blended pixels when a layer edge or different alpha values are inside the block, so those blocks are skipped.
+        The compute shader blends all layers of a batch for each pixel, but between batches only the average chroma of a block is stored,
+        so blocks where a later batch covers the pixels differently are skipped.
+    */
+    int max_uv_diff = 0;
+    int num_uv_compared = 0;
+    const uint32_t *block_signatures = compute_shader ? later_batch_signatures : signatures;
+    for(int cy = 0; cy < TEST_HEIGHT / 2; ++cy) {
+        for(int cx = 0; cx < TEST_WIDTH / 2; ++cx) {
+            const uint32_t signature = block_signatures[cy * 2 * TEST_WIDTH + cx * 2];
+            const bool uniform_block = block_signatures[cy * 2 * TEST_WIDTH + cx * 2 + 1] == signature
+                && block_signatures[(cy * 2 + 1) * TEST_WIDTH + cx * 2] == signature
+                && block_signatures[(cy * 2 + 1) * TEST_WIDTH + cx * 2 + 1] == signature;
+            if(!uniform_block)
+                continue;
+
+            for(int c = 0; c < 2; ++c) {
+                const int index = (cy * TEST_WIDTH / 2 + cx) * 2 + c;
+                const int diff = abs((int)gl_uv[index] - (int)cpu_uv[index]);
+                if(diff > max_uv_diff)
+                    max_uv_diff = diff;
+            }
+            ++num_uv_compared;
+        }
+    }
+
+    /* The blended rgb values are rounded to 8-bit before the cpu conversion, which adds up to 0.5 (2 for 10-bit) to the difference */
+    const int tolerance = destination_color == GSR_DESTINATION_COLOR_P010 ? 6 : 2;
+    fprintf(stderr, "  %s, %s, %d layers: max difference to cpu: y: %d, uv: %d (%d of %d chroma blocks)\n", destination_color_name(destination_color, color_range),
+        compute_shader ? "compute shader" : "render passes", NUM_TEST_LAYERS, max_y_diff, max_uv_diff, num_uv_compared, TEST_WIDTH * TEST_HEIGHT / 4);
+    EXPECT(max_y_diff <= tolerance, "y differs by %d from the cpu conversion", max_y_diff);
+    EXPECT(max_uv_diff <= tolerance, "uv differs by %d from the cpu conversion", max_uv_diff);
+
+    egl->glDeleteTextures(NUM_TEST_LAYERS, textures);
+    conversion_target_deinit(&target, egl);
+}
+
+int main(void) {
+    gsr_egl egl;
+    if(!gl_test_context_init(&egl)) {
+        fprintf(stderr, "SKIP: no opengl context, set LIBGL_ALWAYS_SOFTWARE=1 to use mesa llvmpipe\n");
+        return 77;
+    }
+    fprintf(stderr, "opengl: %s, %s\n", egl.glGetString(GL_VERSION), egl.glGetString(GL_RENDERER));
+
+    const gsr_destination_color destination_colors[2] = { GSR_DESTINATION_COLOR_NV12, GSR_DESTINATION_COLOR_P010 };
+    const gsr_color_range color_ranges[2] = { GSR_COLOR_RANGE_LIMITED, GSR_COLOR_RANGE_FULL };
+    for(int i = 0; i < 2; ++i) {
+        for(int j = 0; j < 2; ++j) {
+            test_single_layer(&egl, destination_colors[i], color_ranges[j], true, false, false);
+            test_single_layer(&egl, destination_colors[i], color_ranges[j], true, true, false);
+            test_single_layer(&egl, destination_colors[i], color_ranges[j], false, false, false);
+            test_single_layer(&egl, destination_colors[i], color_ranges[j], false, true, false);
+            test_single_layer(&egl, destination_colors[i], color_ranges[j], true, true, true);
+            test_single_layer(&egl, destination_colors[i], color_ranges[j], false, false, true);
+            test_multiple_layers(&egl, destination_colors[i], color_ranges[j], true);
+            test_multiple_layers(&egl, destination_colors[i], color_ranges[j], false);
+        }
+    }
+
+    gl_test_context_deinit(&egl);
+
+    if(num_failed > 0) {
+        fprintf(stderr, "color_conversion_test: %d check(s) failed\n", num_failed);
+        return 1;
+    }
+    fprintf(stderr, "color_conversion_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,390 @@
+/*
+    Tests the cpu color conversion: the simd versions have to give exactly the same output as the scalar version
+    and the scalar version has to be within rounding of a double precision conversion with the same color matrices.
+    A negative source stride has to give the same output as converting a vertically flipped copy of the image.
+
+    Run with --bench to measure the speed of each implementation for a 1920x1080 BGRA image.
+*/
+
+#include "../include/cpu_color_conversion.h"
+#include "../include/color_matrices.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+/* Bytes after each row of the destination planes, they should never be written to */
+#define ROW_PADDING 16
+#define PADDING_VALUE 0xCD
+
+static int num_failed = 0;
+
+#define EXPECT(cond, ...) do {                                  \
+        if(!(cond)) {                                           \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fprintf(stderr, "\n");                              \
+            ++num_failed;                                       \
+        }                                                       \
+    } while(0)
+
+static const char *implementations[] = { "scalar", "sse4.1", "avx2", "neon" };
+#define NUM_IMPLEMENTATIONS (int)(sizeof(implementations) / sizeof(implementations[0]))
+
+static const char* format_name(gsr_cpu_source_format format) {
+    switch(format) {
+        case GSR_CPU_SOURCE_FORMAT_RGBA: return "rgba";
+        case GSR_CPU_SOURCE_FORMAT_BGRA: return "bgra";
+        case GSR_CPU_SOURCE_FORMAT_RGB:  return "rgb";
+    }
+    return "unknown";
+}
+
+static int format_bytes_per_pixel(gsr_cpu_source_format format) {
+    return format == GSR_CPU_SOURCE_FORMAT_RGB ? 3 : 4;
+}
+
+static uint32_t random_state = 0x12345678;
+static uint32_t random_u32(void) {
+    random_state = random_state * 1664525u + 1013904223u;
+    return random_state >> 8;
+}
+
+typedef struct {
+    uint8_t *y;
+    uint8_t *uv;
+    int width;
+    int height;
+    gsr_cpu_destination_image image;
+} destination_buffer;
+
+static void destination_buffer_init(destination_buffer *self, int width, int height, bool ten_bit) {
+    const int bytes_per_sample = ten_bit ? 2 : 1;
+    self->width = width;
+    self->height = height;
+    self->image.y_stride = width * bytes_per_sample + ROW_PADDING;
+    self->image.uv_stride = ((width + 1) / 2) * 2 * bytes_per_sample + ROW_PADDING;
+    self->y = malloc((size_t)self->image.y_stride * height);
+    self->uv = malloc((size_t)self->image.uv_stride * ((height + 1) / 2));
+    memset(self->y, PADDING_VALUE, (size_t)self->image.y_stride * height);
+    memset(self->uv, PADDING_VALUE, (size_t)self->image.uv_stride * ((height + 1) / 2));
+    self->image.y = self->y;
+    self->image.uv = self->uv;
+}
+
+static void destination_buffer_deinit(destination_buffer *self) {
+    free(self->y);
+    free(self->uv);
+}
+
+static bool padding_is_untouched(const uint8_t *plane, int stride, int row_size, int num_rows) {
+    for(int y = 0; y < num_rows; ++y) {
+        for(int x = row_size; x < stride; ++x) {
+            if(plane[(size_t)y * stride + x] != PADDING_VALUE)
+                return false;
+        }
+    }
+    return true;
+}
+
+static int read_sample(const uint8_t *plane, int stride, int x, int y, bool ten_bit) {
+    if(ten_bit)
+        return ((const uint16_t*)(plane + (size_t)y * stride))[x] >> 6;
+    else
+        return plane[(size_t)y * stride + x];
+}
+
+static void source_pixel(const gsr_cpu_source_image *source, int x, int y, double *r, double *g, double *b) {
+    const uint8_t *pixel = source->data + (size_t)y * source->stride + (size_t)x * format_bytes_per_pixel(source->format);
+    const bool bgra = source->format == GSR_CPU_SOURCE_FORMAT_BGRA;
+    *r = pixel[bgra ? 2 : 0];
+    *g = pixel[1];
+    *b = pixel[bgra ? 0 : 2];
+}
+
+/* Returns the largest difference between |destination| and a double precision conversion of |source| */
+static double max_error_from_reference(const gsr_cpu_source_image *source, const gsr_cpu_destination_image *destination, gsr_destination_color destination_color, gsr_color_range color_range) {
+    const gsr_color_matrix *m = gsr_color_matrix_get(destination_color, color_range);
+    const bool ten_bit = destination_color == GSR_DESTINATION_COLOR_P010;
+    const double max_value = ten_bit ? 1023.0 : 255.0;
+    double max_error = 0.0;
+
+    for(int y = 0; y < source->height; ++y) {
+        for(int x = 0; x < source->width; ++x) {
+            double r, g, b;
+            source_pixel(source, x, y, &r, &g, &b);
+            double expected = (m->r[0] * r + m->g[0] * g + m->b[0] * b) / 255.0 * max_value + m->offset[0] * max_value;
+            expected = fmin(fmax(expected, 0.0), max_value);
+            const double error = fabs(read_sample(destination->y, destination->y_stride, x, y, ten_bit) - expected);
+            if(error > max_error)
+                max_error = error;
+        }
+    }
+
+    for(int y = 0; y < source->height; y += 2) {
+        for(int x = 0; x < source->width; x += 2) {
+            /* The last row/column is repeated for odd sizes */
+            double r = 0.0, g = 0.0, b = 0.0;
+            for(int i = 0; i < 4; ++i) {
+                const int px = x + (i & 1) < source->width ? x + (i & 1) : x;
+                const int py = y + (i >> 1) < source->height ? y + (i >> 1) : y;
+                double pr, pg, pb;
+                source_pixel(source, px, py, &pr, &pg, &pb);
+                r += pr * 0.25;
+                g += pg * 0.25;
+                b += pb * 0.25;
+            }
+
+            for(int i = 1; i < 3; ++i) {
+                double expected = (m->r[i] * r + m->g[i] * g + m->b[i] * b) / 255.0 * max_value + m->offset[i] * max_value;
+                expected = fmin(fmax(expected, 0.0), max_value);
+                const double error = fabs(read_sample(destination->uv, destination->uv_stride, x + (i - 1), y / 2, ten_bit) - expected);
+                if(error > max_error)
+                    max_error = error;
+            }
+        }
+    }
+
+    return max_error;
+}
+
+static bool convert_with(const char *implementation, const gsr_cpu_source_image *source, destination_buffer *destination, gsr_destination_color destination_color, gsr_color_range color_range) {
+    if(!gsr_cpu_color_conversion_set_implementation(implementation))
+        return false;
+    const int result = gsr_cpu_color_conversion_convert(source, &destination->image, destination_color, color_range);
+    gsr_cpu_color_conversion_set_implementation(NULL);
+    EXPECT(result == 0, "%s: conversion failed", implementation);
+    return true;
+}
+
+static double max_error = 0.0;
+
+static void test_conversion(int width, int height, gsr_cpu_source_format format, gsr_destination_color destination_color, gsr_color_range color_range) {
+    const bool ten_bit = destination_color == GSR_DESTINATION_COLOR_P010;
+    const int bytes_per_pixel = format_bytes_per_pixel(format);
+    /* Padding at the end of each source row, like XImage/shm buffers can have */
+    const int source_stride = width * bytes_per_pixel + 12;
+
+    uint8_t *source_data = malloc((size_t)source_stride * height);
+    for(size_t i = 0; i < (size_t)source_stride * height; ++i) {
+        source_data[i] = random_u32() & 0xFF;
+    }
+    /* The extremes, to test clamping */
+    if(width * height >= 2) {
+        memset(source_data, 0, bytes_per_pixel);
+        memset(source_data + bytes_per_pixel, 0xFF, bytes_per_pixel);
+    }
+
+    const gsr_cpu_source_image source = { source_data, source_stride, width, height, format };
+    const int y_row_size = width * (ten_bit ? 2 : 1);
+    const int uv_row_size = ((width + 1) / 2) * 2 * (ten_bit ? 2 : 1);
+
+    destination_buffer scalar;
+    destination_buffer_init(&scalar, width, height, ten_bit);
+    convert_with("scalar", &source, &scalar, destination_color, color_range);
+
+    const double error = max_error_from_reference(&source, &scalar.image, destination_color, color_range);
+    if(error > max_error)
+        max_error = error;
+    /* Rounding is 0.5, the fixed point coefficients add at most 3 * 255 * 0.5 / 2^14 */
+    EXPECT(error <= 0.53, "scalar %dx%d %s, destination %d, range %d: max error from the reference is %f", width, height, format_name(format), destination_color, color_range, error);
+    EXPECT(padding_is_untouched(scalar.y, scalar.image.y_stride, y_row_size, height), "scalar %dx%d %s: wrote outside of the y plane", width, height, format_name(format));
+    EXPECT(padding_is_untouched(scalar.uv, scalar.image.uv_stride, uv_row_size, (height + 1) / 2), "scalar %dx%d %s: wrote outside of the uv plane", width, height, format_name(format));
+
+    for(int i = 1; i < NUM_IMPLEMENTATIONS; ++i) {
+        destination_buffer simd;
+        destination_buffer_init(&simd, width, height, ten_bit);
+        if(convert_with(implementations[i], &source, &simd, destination_color, color_range)) {
+            /* The padding is included in the comparison */
+            EXPECT(memcmp(simd.y, scalar.y, (size_t)scalar.image.y_stride * height) == 0, "%s %dx%d %s, destination %d, range %d: y is different from scalar", implementations[i], width, height, format_name(format), destination_color, color_range);
+            EXPECT(memcmp(simd.uv, scalar.uv, (size_t)scalar.image.uv_stride * ((height + 1) / 2)) == 0, "%s %dx%d %s, destination %d, range %d: uv is different from scalar", implementations[i], width, height, format_name(format), destination_color, color_range);
+        }
+        destination_buffer_deinit(&simd);
+    }
+
+    destination_buffer_deinit(&scalar);
+    free(source_data);
+}
+
+/* Converting with a negative stride from the last row has to be the same as converting a copy of the image that is upside down */
+static void test_negative_stride(int width, int height) {
+    const int stride = width * 4 + 12;
+    uint8_t *source_data = malloc((size_t)stride * height);
+    uint8_t *flipped_data = malloc((size_t)stride * height);
+    for(size_t i = 0; i < (size_t)stride * height; ++i) {
+        source_data[i] = random_u32() & 0xFF;
+    }
+    for(int y = 0; y < height; ++y) {
+        memcpy(flipped_data + (size_t)y * stride, source_data + (size_t)(height - 1 - y) * stride, stride);
+    }
+
+    const gsr_cpu_source_image source = { source_data + (size_t)(height - 1) * stride, -stride, width, height, GSR_CPU_SOURCE_FORMAT_BGRA };
+    const gsr_cpu_source_image flipped = { flipped_data, stride, width, height, GSR_CPU_SOURCE_FORMAT_BGRA };
+
+    for(int i = 0; i < NUM_IMPLEMENTATIONS; ++i) {
+        destination_buffer expected;
+        destination_buffer actual;
+        destination_buffer_init(&expected, width, height, false);
+        destination_buffer_init(&actual, width, height, false);
+        if(convert_with(implementations[i], &flipped, &expected, GSR_DESTINATION_COLOR_NV12, GSR_COLOR_RANGE_LIMITED)
+            && convert_with(implementations[i], &source, &actual, GSR_DESTINATION_COLOR_NV12, GSR_COLOR_RANGE_LIMITED))
+        {
+            EXPECT(memcmp(actual.y, expected.y, (size_t)expected.image.y_stride * height) == 0, "%s %dx%d: y is different with a negative stride", implementations[i], width, height);
+            EXPECT(memcmp(actual.uv, expected.uv, (size_t)expected.image.uv_stride * ((height + 1) / 2)) == 0, "%s %dx%d: uv is different with a negative stride", implementations[i], width, height);
+        }
+        destination_buffer_deinit(&actual);
+        destination_buffer_deinit(&expected);
+    }
+
+    free(flipped_data);
+    free(source_data);
+}
+
+/* Known values for solid colors */
+static void test_golden_values(void) {
+    typedef struct {
+        uint8_t r, g, b;
+        gsr_destination_color destination_color;
+        gsr_color_range color_range;
+        int y, u, v;
+    } golden_value;
+
+    const golden_value golden_values[] = {
+        { 0,   0,   0,   GSR_DESTINATION_COLOR_NV12, GSR_COLOR_RANGE_LIMITED, 16,  128, 128 },
+        { 255, 255, 255, GSR_DESTINATION_COLOR_NV12, GSR_COLOR_RANGE_LIMITED, 235, 128, 128 },
+        { 0,   0,   0,   GSR_DESTINATION_COLOR_NV12, GSR_COLOR_RANGE_FULL,    0,   128, 128 },
+        { 255, 255, 255, GSR_DESTINATION_COLOR_NV12, GSR_COLOR_RANGE_FULL,    255, 128, 128 },
+        { 128, 128, 128, GSR_DESTINATION_COLOR_NV12, GSR_COLOR_RANGE_FULL,    128, 128, 128 },
+        { 255, 0,   0,   GSR_DESTINATION_COLOR_NV12, GSR_COLOR_RANGE_LIMITED, 63,  102, 237 },
+        { 0,   0,   0,   GSR_DESTINATION_COLOR_P010, GSR_COLOR_RANGE_LIMITED, 64,  512, 512 },
+        /* The 10-bit matrices are the 8-bit limited range scaled to 10 bits (the same as the opengl shaders), so white is 943 and not 940 */
+        { 255, 255, 255, GSR_DESTINATION_COLOR_P010, GSR_COLOR_RANGE_LIMITED, 943, 512, 512 },
+        { 0,   0,   0,   GSR_DESTINATION_COLOR_P010, GSR_COLOR_RANGE_FULL,    0,   512, 512 },
+    };
+
+    enum { WIDTH = 40, HEIGHT = 4 };
+    uint8_t source_data[WIDTH * HEIGHT * 4];
+
+    for(size_t i = 0; i < sizeof(golden_values) / sizeof(golden_values[0]); ++i) {
+        const golden_value *golden = &golden_values[i];
+        const bool ten_bit = golden->destination_color == GSR_DESTINATION_COLOR_P010;
+        for(int p = 0; p < WIDTH * HEIGHT; ++p) {
+            source_data[p * 4 + 0] = golden->r;
+            source_data[p * 4 + 1] = golden->g;
+            source_data[p * 4 + 2] = golden->b;
+            source_data[p * 4 + 3] = 255;
+        }
+
+        const gsr_cpu_source_image source = { source_data, WIDTH * 4, WIDTH, HEIGHT, GSR_CPU_SOURCE_FORMAT_RGBA };
+        for(int impl = 0; impl < NUM_IMPLEMENTATIONS; ++impl) {
+            destination_buffer destination;
+            destination_buffer_init(&destination, WIDTH, HEIGHT, ten_bit);
+            if(convert_with(implementations[impl], &source, &destination, golden->destination_color, golden->color_range)) {
+                /* Check the last pixel, that one is converted by the simd code (if any) or the scalar tail */
+                const int y = read_sample(destination.y, destination.image.y_stride, WIDTH - 1, HEIGHT - 1, ten_bit);
+                const int u = read_sample(destination.uv, destination.image.uv_stride, WIDTH - 2, HEIGHT / 2 - 1, ten_bit);
+                const int v = read_sample(destination.uv, destination.image.uv_stride, WIDTH - 1, HEIGHT / 2 - 1, ten_bit);
+                EXPECT(y == golden->y && u == golden->u && v == golden->v, "%s: rgb(%d, %d, %d), destination %d, range %d: expected yuv(%d, %d, %d), got yuv(%d, %d, %d)",
+                    implementations[impl], golden->r, golden->g, golden->b, golden->destination_color, golden->color_range, golden->y, golden->u, golden->v, y, u, v);
+            }
+            destination_buffer_deinit(&destination);
+        }
+    }
+}
+
+static double clock_get_monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
+}
+
+static void benchmark(void) {
+    enum { WIDTH = 1920, HEIGHT = 1080 };
+    uint8_t *source_data = malloc((size_t)WIDTH * HEIGHT * 4);
+    for(size_t i = 0; i < (size_t)WIDTH * HEIGHT * 4; ++i) {
+        source_data[i] = random_u32() & 0xFF;
+    }
+
+    const gsr_cpu_source_image source = { source_data, WIDTH * 4, WIDTH, HEIGHT, GSR_CPU_SOURCE_FORMAT_BGRA };
+    const gsr_destination_color destination_colors[] = { GSR_DESTINATION_COLOR_NV12, GSR_DESTINATION_COLOR_P010 };
+
+    for(int c = 0; c < 2; ++c) {
+        const gsr_destination_color destination_color = destination_colors[c];
+        destination_buffer destination;
+        destination_buffer_init(&destination, WIDTH, HEIGHT, destination_color == GSR_DESTINATION_COLOR_P010);
+
+        for(int i = 0; i < NUM_IMPLEMENTATIONS; ++i) {
+            if(!gsr_cpu_color_conversion_set_implementation(implementations[i]))
+                continue;
+
+            /* Warm up */
+            gsr_cpu_color_conversion_convert(&source, &destination.image, destination_color, GSR_COLOR_RANGE_LIMITED);
+
+            int num_frames = 0;
+            const double start = clock_get_monotonic_seconds();
+            double elapsed = 0.0;
+            while(elapsed < 1.0) {
+                gsr_cpu_color_conversion_convert(&source, &destination.image, destination_color, GSR_COLOR_RANGE_LIMITED);
+                ++num_frames;
+                elapsed = clock_get_monotonic_seconds() - start;
+            }
+
+            fprintf(stderr, "%dx%d bgra -> %s, %-6s: %.3f ms/frame\n", WIDTH, HEIGHT, destination_color == GSR_DESTINATION_COLOR_P010 ? "p010" : "nv12",
+                implementations[i], elapsed * 1000.0 / num_frames);
+        }
+
+        gsr_cpu_color_conversion_set_implementation(NULL);
+        destination_buffer_deinit(&destination);
+    }
+
+    free(source_data);
+}
+
+int main(int argc, char **argv) {
+    if(argc == 2 && strcmp(argv[1], "--bench") == 0) {
+        fprintf(stderr, "default implementation: %s\n", gsr_cpu_color_conversion_get_implementation_name());
+        benchmark();
+        return 0;
+    }
+
+    fprintf(stderr, "default implementation: %s, available:", gsr_cpu_color_conversion_get_implementation_name());
+    for(int i = 0; i < NUM_IMPLEMENTATIONS; ++i) {
+        if(gsr_cpu_color_conversion_set_implementation(implementations[i]))
+            fprintf(stderr, " %s", implementations[i]);
+    }
+    fprintf(stderr, "\n");
+    gsr_cpu_color_conversion_set_implementation(NULL);
+
+    EXPECT(!gsr_cpu_color_conversion_set_implementation("unknown"), "unknown implementation was accepted");
+
+    test_golden_values();
+    test_negative_stride(67, 5);
+    test_negative_stride(64, 4);
+
+    /* Sizes around the simd widths (4 and 8 pixels) and odd sizes */
+    const int widths[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 64, 67 };
+    const int heights[] = { 1, 2, 3, 5 };
+    const gsr_cpu_source_format formats[] = { GSR_CPU_SOURCE_FORMAT_RGBA, GSR_CPU_SOURCE_FORMAT_BGRA, GSR_CPU_SOURCE_FORMAT_RGB };
+    const gsr_destination_color destination_colors[] = { GSR_DESTINATION_COLOR_NV12, GSR_DESTINATION_COLOR_P010 };
+    const gsr_color_range color_ranges[] = { GSR_COLOR_RANGE_LIMITED, GSR_COLOR_RANGE_FULL };
+
+    for(size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w) {
+        for(size_t h = 0; h < sizeof(heights) / sizeof(heights[0]); ++h) {
+            for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+                for(size_t c = 0; c < 2; ++c) {
+                    for(size_t r = 0; r < 2; ++r) {
+                        test_conversion(widths[w], heights[h], formats[f], destination_colors[c], color_ranges[r]);
+                    }
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "max error from the double precision reference: %f\n", max_error);
+    if(num_failed > 0) {
+        fprintf(stderr, "%d check(s) failed\n", num_failed);
+        return 1;
+    }
+    return 0;
+}
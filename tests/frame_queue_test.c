@@ -0,0 +1,170 @@
+/*
+    Tests the single producer, single consumer frame queue:
+    - Popping from an empty queue returns NULL and pushing to a full queue fails without adding the frame.
+    - Frames come out in the order they were pushed, also when the slots and the indices (at 2^32) wrap around.
+    - One thread pushes and another pops a million frames through a small queue, so that it's often full and often empty,
+      and every frame arrives exactly once and in order.
+
+    The queue never dereferences the frames so the test uses numbers as frame pointers.
+*/
+
+#include "../include/frame_queue.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define NUM_THREADED_FRAMES 1000000
+
+static int num_failed = 0;
+
+#define EXPECT(cond, ...) do {                                  \
+        if(!(cond)) {                                           \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fprintf(stderr, "\n");                              \
+            ++num_failed;                                       \
+        }                                                       \
+    } while(0)
+
+static AVFrame* number_to_frame(uint32_t number) {
+    return (AVFrame*)(uintptr_t)(number + 1);
+}
+
+static uint32_t frame_to_number(AVFrame *frame) {
+    return (uint32_t)((uintptr_t)frame - 1);
+}
+
+/* Starts the queue at |start_index| instead of 0, to test the indices wrapping around */
+static void set_start_index(gsr_frame_queue *queue, uint32_t start_index) {
+    queue->write_index = start_index;
+    queue->read_index = start_index;
+}
+
+/* The queue isn't aligned to a cache line, so there has to be a whole cache line between the fields for them to always be in different cache lines */
+static void test_layout(void) {
+    EXPECT(offsetof(gsr_frame_queue, write_index) - (offsetof(gsr_frame_queue, capacity) + sizeof(uint32_t)) >= GSR_FRAME_QUEUE_CACHE_LINE_SIZE,
+        "write_index can be in the same cache line as capacity");
+    EXPECT(offsetof(gsr_frame_queue, read_index) - (offsetof(gsr_frame_queue, write_index) + sizeof(uint32_t)) >= GSR_FRAME_QUEUE_CACHE_LINE_SIZE,
+        "read_index can be in the same cache line as write_index");
+    EXPECT(sizeof(gsr_frame_queue) - (offsetof(gsr_frame_queue, read_index) + sizeof(uint32_t)) >= GSR_FRAME_QUEUE_CACHE_LINE_SIZE,
+        "read_index can be in the same cache line as what comes after the queue");
+}
+
+static void test_full_and_empty(uint32_t start_index) {
+    gsr_frame_queue queue;
+    if(gsr_frame_queue_init(&queue, 5) != 0) {
+        EXPECT(false, "failed to create the queue");
+        return;
+    }
+    EXPECT(queue.capacity == 8, "expected the capacity to be rounded up to 8, got %u", queue.capacity);
+    set_start_index(&queue, start_index);
+
+    uint32_t next_push = 0;
+    uint32_t next_pop = 0;
+    /* Fills and empties the queue a few times, with a different number of frames each time so that the slots wrap around at different positions */
+    for(int round = 0; round < 5; ++round) {
+        EXPECT(gsr_frame_queue_pop(&queue) == NULL, "popped a frame from an empty queue (round %d)", round);
+
+        for(uint32_t i = 0; i < queue.capacity; ++i) {
+            EXPECT(gsr_frame_queue_push(&queue, number_to_frame(next_push)), "failed to push frame %u of %u (round %d)", i, queue.capacity, round);
+            ++next_push;
+        }
+        EXPECT(!gsr_frame_queue_push(&queue, number_to_frame(12345)), "pushed to a full queue (round %d)", round);
+
+        const uint32_t num_to_pop = queue.capacity - (uint32_t)round;
+        for(uint32_t i = 0; i < num_to_pop; ++i) {
+            AVFrame *frame = gsr_frame_queue_pop(&queue);
+            EXPECT(frame && frame_to_number(frame) == next_pop, "expected frame %u, got %d (round %d)", next_pop, frame ? (int)frame_to_number(frame) : -1, round);
+            ++next_pop;
+        }
+
+        /* Frames that are left go out at the start of the next round */
+        for(uint32_t i = num_to_pop; i < queue.capacity; ++i) {
+            AVFrame *frame = gsr_frame_queue_pop(&queue);
+            EXPECT(frame && frame_to_number(frame) == next_pop, "expected frame %u, got %d (round %d)", next_pop, frame ? (int)frame_to_number(frame) : -1, round);
+            ++next_pop;
+        }
+    }
+
+    EXPECT(gsr_frame_queue_pop(&queue) == NULL, "popped a frame from an empty queue");
+    gsr_frame_queue_deinit(&queue);
+}
+
+typedef struct {
+    gsr_frame_queue *queue;
+    uint32_t num_full;
+} producer_data;
+
+static void* producer_thread(void *userdata) {
+    producer_data *data = userdata;
+    for(uint32_t i = 0; i < NUM_THREADED_FRAMES; ++i) {
+        while(!gsr_frame_queue_push(data->queue, number_to_frame(i))) {
+            ++data->num_full;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void test_two_threads(uint32_t start_index) {
+    gsr_frame_queue queue;
+    if(gsr_frame_queue_init(&queue, 4) != 0) {
+        EXPECT(false, "failed to create the queue");
+        return;
+    }
+    set_start_index(&queue, start_index);
+
+    producer_data producer = { &queue, 0 };
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, producer_thread, &producer) != 0) {
+        EXPECT(false, "failed to create the producer thread");
+        gsr_frame_queue_deinit(&queue);
+        return;
+    }
+
+    uint32_t num_empty = 0;
+    uint32_t num_out_of_order = 0;
+    uint32_t next_pop = 0;
+    while(next_pop < NUM_THREADED_FRAMES) {
+        AVFrame *frame = gsr_frame_queue_pop(&queue);
+        if(!frame) {
+            ++num_empty;
+            /* Let the producer fill the queue now and then, so that it's full sometimes even on a single core */
+            if(num_empty % 64 == 0)
+                sched_yield();
+            continue;
+        }
+
+        if(frame_to_number(frame) != next_pop)
+            ++num_out_of_order;
+        ++next_pop;
+    }
+    pthread_join(thread, NULL);
+
+    fprintf(stderr, "  two threads, start index %u: %d frames, the queue was full %u times and empty %u times\n",
+        start_index, NUM_THREADED_FRAMES, producer.num_full, num_empty);
+    EXPECT(num_out_of_order == 0, "%u frames were popped out of order", num_out_of_order);
+    EXPECT(gsr_frame_queue_pop(&queue) == NULL, "popped more frames than were pushed");
+    EXPECT(producer.num_full > 0, "the queue was never full");
+    EXPECT(num_empty > 0, "the queue was never empty");
+    EXPECT(queue.write_index == start_index + NUM_THREADED_FRAMES && queue.read_index == start_index + NUM_THREADED_FRAMES,
+        "expected both indices to be %u, got %u and %u", start_index + NUM_THREADED_FRAMES, queue.write_index, queue.read_index);
+    gsr_frame_queue_deinit(&queue);
+}
+
+int main(void) {
+    test_layout();
+    test_full_and_empty(0);
+    test_full_and_empty(UINT32_MAX - 11);
+    test_two_threads(0);
+    test_two_threads(UINT32_MAX - NUM_THREADED_FRAMES / 2);
+
+    if(num_failed > 0) {
+        fprintf(stderr, "frame_queue_test: %d check(s) failed\n", num_failed);
+        return 1;
+    }
+    fprintf(stderr, "frame_queue_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include "gl_test_context.h"
+#include "../include/library_loader.h"
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+
+typedef EGLDisplay (*FUNC_eglGetPlatformDisplayEXT)(unsigned int platform, void *native_display, const int32_t *attrib_list);
+typedef void (*FUNC_glGetTexImage)(unsigned int target, int level, unsigned int format, unsigned int type, void *pixels);
+
+static FUNC_glGetTexImage glGetTexImage_func = NULL;
+
+bool gl_test_context_init(gsr_egl *egl) {
+    memset(egl, 0, sizeof(*egl));
+
+    egl->egl_library = dlopen("libEGL.so.1", RTLD_LAZY);
+    egl->gl_library = dlopen("libGL.so.1", RTLD_LAZY);
+    if(!egl->egl_library || !egl->gl_library) {
+        fprintf(stderr, "gl_test_context_init: failed to load libEGL.so.1/libGL.so.1\n");
+        gl_test_context_deinit(egl);
+        return false;
+    }
+
+    const dlsym_assign egl_dlsym[] = {
+        { (void**)&egl->eglGetError, "eglGetError" },
+        { (void**)&egl->eglInitialize, "eglInitialize" },
+        { (void**)&egl->eglTerminate, "eglTerminate" },
+        { (void**)&egl->eglCreateContext, "eglCreateContext" },
+        { (void**)&egl->eglMakeCurrent, "eglMakeCurrent" },
+        { (void**)&egl->eglDestroyContext, "eglDestroyContext" },
+        { (void**)&egl->eglBindAPI, "eglBindAPI" },
+        { (void**)&egl->eglGetProcAddress, "eglGetProcAddress" },
+
+        { NULL, NULL }
+    };
+
+    const dlsym_assign gl_dlsym[] = {
+        { (void**)&egl->glGetError, "glGetError" },
+        { (void**)&egl->glGetString, "glGetString" },
+        { (void**)&egl->glFlush, "glFlush" },
+        { (void**)&egl->glFinish, "glFinish" },
+        { (void**)&egl->glClear, "glClear" },
+        { (void**)&egl->glClearColor, "glClearColor" },
+        { (void**)&egl->glGenTextures, "glGenTextures" },
+        { (void**)&egl->glDeleteTextures, "glDeleteTextures" },
+        { (void**)&egl->glBindTexture, "glBindTexture" },
+        { (void**)&egl->glActiveTexture, "glActiveTexture" },
+        { (void**)&egl->glTexParameteri, "glTexParameteri" },
+        { (void**)&egl->glGetTexLevelParameteriv, "glGetTexLevelParameteriv" },
+        { (void**)&egl->glPixelStorei, "glPixelStorei" },
+        { (void**)&egl->glTexImage2D, "glTexImage2D" },
+        { (void**)&egl->glTexSubImage2D, "glTexSubImage2D" },
+        { (void**)&egl->glGenFramebuffers, "glGenFramebuffers" },
+        { (void**)&egl->glBindFramebuffer, "glBindFramebuffer" },
+        { (void**)&egl->glDeleteFramebuffers, "glDeleteFramebuffers" },
+        { (void**)&egl->glViewport, "glViewport" },
+        { (void**)&egl->glFramebufferTexture2D, "glFramebufferTexture2D" },
+        { (void**)&egl->glDrawBuffers, "glDrawBuffers" },
+        { (void**)&egl->glCheckFramebufferStatus, "glCheckFramebufferStatus" },
+        { (void**)&egl->glBindBuffer, "glBindBuffer" },
+        { (void**)&egl->glGenBuffers, "glGenBuffers" },
+        { (void**)&egl->glBufferData, "glBufferData" },
+        { (void**)&egl->glBufferSubData, "glBufferSubData" },
+        { (void**)&egl->glDeleteBuffers, "glDeleteBuffers" },
+        { (void**)&egl->glGenVertexArrays, "glGenVertexArrays" },
+        { (void**)&egl->glBindVertexArray, "glBindVertexArray" },
+        { (void**)&egl->glDeleteVertexArrays, "glDeleteVertexArrays" },
+        { (void**)&egl->glCreateProgram, "glCreateProgram" },
+        { (void**)&egl->glCreateShader, "glCreateShader" },
+        { (void**)&egl->glAttachShader, "glAttachShader" },
+        { (void**)&egl->glBindAttribLocation, "glBindAttribLocation" },
+        { (void**)&egl->glCompileShader, "glCompileShader" },
+        { (void**)&egl->glLinkProgram, "glLinkProgram" },
+        { (void**)&egl->glShaderSource, "glShaderSource" },
+        { (void**)&egl->glUseProgram, "glUseProgram" },
+        { (void**)&egl->glGetProgramInfoLog, "glGetProgramInfoLog" },
+        { (void**)&egl->glGetShaderiv, "glGetShaderiv" },
+        { (void**)&egl->glGetShaderInfoLog, "glGetShaderInfoLog" },
+        { (void**)&egl->glDeleteProgram, "glDeleteProgram" },
+        { (void**)&egl->glDeleteShader, "glDeleteShader" },
+        { (void**)&egl->glGetProgramiv, "glGetProgramiv" },
+        { (void**)&egl->glVertexAttribPointer, "glVertexAttribPointer" },
+        { (void**)&egl->glEnableVertexAttribArray, "glEnableVertexAttribArray" },
+        { (void**)&egl->glDrawArrays, "glDrawArrays" },
+        { (void**)&egl->glEnable, "glEnable" },
+        { (void**)&egl->glBlendFunc, "glBlendFunc" },
+        { (void**)&egl->glGetUniformLocation, "glGetUniformLocation" },
+        { (void**)&egl->glUniform1f, "glUniform1f" },
+        { (void**)&egl->glUniform2f, "glUniform2f" },
+        { (void**)&egl->glUniform1i, "glUniform1i" },
+        { (void**)&egl->glUniform2i, "glUniform2i" },
+        { (void**)&glGetTexImage_func, "glGetTexImage" },
+
+        { NULL, NULL }
+    };
+
+    if(!dlsym_load_list(egl->egl_library, egl_dlsym) || !dlsym_load_list(egl->gl_library, gl_dlsym)) {
+        gl_test_context_deinit(egl);
+        return false;
+    }
+
+    /* Optional, the same as in |gsr_egl_load| */
+    egl->glDispatchCompute = (FUNC_glDispatchCompute)egl->eglGetProcAddress("glDispatchCompute");
+    egl->glMemoryBarrier = (FUNC_glMemoryBarrier)egl->eglGetProcAddress("glMemoryBarrier");
+    egl->glBindImageTexture = (FUNC_glBindImageTexture)egl->eglGetProcAddress("glBindImageTexture");
+
+    FUNC_eglGetPlatformDisplayEXT eglGetPlatformDisplayEXT = (FUNC_eglGetPlatformDisplayEXT)egl->eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if(!eglGetPlatformDisplayEXT) {
+        fprintf(stderr, "gl_test_context_init: eglGetPlatformDisplayEXT is not supported\n");
+        gl_test_context_deinit(egl);
+        return false;
+    }
+
+    egl->egl_display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, NULL, NULL);
+    if(!egl->egl_display || !egl->eglInitialize(egl->egl_display, NULL, NULL)) {
+        fprintf(stderr, "gl_test_context_init: failed to initialize surfaceless egl display\n");
+        egl->egl_display = NULL;
+        gl_test_context_deinit(egl);
+        return false;
+    }
+
+    const int32_t ctxattr[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 2,
+        EGL_NONE
+    };
+
+    egl->eglBindAPI(EGL_OPENGL_API);
+    /* EGL_KHR_no_config_context, the surfaceless platform doesn't have any configs with opengl support */
+    egl->egl_context = egl->eglCreateContext(egl->egl_display, NULL, NULL, ctxattr);
+    if(!egl->egl_context || !egl->eglMakeCurrent(egl->egl_display, NULL, NULL, egl->egl_context)) {
+        fprintf(stderr, "gl_test_context_init: failed to create opengl context, error: %d\n", egl->eglGetError());
+        gl_test_context_deinit(egl);
+        return false;
+    }
+
+    egl->glEnable(GL_BLEND);
+    egl->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    return true;
+}
+
+void gl_test_context_deinit(gsr_egl *egl) {
+    if(egl->egl_context) {
+        egl->eglMakeCurrent(egl->egl_display, NULL, NULL, NULL);
+        egl->eglDestroyContext(egl->egl_display, egl->egl_context);
+        egl->egl_context = NULL;
+    }
+
+    if(egl->egl_display) {
+        egl->eglTerminate(egl->egl_display);
+        egl->egl_display = NULL;
+    }
+
+    if(egl->egl_library) {
+        dlclose(egl->egl_library);
+        egl->egl_library = NULL;
+    }
+
+    if(egl->gl_library) {
+        dlclose(egl->gl_library);
+        egl->gl_library = NULL;
+    }
+}
+
+void gl_test_context_read_texture(gsr_egl *egl, unsigned int texture, unsigned int format, unsigned int type, void *pixels) {
+    egl->glPixelStorei(0x0D05 /* GL_PACK_ALIGNMENT */, 1);
+    egl->glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexImage_func(GL_TEXTURE_2D, 0, format, type, pixels);
+    egl->glBindTexture(GL_TEXTURE_2D, 0);
+}
@@ -0,0 +1,18 @@
+#ifndef GSR_TESTS_GL_TEST_CONTEXT_H
+#define GSR_TESTS_GL_TEST_CONTEXT_H
+
+#include "../include/egl.h"
+
+/*
+    Creates an opengl context without a window (EGL_MESA_platform_surfaceless), with the same context attributes as |gsr_egl_load|
+    and loads the opengl functions into |egl|. This works without a GPU with mesa llvmpipe (LIBGL_ALWAYS_SOFTWARE=1).
+    Only the opengl functions are loaded, the x11/wayland members of |egl| are not set.
+    Returns false if no context could be created, in which case the opengl tests should be skipped.
+*/
+bool gl_test_context_init(gsr_egl *egl);
+void gl_test_context_deinit(gsr_egl *egl);
+
+/* Reads back level 0 of |texture| */
+void gl_test_context_read_texture(gsr_egl *egl, unsigned int texture, unsigned int format, unsigned int type, void *pixels);
+
+#endif /* GSR_TESTS_GL_TEST_CONTEXT_H */
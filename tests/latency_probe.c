@@ -0,0 +1,255 @@
+/*
+    Measures the latency of a live stream from a frame being shown on the screen until its packet has been received from the socket.
+    Not run by run.sh since it needs an X11 server and a gpu that gpu screen recorder can encode with.
+
+    A window shows a frame counter as a barcode that changes every frame, and the time each counter was shown is remembered.
+    The stream of gpu screen recorder capturing that window is received on a tcp port and decoded, and the counter is read back
+    from the decoded frames. The time a packet was received minus the time its counter was shown is the latency. The capture itself
+    happens at some point during the frame that is shown so the result includes up to one frame (at |DRAW_FPS|) of waiting for the capture.
+
+    Usage: latency_probe [port] [duration_seconds]
+    and then run the command it prints. flv is used instead of mpegts because the mpegts demuxer only returns
+    a video packet when the next one starts, which would add one frame of latency to the measurement.
+*/
+
+#include "../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <X11/Xlib.h>
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+
+#define DRAW_FPS 60
+#define NUM_BITS 32
+#define BIT_WIDTH 16
+#define BAR_HEIGHT 32
+/* The lower 24 bits are the counter and the upper 8 bits are a check, to ignore frames captured while the window was being redrawn */
+#define COUNTER_MASK 0xFFFFFF
+#define MAX_SHOWN_FRAMES 1024
+/* The first packets are delayed by the stream being probed */
+#define WARMUP_SECONDS 1.0
+
+typedef struct {
+    pthread_mutex_t mutex;
+    double shown_time[MAX_SHOWN_FRAMES]; /* Indexed by counter % MAX_SHOWN_FRAMES */
+    uint32_t shown_counter[MAX_SHOWN_FRAMES];
+    atomic_bool running;
+    int port;
+    double duration_seconds;
+    int num_measured;
+} latency_probe;
+
+static uint32_t counter_to_code(uint32_t counter) {
+    counter &= COUNTER_MASK;
+    return counter | ((((counter & 0xFF) ^ 0xA5) & 0xFF) << 24);
+}
+
+/* Returns false if the code is not valid */
+static bool code_to_counter(uint32_t code, uint32_t *counter) {
+    *counter = code & COUNTER_MASK;
+    return counter_to_code(*counter) == code;
+}
+
+static void draw_code(Display *dpy, Window window, GC gc, uint32_t code) {
+    for(int i = 0; i < NUM_BITS; ++i) {
+        const bool bit = (code >> (NUM_BITS - 1 - i)) & 1;
+        XSetForeground(dpy, gc, bit ? WhitePixel(dpy, DefaultScreen(dpy)) : BlackPixel(dpy, DefaultScreen(dpy)));
+        XFillRectangle(dpy, window, gc, i * BIT_WIDTH, 0, BIT_WIDTH, BAR_HEIGHT);
+    }
+}
+
+/* Samples the middle of every bit in the luma plane */
+static uint32_t read_code(const AVFrame *frame) {
+    if(frame->width < NUM_BITS * BIT_WIDTH || frame->height < BAR_HEIGHT)
+        return 0;
+
+    uint32_t code = 0;
+    const uint8_t *row = frame->data[0] + (BAR_HEIGHT / 2) * frame->linesize[0];
+    for(int i = 0; i < NUM_BITS; ++i) {
+        const bool bit = row[i * BIT_WIDTH + BIT_WIDTH / 2] >= 128;
+        code = (code << 1) | bit;
+    }
+    return code;
+}
+
+static void* receive_thread(void *userdata) {
+    latency_probe *self = userdata;
+
+    char url[128];
+    snprintf(url, sizeof(url), "tcp://127.0.0.1:%d?listen=1", self->port);
+
+    AVDictionary *options = NULL;
+    av_dict_set(&options, "fflags", "nobuffer", 0);
+    av_dict_set(&options, "probesize", "32768", 0);
+    AVFormatContext *format_context = NULL;
+    int ret = avformat_open_input(&format_context, url, NULL, &options);
+    av_dict_free(&options);
+    if(ret < 0) {
+        fprintf(stderr, "latency_probe: failed to listen on %s\n", url);
+        self->running = false;
+        return NULL;
+    }
+
+    AVCodecContext *codec_context = NULL;
+    int video_stream_index = -1;
+    if(avformat_find_stream_info(format_context, NULL) >= 0)
+        video_stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+
+    if(video_stream_index >= 0) {
+        const AVCodecParameters *codecpar = format_context->streams[video_stream_index]->codecpar;
+        const AVCodec *codec = avcodec_find_decoder(codecpar->codec_id);
+        codec_context = codec ? avcodec_alloc_context3(codec) : NULL;
+        if(codec_context) {
+            avcodec_parameters_to_context(codec_context, codecpar);
+            /* Frame threads hold on to frames, output every frame as soon as it has been decoded */
+            codec_context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+            codec_context->thread_count = 1;
+            if(avcodec_open2(codec_context, codec, NULL) < 0)
+                avcodec_free_context(&codec_context);
+        }
+    }
+
+    if(!codec_context) {
+        fprintf(stderr, "latency_probe: failed to find a video stream that can be decoded\n");
+        avformat_close_input(&format_context);
+        self->running = false;
+        return NULL;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    const double start_time = clock_get_monotonic_seconds();
+    double second_start_time = start_time;
+    double latency_sum = 0.0;
+    double latency_min = 1000.0;
+    double latency_max = 0.0;
+    int num_frames = 0;
+    int num_invalid_frames = 0;
+
+    while(self->running && av_read_frame(format_context, packet) >= 0) {
+        const double receive_time = clock_get_monotonic_seconds();
+        if(packet->stream_index != video_stream_index || avcodec_send_packet(codec_context, packet) < 0) {
+            av_packet_unref(packet);
+            continue;
+        }
+        av_packet_unref(packet);
+
+        while(avcodec_receive_frame(codec_context, frame) == 0) {
+            uint32_t counter = 0;
+            double shown_time = -1.0;
+            if(code_to_counter(read_code(frame), &counter)) {
+                pthread_mutex_lock(&self->mutex);
+                if(self->shown_counter[counter % MAX_SHOWN_FRAMES] == counter)
+                    shown_time = self->shown_time[counter % MAX_SHOWN_FRAMES];
+                pthread_mutex_unlock(&self->mutex);
+            }
+
+            if(shown_time < 0.0) {
+                ++num_invalid_frames;
+            } else if(receive_time - start_time >= WARMUP_SECONDS) {
+                const double latency = receive_time - shown_time;
+                latency_sum += latency;
+                latency_min = latency < latency_min ? latency : latency_min;
+                latency_max = latency > latency_max ? latency : latency_max;
+                ++num_frames;
+                ++self->num_measured;
+            }
+            av_frame_unref(frame);
+        }
+
+        if(receive_time - second_start_time >= 1.0) {
+            if(num_frames > 0) {
+                fprintf(stderr, "latency: avg %.2f ms, min %.2f ms, max %.2f ms, %d frames, %d frames without a valid counter\n",
+                    latency_sum / num_frames * 1000.0, latency_min * 1000.0, latency_max * 1000.0, num_frames, num_invalid_frames);
+            }
+            second_start_time = receive_time;
+            latency_sum = 0.0;
+            latency_min = 1000.0;
+            latency_max = 0.0;
+            num_frames = 0;
+            num_invalid_frames = 0;
+        }
+
+        if(receive_time - start_time >= self->duration_seconds)
+            break;
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codec_context);
+    avformat_close_input(&format_context);
+    self->running = false;
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    latency_probe probe;
+    memset(&probe, 0, sizeof(probe));
+    pthread_mutex_init(&probe.mutex, NULL);
+    probe.port = argc >= 2 ? atoi(argv[1]) : 5555;
+    probe.duration_seconds = argc >= 3 ? atof(argv[2]) : 10.0;
+    probe.running = true;
+    for(int i = 0; i < MAX_SHOWN_FRAMES; ++i)
+        probe.shown_counter[i] = UINT32_MAX;
+
+    if(probe.port <= 0 || probe.port > 65535 || probe.duration_seconds <= 0.0) {
+        fprintf(stderr, "usage: latency_probe [port] [duration_seconds]\n");
+        return 1;
+    }
+
+    Display *dpy = XOpenDisplay(NULL);
+    if(!dpy) {
+        fprintf(stderr, "latency_probe: failed to open the x11 display\n");
+        return 77;
+    }
+
+    const Window window = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, NUM_BITS * BIT_WIDTH, BAR_HEIGHT, 0, 0, 0);
+    XStoreName(dpy, window, "latency_probe");
+    XMapRaised(dpy, window);
+    const GC gc = XCreateGC(dpy, window, 0, NULL);
+    XSync(dpy, False);
+
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, receive_thread, &probe) != 0) {
+        fprintf(stderr, "latency_probe: failed to create thread\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Listening on port %d, run:\n", probe.port);
+    fprintf(stderr, "  gpu-screen-recorder -w %lu -c flv -f %d -fm cfr -latency low -o tcp://127.0.0.1:%d\n", window, DRAW_FPS, probe.port);
+
+    const double draw_start_time = clock_get_monotonic_seconds();
+    uint32_t counter = 0;
+    while(probe.running) {
+        draw_code(dpy, window, gc, counter_to_code(counter));
+        XSync(dpy, False);
+        const double shown_time = clock_get_monotonic_seconds();
+
+        pthread_mutex_lock(&probe.mutex);
+        probe.shown_time[counter % MAX_SHOWN_FRAMES] = shown_time;
+        probe.shown_counter[counter % MAX_SHOWN_FRAMES] = counter;
+        pthread_mutex_unlock(&probe.mutex);
+
+        counter = (counter + 1) & COUNTER_MASK;
+        const double sleep_seconds = draw_start_time + (double)counter / DRAW_FPS - clock_get_monotonic_seconds();
+        if(sleep_seconds > 0.0)
+            usleep((useconds_t)(sleep_seconds * 1000000.0));
+    }
+
+    pthread_join(thread, NULL);
+    XFreeGC(dpy, gc);
+    XDestroyWindow(dpy, window);
+    XCloseDisplay(dpy);
+    pthread_mutex_destroy(&probe.mutex);
+
+    if(probe.num_measured == 0) {
+        fprintf(stderr, "latency_probe: no frames were measured\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,426 @@
+/*
+    Streams packets through the network output to a local tcp server and checks the adaptive bitrate decisions
+    made from the real network output stats:
+    - A fast server receives every packet intact and in order, and the bitrate is not lowered.
+    - A server that only reads 100 KB/s makes the queue grow: the bitrate is lowered (to below the measured throughput)
+      and the network output asks for a keyframe once it has dropped video and caught up.
+    - When the connection keeps up again the bitrate and framerate go back up to the maximum.
+    - The capture to socket latency is measured from the capture time given with each packet.
+    - When the oldest packets are dropped, the rest of their gop is dropped with them so that the stream stays decodable.
+*/
+
+#include "../include/network_output.h"
+#include "../include/adaptive_bitrate.h"
+#include "../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libavformat/avformat.h>
+
+#define FPS 60
+#define MAX_QUEUE_LATENCY_SECONDS 1.0
+#define MAX_BITRATE 8000000
+#define MIN_BITRATE 1000000
+#define SLOW_SERVER_BYTES_PER_SECOND 100000
+#define MAX_RECEIVED_BYTES (8 * 1024 * 1024)
+/* Pretend that every frame took this long from being captured until its packet was pushed */
+#define CAPTURE_TO_PACKET_SECONDS 0.005
+
+static int num_failed = 0;
+
+#define EXPECT(cond, ...) do {                                  \
+        if(!(cond)) {                                           \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fprintf(stderr, "\n");                              \
+            ++num_failed;                                       \
+        }                                                       \
+    } while(0)
+
+/* Stand-in for a streaming server, it reads everything it receives at a limited rate */
+typedef struct {
+    int listen_fd;
+    int port;
+    pthread_t thread;
+    atomic_int read_bytes_per_second; /* 0 for no limit */
+    uint8_t *received;
+    size_t num_received;
+} test_server;
+
+static void* test_server_thread(void *userdata) {
+    test_server *self = userdata;
+    const int client_fd = accept(self->listen_fd, NULL, NULL);
+    if(client_fd == -1)
+        return NULL;
+
+    uint8_t buffer[1024];
+    for(;;) {
+        const int read_bytes_per_second = atomic_load(&self->read_bytes_per_second);
+        const ssize_t bytes_read = recv(client_fd, buffer, sizeof(buffer), 0);
+        if(bytes_read <= 0)
+            break;
+
+        const size_t bytes_to_copy = self->num_received + bytes_read <= MAX_RECEIVED_BYTES ? (size_t)bytes_read : MAX_RECEIVED_BYTES - self->num_received;
+        memcpy(self->received + self->num_received, buffer, bytes_to_copy);
+        self->num_received += bytes_to_copy;
+
+        if(read_bytes_per_second > 0)
+            usleep((useconds_t)(bytes_read * 1000000LL / read_bytes_per_second));
+    }
+
+    close(client_fd);
+    return NULL;
+}
+
+static bool test_server_start(test_server *self, int read_bytes_per_second) {
+    memset(self, 0, sizeof(*self));
+    atomic_store(&self->read_bytes_per_second, read_bytes_per_second);
+    self->received = malloc(MAX_RECEIVED_BYTES);
+
+    self->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(self->listen_fd == -1)
+        return false;
+
+    /* A small receive buffer so that a slow reader is noticed quickly. Accepted sockets inherit it */
+    const int receive_buffer_size = 16 * 1024;
+    setsockopt(self->listen_fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_size, sizeof(receive_buffer_size));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if(bind(self->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(self->listen_fd, 1) == -1
+        || getsockname(self->listen_fd, (struct sockaddr*)&addr, &addr_len) == -1)
+    {
+        close(self->listen_fd);
+        return false;
+    }
+    self->port = ntohs(addr.sin_port);
+
+    if(pthread_create(&self->thread, NULL, test_server_thread, self) != 0) {
+        close(self->listen_fd);
+        return false;
+    }
+    return true;
+}
+
+/* Call after the network output has been closed, the server thread exits when the connection is closed */
+static void test_server_stop(test_server *self) {
+    pthread_join(self->thread, NULL);
+    close(self->listen_fd);
+}
+
+static void test_server_deinit(test_server *self) {
+    free(self->received);
+}
+
+typedef struct {
+    AVFormatContext *format_context;
+    gsr_network_output network_output;
+    int64_t frame_index;
+} test_stream;
+
+/* The thread that sends the packets is started by test_stream_start */
+static bool test_stream_open(test_stream *self, int port, double max_queue_latency_seconds) {
+    memset(self, 0, sizeof(*self));
+    /* The data muxer writes the packet data as it is, so the server receives exactly what was pushed */
+    if(avformat_alloc_output_context2(&self->format_context, NULL, "data", NULL) < 0) {
+        fprintf(stderr, "failed to create the data muxer\n");
+        return false;
+    }
+
+    AVStream *stream = avformat_new_stream(self->format_context, NULL);
+    if(!stream)
+        return false;
+    stream->codecpar->codec_type = AVMEDIA_TYPE_DATA;
+    stream->time_base = (AVRational){1, FPS};
+
+    char url[64];
+    snprintf(url, sizeof(url), "tcp://127.0.0.1:%d", port);
+    if(gsr_network_output_open(&self->network_output, self->format_context, url, max_queue_latency_seconds) != 0)
+        return false;
+
+    /* Like -latency low, every packet is written to the socket immediately */
+    AVDictionary *options = NULL;
+    av_dict_set(&options, "flush_packets", "1", 0);
+    const int ret = avformat_write_header(self->format_context, &options);
+    av_dict_free(&options);
+    if(ret < 0) {
+        fprintf(stderr, "failed to write header\n");
+        return false;
+    }
+    return true;
+}
+
+static bool test_stream_start(test_stream *self) {
+    return gsr_network_output_start(&self->network_output) == 0;
+}
+
+static void test_stream_close(test_stream *self) {
+    gsr_network_output_stop(&self->network_output);
+    av_write_trailer(self->format_context);
+    gsr_network_output_close(&self->network_output);
+    avformat_free_context(self->format_context);
+}
+
+/* Each packet is filled with its frame index so that the server side can check the order */
+static void test_stream_push_frame(test_stream *self, int size, bool keyframe) {
+    AVPacket *packet = av_packet_alloc();
+    av_new_packet(packet, size);
+    memset(packet->data, (int)(self->frame_index & 0xFF), size);
+    packet->stream_index = 0;
+    packet->pts = self->frame_index;
+    packet->dts = self->frame_index;
+    packet->duration = 1;
+    if(keyframe)
+        packet->flags |= AV_PKT_FLAG_KEY;
+
+    gsr_network_output_push(&self->network_output, packet, true, clock_get_monotonic_seconds() - CAPTURE_TO_PACKET_SECONDS);
+    av_packet_free(&packet);
+    ++self->frame_index;
+}
+
+/* Pushes frames in real time for |duration_seconds| and updates the adaptive bitrate for every frame, like the capture loop does */
+static void stream_frames(test_stream *stream, gsr_adaptive_bitrate *adaptive_bitrate, double duration_seconds, int frame_size, int *num_keyframe_requests) {
+    const double start_time = clock_get_monotonic_seconds();
+    int frame = 0;
+    for(;;) {
+        const double time_now = clock_get_monotonic_seconds();
+        if(time_now - start_time >= duration_seconds)
+            break;
+
+        const bool keyframe_requested = gsr_network_output_take_keyframe_request(&stream->network_output);
+        if(keyframe_requested)
+            ++*num_keyframe_requests;
+
+        /* A gop of 2 seconds */
+        test_stream_push_frame(stream, frame_size, keyframe_requested || frame % (FPS * 2) == 0);
+        ++frame;
+
+        gsr_network_output_stats stats;
+        gsr_network_output_get_stats(&stream->network_output, &stats);
+        gsr_adaptive_bitrate_update(adaptive_bitrate, &stats, MAX_QUEUE_LATENCY_SECONDS, time_now);
+
+        const double next_frame_time = start_time + (double)frame / FPS;
+        const double sleep_seconds = next_frame_time - clock_get_monotonic_seconds();
+        if(sleep_seconds > 0.0)
+            usleep((useconds_t)(sleep_seconds * 1000000.0));
+    }
+}
+
+static void test_fast_connection(void) {
+    test_server server;
+    if(!test_server_start(&server, 0)) {
+        EXPECT(false, "failed to start the test server");
+        return;
+    }
+
+    test_stream stream;
+    if(!test_stream_open(&stream, server.port, MAX_QUEUE_LATENCY_SECONDS) || !test_stream_start(&stream)) {
+        EXPECT(false, "failed to open the network output");
+        return;
+    }
+
+    gsr_adaptive_bitrate adaptive_bitrate;
+    gsr_adaptive_bitrate_init(&adaptive_bitrate, MIN_BITRATE, MAX_BITRATE, FPS, clock_get_monotonic_seconds());
+
+    /* 1 MB/s */
+    const int frame_size = 1000000 / FPS;
+    int num_keyframe_requests = 0;
+    stream_frames(&stream, &adaptive_bitrate, 1.5, frame_size, &num_keyframe_requests);
+
+    gsr_network_output_stats stats;
+    gsr_network_output_get_stats(&stream.network_output, &stats);
+    const int64_t num_frames = stream.frame_index;
+    test_stream_close(&stream);
+    test_server_stop(&server);
+
+    fprintf(stderr, "  fast connection: %d frames, %zu bytes received, %d packets dropped, bitrate %d kbps, capture to socket latency %.2f ms\n", (int)num_frames,
+        server.num_received, (int)stats.num_dropped_packets, (int)(adaptive_bitrate.bitrate / 1000), stats.video_capture_to_socket_latency_seconds * 1000.0);
+    EXPECT(stats.num_dropped_packets == 0, "%d packets were dropped", (int)stats.num_dropped_packets);
+    EXPECT(num_keyframe_requests == 0, "%d keyframes were requested", num_keyframe_requests);
+    EXPECT(adaptive_bitrate.bitrate == MAX_BITRATE && adaptive_bitrate.fps_divider == 1, "the bitrate was changed to %d kbps, fps divider %d",
+        (int)(adaptive_bitrate.bitrate / 1000), adaptive_bitrate.fps_divider);
+    EXPECT(stats.video_capture_to_socket_latency_seconds >= CAPTURE_TO_PACKET_SECONDS + stats.video_send_latency_seconds - 0.0001
+        && stats.video_capture_to_socket_latency_seconds < CAPTURE_TO_PACKET_SECONDS + 0.1,
+        "the capture to socket latency is %.4f seconds, the packet to socket latency is %.4f seconds",
+        stats.video_capture_to_socket_latency_seconds, stats.video_send_latency_seconds);
+    EXPECT(server.num_received == (size_t)(num_frames * frame_size), "expected %d bytes, received %zu", (int)(num_frames * frame_size), server.num_received);
+
+    bool in_order = true;
+    for(size_t i = 0; i < server.num_received; ++i) {
+        if(server.received[i] != ((i / frame_size) & 0xFF)) {
+            in_order = false;
+            break;
+        }
+    }
+    EXPECT(in_order, "the received data is not the pushed packets in order");
+    test_server_deinit(&server);
+}
+
+static void test_slow_connection(void) {
+    test_server server;
+    if(!test_server_start(&server, SLOW_SERVER_BYTES_PER_SECOND)) {
+        EXPECT(false, "failed to start the test server");
+        return;
+    }
+
+    test_stream stream;
+    if(!test_stream_open(&stream, server.port, MAX_QUEUE_LATENCY_SECONDS) || !test_stream_start(&stream)) {
+        EXPECT(false, "failed to open the network output");
+        return;
+    }
+
+    gsr_adaptive_bitrate adaptive_bitrate;
+    gsr_adaptive_bitrate_init(&adaptive_bitrate, MIN_BITRATE, MAX_BITRATE, FPS, clock_get_monotonic_seconds());
+
+    /* 1 MB/s to a server that reads 100 KB/s */
+    int num_keyframe_requests = 0;
+    stream_frames(&stream, &adaptive_bitrate, 3.0, 1000000 / FPS, &num_keyframe_requests);
+
+    gsr_network_output_stats stats;
+    gsr_network_output_get_stats(&stream.network_output, &stats);
+    fprintf(stderr, "  slow connection: throughput %d KB/s, %d packets dropped, queue latency %.3f s, bitrate %d kbps, fps divider %d\n",
+        (int)(stats.send_bytes_per_second / 1000.0), (int)stats.num_dropped_packets, stats.queue_latency_seconds, (int)(adaptive_bitrate.bitrate / 1000), adaptive_bitrate.fps_divider);
+
+    /* Lowered once per second while congested, by 30% or to below the measured throughput (~800 kbps, which is clamped to the minimum) */
+    EXPECT(adaptive_bitrate.bitrate < MAX_BITRATE * 7 / 10, "the bitrate wasn't lowered, it's %d kbps", (int)(adaptive_bitrate.bitrate / 1000));
+    EXPECT(adaptive_bitrate.bitrate == MIN_BITRATE || adaptive_bitrate.bitrate <= stats.send_bytes_per_second * 8.0, "the bitrate %d kbps is higher than the throughput %d kbps",
+        (int)(adaptive_bitrate.bitrate / 1000), (int)(stats.send_bytes_per_second * 8.0 / 1000.0));
+    EXPECT(stats.num_dropped_packets > 0, "no packets were dropped while the queue was %.3f seconds behind", stats.queue_latency_seconds);
+    EXPECT(stats.queue_latency_seconds <= MAX_QUEUE_LATENCY_SECONDS * 4.0, "the queue is %.3f seconds behind", stats.queue_latency_seconds);
+
+    /* The server catches up. Small frames (that fit in the bitrate the connection can handle), like after the encoder bitrate has been lowered */
+    atomic_store(&server.read_bytes_per_second, 0);
+    stream_frames(&stream, &adaptive_bitrate, 1.5, 2000, &num_keyframe_requests);
+    gsr_network_output_get_stats(&stream.network_output, &stats);
+    fprintf(stderr, "  slow connection recovered: %d keyframe request(s), queue latency %.3f s\n", num_keyframe_requests, stats.queue_latency_seconds);
+    EXPECT(num_keyframe_requests >= 1, "the network output didn't ask for a keyframe after dropping video");
+    EXPECT(stats.queue_latency_seconds < MAX_QUEUE_LATENCY_SECONDS * 0.1, "the queue didn't drain, it's %.3f seconds behind", stats.queue_latency_seconds);
+
+    /* The queue is empty from now on, go forward in time instead of waiting for the increases in real time */
+    double time_now = clock_get_monotonic_seconds();
+    for(int i = 0; i < 200; ++i) {
+        gsr_network_output_get_stats(&stream.network_output, &stats);
+        time_now += 0.5;
+        gsr_adaptive_bitrate_update(&adaptive_bitrate, &stats, MAX_QUEUE_LATENCY_SECONDS, time_now);
+    }
+    fprintf(stderr, "  after 100 seconds without congestion: bitrate %d kbps, fps divider %d\n", (int)(adaptive_bitrate.bitrate / 1000), adaptive_bitrate.fps_divider);
+    EXPECT(adaptive_bitrate.bitrate == MAX_BITRATE && adaptive_bitrate.fps_divider == 1, "the bitrate went back up to %d kbps, fps divider %d",
+        (int)(adaptive_bitrate.bitrate / 1000), adaptive_bitrate.fps_divider);
+
+    test_stream_close(&stream);
+    test_server_stop(&server);
+    test_server_deinit(&server);
+}
+
+/* Returns the frame indices of the queued packets, -1 for audio packets */
+static int get_queued_frames(gsr_network_output *network_output, int64_t *frames, int max_frames) {
+    pthread_mutex_lock(&network_output->mutex);
+    int num_frames = 0;
+    for(int i = 0; i < network_output->num_entries && num_frames < max_frames; ++i) {
+        const gsr_network_output_entry *entry = &network_output->entries[(network_output->entries_start + i) % GSR_NETWORK_OUTPUT_MAX_QUEUED_PACKETS];
+        frames[num_frames++] = entry->is_video ? entry->packet->pts : -1;
+    }
+    pthread_mutex_unlock(&network_output->mutex);
+    return num_frames;
+}
+
+static void push_audio_packet(test_stream *self) {
+    AVPacket *packet = av_packet_alloc();
+    av_new_packet(packet, 16);
+    memset(packet->data, 0, 16);
+    gsr_network_output_push(&self->network_output, packet, false, -1.0);
+    av_packet_free(&packet);
+}
+
+/*
+    When the queue is so far behind that the oldest packets are dropped, the rest of the gop of a dropped video packet has to be dropped
+    as well since it can't be decoded without it. The sending thread isn't started so the queue is in the state the test creates.
+*/
+static void test_shed_load_drops_whole_gop(void) {
+    test_server server;
+    if(!test_server_start(&server, 0)) {
+        EXPECT(false, "failed to start the test server");
+        return;
+    }
+
+    const double max_queue_latency_seconds = 0.25;
+    test_stream stream;
+    if(!test_stream_open(&stream, server.port, max_queue_latency_seconds)) {
+        EXPECT(false, "failed to open the network output");
+        return;
+    }
+
+    /* Queues frame 0 (keyframe), 1, 2, an audio packet and frame 3 (keyframe). Nothing is dropped yet since the queue is not congested */
+    const double start_time = clock_get_monotonic_seconds();
+    test_stream_push_frame(&stream, 100, true);
+    test_stream_push_frame(&stream, 100, false);
+    usleep((useconds_t)(max_queue_latency_seconds * 0.8 * 1000000.0));
+    test_stream_push_frame(&stream, 100, false);
+    push_audio_packet(&stream);
+    test_stream_push_frame(&stream, 100, true);
+
+    /* Frame 0 and 1 are now older than 4 times the max queue latency, frame 2 is not. Frame 4 is pushed while congested, which drops them */
+    const double sleep_seconds = start_time + max_queue_latency_seconds * 4.4 - clock_get_monotonic_seconds();
+    if(sleep_seconds > 0.0)
+        usleep((useconds_t)(sleep_seconds * 1000000.0));
+    test_stream_push_frame(&stream, 100, false);
+
+    /* Frame 2 can't be decoded without frame 0 so it's dropped as well. Frame 4 is dropped since video is dropped until the next keyframe */
+    int64_t frames[16];
+    const int num_frames = get_queued_frames(&stream.network_output, frames, 16);
+    EXPECT(num_frames == 2 && frames[0] == -1 && frames[1] == 3, "expected the audio packet and frame 3 to be queued, got %d packet(s): %d %d %d",
+        num_frames, num_frames > 0 ? (int)frames[0] : 0, num_frames > 1 ? (int)frames[1] : 0, num_frames > 2 ? (int)frames[2] : 0);
+
+    /* Sends the rest, so that the queued packets are freed */
+    if(test_stream_start(&stream))
+        test_stream_close(&stream);
+    test_server_stop(&server);
+    test_server_deinit(&server);
+}
+
+/* Decisions for constructed stats, without a connection */
+static void test_decisions(void) {
+    gsr_adaptive_bitrate adaptive_bitrate;
+    double time_now = 100.0;
+    gsr_adaptive_bitrate_init(&adaptive_bitrate, MAX_BITRATE, MAX_BITRATE, FPS, time_now);
+
+    /* The bitrate can't be changed (min == max) so congestion lowers the framerate instead, but never below 15 fps */
+    gsr_network_output_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.queue_latency_seconds = MAX_QUEUE_LATENCY_SECONDS;
+    for(int i = 0; i < 20; ++i) {
+        time_now += 0.5;
+        gsr_adaptive_bitrate_update(&adaptive_bitrate, &stats, MAX_QUEUE_LATENCY_SECONDS, time_now);
+    }
+    EXPECT(adaptive_bitrate.bitrate == MAX_BITRATE, "the bitrate was changed to %d kbps", (int)(adaptive_bitrate.bitrate / 1000));
+    EXPECT(adaptive_bitrate.fps_divider == 4, "expected fps divider 4 (15 fps), got %d", adaptive_bitrate.fps_divider);
+
+    /* Updates more often than twice per second are ignored */
+    gsr_adaptive_bitrate_init(&adaptive_bitrate, MIN_BITRATE, MAX_BITRATE, FPS, time_now);
+    EXPECT(!gsr_adaptive_bitrate_update(&adaptive_bitrate, &stats, MAX_QUEUE_LATENCY_SECONDS, time_now + 0.1), "updated before the update interval");
+}
+
+int main(void) {
+    test_decisions();
+    test_shed_load_drops_whole_gop();
+    test_fast_connection();
+    test_slow_connection();
+
+    if(num_failed > 0) {
+        fprintf(stderr, "network_output_test: %d check(s) failed\n", num_failed);
+        return 1;
+    }
+    fprintf(stderr, "network_output_test: ok\n");
+    return 0;
+}
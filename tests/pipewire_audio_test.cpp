@@ -0,0 +1,167 @@
+/*
+    Records the monitor of a null sink with the pipewire sound backend while pw-play plays a tone into the sink:
+    - The sink monitor is listed by pipewire_get_inputs, named like in pulseaudio.
+    - Audio is read at the requested period size at the speed of the sample rate.
+    - The tone comes through at the volume it was played at.
+    Needs a running pipewire daemon and session manager with the null sink, run.sh starts its own.
+*/
+
+#include "../include/sound_pipewire.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <algorithm>
+
+#define SAMPLE_RATE 48000
+#define NUM_CHANNELS 2
+#define PERIOD_FRAME_SIZE 1024
+#define TONE_FREQUENCY 440.0
+#define TONE_AMPLITUDE 0.5
+#define TONE_SECONDS 5
+#define RECORD_SECONDS 3.0
+
+extern char **environ;
+
+static int num_failed = 0;
+
+#define EXPECT(cond, ...) do {                                  \
+        if(!(cond)) {                                           \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fprintf(stderr, "\n");                              \
+            ++num_failed;                                       \
+        }                                                       \
+    } while(0)
+
+static double get_monotonic_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 0.000000001;
+}
+
+static void write_u32(FILE *file, uint32_t value) {
+    const uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+static void write_u16(FILE *file, uint16_t value) {
+    const uint8_t bytes[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+/* 16-bit stereo wav */
+static bool write_tone(const char *filepath) {
+    FILE *file = fopen(filepath, "wb");
+    if(!file)
+        return false;
+
+    const uint32_t num_frames = SAMPLE_RATE * TONE_SECONDS;
+    const uint32_t data_size = num_frames * NUM_CHANNELS * 2;
+    fwrite("RIFF", 1, 4, file);
+    write_u32(file, 36 + data_size);
+    fwrite("WAVEfmt ", 1, 8, file);
+    write_u32(file, 16);
+    write_u16(file, 1); /* PCM */
+    write_u16(file, NUM_CHANNELS);
+    write_u32(file, SAMPLE_RATE);
+    write_u32(file, SAMPLE_RATE * NUM_CHANNELS * 2);
+    write_u16(file, NUM_CHANNELS * 2);
+    write_u16(file, 16);
+    fwrite("data", 1, 4, file);
+    write_u32(file, data_size);
+
+    for(uint32_t i = 0; i < num_frames; ++i) {
+        const int16_t sample = (int16_t)lround(sin(2.0 * M_PI * TONE_FREQUENCY * i / SAMPLE_RATE) * TONE_AMPLITUDE * 32767.0);
+        for(int c = 0; c < NUM_CHANNELS; ++c)
+            write_u16(file, (uint16_t)sample);
+    }
+
+    const bool success = !ferror(file);
+    fclose(file);
+    return success;
+}
+
+int main(int argc, char **argv) {
+    if(argc != 2) {
+        fprintf(stderr, "usage: pipewire_audio_test <null_sink_name>\n");
+        return 1;
+    }
+    const char *sink_name = argv[1];
+
+    if(!pipewire_load()) {
+        fprintf(stderr, "pipewire_audio_test: skipped, libpipewire-0.3.so.0 could not be loaded\n");
+        return 77;
+    }
+
+    char monitor_name[256];
+    snprintf(monitor_name, sizeof(monitor_name), "%s.monitor", sink_name);
+
+    bool found_monitor = false;
+    for(const AudioInput &input : pipewire_get_inputs()) {
+        if(input.name == monitor_name)
+            found_monitor = true;
+    }
+    EXPECT(found_monitor, "%s is not listed by pipewire_get_inputs", monitor_name);
+
+    void *device = pipewire_sound_device_new(monitor_name, "pipewire_audio_test", NUM_CHANNELS, PERIOD_FRAME_SIZE, F32);
+    if(!device) {
+        EXPECT(false, "failed to open %s", monitor_name);
+        return 1;
+    }
+
+    char tone_filepath[] = "/tmp/gsr_pipewire_audio_test_XXXXXX.wav";
+    const int tone_fd = mkstemps(tone_filepath, 4);
+    pid_t player_pid = -1;
+    if(tone_fd != -1 && write_tone(tone_filepath)) {
+        const char *target_arg = sink_name;
+        char *player_args[] = { (char*)"pw-play", (char*)"--target", (char*)target_arg, tone_filepath, NULL };
+        if(posix_spawnp(&player_pid, "pw-play", NULL, NULL, player_args, environ) != 0)
+            player_pid = -1;
+    }
+    EXPECT(player_pid != -1, "failed to play the tone with pw-play");
+
+    const double start_time = get_monotonic_seconds();
+    int num_periods = 0;
+    int num_timeouts = 0;
+    double peak = 0.0;
+    while(get_monotonic_seconds() - start_time < RECORD_SECONDS) {
+        const float *samples = (const float*)pipewire_sound_device_read(device);
+        if(!samples) {
+            ++num_timeouts;
+            continue;
+        }
+
+        ++num_periods;
+        for(int i = 0; i < PERIOD_FRAME_SIZE * NUM_CHANNELS; ++i)
+            peak = std::max(peak, (double)fabsf(samples[i]));
+    }
+    pipewire_sound_device_free(device);
+
+    if(player_pid != -1) {
+        kill(player_pid, SIGTERM);
+        waitpid(player_pid, NULL, 0);
+    }
+    if(tone_fd != -1) {
+        close(tone_fd);
+        remove(tone_filepath);
+    }
+
+    const int expected_periods = (int)(RECORD_SECONDS * SAMPLE_RATE / PERIOD_FRAME_SIZE);
+    fprintf(stderr, "  %d periods of %d frames read in %.1f seconds (expected %d), %d read timeouts, peak %.3f\n",
+        num_periods, PERIOD_FRAME_SIZE, RECORD_SECONDS, expected_periods, num_timeouts, peak);
+    /* The stream takes a moment to start */
+    EXPECT(num_periods >= expected_periods * 8 / 10 && num_periods <= expected_periods + 5, "read %d periods, expected %d", num_periods, expected_periods);
+    EXPECT(fabs(peak - TONE_AMPLITUDE) < 0.05, "the peak of the recorded audio is %.3f, expected %.3f", peak, TONE_AMPLITUDE);
+
+    if(num_failed == 0)
+        fprintf(stderr, "pipewire_audio_test: ok\n");
+    else
+        fprintf(stderr, "pipewire_audio_test: %d check(s) failed\n", num_failed);
+    return num_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+#!/bin/sh -e
+
+# Builds and runs the tests. None of the tests need a GPU: the opengl tests use mesa llvmpipe, the vulkan test uses mesa lavapipe (if installed)
+# and the sway smoke test and the xshm benchmark encode with libx264.
+# A test that exits with 77 was skipped (for example if there is no opengl driver at all).
+
+script_dir=$(dirname "$0")
+cd "$script_dir/.."
+
+CC=${CC:-gcc}
+CXX=${CXX:-g++}
+
+opts="-O2 -g -Wall -Wextra -Wshadow $CFLAGS"
+build_dir="tests/build"
+mkdir -p "$build_dir"
+
+# The opengl tests don't need a display server
+export LIBGL_ALWAYS_SOFTWARE=1
+
+num_failed=0
+num_skipped=0
+
+run_test() {
+    name="$1"
+    shift
+    echo "Running $name"
+    set +e
+    "$build_dir/$name" "$@"
+    result=$?
+    set -e
+    count_result "$name" "$result"
+}
+
+count_result() {
+    name="$1"
+    result="$2"
+    if [ "$result" -eq 77 ]; then
+        num_skipped=$((num_skipped + 1))
+    elif [ "$result" -ne 0 ]; then
+        echo "$name failed"
+        num_failed=$((num_failed + 1))
+    fi
+}
+
+# Tests that need libraries that aren't installed are skipped
+has_dependencies() {
+    name="$1"
+    dependencies="$2"
+    if ! pkg-config --exists $dependencies; then
+        echo "Skipping $name, missing one of: $dependencies"
+        num_skipped=$((num_skipped + 1))
+        return 1
+    fi
+    return 0
+}
+
+build_color_conversion_test() {
+    dependencies="x11 xrandr libdrm"
+    includes="$(pkg-config --cflags $dependencies)"
+    libs="$(pkg-config --libs $dependencies) -ldl -lm"
+    $CC -o "$build_dir/color_conversion_test" tests/color_conversion_test.c tests/gl_test_context.c \
+        src/color_conversion.c src/shader.c src/cpu_color_conversion.c src/library_loader.c src/utils.c $opts $includes $libs
+}
+
+build_cpu_color_conversion_test() {
+    $CC -o "$build_dir/cpu_color_conversion_test" tests/cpu_color_conversion_test.c src/cpu_color_conversion.c $opts -lm
+}
+
+# libvulkan is loaded at runtime, like in vulkan.c
+build_vulkan_color_conversion_test() {
+    dependencies="x11 xrandr libdrm"
+    includes="$(pkg-config --cflags $dependencies)"
+    $CC -o "$build_dir/vulkan_color_conversion_test" tests/vulkan_color_conversion_test.c \
+        src/vulkan_color_conversion.c src/vulkan.c src/cpu_color_conversion.c src/library_loader.c $opts $includes -ldl -lm
+}
+
+# Uses mesa lavapipe when it's installed so that the test gives the same result with and without a gpu
+run_vulkan_color_conversion_test() {
+    for icd in /usr/share/vulkan/icd.d/lvp_icd.*.json; do
+        if [ -z "$VK_ICD_FILENAMES" ] && [ -f "$icd" ]; then
+            VK_ICD_FILENAMES="$icd" run_test vulkan_color_conversion_test
+            return
+        fi
+    done
+    run_test vulkan_color_conversion_test
+}
+
+build_frame_queue_test() {
+    dependencies="libavutil"
+    includes="$(pkg-config --cflags $dependencies)"
+    libs="$(pkg-config --libs $dependencies) -lpthread"
+    $CC -o "$build_dir/frame_queue_test" tests/frame_queue_test.c src/frame_queue.c $opts $includes $libs
+}
+
+build_network_output_test() {
+    dependencies="libavformat libavcodec libavutil x11 xrandr libdrm"
+    includes="$(pkg-config --cflags $dependencies)"
+    libs="$(pkg-config --libs $dependencies) -lpthread"
+    $CC -o "$build_dir/network_output_test" tests/network_output_test.c \
+        src/network_output.c src/adaptive_bitrate.c src/utils.c $opts $includes $libs
+}
+
+# libpipewire is loaded at runtime, only the headers are needed (like in build.sh)
+build_pipewire_audio_test() {
+    includes="$(pkg-config --cflags libpipewire-0.3)"
+    $CC -c -o "$build_dir/pipewire_library.o" src/pipewire_library.c $opts $includes
+    $CC -c -o "$build_dir/library_loader.o" src/library_loader.c $opts
+    $CXX -o "$build_dir/pipewire_audio_test" tests/pipewire_audio_test.cpp src/sound_pipewire.cpp \
+        "$build_dir/pipewire_library.o" "$build_dir/library_loader.o" $opts $includes -ldl -pthread -lm
+}
+
+# Starts a pipewire daemon and session manager that only this test uses, with a null sink to record from
+run_pipewire_audio_test() {
+    runtime_dir="$(pwd)/$build_dir/pipewire-runtime"
+    rm -rf "$runtime_dir"
+    mkdir -m 700 -p "$runtime_dir"
+    echo "Running pipewire_audio_test"
+    set +e
+    (
+        export XDG_RUNTIME_DIR="$runtime_dir"
+        export PIPEWIRE_RUNTIME_DIR="$runtime_dir"
+        unset PIPEWIRE_REMOTE DBUS_SESSION_BUS_ADDRESS
+        pipewire > "$build_dir/pipewire.log" 2>&1 &
+        pipewire_pid=$!
+        sleep 1
+        wireplumber > "$build_dir/wireplumber.log" 2>&1 &
+        wireplumber_pid=$!
+        sleep 1
+        pw-cli create-node adapter '{ factory.name=support.null-audio-sink node.name=gsr_test_sink media.class=Audio/Sink audio.position=[ FL FR ] object.linger=true }' > /dev/null
+        sleep 1
+        "$build_dir/pipewire_audio_test" gsr_test_sink
+        result=$?
+        kill "$wireplumber_pid" "$pipewire_pid"
+        wait
+        exit "$result"
+    )
+    result=$?
+    set -e
+    count_result pipewire_audio_test "$result"
+}
+
+# Needs an x11 server and a gpu, so it's only built. See the comment at the top of latency_probe.c
+build_latency_probe() {
+    dependencies="libavformat libavcodec libavutil x11 xrandr libdrm"
+    includes="$(pkg-config --cflags $dependencies)"
+    libs="$(pkg-config --libs $dependencies) -lpthread"
+    $CC -o "$build_dir/latency_probe" tests/latency_probe.c src/utils.c $opts $includes $libs
+}
+
+build_cpu_color_conversion_test
+run_test cpu_color_conversion_test
+
+if has_dependencies color_conversion_test "x11 xrandr libdrm"; then
+    build_color_conversion_test
+    # Don't read or write the shader cache of the user
+    XDG_CACHE_HOME="$(pwd)/$build_dir/cache" run_test color_conversion_test
+fi
+
+if has_dependencies vulkan_color_conversion_test "x11 xrandr libdrm"; then
+    build_vulkan_color_conversion_test
+    run_vulkan_color_conversion_test
+fi
+
+if has_dependencies frame_queue_test "libavutil"; then
+    build_frame_queue_test
+    run_test frame_queue_test
+fi
+
+if has_dependencies network_output_test "libavformat libavcodec libavutil x11 xrandr libdrm"; then
+    build_network_output_test
+    run_test network_output_test
+    build_latency_probe
+fi
+
+if command -v pipewire > /dev/null && command -v wireplumber > /dev/null && command -v pw-cli > /dev/null && command -v pw-play > /dev/null; then
+    if has_dependencies pipewire_audio_test "libpipewire-0.3"; then
+        build_pipewire_audio_test
+        run_pipewire_audio_test
+    fi
+else
+    echo "Skipping pipewire_audio_test, missing one of: pipewire wireplumber pw-cli pw-play"
+    num_skipped=$((num_skipped + 1))
+fi
+
+# Needs gpu-screen-recorder to be built and sway, and skips itself otherwise
+echo "Running sway_smoke_test"
+set +e
+tests/sway_smoke_test.sh
+result=$?
+set -e
+count_result sway_smoke_test "$result"
+
+# Needs gpu-screen-recorder to be built and Xvfb, and skips itself otherwise. Run it directly for a longer benchmark at a higher resolution
+echo "Running xshm_benchmark"
+set +e
+tests/xshm_benchmark.sh 1280x720 30 3
+result=$?
+set -e
+count_result xshm_benchmark "$result"
+
+echo "$num_failed test(s) failed, $num_skipped test(s) skipped"
+[ "$num_failed" -eq 0 ]
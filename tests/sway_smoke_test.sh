@@ -0,0 +1,84 @@
+#!/bin/sh
+
+# Records a headless sway output with -w screencopy -encoder cpu for a few seconds and checks that the shared memory path and the cpu encoding were used
+# and that the recording has frames. sway renders with pixman and gpu-screen-recorder converts the frames on the cpu and encodes them with libx264, so no GPU is needed.
+# This is skipped (exit code 77) when sway isn't installed or when gpu-screen-recorder hasn't been built (./build.sh).
+
+script_dir=$(dirname "$0")
+cd "$script_dir/.."
+
+build_dir="$(pwd)/tests/build"
+duration_seconds=3
+fps=30
+
+if [ ! -x ./gpu-screen-recorder ]; then
+    echo "sway_smoke_test: skipped, build gpu-screen-recorder with ./build.sh first"
+    exit 77
+fi
+
+if ! command -v sway > /dev/null; then
+    echo "sway_smoke_test: skipped, sway is not installed"
+    exit 77
+fi
+
+runtime_dir="$build_dir/sway-runtime"
+rm -rf "$runtime_dir"
+mkdir -m 700 -p "$runtime_dir"
+printf 'output HEADLESS-1 mode 1280x720\n' > "$build_dir/sway_smoke_test.conf"
+
+export XDG_RUNTIME_DIR="$runtime_dir"
+unset DISPLAY WAYLAND_DISPLAY
+WLR_BACKENDS=headless WLR_RENDERER=pixman WLR_LIBINPUT_NO_DEVICES=1 WLR_HEADLESS_OUTPUTS=1 \
+    sway -c "$build_dir/sway_smoke_test.conf" > "$build_dir/sway.log" 2>&1 &
+sway_pid=$!
+
+# Wait for sway to create its wayland socket
+for i in $(seq 50); do
+    wayland_socket=$(ls "$runtime_dir" | grep '^wayland-[0-9]*$' | head -n 1)
+    [ -n "$wayland_socket" ] && break
+    sleep 0.1
+done
+
+if [ -z "$wayland_socket" ]; then
+    echo "sway_smoke_test: sway didn't start, see $build_dir/sway.log"
+    kill "$sway_pid" 2> /dev/null
+    exit 1
+fi
+
+output="$build_dir/sway_smoke_test.mp4"
+rm -f "$output"
+WAYLAND_DISPLAY="$wayland_socket" timeout -s INT "$duration_seconds" \
+    ./gpu-screen-recorder -w screencopy -encoder cpu -c mp4 -f "$fps" -fm cfr -o "$output" > "$build_dir/sway_smoke_test.log" 2>&1
+kill "$sway_pid"
+wait "$sway_pid" 2> /dev/null
+
+num_failed=0
+if ! grep -q "gsr_capture_screencopy: .*shared memory" "$build_dir/sway_smoke_test.log"; then
+    echo "FAIL: the screencopy shared memory path wasn't used, see $build_dir/sway_smoke_test.log"
+    num_failed=$((num_failed + 1))
+fi
+
+if ! grep -q "gsr_capture_screencopy: .*encoding: software" "$build_dir/sway_smoke_test.log"; then
+    echo "FAIL: the frames weren't encoded on the cpu, see $build_dir/sway_smoke_test.log"
+    num_failed=$((num_failed + 1))
+fi
+
+if [ ! -s "$output" ]; then
+    echo "FAIL: nothing was recorded, see $build_dir/sway_smoke_test.log"
+    num_failed=$((num_failed + 1))
+elif command -v ffprobe > /dev/null; then
+    # Constant frame rate, so about |fps| frames per second (minus startup) even though the headless output is static
+    num_frames=$(ffprobe -v error -select_streams v:0 -count_frames -show_entries stream=nb_read_frames -of csv=p=0 "$output")
+    min_frames=$((fps * (duration_seconds - 1)))
+    if [ "${num_frames:-0}" -lt "$min_frames" ]; then
+        echo "FAIL: recorded $num_frames frames, expected at least $min_frames"
+        num_failed=$((num_failed + 1))
+    fi
+fi
+
+if [ "$num_failed" -eq 0 ]; then
+    echo "sway_smoke_test: ok"
+    exit 0
+fi
+echo "sway_smoke_test: $num_failed check(s) failed"
+exit 1
@@ -0,0 +1,565 @@
+/*
+    Tests the vulkan compute color conversion against a double precision reference (bilinear scaling, black outside of the destination region and cursor blending)
+    and against the cpu color conversion when the source isn't scaled.
+    Runs on any vulkan driver with a compute queue, for example mesa lavapipe without a gpu: VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json.
+    Skipped (exit code 77) when there is no vulkan driver. The dma-buf import is tested with /dev/udmabuf when the driver supports VK_EXT_external_memory_dma_buf.
+
+    Run with --bench to measure the speed of a 1920x1080 conversion.
+*/
+
+#define _GNU_SOURCE
+#include "../include/vulkan_color_conversion.h"
+#include "../include/cpu_color_conversion.h"
+#include "../include/color_matrices.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/udmabuf.h>
+
+/* Bytes after each row of the destination planes, they should never be written to */
+#define ROW_PADDING 16
+#define PADDING_VALUE 0xCD
+
+static int num_failed = 0;
+
+#define EXPECT(cond, ...) do {                                  \
+        if(!(cond)) {                                           \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fprintf(stderr, "\n");                              \
+            ++num_failed;                                       \
+        }                                                       \
+    } while(0)
+
+static gsr_vulkan vulkan;
+
+static uint32_t random_state = 0x12345678;
+static uint32_t random_u32(void) {
+    random_state = random_state * 1664525u + 1013904223u;
+    return random_state >> 8;
+}
+
+static const char* destination_color_name(gsr_destination_color destination_color, gsr_color_range color_range) {
+    if(destination_color == GSR_DESTINATION_COLOR_P010)
+        return color_range == GSR_COLOR_RANGE_FULL ? "p010 full" : "p010 limited";
+    else
+        return color_range == GSR_COLOR_RANGE_FULL ? "nv12 full" : "nv12 limited";
+}
+
+/* Random rgba/bgra pixels with |extra_pitch| bytes of padding after each row */
+static bool source_create(gsr_vulkan_source_image *image, gsr_vulkan_buffer *buffer, int width, int height, int extra_pitch, bool bgra) {
+    const int pitch = width * 4 + extra_pitch;
+    if(!gsr_vulkan_buffer_create(&vulkan, buffer, (uint64_t)pitch * height))
+        return false;
+
+    uint8_t *data = buffer->mapped;
+    for(int i = 0; i < pitch * height; ++i) {
+        data[i] = random_u32() & 0xFF;
+    }
+
+    *image = (gsr_vulkan_source_image){
+        .buffer = buffer,
+        .offset = 0,
+        .pitch = pitch,
+        .size = { width, height },
+        .bgra = bgra
+    };
+    return true;
+}
+
+static int destination_row_size(int width, bool ten_bit) {
+    return ((width + 3) / 4) * 4 * (ten_bit ? 2 : 1);
+}
+
+/* Both planes in one buffer, like a vaapi surface exported as a dma-buf */
+static void destination_layout(gsr_vulkan_destination_image *image, int width, int height, bool ten_bit) {
+    const int pitch = destination_row_size(width, ten_bit) + ROW_PADDING;
+    image->y_offset = 0;
+    image->y_pitch = pitch;
+    image->uv_offset = pitch * height;
+    image->uv_pitch = pitch;
+    image->size = (vec2i){ width, height };
+}
+
+static uint64_t destination_size(const gsr_vulkan_destination_image *image) {
+    return (uint64_t)image->uv_offset + (uint64_t)image->uv_pitch * (image->size.y / 2);
+}
+
+static bool destination_create(gsr_vulkan_destination_image *image, gsr_vulkan_buffer *buffer, int width, int height, bool ten_bit) {
+    destination_layout(image, width, height, ten_bit);
+    if(!gsr_vulkan_buffer_create(&vulkan, buffer, destination_size(image)))
+        return false;
+    memset(buffer->mapped, PADDING_VALUE, buffer->size);
+    image->buffer = buffer;
+    return true;
+}
+
+static int read_sample(const uint8_t *data, int offset, int pitch, int x, int y, bool ten_bit) {
+    const uint8_t *row = data + offset + (size_t)y * pitch;
+    if(ten_bit)
+        return ((const uint16_t*)row)[x] >> 6;
+    else
+        return row[x];
+}
+
+static bool padding_is_untouched(const uint8_t *data, const gsr_vulkan_destination_image *image, bool ten_bit) {
+    const int row_size = destination_row_size(image->size.x, ten_bit);
+    for(int y = 0; y < image->size.y; ++y) {
+        for(int x = row_size; x < image->y_pitch; ++x) {
+            if(data[image->y_offset + (size_t)y * image->y_pitch + x] != PADDING_VALUE)
+                return false;
+        }
+    }
+    for(int y = 0; y < image->size.y / 2; ++y) {
+        for(int x = row_size; x < image->uv_pitch; ++x) {
+            if(data[image->uv_offset + (size_t)y * image->uv_pitch + x] != PADDING_VALUE)
+                return false;
+        }
+    }
+    return true;
+}
+
+static void image_pixel(const gsr_vulkan_source_image *image, int x, int y, double *rgba) {
+    const uint8_t *pixel = (const uint8_t*)image->buffer->mapped + image->offset + (size_t)y * image->pitch + (size_t)x * 4;
+    rgba[0] = pixel[image->bgra ? 2 : 0] / 255.0;
+    rgba[1] = pixel[1] / 255.0;
+    rgba[2] = pixel[image->bgra ? 0 : 2] / 255.0;
+    rgba[3] = pixel[3] / 255.0;
+}
+
+static int clamp_int(int value, int min, int max) {
+    return value < min ? min : (value > max ? max : value);
+}
+
+/* What the shader should output for pixel |x|, |y| of the frame, in double precision */
+static void reference_pixel(const gsr_vulkan_color_conversion_layer *layer, int x, int y, double *rgb) {
+    const double pos_x = (x - layer->destination_pos.x + 0.5) * layer->source_size.x / layer->destination_size.x - 0.5;
+    const double pos_y = (y - layer->destination_pos.y + 0.5) * layer->source_size.y / layer->destination_size.y - 0.5;
+    const double fraction_x = pos_x - floor(pos_x);
+    const double fraction_y = pos_y - floor(pos_y);
+    const int texel_x = (int)floor(pos_x) + layer->source_pos.x;
+    const int texel_y = (int)floor(pos_y) + layer->source_pos.y;
+
+    double texels[4][4];
+    for(int i = 0; i < 4; ++i) {
+        const int tx = clamp_int(texel_x + (i & 1), 0, layer->source.size.x - 1);
+        const int ty = clamp_int(texel_y + (i >> 1), 0, layer->source.size.y - 1);
+        image_pixel(&layer->source, tx, ty, texels[i]);
+    }
+
+    const bool inside = x >= layer->destination_pos.x && y >= layer->destination_pos.y
+        && x < layer->destination_pos.x + layer->destination_size.x && y < layer->destination_pos.y + layer->destination_size.y;
+    for(int c = 0; c < 3; ++c) {
+        const double top = texels[0][c] + (texels[1][c] - texels[0][c]) * fraction_x;
+        const double bottom = texels[2][c] + (texels[3][c] - texels[2][c]) * fraction_x;
+        rgb[c] = inside ? top + (bottom - top) * fraction_y : 0.0;
+    }
+
+    if(layer->cursor.buffer) {
+        const int cx = x - layer->cursor_pos.x;
+        const int cy = y - layer->cursor_pos.y;
+        if(cx >= 0 && cy >= 0 && cx < layer->cursor.size.x && cy < layer->cursor.size.y) {
+            double cursor[4];
+            image_pixel(&layer->cursor, cx, cy, cursor);
+            for(int c = 0; c < 3; ++c) {
+                rgb[c] += (cursor[c] - rgb[c]) * cursor[3];
+            }
+        }
+    }
+}
+
+static double to_sample(const gsr_color_matrix *m, int component, const double *rgb, double max_value) {
+    const double value = m->r[component] * rgb[0] + m->g[component] * rgb[1] + m->b[component] * rgb[2] + m->offset[component];
+    return fmin(fmax(value, 0.0), 1.0) * max_value;
+}
+
+/* Returns the largest difference between |data| (the destination) and the reference */
+static double max_error_from_reference(const gsr_vulkan_color_conversion_layer *layer, const gsr_vulkan_destination_image *destination, const uint8_t *data, gsr_destination_color destination_color, gsr_color_range color_range) {
+    const gsr_color_matrix *m = gsr_color_matrix_get(destination_color, color_range);
+    const bool ten_bit = destination_color == GSR_DESTINATION_COLOR_P010;
+    const double max_value = ten_bit ? 1023.0 : 255.0;
+    double max_error = 0.0;
+
+    for(int y = 0; y < destination->size.y; y += 2) {
+        for(int x = 0; x < destination->size.x; x += 2) {
+            double average[3] = { 0.0, 0.0, 0.0 };
+            for(int i = 0; i < 4; ++i) {
+                const int px = x + (i & 1);
+                const int py = y + (i >> 1);
+                double rgb[3];
+                reference_pixel(layer, px, py, rgb);
+                for(int c = 0; c < 3; ++c) {
+                    average[c] += rgb[c] * 0.25;
+                }
+
+                const double error = fabs(read_sample(data, destination->y_offset, destination->y_pitch, px, py, ten_bit) - to_sample(m, 0, rgb, max_value));
+                if(error > max_error)
+                    max_error = error;
+            }
+
+            for(int i = 1; i < 3; ++i) {
+                const double error = fabs(read_sample(data, destination->uv_offset, destination->uv_pitch, x + (i - 1), y / 2, ten_bit) - to_sample(m, i, average, max_value));
+                if(error > max_error)
+                    max_error = error;
+            }
+        }
+    }
+
+    return max_error;
+}
+
+/* Rounding is 0.5, the rest is for the single precision floats in the shader */
+#define MAX_ERROR 0.55
+
+static gsr_vulkan_color_conversion_layer full_layer(const gsr_vulkan_source_image *source, int width, int height) {
+    return (gsr_vulkan_color_conversion_layer){
+        .source = *source,
+        .source_pos = { 0, 0 },
+        .source_size = { width, height },
+        .destination_pos = { 0, 0 },
+        .destination_size = { width, height }
+    };
+}
+
+/* Not scaled, so the result should be the same as the cpu color conversion (within rounding) */
+static void test_same_as_cpu(gsr_vulkan_color_conversion *color_conversion, int width, int height, bool bgra, gsr_destination_color destination_color, gsr_color_range color_range) {
+    const bool ten_bit = destination_color == GSR_DESTINATION_COLOR_P010;
+    const char *name = destination_color_name(destination_color, color_range);
+
+    gsr_vulkan_buffer source_buffer;
+    gsr_vulkan_buffer destination_buffer;
+    gsr_vulkan_source_image source;
+    gsr_vulkan_destination_image destination;
+    if(!source_create(&source, &source_buffer, width, height, 12, bgra) || !destination_create(&destination, &destination_buffer, width, height, ten_bit)) {
+        EXPECT(false, "%s %dx%d: failed to create the buffers", name, width, height);
+        return;
+    }
+
+    const gsr_vulkan_color_conversion_layer layer = full_layer(&source, width, height);
+    EXPECT(gsr_vulkan_color_conversion_convert(color_conversion, &layer, &destination) == 0, "%s %dx%d: conversion failed", name, width, height);
+
+    const uint8_t *data = destination_buffer.mapped;
+    const double error = max_error_from_reference(&layer, &destination, data, destination_color, color_range);
+    EXPECT(error <= MAX_ERROR, "%s %dx%d %s: max error from the reference is %f", name, width, height, bgra ? "bgra" : "rgba", error);
+    EXPECT(padding_is_untouched(data, &destination, ten_bit), "%s %dx%d: wrote outside of the planes", name, width, height);
+
+    const int bytes_per_sample = ten_bit ? 2 : 1;
+    const int cpu_y_stride = width * bytes_per_sample;
+    uint8_t *cpu_y = malloc((size_t)cpu_y_stride * height);
+    uint8_t *cpu_uv = malloc((size_t)cpu_y_stride * (height / 2));
+    const gsr_cpu_source_image cpu_source = { source_buffer.mapped, source.pitch, width, height, bgra ? GSR_CPU_SOURCE_FORMAT_BGRA : GSR_CPU_SOURCE_FORMAT_RGBA };
+    const gsr_cpu_destination_image cpu_destination = { cpu_y, cpu_y_stride, cpu_uv, cpu_y_stride };
+    EXPECT(gsr_cpu_color_conversion_convert(&cpu_source, &cpu_destination, destination_color, color_range) == 0, "%s %dx%d: cpu conversion failed", name, width, height);
+
+    int max_difference = 0;
+    for(int y = 0; y < height; ++y) {
+        for(int x = 0; x < width; ++x) {
+            const int difference = abs(read_sample(data, destination.y_offset, destination.y_pitch, x, y, ten_bit) - read_sample(cpu_y, 0, cpu_y_stride, x, y, ten_bit));
+            if(difference > max_difference)
+                max_difference = difference;
+            if(y % 2 == 0) {
+                const int uv_difference = abs(read_sample(data, destination.uv_offset, destination.uv_pitch, x, y / 2, ten_bit) - read_sample(cpu_uv, 0, cpu_y_stride, x, y / 2, ten_bit));
+                if(uv_difference > max_difference)
+                    max_difference = uv_difference;
+            }
+        }
+    }
+    EXPECT(max_difference <= 1, "%s %dx%d %s: max difference to the cpu color conversion is %d", name, width, height, bgra ? "bgra" : "rgba", max_difference);
+
+    free(cpu_y);
+    free(cpu_uv);
+    gsr_vulkan_buffer_destroy(&vulkan, &source_buffer);
+    gsr_vulkan_buffer_destroy(&vulkan, &destination_buffer);
+}
+
+/* A region of the source scaled into a region of the frame, with cursors that are partially outside of the frame */
+static void test_scaled_with_cursor(gsr_vulkan_color_conversion *color_conversion, vec2i source_pos, vec2i source_size, vec2i destination_pos, vec2i destination_size, gsr_destination_color destination_color, gsr_color_range color_range) {
+    const bool ten_bit = destination_color == GSR_DESTINATION_COLOR_P010;
+    const char *name = destination_color_name(destination_color, color_range);
+    const int frame_width = 64;
+    const int frame_height = 48;
+
+    gsr_vulkan_buffer source_buffer;
+    gsr_vulkan_buffer cursor_buffer;
+    gsr_vulkan_buffer destination_buffer;
+    gsr_vulkan_source_image source;
+    gsr_vulkan_source_image cursor;
+    gsr_vulkan_destination_image destination;
+    if(!source_create(&source, &source_buffer, 40, 30, 0, true) || !source_create(&cursor, &cursor_buffer, 9, 7, 4, false) || !destination_create(&destination, &destination_buffer, frame_width, frame_height, ten_bit)) {
+        EXPECT(false, "%s: failed to create the buffers", name);
+        return;
+    }
+
+    /* Fully transparent and fully opaque cursor pixels */
+    uint8_t *cursor_data = cursor_buffer.mapped;
+    cursor_data[3] = 0;
+    cursor_data[7] = 255;
+
+    const vec2i cursor_positions[] = { { -3, 10 }, { frame_width - 5, frame_height - 3 }, { 20, 20 } };
+    for(size_t i = 0; i < sizeof(cursor_positions) / sizeof(cursor_positions[0]); ++i) {
+        const gsr_vulkan_color_conversion_layer layer = {
+            .source = source,
+            .source_pos = source_pos,
+            .source_size = source_size,
+            .destination_pos = destination_pos,
+            .destination_size = destination_size,
+            .cursor = cursor,
+            .cursor_pos = cursor_positions[i]
+        };
+
+        memset(destination_buffer.mapped, PADDING_VALUE, destination_buffer.size);
+        EXPECT(gsr_vulkan_color_conversion_convert(color_conversion, &layer, &destination) == 0, "%s: conversion failed", name);
+        const double error = max_error_from_reference(&layer, &destination, destination_buffer.mapped, destination_color, color_range);
+        EXPECT(error <= MAX_ERROR, "%s: source %d,%d %dx%d, destination %d,%d %dx%d, cursor %d,%d: max error from the reference is %f", name,
+            source_pos.x, source_pos.y, source_size.x, source_size.y, destination_pos.x, destination_pos.y, destination_size.x, destination_size.y, cursor_positions[i].x, cursor_positions[i].y, error);
+        EXPECT(padding_is_untouched(destination_buffer.mapped, &destination, ten_bit), "%s: wrote outside of the planes", name);
+    }
+
+    gsr_vulkan_buffer_destroy(&vulkan, &source_buffer);
+    gsr_vulkan_buffer_destroy(&vulkan, &cursor_buffer);
+    gsr_vulkan_buffer_destroy(&vulkan, &destination_buffer);
+}
+
+static void test_invalid_images(gsr_vulkan_color_conversion *color_conversion) {
+    gsr_vulkan_buffer source_buffer;
+    gsr_vulkan_buffer destination_buffer;
+    gsr_vulkan_source_image source;
+    gsr_vulkan_destination_image destination;
+    if(!source_create(&source, &source_buffer, 8, 8, 0, false) || !destination_create(&destination, &destination_buffer, 8, 8, false)) {
+        EXPECT(false, "failed to create the buffers");
+        return;
+    }
+
+    gsr_vulkan_color_conversion_layer layer = full_layer(&source, 8, 8);
+    gsr_vulkan_destination_image odd_destination = destination;
+    odd_destination.size.y = 7;
+    EXPECT(gsr_vulkan_color_conversion_convert(color_conversion, &layer, &odd_destination) != 0, "an odd destination size was accepted");
+
+    gsr_vulkan_destination_image small_destination = destination;
+    small_destination.uv_offset += 4;
+    EXPECT(gsr_vulkan_color_conversion_convert(color_conversion, &layer, &small_destination) != 0, "a destination larger than its buffer was accepted");
+
+    layer.source.offset = 2;
+    EXPECT(gsr_vulkan_color_conversion_convert(color_conversion, &layer, &destination) != 0, "an unaligned source offset was accepted");
+
+    layer.source.offset = 4;
+    EXPECT(gsr_vulkan_color_conversion_convert(color_conversion, &layer, &destination) != 0, "a source larger than its buffer was accepted");
+
+    gsr_vulkan_buffer_destroy(&vulkan, &source_buffer);
+    gsr_vulkan_buffer_destroy(&vulkan, &destination_buffer);
+}
+
+/* A dma-buf backed by a memfd (so that we can write and read it with mmap). Returns -1 if udmabuf isn't available */
+static int create_udmabuf(size_t size, int *memfd, void **mapped) {
+    const int udmabuf_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if(udmabuf_fd == -1)
+        return -1;
+
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size = (size + page_size - 1) / page_size * page_size;
+    *memfd = memfd_create("gsr-vulkan-test", MFD_ALLOW_SEALING | MFD_CLOEXEC);
+    if(*memfd == -1 || ftruncate(*memfd, size) != 0 || fcntl(*memfd, F_ADD_SEALS, F_SEAL_SHRINK) != 0) {
+        close(udmabuf_fd);
+        return -1;
+    }
+
+    struct udmabuf_create create = {
+        .memfd = *memfd,
+        .flags = UDMABUF_FLAGS_CLOEXEC,
+        .offset = 0,
+        .size = size
+    };
+    const int dma_buf_fd = ioctl(udmabuf_fd, UDMABUF_CREATE, &create);
+    close(udmabuf_fd);
+    if(dma_buf_fd < 0)
+        return -1;
+
+    *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *memfd, 0);
+    if(*mapped == MAP_FAILED) {
+        close(dma_buf_fd);
+        return -1;
+    }
+    return dma_buf_fd;
+}
+
+/* Imports the source and destination as dma-bufs, the way the captures would use this. The result has to be the same as with host memory */
+static void test_dma_buf(gsr_vulkan_color_conversion *color_conversion) {
+    enum { WIDTH = 64, HEIGHT = 32 };
+    if(!vulkan.dma_buf_import_supported) {
+        fprintf(stderr, "  dma-buf import: skipped, the vulkan device doesn't support VK_EXT_external_memory_dma_buf\n");
+        return;
+    }
+
+    gsr_vulkan_buffer host_source_buffer;
+    gsr_vulkan_buffer host_destination_buffer;
+    gsr_vulkan_source_image host_source;
+    gsr_vulkan_destination_image host_destination;
+    if(!source_create(&host_source, &host_source_buffer, WIDTH, HEIGHT, 0, true) || !destination_create(&host_destination, &host_destination_buffer, WIDTH, HEIGHT, false)) {
+        EXPECT(false, "dma-buf: failed to create the buffers");
+        return;
+    }
+
+    const size_t source_size = (size_t)WIDTH * HEIGHT * 4;
+    int source_memfd = -1;
+    int destination_memfd = -1;
+    void *source_data = NULL;
+    void *destination_data = NULL;
+    const int source_fd = create_udmabuf(source_size, &source_memfd, &source_data);
+    const int destination_fd = source_fd != -1 ? create_udmabuf(host_destination_buffer.size, &destination_memfd, &destination_data) : -1;
+    if(source_fd == -1 || destination_fd == -1) {
+        fprintf(stderr, "  dma-buf import: skipped, failed to create a dma-buf with /dev/udmabuf\n");
+    } else {
+        memcpy(source_data, host_source_buffer.mapped, source_size);
+        memset(destination_data, PADDING_VALUE, host_destination_buffer.size);
+
+        gsr_vulkan_buffer source_buffer;
+        gsr_vulkan_buffer destination_buffer;
+        const bool source_imported = gsr_vulkan_buffer_import_dma_buf(&vulkan, &source_buffer, source_fd, source_size);
+        const bool destination_imported = gsr_vulkan_buffer_import_dma_buf(&vulkan, &destination_buffer, destination_fd, host_destination_buffer.size);
+        EXPECT(source_imported && destination_imported, "dma-buf: import failed");
+
+        if(source_imported && destination_imported) {
+            gsr_vulkan_color_conversion_layer layer = full_layer(&host_source, WIDTH, HEIGHT);
+            EXPECT(gsr_vulkan_color_conversion_convert(color_conversion, &layer, &host_destination) == 0, "dma-buf: conversion of host memory failed");
+
+            layer.source.buffer = &source_buffer;
+            gsr_vulkan_destination_image destination = host_destination;
+            destination.buffer = &destination_buffer;
+            EXPECT(gsr_vulkan_color_conversion_convert(color_conversion, &layer, &destination) == 0, "dma-buf: conversion failed");
+            EXPECT(memcmp(destination_data, host_destination_buffer.mapped, host_destination_buffer.size) == 0, "dma-buf: the result is different from the conversion of host memory");
+            fprintf(stderr, "  dma-buf import: tested\n");
+        }
+
+        if(source_imported)
+            gsr_vulkan_buffer_destroy(&vulkan, &source_buffer);
+        if(destination_imported)
+            gsr_vulkan_buffer_destroy(&vulkan, &destination_buffer);
+    }
+
+    if(source_fd != -1)
+        close(source_fd);
+    if(destination_fd != -1)
+        close(destination_fd);
+    if(source_memfd != -1)
+        close(source_memfd);
+    if(destination_memfd != -1)
+        close(destination_memfd);
+    /* The mappings are freed when the process exits */
+
+    gsr_vulkan_buffer_destroy(&vulkan, &host_source_buffer);
+    gsr_vulkan_buffer_destroy(&vulkan, &host_destination_buffer);
+}
+
+static double clock_get_monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
+}
+
+static void benchmark(void) {
+    enum { WIDTH = 1920, HEIGHT = 1080 };
+    const gsr_destination_color destination_colors[] = { GSR_DESTINATION_COLOR_NV12, GSR_DESTINATION_COLOR_P010 };
+
+    for(int c = 0; c < 2; ++c) {
+        const gsr_destination_color destination_color = destination_colors[c];
+        const gsr_vulkan_color_conversion_params params = { &vulkan, destination_color, GSR_COLOR_RANGE_LIMITED };
+        gsr_vulkan_color_conversion color_conversion;
+        if(gsr_vulkan_color_conversion_init(&color_conversion, &params) != 0)
+            continue;
+
+        gsr_vulkan_buffer source_buffer;
+        gsr_vulkan_buffer destination_buffer;
+        gsr_vulkan_source_image source;
+        gsr_vulkan_destination_image destination;
+        if(source_create(&source, &source_buffer, WIDTH, HEIGHT, 0, true) && destination_create(&destination, &destination_buffer, WIDTH, HEIGHT, destination_color == GSR_DESTINATION_COLOR_P010)) {
+            const gsr_vulkan_color_conversion_layer layers[2] = {
+                full_layer(&source, WIDTH, HEIGHT),
+                { .source = source, .source_pos = { 0, 0 }, .source_size = { WIDTH, HEIGHT }, .destination_pos = { 0, 0 }, .destination_size = { WIDTH * 2 / 3, HEIGHT * 2 / 3 } }
+            };
+            const char *layer_names[2] = { "1:1", "scaled" };
+
+            for(int i = 0; i < 2; ++i) {
+                /* Warm up */
+                gsr_vulkan_color_conversion_convert(&color_conversion, &layers[i], &destination);
+
+                int num_frames = 0;
+                const double start = clock_get_monotonic_seconds();
+                double elapsed = 0.0;
+                while(elapsed < 1.0) {
+                    gsr_vulkan_color_conversion_convert(&color_conversion, &layers[i], &destination);
+                    ++num_frames;
+                    elapsed = clock_get_monotonic_seconds() - start;
+                }
+
+                fprintf(stderr, "%dx%d bgra -> %s, %-6s: %.3f ms/frame\n", WIDTH, HEIGHT, destination_color == GSR_DESTINATION_COLOR_P010 ? "p010" : "nv12",
+                    layer_names[i], elapsed * 1000.0 / num_frames);
+            }
+
+            gsr_vulkan_buffer_destroy(&vulkan, &source_buffer);
+            gsr_vulkan_buffer_destroy(&vulkan, &destination_buffer);
+        }
+
+        gsr_vulkan_color_conversion_deinit(&color_conversion);
+    }
+}
+
+int main(int argc, char **argv) {
+    if(!gsr_vulkan_load(&vulkan)) {
+        fprintf(stderr, "vulkan_color_conversion_test: skipped, no vulkan driver with a compute queue\n");
+        return 77;
+    }
+
+    if(argc == 2 && strcmp(argv[1], "--bench") == 0) {
+        benchmark();
+        gsr_vulkan_unload(&vulkan);
+        return 0;
+    }
+
+    const gsr_destination_color destination_colors[] = { GSR_DESTINATION_COLOR_NV12, GSR_DESTINATION_COLOR_P010 };
+    const gsr_color_range color_ranges[] = { GSR_COLOR_RANGE_LIMITED, GSR_COLOR_RANGE_FULL };
+
+    for(int c = 0; c < 2; ++c) {
+        for(int r = 0; r < 2; ++r) {
+            const gsr_vulkan_color_conversion_params params = { &vulkan, destination_colors[c], color_ranges[r] };
+            gsr_vulkan_color_conversion color_conversion;
+            if(gsr_vulkan_color_conversion_init(&color_conversion, &params) != 0) {
+                EXPECT(false, "%s: gsr_vulkan_color_conversion_init failed", destination_color_name(destination_colors[c], color_ranges[r]));
+                continue;
+            }
+
+            /* Widths that are and aren't a multiple of the 4 pixels that each invocation writes, and sizes that aren't a multiple of the workgroup size */
+            const vec2i sizes[] = { { 2, 2 }, { 6, 4 }, { 64, 48 }, { 70, 46 } };
+            for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+                test_same_as_cpu(&color_conversion, sizes[i].x, sizes[i].y, false, destination_colors[c], color_ranges[r]);
+                test_same_as_cpu(&color_conversion, sizes[i].x, sizes[i].y, true, destination_colors[c], color_ranges[r]);
+            }
+
+            /* Upscaled from a region of the source, downscaled, and a region that is partially outside of the frame */
+            test_scaled_with_cursor(&color_conversion, (vec2i){ 3, 5 }, (vec2i){ 30, 20 }, (vec2i){ 6, 4 }, (vec2i){ 50, 36 }, destination_colors[c], color_ranges[r]);
+            test_scaled_with_cursor(&color_conversion, (vec2i){ 0, 0 }, (vec2i){ 40, 30 }, (vec2i){ 10, 10 }, (vec2i){ 17, 13 }, destination_colors[c], color_ranges[r]);
+            test_scaled_with_cursor(&color_conversion, (vec2i){ 0, 0 }, (vec2i){ 40, 30 }, (vec2i){ -8, 30 }, (vec2i){ 40, 30 }, destination_colors[c], color_ranges[r]);
+
+            if(c == 0 && r == 0) {
+                test_invalid_images(&color_conversion);
+                test_dma_buf(&color_conversion);
+            }
+
+            gsr_vulkan_color_conversion_deinit(&color_conversion);
+        }
+    }
+
+    gsr_vulkan_unload(&vulkan);
+
+    if(num_failed == 0) {
+        fprintf(stderr, "vulkan_color_conversion_test: ok\n");
+        return 0;
+    }
+    fprintf(stderr, "vulkan_color_conversion_test: %d check(s) failed\n", num_failed);
+    return 1;
+}
@@ -0,0 +1,114 @@
+#!/bin/sh
+
+# Records an Xvfb screen with -w xshm -encoder cpu (libx264) for a few seconds, checks that the recording has frames and prints
+# how fast the pipeline is: the capture fps, the capture to encoded packet latency and the cpu usage of gpu-screen-recorder.
+# Nothing in the pipeline uses a GPU, so this runs on CI machines without one.
+# Skipped (exit code 77) when gpu-screen-recorder hasn't been built (./build.sh) or when Xvfb is not installed.
+# Usage: xshm_benchmark.sh [WxH] [fps] [duration_seconds]
+
+script_dir=$(dirname "$0")
+cd "$script_dir/.."
+
+build_dir="$(pwd)/tests/build"
+screen_size=${1:-1920x1080}
+fps=${2:-60}
+duration_seconds=${3:-5}
+display=:97
+
+if [ ! -x ./gpu-screen-recorder ]; then
+    echo "xshm_benchmark: skipped, build gpu-screen-recorder with ./build.sh first"
+    exit 77
+fi
+
+if ! command -v Xvfb > /dev/null; then
+    echo "xshm_benchmark: skipped, Xvfb is not installed"
+    exit 77
+fi
+
+mkdir -p "$build_dir"
+Xvfb "$display" -screen 0 "${screen_size}x24" -nolisten tcp > "$build_dir/xvfb.log" 2>&1 &
+xvfb_pid=$!
+
+# Wait for Xvfb to create its socket
+for i in $(seq 50); do
+    [ -S "/tmp/.X11-unix/X${display#:}" ] && break
+    sleep 0.1
+done
+
+if [ ! -S "/tmp/.X11-unix/X${display#:}" ]; then
+    echo "xshm_benchmark: Xvfb didn't start, see $build_dir/xvfb.log"
+    kill "$xvfb_pid" 2> /dev/null
+    exit 1
+fi
+
+# Changes the whole screen every frame so that every frame is copied, converted and encoded (the worst case for xshm)
+damage_pid=
+if command -v xsetroot > /dev/null; then
+    (
+        while true; do
+            DISPLAY="$display" xsetroot -solid red
+            DISPLAY="$display" xsetroot -solid blue
+        done
+    ) > /dev/null 2>&1 &
+    damage_pid=$!
+else
+    echo "xshm_benchmark: xsetroot is not installed, recording a static screen"
+fi
+
+output="$build_dir/xshm_benchmark.mp4"
+log="$build_dir/xshm_benchmark.log"
+rm -f "$output"
+DISPLAY="$display" ./gpu-screen-recorder -w xshm -encoder cpu -c mp4 -f "$fps" -fm cfr -latency low -v yes -o "$output" > "$log" 2>&1 &
+recorder_pid=$!
+sleep "$duration_seconds"
+
+# utime + stime of the recorder, in clock ticks
+cpu_ticks=$(awk '{ print $14 + $15 }' "/proc/$recorder_pid/stat" 2> /dev/null)
+kill -INT "$recorder_pid"
+wait "$recorder_pid"
+[ -n "$damage_pid" ] && kill "$damage_pid"
+kill "$xvfb_pid"
+wait "$xvfb_pid" 2> /dev/null
+
+# The first second is skipped since it includes starting up
+awk -v fps="$fps" '
+    /^update fps:/ { if(++num_seconds > 1) { fps_sum += $3; ++num_fps } }
+    /^latency: capture to packet:/ { if(num_seconds > 1) { latency_sum += $5; ++num_latency } }
+    END {
+        if(num_fps > 0)
+            printf("xshm_benchmark: %.1f fps (target %d)", fps_sum / num_fps, fps)
+        if(num_latency > 0)
+            printf(", capture to packet: %.2f ms", latency_sum / num_latency)
+        printf("\n")
+    }' "$log"
+
+if [ -n "$cpu_ticks" ]; then
+    awk -v ticks="$cpu_ticks" -v ticks_per_second="$(getconf CLK_TCK)" -v seconds="$duration_seconds" \
+        'BEGIN { printf("xshm_benchmark: cpu usage: %.0f%% of one core\n", ticks / ticks_per_second / seconds * 100.0) }'
+fi
+
+num_failed=0
+if ! grep -q "gsr_capture_xshm: .*encoding: software" "$log"; then
+    echo "FAIL: the xshm capture didn't start with software encoding, see $log"
+    num_failed=$((num_failed + 1))
+fi
+
+if [ ! -s "$output" ]; then
+    echo "FAIL: nothing was recorded, see $log"
+    num_failed=$((num_failed + 1))
+elif command -v ffprobe > /dev/null; then
+    # Constant frame rate, so there are frames even if the pipeline is too slow for |fps|
+    num_frames=$(ffprobe -v error -select_streams v:0 -count_frames -show_entries stream=nb_read_frames -of csv=p=0 "$output")
+    min_frames=$((fps * (duration_seconds - 1)))
+    if [ "${num_frames:-0}" -lt "$min_frames" ]; then
+        echo "FAIL: recorded $num_frames frames, expected at least $min_frames"
+        num_failed=$((num_failed + 1))
+    fi
+fi
+
+if [ "$num_failed" -eq 0 ]; then
+    echo "xshm_benchmark: ok"
+    exit 0
+fi
+echo "xshm_benchmark: $num_failed check(s) failed"
+exit 1